@@ -0,0 +1,119 @@
+#include "AccelerationStructureTracker.h"
+
+// Default compaction budget per update
+#define ACCELERATION_STRUCTURE_COMPACTION_BUDGET (32ull * 1024 * 1024)
+
+// Smallest saving worth the copy
+#define ACCELERATION_STRUCTURE_MIN_COMPACTION_SAVINGS (4ull * 1024)
+
+AccelerationStructureTracker::AccelerationStructureTracker() :
+	backend(0),
+	compactionBudget(ACCELERATION_STRUCTURE_COMPACTION_BUDGET),
+	blasScratchBytes(0),
+	tlasBytes(0),
+	tlasScratchBytes(0),
+	lastCompactedBytes(0)
+{
+}
+
+void AccelerationStructureTracker::Initialize(BLASCompactionBackend* backend)
+{
+	this->backend = backend;
+}
+
+void AccelerationStructureTracker::AddBLAS(unsigned int blas, uint64_t buildSize, uint64_t scratchSize)
+{
+	if (blas >= blases.size())
+		blases.resize(blas + 1, BLASMemoryInfo{});
+
+	BLASMemoryInfo& info = blases[blas];
+	info.State = BLAS_STATE_BUILDING;
+	info.BuildSize = buildSize;
+	info.CompactedSize = 0;
+	info.Size = buildSize;
+	info.ScratchSize = scratchSize;
+}
+
+void AccelerationStructureTracker::SetBuildComplete(unsigned int blas)
+{
+	if (blas >= blases.size() || blases[blas].State != BLAS_STATE_BUILDING)
+		return;
+
+	blases[blas].State = BLAS_STATE_BUILT;
+	built.push_back(blas);
+}
+
+
+// --------------------------------------------------------
+// Reads back compacted sizes in the order builds finished,
+// compacting until the budget is used up.  BLASes that
+// aren't worth compacting don't count against it.
+// --------------------------------------------------------
+void AccelerationStructureTracker::Update()
+{
+	lastCompactedBytes = 0;
+	while (!built.empty())
+	{
+		BLASMemoryInfo& info = blases[built.front()];
+		if (lastCompactedBytes > 0 && lastCompactedBytes + info.BuildSize > compactionBudget)
+			break;
+
+		unsigned int blas = built.front();
+		built.pop_front();
+
+		info.CompactedSize = backend->ReadCompactedSize(blas);
+		if (!ShouldCompact(info.BuildSize, info.CompactedSize))
+		{
+			info.State = BLAS_STATE_NOT_COMPACTED;
+			continue;
+		}
+
+		backend->CompactBLAS(blas, info.CompactedSize);
+		info.State = BLAS_STATE_COMPACTED;
+		info.Size = info.CompactedSize;
+		lastCompactedBytes += info.BuildSize;
+	}
+}
+
+void AccelerationStructureTracker::SetTLASSize(uint64_t tlasBytes, uint64_t scratchBytes)
+{
+	this->tlasBytes = tlasBytes;
+	tlasScratchBytes = scratchBytes;
+}
+
+BLASMemoryInfo AccelerationStructureTracker::GetBLASInfo(unsigned int blas) const
+{
+	return blas < blases.size() ? blases[blas] : BLASMemoryInfo{};
+}
+
+AccelerationStructureMemoryStats AccelerationStructureTracker::GetStats() const
+{
+	AccelerationStructureMemoryStats stats = {};
+	for (const BLASMemoryInfo& info : blases)
+	{
+		if (info.State == BLAS_STATE_NONE)
+			continue;
+
+		stats.BLASCount++;
+		stats.BLASBytes += info.Size;
+		stats.BLASBuildBytes += info.BuildSize;
+		if (info.State == BLAS_STATE_COMPACTED)
+			stats.Compacted++;
+		if (info.State == BLAS_STATE_BUILDING || info.State == BLAS_STATE_BUILT)
+			stats.AwaitingCompaction++;
+	}
+	stats.TLASBytes = tlasBytes;
+	stats.ScratchBytes = tlasScratchBytes + blasScratchBytes;
+	stats.TotalBytes = stats.BLASBytes + stats.TLASBytes + stats.ScratchBytes;
+	stats.LastCompactedBytes = lastCompactedBytes;
+	return stats;
+}
+
+bool AccelerationStructureTracker::ShouldCompact(uint64_t buildSize, uint64_t compactedSize)
+{
+	if (compactedSize == 0 || compactedSize >= buildSize)
+		return false;
+
+	uint64_t savings = buildSize - compactedSize;
+	return savings >= ACCELERATION_STRUCTURE_MIN_COMPACTION_SAVINGS && savings * 10 >= buildSize;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// --------------------------------------------------------
+// What compacting a BLAS needs from the device.  BLASes are
+// identified by index (the order they were created in).
+// --------------------------------------------------------
+class BLASCompactionBackend
+{
+public:
+	virtual ~BLASCompactionBackend() {}
+
+	// Size the BLAS compacts to, from its postbuild info (only readable
+	// once the GPU has finished building it)
+	virtual uint64_t ReadCompactedSize(unsigned int blas) = 0;
+
+	// Records a compacting copy into a new buffer of this size, which
+	// replaces the BLAS from then on.  The original is released once
+	// the GPU is done with it.
+	virtual void CompactBLAS(unsigned int blas, uint64_t compactedSize) = 0;
+};
+
+enum BLASState
+{
+	BLAS_STATE_NONE,			// No BLAS with this index
+	BLAS_STATE_BUILDING,		// Recorded, but not finished on the GPU
+	BLAS_STATE_BUILT,			// Waiting for a compaction decision
+	BLAS_STATE_COMPACTED,
+	BLAS_STATE_NOT_COMPACTED	// Wouldn't have saved enough
+};
+
+struct BLASMemoryInfo
+{
+	BLASState State;
+	uint64_t BuildSize;			// Worst case size it was built at
+	uint64_t CompactedSize;		// 0 until read back
+	uint64_t Size;				// What it uses now
+	uint64_t ScratchSize;		// Needed to build it
+};
+
+struct AccelerationStructureMemoryStats
+{
+	unsigned int BLASCount;
+	unsigned int Compacted;
+	unsigned int AwaitingCompaction;	// Building or built
+	uint64_t BLASBytes;
+	uint64_t BLASBuildBytes;			// What they'd use without compaction
+	uint64_t TLASBytes;
+	uint64_t ScratchBytes;				// TLAS scratch plus BLAS scratch still alive
+	uint64_t TotalBytes;
+	uint64_t LastCompactedBytes;		// BLAS bytes copied by the last Update()
+};
+
+// --------------------------------------------------------
+// Keeps count of the memory acceleration structures use and
+// decides which BLASes to compact, and when.
+//
+// A BLAS can only be compacted once its build is done on
+// the GPU and its compacted size has been read back.  From
+// then on, Update() compacts it if that saves enough, up to
+// a number of (uncompacted) bytes per call, so a big batch
+// of new meshes doesn't all get copied in one frame.
+// --------------------------------------------------------
+class AccelerationStructureTracker
+{
+public:
+	AccelerationStructureTracker();
+
+	void Initialize(BLASCompactionBackend* backend);
+
+	// Most BLAS bytes to copy per Update() (at least one BLAS always is)
+	void SetCompactionBudget(uint64_t bytesPerUpdate) { compactionBudget = bytesPerUpdate; }
+
+	// A BLAS whose build has been recorded
+	void AddBLAS(unsigned int blas, uint64_t buildSize, uint64_t scratchSize);
+
+	// The GPU has finished building the BLAS, so its compacted size can be read
+	void SetBuildComplete(unsigned int blas);
+
+	// Compacts BLASes that have finished building, if they're worth it
+	void Update();
+
+	// Scratch buffers for BLAS builds, counted while they're alive
+	void AddBLASScratch(uint64_t bytes) { blasScratchBytes += bytes; }
+	void RemoveBLASScratch(uint64_t bytes) { blasScratchBytes -= bytes; }
+
+	// The TLAS (and its scratch buffer) as currently allocated
+	void SetTLASSize(uint64_t tlasBytes, uint64_t scratchBytes);
+
+	unsigned int GetBLASCount() const { return (unsigned int)blases.size(); }
+	BLASMemoryInfo GetBLASInfo(unsigned int blas) const;
+	AccelerationStructureMemoryStats GetStats() const;
+
+	// Saves at least a tenth of the BLAS (and a few KB)
+	static bool ShouldCompact(uint64_t buildSize, uint64_t compactedSize);
+
+private:
+	BLASCompactionBackend* backend;
+	uint64_t compactionBudget;
+
+	std::vector<BLASMemoryInfo> blases;
+	std::deque<unsigned int> built;		// In the order they finished
+
+	uint64_t blasScratchBytes;
+	uint64_t tlasBytes;
+	uint64_t tlasScratchBytes;
+	uint64_t lastCompactedBytes;
+};
@@ -0,0 +1,85 @@
+#include "BLASBuildQueue.h"
+
+#include <algorithm>
+
+// Default scratch budget (the shared buffer heaps place buffers up
+// to a quarter of their 64MB blocks)
+#define BLAS_BUILD_DEFAULT_SCRATCH_BUDGET (16ull * 1024 * 1024)
+
+static uint64_t AlignBLASBuildSize(uint64_t size)
+{
+	return (size + BLAS_BUILD_ALIGNMENT - 1) & ~(uint64_t)(BLAS_BUILD_ALIGNMENT - 1);
+}
+
+BLASBuildQueue::BLASBuildQueue() :
+	scratchBudget(BLAS_BUILD_DEFAULT_SCRATCH_BUDGET),
+	builds(0),
+	flushes(0),
+	lastBatches(0),
+	lastScratchSize(0),
+	lastUnpooledScratchSize(0)
+{
+}
+
+unsigned int BLASBuildQueue::Add(uint64_t scratchSize)
+{
+	pendingScratchSizes.push_back(AlignBLASBuildSize(std::max<uint64_t>(scratchSize, 1)));
+	return (unsigned int)pendingScratchSizes.size() - 1;
+}
+
+
+// --------------------------------------------------------
+// Fills batches in order, starting a new one when the next
+// build wouldn't fit in the budget.  Builds in a batch get
+// consecutive scratch ranges, so they never overlap.
+// --------------------------------------------------------
+uint64_t BLASBuildQueue::Plan(std::vector<BLASBuildBatch>& batches, std::vector<uint64_t>& scratchOffsets)
+{
+	batches.clear();
+	scratchOffsets.resize(pendingScratchSizes.size());
+
+	uint64_t scratchSize = 0;
+	for (unsigned int i = 0; i < pendingScratchSizes.size(); i++)
+	{
+		uint64_t size = pendingScratchSizes[i];
+		if (batches.empty() || batches.back().ScratchSize + size > scratchBudget)
+			batches.push_back({ i, 0, 0 });
+
+		BLASBuildBatch& batch = batches.back();
+		scratchOffsets[i] = batch.ScratchSize;
+		batch.BuildCount++;
+		batch.ScratchSize += size;
+		scratchSize = std::max(scratchSize, batch.ScratchSize);
+	}
+	return scratchSize;
+}
+
+void BLASBuildQueue::Clear()
+{
+	if (pendingScratchSizes.empty())
+		return;
+
+	std::vector<BLASBuildBatch> batches;
+	std::vector<uint64_t> scratchOffsets;
+	lastScratchSize = Plan(batches, scratchOffsets);
+	lastBatches = (unsigned int)batches.size();
+	lastUnpooledScratchSize = 0;
+	for (uint64_t size : pendingScratchSizes)
+		lastUnpooledScratchSize += size;
+
+	builds += (unsigned int)pendingScratchSizes.size();
+	flushes++;
+	pendingScratchSizes.clear();
+}
+
+BLASBuildQueueStats BLASBuildQueue::GetStats() const
+{
+	BLASBuildQueueStats stats = {};
+	stats.Pending = (unsigned int)pendingScratchSizes.size();
+	stats.Builds = builds;
+	stats.Flushes = flushes;
+	stats.LastBatches = lastBatches;
+	stats.LastScratchSize = lastScratchSize;
+	stats.LastUnpooledScratchSize = lastUnpooledScratchSize;
+	return stats;
+}
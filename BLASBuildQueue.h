@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Scratch (and result) placement alignment, the same value as
+// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT
+#define BLAS_BUILD_ALIGNMENT 256
+
+// Builds that can run together, each in its own part of the
+// scratch buffer.  Batches reuse the same scratch, so each
+// one needs a UAV barrier before it.
+struct BLASBuildBatch
+{
+	unsigned int FirstBuild;
+	unsigned int BuildCount;
+	uint64_t ScratchSize;		// Used by this batch
+};
+
+struct BLASBuildQueueStats
+{
+	unsigned int Pending;
+	unsigned int Builds;				// In total
+	unsigned int Flushes;				// In total
+	unsigned int LastBatches;
+	uint64_t LastScratchSize;			// The pooled scratch buffer
+	uint64_t LastUnpooledScratchSize;	// What a buffer per build would have been
+};
+
+// --------------------------------------------------------
+// Collects bottom level acceleration structure builds so
+// they can be recorded together in one submission, sharing
+// one scratch buffer instead of each creating (and waiting
+// on) its own.
+//
+// Builds are split, in order, into batches that fit the
+// scratch budget.  The buffer is as big as the biggest
+// batch, which is never less than the biggest build, so a
+// build over budget still gets a batch to itself.
+// --------------------------------------------------------
+class BLASBuildQueue
+{
+public:
+	BLASBuildQueue();
+
+	// Most scratch memory to use at once (builds over it still happen)
+	void SetScratchBudget(uint64_t bytes) { scratchBudget = bytes; }
+	uint64_t GetScratchBudget() const { return scratchBudget; }
+
+	// Queues a build with the sizes from its prebuild info, returning its
+	// index in the pending builds
+	unsigned int Add(uint64_t scratchSize);
+	unsigned int GetPendingCount() const { return (unsigned int)pendingScratchSizes.size(); }
+
+	// Splits the pending builds into batches and gives each build its
+	// offset in the scratch buffer.  Returns the scratch buffer's size.
+	uint64_t Plan(std::vector<BLASBuildBatch>& batches, std::vector<uint64_t>& scratchOffsets);
+
+	// The planned builds have been recorded
+	void Clear();
+
+	BLASBuildQueueStats GetStats() const;
+
+private:
+	uint64_t scratchBudget;
+	std::vector<uint64_t> pendingScratchSizes;	// Aligned
+
+	unsigned int builds;
+	unsigned int flushes;
+	unsigned int lastBatches;
+	uint64_t lastScratchSize;
+	uint64_t lastUnpooledScratchSize;
+};
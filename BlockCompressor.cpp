@@ -0,0 +1,1083 @@
+#include "BlockCompressor.h"
+#include "FileStreams.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <wctype.h>
+
+#define BLOCK_CACHE_MAGIC 0x504D4342		// "BCMP"
+#define BLOCK_CACHE_FILE_VERSION 1
+
+// BC7's 4-bit interpolation weights, out of 64
+static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// One 4x4 block's texels, always RGBA
+typedef unsigned char BlockTexels[16][4];
+
+// --------------------------------------------------------
+// Copies a block out of the image, repeating the last row
+// and column for blocks hanging off the edge (small mips).
+// Grey images become grey RGB with opaque alpha.
+// --------------------------------------------------------
+static void LoadBlock(const DecodedImage& image, unsigned int blockX, unsigned int blockY, BlockTexels texels)
+{
+	for (unsigned int y = 0; y < 4; y++)
+	{
+		unsigned int row = std::min(blockY * 4 + y, image.Height - 1);
+		for (unsigned int x = 0; x < 4; x++)
+		{
+			unsigned int column = std::min(blockX * 4 + x, image.Width - 1);
+			const unsigned char* pixel = &image.Pixels[((size_t)row * image.Width + column) * image.Channels];
+			unsigned char* texel = texels[y * 4 + x];
+			if (image.Channels == 1)
+			{
+				texel[0] = texel[1] = texel[2] = pixel[0];
+				texel[3] = 255;
+			}
+			else
+				memcpy(texel, pixel, 4);
+		}
+	}
+}
+
+// Bits packed from the lowest bit of the first byte up
+struct BlockBits
+{
+	unsigned char* Data;
+	unsigned int Position;
+
+	void Write(unsigned int value, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++, Position++)
+			Data[Position / 8] |= (unsigned char)(((value >> i) & 1) << (Position % 8));
+	}
+
+	unsigned int Read(unsigned int count)
+	{
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < count; i++, Position++)
+			value |= (unsigned int)((Data[Position / 8] >> (Position % 8)) & 1) << i;
+		return value;
+	}
+};
+
+// Line through a set of points along which they spread the most
+// (principal axis, by power iteration), as min and max points
+template<int N> static void FitLine(const float (*points)[N], unsigned int count, float* low, float* high)
+{
+	float mean[N] = {};
+	for (unsigned int i = 0; i < count; i++)
+		for (int c = 0; c < N; c++)
+			mean[c] += points[i][c] / count;
+
+	float covariance[N][N] = {};
+	for (unsigned int i = 0; i < count; i++)
+		for (int a = 0; a < N; a++)
+			for (int b = 0; b < N; b++)
+				covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+
+	float axis[N];
+	for (int c = 0; c < N; c++)
+		axis[c] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[N] = {};
+		float length = 0.0f;
+		for (int a = 0; a < N; a++)
+		{
+			for (int b = 0; b < N; b++)
+				next[a] += covariance[a][b] * axis[b];
+			length = std::max(length, fabsf(next[a]));
+		}
+		if (length < 1e-9f)
+			break;
+		for (int c = 0; c < N; c++)
+			axis[c] = next[c] / length;
+	}
+
+	float lowest = 0.0f;
+	float highest = 0.0f;
+	float lengthSquared = 0.0f;
+	for (int c = 0; c < N; c++)
+		lengthSquared += axis[c] * axis[c];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < N; c++)
+			t += (points[i][c] - mean[c]) * axis[c];
+		t /= lengthSquared;
+		lowest = std::min(lowest, t);
+		highest = std::max(highest, t);
+	}
+	for (int c = 0; c < N; c++)
+	{
+		low[c] = mean[c] + axis[c] * lowest;
+		high[c] = mean[c] + axis[c] * highest;
+	}
+}
+
+// Least squares endpoints for one channel, given each texel's weight
+// towards the second endpoint.  False if the weights can't tell.
+static bool SolveEndpoints(const float* values, const float* weights, unsigned int count, float& first, float& second)
+{
+	float aa = 0, ab = 0, bb = 0, ax = 0, bx = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float b = weights[i];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		ax += a * values[i];
+		bx += b * values[i];
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	first = (ax * bb - bx * ab) / determinant;
+	second = (bx * aa - ax * ab) / determinant;
+	return true;
+}
+
+static int Clamp(int value, int low, int high)
+{
+	return std::min(std::max(value, low), high);
+}
+
+// --- BC1 -------------------------------------------------
+
+static unsigned int Pack565(const float* color)
+{
+	int r = Clamp((int)(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+	int g = Clamp((int)(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+	int b = Clamp((int)(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+	return (unsigned int)((r << 11) | (g << 5) | b);
+}
+
+static void Unpack565(unsigned int packed, int* color)
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// The four colors (opaque mode, so the first endpoint must be larger)
+static void GetBC1Palette(unsigned int first, unsigned int second, int palette[4][3])
+{
+	Unpack565(first, palette[0]);
+	Unpack565(second, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		if (first > second)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Nearest palette entry for each texel, and the total squared error
+static unsigned int FindBC1Indices(const BlockTexels texels, unsigned int first, unsigned int second, unsigned int* indices)
+{
+	int palette[4][3];
+	GetBC1Palette(first, second, palette);
+	unsigned int entries = first > second ? 4 : 3;
+	unsigned int total = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int best = 0xFFFFFFFF;
+		for (unsigned int p = 0; p < entries; p++)
+		{
+			unsigned int error = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int difference = (int)texels[i][c] - palette[p][c];
+				error += (unsigned int)(difference * difference);
+			}
+			if (error < best)
+			{
+				best = error;
+				indices[i] = p;
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+// Endpoints in the order that selects four colors (equal ones can't)
+static void OrderBC1Endpoints(unsigned int& first, unsigned int& second)
+{
+	if (first < second)
+		std::swap(first, second);
+}
+
+
+// --------------------------------------------------------
+// Fits a line through the colors, then (above fast) refits
+// the endpoints to the indices they chose by least squares
+// and (high) nudges each 5:6:5 component while it helps
+// --------------------------------------------------------
+static void EncodeBC1(const BlockTexels texels, BlockQuality quality, unsigned char* output)
+{
+	float points[16][3];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			points[i][c] = texels[i][c];
+
+	float low[3], high[3];
+	FitLine<3>(points, 16, low, high);
+	unsigned int first = Pack565(high);
+	unsigned int second = Pack565(low);
+	OrderBC1Endpoints(first, second);
+	unsigned int indices[16];
+	unsigned int error = FindBC1Indices(texels, first, second, indices);
+
+	// Weight towards the second endpoint for each index
+	const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	int refits = quality == BLOCK_QUALITY_FAST ? 0 : (quality == BLOCK_QUALITY_NORMAL ? 1 : 3);
+	for (int refit = 0; refit < refits && error > 0 && first != second; refit++)
+	{
+		float texelWeights[16];
+		for (int i = 0; i < 16; i++)
+			texelWeights[i] = weights[indices[i]];
+
+		float firstColor[3], secondColor[3];
+		bool solved = true;
+		for (int c = 0; c < 3 && solved; c++)
+		{
+			float values[16];
+			for (int i = 0; i < 16; i++)
+				values[i] = points[i][c];
+			solved = SolveEndpoints(values, texelWeights, 16, firstColor[c], secondColor[c]);
+		}
+		if (!solved)
+			break;
+
+		unsigned int newFirst = Pack565(firstColor);
+		unsigned int newSecond = Pack565(secondColor);
+		OrderBC1Endpoints(newFirst, newSecond);
+		unsigned int newIndices[16];
+		unsigned int newError = FindBC1Indices(texels, newFirst, newSecond, newIndices);
+		if (newError >= error)
+			break;
+		first = newFirst;
+		second = newSecond;
+		error = newError;
+		memcpy(indices, newIndices, sizeof(indices));
+	}
+
+	if (quality == BLOCK_QUALITY_HIGH)
+	{
+		const unsigned int fields[3][2] = { { 11, 31 }, { 5, 63 }, { 0, 31 } };
+		bool improved = true;
+		for (int pass = 0; pass < 4 && improved && error > 0; pass++)
+		{
+			improved = false;
+			for (int endpoint = 0; endpoint < 2; endpoint++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					for (int step = -1; step <= 1; step += 2)
+					{
+						unsigned int candidate[2] = { first, second };
+						int value = (int)((candidate[endpoint] >> fields[c][0]) & fields[c][1]) + step;
+						if (value < 0 || value > (int)fields[c][1])
+							continue;
+						candidate[endpoint] = (candidate[endpoint] & ~(fields[c][1] << fields[c][0])) | ((unsigned int)value << fields[c][0]);
+						OrderBC1Endpoints(candidate[0], candidate[1]);
+
+						unsigned int newIndices[16];
+						unsigned int newError = FindBC1Indices(texels, candidate[0], candidate[1], newIndices);
+						if (newError < error)
+						{
+							first = candidate[0];
+							second = candidate[1];
+							error = newError;
+							memcpy(indices, newIndices, sizeof(indices));
+							improved = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	uint32_t packedIndices = 0;
+	for (int i = 0; i < 16; i++)
+		packedIndices |= indices[i] << (i * 2);
+	output[0] = (unsigned char)first;
+	output[1] = (unsigned char)(first >> 8);
+	output[2] = (unsigned char)second;
+	output[3] = (unsigned char)(second >> 8);
+	memcpy(output + 4, &packedIndices, 4);
+}
+
+static void DecodeBC1(const unsigned char* block, BlockTexels texels)
+{
+	unsigned int first = block[0] | (block[1] << 8);
+	unsigned int second = block[2] | (block[3] << 8);
+	uint32_t indices;
+	memcpy(&indices, block + 4, 4);
+
+	int palette[4][3];
+	GetBC1Palette(first, second, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int index = (indices >> (i * 2)) & 3;
+		for (int c = 0; c < 3; c++)
+			texels[i][c] = (unsigned char)palette[index][c];
+		texels[i][3] = (first <= second && index == 3) ? 0 : 255;
+	}
+}
+
+// --- BC4 -------------------------------------------------
+
+// Eight values if the first endpoint is larger, otherwise six plus 0 and 255
+static void GetBC4Palette(int first, int second, int palette[8])
+{
+	palette[0] = first;
+	palette[1] = second;
+	if (first > second)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = ((7 - i) * first + i * second + 3) / 7;
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = ((5 - i) * first + i * second + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static unsigned int FindBC4Indices(const int* values, int first, int second, unsigned int* indices)
+{
+	int palette[8];
+	GetBC4Palette(first, second, palette);
+	unsigned int total = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int best = 0xFFFFFFFF;
+		for (unsigned int p = 0; p < 8; p++)
+		{
+			unsigned int error = (unsigned int)((values[i] - palette[p]) * (values[i] - palette[p]));
+			if (error < best)
+			{
+				best = error;
+				indices[i] = p;
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+
+// --------------------------------------------------------
+// Starts from the block's range in eight value mode.  Above
+// fast, refits to the chosen indices, and (high) also tries
+// six value mode (for blocks with 0 or 255 in them) and
+// searches nearby endpoints.
+// --------------------------------------------------------
+static void EncodeBC4(const int* values, BlockQuality quality, unsigned char* output)
+{
+	int lowest = 255, highest = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		lowest = std::min(lowest, values[i]);
+		highest = std::max(highest, values[i]);
+	}
+
+	int first = highest;
+	int second = lowest;
+	unsigned int indices[16];
+	unsigned int error = FindBC4Indices(values, first, second, indices);
+
+	auto tryEndpoints = [&](int newFirst, int newSecond)
+	{
+		unsigned int newIndices[16];
+		unsigned int newError = FindBC4Indices(values, newFirst, newSecond, newIndices);
+		if (newError >= error)
+			return false;
+		first = newFirst;
+		second = newSecond;
+		error = newError;
+		memcpy(indices, newIndices, sizeof(indices));
+		return true;
+	};
+
+	if (quality != BLOCK_QUALITY_FAST && error > 0 && first > second)
+	{
+		// Weight towards the second endpoint for each eight value mode index
+		const float weights[8] = { 0.0f, 1.0f, 1 / 7.0f, 2 / 7.0f, 3 / 7.0f, 4 / 7.0f, 5 / 7.0f, 6 / 7.0f };
+		float valuesFloat[16], texelWeights[16];
+		for (int i = 0; i < 16; i++)
+		{
+			valuesFloat[i] = (float)values[i];
+			texelWeights[i] = weights[indices[i]];
+		}
+		float newFirst, newSecond;
+		if (SolveEndpoints(valuesFloat, texelWeights, 16, newFirst, newSecond))
+		{
+			int a = Clamp((int)(newFirst + 0.5f), 0, 255);
+			int b = Clamp((int)(newSecond + 0.5f), 0, 255);
+			if (a > b)
+				tryEndpoints(a, b);
+		}
+	}
+
+	if (quality == BLOCK_QUALITY_HIGH && error > 0)
+	{
+		// Six value mode spans the values between the extremes
+		int innerLow = 255, innerHigh = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			if (values[i] > 0 && values[i] < 255)
+			{
+				innerLow = std::min(innerLow, values[i]);
+				innerHigh = std::max(innerHigh, values[i]);
+			}
+		}
+		if (innerLow <= innerHigh)
+			tryEndpoints(innerLow, innerHigh);
+
+		for (int radius = 1; radius <= 2 && error > 0; radius++)
+		{
+			for (int a = -radius; a <= radius; a++)
+			{
+				for (int b = -radius; b <= radius; b++)
+				{
+					int newFirst = Clamp(first + a, 0, 255);
+					int newSecond = Clamp(second + b, 0, 255);
+					if ((newFirst > newSecond) == (first > second))
+						tryEndpoints(newFirst, newSecond);
+				}
+			}
+		}
+	}
+
+	output[0] = (unsigned char)first;
+	output[1] = (unsigned char)second;
+	uint64_t packedIndices = 0;
+	for (int i = 0; i < 16; i++)
+		packedIndices |= (uint64_t)indices[i] << (i * 3);
+	for (int i = 0; i < 6; i++)
+		output[2 + i] = (unsigned char)(packedIndices >> (i * 8));
+}
+
+static void DecodeBC4(const unsigned char* block, int* values)
+{
+	int palette[8];
+	GetBC4Palette(block[0], block[1], palette);
+	uint64_t packedIndices = 0;
+	for (int i = 0; i < 6; i++)
+		packedIndices |= (uint64_t)block[2 + i] << (i * 8);
+	for (int i = 0; i < 16; i++)
+		values[i] = palette[(packedIndices >> (i * 3)) & 7];
+}
+
+// --- BC7 (mode 6) ----------------------------------------
+
+// A mode 6 block before packing: 7-bit endpoints plus a p-bit each
+struct BC7Endpoints
+{
+	int Color[2][4];
+	int PBit[2];
+};
+
+static void GetBC7Palette(const BC7Endpoints& endpoints, int palette[16][4])
+{
+	int first[4], second[4];
+	for (int c = 0; c < 4; c++)
+	{
+		first[c] = (endpoints.Color[0][c] << 1) | endpoints.PBit[0];
+		second[c] = (endpoints.Color[1][c] << 1) | endpoints.PBit[1];
+	}
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = ((64 - bc7Weights[i]) * first[c] + bc7Weights[i] * second[c] + 32) >> 6;
+}
+
+// --------------------------------------------------------
+// The palette is a line, so each texel's projection onto it
+// picks the step; only the steps either side of that need
+// checking (for rounding).
+// --------------------------------------------------------
+static unsigned int FindBC7Indices(const BlockTexels texels, const BC7Endpoints& endpoints, unsigned int* indices)
+{
+	int palette[16][4];
+	GetBC7Palette(endpoints, palette);
+
+	int direction[4];
+	int lengthSquared = 0;
+	for (int c = 0; c < 4; c++)
+	{
+		direction[c] = palette[15][c] - palette[0][c];
+		lengthSquared += direction[c] * direction[c];
+	}
+
+	unsigned int total = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int first = 0;
+		unsigned int last = 15;
+		if (lengthSquared > 0)
+		{
+			int projection = 0;
+			for (int c = 0; c < 4; c++)
+				projection += ((int)texels[i][c] - palette[0][c]) * direction[c];
+			float weight = 64.0f * projection / lengthSquared;
+			unsigned int step = 0;
+			while (step < 15 && (bc7Weights[step] + bc7Weights[step + 1]) * 0.5f < weight)
+				step++;
+			first = step > 0 ? step - 1 : 0;
+			last = std::min(step + 1, 15u);
+		}
+
+		unsigned int best = 0xFFFFFFFF;
+		for (unsigned int p = first; p <= last; p++)
+		{
+			unsigned int error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int difference = (int)texels[i][c] - palette[p][c];
+				error += (unsigned int)(difference * difference);
+			}
+			if (error < best)
+			{
+				best = error;
+				indices[i] = p;
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+// Rounds an endpoint to 7 bits, with the given p-bit as the lowest bit
+static void QuantizeBC7Endpoint(const float* color, int pBit, int* quantized)
+{
+	for (int c = 0; c < 4; c++)
+		quantized[c] = Clamp((int)floorf((color[c] - pBit) / 2.0f + 0.5f), 0, 127);
+}
+
+// Total squared error of an endpoint after quantizing with a p-bit
+static float GetBC7QuantizationError(const float* color, int pBit)
+{
+	int quantized[4];
+	QuantizeBC7Endpoint(color, pBit, quantized);
+	float error = 0.0f;
+	for (int c = 0; c < 4; c++)
+	{
+		float difference = color[c] - (float)((quantized[c] << 1) | pBit);
+		error += difference * difference;
+	}
+	return error;
+}
+
+
+// --------------------------------------------------------
+// Quantizes float endpoints, trying every p-bit pair (or,
+// when fast, whichever p-bit rounds each endpoint best)
+// and keeping whichever gives the least error
+// --------------------------------------------------------
+static unsigned int QuantizeBC7(const BlockTexels texels, const float* first, const float* second, bool allPBits, BC7Endpoints& endpoints, unsigned int* indices)
+{
+	unsigned int bestError = 0xFFFFFFFF;
+	for (int pairing = 0; pairing < 4; pairing++)
+	{
+		BC7Endpoints candidate;
+		if (allPBits)
+		{
+			candidate.PBit[0] = pairing & 1;
+			candidate.PBit[1] = pairing >> 1;
+		}
+		else
+		{
+			if (pairing > 0)
+				break;
+			candidate.PBit[0] = GetBC7QuantizationError(first, 1) < GetBC7QuantizationError(first, 0) ? 1 : 0;
+			candidate.PBit[1] = GetBC7QuantizationError(second, 1) < GetBC7QuantizationError(second, 0) ? 1 : 0;
+		}
+		QuantizeBC7Endpoint(first, candidate.PBit[0], candidate.Color[0]);
+		QuantizeBC7Endpoint(second, candidate.PBit[1], candidate.Color[1]);
+
+		unsigned int candidateIndices[16];
+		unsigned int error = FindBC7Indices(texels, candidate, candidateIndices);
+		if (error < bestError)
+		{
+			bestError = error;
+			endpoints = candidate;
+			memcpy(indices, candidateIndices, sizeof(candidateIndices));
+		}
+	}
+	return bestError;
+}
+
+
+// --------------------------------------------------------
+// Mode 6: one RGBA line, 7 bits per endpoint component, a
+// p-bit per endpoint, and 16 steps between them
+// --------------------------------------------------------
+static void EncodeBC7(const BlockTexels texels, BlockQuality quality, unsigned char* output)
+{
+	float points[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			points[i][c] = texels[i][c];
+
+	float first[4], second[4];
+	FitLine<4>(points, 16, first, second);
+
+	bool allPBits = quality != BLOCK_QUALITY_FAST;
+	BC7Endpoints endpoints;
+	unsigned int indices[16];
+	unsigned int error = QuantizeBC7(texels, first, second, allPBits, endpoints, indices);
+
+	int refits = quality == BLOCK_QUALITY_FAST ? 0 : (quality == BLOCK_QUALITY_NORMAL ? 1 : 3);
+	for (int refit = 0; refit < refits && error > 0; refit++)
+	{
+		float texelWeights[16];
+		for (int i = 0; i < 16; i++)
+			texelWeights[i] = bc7Weights[indices[i]] / 64.0f;
+
+		bool solved = true;
+		for (int c = 0; c < 4 && solved; c++)
+		{
+			float values[16];
+			for (int i = 0; i < 16; i++)
+				values[i] = points[i][c];
+			solved = SolveEndpoints(values, texelWeights, 16, first[c], second[c]);
+		}
+		if (!solved)
+			break;
+
+		BC7Endpoints newEndpoints;
+		unsigned int newIndices[16];
+		unsigned int newError = QuantizeBC7(texels, first, second, allPBits, newEndpoints, newIndices);
+		if (newError >= error)
+			break;
+		endpoints = newEndpoints;
+		error = newError;
+		memcpy(indices, newIndices, sizeof(indices));
+	}
+
+	if (quality == BLOCK_QUALITY_HIGH)
+	{
+		bool improved = true;
+		for (int pass = 0; pass < 4 && improved && error > 0; pass++)
+		{
+			improved = false;
+			for (int endpoint = 0; endpoint < 2; endpoint++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					for (int step = -1; step <= 1; step += 2)
+					{
+						BC7Endpoints candidate = endpoints;
+						candidate.Color[endpoint][c] += step;
+						if (candidate.Color[endpoint][c] < 0 || candidate.Color[endpoint][c] > 127)
+							continue;
+
+						unsigned int newIndices[16];
+						unsigned int newError = FindBC7Indices(texels, candidate, newIndices);
+						if (newError < error)
+						{
+							endpoints = candidate;
+							error = newError;
+							memcpy(indices, newIndices, sizeof(indices));
+							improved = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// The first texel's index drops its top bit, so it has to be under 8
+	if (indices[0] >= 8)
+	{
+		std::swap(endpoints.Color[0], endpoints.Color[1]);
+		std::swap(endpoints.PBit[0], endpoints.PBit[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(output, 0, 16);
+	BlockBits bits = { output, 0 };
+	bits.Write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		bits.Write(endpoints.Color[0][c], 7);
+		bits.Write(endpoints.Color[1][c], 7);
+	}
+	bits.Write(endpoints.PBit[0], 1);
+	bits.Write(endpoints.PBit[1], 1);
+	bits.Write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.Write(indices[i], 4);
+}
+
+// Only mode 6 (all this encoder makes); other modes decode as zeros
+static void DecodeBC7(const unsigned char* block, BlockTexels texels)
+{
+	BlockBits bits = { (unsigned char*)block, 0 };
+	if (bits.Read(7) != (1 << 6))
+	{
+		memset(texels, 0, sizeof(BlockTexels));
+		return;
+	}
+
+	BC7Endpoints endpoints;
+	for (int c = 0; c < 4; c++)
+	{
+		endpoints.Color[0][c] = (int)bits.Read(7);
+		endpoints.Color[1][c] = (int)bits.Read(7);
+	}
+	endpoints.PBit[0] = (int)bits.Read(1);
+	endpoints.PBit[1] = (int)bits.Read(1);
+
+	int palette[16][4];
+	GetBC7Palette(endpoints, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned int index = bits.Read(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++)
+			texels[i][c] = (unsigned char)palette[index][c];
+	}
+}
+
+// ---------------------------------------------------------
+
+static void EncodeBlock(const BlockTexels texels, BlockFormat format, BlockQuality quality, unsigned char* output)
+{
+	int values[16];
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+		EncodeBC1(texels, quality, output);
+		break;
+
+	case BLOCK_FORMAT_BC4:
+		for (int i = 0; i < 16; i++)
+			values[i] = texels[i][0];
+		EncodeBC4(values, quality, output);
+		break;
+
+	case BLOCK_FORMAT_BC5:
+		for (int c = 0; c < 2; c++)
+		{
+			for (int i = 0; i < 16; i++)
+				values[i] = texels[i][c];
+			EncodeBC4(values, quality, output + c * 8);
+		}
+		break;
+
+	case BLOCK_FORMAT_BC7:
+		EncodeBC7(texels, quality, output);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void DecodeBlock(const unsigned char* block, BlockFormat format, BlockTexels texels)
+{
+	int values[16];
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+		DecodeBC1(block, texels);
+		break;
+
+	case BLOCK_FORMAT_BC4:
+		DecodeBC4(block, values);
+		for (int i = 0; i < 16; i++)
+		{
+			texels[i][0] = (unsigned char)values[i];
+			texels[i][1] = texels[i][2] = 0;
+			texels[i][3] = 255;
+		}
+		break;
+
+	case BLOCK_FORMAT_BC5:
+		for (int c = 0; c < 2; c++)
+		{
+			DecodeBC4(block + c * 8, values);
+			for (int i = 0; i < 16; i++)
+				texels[i][c] = (unsigned char)values[i];
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			texels[i][2] = 0;
+			texels[i][3] = 255;
+		}
+		break;
+
+	case BLOCK_FORMAT_BC7:
+		DecodeBC7(block, texels);
+		break;
+
+	default:
+		memset(texels, 0, sizeof(BlockTexels));
+		break;
+	}
+}
+
+unsigned int BlockCompressor::GetBlockBytes(BlockFormat format)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+	case BLOCK_FORMAT_BC4:
+		return 8;
+	case BLOCK_FORMAT_BC5:
+	case BLOCK_FORMAT_BC7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+size_t BlockCompressor::GetCompressedSize(unsigned int width, unsigned int height, BlockFormat format)
+{
+	size_t blocksWide = std::max(1u, (width + 3) / 4);
+	size_t blocksHigh = std::max(1u, (height + 3) / 4);
+	return blocksWide * blocksHigh * GetBlockBytes(format);
+}
+
+bool BlockCompressor::CanCompress(const DecodedImage& image)
+{
+	return image.Width > 0 && image.Height > 0 && image.Width % 4 == 0 && image.Height % 4 == 0 && !image.Pixels.empty();
+}
+
+
+// --------------------------------------------------------
+// Each block row is a job.  Blocks past the edge of small
+// mips repeat the edge texels.
+// --------------------------------------------------------
+void BlockCompressor::Compress(const DecodedImage& image, BlockFormat format, BlockQuality quality, CompressedImage& compressed)
+{
+	unsigned int blocksWide = std::max(1u, (image.Width + 3) / 4);
+	unsigned int blocksHigh = std::max(1u, (image.Height + 3) / 4);
+	unsigned int blockBytes = GetBlockBytes(format);
+
+	compressed.Width = image.Width;
+	compressed.Height = image.Height;
+	compressed.Format = format;
+	compressed.Blocks.assign((size_t)blocksWide * blocksHigh * blockBytes, 0);
+
+	JobSystem::GetInstance().ParallelFor(blocksHigh, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		BlockTexels texels;
+		for (unsigned int blockY = rowStart; blockY < rowEnd; blockY++)
+		{
+			for (unsigned int blockX = 0; blockX < blocksWide; blockX++)
+			{
+				LoadBlock(image, blockX, blockY, texels);
+				EncodeBlock(texels, format, quality, &compressed.Blocks[((size_t)blockY * blocksWide + blockX) * blockBytes]);
+			}
+		}
+	});
+}
+
+void BlockCompressor::Decompress(const CompressedImage& compressed, DecodedImage& image)
+{
+	unsigned int blocksWide = std::max(1u, (compressed.Width + 3) / 4);
+	unsigned int blockBytes = GetBlockBytes(compressed.Format);
+	unsigned int channels = compressed.Format == BLOCK_FORMAT_BC4 ? 1 : 4;
+
+	image.Width = compressed.Width;
+	image.Height = compressed.Height;
+	image.Channels = channels;
+	image.Pixels.resize((size_t)image.Width * image.Height * channels);
+
+	BlockTexels texels;
+	for (unsigned int y = 0; y < image.Height; y++)
+	{
+		for (unsigned int x = 0; x < image.Width; x++)
+		{
+			// Rows of a block are decoded again for each texel row; simple
+			// is fine here, since this is only for measuring
+			if (x % 4 == 0)
+				DecodeBlock(&compressed.Blocks[((size_t)(y / 4) * blocksWide + x / 4) * blockBytes], compressed.Format, texels);
+			memcpy(&image.Pixels[((size_t)y * image.Width + x) * channels], texels[(y % 4) * 4 + x % 4], channels);
+		}
+	}
+}
+
+double BlockCompressor::MeasurePSNR(const DecodedImage& original, const CompressedImage& compressed)
+{
+	DecodedImage decompressed;
+	Decompress(compressed, decompressed);
+
+	unsigned int channels = 4;
+	if (compressed.Format == BLOCK_FORMAT_BC4)
+		channels = 1;
+	else if (compressed.Format == BLOCK_FORMAT_BC5)
+		channels = 2;
+	else if (compressed.Format == BLOCK_FORMAT_BC1)
+		channels = 3;
+
+	double squaredError = 0.0;
+	size_t texels = (size_t)original.Width * original.Height;
+	for (size_t i = 0; i < texels; i++)
+	{
+		for (unsigned int c = 0; c < channels; c++)
+		{
+			int expected = original.Channels == 1 ? (c < 3 ? original.Pixels[i] : 255) : original.Pixels[i * 4 + c];
+			int difference = expected - (int)decompressed.Pixels[i * decompressed.Channels + c];
+			squaredError += difference * difference;
+		}
+	}
+
+	double meanSquaredError = squaredError / ((double)texels * channels);
+	if (meanSquaredError <= 0.0)
+		return 99.0;
+	return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
+BlockFormat BlockCompressor::GetFormatForPath(const std::wstring& path, BlockQuality quality)
+{
+	std::wstring name = path;
+	for (wchar_t& c : name)
+		c = (wchar_t)towlower(c);
+
+	if (name.find(L"normal") != std::wstring::npos)
+		return BLOCK_FORMAT_BC5;
+	if (name.find(L"albedo") != std::wstring::npos || name.find(L"color") != std::wstring::npos || name.find(L"diffuse") != std::wstring::npos)
+		return quality == BLOCK_QUALITY_FAST ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC7;
+	if (name.find(L"metal") != std::wstring::npos || name.find(L"rough") != std::wstring::npos ||
+		name.find(L"height") != std::wstring::npos || name.find(L"_ao") != std::wstring::npos)
+		return BLOCK_FORMAT_BC4;
+	return BLOCK_FORMAT_BC7;
+}
+
+uint64_t BlockCompressor::GetCacheKey(uint64_t sourceKey, BlockFormat format, BlockQuality quality)
+{
+	PipelineKeyHasher hasher;
+	hasher.AddValue(sourceKey);
+	hasher.AddValue((uint32_t)format);
+	hasher.AddValue((uint32_t)quality);
+	hasher.AddValue((uint32_t)BLOCK_COMPRESSOR_VERSION);
+	return hasher.GetHash();
+}
+
+template<typename T> static void AppendValue(std::vector<unsigned char>& data, const T& value)
+{
+	const unsigned char* bytes = (const unsigned char*)&value;
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T> static bool ReadValue(const unsigned char* data, size_t size, size_t& offset, T& value)
+{
+	if (size - offset < sizeof(T))
+		return false;
+	memcpy(&value, data + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+static uint64_t ChecksumLevels(const std::vector<CompressedImage>& levels)
+{
+	PipelineKeyHasher hasher;
+	for (const CompressedImage& level : levels)
+		hasher.Add(level.Blocks.data(), level.Blocks.size());
+	return hasher.GetHash();
+}
+
+void BlockCompressor::Serialize(const std::vector<CompressedImage>& levels, uint64_t key, std::vector<unsigned char>& data)
+{
+	data.clear();
+	AppendValue(data, (uint32_t)BLOCK_CACHE_MAGIC);
+	AppendValue(data, (uint32_t)BLOCK_CACHE_FILE_VERSION);
+	AppendValue(data, key);
+	AppendValue(data, (uint32_t)(levels.empty() ? 0 : levels[0].Width));
+	AppendValue(data, (uint32_t)(levels.empty() ? 0 : levels[0].Height));
+	AppendValue(data, (uint32_t)(levels.empty() ? BLOCK_FORMAT_NONE : levels[0].Format));
+	AppendValue(data, (uint32_t)levels.size());
+	AppendValue(data, ChecksumLevels(levels));
+	for (const CompressedImage& level : levels)
+		data.insert(data.end(), level.Blocks.begin(), level.Blocks.end());
+}
+
+
+// --------------------------------------------------------
+// Levels halve in size like mips, but a chain may stop
+// early (a texture without mips has just the one)
+// --------------------------------------------------------
+bool BlockCompressor::Deserialize(const unsigned char* data, size_t size, uint64_t key, std::vector<CompressedImage>& levels)
+{
+	levels.clear();
+
+	size_t offset = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t fileKey = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t format = 0;
+	uint32_t levelCount = 0;
+	uint64_t checksum = 0;
+	if (!ReadValue(data, size, offset, magic) || magic != BLOCK_CACHE_MAGIC ||
+		!ReadValue(data, size, offset, version) || version != BLOCK_CACHE_FILE_VERSION ||
+		!ReadValue(data, size, offset, fileKey) || fileKey != key ||
+		!ReadValue(data, size, offset, width) ||
+		!ReadValue(data, size, offset, height) ||
+		!ReadValue(data, size, offset, format) ||
+		!ReadValue(data, size, offset, levelCount) ||
+		!ReadValue(data, size, offset, checksum))
+		return false;
+
+	if (width == 0 || height == 0 || width > 65536 || height > 65536 || width % 4 != 0 || height % 4 != 0 ||
+		format == BLOCK_FORMAT_NONE || format > BLOCK_FORMAT_BC7 || levelCount == 0 || levelCount > 17)
+		return false;
+
+	std::vector<CompressedImage> loaded(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		CompressedImage& level = loaded[i];
+		level.Width = width;
+		level.Height = height;
+		level.Format = (BlockFormat)format;
+		size_t bytes = GetCompressedSize(width, height, level.Format);
+		if (size - offset < bytes)
+			return false;
+		level.Blocks.assign(data + offset, data + offset + bytes);
+		offset += bytes;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	if (offset != size || ChecksumLevels(loaded) != checksum)
+		return false;
+
+	levels.swap(loaded);
+	return true;
+}
+
+bool BlockCompressor::Load(const std::wstring& path, uint64_t key, std::vector<CompressedImage>& levels)
+{
+	std::vector<unsigned char> data;
+	return ReadWholeFile(path, data) && Deserialize(data.data(), data.size(), key, levels);
+}
+
+bool BlockCompressor::Save(const std::wstring& path, const std::vector<CompressedImage>& levels, uint64_t key)
+{
+	std::vector<unsigned char> data;
+	Serialize(levels, key, data);
+	return WriteWholeFile(path, data.data(), data.size());
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PNGDecoder.h"
+
+// Bump when compressed blocks would change, so cached ones are rebuilt
+#define BLOCK_COMPRESSOR_VERSION 1
+
+enum BlockFormat
+{
+	BLOCK_FORMAT_NONE,		// Left uncompressed
+	BLOCK_FORMAT_BC1,		// RGB, 8 bytes per block (opaque)
+	BLOCK_FORMAT_BC4,		// One channel (red), 8 bytes per block
+	BLOCK_FORMAT_BC5,		// Two channels (red, green), 16 bytes per block
+	BLOCK_FORMAT_BC7		// RGBA, 16 bytes per block
+};
+
+enum BlockQuality
+{
+	BLOCK_QUALITY_FAST,		// Endpoints straight from the colors' spread
+	BLOCK_QUALITY_NORMAL,	// Plus a least squares refit, and every p-bit choice (BC7)
+	BLOCK_QUALITY_HIGH		// Plus more refits and a search around the endpoints
+};
+
+// Rows of 4x4 blocks, top row first
+struct CompressedImage
+{
+	unsigned int Width;
+	unsigned int Height;
+	BlockFormat Format;
+	std::vector<unsigned char> Blocks;
+};
+
+// --------------------------------------------------------
+// Compresses decoded textures to BC formats on the CPU, so
+// they take 4x (BC7, BC5) to 8x (BC1, and BC4 against
+// RGBA) less GPU memory and bandwidth.
+//
+// Blocks are independent, so each block row is a job on
+// the JobSystem.  BC7 only uses mode 6 (one RGBA line with
+// 16 steps), which needs no partition tables and suits
+// smooth, opaque material textures well.
+//
+// Compressed chains serialize like mip chains, so they can
+// be cached on disk as well.
+// --------------------------------------------------------
+class BlockCompressor
+{
+public:
+	// Images whose width or height isn't a multiple of 4 can't be
+	// compressed (for mips, only the top level needs to be)
+	static bool CanCompress(const DecodedImage& image);
+	static void Compress(const DecodedImage& image, BlockFormat format, BlockQuality quality, CompressedImage& compressed);
+
+	// Back to pixels: one channel for BC4, RGBA otherwise (BC5's blue is
+	// 0, and BC1's alpha is 255)
+	static void Decompress(const CompressedImage& compressed, DecodedImage& image);
+
+	// Peak signal to noise ratio, in dB, over the channels the format keeps
+	static double MeasurePSNR(const DecodedImage& original, const CompressedImage& compressed);
+
+	static unsigned int GetBlockBytes(BlockFormat format);
+	static size_t GetCompressedSize(unsigned int width, unsigned int height, BlockFormat format);
+
+	// Normals are BC5, albedo is BC7 (BC1 when fast), single channel data
+	// is BC4 and anything else is BC7
+	static BlockFormat GetFormatForPath(const std::wstring& path, BlockQuality quality);
+
+	// Identifies blocks compressed from this source (file contents, or a
+	// mip chain's key) in this format and at this quality
+	static uint64_t GetCacheKey(uint64_t sourceKey, BlockFormat format, BlockQuality quality);
+
+	// Cached chain format (little endian):
+	//   Magic, version (uint32 each), key (uint64), width, height,
+	//   format, level count (uint32 each), block checksum (uint64),
+	//   then every level's blocks in order
+	static void Serialize(const std::vector<CompressedImage>& levels, uint64_t key, std::vector<unsigned char>& data);
+	static bool Deserialize(const unsigned char* data, size_t size, uint64_t key, std::vector<CompressedImage>& levels);
+	static bool Load(const std::wstring& path, uint64_t key, std::vector<CompressedImage>& levels);
+	static bool Save(const std::wstring& path, const std::vector<CompressedImage>& levels, uint64_t key);
+};
@@ -28,11 +28,45 @@ struct RaytracingSceneData {
 	DirectX::XMFLOAT3 cameraPosition;
 	unsigned int raysPerPixel;
 	unsigned int maxRecursion;
-	DirectX::XMFLOAT3 lightSourcePosition;
+	unsigned int lightCount;
+	unsigned int lightSamplingStrategy;
+	unsigned int infiniteLightCount;
+	unsigned int infiniteAliasOffset;
+	float infiniteLightProbability;
+	unsigned int frameIndex;
+	unsigned int restirEnabled;
+	unsigned int restirCandidates;
+	unsigned int restirTemporal;
+	unsigned int restirSpatialSamples;
+	float restirSpatialRadius;
+	unsigned int restirHistoryValid;
+	DirectX::XMFLOAT3 previousCameraPosition;
+	DirectX::XMFLOAT4X4 previousViewProjection;
+	unsigned int checkerboard;
+	float pixelSpreadAngle;		// Primary rays' cone (see RayCone.h)
 };
 
-//must match raytracing shader define
-#define MAX_INSTANCES_PER_BLAS 100
-struct RaytracingEntityData {
-	DirectX::XMFLOAT4 color[MAX_INSTANCES_PER_BLAS];
-};
\ No newline at end of file
+// One TLAS instance's data for the hit shaders (by InstanceIndex()):
+// last frame's world matrix, as the rows of its transposed 3x4 (same
+// layout as the instance desc), and which material it uses
+// Must match the struct in Raytracing.hlsl
+#define RAYTRACING_INSTANCE_TRANSPARENT	0x1
+#define RAYTRACING_INSTANCE_EMISSIVE	0x2
+struct RaytracingInstanceData {
+	DirectX::XMFLOAT4 previousRow[3];
+	unsigned int materialIndex;
+	unsigned int flags;
+	unsigned int padding[2];
+};
+
+// A material for the hit shaders: its color and, if it has one, its
+// albedo texture (an index into the CBV/SRV heap) and uv transform
+// Must match the struct in Raytracing.hlsl
+#define RAYTRACING_NO_TEXTURE	0xFFFFFFFF
+struct RaytracingMaterialData {
+	DirectX::XMFLOAT4 color; // Using alpha channel as "roughness"
+	DirectX::XMFLOAT2 uvScale;
+	DirectX::XMFLOAT2 uvOffset;
+	unsigned int albedoTexture;
+	unsigned int padding[3];
+};
@@ -22,13 +22,14 @@ Camera::Camera(
 	aspectRatio(aspectRatio),
 	nearClip(nearClip),
 	farClip(farClip),
-	projectionType(projType),
-	orthographicWidth(2.0f)
+	orthographicWidth(2.0f),
+	projectionType(projType)
 {
 	transform.SetPosition(x, y, z);
 
 	UpdateViewMatrix();
 	UpdateProjectionMatrix(aspectRatio);
+	StorePreviousFrame();
 }
 
 Camera::Camera(
@@ -47,12 +48,14 @@ Camera::Camera(
 	aspectRatio(aspectRatio),
 	nearClip(nearClip),
 	farClip(farClip),
+	orthographicWidth(2.0f),
 	projectionType(projType)
 {
 	transform.SetPosition(position);
 
 	UpdateViewMatrix();
 	UpdateProjectionMatrix(aspectRatio);
+	StorePreviousFrame();
 }
 
 // Nothing to really do
@@ -146,6 +149,12 @@ void Camera::UpdateProjectionMatrix(float aspectRatio)
 
 DirectX::XMFLOAT4X4 Camera::GetView() { return viewMatrix; }
 DirectX::XMFLOAT4X4 Camera::GetProjection() { return projMatrix; }
+DirectX::XMFLOAT4X4 Camera::GetViewProjection()
+{
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, XMMatrixMultiply(XMLoadFloat4x4(&viewMatrix), XMLoadFloat4x4(&projMatrix)));
+	return viewProj;
+}
 Transform* Camera::GetTransform() { return &transform; }
 
 float Camera::GetAspectRatio() { return aspectRatio; }
@@ -184,6 +193,15 @@ void Camera::SetOrthographicWidth(float width)
 	UpdateProjectionMatrix(aspectRatio);
 }
 
+void Camera::StorePreviousFrame()
+{
+	previousViewProjMatrix = GetViewProjection();
+	previousPosition = transform.GetPosition();
+}
+
+DirectX::XMFLOAT4X4 Camera::GetPreviousViewProjection() { return previousViewProjMatrix; }
+DirectX::XMFLOAT3 Camera::GetPreviousPosition() { return previousPosition; }
+
 CameraProjectionType Camera::GetProjectionType() { return projectionType; }
 void Camera::SetProjectionType(CameraProjectionType type)
 {
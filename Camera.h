@@ -42,6 +42,7 @@ public:
 	// Getters
 	DirectX::XMFLOAT4X4 GetView();
 	DirectX::XMFLOAT4X4 GetProjection();
+	DirectX::XMFLOAT4X4 GetViewProjection();
 	Transform* GetTransform();
 	float GetAspectRatio();
 
@@ -66,10 +67,18 @@ public:
 	CameraProjectionType GetProjectionType();
 	void SetProjectionType(CameraProjectionType type);
 
+	// Last frame's camera, for motion vectors
+	// Call StorePreviousFrame() once per frame, before Update()
+	void StorePreviousFrame();
+	DirectX::XMFLOAT4X4 GetPreviousViewProjection();
+	DirectX::XMFLOAT3 GetPreviousPosition();
+
 private:
 	// Camera matrices
 	DirectX::XMFLOAT4X4 viewMatrix;
 	DirectX::XMFLOAT4X4 projMatrix;
+	DirectX::XMFLOAT4X4 previousViewProjMatrix;
+	DirectX::XMFLOAT3 previousPosition;
 
 	Transform transform;
 
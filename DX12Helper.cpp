@@ -2,15 +2,304 @@
 
 #include "WICTextureLoader.h"
 #include "ResourceUploadBatch.h"
+#include "Helpers.h"
+
+#include <dxgi1_4.h>
+#include <cassert>
+#include <chrono>
+#include <stdio.h>
+
 using namespace DirectX;
 
 //declare the singleton
 DX12Helper* DX12Helper::instance;
 
+// --------------------------------------------------------
+// Attached to each placed buffer as private data.  D3D
+// releases it along with the buffer, which is when the
+// buffer's range goes back to its heap's allocator, so
+// callers can keep treating buffers as plain ComPtrs.
+// --------------------------------------------------------
+class PlacedBufferTracker : public IUnknown
+{
+public:
+	PlacedBufferTracker(D3D12_HEAP_TYPE heapType, const HeapAllocation& allocation) :
+		refCount(1), heapType(heapType), allocation(allocation) {}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+	{
+		if (riid == __uuidof(IUnknown))
+		{
+			*object = this;
+			AddRef();
+			return S_OK;
+		}
+		*object = 0;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override { return ++refCount; }
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		ULONG count = --refCount;
+		if (count == 0)
+		{
+			DX12Helper::GetInstance().FreePlacedBuffer(heapType, allocation);
+			delete this;
+		}
+		return count;
+	}
+
+private:
+	ULONG refCount;
+	D3D12_HEAP_TYPE heapType;
+	HeapAllocation allocation;
+};
+
+// Identifies the tracker among a buffer's private data
+static const GUID PlacedBufferTrackerGUID =
+	{ 0x6d1c3b0e, 0x5a4f, 0x4c1e, { 0x9b, 0x2d, 0x71, 0x0e, 0x3a, 0x8f, 0x44, 0xc2 } };
+
 DX12Helper::~DX12Helper() {
 
 }
 
+// --------------------------------------------------------
+// Creates the fence (and the event used to wait on it)
+// --------------------------------------------------------
+void DX12Timeline::Initialize(
+	Microsoft::WRL::ComPtr<ID3D12Device> device,
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue)
+{
+	this->commandQueue = commandQueue;
+	device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(fence.GetAddressOf()));
+	fenceEvent = CreateEventEx(0, 0, 0, EVENT_ALL_ACCESS);
+	fenceCounter = 0;
+}
+
+DX12Timeline::~DX12Timeline()
+{
+	if (fenceEvent)
+		CloseHandle(fenceEvent);
+}
+
+// --------------------------------------------------------
+// Places the next fence value (a unique index for each
+// "stop sign") into the GPU's command queue
+// --------------------------------------------------------
+uint64_t DX12Timeline::Signal()
+{
+	fenceCounter++;
+	commandQueue->Signal(fence.Get(), fenceCounter);
+	return fenceCounter;
+}
+
+uint64_t DX12Timeline::GetCompletedValue()
+{
+	return fence->GetCompletedValue();
+}
+
+// --------------------------------------------------------
+// Sleeps until the GPU reaches a fence value
+// --------------------------------------------------------
+void DX12Timeline::WaitForValue(uint64_t value)
+{
+	// Check to see if the most recently completed fence value
+	// is less than the one we're waiting for
+	if (fence->GetCompletedValue() < value)
+	{
+		// Tell the fence to let us know when it's hit, and then
+		// sit an wait until that fence is hit.
+		fence->SetEventOnCompletion(value, fenceEvent);
+		WaitForSingleObject(fenceEvent, INFINITE);
+	}
+}
+
+// The tracker's states are passed straight through
+static_assert(RESOURCE_STATE_RENDER_TARGET == D3D12_RESOURCE_STATE_RENDER_TARGET, "State values must match D3D12");
+static_assert(RESOURCE_STATE_UNORDERED_ACCESS == D3D12_RESOURCE_STATE_UNORDERED_ACCESS, "State values must match D3D12");
+static_assert(RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE == D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, "State values must match D3D12");
+static_assert(RESOURCE_STATE_COPY_DEST == D3D12_RESOURCE_STATE_COPY_DEST, "State values must match D3D12");
+static_assert(RESOURCE_STATE_COPY_SOURCE == D3D12_RESOURCE_STATE_COPY_SOURCE, "State values must match D3D12");
+static_assert(RESOURCE_STATE_ACCELERATION_STRUCTURE == D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, "State values must match D3D12");
+static_assert(RESOURCE_ALL_SUBRESOURCES == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, "Subresource values must match D3D12");
+
+void DX12BarrierSink::EmitBarriers(const ResourceBarrier* barriers, unsigned int count)
+{
+	d3dBarriers.resize(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		D3D12_RESOURCE_BARRIER& rb = d3dBarriers[i];
+		rb = {};
+		rb.Flags =
+			barriers[i].Split == RESOURCE_BARRIER_SPLIT_BEGIN ? D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY :
+			barriers[i].Split == RESOURCE_BARRIER_SPLIT_END ? D3D12_RESOURCE_BARRIER_FLAG_END_ONLY :
+			D3D12_RESOURCE_BARRIER_FLAG_NONE;
+
+		if (barriers[i].Type == RESOURCE_BARRIER_UAV)
+		{
+			rb.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+			rb.UAV.pResource = (ID3D12Resource*)barriers[i].Resource;
+		}
+		else if (barriers[i].Type == RESOURCE_BARRIER_ALIASING)
+		{
+			rb.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
+			rb.Aliasing.pResourceBefore = (ID3D12Resource*)barriers[i].ResourceBefore;
+			rb.Aliasing.pResourceAfter = (ID3D12Resource*)barriers[i].Resource;
+		}
+		else
+		{
+			rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+			rb.Transition.pResource = (ID3D12Resource*)barriers[i].Resource;
+			rb.Transition.Subresource = barriers[i].Subresource;
+			rb.Transition.StateBefore = (D3D12_RESOURCE_STATES)barriers[i].Before;
+			rb.Transition.StateAfter = (D3D12_RESOURCE_STATES)barriers[i].After;
+		}
+	}
+	commandList->ResourceBarrier(count, d3dBarriers.data());
+}
+
+// --------------------------------------------------------
+// Upload buffers come from the helper (so most are placed
+// in the shared upload heaps) and are mapped for good
+// --------------------------------------------------------
+void* DX12StagingMemory::CreateBuffer(uint64_t size, unsigned int& buffer)
+{
+	buffer = 0;
+	while (buffer < buffers.size() && buffers[buffer])
+		buffer++;
+	if (buffer == buffers.size())
+		buffers.emplace_back();
+
+	buffers[buffer] = DX12Helper::GetInstance().CreateBuffer(
+		size,
+		D3D12_HEAP_TYPE_UPLOAD,
+		D3D12_RESOURCE_STATE_GENERIC_READ);
+
+	// We never read from it on the CPU
+	void* address = 0;
+	D3D12_RANGE range{ 0, 0 };
+	buffers[buffer]->Map(0, &range, &address);
+	return address;
+}
+
+void DX12StagingMemory::ReleaseBuffer(unsigned int buffer)
+{
+	if (buffer < buffers.size())
+		buffers[buffer].Reset();
+}
+
+void DX12RenderGraphBackend::Initialize(
+	Microsoft::WRL::ComPtr<ID3D12Device> device,
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList)
+{
+	this->device = device;
+	this->commandList = commandList;
+}
+
+D3D12_RESOURCE_DESC DX12RenderGraphBackend::GetResourceDesc(const RenderGraphResourceDesc& desc)
+{
+	D3D12_RESOURCE_DESC resourceDesc = {};
+	resourceDesc.DepthOrArraySize = 1;
+	resourceDesc.MipLevels = 1;
+	resourceDesc.SampleDesc.Count = 1;
+	resourceDesc.Width = desc.Width;
+	if (desc.Type == RENDER_GRAPH_BUFFER)
+	{
+		resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		resourceDesc.Height = 1;
+		resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+		resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	}
+	else
+	{
+		resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+		resourceDesc.Height = desc.Height;
+		resourceDesc.Format = (DXGI_FORMAT)desc.Format;
+		resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	}
+
+	if (desc.Flags & RENDER_GRAPH_FLAG_UNORDERED_ACCESS)
+		resourceDesc.Flags |= D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+	if (desc.Flags & RENDER_GRAPH_FLAG_RENDER_TARGET)
+		resourceDesc.Flags |= D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+	return resourceDesc;
+}
+
+void DX12RenderGraphBackend::GetAllocationInfo(const RenderGraphResourceDesc& desc, uint64_t& size, uint64_t& alignment)
+{
+	D3D12_RESOURCE_DESC resourceDesc = GetResourceDesc(desc);
+	D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &resourceDesc);
+	size = info.SizeInBytes;
+	alignment = info.Alignment;
+}
+
+// --------------------------------------------------------
+// Heaps only hold one kind of resource each, which every
+// resource heap tier allows
+// --------------------------------------------------------
+void DX12RenderGraphBackend::CreateHeap(RenderGraphHeapKind kind, uint64_t size)
+{
+	const D3D12_HEAP_FLAGS kindFlags[] = {
+		D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
+		D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES,
+		D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES };
+
+	D3D12_HEAP_DESC heapDesc = {};
+	heapDesc.SizeInBytes = size;
+	heapDesc.Properties.Type = D3D12_HEAP_TYPE_DEFAULT;
+	heapDesc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	heapDesc.Flags = kindFlags[kind];
+	device->CreateHeap(&heapDesc, IID_PPV_ARGS(heaps[kind].ReleaseAndGetAddressOf()));
+}
+
+void* DX12RenderGraphBackend::CreatePlacedResource(const RenderGraphResourceDesc& desc, RenderGraphHeapKind kind, uint64_t offset, ResourceStates initialState)
+{
+	D3D12_RESOURCE_DESC resourceDesc = GetResourceDesc(desc);
+	Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+	device->CreatePlacedResource(
+		heaps[kind].Get(),
+		offset,
+		&resourceDesc,
+		(D3D12_RESOURCE_STATES)initialState,
+		0,
+		IID_PPV_ARGS(resource.GetAddressOf()));
+
+	resources.push_back(resource);
+	return resource.Get();
+}
+
+// --------------------------------------------------------
+// Happens when the graph's layout changes (a resize, a pass
+// added or removed).  Earlier frames may still be using the
+// old placements, so they're released once those finish.
+// --------------------------------------------------------
+void DX12RenderGraphBackend::ReleaseAll()
+{
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	for (Microsoft::WRL::ComPtr<ID3D12Resource>& resource : resources)
+		dx12Helper.DeferRelease(resource);
+	resources.clear();
+	for (Microsoft::WRL::ComPtr<ID3D12Heap>& heap : heaps)
+	{
+		if (heap)
+			dx12Helper.DeferRelease(heap);
+		heap.Reset();
+	}
+}
+
+// --------------------------------------------------------
+// Whatever the memory held belonged to another resource.
+// Textures can only be discarded as render targets or UAVs.
+// --------------------------------------------------------
+void DX12RenderGraphBackend::BeginLifetime(void* resource)
+{
+	ResourceStates state = DX12Helper::GetInstance().GetResourceStates().GetState(resource);
+	if (state == D3D12_RESOURCE_STATE_RENDER_TARGET || state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+		commandList->DiscardResource((ID3D12Resource*)resource, 0);
+}
+
 // --------------------------------------------------------
 // Sets up the helper with required DX12 objects
 // --------------------------------------------------------
@@ -24,32 +313,100 @@ void DX12Helper::Initialize(
 	this->device = device;
 	this->commandList = commandList;
 	this->commandQueue = commandQueue;
-	this->commandAllocator = commandAllocator;
-	// Create the fence for basic synchronization
-	device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(waitFence.GetAddressOf()));
-	waitFenceEvent = CreateEventEx(0, 0, 0, EVENT_ALL_ACCESS);
-	waitFenceCounter = 0;
+	// The given allocator (which the list was created with) is the
+	// first frame's, and each other frame in flight gets its own
+	commandAllocators[0] = commandAllocator;
+	for (unsigned int i = 1; i < FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		device->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(commandAllocators[i].GetAddressOf()));
+	}
+	// Create the fence for synchronization, starting with two frames in flight
+	timeline.Initialize(device, commandQueue);
+	frameScheduler.Initialize(&timeline, 2);
+	deferredReleases.Initialize(&timeline);
+	barrierSink.Initialize(commandList);
+	resourceStates.Initialize(&barrierSink);
+	renderGraphBackend.Initialize(device, commandList);
+
+	// Constant buffer space is handed out per frame and reclaimed as frames finish
+	cbUploadRing.Initialize(&timeline, (uint64_t)maxConstantBuffers * 256, true);
+	cbvDescriptorRing.Initialize(&timeline, maxConstantBuffers, false);
+	srvUavAllocator.Initialize(&timeline, maxTextureDescriptors);
+
+	// Buffer heaps are created as the allocators need them
+	const D3D12_HEAP_TYPE bufferHeapTypes[] = { D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_TYPE_READBACK };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		bufferHeapPools[i].Type = bufferHeapTypes[i];
+		bufferHeapPools[i].Allocator.Initialize(&timeline, bufferHeapBlockSize);
+	}
+
+	// Staging space is reused per submission rather than per frame
+	stagingRing.Initialize(&timeline, &stagingMemory, stagingRingSize, stagingDedicatedThreshold);
+
+	// Textures load in batches, with their SRVs in shared CPU-side heaps
+	loadedTextureCount = 0;
+	cpuSideTextureDescriptorsUsed = 0;
+	textureDescriptorVersion = 0;
+	textureResidency.SetUploadLimit(textureUploadLimit);
 
 	CreateConstantBufferUploadHeap();
 	CreateCBVSRVDescriptorHeap();
+
+	// Cached pipelines are only good for this adapter and driver version
+	PipelineKeyHasher environment;
+	Microsoft::WRL::ComPtr<IDXGIFactory4> dxgiFactory;
+	Microsoft::WRL::ComPtr<IDXGIAdapter1> adapter;
+	if (SUCCEEDED(CreateDXGIFactory1(IID_PPV_ARGS(dxgiFactory.GetAddressOf()))) &&
+		SUCCEEDED(dxgiFactory->EnumAdapterByLuid(device->GetAdapterLuid(), IID_PPV_ARGS(adapter.GetAddressOf()))))
+	{
+		DXGI_ADAPTER_DESC1 adapterDesc = {};
+		LARGE_INTEGER driverVersion = {};
+		adapter->GetDesc1(&adapterDesc);
+		adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion);
+		environment.AddValue(adapterDesc.VendorId);
+		environment.AddValue(adapterDesc.DeviceId);
+		environment.AddValue(adapterDesc.SubSysId);
+		environment.AddValue(adapterDesc.Revision);
+		environment.AddValue(driverVersion.QuadPart);
+	}
+	pipelineCachePath = FixPath(L"PipelineCache.bin");
+	pipelineCache.Load(pipelineCachePath, environment.GetHash());
+
+	// Finished chains don't depend on the device, just the files
+	textureCacheDirectory = FixPath(L"TextureCache\\");
+	CreateDirectoryW(textureCacheDirectory.c_str(), 0);
+	textureManager.SetCacheDirectory(textureCacheDirectory);
+	textureManager.SetBlockCompression(true, BLOCK_QUALITY_NORMAL);
 }
 // --------------------------------------------------------
 // Closes the current command list and tells the GPU to start executing those commands.
 // We also wait for the GPU to finish this work so we can reset the command allocator
 // (which CANNOT be reset while the GPU is using its commands) and the command list itself.
+// 
+// This is for work that must finish mid-frame (uploads, readbacks, etc.). The end of
+// each frame should use CloseExecuteAndBeginNextFrame() instead, which doesn't wait.
 // --------------------------------------------------------
 void DX12Helper::CloseExecuteAndResetCommandList()
 {
+	// Anything still queued belongs to this list
+	resourceStates.Flush();
 	// Close the current list and execute it as our only list
 	commandList->Close();
 	ID3D12CommandList* lists[] = { commandList.Get() };
 	commandQueue->ExecuteCommandLists(1, lists);
+	// Staging space (and anything released) this list used is free once it's done
+	uint64_t fence = timeline.Signal();
+	stagingRing.EndSubmission(fence);
+	deferredReleases.EndSubmission(fence);
 	// Always wait before reseting command allocator, as it should not
 	// be reset while the GPU is processing a command list
 	// See: https://docs.microsoft.com/en-us/windows/desktop/api/d3d12/nf-d3d12-id3d12commandallocator-reset
 	WaitForGPU();
-	commandAllocator->Reset();
-	commandList->Reset(commandAllocator.Get(), 0);
+	commandAllocators[frameScheduler.GetFrameIndex()]->Reset();
+	commandList->Reset(commandAllocators[frameScheduler.GetFrameIndex()].Get(), 0);
 }
 // --------------------------------------------------------
 // Makes our C++ code wait for the GPU to finish its
@@ -57,156 +414,847 @@ void DX12Helper::CloseExecuteAndResetCommandList()
 // --------------------------------------------------------
 void DX12Helper::WaitForGPU()
 {
-	// Update our ongoing fence value (a unique index for each "stop sign")
-	// and then place that value into the GPU's command queue
-	waitFenceCounter++;
-	commandQueue->Signal(waitFence.Get(), waitFenceCounter);
-	// Check to see if the most recently completed fence value
-	// is less than the one we just set.
-	if (waitFence->GetCompletedValue() < waitFenceCounter)
+	frameScheduler.WaitForIdle();
+	deferredReleases.Retire();
+}
+// --------------------------------------------------------
+// Closes and executes the frame's command list, then resets
+// it with the next frame's allocator.  The CPU only waits
+// here if it's a full set of frames ahead of the GPU, since
+// that's when the next frame's allocator (and any other
+// per-frame resources) might still be in use.
+// --------------------------------------------------------
+void DX12Helper::CloseExecuteAndBeginNextFrame()
+{
+	resourceStates.Flush();
+	commandList->Close();
+	ID3D12CommandList* lists[] = { commandList.Get() };
+	commandQueue->ExecuteCommandLists(1, lists);
+
+	frameScheduler.EndFrame();
+
+	// Everything this frame put in the constant buffer rings is freed once its fence is reached
+	uint64_t frameFence = frameScheduler.GetLastFrameFenceValue();
+	cbUploadRing.EndFrame(frameFence);
+	cbvDescriptorRing.EndFrame(frameFence);
+	srvUavAllocator.EndFrame(frameFence);
+	stagingRing.EndSubmission(frameFence);
+	for (BufferHeapPool& pool : bufferHeapPools)
+		pool.Allocator.EndFrame(frameFence);
+	deferredReleases.EndSubmission(frameFence);
+	deferredReleases.Retire();
+
+	// Safe now that the frame which last used this allocator is done
+	commandAllocators[frameScheduler.GetFrameIndex()]->Reset();
+	commandList->Reset(commandAllocators[frameScheduler.GetFrameIndex()].Get(), 0);
+}
+// --------------------------------------------------------
+// Hashes everything that goes into a graphics pipeline: the
+// description's values (the caller zero-initializes it, so
+// padding is zero too), then what its pointers point to
+// --------------------------------------------------------
+static uint64_t HashGraphicsPipelineDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, uint64_t rootSignatureHash)
+{
+	PipelineKeyHasher hasher;
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC values = desc;
+	values.pRootSignature = 0;
+	values.VS = values.PS = values.DS = values.HS = values.GS = {};
+	values.StreamOutput = {};
+	values.InputLayout = {};
+	values.CachedPSO = {};
+	hasher.AddValue(values);
+	hasher.AddValue(rootSignatureHash);
+
+	const D3D12_SHADER_BYTECODE* stages[] = { &desc.VS, &desc.PS, &desc.DS, &desc.HS, &desc.GS };
+	for (const D3D12_SHADER_BYTECODE* stage : stages)
 	{
-		// Tell the fence to let us know when it's hit, and then
-		// sit an wait until that fence is hit.
-		waitFence->SetEventOnCompletion(waitFenceCounter, waitFenceEvent);
-		WaitForSingleObject(waitFenceEvent, INFINITE);
+		hasher.AddValue(stage->BytecodeLength);
+		hasher.Add(stage->pShaderBytecode, stage->BytecodeLength);
+	}
+
+	for (UINT i = 0; i < desc.InputLayout.NumElements; i++)
+	{
+		const D3D12_INPUT_ELEMENT_DESC& element = desc.InputLayout.pInputElementDescs[i];
+		hasher.AddString(element.SemanticName);
+		hasher.AddValue(element.SemanticIndex);
+		hasher.AddValue(element.Format);
+		hasher.AddValue(element.InputSlot);
+		hasher.AddValue(element.AlignedByteOffset);
+		hasher.AddValue(element.InputSlotClass);
+		hasher.AddValue(element.InstanceDataStepRate);
+	}
+
+	for (UINT i = 0; i < desc.StreamOutput.NumEntries; i++)
+	{
+		const D3D12_SO_DECLARATION_ENTRY& entry = desc.StreamOutput.pSODeclaration[i];
+		hasher.AddValue(entry.Stream);
+		hasher.AddString(entry.SemanticName);
+		hasher.AddValue(entry.SemanticIndex);
+		hasher.AddValue(entry.StartComponent);
+		hasher.AddValue(entry.ComponentCount);
+		hasher.AddValue(entry.OutputSlot);
+	}
+	hasher.Add(desc.StreamOutput.pBufferStrides, sizeof(UINT) * desc.StreamOutput.NumStrides);
+	hasher.AddValue(desc.StreamOutput.RasterizedStream);
+
+	return hasher.GetHash();
+}
+
+// --------------------------------------------------------
+// Tries the cached blob first.  If the driver won't take it
+// (a different driver, or it's otherwise stale) it's dropped
+// and the pipeline is compiled as usual, storing a new blob.
+// --------------------------------------------------------
+Microsoft::WRL::ComPtr<ID3D12PipelineState> DX12Helper::CreateGraphicsPipelineState(
+	const char* name,
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+	uint64_t rootSignatureHash)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	uint64_t key = HashGraphicsPipelineDesc(desc, rootSignatureHash);
+
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
+	bool cacheHit = false;
+	const std::vector<unsigned char>* blob = pipelineCache.Find(key);
+	if (blob)
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC cachedDesc = desc;
+		cachedDesc.CachedPSO.pCachedBlob = blob->data();
+		cachedDesc.CachedPSO.CachedBlobSizeInBytes = blob->size();
+		cacheHit = SUCCEEDED(device->CreateGraphicsPipelineState(&cachedDesc, IID_PPV_ARGS(pipelineState.GetAddressOf())));
+		if (!cacheHit)
+			pipelineCache.Reject(key);
 	}
+
+	if (!cacheHit)
+	{
+		device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(pipelineState.ReleaseAndGetAddressOf()));
+		Microsoft::WRL::ComPtr<ID3DBlob> cachedBlob;
+		if (pipelineState && SUCCEEDED(pipelineState->GetCachedBlob(cachedBlob.GetAddressOf())))
+			pipelineCache.Store(key, cachedBlob->GetBufferPointer(), cachedBlob->GetBufferSize());
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	pipelineCache.AddTiming(name, elapsed.count(), cacheHit);
+	return pipelineState;
+}
+
+void DX12Helper::SavePipelineCache()
+{
+	if (pipelineCache.IsDirty())
+		pipelineCache.Save(pipelineCachePath);
+}
+// --------------------------------------------------------
+// Anything recorded so far may use the object, so it's
+// tagged with the next submission's fence.  Placed buffers
+// give their heap space back when this finally releases
+// them, which then waits on a later frame as usual.
+// --------------------------------------------------------
+void DX12Helper::DeferRelease(Microsoft::WRL::ComPtr<IUnknown> object)
+{
+	if (!object)
+		return;
+	deferredReleases.Enqueue([object]() mutable { object.Reset(); });
+}
+void DX12Helper::CallWhenGPUDone(std::function<void()> callback)
+{
+	deferredReleases.Enqueue(callback);
+}
+// --------------------------------------------------------
+// How many frames the CPU may record before waiting on the
+// GPU (takes effect at the end of the current frame)
+// --------------------------------------------------------
+void DX12Helper::SetFramesInFlight(unsigned int framesInFlight)
+{
+	frameScheduler.SetFramesInFlight(framesInFlight);
 }
 Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> DX12Helper::GetCBVSRVDescriptorHeap()
 {
 	return cbvSrvDescriptorHeap;
 }
 // --------------------------------------------------------
-// Copies the given data into the next "unused" spot in the CBV upload heap (wrapping at the end, since
-// we treat it like a ring buffer). Then creates a CBV in the next "unused" spot in the CBV heap that
-// points to the aforementioned spot in the upload heap and returns that CBV (a GPU descriptor handle).
+// Copies the given data into the next "unused" spot in the CB upload heap, then creates a
+// CBV in the next "unused" spot in the CBV heap that points to the aforementioned spot in
+// the upload heap and returns that CBV (a GPU descriptor handle).
+//
+// Both heaps are rings shared by every frame in flight, and a spot is only reused once the
+// GPU has finished the frame that used it.  CBVs sit in front of the SRVs in the same heap,
+// so their range can't grow: if this frame alone uses every CBV descriptor, nothing is
+// written and a null handle (ptr 0) is returned.  Callers must check for that and bind the
+// data as a root CBV (FillNextConstantBufferAndGetGPUAddress) instead, which is what
+// per-object data should use in the first place.
 //
 // data - The data to copy to the GPU
 // dataSizeInBytes - The byte size of the data to copy
 // --------------------------------------------------------
 D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::FillNextConstantBufferAndGetGPUDescriptorHandle(void* data, unsigned int dataSizeInBytes)
 {
-	// How much space will we need? Each CBV must point to a chunk of the upload heap that is
-	// a multiple of 256 bytes, so we need to calculate and reserve that amount.
-	SIZE_T reservationSize = (SIZE_T)dataSizeInBytes;
-	reservationSize = (reservationSize + 255); // Add 255 so we can drop last few bits
-	reservationSize = reservationSize & ~255; // Flip 255 and then use it to mask
-	// Ensure this upload will fit in the remaining space. If not, reset to beginning.
-	if (cbUploadHeapOffsetInBytes + reservationSize >= cbUploadHeapSizeInBytes)
-		cbUploadHeapOffsetInBytes = 0;
-	// Where in the upload heap will this data go?
-	D3D12_GPU_VIRTUAL_ADDRESS virtualGPUAddress = cbUploadHeap->GetGPUVirtualAddress() + cbUploadHeapOffsetInBytes;
-	// === Copy data to the upload heap ===
-	{
-		// Calculate the actual upload address (which we got from mapping the buffer)
-		// Note that this is different than the GPU virtual address needed for the CBV below
-		void* uploadAddress = reinterpret_cast<void*>(
-			(SIZE_T)cbUploadHeapStartAddress + cbUploadHeapOffsetInBytes);
-		// Perform the mem copy to put new data into this part of the heap
-		memcpy(uploadAddress, data, dataSizeInBytes);
-		// Increment the offset and loop back to the beginning if necessary,
-		// allowing us to treat the upload heap like a ring buffer
-		cbUploadHeapOffsetInBytes += reservationSize;
-		if (cbUploadHeapOffsetInBytes >= cbUploadHeapSizeInBytes)
-			cbUploadHeapOffsetInBytes = 0;
+	// Which descriptor will this be? (may wait for an older frame to free one up)
+	uint64_t descriptorIndex = 0;
+	if (!cbvDescriptorRing.Allocate(1, descriptorIndex))
+	{
+		printf("ERROR: This frame has used all %u CBV descriptors - use root CBVs instead\n", maxConstantBuffers);
+		assert(false && "Out of CBV descriptors");
+		D3D12_GPU_DESCRIPTOR_HANDLE none = {};
+		return none;
 	}
+
+	// Each CBV must point to a chunk of the upload heap that is a multiple of 256 bytes
+	SIZE_T reservationSize = ((SIZE_T)dataSizeInBytes + 255) & ~255;
+	D3D12_GPU_VIRTUAL_ADDRESS virtualGPUAddress = FillNextConstantBufferAndGetGPUAddress(data, dataSizeInBytes);
+
 	// Create a CBV for this section of the heap
 	{
 		// Calculate the CPU and GPU side handles for this descriptor
 		D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = cbvSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
 		D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
-		// Offset each by based on how many descriptors we've used
-		// Note: cbvDescriptorOffset is a COUNT of descriptors, not bytes so we must calculate the size
-		cpuHandle.ptr += (SIZE_T)cbvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
-		gpuHandle.ptr += (SIZE_T)cbvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
+		// Offset each by based on which descriptor we were given
+		// Note: descriptorIndex is a COUNT of descriptors, not bytes so we must calculate the size
+		cpuHandle.ptr += (SIZE_T)descriptorIndex * cbvSrvDescriptorHeapIncrementSize;
+		gpuHandle.ptr += (SIZE_T)descriptorIndex * cbvSrvDescriptorHeapIncrementSize;
 		// Describe the constant buffer view that points to our latest chunk of the CB upload heap
 		D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
 		cbvDesc.BufferLocation = virtualGPUAddress;
 		cbvDesc.SizeInBytes = (UINT)reservationSize;
 		// Create the CBV, which is a lightweight operation in DX12
 		device->CreateConstantBufferView(&cbvDesc, cpuHandle);
-		// Increment the offset and loop back to the beginning if necessary
-		// which allows us to treat the descriptor heap as a ring buffer
-		cbvDescriptorOffset++;
-		if (cbvDescriptorOffset >= maxConstantBuffers)
-			cbvDescriptorOffset = 0;
 		// Now that the CBV is ready, we return the GPU handle to it
 		// so it can be set as part of the root signature during drawing
 		return gpuHandle;
 	}
 }
 
+// --------------------------------------------------------
+// Copies the given data into the next "unused" spot in the CB upload heap and returns its
+// GPU address, for binding as a root CBV (or a shader record's root CBV).  The upload heap
+// is replaced with a larger one if the frames in flight need more space than it has.
+//
+// data - The data to copy to the GPU
+// dataSizeInBytes - The byte size of the data to copy
+// --------------------------------------------------------
+D3D12_GPU_VIRTUAL_ADDRESS DX12Helper::FillNextConstantBufferAndGetGPUAddress(void* data, unsigned int dataSizeInBytes)
+{
+	// How much space will we need? Constant buffers must start on 256 byte
+	// boundaries, so we need to calculate and reserve that amount.
+	SIZE_T reservationSize = (SIZE_T)dataSizeInBytes;
+	reservationSize = (reservationSize + 255); // Add 255 so we can drop last few bits
+	reservationSize = reservationSize & ~255; // Flip 255 and then use it to mask
+	uint64_t offset = 0;
+	cbUploadRing.Allocate(reservationSize, offset);
+	// Did the ring outgrow the heap? The old heap stays alive until the GPU is done with it
+	if (cbUploadRing.GetCapacity() != cbUploadHeapSizeInBytes)
+	{
+		DeferRelease(cbUploadHeap);
+		CreateConstantBufferUploadHeap();
+	}
+	// Calculate the actual upload address (which we got from mapping the buffer)
+	// Note that this is different than the GPU virtual address we return
+	void* uploadAddress = reinterpret_cast<void*>((SIZE_T)cbUploadHeapStartAddress + offset);
+	// Perform the mem copy to put new data into this part of the heap
+	memcpy(uploadAddress, data, dataSizeInBytes);
+	return cbUploadHeap->GetGPUVirtualAddress() + offset;
+}
+
+// --------------------------------------------------------
+// Space in the staging ring (or a buffer of its own, for big
+// uploads and once the command list being recorded has
+// filled the ring).  Never submits, since callers may be
+// partway through recording - with a split barrier open or
+// pipeline state bound that a new list wouldn't have.
+// --------------------------------------------------------
+StagingAllocation DX12Helper::AllocateStaging(UINT64 size, UINT64 alignment)
+{
+	return stagingRing.Allocate(size, alignment);
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS DX12Helper::GetStagingGPUAddress(const StagingAllocation& allocation)
+{
+	ID3D12Resource* resource = stagingMemory.GetResource(allocation.Buffer);
+	return resource ? resource->GetGPUVirtualAddress() + allocation.Offset : 0;
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS DX12Helper::StageData(const void* data, UINT64 size, UINT64 alignment)
+{
+	StagingAllocation allocation = AllocateStaging(size, alignment);
+	if (!allocation.IsValid())
+		return 0;
+
+	memcpy(allocation.CPUAddress, data, (size_t)size);
+	return GetStagingGPUAddress(allocation);
+}
+
+void DX12Helper::UploadBufferData(ID3D12Resource* destination, UINT64 destinationOffset, const void* data, UINT64 size)
+{
+	StagingAllocation allocation = AllocateStaging(size);
+	if (!allocation.IsValid())
+		return;
+
+	memcpy(allocation.CPUAddress, data, (size_t)size);
+	commandList->CopyBufferRegion(
+		destination,
+		destinationOffset,
+		stagingMemory.GetResource(allocation.Buffer),
+		allocation.Offset,
+		size);
+}
+
+// --------------------------------------------------------
+// Lays the rows out the way the copy needs them (each row
+// pitch aligned to 256 bytes, the start to 512)
+// --------------------------------------------------------
+void DX12Helper::UploadTextureSubresource(ID3D12Resource* texture, UINT subresource, const D3D12_SUBRESOURCE_DATA& data)
+{
+	D3D12_RESOURCE_DESC desc = texture->GetDesc();
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
+	UINT rowCount = 0;
+	UINT64 rowSize = 0;
+	UINT64 totalSize = 0;
+	device->GetCopyableFootprints(&desc, subresource, 1, 0, &footprint, &rowCount, &rowSize, &totalSize);
+
+	StagingAllocation allocation = AllocateStaging(totalSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+	if (!allocation.IsValid())
+		return;
+
+	// Copy row by row, since the pitches differ
+	for (UINT slice = 0; slice < footprint.Footprint.Depth; slice++)
+	{
+		unsigned char* destSlice = (unsigned char*)allocation.CPUAddress + (SIZE_T)footprint.Footprint.RowPitch * rowCount * slice;
+		const unsigned char* sourceSlice = (const unsigned char*)data.pData + (SIZE_T)data.SlicePitch * slice;
+		for (UINT row = 0; row < rowCount; row++)
+		{
+			memcpy(
+				destSlice + (SIZE_T)footprint.Footprint.RowPitch * row,
+				sourceSlice + (SIZE_T)data.RowPitch * row,
+				(size_t)rowSize);
+		}
+	}
+
+	D3D12_TEXTURE_COPY_LOCATION destination = {};
+	destination.pResource = texture;
+	destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+	destination.SubresourceIndex = subresource;
+
+	D3D12_TEXTURE_COPY_LOCATION source = {};
+	source.pResource = stagingMemory.GetResource(allocation.Buffer);
+	source.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+	source.PlacedFootprint = footprint;
+	source.PlacedFootprint.Offset = allocation.Offset;
+
+	commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, 0);
+}
+
+// --------------------------------------------------------
+// Requests the file and returns its SRV's CPU handle, which
+// is the same for every request of the same path.  Nothing
+// is read until FinishTextureLoads().
+// --------------------------------------------------------
 D3D12_CPU_DESCRIPTOR_HANDLE DX12Helper::LoadTexture(const wchar_t* file, bool generateMips)
 {
-	// Helper function from DXTK for uploading a resource
-	// (like a texture) to the appropriate GPU memory
-	ResourceUploadBatch upload(device.Get());
-	upload.Begin();
-	// Attempt to create the texture
-	Microsoft::WRL::ComPtr<ID3D12Resource> texture;
-	CreateWICTextureFromFile(device.Get(), upload, file, texture.GetAddressOf(), generateMips);
-	// Perform the upload and wait for it to finish before returning the texture
-	auto finish = upload.End(commandQueue.Get());
-	finish.wait();
-	// Now that we have the texture, add to our list and make a CPU-side descriptor heap
-	// just for this texture's SRV. Note that it would probably be better to put all
-	// texture SRVs into the same descriptor heap, but we don't know how many we'll need
-	// until they're all loaded and this is a quick and dirty implementation!
-	textures.push_back(texture);
-	// Create the CPU-SIDE descriptor heap for our descriptor
-	D3D12_DESCRIPTOR_HEAP_DESC dhDesc = {};
-	dhDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE; // Non-shader visible for CPU-side-only desc heap
-	dhDesc.NodeMask = 0;
-	dhDesc.NumDescriptors = 1;
-	dhDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descHeap;
-	device->CreateDescriptorHeap(&dhDesc, IID_PPV_ARGS(descHeap.GetAddressOf()));
-	cpuSideTextureDescriptorHeaps.push_back(descHeap);
-	// Create the SRV on this descriptor heap
-	// Note: Using a null description results in the "default" SRV (same format, all mips, all array slices, etc.)
-	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = descHeap->GetCPUDescriptorHandleForHeapStart();
-	device->CreateShaderResourceView(texture.Get(), 0, cpuHandle);
-	// Return the CPU descriptor handle, which can be used to
-	// copy the descriptor to a shader-visible heap later
-	return cpuHandle;
+	unsigned int texture = textureManager.Request(file, generateMips);
+	if (texture == textureDescriptors.size())
+	{
+		textures.push_back(nullptr);
+		textureDescriptors.push_back(AllocateTextureDescriptor());
+	}
+
+	return textureDescriptors[texture];
+}
+
+// --------------------------------------------------------
+// Decodes everything requested (with mip chains) on the
+// job system, then stages every level of each distinct
+// texture into the current command list.  Nothing waits
+// here, unless WIC had to load something and DXTK has to
+// make its mips.
+// --------------------------------------------------------
+void DX12Helper::FinishTextureLoads()
+{
+	if (!textureManager.HasPending())
+		return;
+
+	textureManager.LoadPending();
+
+	// Only WIC's textures still need mips made on the GPU
+	unsigned int textureCount = textureManager.GetTextureCount();
+	std::vector<ID3D12Resource*> mipTextures;
+	for (unsigned int i = loadedTextureCount; i < textureCount; i++)
+	{
+		unsigned int owner = textureManager.GetContentOwner(i);
+		if (owner == i)
+		{
+			textures[i] = CreateTexture(i);
+			if (textures[i] && textureManager.GetState(i) == TEXTURE_LOAD_UNDECODED && textures[i]->GetDesc().MipLevels > 1)
+				mipTextures.push_back(textures[i].Get());
+
+			// Nothing's mid-recording here, so submit rather than let a
+			// big load spill past the ring into buffers of their own
+			if (stagingRing.IsOverflowing())
+				CloseExecuteAndResetCommandList();
+		}
+
+		// Textures that failed get a null SRV, so copying it is still safe
+		// Note: Using a null description results in the "default" SRV (same format, all mips, all array slices, etc.)
+		ID3D12Resource* resource = textures[owner].Get();
+		D3D12_SHADER_RESOURCE_VIEW_DESC nullDesc = {};
+		nullDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		nullDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		nullDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		nullDesc.Texture2D.MipLevels = 1;
+		device->CreateShaderResourceView(resource, resource ? 0 : &nullDesc, textureDescriptors[i]);
+	}
+	loadedTextureCount = textureCount;
+
+	if (!mipTextures.empty())
+	{
+		// The top mips have to be there before DXTK's own list runs
+		CloseExecuteAndResetCommandList();
+		ResourceUploadBatch upload(device.Get());
+		upload.Begin();
+		for (ID3D12Resource* texture : mipTextures)
+			upload.GenerateMips(texture);
+		auto finish = upload.End(commandQueue.Get());
+		finish.wait();
+	}
+}
+
+// --------------------------------------------------------
+// Creates a texture for a decoded (or block compressed)
+// image and stages each of its levels, leaving it ready
+// for pixel shaders.  Mapped chains with mips only get
+// their tail here; the rest streams in later.  Files the
+// PNG decoder can't read are decoded by WIC here instead
+// (with mips generated by DXTK, which waits).
+// --------------------------------------------------------
+Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateTexture(unsigned int texture)
+{
+	Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+	const std::wstring& path = textureManager.GetPath(texture);
+	bool generateMips = textureManager.GetGenerateMips(texture);
+	std::unique_ptr<uint8_t[]> decodedData;
+	std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+	unsigned int topLevel = 0;
+	TextureLevel level = {};
+	if (textureManager.GetLevel(texture, 0, level))
+	{
+		// Block compressed resources need their top level to be whole blocks,
+		// so streaming can only stop at levels that are
+		unsigned int levelCount = textureManager.GetLevelCount(texture);
+		std::vector<uint64_t> levelBytes;
+		unsigned int lowestTop = 0;
+		for (unsigned int i = 0; textureManager.GetLevel(texture, i, level); i++)
+		{
+			levelBytes.push_back(level.Size);
+			bool wholeBlocks = level.Width % 4 == 0 && level.Height % 4 == 0;
+			if (lowestTop + 1 == i && (textureManager.GetFormat(texture) == BLOCK_FORMAT_NONE || wholeBlocks))
+				lowestTop = i;
+		}
+		if (textureManager.IsMapped(texture) && levelCount > 1)
+		{
+			unsigned int tail = MipResidency::GetTailLevel(levelBytes);
+			topLevel = tail < lowestTop ? tail : lowestTop;
+		}
+
+		resource = CreateTextureResource(texture, topLevel);
+		if (resource && topLevel > 0)
+		{
+			textureResidency.AddTexture(levelBytes, topLevel);
+			streamedTextures.push_back(texture);
+		}
+		for (unsigned int i = topLevel; i < levelCount && resource; i++)
+		{
+			textureManager.GetLevel(texture, i, level);
+			D3D12_SUBRESOURCE_DATA subresource = {};
+			subresource.pData = level.Data;
+			subresource.RowPitch = (LONG_PTR)level.RowPitch;
+			subresource.SlicePitch = (LONG_PTR)level.Size;
+			subresources.push_back(subresource);
+		}
+	}
+	else if (textureManager.GetState(texture) == TEXTURE_LOAD_UNDECODED)
+	{
+		D3D12_SUBRESOURCE_DATA subresource = {};
+		LoadWICTextureFromFileEx(
+			device.Get(),
+			path.c_str(),
+			0,
+			D3D12_RESOURCE_FLAG_NONE,
+			generateMips ? WIC_LOADER_MIP_AUTOGEN : WIC_LOADER_DEFAULT,
+			resource.GetAddressOf(),
+			decodedData,
+			subresource);
+		subresources.push_back(subresource);
+	}
+	if (!resource)
+	{
+		printf("ERROR: Couldn't load texture %ls\n", path.c_str());
+		return nullptr;
+	}
+
+	// Staging has its own copy, so the decoded pixels can go (mapped
+	// levels stay readable for streaming).  Smallest levels go first.
+	for (UINT i = (UINT)subresources.size(); i-- > 0;)
+		UploadTextureSubresource(resource.Get(), i, subresources[i]);
+	textureManager.ReleaseImage(texture);
 
+	D3D12_RESOURCE_BARRIER rb = {};
+	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+	rb.Transition.pResource = resource.Get();
+	rb.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+	rb.Transition.StateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+	rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	commandList->ResourceBarrier(1, &rb);
+	return resource;
 }
 
+// Blocks, or one or four 8 bit channels
+static DXGI_FORMAT GetTextureFormat(BlockFormat format, unsigned int channels)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1: return DXGI_FORMAT_BC1_UNORM;
+	case BLOCK_FORMAT_BC4: return DXGI_FORMAT_BC4_UNORM;
+	case BLOCK_FORMAT_BC5: return DXGI_FORMAT_BC5_UNORM;
+	case BLOCK_FORMAT_BC7: return DXGI_FORMAT_BC7_UNORM;
+	default: return channels == 1 ? DXGI_FORMAT_R8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+// --------------------------------------------------------
+// A texture's resource, from the given level down, in the
+// copy dest state
+// --------------------------------------------------------
+Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateTextureResource(unsigned int texture, unsigned int topLevel)
+{
+	Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+	TextureLevel level = {};
+	if (!textureManager.GetLevel(texture, topLevel, level))
+		return resource;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	desc.Width = level.Width;
+	desc.Height = level.Height;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = (UINT16)(textureManager.GetLevelCount(texture) - topLevel);
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = D3D12_RESOURCE_FLAG_NONE;
+	desc.Format = GetTextureFormat(textureManager.GetFormat(texture), textureManager.GetChannels(texture));
+
+	D3D12_HEAP_PROPERTIES heapProps = {};
+	heapProps.Type = D3D12_HEAP_TYPE_DEFAULT;
+	device->CreateCommittedResource(
+		&heapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		0,
+		IID_PPV_ARGS(resource.GetAddressOf()));
+	return resource;
+}
+
+
+// --------------------------------------------------------
+// Makes a texture from levels built on the CPU, compressed
+// here if asked (and the top level is whole blocks), and
+// stages every level.  Its SRV gets a CPU-side descriptor
+// of its own.
+// --------------------------------------------------------
+D3D12_CPU_DESCRIPTOR_HANDLE DX12Helper::CreateTextureFromLevels(const std::vector<DecodedImage>& levels, BlockFormat format)
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE srv = AllocateTextureDescriptor();
+	if (levels.empty())
+		return srv;
+
+	std::vector<CompressedImage> compressed;
+	if (format != BLOCK_FORMAT_NONE && BlockCompressor::CanCompress(levels[0]))
+	{
+		compressed.resize(levels.size());
+		for (size_t i = 0; i < levels.size(); i++)
+			BlockCompressor::Compress(levels[i], format, BLOCK_QUALITY_NORMAL, compressed[i]);
+	}
+	else
+		format = BLOCK_FORMAT_NONE;
+
+	D3D12_RESOURCE_DESC desc = {};
+	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	desc.Width = levels[0].Width;
+	desc.Height = levels[0].Height;
+	desc.DepthOrArraySize = 1;
+	desc.MipLevels = (UINT16)levels.size();
+	desc.SampleDesc.Count = 1;
+	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	desc.Flags = D3D12_RESOURCE_FLAG_NONE;
+	desc.Format = GetTextureFormat(format, levels[0].Channels);
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+	D3D12_HEAP_PROPERTIES heapProps = {};
+	heapProps.Type = D3D12_HEAP_TYPE_DEFAULT;
+	device->CreateCommittedResource(
+		&heapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		0,
+		IID_PPV_ARGS(resource.GetAddressOf()));
+	if (!resource)
+	{
+		printf("ERROR: Couldn't create a %ux%u texture\n", levels[0].Width, levels[0].Height);
+		return srv;
+	}
+
+	for (UINT i = (UINT)levels.size(); i-- > 0;)
+	{
+		D3D12_SUBRESOURCE_DATA subresource = {};
+		if (format != BLOCK_FORMAT_NONE)
+		{
+			subresource.pData = compressed[i].Blocks.data();
+			subresource.RowPitch = (LONG_PTR)((compressed[i].Width + 3) / 4 * BlockCompressor::GetBlockBytes(format));
+			subresource.SlicePitch = (LONG_PTR)compressed[i].Blocks.size();
+		}
+		else
+		{
+			subresource.pData = levels[i].Pixels.data();
+			subresource.RowPitch = (LONG_PTR)levels[i].Width * levels[i].Channels;
+			subresource.SlicePitch = (LONG_PTR)levels[i].Pixels.size();
+		}
+		UploadTextureSubresource(resource.Get(), i, subresource);
+	}
+
+	D3D12_RESOURCE_BARRIER rb = {};
+	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+	rb.Transition.pResource = resource.Get();
+	rb.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+	rb.Transition.StateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+	rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	commandList->ResourceBarrier(1, &rb);
+
+	device->CreateShaderResourceView(resource.Get(), 0, srv);
+	generatedTextures.push_back(resource);
+	return srv;
+}
+
+
+// --------------------------------------------------------
+// Swaps each texture whose resident levels changed for a
+// new resource holding just those levels.  Levels both
+// have are copied on the GPU, new ones are uploaded from
+// the mapped container, and the old resource goes once
+// the GPU is done with it.
+// --------------------------------------------------------
+void DX12Helper::StreamTextures()
+{
+	if (streamedTextures.empty())
+		return;
+
+	std::vector<MipResidencyChange> changes;
+	textureResidency.Update(changes);
+	for (const MipResidencyChange& change : changes)
+	{
+		unsigned int texture = streamedTextures[change.Texture];
+		Microsoft::WRL::ComPtr<ID3D12Resource> previous = textures[texture];
+		Microsoft::WRL::ComPtr<ID3D12Resource> resource = CreateTextureResource(texture, change.ToLevel);
+		if (!resource)
+			continue;
+
+		D3D12_RESOURCE_BARRIER rb = {};
+		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+		rb.Transition.pResource = previous.Get();
+		rb.Transition.StateBefore = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+		commandList->ResourceBarrier(1, &rb);
+
+		unsigned int levelCount = textureManager.GetLevelCount(texture);
+		unsigned int firstShared = change.FromLevel > change.ToLevel ? change.FromLevel : change.ToLevel;
+		for (unsigned int level = firstShared; level < levelCount; level++)
+		{
+			D3D12_TEXTURE_COPY_LOCATION destination = {};
+			destination.pResource = resource.Get();
+			destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			destination.SubresourceIndex = level - change.ToLevel;
+
+			D3D12_TEXTURE_COPY_LOCATION source = {};
+			source.pResource = previous.Get();
+			source.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			source.SubresourceIndex = level - change.FromLevel;
+			commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, 0);
+		}
+
+		TextureLevel data = {};
+		for (unsigned int level = firstShared; level-- > change.ToLevel;)
+		{
+			textureManager.GetLevel(texture, level, data);
+			D3D12_SUBRESOURCE_DATA subresource = {};
+			subresource.pData = data.Data;
+			subresource.RowPitch = (LONG_PTR)data.RowPitch;
+			subresource.SlicePitch = (LONG_PTR)data.Size;
+			UploadTextureSubresource(resource.Get(), level - change.ToLevel, subresource);
+		}
+
+		rb.Transition.pResource = resource.Get();
+		rb.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+		commandList->ResourceBarrier(1, &rb);
+
+		// Every path sharing these contents sees the new levels
+		DeferRelease(previous);
+		textures[texture] = resource;
+		for (unsigned int i = 0; i < loadedTextureCount; i++)
+		{
+			if (textureManager.GetContentOwner(i) == texture)
+				device->CreateShaderResourceView(resource.Get(), 0, textureDescriptors[i]);
+		}
+	}
+
+	if (!changes.empty())
+		textureDescriptorVersion++;
+}
+
+// --------------------------------------------------------
+// Next slot in the shared CPU-side texture heaps, starting
+// a new heap when the last one is full
+// --------------------------------------------------------
+D3D12_CPU_DESCRIPTOR_HANDLE DX12Helper::AllocateTextureDescriptor()
+{
+	if (cpuSideTextureDescriptorHeaps.empty() || cpuSideTextureDescriptorsUsed == textureDescriptorsPerHeap)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC dhDesc = {};
+		dhDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE; // Non-shader visible for CPU-side-only desc heap
+		dhDesc.NodeMask = 0;
+		dhDesc.NumDescriptors = textureDescriptorsPerHeap;
+		dhDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descHeap;
+		device->CreateDescriptorHeap(&dhDesc, IID_PPV_ARGS(descHeap.GetAddressOf()));
+		cpuSideTextureDescriptorHeaps.push_back(descHeap);
+		cpuSideTextureDescriptorsUsed = 0;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE handle = cpuSideTextureDescriptorHeaps.back()->GetCPUDescriptorHandleForHeapStart();
+	handle.ptr += (SIZE_T)cpuSideTextureDescriptorsUsed * cbvSrvDescriptorHeapIncrementSize;
+	cpuSideTextureDescriptorsUsed++;
+	return handle;
+}
+
+// --------------------------------------------------------
+// Copies descriptors into a newly allocated range of the
+// SRV/UAV section and returns the GPU handle to its start.
+// The range is never freed, so this is for things that
+// live as long as the program.
+// --------------------------------------------------------
 D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy, unsigned int numDescriptorsToCopy)
 {
-	// Grab the actual heap start on both sides and offset to the next open SRV portion
-	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle =
-		cbvSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
-	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle =
-		cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
-	cpuHandle.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
-	gpuHandle.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
-	// We know where to copy these descriptors, so copy all of them and remember the new offset
+	DescriptorHandle range = AllocateSrvUavDescriptors(numDescriptorsToCopy);
+	if (!range.IsValid())
+		return {};
+
+	CopyDescriptorsToSrvUavRange(range, 0, firstDescriptorToCopy, numDescriptorsToCopy);
+	// Pass back the GPU handle to the start of this section
+	// in the final CBV/SRV heap so the caller can use it later
+	return GetSrvUavGPUHandle(range);
+}
+
+// --------------------------------------------------------
+// Contiguous range in the SRV/UAV section.  Prints an error
+// and returns an invalid handle if there's no room.
+// --------------------------------------------------------
+DescriptorHandle DX12Helper::AllocateSrvUavDescriptors(unsigned int count)
+{
+	DescriptorHandle handle = srvUavAllocator.Allocate(count);
+	if (!handle.IsValid())
+	{
+		DescriptorAllocatorStats stats = srvUavAllocator.GetStats();
+		printf("ERROR: Out of SRV/UAV descriptors (wanted %u in a row, largest free range is %u of %u)\n",
+			count, stats.LargestFreeRange, stats.Capacity);
+	}
+	return handle;
+}
+
+// --------------------------------------------------------
+// The handle is invalidated now, and its slots are reused
+// once the current frame is done on the GPU
+// --------------------------------------------------------
+void DX12Helper::FreeSrvUavDescriptors(DescriptorHandle& handle)
+{
+	if (!handle.IsValid())
+		return;
+
+	if (!srvUavAllocator.Validate(handle))
+	{
+		printf("ERROR: Freeing SRV/UAV descriptors %u-%u that were already freed\n",
+			handle.Index, handle.Index + handle.Count - 1);
+		return;
+	}
+	srvUavAllocator.Free(handle);
+}
+
+// --------------------------------------------------------
+// Copies descriptors (usually from a CPU-side heap) into
+// part of an allocated range
+// --------------------------------------------------------
+void DX12Helper::CopyDescriptorsToSrvUavRange(const DescriptorHandle& destination, unsigned int offset, D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy, unsigned int numDescriptorsToCopy)
+{
+	if (offset + numDescriptorsToCopy > destination.Count)
+		return;
+
+	// Texture SRVs aren't written until their textures load
+	FinishTextureLoads();
+
 	device->CopyDescriptorsSimple(
 		numDescriptorsToCopy,
-		cpuHandle,
+		GetSrvUavCPUHandle(destination, offset),
 		firstDescriptorToCopy,
 		D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-	srvDescriptorOffset += numDescriptorsToCopy;
-	// Pass back the GPU handle to the start of this section
-	// in the final CBV/SRV heap so the caller can use it later
+}
+
+// --------------------------------------------------------
+// Heap handles for a descriptor within an allocated range.
+// Stale handles are reported (they point at slots that may
+// belong to something else by now).
+// --------------------------------------------------------
+D3D12_CPU_DESCRIPTOR_HANDLE DX12Helper::GetSrvUavCPUHandle(const DescriptorHandle& handle, unsigned int offset)
+{
+	if (!srvUavAllocator.Validate(handle))
+		printf("ERROR: Using stale SRV/UAV descriptor handle (slot %u)\n", handle.Index);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = cbvSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+	cpuHandle.ptr += (SIZE_T)(srvDescriptorOffset + handle.Index + offset) * cbvSrvDescriptorHeapIncrementSize;
+	return cpuHandle;
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE DX12Helper::GetSrvUavGPUHandle(const DescriptorHandle& handle, unsigned int offset)
+{
+	if (!srvUavAllocator.Validate(handle))
+		printf("ERROR: Using stale SRV/UAV descriptor handle (slot %u)\n", handle.Index);
+
+	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+	gpuHandle.ptr += (SIZE_T)(srvDescriptorOffset + handle.Index + offset) * cbvSrvDescriptorHeapIncrementSize;
 	return gpuHandle;
 }
 
+unsigned int DX12Helper::GetCBVSRVDescriptorIndex(D3D12_GPU_DESCRIPTOR_HANDLE handle)
+{
+	D3D12_GPU_DESCRIPTOR_HANDLE heapStart = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+	return (unsigned int)((handle.ptr - heapStart.ptr) / cbvSrvDescriptorHeapIncrementSize);
+}
+
 // --------------------------------------------------------
 // Creates a single CB upload heap which will store all
 // constant buffer data for the entire program. This
 // heap is treated as a ring buffer, allowing the program
 // to continually re-use the memory as frames progress.
+// Called again (with a bigger size) if the ring grows.
 // --------------------------------------------------------
 void DX12Helper::CreateConstantBufferUploadHeap()
 {
 	// This heap MUST have a size that is a multiple of 256
-	// We'll support up to the max number of CBs if they're
-	// all 256 bytes or less, or fewer overall CBs if they're larger
-	cbUploadHeapSizeInBytes = maxConstantBuffers * 256;
-	// Assume the first CB will start at the beginning of the heap
-	// This offset changes as we use more CBs, and wraps around when full
-	cbUploadHeapOffsetInBytes = 0;
+	// The ring starts with room for the max number of CBs if
+	// they're all 256 bytes or less, and only ever doubles
+	cbUploadHeapSizeInBytes = cbUploadRing.GetCapacity();
 	// Create the upload heap for our constant buffer
 	D3D12_HEAP_PROPERTIES heapProps = {};
 	heapProps.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
@@ -259,16 +1307,15 @@ void DX12Helper::CreateCBVSRVDescriptorHeap()
 	dhDesc.NumDescriptors = maxConstantBuffers + maxTextureDescriptors; // How many descriptors will we need?
 	dhDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV; // This heap can store CBVs, SRVs and UAVs
 	device->CreateDescriptorHeap(&dhDesc, IID_PPV_ARGS(cbvSrvDescriptorHeap.GetAddressOf()));
-	// Assume the first CBV will be at the beginning of the heap
-	// This will increase as we use more CBVs and will wrap back to 0
-	cbvDescriptorOffset = 0;
-	// Assume the first SRV will be after all possible CBVs
+	// CBVs use the first maxConstantBuffers descriptors, handed out by cbvDescriptorRing,
+	// and SRVs/UAVs the rest, handed out by srvUavAllocator
 	srvDescriptorOffset = maxConstantBuffers;
 }
 
 // --------------------------------------------------------
 // Helper for creating a static buffer that will get
-// data once and remain immutable
+// data once and remain immutable.  Doesn't wait for the
+// copy, which is recorded into the current command list.
 //
 // dataStride - The size of one piece of data in the buffer (like a vertex)
 // dataCount - How many pieces of data (like how many vertices)
@@ -278,55 +1325,14 @@ Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateStaticBuffer(
 	unsigned int dataStride, unsigned int dataCount, void* data)
 {
 	// The overall buffer we'll be creating
-	Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
-	// Describes the final heap
-	D3D12_HEAP_PROPERTIES props = {};
-	props.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-	props.CreationNodeMask = 1;
-	props.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-	props.Type = D3D12_HEAP_TYPE_DEFAULT;
-	props.VisibleNodeMask = 1;
-	D3D12_RESOURCE_DESC desc = {};
-	desc.Alignment = 0;
-	desc.DepthOrArraySize = 1;
-	desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-	desc.Flags = D3D12_RESOURCE_FLAG_NONE;
-	desc.Format = DXGI_FORMAT_UNKNOWN;
-	desc.Height = 1; // Assuming this is a regular buffer, not a texture
-	desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-	desc.MipLevels = 1;
-	desc.SampleDesc.Count = 1;
-	desc.SampleDesc.Quality = 0;
-	desc.Width = dataStride * dataCount; // Size of the buffer
-	device->CreateCommittedResource(
-		&props,
-		D3D12_HEAP_FLAG_NONE,
-		&desc,
-		D3D12_RESOURCE_STATE_COPY_DEST, // Will eventually be "common", but we're copying first
-		0,
-		IID_PPV_ARGS(buffer.GetAddressOf()));
-	// Now create an intermediate upload heap for copying initial data
-	D3D12_HEAP_PROPERTIES uploadProps = {};
-	uploadProps.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-	uploadProps.CreationNodeMask = 1;
-	uploadProps.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-	uploadProps.Type = D3D12_HEAP_TYPE_UPLOAD; // Can only ever be Generic_Read state
-	uploadProps.VisibleNodeMask = 1;
-	Microsoft::WRL::ComPtr<ID3D12Resource> uploadHeap;
-	device->CreateCommittedResource(
-		&uploadProps,
-		D3D12_HEAP_FLAG_NONE,
-		&desc,
-		D3D12_RESOURCE_STATE_GENERIC_READ,
-		0,
-		IID_PPV_ARGS(uploadHeap.GetAddressOf()));
-	// Do a straight map/memcpy/unmap
-	void* gpuAddress = 0;
-	uploadHeap->Map(0, 0, &gpuAddress);
-	memcpy(gpuAddress, data, dataStride * dataCount);
-	uploadHeap->Unmap(0, 0);
-	// Copy the whole buffer from uploadheap to vert buffer
-	commandList->CopyResource(buffer.Get(), uploadHeap.Get());
+	// (will eventually be "common", but we're copying first)
+	UINT64 size = (UINT64)dataStride * dataCount;
+	Microsoft::WRL::ComPtr<ID3D12Resource> buffer = CreateBuffer(
+		size,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+	// Copy the initial data in through the staging ring
+	UploadBufferData(buffer.Get(), 0, data, size);
 	// Transition the buffer to generic read for the rest of the app lifetime (presumable)
 	D3D12_RESOURCE_BARRIER rb = {};
 	rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
@@ -336,8 +1342,8 @@ Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateStaticBuffer(
 	rb.Transition.StateAfter = D3D12_RESOURCE_STATE_GENERIC_READ;
 	rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 	commandList->ResourceBarrier(1, &rb);
-	// Execute the command list and return the finished buffer
-	CloseExecuteAndResetCommandList();
+	// The copy runs with the rest of the command list, before
+	// anything recorded after this can use the buffer
 	return buffer;
 }
 
@@ -349,6 +1355,9 @@ Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateStaticBuffer(
 // state     - What state should the resulting resource be in?  Default is D3D12_RESOURCE_STATE_COMMON
 // flags     - Any special flags?  Default is D3D12_RESOURCE_FLAG_NONE
 // alignment - What's the buffer alignment?  Default is 0
+//
+// Buffers up to a quarter of a heap block are placed in the
+// shared buffer heaps; anything bigger gets committed
 // --------------------------------------------------------
 Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateBuffer(
 	UINT64 size,
@@ -381,38 +1390,121 @@ Microsoft::WRL::ComPtr<ID3D12Resource> DX12Helper::CreateBuffer(
 	desc.SampleDesc.Quality = 0;
 	desc.Width = size; // Size of the buffer
 
+	// Place it in one of the shared heaps if it's small enough
+	BufferHeapPool* pool = GetBufferHeapPool(heapType);
+	D3D12_RESOURCE_ALLOCATION_INFO allocInfo = device->GetResourceAllocationInfo(0, 1, &desc);
+	if (pool && allocInfo.SizeInBytes <= bufferHeapBlockSize / 4)
+	{
+		HeapAllocation allocation = pool->Allocator.Allocate(allocInfo.SizeInBytes, max(allocInfo.Alignment, alignment));
+		if (allocation.IsValid())
+		{
+			// First buffer in this block?
+			if (pool->Heaps.size() <= allocation.Block)
+				pool->Heaps.resize(allocation.Block + 1);
+			if (!pool->Heaps[allocation.Block])
+			{
+				D3D12_HEAP_DESC blockDesc = {};
+				blockDesc.SizeInBytes = bufferHeapBlockSize;
+				blockDesc.Properties = heapDesc;
+				blockDesc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+				blockDesc.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+				device->CreateHeap(&blockDesc, IID_PPV_ARGS(pool->Heaps[allocation.Block].GetAddressOf()));
+			}
+
+			HRESULT hr = device->CreatePlacedResource(
+				pool->Heaps[allocation.Block].Get(),
+				allocation.Offset,
+				&desc,
+				state,
+				0,
+				IID_PPV_ARGS(buffer.GetAddressOf()));
+			if (SUCCEEDED(hr))
+			{
+				// The buffer holds the only reference, so the space is
+				// freed when the buffer is
+				PlacedBufferTracker* tracker = new PlacedBufferTracker(heapType, allocation);
+				buffer->SetPrivateDataInterface(PlacedBufferTrackerGUID, tracker);
+				tracker->Release();
+				return buffer;
+			}
+
+			// Fall back to a committed resource
+			pool->Allocator.Free(allocation);
+		}
+	}
+
 	// Create the buffer
 	device->CreateCommittedResource(&heapDesc, D3D12_HEAP_FLAG_NONE, &desc, state, 0, IID_PPV_ARGS(buffer.GetAddressOf()));
 	return buffer;
 }
 
+// --------------------------------------------------------
+// Called (by way of the buffer's tracker) when a placed
+// buffer is released.  The space is reused once the frame
+// being recorded is done on the GPU.
+// --------------------------------------------------------
+void DX12Helper::FreePlacedBuffer(D3D12_HEAP_TYPE heapType, const HeapAllocation& allocation)
+{
+	BufferHeapPool* pool = GetBufferHeapPool(heapType);
+	if (pool)
+		pool->Allocator.Free(allocation);
+}
+
+HeapSubAllocatorStats DX12Helper::GetBufferHeapStats(D3D12_HEAP_TYPE heapType)
+{
+	BufferHeapPool* pool = GetBufferHeapPool(heapType);
+	return pool ? pool->Allocator.GetStats() : HeapSubAllocatorStats{};
+}
+
+// --------------------------------------------------------
+// Empty blocks have no buffers left in them and no frees
+// the GPU might still be using, so their heaps can go
+// --------------------------------------------------------
+void DX12Helper::TrimBufferHeaps()
+{
+	for (BufferHeapPool& pool : bufferHeapPools)
+	{
+		std::vector<unsigned int> released;
+		pool.Allocator.ReleaseEmptyBlocks(released);
+		for (unsigned int block : released)
+			pool.Heaps[block].Reset();
+	}
+}
+
+DX12Helper::BufferHeapPool* DX12Helper::GetBufferHeapPool(D3D12_HEAP_TYPE heapType)
+{
+	for (BufferHeapPool& pool : bufferHeapPools)
+	{
+		if (pool.Type == heapType)
+			return &pool;
+	}
+	return 0;
+}
+
 // --------------------------------------------------------
 // Reserves a slot in the SRV/UAV section of the overall
 // CBV/SRV/UAV descriptor heap.  Handles to CPU and/or GPU
 // are set via parameters.  Pass in 0 to skip a parameter.
+// The slot is never freed; use AllocateSrvUavDescriptors()
+// for anything that can go away.
 // --------------------------------------------------------
 void DX12Helper::ReserveSrvUavDescriptorHeapSlot(D3D12_CPU_DESCRIPTOR_HANDLE* reservedCPUHandle, D3D12_GPU_DESCRIPTOR_HANDLE* reservedGPUHandle)
 {
-	// Grab the actual heap start on both sides and offset to the next open SRV/UAV portion
-	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = cbvSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
-	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = cbvSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
-
-	cpuHandle.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
-	gpuHandle.ptr += (SIZE_T)srvDescriptorOffset * cbvSrvDescriptorHeapIncrementSize;
+	DescriptorHandle slot = AllocateSrvUavDescriptors(1);
+	if (!slot.IsValid())
+		return;
 
 	// Set the requested handle(s)
-	if (reservedCPUHandle) { *reservedCPUHandle = cpuHandle; }
-	if (reservedGPUHandle) { *reservedGPUHandle = gpuHandle; }
-
-	// Update the overall offset
-	srvDescriptorOffset++;
+	if (reservedCPUHandle) { *reservedCPUHandle = GetSrvUavCPUHandle(slot); }
+	if (reservedGPUHandle) { *reservedGPUHandle = GetSrvUavGPUHandle(slot); }
 }
 
 
 // --------------------------------------------------------
 // Gets the command allocator we can use to reset a command list
+// (the one belonging to the frame being recorded)
 // --------------------------------------------------------
 Microsoft::WRL::ComPtr<ID3D12CommandAllocator> DX12Helper::GetDefaultAllocator()
 {
-	return commandAllocator;
+	return commandAllocators[frameScheduler.GetFrameIndex()];
 }
\ No newline at end of file
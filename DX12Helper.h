@@ -2,6 +2,101 @@
 #include <d3d12.h>
 #include <wrl/client.h>
 #include <vector>
+#include <string>
+
+#include "FrameScheduler.h"
+#include "FrameRingAllocator.h"
+#include "DescriptorAllocator.h"
+#include "HeapSubAllocator.h"
+#include "StagingRing.h"
+#include "ResourceStateTracker.h"
+#include "RenderGraph.h"
+#include "DeferredReleaseQueue.h"
+#include "PipelineCache.h"
+#include "TextureManager.h"
+#include "MipResidency.h"
+
+// --------------------------------------------------------
+// GPUTimeline backed by a D3D12 fence on the command queue
+// --------------------------------------------------------
+class DX12Timeline : public GPUTimeline
+{
+public:
+	DX12Timeline() : fenceEvent(0), fenceCounter(0) {}
+	~DX12Timeline();
+
+	void Initialize(
+		Microsoft::WRL::ComPtr<ID3D12Device> device,
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue);
+
+	uint64_t Signal() override;
+	uint64_t GetCompletedValue() override;
+	void WaitForValue(uint64_t value) override;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue;
+	Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+	HANDLE fenceEvent;
+	uint64_t fenceCounter;
+};
+
+// --------------------------------------------------------
+// Sends each batch of tracked barriers to a command list
+// as a single ResourceBarrier() call
+// --------------------------------------------------------
+class DX12BarrierSink : public ResourceBarrierSink
+{
+public:
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList) { this->commandList = commandList; }
+	void EmitBarriers(const ResourceBarrier* barriers, unsigned int count) override;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList;
+	std::vector<D3D12_RESOURCE_BARRIER> d3dBarriers;
+};
+
+// --------------------------------------------------------
+// StagingMemory made of upload heap buffers, each mapped
+// once when it's created
+// --------------------------------------------------------
+class DX12StagingMemory : public StagingMemory
+{
+public:
+	void* CreateBuffer(uint64_t size, unsigned int& buffer) override;
+	void ReleaseBuffer(unsigned int buffer) override;
+
+	ID3D12Resource* GetResource(unsigned int buffer) { return buffer < buffers.size() ? buffers[buffer].Get() : 0; }
+
+private:
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> buffers;
+};
+
+// --------------------------------------------------------
+// Render graph memory as default heaps (one per kind of
+// resource) with the graph's transients placed in them
+// --------------------------------------------------------
+class DX12RenderGraphBackend : public RenderGraphBackend
+{
+public:
+	void Initialize(
+		Microsoft::WRL::ComPtr<ID3D12Device> device,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList);
+
+	void GetAllocationInfo(const RenderGraphResourceDesc& desc, uint64_t& size, uint64_t& alignment) override;
+	void CreateHeap(RenderGraphHeapKind kind, uint64_t size) override;
+	void* CreatePlacedResource(const RenderGraphResourceDesc& desc, RenderGraphHeapKind kind, uint64_t offset, ResourceStates initialState) override;
+	void ReleaseAll() override;
+	void BeginLifetime(void* resource) override;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> device;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList;
+	Microsoft::WRL::ComPtr<ID3D12Heap> heaps[RENDER_GRAPH_HEAP_KIND_COUNT];
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> resources;
+
+	D3D12_RESOURCE_DESC GetResourceDesc(const RenderGraphResourceDesc& desc);
+};
+
 class DX12Helper
 {
 #pragma region Singleton
@@ -42,20 +137,121 @@ public:
 		unsigned int dataCount,
 		void* data);
 	
+	// States of resources that change state every frame.  Transitions
+	// are batched until FlushBarriers() (or the list is executed).
+	ResourceStateTracker& GetResourceStates() { return resourceStates; }
+	void FlushBarriers() { resourceStates.Flush(); }
+
+	// Where render graph transients are placed
+	RenderGraphBackend* GetRenderGraphBackend() { return &renderGraphBackend; }
+
+	// Pipelines are created from the driver's cached blobs when the disk
+	// cache has one for the same description, shaders and root signature
+	// (hashed from its serialized form), and timed either way
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> CreateGraphicsPipelineState(
+		const char* name,
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+		uint64_t rootSignatureHash);
+	void AddPipelineTiming(const char* name, double ms) { pipelineCache.AddTiming(name, ms, false); }
+	const std::vector<PipelineTiming>& GetPipelineTimings() { return pipelineCache.GetTimings(); }
+	PipelineCacheStats GetPipelineCacheStats() { return pipelineCache.GetStats(); }
+	// Writes the cache if anything changed (once startup's pipelines exist)
+	void SavePipelineCache();
+
+	// Keeps an object alive until the GPU finishes the submission being
+	// recorded (the last that could use it), so replacing a resource
+	// never needs to wait for the GPU
+	void DeferRelease(Microsoft::WRL::ComPtr<IUnknown> object);
+	// Same, for anything else waiting on that submission (reading back
+	// its results, etc.)
+	void CallWhenGPUDone(std::function<void()> callback);
+	DeferredReleaseQueueStats GetDeferredReleaseStats() { return deferredReleases.GetStats(); }
+
 	// Command list & synchronization
 	void CloseExecuteAndResetCommandList();
 	void WaitForGPU();
 
+	// Frames in flight: ends the frame by executing its command list, then
+	// resets the list for the next frame (only waiting if the GPU is still
+	// using that frame's allocator and per-frame resources)
+	void CloseExecuteAndBeginNextFrame();
+	void SetFramesInFlight(unsigned int framesInFlight);
+	unsigned int GetFramesInFlight() { return frameScheduler.GetFramesInFlight(); }
+	unsigned int GetFrameIndex() { return frameScheduler.GetFrameIndex(); }
+
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> GetCBVSRVDescriptorHeap();
+	// Returns a null handle (ptr 0) once the frame is out of CBV descriptors
 	D3D12_GPU_DESCRIPTOR_HANDLE FillNextConstantBufferAndGetGPUDescriptorHandle(
 		void* data,
 		unsigned int dataSizeInBytes);
+	// Same, but for root CBVs (no descriptor needed)
+	D3D12_GPU_VIRTUAL_ADDRESS FillNextConstantBufferAndGetGPUAddress(
+		void* data,
+		unsigned int dataSizeInBytes);
+	// Usage of the constant buffer upload heap (bytes) and CBV descriptors
+	const FrameRingAllocator& GetConstantBufferRing() { return cbUploadRing; }
+	const FrameRingAllocator& GetCBVDescriptorRing() { return cbvDescriptorRing; }
 
+	// Uploads: data is written into the staging ring and copied on the GPU
+	// as part of the command list being recorded, so none of these wait or
+	// submit.  Staging space is reused once that submission completes.
+	StagingAllocation AllocateStaging(UINT64 size, UINT64 alignment = 4);
+	ID3D12Resource* GetStagingResource(const StagingAllocation& allocation) { return stagingMemory.GetResource(allocation.Buffer); }
+	D3D12_GPU_VIRTUAL_ADDRESS GetStagingGPUAddress(const StagingAllocation& allocation);
+	// Copies data into staging and returns its GPU address, for data the
+	// GPU reads straight out of the upload heap (instance descs, etc.)
+	D3D12_GPU_VIRTUAL_ADDRESS StageData(const void* data, UINT64 size, UINT64 alignment = 4);
+	// Records a copy into a buffer (which must be in the copy dest state)
+	void UploadBufferData(ID3D12Resource* destination, UINT64 destinationOffset, const void* data, UINT64 size);
+	// Records a copy into one subresource of a texture (in the copy dest state)
+	void UploadTextureSubresource(ID3D12Resource* texture, UINT subresource, const D3D12_SUBRESOURCE_DATA& data);
+	StagingRingStats GetStagingStats() { return stagingRing.GetStats(); }
+
+	// Textures: LoadTexture() only requests the file (once per path) and
+	// hands back its CPU-side SRV, which is written when the texture loads.
+	// FinishTextureLoads() decodes everything requested on the job system
+	// (mip chains are built and block compressed on the CPU, or mapped
+	// from the texture cache) and uploads it all in one submission.
+	// Copying SRVs into the shader visible heap finishes loads first.
 	D3D12_CPU_DESCRIPTOR_HANDLE LoadTexture(const wchar_t* file, bool generateMips = true);
+	void FinishTextureLoads();
+	TextureLoadStats GetTextureLoadStats() { return textureManager.GetStats(); }
+	// Mapped textures load with just their small levels, and StreamTextures()
+	// (once a frame, before drawing) brings the rest in under the budget, a
+	// few MB of uploads at a time.  A texture's SRV is rewritten whenever its
+	// levels change, which bumps the descriptor version so copies of it
+	// (like material tables) know to copy it again.
+	void StreamTextures();
+	void SetTextureBudget(uint64_t bytes) { textureResidency.SetBudget(bytes); }
+	MipResidencyStats GetTextureStreamingStats() { return textureResidency.GetStats(); }
+	unsigned int GetTextureDescriptorVersion() { return textureDescriptorVersion; }
+	const std::wstring& GetTextureCacheDirectory() { return textureCacheDirectory; }
+	// Textures made on the CPU (like atlas pages): every level is block
+	// compressed (unless the format is none) and staged right away, and
+	// the SRV's CPU handle comes back.  They last as long as the helper.
+	D3D12_CPU_DESCRIPTOR_HANDLE CreateTextureFromLevels(const std::vector<DecodedImage>& levels, BlockFormat format = BLOCK_FORMAT_NONE);
+	unsigned int GetTextureDescriptorHeapCount() { return (unsigned int)cpuSideTextureDescriptorHeaps.size(); }
 	D3D12_GPU_DESCRIPTOR_HANDLE CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(
 		D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy,
 		unsigned int numDescriptorsToCopy);
 
+	// SRV/UAV section of the shader visible heap.  Ranges are contiguous
+	// (for tables) and freed ranges are reused once the GPU is done with
+	// the frame they were freed in.  Handles are checked on use.
+	DescriptorHandle AllocateSrvUavDescriptors(unsigned int count = 1);
+	void FreeSrvUavDescriptors(DescriptorHandle& handle);
+	void CopyDescriptorsToSrvUavRange(
+		const DescriptorHandle& destination,
+		unsigned int offset,
+		D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy,
+		unsigned int numDescriptorsToCopy);
+	D3D12_CPU_DESCRIPTOR_HANDLE GetSrvUavCPUHandle(const DescriptorHandle& handle, unsigned int offset = 0);
+	D3D12_GPU_DESCRIPTOR_HANDLE GetSrvUavGPUHandle(const DescriptorHandle& handle, unsigned int offset = 0);
+	// Where a descriptor sits in the whole shader visible heap (for shaders
+	// that index the heap, like the raytracer's material textures)
+	unsigned int GetCBVSRVDescriptorIndex(D3D12_GPU_DESCRIPTOR_HANDLE handle);
+	DescriptorAllocatorStats GetSrvUavDescriptorStats() { return srvUavAllocator.GetStats(); }
+
 	//real time raytracing helpers
 	Microsoft::WRL::ComPtr<ID3D12Resource> CreateBuffer(
 		UINT64 size,
@@ -68,6 +264,13 @@ public:
 		D3D12_CPU_DESCRIPTOR_HANDLE* reservedCPUHandle,
 		D3D12_GPU_DESCRIPTOR_HANDLE* reservedGPUHandle);
 
+	// Buffers from CreateBuffer() are placed in large shared heaps (one set
+	// per heap type) and give their space back when they're released
+	void FreePlacedBuffer(D3D12_HEAP_TYPE heapType, const HeapAllocation& allocation);
+	HeapSubAllocatorStats GetBufferHeapStats(D3D12_HEAP_TYPE heapType);
+	// Releases heaps that nothing is placed in anymore
+	void TrimBufferHeaps();
+
 	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> GetDefaultAllocator();
 private:
 	// Overall device
@@ -78,25 +281,39 @@ private:
 	// complex engines but should be fine for now
 	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList;
 	Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue;
-	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator;
-	// Basic CPU/GPU synchronization
-	Microsoft::WRL::ComPtr<ID3D12Fence> waitFence;
-	HANDLE waitFenceEvent;
-	unsigned long waitFenceCounter;
-
-	// Maximum number of constant buffers, assuming each buffer
-	// is 256 bytes or less. Larger buffers are fine, but will
-	// result in fewer buffers in use at any time
+	// One allocator per frame in flight, since an allocator
+	// can't be reset while the GPU is executing its commands
+	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocators[FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT];
+	// CPU/GPU synchronization
+	DX12Timeline timeline;
+	FrameScheduler frameScheduler;
+	// Objects waiting on the GPU before they're released
+	DeferredReleaseQueue deferredReleases;
+	// Barriers for tracked resources, recorded into the command list
+	DX12BarrierSink barrierSink;
+	ResourceStateTracker resourceStates;
+	DX12RenderGraphBackend renderGraphBackend;
+	// Compiled pipelines on disk, for this adapter and driver
+	PipelineCache pipelineCache;
+	std::wstring pipelineCachePath;
+	// Mip chains, compressed blocks and compiled material textures
+	std::wstring textureCacheDirectory;
+
+	// Maximum number of CBV descriptors, and the starting size of
+	// the upload heap (enough for this many 256 byte buffers). The
+	// upload heap grows if frames in flight need more than that,
+	// but the descriptors can't, so they wait on the GPU instead.
 	const unsigned int maxConstantBuffers = 1000;
-	// GPU-side constant buffer upload heap
+	// GPU-side constant buffer upload heap, and the ring tracking
+	// which parts of it each frame in flight is still using
 	Microsoft::WRL::ComPtr<ID3D12Resource> cbUploadHeap;
 	UINT64 cbUploadHeapSizeInBytes;
-	UINT64 cbUploadHeapOffsetInBytes;
 	void* cbUploadHeapStartAddress;
+	FrameRingAllocator cbUploadRing;
 	// GPU-side CBV/SRV descriptor heap
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> cbvSrvDescriptorHeap;
 	SIZE_T cbvSrvDescriptorHeapIncrementSize;
-	unsigned int cbvDescriptorOffset;
+	FrameRingAllocator cbvDescriptorRing;
 
 	void CreateConstantBufferUploadHeap();
 	void CreateCBVSRVDescriptorHeap();
@@ -108,9 +325,52 @@ private:
 	// we could come up with an exact amount. The following
 	// constant ensures we (hopefully) never run out of room.
 	const unsigned int maxTextureDescriptors = 1000;
+	// First SRV/UAV descriptor in the heap (right after the CBVs),
+	// and the allocator handing out slots from there
 	unsigned int srvDescriptorOffset;
-	// Texture resources we need to keep alive
+	DescriptorAllocator srvUavAllocator;
+	// Heaps buffers are placed in, and the allocator deciding where.
+	// Buffers bigger than a quarter of a heap are committed instead.
+	struct BufferHeapPool
+	{
+		D3D12_HEAP_TYPE Type;
+		HeapSubAllocator Allocator;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> Heaps;	// One per allocator block
+	};
+	BufferHeapPool bufferHeapPools[3];	// Default, upload and readback
+	const UINT64 bufferHeapBlockSize = 64 * 1024 * 1024;
+	BufferHeapPool* GetBufferHeapPool(D3D12_HEAP_TYPE heapType);
+
+	// Everything uploaded goes through here.  Uploads bigger than the
+	// dedicated threshold get their own upload buffer instead.
+	DX12StagingMemory stagingMemory;
+	StagingRing stagingRing;
+	const UINT64 stagingRingSize = 32 * 1024 * 1024;
+	const UINT64 stagingDedicatedThreshold = 8 * 1024 * 1024;
+
+	// Texture files, decoded once per path and per distinct contents.
+	// By texture id: its resource (only content owners have one) and
+	// its CPU-side SRV.
+	TextureManager textureManager;
 	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> textures;
+	std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> textureDescriptors;
+	unsigned int loadedTextureCount;
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateTexture(unsigned int texture);
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateTextureResource(unsigned int texture, unsigned int topLevel);
+
+	// From CreateTextureFromLevels()
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> generatedTextures;
+
+	// Streamed textures (content owners), by residency id
+	MipResidency textureResidency;
+	std::vector<unsigned int> streamedTextures;
+	unsigned int textureDescriptorVersion;
+	const UINT64 textureUploadLimit = 4 * 1024 * 1024;
+
+	// CPU-side SRVs for textures, handed out in order from shared heaps
 	std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> cpuSideTextureDescriptorHeaps;
+	unsigned int cpuSideTextureDescriptorsUsed;		// In the last heap
+	const unsigned int textureDescriptorsPerHeap = 256;
+	D3D12_CPU_DESCRIPTOR_HANDLE AllocateTextureDescriptor();
 };
 
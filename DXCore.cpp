@@ -288,6 +288,8 @@ HRESULT DXCore::InitDirect3D()
 		{
 			// Grab this buffer from the swap chain
 			swapChain->GetBuffer(i, IID_PPV_ARGS(backBuffers[i].GetAddressOf()));
+			// Track its state from here on (it starts out ready to present)
+			DX12Helper::GetInstance().GetResourceStates().Register(backBuffers[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
 			// Make a handle for it
 			rtvHandles[i] = rtvHeap->GetCPUDescriptorHandleForHeapStart();
 			rtvHandles[i].ptr += rtvDescriptorSize * i;
@@ -389,7 +391,10 @@ HRESULT DXCore::InitDirect3D()
 		DX12Helper::GetInstance().WaitForGPU();
 		// Release the back buffers using ComPtr's Reset()
 		for (unsigned int i = 0; i < numBackBuffers; i++)
+		{
+			DX12Helper::GetInstance().GetResourceStates().Unregister(backBuffers[i].Get());
 			backBuffers[i].Reset();
+		}
 		// Resize the swap chain (assuming a basic color format here)
 		swapChain->ResizeBuffers(
 			numBackBuffers,
@@ -404,6 +409,8 @@ HRESULT DXCore::InitDirect3D()
 		{
 			// Grab this buffer from the swap chain
 			swapChain->GetBuffer(i, IID_PPV_ARGS(backBuffers[i].GetAddressOf()));
+			// Track its state from here on (it starts out ready to present)
+			DX12Helper::GetInstance().GetResourceStates().Register(backBuffers[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
 			// Make a handle for it
 			rtvHandles[i] = rtvHeap->GetCPUDescriptorHandleForHeapStart();
 			rtvHandles[i].ptr += rtvDescriptorSize * i;
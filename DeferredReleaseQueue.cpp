@@ -0,0 +1,96 @@
+#include "DeferredReleaseQueue.h"
+
+#include <algorithm>
+
+DeferredReleaseQueue::DeferredReleaseQueue() :
+	timeline(0),
+	untagged(0),
+	queued(0),
+	released(0),
+	peakPending(0)
+{
+}
+
+DeferredReleaseQueue::~DeferredReleaseQueue()
+{
+	ReleaseAll();
+}
+
+void DeferredReleaseQueue::Initialize(GPUTimeline* timeline)
+{
+	this->timeline = timeline;
+}
+
+
+// --------------------------------------------------------
+// Holds on to something until the submission being
+// recorded (which may still use it) has finished
+// --------------------------------------------------------
+void DeferredReleaseQueue::Enqueue(std::function<void()> release)
+{
+	Entry entry = {};
+	entry.Release = release;
+	entries.push_back(entry);
+	untagged++;
+
+	queued++;
+	peakPending = std::max(peakPending, (unsigned int)entries.size());
+}
+
+
+// --------------------------------------------------------
+// Tags everything queued since the last submission ended
+// --------------------------------------------------------
+void DeferredReleaseQueue::EndSubmission(uint64_t fenceValue)
+{
+	for (size_t i = entries.size() - untagged; i < entries.size(); i++)
+		entries[i].FenceValue = fenceValue;
+	untagged = 0;
+}
+
+
+// --------------------------------------------------------
+// Releases from the front until an entry's submission
+// hasn't finished (or hasn't ended).  Entries are removed
+// before they're released, in case releasing queues more.
+// --------------------------------------------------------
+void DeferredReleaseQueue::Retire()
+{
+	if (entries.empty())
+		return;
+
+	uint64_t completed = timeline->GetCompletedValue();
+	while (entries.size() > untagged && entries.front().FenceValue <= completed)
+	{
+		Entry entry = entries.front();
+		entries.pop_front();
+		entry.Release();
+		released++;
+	}
+}
+
+
+// --------------------------------------------------------
+// For shutdown (or after waiting for the GPU to go idle)
+// --------------------------------------------------------
+void DeferredReleaseQueue::ReleaseAll()
+{
+	while (!entries.empty())
+	{
+		Entry entry = entries.front();
+		entries.pop_front();
+		entry.Release();
+		released++;
+	}
+	untagged = 0;
+}
+
+DeferredReleaseQueueStats DeferredReleaseQueue::GetStats() const
+{
+	DeferredReleaseQueueStats stats = {};
+	stats.Queued = queued;
+	stats.Released = released;
+	stats.Pending = (unsigned int)entries.size();
+	stats.PeakPending = peakPending;
+	return stats;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+#include "FrameScheduler.h"
+
+struct DeferredReleaseQueueStats
+{
+	unsigned int Queued;			// In total
+	unsigned int Released;			// In total
+	unsigned int Pending;			// Waiting on the GPU (or their submission)
+	unsigned int PeakPending;
+};
+
+// --------------------------------------------------------
+// Objects the GPU may still be using, destroyed only once
+// the fence of the last submission that used them has
+// completed.  Anything queued while a submission is being
+// recorded is used by it, so it's tagged with that
+// submission's fence at EndSubmission().
+//
+// Fences only increase, so entries retire in the order
+// they were queued.  What "destroying" means is up to the
+// caller (releasing a resource, freeing descriptors, etc.).
+// --------------------------------------------------------
+class DeferredReleaseQueue
+{
+public:
+	DeferredReleaseQueue();
+	~DeferredReleaseQueue();
+
+	void Initialize(GPUTimeline* timeline);
+
+	// Calls release once the submission being recorded has finished
+	void Enqueue(std::function<void()> release);
+
+	// Everything queued since the last call is used by the work that
+	// signals this fence
+	void EndSubmission(uint64_t fenceValue);
+
+	// Releases everything whose fence has completed
+	void Retire();
+
+	// Releases everything, finished or not (only once the GPU is idle)
+	void ReleaseAll();
+
+	DeferredReleaseQueueStats GetStats() const;
+
+private:
+	struct Entry
+	{
+		std::function<void()> Release;
+		uint64_t FenceValue;	// 0 until its submission ends
+	};
+
+	GPUTimeline* timeline;
+	std::deque<Entry> entries;
+	size_t untagged;			// Entries at the back still waiting for EndSubmission()
+
+	unsigned int queued;
+	unsigned int released;
+	unsigned int peakPending;
+};
@@ -0,0 +1,543 @@
+#include "Denoiser.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+// Largest a-trous reach (2 taps * 16 pixel steps)
+#define DENOISER_PADDING 32
+
+// Pixels that keep this much history skip the spatial variance estimate
+#define DENOISER_MIN_HISTORY_FOR_VARIANCE 4.0f
+
+// History length stops growing here, so alpha never drops below 1/32
+#define DENOISER_MAX_HISTORY_LENGTH 32.0f
+
+// B3 spline weights for the 5x5 a-trous kernel
+static const float atrousKernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+static float Luminance(float r, float g, float b) { return r * 0.2126f + g * 0.7152f + b * 0.0722f; }
+
+// --------------------------------------------------------
+// exp(x) for four values at once (x <= 0 is all we need).
+// Splits into 2^i * 2^f, with a polynomial for 2^f.
+// --------------------------------------------------------
+static __m128 FastExp(__m128 x)
+{
+	x = _mm_max_ps(x, _mm_set1_ps(-80.0f));
+	__m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+
+	// Floor (SSE2 has no round instruction)
+	__m128i i = _mm_cvttps_epi32(t);
+	__m128 fi = _mm_cvtepi32_ps(i);
+	__m128 adjust = _mm_and_ps(_mm_cmplt_ps(t, fi), _mm_set1_ps(1.0f));
+	fi = _mm_sub_ps(fi, adjust);
+	i = _mm_cvtps_epi32(fi);
+	__m128 f = _mm_sub_ps(t, fi);
+
+	// 2^f on [0,1)
+	__m128 p = _mm_set1_ps(1.3534167e-2f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.2011464e-2f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4144275e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9300383e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+	// 2^i straight into the exponent bits
+	__m128i exponent = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+}
+
+static __m128 Abs(__m128 x) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), x); }
+
+static __m128 Luminance(__m128 r, __m128 g, __m128 b)
+{
+	return _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(r, _mm_set1_ps(0.2126f)),
+		_mm_mul_ps(g, _mm_set1_ps(0.7152f))),
+		_mm_mul_ps(b, _mm_set1_ps(0.0722f)));
+}
+
+
+Denoiser::Denoiser() :
+	width(0),
+	height(0),
+	stride(0),
+	padding(DENOISER_PADDING),
+	hasHistory(false),
+	timings{}
+{
+}
+
+void Denoiser::Reset()
+{
+	hasHistory = false;
+}
+
+// --------------------------------------------------------
+// (Re)allocates every plane for a new frame size.  Padded
+// planes get a border wide enough for the largest a-trous
+// step, plus extra columns so rows are a multiple of four.
+// --------------------------------------------------------
+void Denoiser::Resize(unsigned int width, unsigned int height)
+{
+	if (width == this->width && height == this->height)
+		return;
+
+	this->width = width;
+	this->height = height;
+	stride = padding + ((width + 3) & ~3u) + padding;
+	size_t paddedSize = (size_t)stride * (height + padding * 2);
+	size_t pixelCount = (size_t)width * height;
+
+	for (int i = 0; i < 2; i++)
+	{
+		for (int c = 0; c < 3; c++)
+			illumination[i][c].assign(paddedSize, 0.0f);
+		variance[i].assign(paddedSize, 0.0f);
+	}
+	depth.assign(paddedSize, 0.0f);
+	normalX.assign(paddedSize, 0.0f);
+	normalY.assign(paddedSize, 0.0f);
+	normalZ.assign(paddedSize, 0.0f);
+	valid.assign(paddedSize, 0.0f);
+
+	albedo.assign(pixelCount * 3, 1.0f);
+	moments.assign(pixelCount * 2, 0.0f);
+	historyLength.assign(pixelCount, 0.0f);
+	previousIllumination.assign(pixelCount * 3, 0.0f);
+	previousMoments.assign(pixelCount * 2, 0.0f);
+	previousHistoryLength.assign(pixelCount, 0.0f);
+	previousSurfaces.assign(pixelCount, ReprojectionSurface{ 0.0f, XMFLOAT3(0, 0, 0), DENOISER_INVALID_INSTANCE });
+
+	hasHistory = false;
+}
+
+// --------------------------------------------------------
+// Runs the whole denoiser for one frame
+// --------------------------------------------------------
+void Denoiser::Denoise(
+	const DenoiserPixel* pixels,
+	unsigned int width,
+	unsigned int height,
+	const DenoiserSettings& settings,
+	unsigned char* output,
+	unsigned int outputRowPitch)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	Resize(width, height);
+
+	auto start = Clock::now();
+	TemporalAccumulation(pixels, settings);
+	auto afterTemporal = Clock::now();
+	EstimateVariance();
+	auto afterVariance = Clock::now();
+
+	// Wavelet passes ping-pong between the two sets of planes.
+	// The first pass' result is what gets accumulated next frame.
+	unsigned int iterations = std::min(settings.AtrousIterations, (unsigned int)DENOISER_MAX_ATROUS_ITERATIONS);
+	unsigned int source = 0;
+	if (iterations == 0)
+		StoreHistory(pixels, source);
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		AtrousPass(source, 1u << i, settings);
+		source = 1 - source;
+		if (i == 0)
+			StoreHistory(pixels, source);
+	}
+	auto afterAtrous = Clock::now();
+
+	WriteOutput(source, output, outputRowPitch);
+	auto end = Clock::now();
+
+	timings.TemporalMs = std::chrono::duration<double, std::milli>(afterTemporal - start).count();
+	timings.VarianceMs = std::chrono::duration<double, std::milli>(afterVariance - afterTemporal).count();
+	timings.AtrousMs = std::chrono::duration<double, std::milli>(afterAtrous - afterVariance).count();
+	timings.OutputMs = std::chrono::duration<double, std::milli>(end - afterAtrous).count();
+	timings.TotalMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+	hasHistory = settings.Temporal;
+}
+
+// --------------------------------------------------------
+// Demodulates albedo, follows each pixel's motion vector
+// into last frame and blends in whatever history survives
+// the disocclusion tests
+// --------------------------------------------------------
+void Denoiser::TemporalAccumulation(const DenoiserPixel* pixels, const DenoiserSettings& settings)
+{
+	bool useHistory = settings.Temporal && hasHistory;
+
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				unsigned int p = y * width + x;
+				size_t padded = (size_t)(y + padding) * stride + x + padding;
+				const DenoiserPixel& pixel = pixels[p];
+				bool hit = pixel.InstanceID != DENOISER_INVALID_INSTANCE;
+
+				// Misses (sky) aren't demodulated or filtered
+				float a[3] = { 1.0f, 1.0f, 1.0f };
+				if (hit)
+				{
+					a[0] = std::max(pixel.Albedo.x, 0.001f);
+					a[1] = std::max(pixel.Albedo.y, 0.001f);
+					a[2] = std::max(pixel.Albedo.z, 0.001f);
+				}
+				float illum[3] = { pixel.Color.x / a[0], pixel.Color.y / a[1], pixel.Color.z / a[2] };
+				float lum = Luminance(illum[0], illum[1], illum[2]);
+				float m[2] = { lum, lum * lum };
+				float length = 1.0f;
+
+				ReprojectionTaps taps;
+				if (hit && useHistory && Reprojection::FindHistoryTaps(
+					XMFLOAT2((x + 0.5f) / width, (y + 0.5f) / height),
+					pixel.Motion,
+					ReprojectionSurface{ pixel.Depth, pixel.Normal, pixel.InstanceID },
+					pixel.PreviousDepth,
+					previousSurfaces.data(),
+					width,
+					height,
+					taps))
+				{
+					// Bilinear over the taps that passed
+					float historyIllum[3] = {};
+					float historyMoments[2] = {};
+					float historyLengthSum = 0.0f;
+					for (unsigned int t = 0; t < taps.Count; t++)
+					{
+						unsigned int q = taps.Indices[t];
+						float w = taps.Weights[t];
+						for (int c = 0; c < 3; c++)
+							historyIllum[c] += previousIllumination[q * 3 + c] * w;
+						historyMoments[0] += previousMoments[q * 2 + 0] * w;
+						historyMoments[1] += previousMoments[q * 2 + 1] * w;
+						historyLengthSum += previousHistoryLength[q] * w;
+					}
+
+					length = std::min(historyLengthSum + 1.0f, DENOISER_MAX_HISTORY_LENGTH);
+					float colorAlpha = std::max(settings.ColorAlpha, 1.0f / length);
+					float momentsAlpha = std::max(settings.MomentsAlpha, 1.0f / length);
+					for (int c = 0; c < 3; c++)
+						illum[c] = historyIllum[c] * (1.0f - colorAlpha) + illum[c] * colorAlpha;
+					m[0] = historyMoments[0] * (1.0f - momentsAlpha) + m[0] * momentsAlpha;
+					m[1] = historyMoments[1] * (1.0f - momentsAlpha) + m[1] * momentsAlpha;
+				}
+
+				illumination[0][0][padded] = illum[0];
+				illumination[0][1][padded] = illum[1];
+				illumination[0][2][padded] = illum[2];
+				variance[0][padded] = hit ? std::max(m[1] - m[0] * m[0], 0.0f) : 0.0f;
+				depth[padded] = pixel.Depth;
+				normalX[padded] = pixel.Normal.x;
+				normalY[padded] = pixel.Normal.y;
+				normalZ[padded] = pixel.Normal.z;
+				valid[padded] = hit ? 1.0f : 0.0f;
+
+				albedo[p * 3 + 0] = a[0];
+				albedo[p * 3 + 1] = a[1];
+				albedo[p * 3 + 2] = a[2];
+				moments[p * 2 + 0] = m[0];
+				moments[p * 2 + 1] = m[1];
+				historyLength[p] = length;
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// Pixels with too little history have unreliable temporal
+// moments, so estimate their variance from a 7x7 bilateral
+// neighbourhood instead
+// --------------------------------------------------------
+void Denoiser::EstimateVariance()
+{
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				unsigned int p = y * width + x;
+				size_t center = (size_t)(y + padding) * stride + x + padding;
+				if (valid[center] == 0.0f || historyLength[p] >= DENOISER_MIN_HISTORY_FOR_VARIANCE)
+					continue;
+
+				float centerDepth = depth[center];
+				float m[2] = {};
+				float weightSum = 0.0f;
+				for (int dy = -3; dy <= 3; dy++)
+				{
+					int ny = (int)y + dy;
+					if (ny < 0 || ny >= (int)height)
+						continue;
+
+					for (int dx = -3; dx <= 3; dx++)
+					{
+						int nx = (int)x + dx;
+						if (nx < 0 || nx >= (int)width)
+							continue;
+
+						size_t q = (size_t)(ny + padding) * stride + nx + padding;
+						if (valid[q] == 0.0f)
+							continue;
+
+						// Same normal (pow 128) and depth weights as the a-trous passes
+						float normalWeight = std::max(normalX[center] * normalX[q] + normalY[center] * normalY[q] + normalZ[center] * normalZ[q], 0.0f);
+						for (int s = 0; s < 7; s++)
+							normalWeight *= normalWeight;
+						float w = normalWeight *
+							expf(-fabsf(centerDepth - depth[q]) / (0.05f * centerDepth * (abs(dx) + abs(dy)) + 1e-4f));
+
+						unsigned int qp = ny * width + nx;
+						m[0] += moments[qp * 2 + 0] * w;
+						m[1] += moments[qp * 2 + 1] * w;
+						weightSum += w;
+					}
+				}
+
+				// Boost it a little for very young pixels, as SVGF does
+				if (weightSum > 0.0f)
+				{
+					m[0] /= weightSum;
+					m[1] /= weightSum;
+					variance[0][center] = std::max(m[1] - m[0] * m[0], 0.0f) * DENOISER_MIN_HISTORY_FOR_VARIANCE / historyLength[p];
+				}
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// One edge-aware a-trous wavelet pass, reading from one set
+// of planes and writing the other.  Four horizontally
+// adjacent pixels are filtered at once; the padding means
+// every tap is in bounds, and padded pixels have no weight.
+// --------------------------------------------------------
+void Denoiser::AtrousPass(unsigned int source, unsigned int stepSize, const DenoiserSettings& settings)
+{
+	unsigned int dest = 1 - source;
+	const float* srcR = illumination[source][0].data();
+	const float* srcG = illumination[source][1].data();
+	const float* srcB = illumination[source][2].data();
+	const float* srcVar = variance[source].data();
+	float* dstR = illumination[dest][0].data();
+	float* dstG = illumination[dest][1].data();
+	float* dstB = illumination[dest][2].data();
+	float* dstVar = variance[dest].data();
+
+	// Normal weight is pow(dot, phi), done by repeated squaring so phi is rounded to a power of two
+	unsigned int normalSquarings = 0;
+	while ((1u << (normalSquarings + 1)) <= settings.PhiNormal && normalSquarings < 10)
+		normalSquarings++;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 epsilon = _mm_set1_ps(1e-6f);
+	const __m128 phiColor = _mm_set1_ps(settings.PhiColor);
+	const __m128 phiDepth = _mm_set1_ps(settings.PhiDepth * stepSize);
+	const int rowStep = (int)(stepSize * stride);
+
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			size_t rowIndex = (size_t)(y + padding) * stride + padding;
+			for (unsigned int x = 0; x < width; x += 4)
+			{
+				size_t p = rowIndex + x;
+
+				__m128 centerR = _mm_loadu_ps(srcR + p);
+				__m128 centerG = _mm_loadu_ps(srcG + p);
+				__m128 centerB = _mm_loadu_ps(srcB + p);
+				__m128 centerLum = Luminance(centerR, centerG, centerB);
+				__m128 centerDepth = _mm_loadu_ps(depth.data() + p);
+				__m128 centerNX = _mm_loadu_ps(normalX.data() + p);
+				__m128 centerNY = _mm_loadu_ps(normalY.data() + p);
+				__m128 centerNZ = _mm_loadu_ps(normalZ.data() + p);
+				__m128 centerValid = _mm_loadu_ps(valid.data() + p);
+
+				// 3x3 blurred variance drives the luminance edge stopping
+				__m128 blurredVar = zero;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						float w = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+						blurredVar = _mm_add_ps(blurredVar, _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(srcVar + p + dy * (int)stride + dx)));
+					}
+				}
+				__m128 invLumDenominator = _mm_div_ps(_mm_set1_ps(-1.0f), _mm_add_ps(_mm_mul_ps(phiColor, _mm_sqrt_ps(blurredVar)), epsilon));
+				__m128 invDepthDenominator = _mm_div_ps(_mm_set1_ps(-1.0f), _mm_add_ps(_mm_mul_ps(phiDepth, centerDepth), epsilon));
+
+				__m128 sumR = zero;
+				__m128 sumG = zero;
+				__m128 sumB = zero;
+				__m128 sumVar = zero;
+				__m128 sumWeight = zero;
+				for (int ky = 0; ky < 5; ky++)
+				{
+					for (int kx = 0; kx < 5; kx++)
+					{
+						size_t q = p + (ky - 2) * rowStep + (kx - 2) * (int)stepSize;
+
+						__m128 r = _mm_loadu_ps(srcR + q);
+						__m128 g = _mm_loadu_ps(srcG + q);
+						__m128 b = _mm_loadu_ps(srcB + q);
+						__m128 var = _mm_loadu_ps(srcVar + q);
+
+						// Normal weight
+						__m128 nDot = _mm_add_ps(_mm_add_ps(
+							_mm_mul_ps(centerNX, _mm_loadu_ps(normalX.data() + q)),
+							_mm_mul_ps(centerNY, _mm_loadu_ps(normalY.data() + q))),
+							_mm_mul_ps(centerNZ, _mm_loadu_ps(normalZ.data() + q)));
+						__m128 normalWeight = _mm_max_ps(nDot, zero);
+						for (unsigned int s = 0; s < normalSquarings; s++)
+							normalWeight = _mm_mul_ps(normalWeight, normalWeight);
+
+						// Depth and luminance weights share one exp (the denominators are pre-negated)
+						__m128 depthTerm = _mm_mul_ps(Abs(_mm_sub_ps(centerDepth, _mm_loadu_ps(depth.data() + q))), invDepthDenominator);
+						__m128 lumTerm = _mm_mul_ps(Abs(_mm_sub_ps(centerLum, Luminance(r, g, b))), invLumDenominator);
+						__m128 edgeWeight = FastExp(_mm_add_ps(depthTerm, lumTerm));
+
+						__m128 w = _mm_mul_ps(_mm_set1_ps(atrousKernel[kx] * atrousKernel[ky]), _mm_mul_ps(normalWeight, edgeWeight));
+						w = _mm_mul_ps(w, _mm_loadu_ps(valid.data() + q));
+
+						sumR = _mm_add_ps(sumR, _mm_mul_ps(w, r));
+						sumG = _mm_add_ps(sumG, _mm_mul_ps(w, g));
+						sumB = _mm_add_ps(sumB, _mm_mul_ps(w, b));
+						sumVar = _mm_add_ps(sumVar, _mm_mul_ps(_mm_mul_ps(w, w), var));
+						sumWeight = _mm_add_ps(sumWeight, w);
+					}
+				}
+
+				// Misses (and pixels nothing agreed with) keep their value
+				__m128 keep = _mm_or_ps(_mm_cmpeq_ps(centerValid, zero), _mm_cmple_ps(sumWeight, epsilon));
+				__m128 invWeight = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(sumWeight, epsilon));
+				__m128 outR = _mm_mul_ps(sumR, invWeight);
+				__m128 outG = _mm_mul_ps(sumG, invWeight);
+				__m128 outB = _mm_mul_ps(sumB, invWeight);
+				__m128 outVar = _mm_mul_ps(sumVar, _mm_mul_ps(invWeight, invWeight));
+
+				_mm_storeu_ps(dstR + p, _mm_or_ps(_mm_and_ps(keep, centerR), _mm_andnot_ps(keep, outR)));
+				_mm_storeu_ps(dstG + p, _mm_or_ps(_mm_and_ps(keep, centerG), _mm_andnot_ps(keep, outG)));
+				_mm_storeu_ps(dstB + p, _mm_or_ps(_mm_and_ps(keep, centerB), _mm_andnot_ps(keep, outB)));
+				_mm_storeu_ps(dstVar + p, _mm_or_ps(_mm_and_ps(keep, _mm_loadu_ps(srcVar + p)), _mm_andnot_ps(keep, outVar)));
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// Keeps what next frame needs to reproject into this one
+// --------------------------------------------------------
+void Denoiser::StoreHistory(const DenoiserPixel* pixels, unsigned int source)
+{
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				unsigned int p = y * width + x;
+				size_t padded = (size_t)(y + padding) * stride + x + padding;
+
+				previousIllumination[p * 3 + 0] = illumination[source][0][padded];
+				previousIllumination[p * 3 + 1] = illumination[source][1][padded];
+				previousIllumination[p * 3 + 2] = illumination[source][2][padded];
+				previousMoments[p * 2 + 0] = moments[p * 2 + 0];
+				previousMoments[p * 2 + 1] = moments[p * 2 + 1];
+				previousHistoryLength[p] = historyLength[p];
+				previousSurfaces[p].Depth = pixels[p].Depth;
+				previousSurfaces[p].Normal = pixels[p].Normal;
+				previousSurfaces[p].InstanceID = pixels[p].InstanceID;
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// Linear [0,1] to gamma corrected 8 bit, using a lookup
+// table since pow() per channel would dominate at 4K
+// --------------------------------------------------------
+#define DENOISER_GAMMA_TABLE_SIZE 4096
+static const unsigned char* GetGammaTable()
+{
+	static unsigned char gammaTable[DENOISER_GAMMA_TABLE_SIZE];
+	static bool gammaTableReady = false;
+	if (!gammaTableReady)
+	{
+		for (unsigned int i = 0; i < DENOISER_GAMMA_TABLE_SIZE; i++)
+			gammaTable[i] = (unsigned char)(powf(i / (float)(DENOISER_GAMMA_TABLE_SIZE - 1), 1.0f / 2.2f) * 255.0f + 0.5f);
+		gammaTableReady = true;
+	}
+	return gammaTable;
+}
+
+static unsigned char ToGamma(const unsigned char* gammaTable, float value)
+{
+	value = std::min(std::max(value, 0.0f), 1.0f);
+	return gammaTable[(unsigned int)(value * (DENOISER_GAMMA_TABLE_SIZE - 1))];
+}
+
+// --------------------------------------------------------
+// Puts albedo back and writes gamma corrected RGBA8
+// --------------------------------------------------------
+void Denoiser::WriteOutput(unsigned int source, unsigned char* output, unsigned int outputRowPitch)
+{
+	const unsigned char* gammaTable = GetGammaTable();
+
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			unsigned char* row = output + (size_t)y * outputRowPitch;
+			for (unsigned int x = 0; x < width; x++)
+			{
+				unsigned int p = y * width + x;
+				size_t padded = (size_t)(y + padding) * stride + x + padding;
+				for (int c = 0; c < 3; c++)
+					row[x * 4 + c] = ToGamma(gammaTable, illumination[source][c][padded] * albedo[p * 3 + c]);
+				row[x * 4 + 3] = 255;
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// Writes the raw (not denoised) color as gamma corrected
+// RGBA8, exactly as the ray generation shader would
+// --------------------------------------------------------
+void Denoiser::WriteColor(
+	const DenoiserPixel* pixels,
+	unsigned int width,
+	unsigned int height,
+	unsigned char* output,
+	unsigned int outputRowPitch)
+{
+	const unsigned char* gammaTable = GetGammaTable();
+
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			unsigned char* row = output + (size_t)y * outputRowPitch;
+			for (unsigned int x = 0; x < width; x++)
+			{
+				const XMFLOAT3& color = pixels[(size_t)y * width + x].Color;
+				row[x * 4 + 0] = ToGamma(gammaTable, color.x);
+				row[x * 4 + 1] = ToGamma(gammaTable, color.y);
+				row[x * 4 + 2] = ToGamma(gammaTable, color.z);
+				row[x * 4 + 3] = 255;
+			}
+		}
+	}, 4);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Reprojection.h"
+
+// Instance ID written for pixels whose primary ray hit nothing
+// Must match the define in Raytracing.hlsl
+#define DENOISER_INVALID_INSTANCE 0xFFFFFFFF
+
+// Most a-trous passes the denoiser will run (steps of 1, 2, 4 ... 16 pixels)
+#define DENOISER_MAX_ATROUS_ITERATIONS 5
+
+// Per-pixel data written by the ray generation pass
+// Must match the struct in Raytracing.hlsl
+struct DenoiserPixel
+{
+	DirectX::XMFLOAT3	Color;		// Linear radiance averaged over the pixel's rays
+	float				Depth;		// Distance along the primary ray, 0 if it missed
+	DirectX::XMFLOAT3	Normal;		// World space normal at the primary hit
+	unsigned int		InstanceID;	// DENOISER_INVALID_INSTANCE if it missed
+	DirectX::XMFLOAT3	Albedo;		// Surface color at the primary hit
+	float				PreviousDepth;	// Distance of the hit from last frame's camera, where it was last frame
+	DirectX::XMFLOAT2	Motion;		// Screen UV offset to where the hit was last frame
+	DirectX::XMFLOAT2	Padding;	// 64 bytes
+};
+
+struct DenoiserSettings
+{
+	bool			Temporal = true;			// Accumulate with last frame
+	unsigned int	AtrousIterations = 5;		// Wavelet passes (1 to DENOISER_MAX_ATROUS_ITERATIONS)
+	float			ColorAlpha = 0.2f;			// Lowest blend factor for new color
+	float			MomentsAlpha = 0.2f;		// Lowest blend factor for new moments
+	float			PhiColor = 4.0f;			// Luminance edge stopping (in standard deviations)
+	float			PhiNormal = 128.0f;			// Normal edge stopping exponent
+	float			PhiDepth = 0.05f;			// Relative depth edge stopping
+};
+
+// Time spent in each stage of the last Denoise() call
+struct DenoiserTimings
+{
+	double TemporalMs;
+	double VarianceMs;
+	double AtrousMs;
+	double OutputMs;
+	double TotalMs;
+};
+
+// --------------------------------------------------------
+// CPU spatiotemporal denoiser in the style of SVGF
+// (Schied et al. 2017):
+//  1. Demodulate albedo and accumulate the illumination
+//     and its first two luminance moments over time, following
+//     the motion vectors into last frame wherever the history
+//     isn't disoccluded
+//  2. Estimate per-pixel variance from the moments (or
+//     spatially where there's little history)
+//  3. Run several a-trous wavelet passes whose weights stop
+//     at depth, normal and luminance edges, the latter
+//     scaled by the filtered variance
+//  4. Re-modulate albedo and write 8 bit gamma corrected color
+//
+// Only depends on the standard library and SSE, so it also
+// runs headless.  Rows are split across the JobSystem and
+// the wavelet passes process four pixels at a time.
+// --------------------------------------------------------
+class Denoiser
+{
+public:
+	Denoiser();
+
+	// Denoises a frame and writes RGBA8 rows into output, which
+	// may have a row pitch larger than width * 4 (as upload buffers do)
+	void Denoise(
+		const DenoiserPixel* pixels,
+		unsigned int width,
+		unsigned int height,
+		const DenoiserSettings& settings,
+		unsigned char* output,
+		unsigned int outputRowPitch);
+
+	// Forget all history (camera cuts, resizes, etc.)
+	void Reset();
+
+	// Writes pixels' color without denoising, in the same RGBA8 format
+	static void WriteColor(
+		const DenoiserPixel* pixels,
+		unsigned int width,
+		unsigned int height,
+		unsigned char* output,
+		unsigned int outputRowPitch);
+
+	const DenoiserTimings& GetTimings() const { return timings; }
+
+private:
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;	// Width of the padded planes
+	unsigned int padding;	// Border around the padded planes
+	bool hasHistory;
+	DenoiserTimings timings;
+
+	// Padded planes (structure of arrays) used by the wavelet passes
+	std::vector<float> illumination[2][3];	// Ping-pong RGB
+	std::vector<float> variance[2];
+	std::vector<float> depth;
+	std::vector<float> normalX;
+	std::vector<float> normalY;
+	std::vector<float> normalZ;
+	std::vector<float> valid;				// 1 for hits, 0 for misses and padding
+
+	// Unpadded per-pixel data for this frame and history from last frame
+	std::vector<float> albedo;				// RGB
+	std::vector<float> moments;				// Luminance and luminance squared
+	std::vector<float> historyLength;
+	std::vector<float> previousIllumination;	// RGB
+	std::vector<float> previousMoments;
+	std::vector<float> previousHistoryLength;
+	std::vector<ReprojectionSurface> previousSurfaces;
+
+	void Resize(unsigned int width, unsigned int height);
+	void TemporalAccumulation(const DenoiserPixel* pixels, const DenoiserSettings& settings);
+	void EstimateVariance();
+	void AtrousPass(unsigned int source, unsigned int stepSize, const DenoiserSettings& settings);
+	void StoreHistory(const DenoiserPixel* pixels, unsigned int source);
+	void WriteOutput(unsigned int source, unsigned char* output, unsigned int outputRowPitch);
+};
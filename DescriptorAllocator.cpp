@@ -0,0 +1,213 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+
+DescriptorAllocator::DescriptorAllocator() :
+	timeline(0),
+	capacity(0),
+	searchStart(0),
+	allocated(0),
+	pendingFreeCount(0),
+	highWaterMark(0),
+	failedAllocations(0),
+	staleHandleUses(0)
+{
+}
+
+// --------------------------------------------------------
+// Starts with every slot free and at generation 1
+// (so a default constructed handle never validates)
+// --------------------------------------------------------
+void DescriptorAllocator::Initialize(GPUTimeline* timeline, unsigned int capacity)
+{
+	this->timeline = timeline;
+	this->capacity = capacity;
+	usedBits.assign((capacity + 63) / 64, 0);
+	generations.assign(capacity, 1);
+	pendingFrees.clear();
+	searchStart = 0;
+	allocated = 0;
+	pendingFreeCount = 0;
+	highWaterMark = 0;
+	failedAllocations = 0;
+	staleHandleUses = 0;
+
+	// Bits past the end of the last word are never free
+	for (unsigned int slot = capacity; slot < usedBits.size() * 64; slot++)
+		usedBits[slot / 64] |= 1ull << (slot % 64);
+}
+
+// --------------------------------------------------------
+// Next-fit search for a free run, after retiring whatever
+// the GPU has finished with
+// --------------------------------------------------------
+DescriptorHandle DescriptorAllocator::Allocate(unsigned int count)
+{
+	DescriptorHandle handle;
+	if (count == 0)
+		return handle;
+
+	Retire();
+
+	unsigned int index = 0;
+	if (!FindFreeRange(count, index))
+	{
+		failedAllocations++;
+		return handle;
+	}
+
+	SetRange(index, count, true);
+	searchStart = (index + count) % capacity;
+	allocated += count;
+	highWaterMark = std::max(highWaterMark, allocated);
+
+	// Slots in the range may have been freed different numbers of times,
+	// so bring them all up to the newest generation among them (which is
+	// still newer than any stale handle to any of them)
+	unsigned int generation = *std::max_element(generations.begin() + index, generations.begin() + index + count);
+	for (unsigned int i = 0; i < count; i++)
+		generations[index + i] = generation;
+
+	handle.Index = index;
+	handle.Count = count;
+	handle.Generation = generation;
+	return handle;
+}
+
+// --------------------------------------------------------
+// Bumps the generation right away so the handle (and any
+// copies of it) stop validating, but keeps the slots
+// reserved until the GPU is done with them
+// --------------------------------------------------------
+void DescriptorAllocator::Free(DescriptorHandle& handle)
+{
+	if (!Validate(handle))
+		return;
+
+	for (unsigned int i = 0; i < handle.Count; i++)
+		generations[handle.Index + i]++;
+
+	pendingFrees.push_back({ handle.Index, handle.Count, 0 });
+	pendingFreeCount += handle.Count;
+	handle = DescriptorHandle();
+}
+
+// --------------------------------------------------------
+// Tags this frame's frees with its fence
+// --------------------------------------------------------
+void DescriptorAllocator::EndFrame(uint64_t fenceValue)
+{
+	for (PendingFree& pending : pendingFrees)
+	{
+		if (pending.FenceValue == 0)
+			pending.FenceValue = fenceValue;
+	}
+}
+
+// --------------------------------------------------------
+// Frees are queued in frame order, so stop at the first
+// one that's still in use (or whose frame hasn't ended)
+// --------------------------------------------------------
+void DescriptorAllocator::Retire()
+{
+	if (pendingFrees.empty())
+		return;
+
+	uint64_t completed = timeline->GetCompletedValue();
+	while (!pendingFrees.empty() &&
+		pendingFrees.front().FenceValue != 0 &&
+		pendingFrees.front().FenceValue <= completed)
+	{
+		const PendingFree& pending = pendingFrees.front();
+		SetRange(pending.Index, pending.Count, false);
+		allocated -= pending.Count;
+		pendingFreeCount -= pending.Count;
+		pendingFrees.pop_front();
+	}
+}
+
+// --------------------------------------------------------
+// A handle is only valid while every slot in its range is
+// allocated and still at the generation it was given
+// --------------------------------------------------------
+bool DescriptorAllocator::Validate(const DescriptorHandle& handle)
+{
+	bool valid = handle.IsValid() && handle.Index + handle.Count <= capacity;
+	for (unsigned int i = 0; valid && i < handle.Count; i++)
+		valid = IsUsed(handle.Index + i) && generations[handle.Index + i] == handle.Generation;
+
+	if (!valid)
+		staleHandleUses++;
+	return valid;
+}
+
+DescriptorAllocatorStats DescriptorAllocator::GetStats() const
+{
+	DescriptorAllocatorStats stats = {};
+	stats.Capacity = capacity;
+	stats.Allocated = allocated;
+	stats.PendingFree = pendingFreeCount;
+	stats.HighWaterMark = highWaterMark;
+	stats.FailedAllocations = failedAllocations;
+	stats.StaleHandleUses = staleHandleUses;
+
+	unsigned int run = 0;
+	for (unsigned int slot = 0; slot < capacity; slot++)
+	{
+		run = IsUsed(slot) ? 0 : run + 1;
+		stats.LargestFreeRange = std::max(stats.LargestFreeRange, run);
+	}
+	return stats;
+}
+
+// --------------------------------------------------------
+// Marks a range of slots used or free
+// --------------------------------------------------------
+void DescriptorAllocator::SetRange(unsigned int index, unsigned int count, bool used)
+{
+	for (unsigned int slot = index; slot < index + count; slot++)
+	{
+		if (used)
+			usedBits[slot / 64] |= 1ull << (slot % 64);
+		else
+			usedBits[slot / 64] &= ~(1ull << (slot % 64));
+	}
+}
+
+// --------------------------------------------------------
+// Looks for count free slots in a row, starting at the
+// search position and wrapping once.  Full words are
+// skipped 64 slots at a time.
+// --------------------------------------------------------
+bool DescriptorAllocator::FindFreeRange(unsigned int count, unsigned int& index) const
+{
+	if (count > capacity)
+		return false;
+
+	// Two passes: from the search position to the end, then from the start
+	unsigned int passStart[2] = { searchStart, 0 };
+	unsigned int passEnd[2] = { capacity, std::min(capacity, searchStart + count - 1) };
+	for (unsigned int pass = 0; pass < 2; pass++)
+	{
+		unsigned int run = 0;
+		unsigned int slot = passStart[pass];
+		while (slot < passEnd[pass])
+		{
+			if (slot % 64 == 0 && usedBits[slot / 64] == ~0ull)
+			{
+				run = 0;
+				slot += 64;
+				continue;
+			}
+
+			run = IsUsed(slot) ? 0 : run + 1;
+			slot++;
+			if (run == count)
+			{
+				index = slot - count;
+				return true;
+			}
+		}
+	}
+	return false;
+}
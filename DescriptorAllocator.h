@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "FrameScheduler.h"
+
+// A contiguous range of descriptors from a DescriptorAllocator.
+// The generation is the one its slots had when it was allocated,
+// so a freed (or double freed) handle can be told apart from
+// whatever is allocated in the same place later.
+struct DescriptorHandle
+{
+	unsigned int Index = 0;			// First descriptor, relative to the allocator's range
+	unsigned int Count = 0;			// 0 for an invalid handle
+	unsigned int Generation = 0;
+
+	bool IsValid() const { return Count > 0; }
+};
+
+// Where the allocator currently stands
+struct DescriptorAllocatorStats
+{
+	unsigned int Capacity;
+	unsigned int Allocated;			// Live, plus freed ones the GPU may still read
+	unsigned int PendingFree;		// Freed, waiting on the GPU
+	unsigned int HighWaterMark;		// Most ever allocated at once
+	unsigned int LargestFreeRange;	// Biggest table that would fit right now
+	unsigned int FailedAllocations;
+	unsigned int StaleHandleUses;	// Frees or lookups of handles that were already freed
+};
+
+// --------------------------------------------------------
+// Hands out ranges of slots in a descriptor heap (or part
+// of one), tracked with a bitmap so freed slots are reused
+// and tables get contiguous runs.  Frees are deferred until
+// the fence of the frame they happened in completes, since
+// commands already recorded may still use the descriptors.
+//
+// Only indices are tracked, so it runs without a device.
+// --------------------------------------------------------
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator();
+
+	void Initialize(GPUTimeline* timeline, unsigned int capacity);
+
+	// Contiguous range of count descriptors, or an invalid handle if
+	// there's no run that long (even after retiring finished frees)
+	DescriptorHandle Allocate(unsigned int count = 1);
+
+	// Invalidates the handle immediately, but its slots are only reused
+	// once the fence of the frame it was freed in has completed
+	void Free(DescriptorHandle& handle);
+
+	// Frees since the last call belong to the frame signaling this fence
+	void EndFrame(uint64_t fenceValue);
+
+	// Makes slots available again once the GPU is done with them
+	void Retire();
+
+	// Is this handle still the owner of its slots?  Counts a stale use if not.
+	bool Validate(const DescriptorHandle& handle);
+
+	DescriptorAllocatorStats GetStats() const;
+
+private:
+	struct PendingFree
+	{
+		unsigned int Index;
+		unsigned int Count;
+		uint64_t FenceValue;	// 0 until the frame it was freed in ends
+	};
+
+	GPUTimeline* timeline;
+	unsigned int capacity;
+	std::vector<uint64_t> usedBits;			// One bit per slot
+	std::vector<unsigned int> generations;	// Per slot, bumped on free
+	std::deque<PendingFree> pendingFrees;
+	unsigned int searchStart;				// Next-fit: start looking after the last allocation
+
+	unsigned int allocated;
+	unsigned int pendingFreeCount;
+	unsigned int highWaterMark;
+	unsigned int failedAllocations;
+	unsigned int staleHandleUses;
+
+	bool IsUsed(unsigned int slot) const { return (usedBits[slot / 64] >> (slot % 64)) & 1; }
+	void SetRange(unsigned int index, unsigned int count, bool used);
+	bool FindFreeRange(unsigned int count, unsigned int& index) const;
+};
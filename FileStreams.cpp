@@ -0,0 +1,84 @@
+#include "FileStreams.h"
+
+#include <cstdint>
+
+// --------------------------------------------------------
+// Encodes each character as UTF-8.  wchar_t holds whole
+// code points everywhere this is used (it's only UTF-16
+// on Windows, where paths stay wide).
+// --------------------------------------------------------
+std::string GetNarrowPath(const std::wstring& path)
+{
+	std::string narrow;
+	narrow.reserve(path.size());
+	for (wchar_t c : path)
+	{
+		uint32_t code = (uint32_t)c;
+		if (code < 0x80)
+			narrow += (char)code;
+		else if (code < 0x800)
+		{
+			narrow += (char)(0xC0 | (code >> 6));
+			narrow += (char)(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			narrow += (char)(0xE0 | (code >> 12));
+			narrow += (char)(0x80 | ((code >> 6) & 0x3F));
+			narrow += (char)(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			narrow += (char)(0xF0 | ((code >> 18) & 0x07));
+			narrow += (char)(0x80 | ((code >> 12) & 0x3F));
+			narrow += (char)(0x80 | ((code >> 6) & 0x3F));
+			narrow += (char)(0x80 | (code & 0x3F));
+		}
+	}
+	return narrow;
+}
+
+bool OpenFile(std::ifstream& file, const std::wstring& path, std::ios::openmode mode)
+{
+#ifdef _MSC_VER
+	file.open(path.c_str(), mode | std::ios::binary);
+#else
+	file.open(GetNarrowPath(path), mode | std::ios::binary);
+#endif
+	return file.is_open();
+}
+
+bool OpenFile(std::ofstream& file, const std::wstring& path, std::ios::openmode mode)
+{
+#ifdef _MSC_VER
+	file.open(path.c_str(), mode | std::ios::binary);
+#else
+	file.open(GetNarrowPath(path), mode | std::ios::binary);
+#endif
+	return file.is_open();
+}
+
+bool ReadWholeFile(const std::wstring& path, std::vector<unsigned char>& data)
+{
+	std::ifstream file;
+	if (!OpenFile(file, path, std::ios::in | std::ios::ate))
+		return false;
+
+	std::streamoff size = file.tellg();
+	if (size < 0)
+		return false;
+	data.resize((size_t)size);
+	file.seekg(0);
+	file.read((char*)data.data(), size);
+	return file.good();
+}
+
+bool WriteWholeFile(const std::wstring& path, const void* data, size_t size)
+{
+	std::ofstream file;
+	if (!OpenFile(file, path))
+		return false;
+
+	file.write((const char*)data, size);
+	return file.good();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// File streams opened by wide path, as paths are kept
+// everywhere in the renderer.  MSVC's streams take wide
+// paths as they are; elsewhere they're converted to UTF-8.
+// --------------------------------------------------------
+
+// A wide path as the narrow (UTF-8) one the OS expects off Windows
+std::string GetNarrowPath(const std::wstring& path);
+
+// Opens in binary mode, plus whatever else is asked for
+bool OpenFile(std::ifstream& file, const std::wstring& path, std::ios::openmode mode = std::ios::in);
+bool OpenFile(std::ofstream& file, const std::wstring& path, std::ios::openmode mode = std::ios::out | std::ios::trunc);
+
+// The whole file at once, replacing whatever was in data
+bool ReadWholeFile(const std::wstring& path, std::vector<unsigned char>& data);
+bool WriteWholeFile(const std::wstring& path, const void* data, size_t size);
@@ -0,0 +1,180 @@
+#include "FrameRingAllocator.h"
+
+#include <algorithm>
+
+FrameRingAllocator::FrameRingAllocator() :
+	timeline(0),
+	growable(false),
+	capacity(0),
+	head(0),
+	tail(0),
+	used(0),
+	currentFrameSize(0),
+	currentFrameAllocated(0),
+	highWaterMark(0),
+	frameHighWaterMark(0),
+	growCount(0),
+	stallCount(0)
+{
+}
+
+// --------------------------------------------------------
+// Sets the fence to retire frames against and the initial
+// amount of space
+// --------------------------------------------------------
+void FrameRingAllocator::Initialize(GPUTimeline* timeline, uint64_t capacity, bool growable)
+{
+	this->timeline = timeline;
+	this->capacity = capacity;
+	this->growable = growable;
+	head = 0;
+	tail = 0;
+	used = 0;
+	currentFrameSize = 0;
+	currentFrameAllocated = 0;
+	frames.clear();
+	ResetStats();
+}
+
+// --------------------------------------------------------
+// Retires what it can, then grows or waits on the GPU if
+// the allocation still doesn't fit
+// --------------------------------------------------------
+bool FrameRingAllocator::Allocate(uint64_t size, uint64_t& offset, uint64_t alignment)
+{
+	if (alignment == 0)
+		alignment = 1;
+
+	Retire();
+	if (TryAllocate(size, alignment, offset))
+		return true;
+
+	if (growable)
+	{
+		Grow(size);
+		return TryAllocate(size, alignment, offset);
+	}
+
+	// Wait for frames in flight one at a time, oldest first
+	while (!frames.empty())
+	{
+		stallCount++;
+		timeline->WaitForValue(frames.front().FenceValue);
+		Retire();
+		if (TryAllocate(size, alignment, offset))
+			return true;
+	}
+
+	// Even the whole ring isn't enough for this frame
+	return false;
+}
+
+// --------------------------------------------------------
+// Closes off the current frame's span
+// --------------------------------------------------------
+void FrameRingAllocator::EndFrame(uint64_t fenceValue)
+{
+	if (currentFrameSize > 0)
+		frames.push_back({ fenceValue, currentFrameSize });
+
+	frameHighWaterMark = std::max(frameHighWaterMark, currentFrameAllocated);
+	currentFrameSize = 0;
+	currentFrameAllocated = 0;
+}
+
+// --------------------------------------------------------
+// Frames finish in order, so the tail just moves past each
+// finished frame's span
+// --------------------------------------------------------
+void FrameRingAllocator::Retire()
+{
+	if (frames.empty())
+		return;
+
+	uint64_t completed = timeline->GetCompletedValue();
+	while (!frames.empty() && frames.front().FenceValue <= completed)
+	{
+		tail = (tail + frames.front().Size) % capacity;
+		used -= frames.front().Size;
+		frames.pop_front();
+	}
+}
+
+void FrameRingAllocator::ResetStats()
+{
+	highWaterMark = used;
+	frameHighWaterMark = 0;
+	growCount = 0;
+	stallCount = 0;
+}
+
+// --------------------------------------------------------
+// Free space is [head, capacity) + [0, tail) when the used
+// space doesn't wrap, or [head, tail) when it does.
+// Allocations never straddle the end; the space skipped to
+// wrap or align is charged to the current frame.
+// --------------------------------------------------------
+bool FrameRingAllocator::TryAllocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+	if (size > capacity)
+		return false;
+
+	// Start from the beginning whenever everything is free
+	if (used == 0)
+	{
+		head = 0;
+		tail = 0;
+	}
+
+	uint64_t start = (head + alignment - 1) / alignment * alignment;
+	uint64_t consumed = 0;
+	if (head >= tail && used < capacity)
+	{
+		if (start + size <= capacity)
+		{
+			offset = start;
+			consumed = start - head + size;
+		}
+		else if (size <= tail)
+		{
+			offset = 0;
+			consumed = (capacity - head) + size;
+		}
+		else
+			return false;
+	}
+	else
+	{
+		if (start + size > tail)
+			return false;
+		offset = start;
+		consumed = start - head + size;
+	}
+
+	head = (offset + size) % capacity;
+	used += consumed;
+	currentFrameSize += consumed;
+	currentFrameAllocated += size;
+	highWaterMark = std::max(highWaterMark, used);
+	return true;
+}
+
+// --------------------------------------------------------
+// Doubles until the allocation fits and starts over with
+// an empty ring (everything allocated so far lives in the
+// old backing memory)
+// --------------------------------------------------------
+void FrameRingAllocator::Grow(uint64_t minimumSize)
+{
+	uint64_t newCapacity = std::max(capacity, (uint64_t)1);
+	while (newCapacity < minimumSize || newCapacity <= capacity)
+		newCapacity *= 2;
+
+	capacity = newCapacity;
+	head = 0;
+	tail = 0;
+	used = 0;
+	currentFrameSize = 0;
+	frames.clear();
+	growCount++;
+}
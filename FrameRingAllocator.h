@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "FrameScheduler.h"
+
+// --------------------------------------------------------
+// Hands out space (bytes of an upload heap, slots of a
+// descriptor heap, etc.) linearly within each frame, and
+// only reuses a frame's space once the GPU's fence shows
+// that frame has finished.  Doesn't own any memory, just
+// offsets into it, so it can run against a fake fence.
+//
+// When an allocation doesn't fit, a growable ring doubles
+// its capacity and starts over at offset 0 (the owner must
+// create new backing memory and keep the old one alive
+// until the GPU is done with it).  A fixed ring waits for
+// the oldest frame in flight instead.
+// --------------------------------------------------------
+class FrameRingAllocator
+{
+public:
+	FrameRingAllocator();
+
+	void Initialize(GPUTimeline* timeline, uint64_t capacity, bool growable);
+
+	// Reserves size units for the current frame, starting at a multiple of
+	// alignment.  Returns false only if a fixed ring can't fit it even with
+	// nothing else in flight.
+	bool Allocate(uint64_t size, uint64_t& offset, uint64_t alignment = 1);
+
+	// Everything allocated since the last call belongs to the frame
+	// that signals this fence value
+	void EndFrame(uint64_t fenceValue);
+
+	// Frees space from frames the GPU has finished
+	void Retire();
+
+	uint64_t GetCapacity() const { return capacity; }
+	uint64_t GetUsed() const { return used; }
+	unsigned int GetFramesInFlight() const { return (unsigned int)frames.size(); }
+
+	// Stats
+	uint64_t GetHighWaterMark() const { return highWaterMark; }				// Most in use at once (all frames in flight)
+	uint64_t GetFrameHighWaterMark() const { return frameHighWaterMark; }	// Most used by a single frame
+	unsigned int GetGrowCount() const { return growCount; }
+	unsigned int GetStallCount() const { return stallCount; }
+	void ResetStats();
+
+private:
+	struct FrameSpan
+	{
+		uint64_t FenceValue;
+		uint64_t Size;		// Including padding skipped when wrapping
+	};
+
+	GPUTimeline* timeline;
+	bool growable;
+	uint64_t capacity;
+	uint64_t head;		// Next free offset
+	uint64_t tail;		// Oldest offset still in use
+	uint64_t used;
+	uint64_t currentFrameSize;
+	uint64_t currentFrameAllocated;	// For stats (survives growing)
+	std::deque<FrameSpan> frames;
+
+	uint64_t highWaterMark;
+	uint64_t frameHighWaterMark;
+	unsigned int growCount;
+	unsigned int stallCount;
+
+	bool TryAllocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+	void Grow(uint64_t minimumSize);
+};
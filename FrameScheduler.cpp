@@ -0,0 +1,77 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+
+FrameScheduler::FrameScheduler() :
+	timeline(0),
+	framesInFlight(1),
+	requestedFramesInFlight(1),
+	frameIndex(0),
+	frameNumber(0),
+	frameFenceValues{},
+	lastFrameFenceValue(0),
+	stallCount(0)
+{
+}
+
+// --------------------------------------------------------
+// Sets the timeline to schedule against and how far ahead
+// the CPU may get
+// --------------------------------------------------------
+void FrameScheduler::Initialize(GPUTimeline* timeline, unsigned int framesInFlight)
+{
+	this->timeline = timeline;
+	this->framesInFlight = std::min(std::max(framesInFlight, 1u), (unsigned int)FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT);
+	requestedFramesInFlight = this->framesInFlight;
+	frameIndex = 0;
+	frameNumber = 0;
+	lastFrameFenceValue = 0;
+	stallCount = 0;
+	for (unsigned int i = 0; i < FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT; i++)
+		frameFenceValues[i] = 0;
+}
+
+// --------------------------------------------------------
+// Signals the end of the current frame and moves to the
+// next slot, waiting only if the frame that last used it
+// is still running on the GPU
+// --------------------------------------------------------
+void FrameScheduler::EndFrame()
+{
+	lastFrameFenceValue = timeline->Signal();
+	frameFenceValues[frameIndex] = lastFrameFenceValue;
+	frameNumber++;
+
+	// Changing the count changes which frame each slot belongs to,
+	// so only do that once nothing is in flight
+	if (requestedFramesInFlight != framesInFlight)
+	{
+		timeline->WaitForValue(lastFrameFenceValue);
+		framesInFlight = requestedFramesInFlight;
+	}
+
+	frameIndex = (unsigned int)(frameNumber % framesInFlight);
+
+	// Is the GPU still using this slot's resources?
+	if (!IsComplete(frameFenceValues[frameIndex]))
+	{
+		stallCount++;
+		timeline->WaitForValue(frameFenceValues[frameIndex]);
+	}
+}
+
+// --------------------------------------------------------
+// Waits for all submitted work, frames or otherwise
+// --------------------------------------------------------
+void FrameScheduler::WaitForIdle()
+{
+	timeline->WaitForValue(timeline->Signal());
+}
+
+// --------------------------------------------------------
+// Clamped to what per-frame resources are sized for
+// --------------------------------------------------------
+void FrameScheduler::SetFramesInFlight(unsigned int framesInFlight)
+{
+	requestedFramesInFlight = std::min(std::max(framesInFlight, 1u), (unsigned int)FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT);
+}
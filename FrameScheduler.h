@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+// Most frames the CPU may record ahead of the GPU
+// (per-frame resources are sized for this many)
+#define FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT 3
+
+// --------------------------------------------------------
+// A GPU queue as the CPU sees it: a fence that's signaled
+// once everything submitted before it has finished, and a
+// way to wait for that.  Values only ever increase, and 0
+// is never signaled (so it means "nothing to wait for").
+// --------------------------------------------------------
+class GPUTimeline
+{
+public:
+	virtual ~GPUTimeline() {}
+
+	// Queues a signal after all work submitted so far and returns its value
+	virtual uint64_t Signal() = 0;
+
+	// Highest value the GPU has reached
+	virtual uint64_t GetCompletedValue() = 0;
+
+	// Blocks the CPU until the GPU reaches a value
+	virtual void WaitForValue(uint64_t value) = 0;
+};
+
+// --------------------------------------------------------
+// Lets the CPU record up to N frames ahead of the GPU.
+// Each frame in flight has a slot (GetFrameIndex()) that
+// picks its command allocator and any other per-frame
+// resources, plus the fence value signaled when it was
+// submitted.  Moving on to a slot only waits if the GPU
+// hasn't finished the last frame that used it, so the CPU
+// blocks only once it's N frames ahead.
+// --------------------------------------------------------
+class FrameScheduler
+{
+public:
+	FrameScheduler();
+
+	void Initialize(GPUTimeline* timeline, unsigned int framesInFlight);
+
+	// Call once the frame's work has been submitted: signals its fence
+	// and moves on to the next frame's slot, which is free to reuse
+	// once this returns
+	void EndFrame();
+
+	// Blocks until everything submitted so far has finished
+	void WaitForIdle();
+
+	// Takes effect at the end of the current frame (which waits for
+	// the GPU to go idle, since slots are renumbered)
+	void SetFramesInFlight(unsigned int framesInFlight);
+	unsigned int GetFramesInFlight() const { return framesInFlight; }
+
+	// Slot of the frame being recorded
+	unsigned int GetFrameIndex() const { return frameIndex; }
+	uint64_t GetFrameNumber() const { return frameNumber; }
+
+	// Fence value of the most recently ended frame
+	uint64_t GetLastFrameFenceValue() const { return lastFrameFenceValue; }
+
+	// Has the GPU finished everything up to this fence value?
+	bool IsComplete(uint64_t fenceValue) { return fenceValue <= timeline->GetCompletedValue(); }
+
+	// How many times EndFrame() had to block on the GPU
+	unsigned int GetStallCount() const { return stallCount; }
+
+private:
+	GPUTimeline* timeline;
+	unsigned int framesInFlight;
+	unsigned int requestedFramesInFlight;
+	unsigned int frameIndex;
+	uint64_t frameNumber;
+	uint64_t frameFenceValues[FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT];
+	uint64_t lastFrameFenceValue;
+	unsigned int stallCount;
+};
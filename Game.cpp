@@ -5,6 +5,30 @@
 #include "BufferStructs.h"
 #include "DX12Helper.h"
 #include "RaytracingHelper.h"
+#include "LightSampler.h"
+#include "ReservoirResampler.h"
+#include "Denoiser.h"
+#include "Upscaler.h"
+#include "FrameScheduler.h"
+#include "FrameRingAllocator.h"
+#include "DescriptorAllocator.h"
+#include "HeapSubAllocator.h"
+#include "StagingRing.h"
+#include "ResourceStateTracker.h"
+#include "RenderGraph.h"
+#include "ShaderTableBuilder.h"
+#include "InstanceBuffer.h"
+#include "DeferredReleaseQueue.h"
+#include "BLASBuildQueue.h"
+#include "AccelerationStructureTracker.h"
+#include "PipelineCache.h"
+#include "FileStreams.h"
+#include "TextureManager.h"
+#include "MipGenerator.h"
+#include "BlockCompressor.h"
+#include "MaterialCompiler.h"
+#include "MipResidency.h"
+#include "TextureAtlas.h"
 
 #include "Vendor/imgui-1.87/imgui.h"
 #include "imgui_impl_dx12.h"
@@ -61,6 +85,7 @@ Game::Game(HINSTANCE hInstance)
 		CameraProjectionType::Perspective);
 
 	dx12Helper = &DX12Helper::GetInstance();
+	frameGraph.Initialize(dx12Helper->GetRenderGraphBackend(), &dx12Helper->GetResourceStates());
 }
 
 // --------------------------------------------------------
@@ -78,6 +103,11 @@ Game::~Game()
 	// - Note: this is unnecessary for D3D objects stored in ComPtrs
 	DX12Helper::GetInstance().WaitForGPU();
 
+	//the materials only borrow the atlas page tables
+	for (DescriptorHandle& table : atlasPageTables) {
+		DX12Helper::GetInstance().FreeSrvUavDescriptors(table);
+	}
+
 	//RaytracingHelper::GetINstance().
 	
 	//clear imgui
@@ -125,7 +155,7 @@ void Game::Init()
 
 		// Initialize helper Platform and Renderer backends (here we are using imgui_impl_win32.cpp and imgui_impl_dx11.cpp)
 		ImGui_ImplWin32_Init(this->hWnd);
-		ImGui_ImplDX12_Init(device.Get(), this->numBackBuffers, DXGI_FORMAT_R8G8B8A8_UNORM, DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get(), cpuHandle, gpuHandle);
+		ImGui_ImplDX12_Init(device.Get(), FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT, DXGI_FORMAT_R8G8B8A8_UNORM, DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get(), cpuHandle, gpuHandle);
 	}
 
 	// Helper methods for loading shaders, creating some basic
@@ -136,6 +166,9 @@ void Game::Init()
 	LoadTexturesAndCreateMaterials();
 	CreateEntities();
 	CreateLights();
+
+	// Next launch can skip compiling anything created by now
+	dx12Helper->SavePipelineCache();
 }
 
 // --------------------------------------------------------
@@ -189,6 +222,7 @@ void Game::CreateRootSigAndPipelineState()
 	}
 
 	// Root Signature
+	PipelineKeyHasher rootSignatureHasher;
 	{
 		// Describe the range of CBVs needed for the vertex shader
 		D3D12_DESCRIPTOR_RANGE cbvRangeVS = {};
@@ -207,7 +241,7 @@ void Game::CreateRootSigAndPipelineState()
 		// Create a range of SRV's for textures
 		D3D12_DESCRIPTOR_RANGE srvRange = {};
 		srvRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-		srvRange.NumDescriptors = 4; // Set to max number of textures at once (match pixel shader!)
+		srvRange.NumDescriptors = 3; // Set to max number of textures at once (match pixel shader!)
 		srvRange.BaseShaderRegister = 0; // Starts at s0 (match pixel shader!)
 		srvRange.RegisterSpace = 0;
 		srvRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
@@ -265,6 +299,8 @@ void Game::CreateRootSigAndPipelineState()
 			serializedRootSig->GetBufferPointer(),
 			serializedRootSig->GetBufferSize(),
 			IID_PPV_ARGS(rootSignature.GetAddressOf()));
+		// The pipeline cache's key includes the root signature
+		rootSignatureHasher.Add(serializedRootSig->GetBufferPointer(), serializedRootSig->GetBufferSize());
 	}
 
 	// Pipeline state
@@ -302,9 +338,8 @@ void Game::CreateRootSigAndPipelineState()
 			D3D12_COLOR_WRITE_ENABLE_ALL;
 		// -- Misc ---
 		psoDesc.SampleMask = 0xffffffff;
-		// Create the pipe state object
-		device->CreateGraphicsPipelineState(&psoDesc,
-			IID_PPV_ARGS(pipelineState.GetAddressOf()));
+		// Create the pipe state object (from the pipeline cache, if it's there)
+		pipelineState = dx12Helper->CreateGraphicsPipelineState("Rasterized", psoDesc, rootSignatureHasher.GetHash());
 	}
 }
 
@@ -356,37 +391,144 @@ void Game::LoadTexturesAndCreateMaterials()
 	}
 
 	//add appropriate textures to each material
-	//materials[0]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/bronze_albedo.png").c_str()), 0);
-	//materials[0]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/bronze_metal.png").c_str()), 1);
-	//materials[0]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/bronze_normals.png").c_str()), 2);
-	//materials[0]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/bronze_roughness.png").c_str()), 3);
-	//
-	//materials[1]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/cobblestone_albedo.png").c_str()), 0);
-	//materials[1]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/cobblestone_metal.png").c_str()), 1);
-	//materials[1]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/cobblestone_normals.png").c_str()), 2);
-	//materials[1]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/cobblestone_roughness.png").c_str()), 3);
-	//
-	//materials[2]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/paint_albedo.png").c_str()), 0);
-	//materials[2]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/paint_metal.png").c_str()), 1);
-	//materials[2]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/paint_normals.png").c_str()), 2);
-	//materials[2]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/paint_roughness.png").c_str()), 3);
-	//
-	//materials[3]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_albedo.png").c_str()), 0);
-	//materials[3]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_metal.png").c_str()), 1);
-	//materials[3]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_normals.png").c_str()), 2);
-	//materials[3]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_roughness.png").c_str()), 3);
+	//(occlusion, roughness and metal are packed into one
+	//texture in the texture cache, rebuilt if a map changes)
+	//bronze's material is still disabled above, so the sets
+	//start at cobblestone
+	const wchar_t* sets[] = { L"cobblestone", L"paint", L"scratched" };
+	const int texturedMaterials = 3;
+	std::vector<CompiledMaterial> compiledSets;
+	for (int i = 0; i < texturedMaterials; i++) {
+		CompiledMaterial compiled = MaterialCompiler::Compile(
+			MaterialCompiler::GetSourcesForSet(FixPath(L"../../Assets/Textures/"), sets[i]),
+			dx12Helper->GetTextureCacheDirectory());
+		materials[i]->AddTexture(dx12Helper->LoadTexture(compiled.Albedo.c_str()), MATERIAL_SLOT_ALBEDO);
+		materials[i]->AddTexture(dx12Helper->LoadTexture(compiled.Normals.c_str()), MATERIAL_SLOT_NORMALS);
+		materials[i]->AddTexture(dx12Helper->LoadTexture(compiled.ORM.c_str()), MATERIAL_SLOT_ORM);
+		compiledSets.push_back(compiled);
+	}
 
-	//
-	//for (int i = 0; i < materials.size(); i++) {
+	//decode and upload everything requested above in one go
+	//(paths requested more than once are only loaded once)
+	dx12Helper->FinishTextureLoads();
 
-	//	//'fake' textures to prevent seg faults
-	//	materials[i]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_albedo.png").c_str()), 0);
-	//	materials[i]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_metal.png").c_str()), 1);
-	//	materials[i]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_normals.png").c_str()), 2);
-	//	materials[i]->AddTexture(dx12Helper->LoadTexture(FixPath(L"../../Assets/Textures/scratched_roughness.png").c_str()), 3);
+	for (int i = 0; i < texturedMaterials; i++) {
+		materials[i]->FinalizeMaterial();
+	}
 
-	//	materials[i]->FinalizeMaterial();
-	//}
+	//the random materials sample the sets too, but through
+	//atlas pages rather than textures of their own
+	CreateAtlasMaterials(compiledSets, texturedMaterials);
+}
+
+// --------------------------------------------------------
+// Gives the materials from firstMaterial on small versions
+// of the sets (their 256, 128 or 64 texel mips), packed
+// into atlas pages.  Every material on a page shares its
+// three textures and one table, where each would otherwise
+// need three textures and a table of its own.
+// --------------------------------------------------------
+void Game::CreateAtlasMaterials(const std::vector<CompiledMaterial>& sets, int firstMaterial)
+{
+	const unsigned int sizes[] = { 256, 128, 64 };
+	const unsigned int layerCount = 3;
+
+	//full chains of each set's layers, then each size's
+	//part of them as a chain of its own
+	std::vector<std::vector<DecodedImage>> chains;
+	for (const CompiledMaterial& set : sets) {
+		const std::wstring* paths[layerCount] = { &set.Albedo, &set.Normals, &set.ORM };
+		DecodedImage layers[layerCount];
+		bool found[layerCount] = {};
+		std::vector<unsigned char> file;
+		for (unsigned int layer = 0; layer < layerCount; layer++) {
+			found[layer] = ReadWholeFile(*paths[layer], file) && PNGDecoder::Decode(file.data(), file.size(), layers[layer]);
+		}
+		if (!found[MATERIAL_SLOT_ALBEDO] || !found[MATERIAL_SLOT_ORM]) {
+			continue;
+		}
+
+		//sets without normals get flat ones
+		if (!found[MATERIAL_SLOT_NORMALS]) {
+			const unsigned char flat[4] = { 128, 128, 255, 255 };
+			DecodedImage& normals = layers[MATERIAL_SLOT_NORMALS];
+			normals = { layers[0].Width, layers[0].Height, 4, {} };
+			for (size_t i = 0; i < (size_t)normals.Width * normals.Height; i++) {
+				normals.Pixels.insert(normals.Pixels.end(), flat, flat + 4);
+			}
+		}
+
+		std::vector<DecodedImage> full[layerCount];
+		for (unsigned int layer = 0; layer < layerCount; layer++) {
+			MipGenerator::Generate(layers[layer], MipGenerator::GetSettingsForPath(*paths[layer]), full[layer]);
+		}
+		for (unsigned int size : sizes) {
+			size_t levels[layerCount] = {};
+			unsigned int matched = 0;
+			for (unsigned int layer = 0; layer < layerCount; layer++) {
+				for (size_t level = 0; level < full[layer].size(); level++) {
+					if (full[layer][level].Width == size && full[layer][level].Height == size) {
+						levels[layer] = level;
+						matched++;
+					}
+				}
+			}
+			if (matched != layerCount) {
+				continue;
+			}
+			for (unsigned int layer = 0; layer < layerCount; layer++) {
+				chains.push_back(std::vector<DecodedImage>(full[layer].begin() + levels[layer], full[layer].end()));
+			}
+		}
+	}
+
+	std::vector<AtlasItem> items(chains.size() / layerCount);
+	for (size_t i = 0; i < items.size(); i++) {
+		for (unsigned int layer = 0; layer < layerCount; layer++) {
+			items[i].Layers.push_back(&chains[i * layerCount + layer]);
+		}
+	}
+
+	AtlasSettings settings;
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasPlacement> placements;
+	if (items.empty() || !TextureAtlas::Build(items, settings, pages, placements)) {
+		printf("No small materials to pack, so the random materials stay untextured\n");
+		return;
+	}
+
+	//each page's layers become textures, compressed as the
+	//set's own are, with their srvs side by side in a table
+	const std::wstring layerNames[layerCount] = { L"atlas_albedo.png", L"atlas_normals.png", L"atlas_orm.png" };
+	std::vector<D3D12_GPU_DESCRIPTOR_HANDLE> pageTables;
+	for (const AtlasPage& page : pages) {
+		DescriptorHandle table = dx12Helper->AllocateSrvUavDescriptors(layerCount);
+		if (!table.IsValid()) {
+			break;
+		}
+		for (unsigned int layer = 0; layer < layerCount; layer++) {
+			D3D12_CPU_DESCRIPTOR_HANDLE srv = dx12Helper->CreateTextureFromLevels(
+				page.Layers[layer], BlockCompressor::GetFormatForPath(layerNames[layer], BLOCK_QUALITY_NORMAL));
+			dx12Helper->CopyDescriptorsToSrvUavRange(table, layer, srv, 1);
+		}
+		pageTables.push_back(dx12Helper->GetSrvUavGPUHandle(table));
+		atlasPageTables.push_back(table);
+	}
+
+	//materials take the small sets in turn
+	unsigned int atlased = 0;
+	for (size_t i = firstMaterial; i < materials.size(); i++) {
+		const AtlasPlacement& placement = placements[(i - firstMaterial) % items.size()];
+		if (!placement.Packed || placement.Page >= pageTables.size()) {
+			continue;
+		}
+		materials[i]->SetAtlasRegion(
+			XMFLOAT2(placement.ScaleU, placement.ScaleV),
+			XMFLOAT2(placement.OffsetU, placement.OffsetV),
+			pageTables[placement.Page]);
+		atlased++;
+	}
+	printf("%u materials share %zu atlas pages (%zu small sets)\n", atlased, pageTables.size(), items.size());
 }
 
 void Game::CreateEntities() 
@@ -420,6 +562,8 @@ void Game::CreateEntities()
 		entities[i]->GetTransform()->SetScale(RandomRange(0.1f, 0.5f));
 	}
 
+	DX12Helper::GetInstance().SetFramesInFlight(framesInFlight);
+
 	RaytracingHelper::GetInstance().CreateTopLevelAccelerationStructureForScene(entities);
 }
 
@@ -543,16 +687,162 @@ void Game::CreateGui(float deltaTime) {
 
 		ImGui::Text("FPS: %i", lastFrameCount);
 
+		//how far the CPU may get ahead of the GPU
+		ImGui::SliderInt("Frames In Flight: ", &framesInFlight, 2, FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT);
+
+		//constant buffer space used by the frames in flight
+		const FrameRingAllocator& cbRing = dx12Helper->GetConstantBufferRing();
+		const FrameRingAllocator& cbvRing = dx12Helper->GetCBVDescriptorRing();
+		ImGui::Text("CB heap: %llu KB peak, %llu KB/frame peak, %llu KB (%u grows)",
+			(unsigned long long)(cbRing.GetHighWaterMark() / 1024), (unsigned long long)(cbRing.GetFrameHighWaterMark() / 1024),
+			(unsigned long long)(cbRing.GetCapacity() / 1024), cbRing.GetGrowCount());
+		ImGui::Text("CBVs: %llu peak of %llu (%u stalls)",
+			(unsigned long long)cbvRing.GetHighWaterMark(), (unsigned long long)cbvRing.GetCapacity(), cbvRing.GetStallCount());
+
+		//srv/uav descriptors (textures, geometry, outputs)
+		DescriptorAllocatorStats srvUavStats = dx12Helper->GetSrvUavDescriptorStats();
+		ImGui::Text("SRV/UAVs: %u of %u (%u pending free, %u peak), largest free range %u",
+			srvUavStats.Allocated, srvUavStats.Capacity, srvUavStats.PendingFree, srvUavStats.HighWaterMark, srvUavStats.LargestFreeRange);
+		if (srvUavStats.FailedAllocations || srvUavStats.StaleHandleUses)
+			ImGui::Text("SRV/UAV errors: %u failed allocations, %u stale handle uses",
+				srvUavStats.FailedAllocations, srvUavStats.StaleHandleUses);
+
+		//placed buffer heaps
+		const char* bufferHeapNames[] = { "Default", "Upload", "Readback" };
+		const D3D12_HEAP_TYPE bufferHeapTypes[] = { D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_TYPE_READBACK };
+		for (int i = 0; i < 3; i++)
+		{
+			HeapSubAllocatorStats heapStats = dx12Helper->GetBufferHeapStats(bufferHeapTypes[i]);
+			ImGui::Text("%s buffer heaps: %u (%llu MB), %llu KB in %u buffers, fragmentation %.2f",
+				bufferHeapNames[i], heapStats.BlockCount, (unsigned long long)(heapStats.ReservedBytes / (1024 * 1024)),
+				(unsigned long long)(heapStats.AllocatedBytes / 1024), heapStats.AllocationCount, heapStats.Fragmentation);
+		}
+		if (ImGui::Button("Trim Buffer Heaps"))
+			dx12Helper->TrimBufferHeaps();
+		ImGui::SameLine();
+
+		//staging ring
+		StagingRingStats stagingStats = dx12Helper->GetStagingStats();
+		ImGui::Text("Staging: %llu KB of %llu KB in use (%llu KB peak), %llu MB staged, %u dedicated, %u stalls",
+			(unsigned long long)(stagingStats.Used / 1024), (unsigned long long)(stagingStats.Capacity / 1024),
+			(unsigned long long)(stagingStats.HighWaterMark / 1024), (unsigned long long)(stagingStats.BytesStaged / (1024 * 1024)), stagingStats.DedicatedAllocations, stagingStats.Stalls);
+
+		//resource state tracking
+		ResourceStateTrackerStats barrierStats = dx12Helper->GetResourceStates().GetStats();
+		ImGui::Text("Barriers: %u in %u batches, %u skipped, %u merged, %u split (%u resources tracked)",
+			barrierStats.Barriers, barrierStats.Batches, barrierStats.SkippedTransitions,
+			barrierStats.MergedTransitions, barrierStats.SplitBarriers, barrierStats.TrackedResources);
+
+		//render graph
+		RenderGraphStats graphStats = frameGraph.GetStats();
+		ImGui::Text("Render graph: %u passes (%u culled), %u transients in %llu KB (%llu KB unaliased), %u reallocations",
+			graphStats.Passes, graphStats.CulledPasses, graphStats.TransientResources,
+			(unsigned long long)(graphStats.HeapBytes / 1024), (unsigned long long)(graphStats.UnaliasedBytes / 1024), graphStats.Reallocations);
+
+		//shader table
+		ShaderTableBuilderStats tableStats = RaytracingHelper::GetInstance().GetShaderTableStats();
+		ImGui::Text("Shader table: %u records in %llu KB, %u written, %u unchanged, %u shared, %llu KB uploaded",
+			tableStats.Records, (unsigned long long)(tableStats.TableSize / 1024), tableStats.RecordsWritten,
+			tableStats.RecordsUnchanged, tableStats.RecordsShared, (unsigned long long)(tableStats.BytesUploaded / 1024));
+
+		//per-instance data
+		InstanceBufferStats instanceStats = RaytracingHelper::GetInstance().GetInstanceBufferStats();
+		ImGui::Text("Instances: %u (%u repacked), %u materials (%u changed), %u copies, %llu KB uploaded",
+			instanceStats.Instances, instanceStats.InstancesPacked, instanceStats.Materials,
+			instanceStats.MaterialsChanged, instanceStats.Ranges, (unsigned long long)(instanceStats.BytesUploaded / 1024));
+
+		//resources waiting on the GPU before they're released
+		DeferredReleaseQueueStats releaseStats = DX12Helper::GetInstance().GetDeferredReleaseStats();
+		ImGui::Text("Deferred releases: %u pending (peak %u), %u released",
+			releaseStats.Pending, releaseStats.PeakPending, releaseStats.Released);
+
+		//bottom level acceleration structure builds
+		BLASBuildQueueStats blasStats = RaytracingHelper::GetInstance().GetBLASBuildStats();
+		ImGui::Text("BLAS builds: %u in %u flushes, last in %u batches, %llu KB scratch (%llu KB unpooled)",
+			blasStats.Builds, blasStats.Flushes, blasStats.LastBatches,
+			(unsigned long long)(blasStats.LastScratchSize / 1024), (unsigned long long)(blasStats.LastUnpooledScratchSize / 1024));
+
+		//acceleration structure memory, in total and per mesh
+		AccelerationStructureMemoryStats asStats = RaytracingHelper::GetInstance().GetAccelerationStructureStats();
+		ImGui::Text("Acceleration structures: %llu KB (BLAS %llu KB of %llu KB uncompacted, TLAS %llu KB, scratch %llu KB), %u of %u compacted",
+			(unsigned long long)(asStats.TotalBytes / 1024), (unsigned long long)(asStats.BLASBytes / 1024),
+			(unsigned long long)(asStats.BLASBuildBytes / 1024), (unsigned long long)(asStats.TLASBytes / 1024),
+			(unsigned long long)(asStats.ScratchBytes / 1024), asStats.Compacted, asStats.BLASCount);
+		std::shared_ptr<Mesh> meshes[] = { sphereMesh, helixMesh, cubeMesh };
+		const char* meshNames[] = { "Sphere", "Helix", "Cube" };
+		for (int i = 0; i < 3; i++)
+		{
+			BLASMemoryInfo blasInfo = RaytracingHelper::GetInstance().GetBLASMemoryInfo(meshes[i]->GetRaytracingData().HitGroupIndex);
+			ImGui::Text("  %s BLAS: %llu KB (built at %llu KB, %llu KB scratch)%s",
+				meshNames[i], (unsigned long long)(blasInfo.Size / 1024), (unsigned long long)(blasInfo.BuildSize / 1024),
+				(unsigned long long)(blasInfo.ScratchSize / 1024),
+				blasInfo.State == BLAS_STATE_COMPACTED ? ", compacted" : "");
+		}
+
+		//pipeline creation at startup
+		PipelineCacheStats pipelineStats = dx12Helper->GetPipelineCacheStats();
+		ImGui::Text("Pipeline cache: %u entries, %u hits, %u misses, %u rejected%s",
+			pipelineStats.Entries, pipelineStats.Hits, pipelineStats.Misses, pipelineStats.Rejected,
+			pipelineStats.EnvironmentChanged ? " (driver changed)" : "");
+		for (const PipelineTiming& timing : dx12Helper->GetPipelineTimings())
+			ImGui::Text("  %s: %.2fms%s", timing.Name.c_str(), timing.Ms, timing.CacheHit ? " (cached)" : "");
+
+		//texture loading at startup
+		TextureLoadStats textureStats = dx12Helper->GetTextureLoadStats();
+		ImGui::Text("Textures: %u requests, %u files, %u decoded, %u shared, %u missing, read %.1fms, decode %.1fms, %u SRV heaps",
+			textureStats.Requests, textureStats.Textures, textureStats.Decoded, textureStats.SharedContents, textureStats.Missing,
+			textureStats.LastReadMs, textureStats.LastDecodeMs, dx12Helper->GetTextureDescriptorHeapCount());
+		ImGui::Text("Mips: %u chains generated in %.1fms, %u from the texture cache",
+			textureStats.MipChains, textureStats.LastMipMs, textureStats.MipCacheHits);
+		ImGui::Text("Compression: %u textures (%u from the cache) in %.1fms, %.1f MB on the GPU (%.1f MB uncompressed)",
+			textureStats.Compressed, textureStats.BlockCacheHits, textureStats.LastCompressMs,
+			textureStats.GPUBytes / (1024.0 * 1024.0), textureStats.UncompressedBytes / (1024.0 * 1024.0));
+		MipResidencyStats streamingStats = dx12Helper->GetTextureStreamingStats();
+		ImGui::Text("Streaming: %u mapped, %u streamed (%u still loading), %.1f MB resident (%.1f MB tails, %.1f MB wanted), %u levels in, %u out",
+			textureStats.Mapped, streamingStats.Textures, streamingStats.Streaming,
+			streamingStats.ResidentBytes / (1024.0 * 1024.0), streamingStats.TailBytes / (1024.0 * 1024.0), streamingStats.WantedBytes / (1024.0 * 1024.0),
+			streamingStats.Loads, streamingStats.Evictions);
+		ImGui::SliderInt("Texture Budget (MB): ", &textureBudgetMB, 1, 1024);
+
 		ImGui::PushID(1);
 		//first param is id of slider
 		ImGui::SliderInt("Rays Per Pixel: ", &raysPerPixel, 0, 100);
 		ImGui::SliderInt("Max recursion Depth: ", &maxRecursion, 0, D3D12_RAYTRACING_MAX_DECLARABLE_TRACE_RECURSION_DEPTH - 2);
 		ImGui::Checkbox("Freeze Objects: ", &freeze);
-		//add float slider for x,y,z pos of light source
+		//add float slider for x,y,z pos of the first point light
 		ImGui::SliderFloat("Light Position X: ", &lightSourcePosition.x, -10.0f, 10.0f);
 		ImGui::SliderFloat("Light Position Y: ", &lightSourcePosition.y, -10.0f, 10.0f);
 		ImGui::SliderFloat("Light Position Z: ", &lightSourcePosition.z, -10.0f, 10.0f);
 
+		//how a light is picked for each shadow ray (-1 lets the sampler decide)
+		const char* samplingNames[] = { "Auto", "Uniform", "Alias Table", "Light BVH" };
+		int samplingChoice = lightSamplingStrategy + 1;
+		if (ImGui::Combo("Light Sampling: ", &samplingChoice, samplingNames, IM_ARRAYSIZE(samplingNames)))
+			lightSamplingStrategy = samplingChoice - 1;
+		ImGui::Text("Active strategy: %s", samplingNames[RaytracingHelper::GetInstance().GetLightSamplingStrategy() + 1]);
+
+		//ReSTIR resamples the light used at each primary hit
+		ImGui::Checkbox("ReSTIR: ", &restirEnabled);
+		ImGui::SliderInt("ReSTIR Candidates: ", &restirCandidates, 1, 64);
+		ImGui::Checkbox("ReSTIR Temporal Reuse: ", &restirTemporal);
+		ImGui::SliderInt("ReSTIR Spatial Samples: ", &restirSpatialSamples, 0, RESTIR_MAX_SPATIAL_SAMPLES);
+		ImGui::SliderFloat("ReSTIR Spatial Radius: ", &restirSpatialRadius, 1.0f, 64.0f);
+
+		//denoising on the CPU reads the frame back, so it's off by default
+		ImGui::Checkbox("CPU Denoiser: ", &denoiserEnabled);
+		ImGui::Checkbox("Denoiser Temporal: ", &denoiserTemporal);
+		ImGui::SliderInt("Denoiser Iterations: ", &denoiserIterations, 1, DENOISER_MAX_ATROUS_ITERATIONS);
+		if (denoiserEnabled)
+			ImGui::Text("Denoise time: %.2f ms", RaytracingHelper::GetInstance().GetDenoiserTimings().TotalMs);
+
+		//trace fewer pixels and rebuild the rest on the CPU
+		ImGui::SliderFloat("Render Scale: ", &renderScale, UPSCALER_MIN_RENDER_SCALE, 1.0f);
+		ImGui::Checkbox("Checkerboard: ", &checkerboard);
+		ImGui::Checkbox("Edge-Aware Upscale: ", &edgeAwareUpscale);
+		unsigned int tracedPixels = RaytracingHelper::GetInstance().GetTracedPixelCount();
+		ImGui::Text("Primary rays: %u (%.0f%% of native)", tracedPixels * raysPerPixel,
+			100.0f * tracedPixels / ((float)windowWidth * windowHeight));
+
 		ImGui::PopID();
 
 		ImGui::End();
@@ -568,6 +858,11 @@ void Game::Update(float deltaTime, float totalTime)
 	if (Input::GetInstance().KeyDown(VK_ESCAPE)) {
 		Quit();
 	}
+	// Remember where everything was for motion vectors
+	for (int i = 0; i < entities.size(); i++)
+		entities[i]->GetTransform()->StorePreviousWorldMatrix();
+	camera->StorePreviousFrame();
+
 	if (!freeze) {
 
 		//entities[0]->GetTransform()->MoveRelative(0, (float)cos(totalTime) / 4, 0);
@@ -587,6 +882,10 @@ void Game::Update(float deltaTime, float totalTime)
 		}
 	}
 
+	//first point light follows the gui sliders
+	if (lights.size() > 3)
+		lights[3].Position = lightSourcePosition;
+
 	camera->Update(deltaTime);
 
 	CreateGui(deltaTime);
@@ -600,11 +899,87 @@ void Game::Draw(float deltaTime, float totalTime)
 	// Grab the current back buffer for this frame
 	//Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer = backBuffers[currentSwapBuffer];
 	
-	RaytracingHelper::GetInstance().CreateTopLevelAccelerationStructureForScene(entities);
+	// Texture levels stream in (or out) before anything samples them
+	dx12Helper->SetTextureBudget((uint64_t)textureBudgetMB * 1024 * 1024);
+	dx12Helper->StreamTextures();
+
+	RaytracingHelper::GetInstance().UpdateLights(lights, lightSamplingStrategy);
+
+	ReSTIRSettings restirSettings = {};
+	restirSettings.InitialCandidates = restirCandidates;
+	restirSettings.Temporal = restirTemporal;
+	restirSettings.SpatialSamples = restirSpatialSamples;
+	restirSettings.SpatialRadius = restirSpatialRadius;
+	restirSettings.SourceStrategy = lightSamplingStrategy;
+	RaytracingHelper::GetInstance().SetReSTIR(restirEnabled, restirSettings);
+
+	DenoiserSettings denoiserSettings = {};
+	denoiserSettings.Temporal = denoiserTemporal;
+	denoiserSettings.AtrousIterations = denoiserIterations;
+	RaytracingHelper::GetInstance().SetDenoiser(denoiserEnabled, denoiserSettings);
+
+	UpscalerSettings upscalerSettings = {};
+	upscalerSettings.RenderScale = renderScale;
+	upscalerSettings.Checkerboard = checkerboard;
+	upscalerSettings.EdgeAware = edgeAwareUpscale;
+	RaytracingHelper::GetInstance().SetUpscaler(upscalerSettings);
+
+	// The frame's passes (transitions between them come from the graph)
+	frameGraph.Reset();
+	RenderGraphResource tlas = frameGraph.Import("TLAS", 0, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+	RenderGraphResource backBuffer = frameGraph.Import("Back buffer", backBuffers[currentSwapBuffer].Get(), D3D12_RESOURCE_STATE_PRESENT);
+
+	RenderGraphResourceDesc outputDesc = {};
+	outputDesc.Type = RENDER_GRAPH_TEXTURE_2D;
+	outputDesc.Width = windowWidth;
+	outputDesc.Height = windowHeight;
+	outputDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	outputDesc.BytesPerPixel = 4;
+	outputDesc.Flags = RENDER_GRAPH_FLAG_UNORDERED_ACCESS;
+	RenderGraphResource output = frameGraph.CreateTransient("Raytracing output", outputDesc);
+
+	unsigned int pass = frameGraph.AddPass("Build TLAS", [&]()
+	{
+		RaytracingHelper::GetInstance().CreateTopLevelAccelerationStructureForScene(entities);
+	});
+	frameGraph.Write(pass, tlas, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+
+	pass = frameGraph.AddPass("Raytrace", [&]()
+	{
+		RaytracingHelper::GetInstance().SetOutputTexture((ID3D12Resource*)frameGraph.GetPhysical(output));
+		RaytracingHelper::GetInstance().Raytrace(
+			camera, backBuffers[currentSwapBuffer], raysPerPixel, maxRecursion, false
+		);
+	});
+	frameGraph.Read(pass, tlas, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+	frameGraph.Write(pass, output, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	frameGraph.Write(pass, backBuffer, D3D12_RESOURCE_STATE_COPY_DEST);
+
+	pass = frameGraph.AddPass("UI", [&]()
+	{
+		//set pipeline requirements
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descriptorHeap = dx12Helper->GetCBVSRVDescriptorHeap();
+		commandList->SetDescriptorHeaps(1, descriptorHeap.GetAddressOf());
+		commandList->OMSetRenderTargets(1, &rtvHandles[currentSwapBuffer], true, &dsvHandle);
 
-	RaytracingHelper::GetInstance().Raytrace(
-		camera, backBuffers[currentSwapBuffer], raysPerPixel, maxRecursion, lightSourcePosition, false
-	);
+		ImGui::Render();
+		ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), commandList.Get());
+	});
+	frameGraph.Write(pass, backBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET);
+
+	if (frameGraph.Compile())
+	{
+		// Recreated resources can land at a freed one's address,
+		// so the output's view is always rewritten after that
+		if (frameGraph.GetStats().Reallocations != frameGraphReallocations)
+		{
+			frameGraphReallocations = frameGraph.GetStats().Reallocations;
+			RaytracingHelper::GetInstance().SetOutputTexture(0);
+		}
+
+		// Leaves the back buffer's transition to present for the frame's close
+		frameGraph.Execute();
+	}
 	
 	//=============================
 	//comments bellow were old drawing
@@ -710,35 +1085,6 @@ void Game::Draw(float deltaTime, float totalTime)
 	//}
 
 	
-	//handle imgui command list orders
-	{
-		D3D12_RESOURCE_BARRIER rb = {};
-		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-		rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-		rb.Transition.pResource = backBuffers[currentSwapBuffer].Get();
-		rb.Transition.StateBefore =	D3D12_RESOURCE_STATE_PRESENT;
-		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
-		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-		commandList->ResourceBarrier(1, &rb);
-
-		//set pipeline requirements
-		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> descriptorHeap = dx12Helper->GetCBVSRVDescriptorHeap();
-		commandList->SetDescriptorHeaps(1, descriptorHeap.GetAddressOf());
-		commandList->OMSetRenderTargets(1, &rtvHandles[currentSwapBuffer], true, &dsvHandle);
-
-		ImGui::Render();
-		ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), commandList.Get());
-
-		rb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-		rb.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-		rb.Transition.pResource = backBuffers[currentSwapBuffer].Get();
-		rb.Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
-		rb.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
-		rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-		commandList->ResourceBarrier(1, &rb);
-
-	}
-
 
 	// Present
 	{
@@ -753,7 +1099,8 @@ void Game::Draw(float deltaTime, float totalTime)
 		//commandList->ResourceBarrier(1, &rb);
 		
 		// Must occur BEFORE present
-		DX12Helper::GetInstance().CloseExecuteAndResetCommandList();
+		// (only waits on the GPU once it's a full set of frames behind)
+		DX12Helper::GetInstance().CloseExecuteAndBeginNextFrame();
 		//DX12Helper::GetInstance().WaitForGPU();
 		//commandAllocator->Reset();
 		//commandList->Reset(commandAllocator.Get(), 0);
@@ -11,7 +11,9 @@
 #include "GameEntity.h"
 #include "DX12Helper.h"
 #include "Material.h"
+#include "MaterialCompiler.h"
 #include "Lights.h"
+#include "RenderGraph.h"
 
 class Game 
 	: public DXCore
@@ -35,6 +37,10 @@ private:
 
 	void LoadTexturesAndCreateMaterials();
 
+	//small versions of the sets for the random materials,
+	//packed into shared atlas pages
+	void CreateAtlasMaterials(const std::vector<CompiledMaterial>& sets, int firstMaterial);
+
 	//dx12 helper, replace LoadShaders effectively
 	void CreateRootSigAndPipelineState();
 
@@ -63,9 +69,14 @@ private:
 
 	DX12Helper* dx12Helper;
 
+	// The frame's passes, declared again every frame
+	RenderGraph frameGraph;
+	unsigned int frameGraphReallocations = 0;
+
 	std::shared_ptr<Camera> camera;
 	int raysPerPixel = 25;
 	int maxRecursion = 10;
+	int framesInFlight = 2;
 
 	//hold basic shapes for testing
 	std::shared_ptr<Mesh> sphereMesh;
@@ -73,6 +84,10 @@ private:
 	std::shared_ptr<Mesh> cubeMesh;
 
 	std::vector<std::shared_ptr<Material>> materials;
+
+	//one table per atlas page, shared by its materials
+	std::vector<DescriptorHandle> atlasPageTables;
+
 	std::vector<std::shared_ptr<GameEntity>> entities;
 
 	// Lights
@@ -82,5 +97,26 @@ private:
 	bool freeze = false;
 
 	DirectX::XMFLOAT3 lightSourcePosition;
+	int lightSamplingStrategy = -1; // -1 = pick automatically
+
+	// ReSTIR options
+	bool restirEnabled = true;
+	int restirCandidates = 16;
+	bool restirTemporal = true;
+	int restirSpatialSamples = 4;
+	float restirSpatialRadius = 16.0f;
+
+	// CPU denoiser options
+	bool denoiserEnabled = false;
+	bool denoiserTemporal = true;
+	int denoiserIterations = 5;
+
+	// Upscaling options
+	float renderScale = 1.0f;
+	bool checkerboard = false;
+	bool edgeAwareUpscale = true;
+
+	// Texture streaming budget, in MB
+	int textureBudgetMB = 256;
 };
 
@@ -0,0 +1,623 @@
+#include "HeapSubAllocator.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Free ranges smaller than this all go in the first level,
+// one second level list per multiple of the granularity
+static const uint64_t SmallRangeSize = HEAP_SUB_ALLOCATOR_GRANULARITY * 16;
+static const unsigned int SmallRangeLog2 = 12;
+
+// --------------------------------------------------------
+// Index of the highest/lowest set bit (v must not be 0)
+// --------------------------------------------------------
+static unsigned int HighBit(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, v);
+	return (unsigned int)index;
+#else
+	return 63 - (unsigned int)__builtin_clzll(v);
+#endif
+}
+
+static unsigned int LowBit(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, v);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctzll(v);
+#endif
+}
+
+// --------------------------------------------------------
+// Which first and second level list a free range of this
+// size belongs in.  The first level is the power of two,
+// and the second splits that into 16 linear steps.
+// --------------------------------------------------------
+static void MapSize(uint64_t size, unsigned int& fl, unsigned int& sl)
+{
+	if (size < SmallRangeSize)
+	{
+		fl = 0;
+		sl = (unsigned int)(size / HEAP_SUB_ALLOCATOR_GRANULARITY);
+		return;
+	}
+
+	unsigned int log2 = HighBit(size);
+	sl = (unsigned int)(size >> (log2 - 4)) - 16;
+	fl = log2 - SmallRangeLog2 + 1;
+}
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+
+HeapSubAllocator::HeapSubAllocator() :
+	timeline(0),
+	blockSize(0),
+	maxBlocks(0),
+	allocatedBytes(0),
+	pendingFreeBytes(0),
+	highWaterMark(0),
+	allocationCount(0),
+	failedAllocations(0)
+{
+}
+
+// --------------------------------------------------------
+// Starts with no blocks; the first allocation adds one
+// --------------------------------------------------------
+void HeapSubAllocator::Initialize(GPUTimeline* timeline, uint64_t blockSize, unsigned int maxBlocks)
+{
+	this->timeline = timeline;
+	this->blockSize = AlignUp(blockSize, HEAP_SUB_ALLOCATOR_GRANULARITY);
+	this->maxBlocks = maxBlocks;
+	blocks.clear();
+	nodes.clear();
+	unusedNodes.clear();
+	pendingFrees.clear();
+	allocatedBytes = 0;
+	pendingFreeBytes = 0;
+	highWaterMark = 0;
+	allocationCount = 0;
+	failedAllocations = 0;
+}
+
+// --------------------------------------------------------
+// Looks through the existing blocks for a free range big
+// enough even after aligning, and adds a block if none is
+// --------------------------------------------------------
+HeapAllocation HeapSubAllocator::Allocate(uint64_t size, uint64_t alignment)
+{
+	if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+	{
+		failedAllocations++;
+		return HeapAllocation();
+	}
+
+	size = AlignUp(size, HEAP_SUB_ALLOCATOR_GRANULARITY);
+	alignment = std::max(alignment, (uint64_t)HEAP_SUB_ALLOCATOR_GRANULARITY);
+	if (size > blockSize)
+	{
+		failedAllocations++;
+		return HeapAllocation();
+	}
+
+	Retire();
+
+	// Any range this big can fit the allocation wherever it starts
+	uint64_t searchSize = size + alignment - HEAP_SUB_ALLOCATOR_GRANULARITY;
+	for (unsigned int b = 0; b < blocks.size(); b++)
+	{
+		if (!blocks[b].Active)
+			continue;
+
+		int node = FindFreeNode(b, searchSize);
+		if (node != NO_NODE)
+			return Place(node, size, alignment);
+	}
+
+	// A new block starts at offset 0, which any alignment is happy with
+	unsigned int activeBlocks = 0;
+	for (const Block& block : blocks)
+		activeBlocks += block.Active ? 1 : 0;
+	if (maxBlocks && activeBlocks >= maxBlocks)
+	{
+		failedAllocations++;
+		return HeapAllocation();
+	}
+
+	unsigned int block = AddBlock();
+	return Place(blocks[block].FirstNode, size, alignment);
+}
+
+// --------------------------------------------------------
+// Queues the range to be merged back into the free lists
+// once the GPU is done with it
+// --------------------------------------------------------
+void HeapSubAllocator::Free(const HeapAllocation& allocation)
+{
+	if (!IsLive(allocation))
+		return;
+
+	nodes[allocation.Node].PendingFree = true;
+	pendingFrees.push_back({ (int)allocation.Node, 0 });
+	pendingFreeBytes += nodes[allocation.Node].Size;
+}
+
+// --------------------------------------------------------
+// Tags this frame's frees with its fence
+// --------------------------------------------------------
+void HeapSubAllocator::EndFrame(uint64_t fenceValue)
+{
+	for (PendingFree& pending : pendingFrees)
+	{
+		if (pending.FenceValue == 0)
+			pending.FenceValue = fenceValue;
+	}
+}
+
+// --------------------------------------------------------
+// Frees are queued in frame order, so stop at the first
+// one that's still in use (or whose frame hasn't ended)
+// --------------------------------------------------------
+void HeapSubAllocator::Retire()
+{
+	if (pendingFrees.empty())
+		return;
+
+	uint64_t completed = timeline->GetCompletedValue();
+	while (!pendingFrees.empty() &&
+		pendingFrees.front().FenceValue != 0 &&
+		pendingFrees.front().FenceValue <= completed)
+	{
+		ReleaseNode(pendingFrees.front().Node);
+		pendingFrees.pop_front();
+	}
+}
+
+// --------------------------------------------------------
+// Empties the least used blocks first, moving each live
+// allocation into the fullest block it fits in.  Within a
+// block nothing is moved, since that only helps once the
+// block's free space is too splintered to use.
+// --------------------------------------------------------
+void HeapSubAllocator::Defragment(uint64_t maxBytesToMove, std::vector<HeapAllocationMove>& moves)
+{
+	Retire();
+
+	std::vector<unsigned int> order;
+	for (unsigned int b = 0; b < blocks.size(); b++)
+	{
+		if (blocks[b].Active)
+			order.push_back(b);
+	}
+	std::sort(order.begin(), order.end(),
+		[&](unsigned int a, unsigned int b) { return blocks[a].Used < blocks[b].Used; });
+
+	uint64_t movedBytes = 0;
+	for (size_t i = 0; i + 1 < order.size(); i++)
+	{
+		// Moves only split nodes in other blocks, so this block's list stays intact
+		for (int node = blocks[order[i]].FirstNode; node != NO_NODE; node = nodes[node].NextPhysical)
+		{
+			if (nodes[node].Free || nodes[node].PendingFree)
+				continue;
+
+			uint64_t size = nodes[node].Size;
+			uint64_t alignment = nodes[node].Alignment;
+			if (movedBytes + size > maxBytesToMove)
+				return;
+
+			int target = NO_NODE;
+			for (size_t j = order.size() - 1; j > i && target == NO_NODE; j--)
+				target = FindFreeNode(order[j], size + alignment - HEAP_SUB_ALLOCATOR_GRANULARITY);
+			if (target == NO_NODE)
+				continue;
+
+			HeapAllocationMove move;
+			move.From.Block = nodes[node].Block;
+			move.From.Offset = nodes[node].Offset;
+			move.From.Size = size;
+			move.From.Node = node;
+			move.To = Place(target, size, alignment);
+			Free(move.From);
+
+			moves.push_back(move);
+			movedBytes += size;
+		}
+	}
+}
+
+// --------------------------------------------------------
+// A block is empty when its first range is free and spans
+// the whole thing
+// --------------------------------------------------------
+void HeapSubAllocator::ReleaseEmptyBlocks(std::vector<unsigned int>& releasedBlocks)
+{
+	Retire();
+
+	for (unsigned int b = 0; b < blocks.size(); b++)
+	{
+		Block& block = blocks[b];
+		if (!block.Active || block.Used > 0)
+			continue;
+
+		int node = block.FirstNode;
+		if (!nodes[node].Free || nodes[node].Size != blockSize)
+			continue;
+
+		RemoveFree(node);
+		RecycleNode(node);
+		block.Active = false;
+		block.FirstNode = NO_NODE;
+		releasedBlocks.push_back(b);
+	}
+}
+
+// --------------------------------------------------------
+// Walks every block's ranges to total up free space
+// --------------------------------------------------------
+HeapSubAllocatorStats HeapSubAllocator::GetStats() const
+{
+	HeapSubAllocatorStats stats = {};
+	stats.AllocatedBytes = allocatedBytes;
+	stats.PendingFreeBytes = pendingFreeBytes;
+	stats.HighWaterMark = highWaterMark;
+	stats.AllocationCount = allocationCount;
+	stats.FailedAllocations = failedAllocations;
+
+	uint64_t largestPerBlock = 0;
+	for (const Block& block : blocks)
+	{
+		if (!block.Active)
+			continue;
+
+		stats.BlockCount++;
+		stats.ReservedBytes += blockSize;
+
+		uint64_t largest = 0;
+		for (int node = block.FirstNode; node != NO_NODE; node = nodes[node].NextPhysical)
+		{
+			if (!nodes[node].Free)
+				continue;
+
+			stats.FreeBytes += nodes[node].Size;
+			stats.FreeRangeCount++;
+			largest = std::max(largest, nodes[node].Size);
+		}
+		largestPerBlock += largest;
+		stats.LargestFreeRange = std::max(stats.LargestFreeRange, largest);
+	}
+
+	if (stats.FreeBytes > 0)
+		stats.Fragmentation = 1.0f - (float)((double)largestPerBlock / stats.FreeBytes);
+	return stats;
+}
+
+// --------------------------------------------------------
+// Checks the physical lists against the free lists (which
+// must hold exactly the free ranges, in the right class)
+// --------------------------------------------------------
+bool HeapSubAllocator::CheckConsistency() const
+{
+	uint64_t totalUsed = 0;
+	for (unsigned int b = 0; b < blocks.size(); b++)
+	{
+		const Block& block = blocks[b];
+		if (!block.Active)
+			continue;
+
+		// Ranges must tile the block, with no two free ones in a row
+		uint64_t offset = 0;
+		uint64_t used = 0;
+		unsigned int freeRanges = 0;
+		int prev = NO_NODE;
+		for (int node = block.FirstNode; node != NO_NODE; node = nodes[node].NextPhysical)
+		{
+			const Node& n = nodes[node];
+			if (n.Block != b || n.Offset != offset || n.PrevPhysical != prev || n.Size == 0)
+				return false;
+			if (n.Free && prev != NO_NODE && nodes[prev].Free)
+				return false;
+
+			if (n.Free)
+				freeRanges++;
+			else
+				used += n.Size;
+			offset += n.Size;
+			prev = node;
+		}
+		if (offset != blockSize || used != block.Used)
+			return false;
+		totalUsed += used;
+
+		// Every listed range must be free, in this block and in the right list
+		unsigned int listed = 0;
+		for (unsigned int fl = 0; fl < FL_COUNT; fl++)
+		{
+			bool flSet = (block.FirstLevelBitmap >> fl) & 1;
+			if (flSet != (block.SecondLevelBitmaps[fl] != 0))
+				return false;
+
+			for (unsigned int sl = 0; sl < SL_COUNT; sl++)
+			{
+				int head = block.FreeLists[fl][sl];
+				bool slSet = (block.SecondLevelBitmaps[fl] >> sl) & 1;
+				if (slSet != (head != NO_NODE))
+					return false;
+
+				int prevFree = NO_NODE;
+				for (int node = head; node != NO_NODE; node = nodes[node].NextFree)
+				{
+					unsigned int nodeFL, nodeSL;
+					MapSize(nodes[node].Size, nodeFL, nodeSL);
+					if (!nodes[node].Free || nodes[node].Block != b || nodeFL != fl || nodeSL != sl || nodes[node].PrevFree != prevFree)
+						return false;
+					prevFree = node;
+					listed++;
+				}
+			}
+		}
+		if (listed != freeRanges)
+			return false;
+	}
+	return totalUsed == allocatedBytes;
+}
+
+// --------------------------------------------------------
+// Node storage is recycled rather than shrunk
+// --------------------------------------------------------
+int HeapSubAllocator::NewNode()
+{
+	if (!unusedNodes.empty())
+	{
+		int node = unusedNodes.back();
+		unusedNodes.pop_back();
+		return node;
+	}
+
+	nodes.push_back(Node());
+	return (int)nodes.size() - 1;
+}
+
+void HeapSubAllocator::RecycleNode(int node)
+{
+	// A zero size never matches an allocation, so old handles can't free it
+	nodes[node].Size = 0;
+	nodes[node].Free = false;
+	nodes[node].PendingFree = false;
+	unusedNodes.push_back(node);
+}
+
+// --------------------------------------------------------
+// Reuses a released block's slot if there is one, and
+// starts it as a single free range
+// --------------------------------------------------------
+unsigned int HeapSubAllocator::AddBlock()
+{
+	unsigned int index = 0;
+	while (index < blocks.size() && blocks[index].Active)
+		index++;
+	if (index == blocks.size())
+		blocks.push_back(Block());
+
+	Block& block = blocks[index];
+	block.Active = true;
+	block.Used = 0;
+	block.FirstLevelBitmap = 0;
+	for (unsigned int fl = 0; fl < FL_COUNT; fl++)
+	{
+		block.SecondLevelBitmaps[fl] = 0;
+		for (unsigned int sl = 0; sl < SL_COUNT; sl++)
+			block.FreeLists[fl][sl] = NO_NODE;
+	}
+
+	int node = NewNode();
+	Node& n = nodes[node];
+	n.Block = index;
+	n.Offset = 0;
+	n.Size = blockSize;
+	n.Alignment = 0;
+	n.PrevPhysical = NO_NODE;
+	n.NextPhysical = NO_NODE;
+	n.PendingFree = false;
+	blocks[index].FirstNode = node;
+	InsertFree(node);
+	return index;
+}
+
+// --------------------------------------------------------
+// Rounds the size up to the next list boundary so that
+// anything in the list found is big enough, then takes the
+// first non-empty list at or above it using the bitmaps
+// --------------------------------------------------------
+int HeapSubAllocator::FindFreeNode(unsigned int block, uint64_t size) const
+{
+	if (size >= SmallRangeSize)
+		size += (1ull << (HighBit(size) - SL_LOG2)) - 1;
+
+	unsigned int fl, sl;
+	MapSize(size, fl, sl);
+	if (fl >= FL_COUNT)
+		return NO_NODE;
+
+	const Block& b = blocks[block];
+	uint32_t slMap = b.SecondLevelBitmaps[fl] & (~0u << sl);
+	if (!slMap)
+	{
+		uint64_t flMap = b.FirstLevelBitmap & (~0ull << (fl + 1));
+		if (!flMap)
+			return NO_NODE;
+
+		fl = LowBit(flMap);
+		slMap = b.SecondLevelBitmaps[fl];
+	}
+
+	return b.FreeLists[fl][LowBit(slMap)];
+}
+
+void HeapSubAllocator::InsertFree(int node)
+{
+	Node& n = nodes[node];
+	Block& block = blocks[n.Block];
+	unsigned int fl, sl;
+	MapSize(n.Size, fl, sl);
+
+	n.Free = true;
+	n.PrevFree = NO_NODE;
+	n.NextFree = block.FreeLists[fl][sl];
+	if (n.NextFree != NO_NODE)
+		nodes[n.NextFree].PrevFree = node;
+	block.FreeLists[fl][sl] = node;
+	block.FirstLevelBitmap |= 1ull << fl;
+	block.SecondLevelBitmaps[fl] |= 1u << sl;
+}
+
+void HeapSubAllocator::RemoveFree(int node)
+{
+	Node& n = nodes[node];
+	Block& block = blocks[n.Block];
+	unsigned int fl, sl;
+	MapSize(n.Size, fl, sl);
+
+	if (n.PrevFree != NO_NODE)
+		nodes[n.PrevFree].NextFree = n.NextFree;
+	else
+		block.FreeLists[fl][sl] = n.NextFree;
+	if (n.NextFree != NO_NODE)
+		nodes[n.NextFree].PrevFree = n.PrevFree;
+
+	if (block.FreeLists[fl][sl] == NO_NODE)
+	{
+		block.SecondLevelBitmaps[fl] &= ~(1u << sl);
+		if (!block.SecondLevelBitmaps[fl])
+			block.FirstLevelBitmap &= ~(1ull << fl);
+	}
+	n.Free = false;
+	n.PrevFree = NO_NODE;
+	n.NextFree = NO_NODE;
+}
+
+// --------------------------------------------------------
+// Keeps the first size bytes in this node and returns a
+// new node (in neither list yet) for the rest
+// --------------------------------------------------------
+int HeapSubAllocator::Split(int node, uint64_t size)
+{
+	int rest = NewNode();
+	Node& n = nodes[node];
+	Node& r = nodes[rest];
+	r.Block = n.Block;
+	r.Offset = n.Offset + size;
+	r.Size = n.Size - size;
+	r.Alignment = 0;
+	r.PrevPhysical = node;
+	r.NextPhysical = n.NextPhysical;
+	r.PrevFree = NO_NODE;
+	r.NextFree = NO_NODE;
+	r.Free = false;
+	r.PendingFree = false;
+	if (n.NextPhysical != NO_NODE)
+		nodes[n.NextPhysical].PrevPhysical = rest;
+	n.NextPhysical = rest;
+	n.Size = size;
+	return rest;
+}
+
+// --------------------------------------------------------
+// Takes a free node, gives back the padding before the
+// aligned offset and whatever's left after the allocation
+// --------------------------------------------------------
+HeapAllocation HeapSubAllocator::Place(int node, uint64_t size, uint64_t alignment)
+{
+	RemoveFree(node);
+
+	uint64_t padding = AlignUp(nodes[node].Offset, alignment) - nodes[node].Offset;
+	if (padding > 0)
+	{
+		int rest = Split(node, padding);
+		InsertFree(node);
+		node = rest;
+	}
+	if (nodes[node].Size > size)
+		InsertFree(Split(node, size));
+
+	Node& n = nodes[node];
+	n.Alignment = alignment;
+	n.PendingFree = false;
+	blocks[n.Block].Used += size;
+	allocatedBytes += size;
+	allocationCount++;
+	highWaterMark = std::max(highWaterMark, allocatedBytes);
+
+	HeapAllocation allocation;
+	allocation.Block = n.Block;
+	allocation.Offset = n.Offset;
+	allocation.Size = size;
+	allocation.Node = (unsigned int)node;
+	return allocation;
+}
+
+// --------------------------------------------------------
+// Returns a node to the free lists, merging it with free
+// neighbors so free ranges never sit side by side
+// --------------------------------------------------------
+void HeapSubAllocator::ReleaseNode(int node)
+{
+	uint64_t size = nodes[node].Size;
+	blocks[nodes[node].Block].Used -= size;
+	allocatedBytes -= size;
+	pendingFreeBytes -= size;
+	allocationCount--;
+	nodes[node].PendingFree = false;
+
+	int prev = nodes[node].PrevPhysical;
+	if (prev != NO_NODE && nodes[prev].Free)
+	{
+		RemoveFree(prev);
+		nodes[prev].Size += nodes[node].Size;
+		nodes[prev].NextPhysical = nodes[node].NextPhysical;
+		if (nodes[node].NextPhysical != NO_NODE)
+			nodes[nodes[node].NextPhysical].PrevPhysical = prev;
+		RecycleNode(node);
+		node = prev;
+	}
+
+	int next = nodes[node].NextPhysical;
+	if (next != NO_NODE && nodes[next].Free)
+	{
+		RemoveFree(next);
+		nodes[node].Size += nodes[next].Size;
+		nodes[node].NextPhysical = nodes[next].NextPhysical;
+		if (nodes[next].NextPhysical != NO_NODE)
+			nodes[nodes[next].NextPhysical].PrevPhysical = node;
+		RecycleNode(next);
+	}
+
+	InsertFree(node);
+}
+
+// --------------------------------------------------------
+// Is this allocation still allocated, and not freed yet?
+// --------------------------------------------------------
+bool HeapSubAllocator::IsLive(const HeapAllocation& allocation) const
+{
+	if (!allocation.IsValid() || allocation.Node >= nodes.size())
+		return false;
+
+	const Node& n = nodes[allocation.Node];
+	return !n.Free && !n.PendingFree &&
+		n.Block == allocation.Block &&
+		n.Offset == allocation.Offset &&
+		n.Size == allocation.Size;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "FrameScheduler.h"
+
+// Everything is handed out in multiples of this (which is also
+// the alignment acceleration structures need)
+#define HEAP_SUB_ALLOCATOR_GRANULARITY 256
+
+// Part of one of a HeapSubAllocator's blocks
+struct HeapAllocation
+{
+	unsigned int Block = 0;
+	uint64_t Offset = 0;		// From the start of the block, aligned as requested
+	uint64_t Size = 0;			// Rounded up to the granularity; 0 for an invalid allocation
+	unsigned int Node = 0;		// Internal bookkeeping
+
+	bool IsValid() const { return Size > 0; }
+};
+
+// One allocation Defragment() moved (the caller copies the data
+// and starts using To; From is freed like any other allocation)
+struct HeapAllocationMove
+{
+	HeapAllocation From;
+	HeapAllocation To;
+};
+
+// Where the allocator currently stands
+struct HeapSubAllocatorStats
+{
+	unsigned int BlockCount;
+	uint64_t ReservedBytes;			// All blocks
+	uint64_t AllocatedBytes;		// Live, plus freed ones the GPU may still use
+	uint64_t PendingFreeBytes;
+	uint64_t HighWaterMark;
+	unsigned int AllocationCount;
+	uint64_t FreeBytes;
+	uint64_t LargestFreeRange;
+	unsigned int FreeRangeCount;
+	float Fragmentation;			// 0 when each block's free space is one range, towards 1 as it splinters
+	unsigned int FailedAllocations;
+};
+
+// --------------------------------------------------------
+// Sub-allocates fixed size blocks (each one standing in for
+// an ID3D12Heap) using TLSF: free ranges are binned by size
+// into a two-level set of lists with a bitmap per level,
+// so finding a fitting range and freeing (merging with free
+// neighbors) are both constant time.
+//
+// Blocks are added as needed and only released when empty.
+// Frees are deferred until the fence of the frame they
+// happened in completes, like the other frame allocators.
+//
+// Only offsets are tracked, so it runs without a device.
+// --------------------------------------------------------
+class HeapSubAllocator
+{
+public:
+	HeapSubAllocator();
+
+	// Block size must be a multiple of the granularity; maxBlocks of 0 means no limit
+	void Initialize(GPUTimeline* timeline, uint64_t blockSize, unsigned int maxBlocks = 0);
+
+	// Alignment must be a power of two.  Returns an invalid allocation
+	// if it's bigger than a block or no more blocks are allowed.
+	HeapAllocation Allocate(uint64_t size, uint64_t alignment);
+
+	// The range is reused once the fence of the current frame completes
+	void Free(const HeapAllocation& allocation);
+
+	// Frees since the last call belong to the frame signaling this fence
+	void EndFrame(uint64_t fenceValue);
+
+	// Makes ranges available again once the GPU is done with them
+	void Retire();
+
+	// Moves live allocations out of the emptiest blocks and into fuller
+	// ones (up to maxBytesToMove), so whole blocks can be released.
+	// Sources are freed as part of the move.
+	void Defragment(uint64_t maxBytesToMove, std::vector<HeapAllocationMove>& moves);
+
+	// Blocks with nothing in them (not even pending frees), which the
+	// owner should release the memory for.  The indices may be reused.
+	void ReleaseEmptyBlocks(std::vector<unsigned int>& releasedBlocks);
+
+	uint64_t GetBlockSize() const { return blockSize; }
+	unsigned int GetBlockCount() const { return (unsigned int)blocks.size(); }
+	bool IsBlockActive(unsigned int block) const { return block < blocks.size() && blocks[block].Active; }
+	HeapSubAllocatorStats GetStats() const;
+
+	// Walks every block checking that ranges tile it exactly, that free
+	// neighbors were merged and that the free lists and bitmaps agree
+	bool CheckConsistency() const;
+
+private:
+	static const unsigned int SL_LOG2 = 4;
+	static const unsigned int SL_COUNT = 1 << SL_LOG2;
+	static const unsigned int FL_COUNT = 40;
+	static const int NO_NODE = -1;
+
+	// A range within a block, either allocated or in a free list
+	struct Node
+	{
+		unsigned int Block;
+		uint64_t Offset;
+		uint64_t Size;
+		uint64_t Alignment;		// As requested, so defragmenting can keep it
+		int PrevPhysical;		// Neighbors in the block, by offset
+		int NextPhysical;
+		int PrevFree;			// Neighbors in the same size class
+		int NextFree;
+		bool Free;
+		bool PendingFree;
+	};
+
+	struct Block
+	{
+		bool Active;
+		int FirstNode;
+		uint64_t Used;
+		uint64_t FirstLevelBitmap;
+		uint32_t SecondLevelBitmaps[FL_COUNT];
+		int FreeLists[FL_COUNT][SL_COUNT];
+	};
+
+	struct PendingFree
+	{
+		int Node;
+		uint64_t FenceValue;	// 0 until the frame it was freed in ends
+	};
+
+	GPUTimeline* timeline;
+	uint64_t blockSize;
+	unsigned int maxBlocks;
+	std::vector<Block> blocks;
+	std::vector<Node> nodes;
+	std::vector<int> unusedNodes;
+	std::deque<PendingFree> pendingFrees;
+
+	uint64_t allocatedBytes;
+	uint64_t pendingFreeBytes;
+	uint64_t highWaterMark;
+	unsigned int allocationCount;
+	unsigned int failedAllocations;
+
+	int NewNode();
+	unsigned int AddBlock();
+	int FindFreeNode(unsigned int block, uint64_t size) const;
+	void InsertFree(int node);
+	void RemoveFree(int node);
+	int Split(int node, uint64_t size);
+	void RecycleNode(int node);
+	HeapAllocation Place(int node, uint64_t size, uint64_t alignment);
+	void ReleaseNode(int node);
+	bool IsLive(const HeapAllocation& allocation) const;
+};
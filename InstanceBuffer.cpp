@@ -0,0 +1,205 @@
+#include "InstanceBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Changed records at most this many apart are copied together
+// (more if that would mean too many copies)
+#define INSTANCE_BUFFER_MAX_GAP 8
+#define INSTANCE_BUFFER_MAX_RANGES 4096
+
+InstanceBuffer::InstanceBuffer() :
+	instanceCount(0),
+	instancesGrown(false),
+	materialCapacity(0),
+	materialsGrown(false),
+	instancesPacked(0),
+	materialsChanged(0),
+	lastRanges(0),
+	bytesUploaded(0)
+{
+}
+
+
+// --------------------------------------------------------
+// Sets this frame's instance count, growing the buffer
+// (by doubling) if it's too small.  New slots have no
+// entity, so they're packed the first time they're used.
+// --------------------------------------------------------
+void InstanceBuffer::BeginFrame(unsigned int count)
+{
+	instanceCount = count;
+	instancesPacked = 0;
+	materialsChanged = 0;
+
+	if (count <= instances.size())
+		return;
+
+	size_t capacity = std::max<size_t>(1024, instances.size());
+	while (capacity < count)
+		capacity *= 2;
+
+	instances.resize(capacity, RaytracingInstanceData{});
+	instanceKeys.resize(capacity, InstanceKey{});
+	instancesGrown = true;
+}
+
+
+// --------------------------------------------------------
+// Hands back the instance's record (zeroed) if anything it
+// was packed from has changed, remembering the new source
+// and that the record needs uploading
+// --------------------------------------------------------
+RaytracingInstanceData* InstanceBuffer::UpdateInstance(unsigned int index, const void* entity, unsigned int transformVersion, const void* material)
+{
+	InstanceKey& key = instanceKeys[index];
+	if (key.Entity == entity && key.Material == material && key.TransformVersion == transformVersion)
+		return 0;
+
+	key.Entity = entity;
+	key.Material = material;
+	key.TransformVersion = transformVersion;
+	dirtyInstances.push_back(index);
+	instancesPacked++;
+
+	memset(&instances[index], 0, sizeof(RaytracingInstanceData));
+	return &instances[index];
+}
+
+
+// --------------------------------------------------------
+// Finds a material's index, adding it (with zeroed data
+// until it's set) the first time it's seen
+// --------------------------------------------------------
+unsigned int InstanceBuffer::GetMaterialIndex(const void* material)
+{
+	auto it = materialIndices.find(material);
+	if (it != materialIndices.end())
+		return it->second;
+
+	unsigned int index = (unsigned int)materials.size();
+	materialIndices[material] = index;
+	materials.push_back(RaytracingMaterialData{});
+	dirtyMaterials.push_back(index);
+
+	if (materials.size() > materialCapacity)
+	{
+		materialCapacity = std::max(16u, materialCapacity);
+		while (materialCapacity < materials.size())
+			materialCapacity *= 2;
+		materialsGrown = true;
+	}
+	return index;
+}
+
+
+// --------------------------------------------------------
+// Replaces a material's data if it's different
+// --------------------------------------------------------
+void InstanceBuffer::SetMaterialData(unsigned int index, const RaytracingMaterialData& data)
+{
+	if (memcmp(&materials[index], &data, sizeof(RaytracingMaterialData)) == 0)
+		return;
+
+	materials[index] = data;
+	dirtyMaterials.push_back(index);
+	materialsChanged++;
+}
+
+
+// --------------------------------------------------------
+// Turns changed record indices into byte ranges, merging
+// records that are close enough that one larger copy is
+// cheaper than several small ones.  Widely scattered
+// changes are merged more aggressively, so there are never
+// more than a few thousand copies.
+// --------------------------------------------------------
+void InstanceBuffer::CoalesceRanges(std::vector<unsigned int>& indices, uint64_t stride, std::vector<InstanceBufferRange>& ranges)
+{
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+	size_t firstRange = ranges.size();
+	for (unsigned int gap = INSTANCE_BUFFER_MAX_GAP; ; gap *= 2)
+	{
+		ranges.resize(firstRange);
+
+		size_t i = 0;
+		while (i < indices.size())
+		{
+			unsigned int first = indices[i];
+			unsigned int last = first;
+			while (i < indices.size() && indices[i] <= last + gap)
+				last = indices[i++];
+
+			InstanceBufferRange range = {};
+			range.Offset = stride * first;
+			range.Size = stride * (last - first + 1ull);
+			ranges.push_back(range);
+		}
+
+		if (ranges.size() - firstRange <= INSTANCE_BUFFER_MAX_RANGES)
+			break;
+	}
+	indices.clear();
+}
+
+
+// --------------------------------------------------------
+// Gives the ranges of each buffer that changed since the
+// last call (or everything in use, if it grew)
+// --------------------------------------------------------
+void InstanceBuffer::CollectUploads(std::vector<InstanceBufferRange>& instanceRanges, std::vector<InstanceBufferRange>& materialRanges)
+{
+	instanceRanges.clear();
+	materialRanges.clear();
+
+	// Slots past the count aren't in use, but keep their records for
+	// when the count comes back up
+	dirtyInstances.erase(
+		std::remove_if(dirtyInstances.begin(), dirtyInstances.end(), [this](unsigned int i) { return i >= instanceCount; }),
+		dirtyInstances.end());
+
+	if (instancesGrown)
+	{
+		dirtyInstances.clear();
+		if (instanceCount > 0)
+			instanceRanges.push_back({ 0, sizeof(RaytracingInstanceData) * (uint64_t)instanceCount });
+		instancesGrown = false;
+	}
+	else
+	{
+		CoalesceRanges(dirtyInstances, sizeof(RaytracingInstanceData), instanceRanges);
+	}
+
+	if (materialsGrown)
+	{
+		dirtyMaterials.clear();
+		materialRanges.push_back({ 0, sizeof(RaytracingMaterialData) * (uint64_t)materials.size() });
+		materialsGrown = false;
+	}
+	else
+	{
+		CoalesceRanges(dirtyMaterials, sizeof(RaytracingMaterialData), materialRanges);
+	}
+
+	lastRanges = (unsigned int)(instanceRanges.size() + materialRanges.size());
+	for (const InstanceBufferRange& range : instanceRanges)
+		bytesUploaded += range.Size;
+	for (const InstanceBufferRange& range : materialRanges)
+		bytesUploaded += range.Size;
+}
+
+
+InstanceBufferStats InstanceBuffer::GetStats() const
+{
+	InstanceBufferStats stats = {};
+	stats.Instances = instanceCount;
+	stats.InstanceCapacity = (unsigned int)instances.size();
+	stats.Materials = (unsigned int)materials.size();
+	stats.InstancesPacked = instancesPacked;
+	stats.MaterialsChanged = materialsChanged;
+	stats.Ranges = lastRanges;
+	stats.BytesUploaded = bytesUploaded;
+	return stats;
+}
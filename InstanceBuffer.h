@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "BufferStructs.h"
+
+// Bytes of one of the buffers to copy to the GPU
+struct InstanceBufferRange
+{
+	uint64_t Offset;
+	uint64_t Size;
+};
+
+struct InstanceBufferStats
+{
+	unsigned int Instances;
+	unsigned int InstanceCapacity;
+	unsigned int Materials;
+	unsigned int InstancesPacked;		// Last frame
+	unsigned int MaterialsChanged;		// Last frame
+	unsigned int Ranges;				// Last frame's copies, across both buffers
+	uint64_t BytesUploaded;				// In total
+};
+
+// --------------------------------------------------------
+// CPU side of the per-instance data the hit shaders read by
+// InstanceIndex(), and the table of materials it indexes.
+//
+// Each instance slot remembers what it was packed from (the
+// entity, its transform's history version and material), so
+// a frame only repacks instances that changed, and only the
+// records that changed are uploaded.  Nearby changed records
+// are copied together to keep the number of copies down.
+//
+// Materials are found by identity and their data compared
+// each frame, as there are only ever a few of them.
+// --------------------------------------------------------
+class InstanceBuffer
+{
+public:
+	InstanceBuffer();
+
+	// Starts a frame with this many instances (in TLAS order)
+	void BeginFrame(unsigned int instanceCount);
+
+	// The record to fill in if the instance changed since it was
+	// packed, or null if what's there is still current
+	RaytracingInstanceData* UpdateInstance(unsigned int index, const void* entity, unsigned int transformVersion, const void* material);
+
+	// Materials, by identity (added when first seen)
+	unsigned int GetMaterialIndex(const void* material);
+	unsigned int GetMaterialCount() const { return (unsigned int)materials.size(); }
+	void SetMaterialData(unsigned int index, const RaytracingMaterialData& data);
+
+	// What changed since the last call, in bytes.  Everything in use
+	// is included after a buffer grows, as it has to be recreated.
+	void CollectUploads(std::vector<InstanceBufferRange>& instanceRanges, std::vector<InstanceBufferRange>& materialRanges);
+
+	const RaytracingInstanceData* GetInstanceData() const { return instances.data(); }
+	const RaytracingMaterialData* GetMaterialData() const { return materials.data(); }
+	unsigned int GetInstanceCount() const { return instanceCount; }
+	unsigned int GetInstanceCapacity() const { return (unsigned int)instances.size(); }
+	unsigned int GetMaterialCapacity() const { return materialCapacity; }
+
+	InstanceBufferStats GetStats() const;
+
+private:
+	// What an instance slot was last packed from
+	struct InstanceKey
+	{
+		const void* Entity;
+		const void* Material;
+		unsigned int TransformVersion;
+	};
+
+	unsigned int instanceCount;
+	std::vector<RaytracingInstanceData> instances;
+	std::vector<InstanceKey> instanceKeys;
+	std::vector<unsigned int> dirtyInstances;
+	bool instancesGrown;
+
+	std::vector<RaytracingMaterialData> materials;
+	std::unordered_map<const void*, unsigned int> materialIndices;
+	std::vector<unsigned int> dirtyMaterials;
+	unsigned int materialCapacity;
+	bool materialsGrown;
+
+	unsigned int instancesPacked;
+	unsigned int materialsChanged;
+	unsigned int lastRanges;
+	uint64_t bytesUploaded;
+
+	static void CoalesceRanges(std::vector<unsigned int>& indices, uint64_t stride, std::vector<InstanceBufferRange>& ranges);
+};
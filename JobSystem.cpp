@@ -0,0 +1,113 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+// Singleton requirement
+JobSystem* JobSystem::instance;
+
+// --------------------------------------------------------
+// Starts one worker per hardware thread (minus the caller)
+// --------------------------------------------------------
+JobSystem::JobSystem() :
+	shuttingDown(false),
+	currentJob(0),
+	jobCount(0),
+	chunkSize(1),
+	jobGeneration(0),
+	nextChunkStart(0),
+	activeWorkers(0)
+{
+	unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (unsigned int i = 0; i + 1 < hardwareThreads; i++)
+		workers.emplace_back(&JobSystem::WorkerLoop, this);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shuttingDown = true;
+	}
+	workAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+// --------------------------------------------------------
+// Splits [0, count) into chunks and processes them on all
+// threads, including this one.  Blocks until done.
+// --------------------------------------------------------
+void JobSystem::ParallelFor(
+	unsigned int count,
+	const std::function<void(unsigned int begin, unsigned int end)>& job,
+	unsigned int minChunkSize)
+{
+	if (count == 0)
+		return;
+
+	// Not worth waking anyone up?
+	if (workers.empty() || count <= minChunkSize)
+	{
+		job(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> loopLock(parallelForMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		jobCount = count;
+
+		// A few chunks per thread so uneven work still balances
+		unsigned int chunks = GetThreadCount() * 4;
+		chunkSize = std::max((count + chunks - 1) / chunks, std::max(minChunkSize, 1u));
+		nextChunkStart = 0;
+		activeWorkers = (unsigned int)workers.size();
+		jobGeneration++;
+	}
+	workAvailable.notify_all();
+
+	// Help out, then wait for everyone else to finish their chunks
+	RunChunks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	workFinished.wait(lock, [this]() { return activeWorkers == 0; });
+	currentJob = 0;
+}
+
+void JobSystem::RunChunks()
+{
+	while (true)
+	{
+		unsigned int begin = nextChunkStart.fetch_add(chunkSize);
+		if (begin >= jobCount)
+			return;
+
+		(*currentJob)(begin, std::min(begin + chunkSize, jobCount));
+	}
+}
+
+void JobSystem::WorkerLoop()
+{
+	unsigned int seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [&]() { return shuttingDown || jobGeneration != seenGeneration; });
+			if (shuttingDown)
+				return;
+			seenGeneration = jobGeneration;
+		}
+
+		RunChunks();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		workFinished.notify_one();
+	}
+}
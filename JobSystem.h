@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------
+// A small pool of worker threads for splitting loops over
+// rows, pixels, textures, etc. across every core.  The
+// calling thread helps out, so ParallelFor() returns only
+// once every index has been processed.
+// --------------------------------------------------------
+class JobSystem
+{
+#pragma region Singleton
+public:
+	// Gets the one and only instance of this class
+	static JobSystem& GetInstance()
+	{
+		if (!instance)
+		{
+			instance = new JobSystem();
+		}
+
+		return *instance;
+	}
+
+	// Remove these functions (C++ 11 version)
+	JobSystem(JobSystem const&) = delete;
+	void operator=(JobSystem const&) = delete;
+
+private:
+	static JobSystem* instance;
+	JobSystem();
+#pragma endregion
+
+public:
+	~JobSystem();
+
+	// Calls job(begin, end) for chunks covering [0, count)
+	// Chunks are at least minChunkSize long (except the last)
+	void ParallelFor(
+		unsigned int count,
+		const std::function<void(unsigned int begin, unsigned int end)>& job,
+		unsigned int minChunkSize = 1);
+
+	// Workers plus the calling thread
+	unsigned int GetThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+	bool shuttingDown;
+
+	// The loop currently being processed
+	const std::function<void(unsigned int, unsigned int)>* currentJob;
+	unsigned int jobCount;
+	unsigned int chunkSize;
+	unsigned int jobGeneration;
+	std::atomic<unsigned int> nextChunkStart;
+	unsigned int activeWorkers;
+
+	// Only one loop runs at a time
+	std::mutex parallelForMutex;
+
+	void WorkerLoop();
+	void RunChunks();
+};
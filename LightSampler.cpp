@@ -0,0 +1,553 @@
+#include "LightSampler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Small vector helpers so this file has no dependencies
+// beyond the structs themselves (keeps it usable headless)
+// --------------------------------------------------------
+static float Dot(XMFLOAT3 a, XMFLOAT3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static XMFLOAT3 Sub(XMFLOAT3 a, XMFLOAT3 b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static float Saturate(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+static XMFLOAT3 Normalize(XMFLOAT3 v)
+{
+	float len = sqrtf(Dot(v, v));
+	if (len <= 0.0f) return XMFLOAT3(0, 0, 0);
+	return XMFLOAT3(v.x / len, v.y / len, v.z / len);
+}
+
+// --------------------------------------------------------
+// Importance of a BVH node for a shading position.  Uses the
+// same range-based falloff as Attenuate() in Lighting.hlsli,
+// evaluated at the closest point of the node's bounds, so it
+// never underestimates a light that could reach the position.
+// Must match LightBVHNodeImportance() in Raytracing.hlsl
+// --------------------------------------------------------
+static float NodeImportance(const LightBVHNode& node, XMFLOAT3 position)
+{
+	// Distance from the position to the closest point on the bounds
+	float dx = std::max(std::max(node.BoundsMin.x - position.x, 0.0f), position.x - node.BoundsMax.x);
+	float dy = std::max(std::max(node.BoundsMin.y - position.y, 0.0f), position.y - node.BoundsMax.y);
+	float dz = std::max(std::max(node.BoundsMin.z - position.z, 0.0f), position.z - node.BoundsMax.z);
+	float distSq = dx * dx + dy * dy + dz * dz;
+
+	if (node.MaxRange <= 0.0f)
+		return 0.0f;
+
+	float att = Saturate(1.0f - distSq / (node.MaxRange * node.MaxRange));
+	return node.Power * att * att;
+}
+
+
+LightSampler::LightSampler() :
+	lightCount(0),
+	infiniteLightCount(0),
+	infiniteLightProbability(0.0f),
+	sceneVolume(0.0f)
+{
+}
+
+// --------------------------------------------------------
+// Power used for importance - intensity times luminance
+// --------------------------------------------------------
+float LightSampler::LightPower(const Light& light)
+{
+	float luminance = light.Color.x * 0.2126f + light.Color.y * 0.7152f + light.Color.z * 0.0722f;
+	return std::max(light.Intensity * luminance, 0.0f);
+}
+
+// --------------------------------------------------------
+// How much a light matters to a random point in a volume of
+// the given size.  Directional lights reach every point; a
+// local light only the sphere within its range, falling off
+// as in Attenuate() - (1 - d^2/r^2)^2 over the sphere comes to
+// 32/105 pi r^3 - and a spot light only its cone, where
+// angle^falloff averages 1 / (2 * (falloff + 1)).
+//
+// Picking by power times reach would be right for absolute
+// error, but a dim light is often the only one reaching a
+// point, so the square root hedges toward uniform picking
+// and keeps relative error (what the eye sees) down.
+// --------------------------------------------------------
+float LightSampler::LightImportance(const Light& light, float sceneVolume)
+{
+	float power = LightPower(light);
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL || sceneVolume <= 0.0f)
+		return sqrtf(power);
+
+	float reach = 32.0f / 105.0f * XM_PI * light.Range * light.Range * light.Range;
+	if (light.Type == LIGHT_TYPE_SPOT)
+		reach /= 2.0f * (std::max(light.SpotFalloff, 0.0f) + 1.0f);
+	return sqrtf(power * std::min(reach / sceneVolume, 1.0f));
+}
+
+// --------------------------------------------------------
+// Scalar direct light arriving at a point (Lambert term and
+// range attenuation, no visibility).  Mirrors the lighting
+// functions in Lighting.hlsli closely enough to use as the
+// "ground truth" when measuring sampler variance.
+// --------------------------------------------------------
+float LightSampler::UnshadowedContribution(const Light& light, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	float power = LightPower(light);
+
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+	{
+		XMFLOAT3 toLight = Normalize(XMFLOAT3(-light.Direction.x, -light.Direction.y, -light.Direction.z));
+		return power * Saturate(Dot(normal, toLight));
+	}
+
+	XMFLOAT3 toLight = Sub(light.Position, position);
+	float distSq = Dot(toLight, toLight);
+	toLight = Normalize(toLight);
+
+	float att = light.Range > 0.0f ? Saturate(1.0f - distSq / (light.Range * light.Range)) : 0.0f;
+	float contribution = power * Saturate(Dot(normal, toLight)) * att * att;
+
+	if (light.Type == LIGHT_TYPE_SPOT)
+	{
+		XMFLOAT3 dir = Normalize(light.Direction);
+		float angle = Saturate(-Dot(toLight, dir));
+		contribution *= powf(angle, light.SpotFalloff);
+	}
+
+	return contribution;
+}
+
+// --------------------------------------------------------
+// Builds the alias tables and the light BVH for a set of lights
+// --------------------------------------------------------
+void LightSampler::Build(const std::vector<Light>& lights)
+{
+	this->lights = lights;
+	lightCount = (unsigned int)lights.size();
+	infiniteLightCount = 0;
+	infiniteLightProbability = 0.0f;
+	sceneVolume = 0.0f;
+	aliasTable.clear();
+	bvhNodes.clear();
+
+	if (lightCount == 0)
+		return;
+
+	// The space the local lights can light, since a light that reaches
+	// less of it matters less to any one point than its power suggests
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const Light& light : lights)
+	{
+		if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+			continue;
+		boundsMin.x = std::min(boundsMin.x, light.Position.x - light.Range);
+		boundsMin.y = std::min(boundsMin.y, light.Position.y - light.Range);
+		boundsMin.z = std::min(boundsMin.z, light.Position.z - light.Range);
+		boundsMax.x = std::max(boundsMax.x, light.Position.x + light.Range);
+		boundsMax.y = std::max(boundsMax.y, light.Position.y + light.Range);
+		boundsMax.z = std::max(boundsMax.z, light.Position.z + light.Range);
+	}
+	sceneVolume = boundsMax.x > boundsMin.x ?
+		(boundsMax.x - boundsMin.x) * (boundsMax.y - boundsMin.y) * (boundsMax.z - boundsMin.z) :
+		0.0f;
+
+	// Split lights by whether they have a position
+	std::vector<unsigned int> allIndices;
+	std::vector<float> allWeights;
+	std::vector<unsigned int> infiniteIndices;
+	std::vector<float> infiniteWeights;
+	std::vector<unsigned int> localIndices;
+
+	double infiniteImportance = 0.0;
+	double localImportance = 0.0;
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		float importance = LightImportance(lights[i], sceneVolume);
+		allIndices.push_back(i);
+		allWeights.push_back(importance);
+
+		if (lights[i].Type == LIGHT_TYPE_DIRECTIONAL)
+		{
+			infiniteIndices.push_back(i);
+			infiniteWeights.push_back(importance);
+			infiniteImportance += importance;
+		}
+		else
+		{
+			localIndices.push_back(i);
+			localImportance += importance;
+		}
+	}
+
+	// The table over everything knows nothing about where the shading
+	// point is, so half its picks are uniform to cap how badly a light
+	// it underrates (one that happens to be close) can be sampled
+	double totalImportance = infiniteImportance + localImportance;
+	if (totalImportance > 0.0)
+	{
+		for (float& weight : allWeights)
+			weight = (float)(0.5 * weight / totalImportance + 0.5 / lightCount);
+	}
+
+	// One table over everything, followed by one over just the directional lights
+	BuildAliasTable(allIndices, allWeights);
+	BuildAliasTable(infiniteIndices, infiniteWeights);
+	infiniteLightCount = (unsigned int)infiniteIndices.size();
+
+	// The BVH only holds lights that have a position
+	if (!localIndices.empty())
+	{
+		bvhNodes.reserve(localIndices.size() * 2 - 1);
+		BuildBVHNode(localIndices, 0, (unsigned int)localIndices.size());
+	}
+
+	// How often the BVH strategy should go to the directional lights
+	if (localIndices.empty())
+		infiniteLightProbability = 1.0f;
+	else if (infiniteImportance > 0.0)
+		infiniteLightProbability = LIGHT_BVH_INFINITE_PROBABILITY;
+}
+
+// --------------------------------------------------------
+// Appends an alias table for the given lights using Vose's
+// method, so any light can be picked in constant time with
+// a chance proportional to its weight.
+// --------------------------------------------------------
+void LightSampler::BuildAliasTable(const std::vector<unsigned int>& lightIndices, const std::vector<float>& weights)
+{
+	size_t count = lightIndices.size();
+	if (count == 0)
+		return;
+
+	size_t offset = aliasTable.size();
+	aliasTable.resize(offset + count);
+
+	double total = 0.0;
+	for (size_t i = 0; i < count; i++)
+		total += weights[i];
+
+	// No weight at all?  Fall back to uniform
+	std::vector<double> scaled(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		double pdf = total > 0.0 ? weights[i] / total : 1.0 / count;
+		scaled[i] = pdf * count;
+
+		aliasTable[offset + i].Pdf = (float)pdf;
+		aliasTable[offset + i].LightIndex = lightIndices[i];
+		aliasTable[offset + i].Alias = (unsigned int)i;
+		aliasTable[offset + i].Probability = 1.0f;
+	}
+
+	// Split into entries above and below the average
+	std::vector<size_t> small;
+	std::vector<size_t> large;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (scaled[i] < 1.0) small.push_back(i);
+		else large.push_back(i);
+	}
+
+	// Pair each small entry with a large one that fills the rest of its bucket
+	while (!small.empty() && !large.empty())
+	{
+		size_t s = small.back(); small.pop_back();
+		size_t l = large.back(); large.pop_back();
+
+		aliasTable[offset + s].Probability = (float)scaled[s];
+		aliasTable[offset + s].Alias = (unsigned int)l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0) small.push_back(l);
+		else large.push_back(l);
+	}
+
+	// Anything left over is (within rounding) a full bucket
+	for (size_t l : large) aliasTable[offset + l].Probability = 1.0f;
+	for (size_t s : small) aliasTable[offset + s].Probability = 1.0f;
+}
+
+// --------------------------------------------------------
+// Recursively builds BVH nodes over lightIndices[first, first+count)
+// by splitting at the median of the widest axis.  Returns the
+// index of the node that was created.
+// --------------------------------------------------------
+unsigned int LightSampler::BuildBVHNode(std::vector<unsigned int>& lightIndices, unsigned int first, unsigned int count)
+{
+	unsigned int nodeIndex = (unsigned int)bvhNodes.size();
+	bvhNodes.push_back({});
+
+	// Gather bounds and totals for this node
+	LightBVHNode node = {};
+	node.BoundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.BoundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const Light& light = lights[lightIndices[i]];
+		node.BoundsMin.x = std::min(node.BoundsMin.x, light.Position.x);
+		node.BoundsMin.y = std::min(node.BoundsMin.y, light.Position.y);
+		node.BoundsMin.z = std::min(node.BoundsMin.z, light.Position.z);
+		node.BoundsMax.x = std::max(node.BoundsMax.x, light.Position.x);
+		node.BoundsMax.y = std::max(node.BoundsMax.y, light.Position.y);
+		node.BoundsMax.z = std::max(node.BoundsMax.z, light.Position.z);
+		node.Power += LightPower(light);
+		node.MaxRange = std::max(node.MaxRange, light.Range);
+	}
+
+	if (count == 1)
+	{
+		node.ChildOrLight = lightIndices[first] | LIGHT_BVH_LEAF_BIT;
+		bvhNodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	// Split along the widest axis
+	XMFLOAT3 extent = Sub(node.BoundsMax, node.BoundsMin);
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
+
+	unsigned int half = count / 2;
+	const std::vector<Light>& allLights = lights;
+	std::nth_element(
+		lightIndices.begin() + first,
+		lightIndices.begin() + first + half,
+		lightIndices.begin() + first + count,
+		[&](unsigned int a, unsigned int b) {
+			const XMFLOAT3& pa = allLights[a].Position;
+			const XMFLOAT3& pb = allLights[b].Position;
+			return (axis == 0 ? pa.x < pb.x : (axis == 1 ? pa.y < pb.y : pa.z < pb.z));
+		});
+
+	// Left child always directly follows its parent
+	BuildBVHNode(lightIndices, first, half);
+	node.ChildOrLight = BuildBVHNode(lightIndices, first + half, count - half);
+	bvhNodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+// --------------------------------------------------------
+// Picks any light with equal probability
+// --------------------------------------------------------
+LightSample LightSampler::SampleUniform(float u0) const
+{
+	if (lightCount == 0)
+		return { -1, 0.0f };
+
+	unsigned int index = std::min((unsigned int)(u0 * lightCount), lightCount - 1);
+	return { (int)index, 1.0f / lightCount };
+}
+
+// --------------------------------------------------------
+// Picks a light by its importance, regardless of position
+// --------------------------------------------------------
+LightSample LightSampler::SampleAliasTable(float u0, float u1) const
+{
+	return SampleAliasRange(0, lightCount, u0, u1);
+}
+
+LightSample LightSampler::SampleAliasRange(unsigned int offset, unsigned int count, float u0, float u1) const
+{
+	if (count == 0)
+		return { -1, 0.0f };
+
+	unsigned int bucket = std::min((unsigned int)(u0 * count), count - 1);
+	const LightAliasEntry& entry = aliasTable[offset + bucket];
+	const LightAliasEntry& chosen = u1 < entry.Probability ? entry : aliasTable[offset + entry.Alias];
+	return { (int)chosen.LightIndex, chosen.Pdf };
+}
+
+// --------------------------------------------------------
+// Picks a light by walking the BVH, choosing each child
+// by its estimated contribution at this position
+// --------------------------------------------------------
+LightSample LightSampler::SampleBVH(XMFLOAT3 position, float u0, float u1) const
+{
+	// Go to the directional lights instead?
+	if (u1 < infiniteLightProbability)
+	{
+		float remapped = u1 / infiniteLightProbability;
+		LightSample sample = SampleAliasRange(GetInfiniteAliasOffset(), infiniteLightCount, u0, remapped);
+		sample.Pdf *= infiniteLightProbability;
+		return sample;
+	}
+
+	if (bvhNodes.empty())
+		return { -1, 0.0f };
+
+	float pdf = 1.0f - infiniteLightProbability;
+	unsigned int nodeIndex = 0;
+	while (!(bvhNodes[nodeIndex].ChildOrLight & LIGHT_BVH_LEAF_BIT))
+	{
+		unsigned int left = nodeIndex + 1;
+		unsigned int right = bvhNodes[nodeIndex].ChildOrLight;
+		float importanceLeft = NodeImportance(bvhNodes[left], position);
+		float importanceRight = NodeImportance(bvhNodes[right], position);
+		float total = importanceLeft + importanceRight;
+
+		// Nothing below here can reach this position
+		if (total <= 0.0f)
+			return { -1, 0.0f };
+
+		// Pick a child and reuse the random number for the next level
+		float probLeft = importanceLeft / total;
+		if (u0 < probLeft)
+		{
+			u0 = u0 / probLeft;
+			pdf *= probLeft;
+			nodeIndex = left;
+		}
+		else
+		{
+			u0 = (u0 - probLeft) / (1.0f - probLeft);
+			pdf *= 1.0f - probLeft;
+			nodeIndex = right;
+		}
+		u0 = std::min(u0, 0.99999994f);
+	}
+
+	return { (int)(bvhNodes[nodeIndex].ChildOrLight & ~LIGHT_BVH_LEAF_BIT), pdf };
+}
+
+LightSample LightSampler::Sample(int strategy, XMFLOAT3 position, float u0, float u1) const
+{
+	switch (strategy)
+	{
+	case LIGHT_SAMPLING_UNIFORM: return SampleUniform(u0);
+	case LIGHT_SAMPLING_ALIAS_TABLE: return SampleAliasTable(u0, u1);
+	default: return SampleBVH(position, u0, u1);
+	}
+}
+
+int LightSampler::GetDefaultStrategy() const
+{
+	return (lightCount - infiniteLightCount) > LIGHT_BVH_THRESHOLD ?
+		LIGHT_SAMPLING_BVH :
+		LIGHT_SAMPLING_UNIFORM;
+}
+
+// --------------------------------------------------------
+// Exact second moment, E[(contribution / pdf)^2], of the one
+// sample estimate at a point.  Enumerates every light with its
+// pdf instead of sampling, since rare high-value picks would
+// otherwise make the measured variance very unreliable.
+// --------------------------------------------------------
+double LightSampler::SecondMoment(int strategy, XMFLOAT3 position, XMFLOAT3 normal) const
+{
+	double moment = 0.0;
+	switch (strategy)
+	{
+	case LIGHT_SAMPLING_UNIFORM:
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			double contribution = UnshadowedContribution(lights[i], position, normal);
+			moment += contribution * contribution * lightCount;
+		}
+		return moment;
+
+	case LIGHT_SAMPLING_ALIAS_TABLE:
+		// The first table's entries start out in light order
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			double contribution = UnshadowedContribution(lights[i], position, normal);
+			if (aliasTable[i].Pdf > 0.0f)
+				moment += contribution * contribution / aliasTable[i].Pdf;
+		}
+		return moment;
+
+	default:
+		for (unsigned int i = 0; i < infiniteLightCount; i++)
+		{
+			const LightAliasEntry& entry = aliasTable[GetInfiniteAliasOffset() + i];
+			double contribution = UnshadowedContribution(lights[entry.LightIndex], position, normal);
+			double pdf = (double)entry.Pdf * infiniteLightProbability;
+			if (pdf > 0.0)
+				moment += contribution * contribution / pdf;
+		}
+		if (!bvhNodes.empty() && infiniteLightProbability < 1.0f)
+			moment += SecondMomentBVH(0, 1.0 - infiniteLightProbability, position, normal);
+		return moment;
+	}
+}
+
+double LightSampler::SecondMomentBVH(unsigned int nodeIndex, double pdf, XMFLOAT3 position, XMFLOAT3 normal) const
+{
+	const LightBVHNode& node = bvhNodes[nodeIndex];
+	if (node.ChildOrLight & LIGHT_BVH_LEAF_BIT)
+	{
+		double contribution = UnshadowedContribution(lights[node.ChildOrLight & ~LIGHT_BVH_LEAF_BIT], position, normal);
+		return contribution * contribution / pdf;
+	}
+
+	unsigned int left = nodeIndex + 1;
+	unsigned int right = node.ChildOrLight;
+	double importanceLeft = NodeImportance(bvhNodes[left], position);
+	double importanceRight = NodeImportance(bvhNodes[right], position);
+	double total = importanceLeft + importanceRight;
+
+	// Importance is conservative, so nothing below here contributes
+	if (total <= 0.0)
+		return 0.0;
+
+	double moment = 0.0;
+	if (importanceLeft > 0.0)
+		moment += SecondMomentBVH(left, pdf * importanceLeft / total, position, normal);
+	if (importanceRight > 0.0)
+		moment += SecondMomentBVH(right, pdf * importanceRight / total, position, normal);
+	return moment;
+}
+
+// --------------------------------------------------------
+// Measures the average relative variance of a one-sample
+// direct lighting estimate (contribution / pdf) for random
+// shading points.  Lower is better; 0 means every sample
+// would return the exact answer.
+// --------------------------------------------------------
+double LightSampler::MeasureVariance(
+	const std::vector<Light>& lights,
+	int strategy,
+	unsigned int shadingPoints)
+{
+	LightSampler sampler;
+	sampler.Build(lights);
+
+	// Shading points are placed inside the bounds of the local lights
+	XMFLOAT3 boundsMin(-10, -10, -10);
+	XMFLOAT3 boundsMax(10, 10, 10);
+	if (!sampler.bvhNodes.empty())
+	{
+		boundsMin = sampler.bvhNodes[0].BoundsMin;
+		boundsMax = sampler.bvhNodes[0].BoundsMax;
+	}
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	double totalRelativeVariance = 0.0;
+	unsigned int measuredPoints = 0;
+	for (unsigned int p = 0; p < shadingPoints; p++)
+	{
+		XMFLOAT3 position(
+			boundsMin.x + (boundsMax.x - boundsMin.x) * dist(rng),
+			boundsMin.y + (boundsMax.y - boundsMin.y) * dist(rng),
+			boundsMin.z + (boundsMax.z - boundsMin.z) * dist(rng));
+		XMFLOAT3 normal = Normalize(XMFLOAT3(dist(rng) * 2 - 1, dist(rng) * 2 - 1, dist(rng) * 2 - 1));
+
+		// Exact answer for this point
+		double reference = 0.0;
+		for (const Light& light : lights)
+			reference += UnshadowedContribution(light, position, normal);
+		if (reference <= 0.0)
+			continue;
+
+		// Variance is the second moment minus the squared mean
+		double variance = std::max(sampler.SecondMoment(strategy, position, normal) - reference * reference, 0.0);
+		totalRelativeVariance += variance / (reference * reference);
+		measuredPoints++;
+	}
+
+	return measuredPoints > 0 ? totalRelativeVariance / measuredPoints : 0.0;
+}
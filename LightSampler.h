@@ -0,0 +1,130 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Lights.h"
+
+// Light sampling strategies
+// Must match definitions in Raytracing.hlsl
+#define LIGHT_SAMPLING_UNIFORM		0
+#define LIGHT_SAMPLING_ALIAS_TABLE	1
+#define LIGHT_SAMPLING_BVH			2
+
+// Above this many local (point/spot) lights the BVH
+// pays for its traversal and becomes the default strategy.
+// Below it, no table picks much better than uniform does
+#define LIGHT_BVH_THRESHOLD 4
+
+// How often the BVH strategy picks a directional light instead of
+// walking the BVH, when there are both.  The BVH finds the lights
+// near each point, so the other lights' power says little about
+// it, and this measured best from a handful of lights to 100000
+#define LIGHT_BVH_INFINITE_PROBABILITY 0.2f
+
+// Marks a BVH node as a leaf - the rest of ChildOrLight is then a light index
+#define LIGHT_BVH_LEAF_BIT 0x80000000u
+
+// One entry of an importance-weighted alias table (Vose's method)
+// Must match the struct in Raytracing.hlsl
+struct LightAliasEntry
+{
+	float			Probability;	// Chance of keeping this entry instead of jumping to Alias
+	unsigned int	Alias;			// Entry to use otherwise
+	float			Pdf;			// Overall chance of this entry being picked
+	unsigned int	LightIndex;		// Index into the light array this entry refers to
+};
+
+// A node of the light BVH, stored depth first so the
+// left child of an interior node is always the next node
+// Must match the struct in Raytracing.hlsl
+struct LightBVHNode
+{
+	DirectX::XMFLOAT3	BoundsMin;
+	float				Power;			// Summed power of all lights below this node
+	DirectX::XMFLOAT3	BoundsMax;
+	float				MaxRange;		// Largest light range below this node
+	unsigned int		ChildOrLight;	// Right child index, or light index | LIGHT_BVH_LEAF_BIT
+	unsigned int		Padding[3];		// 48 bytes
+};
+
+// Result of picking a light
+struct LightSample
+{
+	int		LightIndex;	// -1 if no light could be picked
+	float	Pdf;
+};
+
+// --------------------------------------------------------
+// Importance sampling for many lights.  Builds an alias
+// table over every light, weighted by power and reach, and a
+// BVH over the local (point/spot) lights, so picking a light
+// for a single shadow ray costs O(1) or O(log n) regardless
+// of count.
+//
+// Directional lights have no position, so the BVH strategy
+// first chooses between "any directional light" and "the BVH"
+// by importance, then uses a second alias table over only the
+// directional lights.
+// --------------------------------------------------------
+class LightSampler
+{
+public:
+	LightSampler();
+
+	void Build(const std::vector<Light>& lights);
+
+	// Sampling - u0/u1 are uniform random numbers in [0,1)
+	LightSample SampleUniform(float u0) const;
+	LightSample SampleAliasTable(float u0, float u1) const;
+	LightSample SampleBVH(DirectX::XMFLOAT3 position, float u0, float u1) const;
+	LightSample Sample(int strategy, DirectX::XMFLOAT3 position, float u0, float u1) const;
+
+	// Strategy we'd pick for this light set
+	int GetDefaultStrategy() const;
+
+	// Data for the GPU
+	// Alias table holds all lights first, then the directional-only table
+	const std::vector<LightAliasEntry>& GetAliasTable() const { return aliasTable; }
+	const std::vector<LightBVHNode>& GetBVHNodes() const { return bvhNodes; }
+	unsigned int GetLightCount() const { return lightCount; }
+	unsigned int GetInfiniteLightCount() const { return infiniteLightCount; }
+	unsigned int GetInfiniteAliasOffset() const { return lightCount; }
+	float GetInfiniteLightProbability() const { return infiniteLightProbability; }
+
+	// Power used for importance - intensity times luminance
+	static float LightPower(const Light& light);
+
+	// How much a light matters to a random point in a scene of the
+	// given volume.  The directional table picks by it directly, the
+	// table over every light by an even mix of it and uniform
+	static float LightImportance(const Light& light, float sceneVolume);
+	float GetSceneVolume() const { return sceneVolume; }
+
+	// Direct light arriving at a point from a light, ignoring visibility
+	// This is the quantity the samplers are trying to estimate
+	static float UnshadowedContribution(const Light& light, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+
+	// Exact variance of a one-sample direct light estimate, averaged
+	// over random shading points in the light set's bounds
+	static double MeasureVariance(
+		const std::vector<Light>& lights,
+		int strategy,
+		unsigned int shadingPoints);
+
+private:
+	unsigned int lightCount;
+	unsigned int infiniteLightCount;
+	float infiniteLightProbability;
+	float sceneVolume;
+
+	std::vector<Light> lights;
+	std::vector<LightAliasEntry> aliasTable;
+	std::vector<LightBVHNode> bvhNodes;
+
+	void BuildAliasTable(const std::vector<unsigned int>& lightIndices, const std::vector<float>& weights);
+	unsigned int BuildBVHNode(std::vector<unsigned int>& lightIndices, unsigned int first, unsigned int count);
+	LightSample SampleAliasRange(unsigned int offset, unsigned int count, float u0, float u1) const;
+	double SecondMoment(int strategy, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal) const;
+	double SecondMomentBVH(unsigned int nodeIndex, double pdf, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal) const;
+};
@@ -0,0 +1,130 @@
+#include "MappedFile.h"
+#include "FileStreams.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+	data(0),
+	size(0),
+	file(0),
+	mapping(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::wstring& path)
+{
+	Close();
+
+	HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, 0);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE view = CreateFileMappingW(handle, 0, PAGE_READONLY, 0, 0, 0);
+	void* address = view ? MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0) : 0;
+	if (!address)
+	{
+		if (view)
+			CloseHandle(view);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file = handle;
+	mapping = view;
+	data = (const unsigned char*)address;
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	data = 0;
+	size = 0;
+	file = 0;
+	mapping = 0;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+	if (!data || offset >= size)
+		return;
+
+	WIN32_MEMORY_RANGE_ENTRY range = {};
+	range.VirtualAddress = (void*)(data + offset);
+	range.NumberOfBytes = bytes < size - offset ? bytes : size - offset;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+bool MappedFile::Open(const std::wstring& path)
+{
+	Close();
+
+	int descriptor = open(GetNarrowPath(path).c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat status = {};
+	void* address = MAP_FAILED;
+	if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+		address = mmap(0, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+	// The mapping keeps the file alive on its own
+	close(descriptor);
+	if (address == MAP_FAILED)
+		return false;
+
+	data = (const unsigned char*)address;
+	size = (size_t)status.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		munmap((void*)data, size);
+	data = 0;
+	size = 0;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+	if (!data || offset >= size)
+		return;
+
+	// madvise wants a page aligned start
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = offset / page * page;
+	size_t end = bytes < size - offset ? offset + bytes : size;
+	madvise((void*)(data + start), end - start, MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// --------------------------------------------------------
+// A whole file mapped read-only into memory, so its bytes
+// are only read from disk as they're touched (and pages
+// nobody touches are never read at all).
+//
+// Uses file mappings on Windows and mmap elsewhere.
+// --------------------------------------------------------
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Empty files can't be mapped, so they fail to open
+	bool Open(const std::wstring& path);
+	void Close();
+
+	bool IsOpen() const { return data != 0; }
+	const unsigned char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+	// Asks the OS to start reading a range in ahead of use (a hint only)
+	void Prefetch(size_t offset, size_t bytes) const;
+
+private:
+	const unsigned char* data;
+	size_t size;
+	void* file;			// Windows handles (unused elsewhere)
+	void* mapping;
+};
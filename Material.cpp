@@ -9,14 +9,21 @@ Material::Material(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState, Di
     this->uvOffset = uvOffset;
 }
 
+Material::~Material()
+{
+    //give the texture descriptors back to the heap
+    DX12Helper::GetInstance().FreeSrvUavDescriptors(srvDescriptors);
+}
+
+//both include the atlas remap, since that's what the shaders use
 DirectX::XMFLOAT2 Material::GetUVScale()
 {
-    return uvScale;
+    return DirectX::XMFLOAT2(uvScale.x * atlasScale.x, uvScale.y * atlasScale.y);
 }
 
 DirectX::XMFLOAT2 Material::GetUVOffset()
 {
-    return uvOffset;
+    return DirectX::XMFLOAT2(uvOffset.x * atlasScale.x + atlasOffset.x, uvOffset.y * atlasScale.y + atlasOffset.y);
 }
 
 DirectX::XMFLOAT4 Material::GetColorTint()
@@ -54,6 +61,25 @@ Microsoft::WRL::ComPtr<ID3D12PipelineState> Material::GetPipelineState()
 
 D3D12_GPU_DESCRIPTOR_HANDLE Material::GetFinalGPUHandleForTextures()
 {
+    //textures that streamed levels in or out have new srvs,
+    //so copy them into a fresh range (the old one is only
+    //reused once the gpu is done with it)
+    DX12Helper* dx12Helper = &DX12Helper::GetInstance();
+    if (finalized && !atlased && textureDescriptorVersion != dx12Helper->GetTextureDescriptorVersion()) {
+        DescriptorHandle previous = srvDescriptors;
+        D3D12_GPU_DESCRIPTOR_HANDLE previousGPUHandle = finalGPUHandleForSRVs;
+        finalized = false;
+        FinalizeMaterial();
+        if (finalized) {
+            dx12Helper->FreeSrvUavDescriptors(previous);
+        }
+        else {
+            srvDescriptors = previous;
+            finalGPUHandleForSRVs = previousGPUHandle;
+            finalized = true;
+        }
+    }
+
     return finalGPUHandleForSRVs;
 }
 
@@ -77,18 +103,34 @@ void Material::FinalizeMaterial()
 
     DX12Helper* dx12Helper = &DX12Helper::GetInstance();
 
+    //the shaders see these as one table, so they need
+    //a contiguous range in the heap
+    srvDescriptors = dx12Helper->AllocateSrvUavDescriptors(numTexSlots);
+    if (!srvDescriptors.IsValid()) {
+        return;
+    }
+
     for (int i = 0; i < numTexSlots; i++) {
-        D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle = dx12Helper->CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(
-            textureSRVsBySlot[i], 1);
-        
-        //if this is the first one we're copying
-        //store the handle so we can reference the 
-        //whole area on the gpu
-        if (i == 0) {
-            finalGPUHandleForSRVs = gpuHandle;
-        }
+        dx12Helper->CopyDescriptorsToSrvUavRange(srvDescriptors, i, textureSRVsBySlot[i], 1);
     }
 
+    //store the handle so we can reference the
+    //whole area on the gpu
+    finalGPUHandleForSRVs = dx12Helper->GetSrvUavGPUHandle(srvDescriptors);
+
     //set finalize to true so we can't finalize again
     finalized = true;
+    textureDescriptorVersion = dx12Helper->GetTextureDescriptorVersion();
+}
+
+void Material::SetAtlasRegion(DirectX::XMFLOAT2 scale, DirectX::XMFLOAT2 offset, D3D12_GPU_DESCRIPTOR_HANDLE pageTable)
+{
+    //the page's table replaces any of our own
+    DX12Helper::GetInstance().FreeSrvUavDescriptors(srvDescriptors);
+
+    atlasScale = scale;
+    atlasOffset = offset;
+    finalGPUHandleForSRVs = pageTable;
+    atlased = true;
+    finalized = true;
 }
@@ -11,6 +11,13 @@
 #include "Transform.h"
 #include "DX12Helper.h"
 
+//the slots in a material's texture table (match the pixel shader!)
+enum MaterialTextureSlot {
+	MATERIAL_SLOT_ALBEDO,
+	MATERIAL_SLOT_NORMALS,
+	MATERIAL_SLOT_ORM
+};
+
 enum MaterialType {
 	Normal,
 	Transparent,
@@ -27,6 +34,7 @@ public:
 		MaterialType type = MaterialType::Normal,
 		DirectX::XMFLOAT2 uvScale = DirectX::XMFLOAT2(1, 1),
 		DirectX::XMFLOAT2 uvOffset = DirectX::XMFLOAT2(0, 0));
+	~Material();
 
 	DirectX::XMFLOAT2 GetUVScale();
 	DirectX::XMFLOAT2 GetUVOffset();
@@ -42,6 +50,13 @@ public:
 	//done adding textures
 	void FinalizeMaterial();
 
+	//instead of textures of its own, sample a region of an atlas page's
+	//(see TextureAtlas) through the page's table, which every material on
+	//the page shares and whoever built the page owns.  uvs are remapped
+	//into the region (on top of the uv scale and offset), so they need
+	//to stay within 0-1: the region can't tile
+	void SetAtlasRegion(DirectX::XMFLOAT2 scale, DirectX::XMFLOAT2 offset, D3D12_GPU_DESCRIPTOR_HANDLE pageTable);
+
 	//getters for pipelinestate and gpu handle
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> GetPipelineState();
 	D3D12_GPU_DESCRIPTOR_HANDLE GetFinalGPUHandleForTextures();
@@ -49,6 +64,10 @@ public:
 private:
 	bool finalized = false;
 
+	//which version of the texture srvs the table holds
+	//(streaming rewrites them)
+	unsigned int textureDescriptorVersion = 0;
+
 	// Material properties
 	DirectX::XMFLOAT4 colorTint;
 	MaterialType type;
@@ -56,15 +75,21 @@ private:
 	// Texture-related
 	DirectX::XMFLOAT2 uvOffset;
 	DirectX::XMFLOAT2 uvScale;
+	bool atlased = false;
+	DirectX::XMFLOAT2 atlasScale = DirectX::XMFLOAT2(1, 1);
+	DirectX::XMFLOAT2 atlasOffset = DirectX::XMFLOAT2(0, 0);
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState;
 	
-	const int numTexSlots = 4;
+	const int numTexSlots = 3;
 
-	//array to hold the four tex types we'll need
-	//albedo normal, metalness, roughness in that order
-	D3D12_CPU_DESCRIPTOR_HANDLE textureSRVsBySlot[4];
+	//array to hold the three tex types we'll need
+	//albedo, normals, and occlusion/roughness/metal
+	//packed into one (see MaterialCompiler)
+	D3D12_CPU_DESCRIPTOR_HANDLE textureSRVsBySlot[3];
 
-	//location of first srv in heap
-	D3D12_GPU_DESCRIPTOR_HANDLE finalGPUHandleForSRVs;
+	//range of the heap the srvs were copied to,
+	//and the location of the first one
+	DescriptorHandle srvDescriptors;
+	D3D12_GPU_DESCRIPTOR_HANDLE finalGPUHandleForSRVs = {};
 };
 
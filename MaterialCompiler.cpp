@@ -0,0 +1,156 @@
+#include "MaterialCompiler.h"
+#include "FileStreams.h"
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <wchar.h>
+
+// Paths can be empty, for maps a material doesn't have
+static bool ReadMap(const std::wstring& path, std::vector<unsigned char>& data)
+{
+	data.clear();
+	return !path.empty() && ReadWholeFile(path, data);
+}
+
+MaterialSource MaterialCompiler::GetSourcesForSet(const std::wstring& directory, const std::wstring& set)
+{
+	MaterialSource source;
+	source.Albedo = directory + set + L"_albedo.png";
+	source.Normals = directory + set + L"_normals.png";
+	source.Metal = directory + set + L"_metal.png";
+	source.Roughness = directory + set + L"_roughness.png";
+	source.Occlusion = directory + set + L"_ao.png";
+	return source;
+}
+
+// A map's first channel at a point in [0, 1) texture space (wrapping)
+static float SampleBilinear(const DecodedImage& image, float u, float v)
+{
+	float x = u * image.Width - 0.5f;
+	float y = v * image.Height - 0.5f;
+	float left = floorf(x);
+	float top = floorf(y);
+	float fractionX = x - left;
+	float fractionY = y - top;
+
+	auto texel = [&image](int column, int row)
+	{
+		column = ((column % (int)image.Width) + (int)image.Width) % (int)image.Width;
+		row = ((row % (int)image.Height) + (int)image.Height) % (int)image.Height;
+		return (float)image.Pixels[((size_t)row * image.Width + column) * image.Channels];
+	};
+
+	int column = (int)left;
+	int row = (int)top;
+	float upper = texel(column, row) + (texel(column + 1, row) - texel(column, row)) * fractionX;
+	float lower = texel(column, row + 1) + (texel(column + 1, row + 1) - texel(column, row + 1)) * fractionX;
+	return upper + (lower - upper) * fractionY;
+}
+
+bool MaterialCompiler::PackORM(const DecodedImage* occlusion, const DecodedImage* roughness, const DecodedImage* metal, DecodedImage& orm)
+{
+	const DecodedImage* maps[3] = { occlusion, roughness, metal };
+	const unsigned char defaults[3] = { 255, 255, 0 };
+
+	orm.Width = 0;
+	orm.Height = 0;
+	for (const DecodedImage* map : maps)
+	{
+		if (map && (map->Width == 0 || map->Height == 0 || map->Pixels.size() != (size_t)map->Width * map->Height * map->Channels))
+			return false;
+		if (map)
+		{
+			orm.Width = std::max(orm.Width, map->Width);
+			orm.Height = std::max(orm.Height, map->Height);
+		}
+	}
+	if (orm.Width == 0)
+		return false;
+
+	orm.Channels = 4;
+	orm.Pixels.resize((size_t)orm.Width * orm.Height * 4);
+	for (unsigned int y = 0; y < orm.Height; y++)
+	{
+		for (unsigned int x = 0; x < orm.Width; x++)
+		{
+			unsigned char* pixel = &orm.Pixels[((size_t)y * orm.Width + x) * 4];
+			for (int c = 0; c < 3; c++)
+			{
+				const DecodedImage* map = maps[c];
+				if (!map)
+					pixel[c] = defaults[c];
+				else if (map->Width == orm.Width && map->Height == orm.Height)
+					pixel[c] = map->Pixels[((size_t)y * orm.Width + x) * map->Channels];
+				else
+				{
+					float value = SampleBilinear(*map, (x + 0.5f) / orm.Width, (y + 0.5f) / orm.Height);
+					pixel[c] = (unsigned char)std::min(std::max(value + 0.5f, 0.0f), 255.0f);
+				}
+			}
+			pixel[3] = 255;
+		}
+	}
+	return true;
+}
+
+
+// --------------------------------------------------------
+// The cache name comes from the maps' bytes (not their
+// paths or dates), so identical maps share a packed
+// texture and any edit makes a new one
+// --------------------------------------------------------
+CompiledMaterial MaterialCompiler::Compile(const MaterialSource& source, const std::wstring& cacheDirectory)
+{
+	CompiledMaterial compiled = {};
+	compiled.Albedo = source.Albedo;
+	compiled.Normals = source.Normals;
+
+	const std::wstring* paths[3] = { &source.Occlusion, &source.Roughness, &source.Metal };
+	std::vector<unsigned char> files[3];
+	bool found[3];
+	PipelineKeyHasher hasher;
+	hasher.AddValue((uint32_t)MATERIAL_COMPILER_VERSION);
+	for (int i = 0; i < 3; i++)
+	{
+		found[i] = ReadMap(*paths[i], files[i]);
+		hasher.AddValue((uint64_t)(found[i] ? files[i].size() : ~0ull));
+		if (found[i])
+			hasher.Add(files[i].data(), files[i].size());
+	}
+	if (!found[0] && !found[1] && !found[2])
+		return compiled;
+
+	wchar_t name[32];
+	swprintf(name, 32, L"%016llx_orm.png", (unsigned long long)hasher.GetHash());
+	compiled.ORM = cacheDirectory + name;
+
+	std::vector<unsigned char> existing;
+	if (ReadWholeFile(compiled.ORM, existing) && PNGDecoder::IsPNG(existing.data(), existing.size()))
+	{
+		compiled.CacheHit = true;
+		compiled.Valid = true;
+		return compiled;
+	}
+
+	// Maps that can't be decoded count as missing
+	DecodedImage images[3];
+	const DecodedImage* maps[3] = {};
+	for (int i = 0; i < 3; i++)
+	{
+		if (found[i] && PNGDecoder::Decode(files[i].data(), files[i].size(), images[i]))
+			maps[i] = &images[i];
+		else if (found[i])
+			printf("ERROR: Couldn't decode material map %ls\n", paths[i]->c_str());
+	}
+
+	DecodedImage orm;
+	if (!PackORM(maps[0], maps[1], maps[2], orm))
+		return compiled;
+
+	std::vector<unsigned char> png;
+	PNGDecoder::Encode(orm, png);
+	compiled.Valid = WriteWholeFile(compiled.ORM, png.data(), png.size());
+	return compiled;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PNGDecoder.h"
+
+// Bump when packed textures would change, so cached ones are rebuilt
+#define MATERIAL_COMPILER_VERSION 1
+
+// One material's maps as authored (a path can be empty, or a file
+// that doesn't exist, for a map the material doesn't have)
+struct MaterialSource
+{
+	std::wstring Albedo;
+	std::wstring Normals;
+	std::wstring Metal;
+	std::wstring Roughness;
+	std::wstring Occlusion;
+};
+
+// The files a material binds, one per slot (see MaterialTextureSlot)
+struct CompiledMaterial
+{
+	std::wstring Albedo;
+	std::wstring Normals;	// Only X and Y are read (BC5 keeps just those)
+	std::wstring ORM;		// Occlusion, roughness and metal in R, G and B
+	bool CacheHit;			// The ORM texture was already in the cache
+	bool Valid;				// False if the ORM texture couldn't be written
+};
+
+// --------------------------------------------------------
+// Turns authored material maps into the textures materials
+// bind: albedo and normals as they are, and occlusion,
+// roughness and metal packed into the channels of one
+// texture, so the pixel shader samples three textures
+// rather than four (and materials hold three SRVs).
+//
+// Packed textures are written to the texture cache as
+// PNGs, named by the contents of the maps they came from,
+// so they're only packed again when a map changes.  From
+// there they load (and get mips and block compression)
+// like any other texture.
+// --------------------------------------------------------
+class MaterialCompiler
+{
+public:
+	// The <set>_albedo, _normals, _metal, _roughness and _ao files in a directory
+	static MaterialSource GetSourcesForSet(const std::wstring& directory, const std::wstring& set);
+
+	// Packs the ORM texture into the cache directory, unless it's already there
+	static CompiledMaterial Compile(const MaterialSource& source, const std::wstring& cacheDirectory);
+
+	// Maps that are missing (null) get their default: no occlusion, fully
+	// rough, not metal.  Each map's first channel is used, and smaller maps
+	// are scaled up (bilinear, wrapping) to the size of the largest.
+	static bool PackORM(const DecodedImage* occlusion, const DecodedImage* roughness, const DecodedImage* metal, DecodedImage& orm);
+};
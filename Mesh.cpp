@@ -198,9 +198,13 @@ Mesh::Mesh(const std::wstring& objFile, Microsoft::WRL::ComPtr<ID3D12Device> dev
 
 
 // --------------------------------------------------------
-// Destructor doesn't have much to do since we're using ComPtrs
+// Destructor doesn't have much to do since we're using ComPtrs,
+// other than giving back the raytracing SRV descriptors
 // --------------------------------------------------------
-Mesh::~Mesh() { }
+Mesh::~Mesh()
+{
+	DX12Helper::GetInstance().FreeSrvUavDescriptors(raytracingData.GeometrySRVs);
+}
 
 
 // --------------------------------------------------------
@@ -277,6 +281,11 @@ void Mesh::CreateBuffers(Vertex* vertArray, size_t numVerts, unsigned int* index
 	ibView.SizeInBytes = sizeof(unsigned int) * (UINT)numIndices;
 	ibView.BufferLocation = ib->GetGPUVirtualAddress();
 
+	// Per triangle data for picking texture mips in the hit shaders
+	std::vector<RayConeTriangle> triangles;
+	RayConeLOD::ComputeTriangles(vertArray, indexArray, numIndices, triangles);
+	rayConeTriangles = DX12Helper::GetInstance().CreateStaticBuffer(sizeof(RayConeTriangle), (UINT)triangles.size(), triangles.data());
+
 	// Save the indices
 	this->numIndices = (unsigned int)numIndices;
 	this->numVerts = (unsigned int)numVerts;
@@ -6,15 +6,17 @@
 #include <string>
 
 #include "Vertex.h"
+#include "RayCone.h"
+#include "DescriptorAllocator.h"
 
 #pragma comment(lib, "d3d12.lib")
 //#pragma comment(lib, "dxgi.lib")
 
 struct MeshRaytracingData {
+	DescriptorHandle GeometrySRVs;	// Index, vertex and ray cone triangle buffer SRVs, freed with the mesh
 	D3D12_GPU_DESCRIPTOR_HANDLE IndexBufferSRV{};
 	D3D12_GPU_DESCRIPTOR_HANDLE VertexBufferSRV{};
-	Microsoft::WRL::ComPtr<ID3D12Resource> BLAS;
-	unsigned int HitGroupIndex = 0;
+	unsigned int HitGroupIndex = 0;	// Also the BLAS index (the raytracing helper owns the BLAS, as compacting replaces it)
 };
 
 class Mesh
@@ -39,12 +41,15 @@ public:
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> GetVBResource() { return vb; }
 	Microsoft::WRL::ComPtr<ID3D12Resource> GetIBResource() { return ib; }
+	// Texel density and curvature per triangle, for ray cone texture LOD
+	Microsoft::WRL::ComPtr<ID3D12Resource> GetRayConeTriangleResource() { return rayConeTriangles; }
 
 	MeshRaytracingData GetRaytracingData() { return raytracingData; }
 private:
 	// D3D buffers
 	Microsoft::WRL::ComPtr<ID3D12Resource> vb;
 	Microsoft::WRL::ComPtr<ID3D12Resource> ib;
+	Microsoft::WRL::ComPtr<ID3D12Resource> rayConeTriangles;
 	
 	D3D12_VERTEX_BUFFER_VIEW vbView;
 	D3D12_INDEX_BUFFER_VIEW ibView;
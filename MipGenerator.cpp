@@ -0,0 +1,665 @@
+#include "MipGenerator.h"
+#include "FileStreams.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <wctype.h>
+
+#include <emmintrin.h>
+
+#define MIP_CACHE_MAGIC 0x4350494D		// "MIPC"
+#define MIP_CACHE_FILE_VERSION 1
+
+// Kaiser window shape (as in NVTT)
+#define MIP_KAISER_ALPHA 4.0
+
+static const double pi = 3.14159265358979323846;
+
+static double Sinc(double x)
+{
+	if (fabs(x) < 1e-9)
+		return 1.0;
+	return sin(pi * x) / (pi * x);
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double BesselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	double quarterSquare = x * x / 4.0;
+	for (int k = 1; k < 64 && term > sum * 1e-12; k++)
+	{
+		term *= quarterSquare / ((double)k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+// How far the filter reaches, in destination texels
+static double GetFilterRadius(MipFilter filter)
+{
+	return filter == MIP_FILTER_BOX ? 0.5 : 3.0;
+}
+
+static double EvaluateFilter(MipFilter filter, double x)
+{
+	x = fabs(x);
+	switch (filter)
+	{
+	case MIP_FILTER_BOX:
+		// Split texels that sit right on the edge (odd sizes)
+		return x < 0.5 ? 1.0 : (x == 0.5 ? 0.5 : 0.0);
+
+	case MIP_FILTER_KAISER:
+	{
+		if (x >= 3.0)
+			return 0.0;
+		double t = x / 3.0;
+		return Sinc(x) * BesselI0(MIP_KAISER_ALPHA * sqrt(1.0 - t * t)) / BesselI0(MIP_KAISER_ALPHA);
+	}
+
+	case MIP_FILTER_LANCZOS:
+		return x >= 3.0 ? 0.0 : Sinc(x) * Sinc(x / 3.0);
+	}
+	return 0.0;
+}
+
+// The source texels, and their weights, that make up each
+// destination texel along one axis
+struct MipTaps
+{
+	unsigned int Count;					// Per destination texel
+	std::vector<unsigned int> Indices;	// Destination texel * Count + tap
+	std::vector<double> Weights;		// Normalized to add up to 1
+};
+
+
+// --------------------------------------------------------
+// Centers the filter on each destination texel, scaled to
+// cover the source texels it replaces.  Taps past the edge
+// wrap or clamp.  Taps that are zero for every destination
+// texel (the filter's end points) are dropped.
+// --------------------------------------------------------
+static void BuildTaps(unsigned int sourceSize, unsigned int destinationSize, const MipSettings& settings, MipTaps& taps)
+{
+	double scale = (double)sourceSize / destinationSize;
+	double radius = GetFilterRadius(settings.Filter) * scale;
+	unsigned int count = (unsigned int)floor(radius * 2.0) + 2;
+
+	std::vector<unsigned int> indices((size_t)destinationSize * count);
+	std::vector<double> weights((size_t)destinationSize * count);
+	unsigned int leadingZeros = count;
+	unsigned int trailingZeros = count;
+	for (unsigned int d = 0; d < destinationSize; d++)
+	{
+		double center = (d + 0.5) * scale;
+		int first = (int)ceil(center - radius - 0.5);
+		double total = 0.0;
+		unsigned int firstUsed = count;
+		unsigned int lastUsed = 0;
+		for (unsigned int k = 0; k < count; k++)
+		{
+			int j = first + (int)k;
+			double weight = EvaluateFilter(settings.Filter, (j + 0.5 - center) / scale);
+			int size = (int)sourceSize;
+			int index = settings.Wrap ? ((j % size) + size) % size : std::min(std::max(j, 0), size - 1);
+			indices[(size_t)d * count + k] = (unsigned int)index;
+			weights[(size_t)d * count + k] = weight;
+			total += weight;
+			if (weight != 0.0)
+			{
+				firstUsed = std::min(firstUsed, k);
+				lastUsed = k;
+			}
+		}
+		for (unsigned int k = 0; k < count; k++)
+			weights[(size_t)d * count + k] /= total;
+
+		leadingZeros = std::min(leadingZeros, firstUsed);
+		trailingZeros = std::min(trailingZeros, count - 1 - lastUsed);
+	}
+
+	taps.Count = count - leadingZeros - trailingZeros;
+	taps.Indices.resize((size_t)destinationSize * taps.Count);
+	taps.Weights.resize((size_t)destinationSize * taps.Count);
+	for (unsigned int d = 0; d < destinationSize; d++)
+	{
+		for (unsigned int k = 0; k < taps.Count; k++)
+		{
+			taps.Indices[(size_t)d * taps.Count + k] = indices[(size_t)d * count + leadingZeros + k];
+			taps.Weights[(size_t)d * taps.Count + k] = weights[(size_t)d * count + leadingZeros + k];
+		}
+	}
+}
+
+static double SRGBToLinear(double value)
+{
+	return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+}
+
+static double LinearToSRGB(double value)
+{
+	return value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1.0 / 2.4) - 0.055;
+}
+
+// Which channels hold color (or normal) rather than alpha or data
+static unsigned int GetColorChannels(unsigned int channels, const MipSettings& settings)
+{
+	if (settings.Content == MIP_CONTENT_NORMAL)
+		return channels == 4 ? 3 : 0;
+	if (settings.Content == MIP_CONTENT_SRGB)
+		return channels == 4 ? 3 : channels;
+	return 0;
+}
+
+// sRGB bytes to linear, and the linear values halfway between
+// neighbouring bytes (so encoding is a search, not a pow)
+struct SRGBTables
+{
+	float ToLinear[256];
+	float Thresholds[256];
+
+	SRGBTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			ToLinear[i] = (float)SRGBToLinear(i / 255.0);
+			Thresholds[i] = i < 255 ? (float)SRGBToLinear((i + 0.5) / 255.0) : 2.0f;
+		}
+	}
+};
+
+static const SRGBTables& GetSRGBTables()
+{
+	static const SRGBTables tables;
+	return tables;
+}
+
+static unsigned char EncodeLinear(float value)
+{
+	return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// Rounds to the nearest sRGB byte (no pow needed)
+static unsigned char EncodeSRGB(float value, const SRGBTables& tables)
+{
+	unsigned int byte = 0;
+	for (unsigned int step = 128; step > 0; step >>= 1)
+	{
+		if (tables.Thresholds[byte + step - 1] <= value)
+			byte += step;
+	}
+	return (unsigned char)byte;
+}
+
+
+// --------------------------------------------------------
+// Level 0's bytes as linear floats (normals in [-1, 1]
+// and normalized)
+// --------------------------------------------------------
+static void DecodeTexels(const DecodedImage& image, const MipSettings& settings, std::vector<float>& texels)
+{
+	const SRGBTables& tables = GetSRGBTables();
+	unsigned int channels = image.Channels;
+	unsigned int colorChannels = GetColorChannels(channels, settings);
+	size_t count = (size_t)image.Width * image.Height;
+	texels.resize(count * channels);
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* pixel = &image.Pixels[i * channels];
+		float* texel = &texels[i * channels];
+		for (unsigned int c = 0; c < channels; c++)
+		{
+			if (c >= colorChannels)
+				texel[c] = pixel[c] / 255.0f;
+			else if (settings.Content == MIP_CONTENT_SRGB)
+				texel[c] = tables.ToLinear[pixel[c]];
+			else
+				texel[c] = pixel[c] / 127.5f - 1.0f;
+		}
+
+		if (settings.Content == MIP_CONTENT_NORMAL && colorChannels == 3)
+		{
+			float length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+			float scale = length > 1e-6f ? 1.0f / length : 0.0f;
+			texel[0] *= scale;
+			texel[1] *= scale;
+			texel[2] = length > 1e-6f ? texel[2] * scale : 1.0f;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Keeps a filtered row in range (sharp filters overshoot),
+// renormalizes normals, and encodes it to bytes.  The row
+// is updated too, since the next level is made from it.
+// --------------------------------------------------------
+static void FinishRow(float* texels, unsigned int width, unsigned int channels, const MipSettings& settings, unsigned char* pixels)
+{
+	const SRGBTables& tables = GetSRGBTables();
+	unsigned int colorChannels = GetColorChannels(channels, settings);
+	for (unsigned int x = 0; x < width; x++)
+	{
+		float* texel = texels + (size_t)x * channels;
+		unsigned char* pixel = pixels + (size_t)x * channels;
+		if (settings.Content == MIP_CONTENT_NORMAL && colorChannels == 3)
+		{
+			float length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+			float scale = length > 1e-6f ? 1.0f / length : 0.0f;
+			texel[0] *= scale;
+			texel[1] *= scale;
+			texel[2] = length > 1e-6f ? texel[2] * scale : 1.0f;
+			for (unsigned int c = 0; c < 3; c++)
+				pixel[c] = EncodeLinear(texel[c] * 0.5f + 0.5f);
+			texel[3] = std::min(std::max(texel[3], 0.0f), 1.0f);
+			pixel[3] = EncodeLinear(texel[3]);
+			continue;
+		}
+
+		for (unsigned int c = 0; c < channels; c++)
+		{
+			texel[c] = std::min(std::max(texel[c], 0.0f), 1.0f);
+			pixel[c] = c < colorChannels ? EncodeSRGB(texel[c], tables) : EncodeLinear(texel[c]);
+		}
+	}
+}
+
+// Taps in float, for the fast path
+struct MipAxis
+{
+	unsigned int Count;
+	std::vector<unsigned int> Indices;
+	std::vector<float> Weights;
+};
+
+static void BuildAxis(unsigned int sourceSize, unsigned int destinationSize, const MipSettings& settings, MipAxis& axis)
+{
+	MipTaps taps;
+	BuildTaps(sourceSize, destinationSize, settings, taps);
+	axis.Count = taps.Count;
+	axis.Indices = taps.Indices;
+	axis.Weights.assign(taps.Weights.begin(), taps.Weights.end());
+}
+
+// One destination row's worth of source rows, blended a
+// whole row at a time (so it doesn't care about channels)
+static void FilterVertical(const float* source, size_t rowFloats, const MipAxis& axis, unsigned int y, float* output)
+{
+	const unsigned int* indices = &axis.Indices[(size_t)y * axis.Count];
+	const float* weights = &axis.Weights[(size_t)y * axis.Count];
+
+	size_t x = 0;
+	for (; x + 4 <= rowFloats; x += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (unsigned int k = 0; k < axis.Count; k++)
+		{
+			__m128 row = _mm_loadu_ps(source + indices[k] * rowFloats + x);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), row));
+		}
+		_mm_storeu_ps(output + x, sum);
+	}
+	for (; x < rowFloats; x++)
+	{
+		float sum = 0.0f;
+		for (unsigned int k = 0; k < axis.Count; k++)
+			sum += weights[k] * source[indices[k] * rowFloats + x];
+		output[x] = sum;
+	}
+}
+
+// RGBA: a whole texel per register
+static void FilterHorizontal4(const float* row, const MipAxis& axis, unsigned int width, float* output)
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		const unsigned int* indices = &axis.Indices[(size_t)x * axis.Count];
+		const float* weights = &axis.Weights[(size_t)x * axis.Count];
+		__m128 sum = _mm_setzero_ps();
+		for (unsigned int k = 0; k < axis.Count; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + indices[k] * 4)));
+		_mm_storeu_ps(output + (size_t)x * 4, sum);
+	}
+}
+
+// One channel: four destination texels per register
+static void FilterHorizontal1(const float* row, const MipAxis& axis, unsigned int width, float* output)
+{
+	unsigned int count = axis.Count;
+	const unsigned int* indices = axis.Indices.data();
+	const float* weights = axis.Weights.data();
+
+	unsigned int x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		size_t t = (size_t)x * count;
+		__m128 sum = _mm_setzero_ps();
+		for (unsigned int k = 0; k < count; k++, t++)
+		{
+			__m128 w = _mm_setr_ps(weights[t], weights[t + count], weights[t + count * 2], weights[t + count * 3]);
+			__m128 v = _mm_setr_ps(row[indices[t]], row[indices[t + count]], row[indices[t + count * 2]], row[indices[t + count * 3]]);
+			sum = _mm_add_ps(sum, _mm_mul_ps(w, v));
+		}
+		_mm_storeu_ps(output + x, sum);
+	}
+	for (; x < width; x++)
+	{
+		float sum = 0.0f;
+		for (unsigned int k = 0; k < count; k++)
+			sum += weights[(size_t)x * count + k] * row[indices[(size_t)x * count + k]];
+		output[x] = sum;
+	}
+}
+
+unsigned int MipGenerator::GetMipCount(unsigned int width, unsigned int height)
+{
+	unsigned int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		levels++;
+	}
+	return levels;
+}
+
+
+// --------------------------------------------------------
+// Each level is made from the last one's floats, a row at
+// a time: the source rows under it are blended vertically
+// into a scratch row, which is filtered horizontally.
+// Rows are independent, so they're split across the pool.
+// --------------------------------------------------------
+void MipGenerator::Generate(const DecodedImage& image, const MipSettings& settings, std::vector<DecodedImage>& mips)
+{
+	unsigned int channels = image.Channels;
+	unsigned int width = image.Width;
+	unsigned int height = image.Height;
+	unsigned int levels = GetMipCount(width, height);
+
+	mips.assign(1, image);
+	mips.reserve(levels);
+	std::vector<float> source;
+	std::vector<float> destination;
+	DecodeTexels(image, settings, source);
+
+	for (unsigned int level = 1; level < levels; level++)
+	{
+		unsigned int mipWidth = std::max(1u, width / 2);
+		unsigned int mipHeight = std::max(1u, height / 2);
+		MipAxis horizontal;
+		MipAxis vertical;
+		BuildAxis(width, mipWidth, settings, horizontal);
+		BuildAxis(height, mipHeight, settings, vertical);
+
+		DecodedImage mip;
+		mip.Width = mipWidth;
+		mip.Height = mipHeight;
+		mip.Channels = channels;
+		mip.Pixels.resize((size_t)mipWidth * mipHeight * channels);
+		destination.resize(mip.Pixels.size());
+
+		size_t sourceRowFloats = (size_t)width * channels;
+		JobSystem::GetInstance().ParallelFor(mipHeight, [&](unsigned int rowStart, unsigned int rowEnd)
+		{
+			std::vector<float> blended(sourceRowFloats);
+			for (unsigned int y = rowStart; y < rowEnd; y++)
+			{
+				FilterVertical(source.data(), sourceRowFloats, vertical, y, blended.data());
+
+				float* row = destination.data() + (size_t)y * mipWidth * channels;
+				if (channels == 4)
+					FilterHorizontal4(blended.data(), horizontal, mipWidth, row);
+				else
+					FilterHorizontal1(blended.data(), horizontal, mipWidth, row);
+
+				FinishRow(row, mipWidth, channels, settings, mip.Pixels.data() + (size_t)y * mipWidth * channels);
+			}
+		});
+
+		mips.push_back(std::move(mip));
+		source.swap(destination);
+		width = mipWidth;
+		height = mipHeight;
+	}
+}
+
+
+// --------------------------------------------------------
+// Deliberately simple: every destination texel sums every
+// (source texel, tap) pair in 2D, in double, and encodes
+// with pow.  Matches Generate() to within rounding.
+// --------------------------------------------------------
+void MipGenerator::GenerateReference(const DecodedImage& image, const MipSettings& settings, std::vector<DecodedImage>& mips)
+{
+	unsigned int channels = image.Channels;
+	unsigned int colorChannels = GetColorChannels(channels, settings);
+	bool normals = settings.Content == MIP_CONTENT_NORMAL && colorChannels == 3;
+	unsigned int width = image.Width;
+	unsigned int height = image.Height;
+	unsigned int levels = GetMipCount(width, height);
+
+	auto normalize = [](double* texel)
+	{
+		double length = sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+		if (length > 1e-6)
+		{
+			texel[0] /= length;
+			texel[1] /= length;
+			texel[2] /= length;
+		}
+		else
+		{
+			texel[0] = texel[1] = 0.0;
+			texel[2] = 1.0;
+		}
+	};
+
+	mips.assign(1, image);
+	std::vector<double> source(image.Pixels.size());
+	for (size_t i = 0; i < source.size(); i += channels)
+	{
+		for (unsigned int c = 0; c < channels; c++)
+		{
+			double value = image.Pixels[i + c] / 255.0;
+			if (c < colorChannels)
+				value = settings.Content == MIP_CONTENT_SRGB ? SRGBToLinear(value) : value * 2.0 - 1.0;
+			source[i + c] = value;
+		}
+		if (normals)
+			normalize(&source[i]);
+	}
+
+	for (unsigned int level = 1; level < levels; level++)
+	{
+		unsigned int mipWidth = std::max(1u, width / 2);
+		unsigned int mipHeight = std::max(1u, height / 2);
+		MipTaps horizontal;
+		MipTaps vertical;
+		BuildTaps(width, mipWidth, settings, horizontal);
+		BuildTaps(height, mipHeight, settings, vertical);
+
+		DecodedImage mip;
+		mip.Width = mipWidth;
+		mip.Height = mipHeight;
+		mip.Channels = channels;
+		mip.Pixels.resize((size_t)mipWidth * mipHeight * channels);
+		std::vector<double> destination(mip.Pixels.size());
+
+		for (unsigned int y = 0; y < mipHeight; y++)
+		{
+			for (unsigned int x = 0; x < mipWidth; x++)
+			{
+				double* texel = &destination[((size_t)y * mipWidth + x) * channels];
+				for (unsigned int ky = 0; ky < vertical.Count; ky++)
+				{
+					for (unsigned int kx = 0; kx < horizontal.Count; kx++)
+					{
+						size_t v = (size_t)y * vertical.Count + ky;
+						size_t h = (size_t)x * horizontal.Count + kx;
+						double weight = vertical.Weights[v] * horizontal.Weights[h];
+						const double* sourceTexel = &source[((size_t)vertical.Indices[v] * width + horizontal.Indices[h]) * channels];
+						for (unsigned int c = 0; c < channels; c++)
+							texel[c] += weight * sourceTexel[c];
+					}
+				}
+
+				unsigned char* pixel = &mip.Pixels[((size_t)y * mipWidth + x) * channels];
+				if (normals)
+					normalize(texel);
+				for (unsigned int c = 0; c < channels; c++)
+				{
+					if (!normals || c == 3)
+						texel[c] = std::min(std::max(texel[c], 0.0), 1.0);
+
+					double encoded = texel[c];
+					if (normals && c < 3)
+						encoded = encoded * 0.5 + 0.5;
+					else if (c < colorChannels)
+						encoded = LinearToSRGB(encoded);
+					pixel[c] = (unsigned char)floor(std::min(std::max(encoded, 0.0), 1.0) * 255.0 + 0.5);
+				}
+			}
+		}
+
+		mips.push_back(std::move(mip));
+		source.swap(destination);
+		width = mipWidth;
+		height = mipHeight;
+	}
+}
+
+MipSettings MipGenerator::GetSettingsForPath(const std::wstring& path)
+{
+	std::wstring name = path;
+	for (wchar_t& c : name)
+		c = (wchar_t)towlower(c);
+
+	MipSettings settings;
+	if (name.find(L"normal") != std::wstring::npos)
+		settings.Content = MIP_CONTENT_NORMAL;
+	else if (name.find(L"albedo") != std::wstring::npos || name.find(L"color") != std::wstring::npos || name.find(L"diffuse") != std::wstring::npos)
+		settings.Content = MIP_CONTENT_SRGB;
+	return settings;
+}
+
+uint64_t MipGenerator::GetCacheKey(uint64_t contentHash, const MipSettings& settings)
+{
+	PipelineKeyHasher hasher;
+	hasher.AddValue(contentHash);
+	hasher.AddValue((uint32_t)settings.Filter);
+	hasher.AddValue((uint32_t)settings.Content);
+	hasher.AddValue((uint32_t)settings.Wrap);
+	hasher.AddValue((uint32_t)MIP_GENERATOR_VERSION);
+	return hasher.GetHash();
+}
+
+template<typename T> static void AppendValue(std::vector<unsigned char>& data, const T& value)
+{
+	const unsigned char* bytes = (const unsigned char*)&value;
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T> static bool ReadValue(const unsigned char* data, size_t size, size_t& offset, T& value)
+{
+	if (size - offset < sizeof(T))
+		return false;
+	memcpy(&value, data + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+static uint64_t ChecksumMips(const std::vector<DecodedImage>& mips)
+{
+	PipelineKeyHasher hasher;
+	for (const DecodedImage& mip : mips)
+		hasher.Add(mip.Pixels.data(), mip.Pixels.size());
+	return hasher.GetHash();
+}
+
+void MipGenerator::Serialize(const std::vector<DecodedImage>& mips, uint64_t key, std::vector<unsigned char>& data)
+{
+	data.clear();
+	AppendValue(data, (uint32_t)MIP_CACHE_MAGIC);
+	AppendValue(data, (uint32_t)MIP_CACHE_FILE_VERSION);
+	AppendValue(data, key);
+	AppendValue(data, (uint32_t)(mips.empty() ? 0 : mips[0].Width));
+	AppendValue(data, (uint32_t)(mips.empty() ? 0 : mips[0].Height));
+	AppendValue(data, (uint32_t)(mips.empty() ? 0 : mips[0].Channels));
+	AppendValue(data, (uint32_t)mips.size());
+	AppendValue(data, ChecksumMips(mips));
+	for (const DecodedImage& mip : mips)
+		data.insert(data.end(), mip.Pixels.begin(), mip.Pixels.end());
+}
+
+
+// --------------------------------------------------------
+// Only accepts a whole chain, for this key, whose sizes are
+// what the header says and whose pixels pass the checksum
+// --------------------------------------------------------
+bool MipGenerator::Deserialize(const unsigned char* data, size_t size, uint64_t key, std::vector<DecodedImage>& mips)
+{
+	mips.clear();
+
+	size_t offset = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t fileKey = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t channels = 0;
+	uint32_t levels = 0;
+	uint64_t checksum = 0;
+	if (!ReadValue(data, size, offset, magic) || magic != MIP_CACHE_MAGIC ||
+		!ReadValue(data, size, offset, version) || version != MIP_CACHE_FILE_VERSION ||
+		!ReadValue(data, size, offset, fileKey) || fileKey != key ||
+		!ReadValue(data, size, offset, width) ||
+		!ReadValue(data, size, offset, height) ||
+		!ReadValue(data, size, offset, channels) ||
+		!ReadValue(data, size, offset, levels) ||
+		!ReadValue(data, size, offset, checksum))
+		return false;
+
+	if (width == 0 || height == 0 || width > 65536 || height > 65536 ||
+		(channels != 1 && channels != 4) || levels != GetMipCount(width, height))
+		return false;
+
+	std::vector<DecodedImage> loaded(levels);
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		DecodedImage& mip = loaded[level];
+		mip.Width = width;
+		mip.Height = height;
+		mip.Channels = channels;
+		size_t bytes = (size_t)width * height * channels;
+		if (size - offset < bytes)
+			return false;
+		mip.Pixels.assign(data + offset, data + offset + bytes);
+		offset += bytes;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	if (offset != size || ChecksumMips(loaded) != checksum)
+		return false;
+
+	mips.swap(loaded);
+	return true;
+}
+
+bool MipGenerator::Load(const std::wstring& path, uint64_t key, std::vector<DecodedImage>& mips)
+{
+	std::vector<unsigned char> data;
+	return ReadWholeFile(path, data) && Deserialize(data.data(), data.size(), key, mips);
+}
+
+bool MipGenerator::Save(const std::wstring& path, const std::vector<DecodedImage>& mips, uint64_t key)
+{
+	std::vector<unsigned char> data;
+	Serialize(mips, key, data);
+	return WriteWholeFile(path, data.data(), data.size());
+}
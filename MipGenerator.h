@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PNGDecoder.h"
+
+// Bump when generated mips would change, so cached chains are rebuilt
+#define MIP_GENERATOR_VERSION 1
+
+enum MipFilter
+{
+	MIP_FILTER_BOX,			// 2x2 average (for power of two sizes)
+	MIP_FILTER_KAISER,		// Windowed sinc, 3 texels each side
+	MIP_FILTER_LANCZOS		// Lanczos-3
+};
+
+enum MipContent
+{
+	MIP_CONTENT_LINEAR,		// Data (roughness, metalness, etc.)
+	MIP_CONTENT_SRGB,		// Color stored as sRGB, filtered in linear (alpha is linear)
+	MIP_CONTENT_NORMAL		// Tangent space normals, renormalized per level
+};
+
+struct MipSettings
+{
+	MipFilter	Filter = MIP_FILTER_KAISER;
+	MipContent	Content = MIP_CONTENT_LINEAR;
+	bool		Wrap = true;		// Filter across edges as if tiled (false = clamp)
+};
+
+// --------------------------------------------------------
+// Builds full mip chains on the CPU, so textures can be
+// uploaded with every mip rather than generating them on
+// the GPU at load time.
+//
+// Each level is filtered from the one above it (kept in
+// float, so error doesn't build up through 8-bit levels),
+// vertically then horizontally, one output row at a time.
+// Rows are split across the JobSystem and the filter taps
+// are applied with SSE, four floats at a time.
+//
+// Chains serialize to a small binary format, so they can be
+// cached on disk and skipped entirely on later launches.
+// --------------------------------------------------------
+class MipGenerator
+{
+public:
+	// Level 0 is a copy of the image, down to 1x1 (each level half
+	// the size of the last, rounded down, like D3D's mips)
+	static void Generate(const DecodedImage& image, const MipSettings& settings, std::vector<DecodedImage>& mips);
+
+	// The same chain, a texel at a time with direct 2D filtering in double
+	// precision on one thread (what Generate() is checked against)
+	static void GenerateReference(const DecodedImage& image, const MipSettings& settings, std::vector<DecodedImage>& mips);
+
+	// Levels in a chain for this size
+	static unsigned int GetMipCount(unsigned int width, unsigned int height);
+
+	// Albedo is sRGB, normals are normals, anything else is data
+	static MipSettings GetSettingsForPath(const std::wstring& path);
+
+	// Identifies a chain built from these file contents with these settings
+	static uint64_t GetCacheKey(uint64_t contentHash, const MipSettings& settings);
+
+	// Cached chain format (little endian):
+	//   Magic, version (uint32 each), key (uint64), width, height,
+	//   channels, level count (uint32 each), pixel checksum (uint64),
+	//   then every level's pixels in order
+	static void Serialize(const std::vector<DecodedImage>& mips, uint64_t key, std::vector<unsigned char>& data);
+	static bool Deserialize(const unsigned char* data, size_t size, uint64_t key, std::vector<DecodedImage>& mips);
+	static bool Load(const std::wstring& path, uint64_t key, std::vector<DecodedImage>& mips);
+	static bool Save(const std::wstring& path, const std::vector<DecodedImage>& mips, uint64_t key);
+};
@@ -0,0 +1,197 @@
+#include "MipResidency.h"
+
+#include <algorithm>
+#include <queue>
+
+MipResidency::MipResidency() :
+	budget(UINT64_MAX),
+	uploadLimit(UINT64_MAX),
+	residentBytes(0),
+	tailBytes(0),
+	loadedBytes(0),
+	evictedBytes(0),
+	loads(0),
+	evictions(0)
+{
+}
+
+unsigned int MipResidency::GetTailLevel(const std::vector<uint64_t>& levelBytes, uint64_t tailBytes)
+{
+	unsigned int level = levelBytes.empty() ? 0 : (unsigned int)levelBytes.size() - 1;
+	while (level > 0 && levelBytes[level - 1] <= tailBytes)
+		level--;
+	return level;
+}
+
+unsigned int MipResidency::AddTexture(const std::vector<uint64_t>& levelBytes, unsigned int tailLevel)
+{
+	Texture texture = {};
+	texture.LevelBytes = levelBytes;
+	texture.Tail = std::min(tailLevel, levelBytes.empty() ? 0u : (unsigned int)levelBytes.size() - 1);
+	texture.Wanted = 0;
+	texture.Priority = 1.0f;
+	texture.Target = texture.Tail;
+	texture.Resident = texture.Tail;
+
+	uint64_t bytes = GetBytesFrom(texture, texture.Tail);
+	residentBytes += bytes;
+	tailBytes += bytes;
+	textures.push_back(texture);
+	return (unsigned int)textures.size() - 1;
+}
+
+void MipResidency::SetWantedLevel(unsigned int texture, unsigned int level, float priority)
+{
+	textures[texture].Wanted = level;
+	textures[texture].Priority = priority;
+}
+
+// Bytes of this level and every smaller one
+uint64_t MipResidency::GetBytesFrom(const Texture& texture, unsigned int level) const
+{
+	uint64_t bytes = 0;
+	for (size_t i = level; i < texture.LevelBytes.size(); i++)
+		bytes += texture.LevelBytes[i];
+	return bytes;
+}
+
+
+// --------------------------------------------------------
+// Hands the budget out a level at a time, always to the
+// texture that's the most levels short of what it wants.
+// A texture whose next level doesn't fit stops there, but
+// smaller levels of others may still fit after it.
+// --------------------------------------------------------
+void MipResidency::ChooseTargets()
+{
+	// Furthest behind first, then the higher priority, then the first added
+	auto behind = [this](unsigned int a, unsigned int b)
+	{
+		const Texture& first = textures[a];
+		const Texture& second = textures[b];
+		unsigned int firstShort = first.Target - std::min(first.Wanted, first.Tail);
+		unsigned int secondShort = second.Target - std::min(second.Wanted, second.Tail);
+		if (firstShort != secondShort)
+			return firstShort < secondShort;
+		if (first.Priority != second.Priority)
+			return first.Priority < second.Priority;
+		return a > b;
+	};
+	std::priority_queue<unsigned int, std::vector<unsigned int>, decltype(behind)> queue(behind);
+
+	uint64_t used = tailBytes;
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		Texture& texture = textures[i];
+		texture.Target = texture.Tail;
+		if (texture.Target > texture.Wanted)
+			queue.push(i);
+	}
+
+	while (!queue.empty())
+	{
+		unsigned int i = queue.top();
+		queue.pop();
+
+		Texture& texture = textures[i];
+		uint64_t bytes = texture.LevelBytes[texture.Target - 1];
+		if (used + bytes > budget)
+			continue;
+
+		used += bytes;
+		texture.Target--;
+		if (texture.Target > texture.Wanted)
+			queue.push(i);
+	}
+}
+
+
+// --------------------------------------------------------
+// Evictions happen first, so the loads that follow never
+// take residency past the budget.  Loads go round the
+// textures a level each, furthest behind first, so one big
+// texture doesn't hold the rest back.
+// --------------------------------------------------------
+void MipResidency::Update(std::vector<MipResidencyChange>& changes)
+{
+	changes.clear();
+	ChooseTargets();
+
+	std::vector<unsigned int> before(textures.size());
+	std::vector<unsigned int> loading;
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		Texture& texture = textures[i];
+		before[i] = texture.Resident;
+		while (texture.Resident < texture.Target)
+		{
+			uint64_t bytes = texture.LevelBytes[texture.Resident];
+			residentBytes -= bytes;
+			evictedBytes += bytes;
+			evictions++;
+			texture.Resident++;
+		}
+		if (texture.Resident > texture.Target)
+			loading.push_back(i);
+	}
+
+	std::stable_sort(loading.begin(), loading.end(), [this](unsigned int a, unsigned int b)
+	{
+		const Texture& first = textures[a];
+		const Texture& second = textures[b];
+		if (first.Resident - first.Target != second.Resident - second.Target)
+			return first.Resident - first.Target > second.Resident - second.Target;
+		return first.Priority > second.Priority;
+	});
+
+	uint64_t uploaded = 0;
+	bool progress = true;
+	while (progress)
+	{
+		progress = false;
+		for (unsigned int i : loading)
+		{
+			Texture& texture = textures[i];
+			if (texture.Resident == texture.Target)
+				continue;
+
+			uint64_t bytes = texture.LevelBytes[texture.Resident - 1];
+			if (uploaded > 0 && uploaded + bytes > uploadLimit)
+				continue;
+
+			uploaded += bytes;
+			residentBytes += bytes;
+			loadedBytes += bytes;
+			loads++;
+			texture.Resident--;
+			progress = true;
+		}
+	}
+
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		if (textures[i].Resident != before[i])
+			changes.push_back({ i, before[i], textures[i].Resident });
+	}
+}
+
+MipResidencyStats MipResidency::GetStats() const
+{
+	MipResidencyStats stats = {};
+	stats.Textures = (unsigned int)textures.size();
+	for (const Texture& texture : textures)
+	{
+		unsigned int wanted = std::min(texture.Wanted, texture.Tail);
+		if (texture.Resident > wanted)
+			stats.Streaming++;
+		stats.WantedBytes += GetBytesFrom(texture, wanted);
+	}
+	stats.Budget = budget;
+	stats.ResidentBytes = residentBytes;
+	stats.TailBytes = tailBytes;
+	stats.LoadedBytes = loadedBytes;
+	stats.EvictedBytes = evictedBytes;
+	stats.Loads = loads;
+	stats.Evictions = evictions;
+	return stats;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Levels this size or smaller are a texture's tail, which is always resident
+#define MIP_RESIDENCY_DEFAULT_TAIL_BYTES (64 * 1024)
+
+// A texture's most detailed resident level, before and after an update
+struct MipResidencyChange
+{
+	unsigned int Texture;
+	unsigned int FromLevel;
+	unsigned int ToLevel;		// Lower means more detail was streamed in
+};
+
+struct MipResidencyStats
+{
+	unsigned int Textures;
+	unsigned int Streaming;			// Resident level coarser than wanted
+	uint64_t Budget;
+	uint64_t ResidentBytes;
+	uint64_t TailBytes;				// Resident whatever the budget
+	uint64_t WantedBytes;			// If every texture had the level it wants
+	uint64_t LoadedBytes;			// In total
+	uint64_t EvictedBytes;			// In total
+	unsigned int Loads;				// Levels, in total
+	unsigned int Evictions;			// Levels, in total
+};
+
+// --------------------------------------------------------
+// Decides which mip levels of streamed textures should be
+// resident under a memory budget.  It only does the
+// bookkeeping: the caller uploads or drops levels as the
+// changes from each Update() say.
+//
+// Every texture's tail (its small levels) is resident from
+// the start.  Each update then picks a target level for
+// every texture: starting from the tails, the budget goes
+// one level at a time to the texture furthest from the
+// level it wants (the one with the higher priority on a
+// tie), until nothing more fits.  Textures above their
+// target drop levels straight away; textures below it
+// stream in a level at a time, coarsest first, at most
+// the upload limit's worth per update (but always at least
+// one level, however big).
+// --------------------------------------------------------
+class MipResidency
+{
+public:
+	MipResidency();
+
+	void SetBudget(uint64_t bytes) { budget = bytes; }
+	void SetUploadLimit(uint64_t bytesPerUpdate) { uploadLimit = bytesPerUpdate; }
+
+	// The most detailed level that's still in the tail
+	static unsigned int GetTailLevel(const std::vector<uint64_t>& levelBytes, uint64_t tailBytes = MIP_RESIDENCY_DEFAULT_TAIL_BYTES);
+
+	// Level sizes from the most detailed down.  Levels from the tail level
+	// down start resident (and stay that way).  Textures want level 0 until
+	// told otherwise.
+	unsigned int AddTexture(const std::vector<uint64_t>& levelBytes, unsigned int tailLevel);
+
+	// The most detailed level the texture would be sampled at, and how
+	// much it matters against others wanting the same
+	void SetWantedLevel(unsigned int texture, unsigned int level, float priority = 1.0f);
+
+	// Works out what should be resident, and reports each texture whose
+	// resident levels changed since the last update
+	void Update(std::vector<MipResidencyChange>& changes);
+
+	unsigned int GetResidentLevel(unsigned int texture) const { return textures[texture].Resident; }
+	unsigned int GetTextureCount() const { return (unsigned int)textures.size(); }
+	MipResidencyStats GetStats() const;
+
+private:
+	struct Texture
+	{
+		std::vector<uint64_t> LevelBytes;
+		unsigned int Tail;
+		unsigned int Wanted;
+		float Priority;
+		unsigned int Target;
+		unsigned int Resident;
+	};
+
+	std::vector<Texture> textures;
+	uint64_t budget;
+	uint64_t uploadLimit;
+	uint64_t residentBytes;
+	uint64_t tailBytes;
+	uint64_t loadedBytes;
+	uint64_t evictedBytes;
+	unsigned int loads;
+	unsigned int evictions;
+
+	void ChooseTargets();
+	uint64_t GetBytesFrom(const Texture& texture, unsigned int level) const;
+};
@@ -0,0 +1,691 @@
+#include "PNGDecoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Codes up to this long decode with one table lookup
+#define INFLATE_FAST_BITS 10
+
+// Far bigger than any texture we could create
+#define PNG_MAX_DIMENSION 65536
+
+// A canonical Huffman code, as deflate describes them
+struct HuffmanTable
+{
+	uint16_t Fast[1 << INFLATE_FAST_BITS];	// (length << 9) | symbol, or 0 if longer
+	uint16_t Counts[16];					// How many codes of each length
+	uint16_t Symbols[288];					// Ordered by code
+};
+
+// Deflate reads bits least significant first
+struct InflateBits
+{
+	const unsigned char* Next;
+	const unsigned char* End;
+	uint64_t Buffer;
+	unsigned int Count;
+	unsigned int Overrun;	// Zero bytes read past the end
+
+	void Refill()
+	{
+		while (Count <= 56)
+		{
+			uint64_t byte = 0;
+			if (Next < End)
+				byte = *Next++;
+			else
+				Overrun++;
+			Buffer |= byte << Count;
+			Count += 8;
+		}
+	}
+
+	unsigned int Peek(unsigned int bits)
+	{
+		if (Count < bits)
+			Refill();
+		return (unsigned int)(Buffer & ((1ull << bits) - 1));
+	}
+
+	void Drop(unsigned int bits)
+	{
+		Buffer >>= bits;
+		Count -= bits;
+	}
+
+	unsigned int Read(unsigned int bits)
+	{
+		unsigned int value = Peek(bits);
+		Drop(bits);
+		return value;
+	}
+
+	// Whether the stream was shorter than what's been read from it
+	bool Overran() const { return Overrun * 8 > Count; }
+};
+
+static const uint16_t lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distanceExtraBits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t codeLengthOrder[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+// --------------------------------------------------------
+// Builds a table from each symbol's code length (0 for
+// unused symbols).  Incomplete codes are allowed, since a
+// stream with one distance code has one.
+// --------------------------------------------------------
+static bool BuildHuffmanTable(HuffmanTable& table, const unsigned char* lengths, unsigned int count)
+{
+	memset(table.Counts, 0, sizeof(table.Counts));
+	for (unsigned int i = 0; i < count; i++)
+		table.Counts[lengths[i]]++;
+	table.Counts[0] = 0;
+
+	// More codes of a length than there's room for can't be decoded
+	int left = 1;
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		left = (left << 1) - table.Counts[length];
+		if (left < 0)
+			return false;
+	}
+
+	uint16_t offsets[16] = {};
+	for (unsigned int length = 1; length < 15; length++)
+		offsets[length + 1] = offsets[length] + table.Counts[length];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (lengths[i] != 0)
+			table.Symbols[offsets[lengths[i]]++] = (uint16_t)i;
+	}
+
+	// Short codes fill every fast entry that starts with them
+	// (reversed, since codes are stored most significant bit first)
+	memset(table.Fast, 0, sizeof(table.Fast));
+	unsigned int nextCode[16] = {};
+	unsigned int code = 0;
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		code = (code + table.Counts[length - 1]) << 1;
+		nextCode[length] = code;
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int length = lengths[i];
+		if (length == 0)
+			continue;
+
+		unsigned int symbolCode = nextCode[length]++;
+		if (length > INFLATE_FAST_BITS)
+			continue;
+
+		unsigned int reversed = 0;
+		for (unsigned int bit = 0; bit < length; bit++)
+			reversed |= ((symbolCode >> bit) & 1) << (length - 1 - bit);
+		for (unsigned int entry = reversed; entry < (1u << INFLATE_FAST_BITS); entry += 1u << length)
+			table.Fast[entry] = (uint16_t)((length << 9) | i);
+	}
+	return true;
+}
+
+// Returns -1 for a code the table doesn't have
+static int DecodeSymbol(InflateBits& bits, const HuffmanTable& table)
+{
+	unsigned int peeked = bits.Peek(15);
+	uint16_t entry = table.Fast[peeked & ((1u << INFLATE_FAST_BITS) - 1)];
+	if (entry != 0)
+	{
+		bits.Drop(entry >> 9);
+		return entry & 511;
+	}
+
+	// Longer codes a bit at a time (codes of each length are consecutive)
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		code |= (peeked >> (length - 1)) & 1;
+		int count = table.Counts[length];
+		if (code - first < count)
+		{
+			bits.Drop(length);
+			return table.Symbols[index + code - first];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+struct FixedHuffmanTables
+{
+	HuffmanTable Literals;
+	HuffmanTable Distances;
+
+	FixedHuffmanTables()
+	{
+		unsigned char lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		BuildHuffmanTable(Literals, lengths, 288);
+
+		memset(lengths, 5, 30);
+		BuildHuffmanTable(Distances, lengths, 30);
+	}
+};
+
+static bool ReadDynamicTables(InflateBits& bits, HuffmanTable& literals, HuffmanTable& distances)
+{
+	unsigned int literalCount = bits.Read(5) + 257;
+	unsigned int distanceCount = bits.Read(5) + 1;
+	unsigned int codeLengthCount = bits.Read(4) + 4;
+	if (literalCount > 286 || distanceCount > 30)
+		return false;
+
+	// The code lengths are themselves Huffman coded
+	unsigned char codeLengthLengths[19] = {};
+	for (unsigned int i = 0; i < codeLengthCount; i++)
+		codeLengthLengths[codeLengthOrder[i]] = (unsigned char)bits.Read(3);
+	HuffmanTable codeLengths;
+	if (!BuildHuffmanTable(codeLengths, codeLengthLengths, 19))
+		return false;
+
+	unsigned char lengths[286 + 30] = {};
+	unsigned int total = literalCount + distanceCount;
+	unsigned int count = 0;
+	while (count < total)
+	{
+		int symbol = DecodeSymbol(bits, codeLengths);
+		if (symbol < 0)
+			return false;
+		if (symbol < 16)
+		{
+			lengths[count++] = (unsigned char)symbol;
+			continue;
+		}
+
+		// Runs of the previous length, or of zeros
+		unsigned char length = 0;
+		unsigned int repeat = 0;
+		if (symbol == 16)
+		{
+			if (count == 0)
+				return false;
+			length = lengths[count - 1];
+			repeat = 3 + bits.Read(2);
+		}
+		else if (symbol == 17)
+			repeat = 3 + bits.Read(3);
+		else
+			repeat = 11 + bits.Read(7);
+
+		if (repeat > total - count)
+			return false;
+		while (repeat-- > 0)
+			lengths[count++] = length;
+	}
+
+	// Every block has to be able to end
+	if (lengths[256] == 0 || bits.Overran())
+		return false;
+
+	return
+		BuildHuffmanTable(literals, lengths, literalCount) &&
+		BuildHuffmanTable(distances, lengths + literalCount, distanceCount);
+}
+
+uint32_t PNGDecoder::Adler32(const unsigned char* data, size_t size)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+	while (size > 0)
+	{
+		// Largest run that can't overflow before the modulo
+		size_t run = size < 5552 ? size : 5552;
+		size -= run;
+		while (run-- > 0)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+
+// --------------------------------------------------------
+// Decodes every block into the output, which has to be
+// exactly the size of the stream's data, then checks it
+// against the stream's checksum.
+// --------------------------------------------------------
+bool PNGDecoder::Inflate(const unsigned char* data, size_t size, unsigned char* output, size_t outputSize)
+{
+	// Deflate, with no preset dictionary
+	if (size < 6 || (data[0] & 0x0F) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20) != 0)
+		return false;
+
+	static const FixedHuffmanTables fixedTables;
+	HuffmanTable dynamicLiterals;
+	HuffmanTable dynamicDistances;
+
+	InflateBits bits = { data + 2, data + size, 0, 0, 0 };
+	size_t written = 0;
+	bool finalBlock = false;
+	while (!finalBlock)
+	{
+		finalBlock = bits.Read(1) != 0;
+		unsigned int type = bits.Read(2);
+		if (type == 0)
+		{
+			// Stored: byte aligned, with its length (and the length's complement)
+			bits.Drop(bits.Count % 8);
+			unsigned int length = bits.Read(16);
+			unsigned int complement = bits.Read(16);
+			if (length != (~complement & 0xFFFF) || length > outputSize - written)
+				return false;
+			for (unsigned int i = 0; i < length; i++)
+				output[written++] = (unsigned char)bits.Read(8);
+		}
+		else
+		{
+			const HuffmanTable* literals = &fixedTables.Literals;
+			const HuffmanTable* distances = &fixedTables.Distances;
+			if (type == 2)
+			{
+				if (!ReadDynamicTables(bits, dynamicLiterals, dynamicDistances))
+					return false;
+				literals = &dynamicLiterals;
+				distances = &dynamicDistances;
+			}
+			else if (type != 1)
+				return false;
+
+			for (;;)
+			{
+				int symbol = DecodeSymbol(bits, *literals);
+				if (symbol < 0)
+					return false;
+				if (symbol < 256)
+				{
+					if (written == outputSize)
+						return false;
+					output[written++] = (unsigned char)symbol;
+					continue;
+				}
+				if (symbol == 256)
+					break;
+
+				// A copy of earlier output (which can overlap itself)
+				symbol -= 257;
+				if (symbol >= 29)
+					return false;
+				size_t length = lengthBase[symbol] + bits.Read(lengthExtraBits[symbol]);
+				int distanceSymbol = DecodeSymbol(bits, *distances);
+				if (distanceSymbol < 0 || distanceSymbol >= 30)
+					return false;
+				size_t distance = distanceBase[distanceSymbol] + bits.Read(distanceExtraBits[distanceSymbol]);
+				if (distance > written || length > outputSize - written)
+					return false;
+
+				unsigned char* to = output + written;
+				const unsigned char* from = to - distance;
+				for (size_t i = 0; i < length; i++)
+					to[i] = from[i];
+				written += length;
+			}
+		}
+
+		if (bits.Overran())
+			return false;
+	}
+
+	if (written != outputSize)
+		return false;
+
+	// Adler-32 of the output, big endian, after the last block
+	bits.Drop(bits.Count % 8);
+	uint32_t checksum = 0;
+	for (int i = 0; i < 4; i++)
+		checksum = (checksum << 8) | bits.Read(8);
+	return !bits.Overran() && checksum == Adler32(output, outputSize);
+}
+
+static uint32_t ReadBigEndian(const unsigned char* data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static unsigned char Paeth(int left, int up, int upLeft)
+{
+	int estimate = left + up - upLeft;
+	int toLeft = abs(estimate - left);
+	int toUp = abs(estimate - up);
+	int toUpLeft = abs(estimate - upLeft);
+	if (toLeft <= toUp && toLeft <= toUpLeft)
+		return (unsigned char)left;
+	return (unsigned char)(toUp <= toUpLeft ? up : upLeft);
+}
+
+// Undoes a row's filter in place.  The first row has no previous row.
+static bool UnfilterRow(unsigned int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, size_t pixelBytes)
+{
+	switch (filter)
+	{
+	case 0:
+		return true;
+
+	case 1:
+		for (size_t i = pixelBytes; i < rowBytes; i++)
+			row[i] += row[i - pixelBytes];
+		return true;
+
+	case 2:
+		if (previous)
+		{
+			for (size_t i = 0; i < rowBytes; i++)
+				row[i] += previous[i];
+		}
+		return true;
+
+	case 3:
+		for (size_t i = 0; i < rowBytes; i++)
+		{
+			int left = i >= pixelBytes ? row[i - pixelBytes] : 0;
+			int up = previous ? previous[i] : 0;
+			row[i] += (unsigned char)((left + up) / 2);
+		}
+		return true;
+
+	case 4:
+		for (size_t i = 0; i < rowBytes; i++)
+		{
+			int left = i >= pixelBytes ? row[i - pixelBytes] : 0;
+			int up = previous ? previous[i] : 0;
+			int upLeft = previous && i >= pixelBytes ? previous[i - pixelBytes] : 0;
+			row[i] += Paeth(left, up, upLeft);
+		}
+		return true;
+	}
+	return false;
+}
+
+// One sample from a row, as stored (or its top 8 bits, for 16-bit images)
+static unsigned int ReadSample(const unsigned char* row, size_t index, unsigned int bitDepth)
+{
+	if (bitDepth == 8)
+		return row[index];
+	if (bitDepth == 16)
+		return row[index * 2];
+
+	size_t bit = index * bitDepth;
+	return (row[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1u << bitDepth) - 1);
+}
+
+bool PNGDecoder::IsPNG(const unsigned char* data, size_t size)
+{
+	static const unsigned char signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	return size >= 8 && memcmp(data, signature, 8) == 0;
+}
+
+
+// --------------------------------------------------------
+// Gathers the header, palette and image data chunks (other
+// chunks are skipped), inflates the data, unfilters it row
+// by row, then expands it to 8-bit grey or RGBA.
+// --------------------------------------------------------
+bool PNGDecoder::Decode(const unsigned char* data, size_t size, DecodedImage& image)
+{
+	if (!IsPNG(data, size))
+		return false;
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int bitDepth = 0;
+	unsigned int colorType = 0;
+	bool hasHeader = false;
+	bool ended = false;
+	unsigned char palette[256 * 4];
+	unsigned int paletteSize = 0;
+	std::vector<unsigned char> compressed;
+
+	size_t offset = 8;
+	while (!ended && size - offset >= 12)
+	{
+		// Length, type, data, CRC
+		uint32_t length = ReadBigEndian(data + offset);
+		if (length > size - offset - 12)
+			return false;
+		const unsigned char* type = data + offset + 4;
+		const unsigned char* chunk = data + offset + 8;
+		offset += 12 + (size_t)length;
+
+		if (memcmp(type, "IHDR", 4) == 0)
+		{
+			if (length != 13)
+				return false;
+			width = ReadBigEndian(chunk);
+			height = ReadBigEndian(chunk + 4);
+			bitDepth = chunk[8];
+			colorType = chunk[9];
+
+			// Deflate, adaptive filters, not interlaced
+			if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0)
+				return false;
+			hasHeader = true;
+		}
+		else if (memcmp(type, "PLTE", 4) == 0)
+		{
+			if (length % 3 != 0 || length / 3 > 256)
+				return false;
+			paletteSize = length / 3;
+			for (unsigned int i = 0; i < paletteSize; i++)
+			{
+				memcpy(palette + i * 4, chunk + i * 3, 3);
+				palette[i * 4 + 3] = 255;
+			}
+		}
+		else if (memcmp(type, "tRNS", 4) == 0)
+		{
+			// Palette alpha only (it comes after the palette)
+			if (colorType != 3 || length > paletteSize)
+				return false;
+			for (unsigned int i = 0; i < length; i++)
+				palette[i * 4 + 3] = chunk[i];
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		else if (memcmp(type, "IEND", 4) == 0)
+			ended = true;
+	}
+	if (!hasHeader || !ended || width == 0 || height == 0 || width > PNG_MAX_DIMENSION || height > PNG_MAX_DIMENSION)
+		return false;
+
+	unsigned int samples = 0;
+	switch (colorType)
+	{
+	case 0: samples = 1; break;		// Grey
+	case 2: samples = 3; break;		// RGB
+	case 3: samples = 1; break;		// Palette
+	case 4: samples = 2; break;		// Grey and alpha
+	case 6: samples = 4; break;		// RGBA
+	default: return false;
+	}
+	bool lowBitDepth = bitDepth == 1 || bitDepth == 2 || bitDepth == 4;
+	bool validDepth =
+		bitDepth == 8 ||
+		(bitDepth == 16 && colorType != 3) ||
+		(lowBitDepth && (colorType == 0 || colorType == 3));
+	if (!validDepth || (colorType == 3 && paletteSize == 0))
+		return false;
+
+	// Each row starts with its filter type
+	size_t pixelBits = (size_t)samples * bitDepth;
+	size_t rowBytes = (width * pixelBits + 7) / 8;
+	size_t pixelBytes = pixelBits < 8 ? 1 : pixelBits / 8;
+	std::vector<unsigned char> raw((rowBytes + 1) * height);
+	if (!Inflate(compressed.data(), compressed.size(), raw.data(), raw.size()))
+		return false;
+
+	const unsigned char* previous = 0;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		unsigned char* row = raw.data() + (rowBytes + 1) * y;
+		if (!UnfilterRow(row[0], row + 1, previous, rowBytes, pixelBytes))
+			return false;
+		previous = row + 1;
+	}
+
+	image.Width = width;
+	image.Height = height;
+	image.Channels = colorType == 0 ? 1 : 4;
+	image.Pixels.resize((size_t)width * height * image.Channels);
+
+	unsigned int greyScale = lowBitDepth ? 255 / ((1u << bitDepth) - 1) : 1;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const unsigned char* row = raw.data() + (rowBytes + 1) * y + 1;
+		unsigned char* pixel = image.Pixels.data() + (size_t)width * image.Channels * y;
+		for (unsigned int x = 0; x < width; x++, pixel += image.Channels)
+		{
+			size_t sample = (size_t)x * samples;
+			switch (colorType)
+			{
+			case 0:
+				pixel[0] = (unsigned char)(ReadSample(row, sample, bitDepth) * greyScale);
+				break;
+
+			case 2:
+				pixel[0] = (unsigned char)ReadSample(row, sample, bitDepth);
+				pixel[1] = (unsigned char)ReadSample(row, sample + 1, bitDepth);
+				pixel[2] = (unsigned char)ReadSample(row, sample + 2, bitDepth);
+				pixel[3] = 255;
+				break;
+
+			case 3:
+			{
+				unsigned int index = ReadSample(row, sample, bitDepth);
+				if (index >= paletteSize)
+					return false;
+				memcpy(pixel, palette + index * 4, 4);
+				break;
+			}
+
+			case 4:
+				pixel[0] = pixel[1] = pixel[2] = (unsigned char)ReadSample(row, sample, bitDepth);
+				pixel[3] = (unsigned char)ReadSample(row, sample + 1, bitDepth);
+				break;
+
+			case 6:
+				for (unsigned int c = 0; c < 4; c++)
+					pixel[c] = (unsigned char)ReadSample(row, sample + c, bitDepth);
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+// CRC-32 of every byte value (built once, on first use)
+struct CRC32Table
+{
+	uint32_t Values[256];
+
+	CRC32Table()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++)
+				value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+			Values[i] = value;
+		}
+	}
+};
+
+uint32_t PNGDecoder::CRC32(const unsigned char* data, size_t size, uint32_t crc)
+{
+	static const CRC32Table table;
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table.Values[(crc ^ data[i]) & 255] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void AppendBigEndian(std::vector<unsigned char>& data, uint32_t value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		data.push_back((unsigned char)(value >> shift));
+}
+
+static void AppendChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& chunk)
+{
+	AppendBigEndian(png, (uint32_t)chunk.size());
+	size_t typeStart = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), chunk.begin(), chunk.end());
+	AppendBigEndian(png, PNGDecoder::CRC32(png.data() + typeStart, png.size() - typeStart));
+}
+
+
+// --------------------------------------------------------
+// Each row gets filter 0, and the rows go into stored
+// deflate blocks (at most 65535 bytes each)
+// --------------------------------------------------------
+void PNGDecoder::Encode(const DecodedImage& image, std::vector<unsigned char>& png)
+{
+	size_t rowBytes = (size_t)image.Width * image.Channels;
+	std::vector<unsigned char> rows;
+	rows.reserve((rowBytes + 1) * image.Height);
+	for (unsigned int y = 0; y < image.Height; y++)
+	{
+		rows.push_back(0);
+		rows.insert(rows.end(), image.Pixels.begin() + rowBytes * y, image.Pixels.begin() + rowBytes * (y + 1));
+	}
+
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	zlib.reserve(rows.size() + rows.size() / 65535 * 5 + 16);
+	size_t offset = 0;
+	do
+	{
+		size_t length = rows.size() - offset < 65535 ? rows.size() - offset : 65535;
+		zlib.push_back(offset + length == rows.size() ? 1 : 0);
+		zlib.push_back((unsigned char)length);
+		zlib.push_back((unsigned char)(length >> 8));
+		zlib.push_back((unsigned char)~length);
+		zlib.push_back((unsigned char)(~length >> 8));
+		zlib.insert(zlib.end(), rows.begin() + offset, rows.begin() + offset + length);
+		offset += length;
+	} while (offset < rows.size());
+	AppendBigEndian(zlib, Adler32(rows.data(), rows.size()));
+
+	std::vector<unsigned char> header;
+	AppendBigEndian(header, image.Width);
+	AppendBigEndian(header, image.Height);
+	header.push_back(8);
+	header.push_back(image.Channels == 1 ? 0 : 6);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+
+	png.assign({ 137, 'P', 'N', 'G', 13, 10, 26, 10 });
+	AppendChunk(png, "IHDR", header);
+	AppendChunk(png, "IDAT", zlib);
+	AppendChunk(png, "IEND", {});
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pixels decoded on the CPU, tightly packed rows of 8-bit channels
+struct DecodedImage
+{
+	unsigned int Width;
+	unsigned int Height;
+	unsigned int Channels;		// 1 (grey) or 4 (RGBA)
+	std::vector<unsigned char> Pixels;
+};
+
+// --------------------------------------------------------
+// A small PNG decoder that doesn't need WIC (or COM), so it
+// can run on any thread, and anywhere.
+//
+// Handles every color type at every bit depth, except for
+// interlaced images and color-keyed (tRNS) grey or RGB, for
+// which Decode() returns false so the caller can fall back
+// to WIC.  Grey images stay one channel; everything else
+// becomes RGBA.  16-bit channels are reduced to 8 bits.
+//
+// Chunk CRCs aren't checked.  The image data's zlib stream
+// has its own checksum (Adler-32), which is.
+//
+// Encode() writes the other way, for files the engine makes
+// itself: stored (uncompressed) deflate, so it's fast and
+// simple, with real CRCs so any tool can open the result.
+// --------------------------------------------------------
+class PNGDecoder
+{
+public:
+	static bool IsPNG(const unsigned char* data, size_t size);
+	static bool Decode(const unsigned char* data, size_t size, DecodedImage& image);
+
+	// Inflates a zlib stream into exactly outputSize bytes
+	static bool Inflate(const unsigned char* data, size_t size, unsigned char* output, size_t outputSize);
+
+	// 8-bit grey (one channel) or RGBA, unfiltered
+	static void Encode(const DecodedImage& image, std::vector<unsigned char>& png);
+
+	// The checksum zlib streams end with
+	static uint32_t Adler32(const unsigned char* data, size_t size);
+
+	// The checksum every PNG chunk ends with
+	static uint32_t CRC32(const unsigned char* data, size_t size, uint32_t crc = 0);
+};
@@ -0,0 +1,262 @@
+#include "PipelineCache.h"
+
+#include <cstring>
+
+#include "FileStreams.h"
+
+#define PIPELINE_CACHE_MAGIC 0x48434C50		// "PLCH"
+#define PIPELINE_CACHE_VERSION 1
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+PipelineKeyHasher::PipelineKeyHasher() :
+	hash(FNV_OFFSET_BASIS)
+{
+}
+
+void PipelineKeyHasher::Add(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+}
+
+// --------------------------------------------------------
+// Includes the terminator, so "ab" + "c" and "a" + "bc"
+// hash differently
+// --------------------------------------------------------
+void PipelineKeyHasher::AddString(const char* string)
+{
+	Add(string, string ? strlen(string) + 1 : 0);
+}
+
+static uint64_t ChecksumBlob(const unsigned char* data, size_t size)
+{
+	PipelineKeyHasher hasher;
+	hasher.Add(data, size);
+	return hasher.GetHash();
+}
+
+template<typename T> static void AppendValue(std::vector<unsigned char>& data, const T& value)
+{
+	const unsigned char* bytes = (const unsigned char*)&value;
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T> static bool ReadValue(const unsigned char* data, size_t size, size_t& offset, T& value)
+{
+	if (size - offset < sizeof(T))
+		return false;
+	memcpy(&value, data + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+PipelineCache::PipelineCache() :
+	environment(0),
+	dirty(false),
+	loaded(0),
+	hits(0),
+	misses(0),
+	stored(0),
+	rejected(0),
+	environmentChanged(false)
+{
+}
+
+
+// --------------------------------------------------------
+// Reads the whole file and hands it to Deserialize()
+// --------------------------------------------------------
+bool PipelineCache::Load(const std::wstring& path, uint64_t environment)
+{
+	this->environment = environment;
+
+	std::vector<unsigned char> data;
+	if (!ReadWholeFile(path, data))
+		return false;
+	return Deserialize(data.data(), data.size(), environment);
+}
+
+bool PipelineCache::Save(const std::wstring& path)
+{
+	std::vector<unsigned char> data;
+	Serialize(data);
+	if (!WriteWholeFile(path, data.data(), data.size()))
+		return false;
+
+	dirty = false;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Writes the entries used this run
+// --------------------------------------------------------
+void PipelineCache::Serialize(std::vector<unsigned char>& data) const
+{
+	uint32_t count = 0;
+	for (const auto& entry : entries)
+	{
+		if (entry.second.Used)
+			count++;
+	}
+
+	data.clear();
+	AppendValue(data, (uint32_t)PIPELINE_CACHE_MAGIC);
+	AppendValue(data, (uint32_t)PIPELINE_CACHE_VERSION);
+	AppendValue(data, environment);
+	AppendValue(data, count);
+	AppendValue(data, (uint32_t)0);
+
+	for (const auto& entry : entries)
+	{
+		if (!entry.second.Used)
+			continue;
+
+		const std::vector<unsigned char>& blob = entry.second.Blob;
+		AppendValue(data, entry.first);
+		AppendValue(data, (uint64_t)blob.size());
+		AppendValue(data, ChecksumBlob(blob.data(), blob.size()));
+		data.insert(data.end(), blob.begin(), blob.end());
+		data.resize((data.size() + 7) & ~(size_t)7, 0);
+	}
+}
+
+
+// --------------------------------------------------------
+// Replaces the cache's entries with the data's, as long as
+// it was written for this environment.  Entries that fail
+// their checksum are skipped, and a truncated file keeps
+// whatever came before the cut.
+// --------------------------------------------------------
+bool PipelineCache::Deserialize(const unsigned char* data, size_t size, uint64_t environment)
+{
+	this->environment = environment;
+	entries.clear();
+	loaded = 0;
+	environmentChanged = false;
+
+	size_t offset = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t fileEnvironment = 0;
+	uint32_t count = 0;
+	uint32_t padding = 0;
+	if (!ReadValue(data, size, offset, magic) || magic != PIPELINE_CACHE_MAGIC ||
+		!ReadValue(data, size, offset, version) || version != PIPELINE_CACHE_VERSION ||
+		!ReadValue(data, size, offset, fileEnvironment) ||
+		!ReadValue(data, size, offset, count) ||
+		!ReadValue(data, size, offset, padding))
+	{
+		dirty = true;
+		return false;
+	}
+
+	if (fileEnvironment != environment)
+	{
+		environmentChanged = true;
+		dirty = true;
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t key = 0;
+		uint64_t blobSize = 0;
+		uint64_t checksum = 0;
+		if (!ReadValue(data, size, offset, key) ||
+			!ReadValue(data, size, offset, blobSize) ||
+			!ReadValue(data, size, offset, checksum) ||
+			blobSize > size - offset)
+		{
+			rejected++;
+			dirty = true;
+			break;
+		}
+
+		const unsigned char* blob = data + offset;
+		offset += ((size_t)blobSize + 7) & ~(size_t)7;
+		offset = offset < size ? offset : size;
+		if (ChecksumBlob(blob, (size_t)blobSize) != checksum)
+		{
+			rejected++;
+			dirty = true;
+			continue;
+		}
+
+		Entry& entry = entries[key];
+		entry.Blob.assign(blob, blob + blobSize);
+		entry.Used = false;
+		loaded++;
+	}
+	return true;
+}
+
+const std::vector<unsigned char>* PipelineCache::Find(uint64_t key)
+{
+	auto it = entries.find(key);
+	if (it == entries.end())
+	{
+		misses++;
+		return 0;
+	}
+
+	hits++;
+	it->second.Used = true;
+	return &it->second.Blob;
+}
+
+void PipelineCache::Store(uint64_t key, const void* blob, size_t size)
+{
+	Entry& entry = entries[key];
+	entry.Blob.assign((const unsigned char*)blob, (const unsigned char*)blob + size);
+	entry.Used = true;
+	dirty = true;
+	stored++;
+}
+
+void PipelineCache::Reject(uint64_t key)
+{
+	if (entries.erase(key))
+	{
+		rejected++;
+		dirty = true;
+	}
+}
+
+bool PipelineCache::IsDirty() const
+{
+	if (dirty)
+		return true;
+
+	// Anything unused would be dropped
+	for (const auto& entry : entries)
+	{
+		if (!entry.second.Used)
+			return true;
+	}
+	return false;
+}
+
+void PipelineCache::AddTiming(const std::string& name, double ms, bool cacheHit)
+{
+	timings.push_back({ name, ms, cacheHit });
+}
+
+PipelineCacheStats PipelineCache::GetStats() const
+{
+	PipelineCacheStats stats = {};
+	stats.Entries = (unsigned int)entries.size();
+	stats.Loaded = loaded;
+	stats.Hits = hits;
+	stats.Misses = misses;
+	stats.Stored = stored;
+	stats.Rejected = rejected;
+	stats.EnvironmentChanged = environmentChanged;
+	return stats;
+}
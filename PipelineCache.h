@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// --------------------------------------------------------
+// 64-bit FNV-1a over everything that makes a pipeline what
+// it is (its description, shader bytecode, root signature)
+// --------------------------------------------------------
+class PipelineKeyHasher
+{
+public:
+	PipelineKeyHasher();
+
+	void Add(const void* data, size_t size);
+	void AddString(const char* string);
+	template<typename T> void AddValue(const T& value) { Add(&value, sizeof(T)); }
+
+	uint64_t GetHash() const { return hash; }
+
+private:
+	uint64_t hash;
+};
+
+// How long one pipeline took to create at startup
+struct PipelineTiming
+{
+	std::string Name;
+	double Ms;
+	bool CacheHit;
+};
+
+struct PipelineCacheStats
+{
+	unsigned int Entries;
+	unsigned int Loaded;			// From the file
+	unsigned int Hits;
+	unsigned int Misses;
+	unsigned int Stored;			// New or replaced blobs
+	unsigned int Rejected;			// Corrupt, or the driver wouldn't take them
+	bool EnvironmentChanged;		// Adapter or driver differs from the file's
+};
+
+// --------------------------------------------------------
+// Driver-compiled pipeline blobs by key, saved to disk so
+// later launches can skip compiling them.
+//
+// The file starts with the environment (adapter and driver)
+// it was written for, and is ignored entirely if that's
+// changed.  Each blob has a checksum, and a blob that fails
+// it is dropped.  Only blobs used this run are saved, so
+// entries for old shaders go away on their own.
+//
+// File layout (little endian):
+//   Magic, version (uint32 each), environment (uint64),
+//   entry count (uint32), padding (uint32)
+//   Per entry: key, size, checksum (uint64 each), then the
+//   blob padded to 8 bytes
+// --------------------------------------------------------
+class PipelineCache
+{
+public:
+	PipelineCache();
+
+	// Reads the file (a missing or stale file just means an empty cache)
+	bool Load(const std::wstring& path, uint64_t environment);
+	bool Save(const std::wstring& path);
+
+	void Serialize(std::vector<unsigned char>& data) const;
+	bool Deserialize(const unsigned char* data, size_t size, uint64_t environment);
+
+	// The blob stored for a key, or null.  Only valid until the cache changes.
+	const std::vector<unsigned char>* Find(uint64_t key);
+	void Store(uint64_t key, const void* blob, size_t size);
+
+	// The driver wouldn't create a pipeline from this blob
+	void Reject(uint64_t key);
+
+	// Whether saving would change the file
+	bool IsDirty() const;
+
+	void AddTiming(const std::string& name, double ms, bool cacheHit);
+	const std::vector<PipelineTiming>& GetTimings() const { return timings; }
+
+	PipelineCacheStats GetStats() const;
+
+private:
+	struct Entry
+	{
+		std::vector<unsigned char> Blob;
+		bool Used;
+	};
+
+	uint64_t environment;
+	std::unordered_map<uint64_t, Entry> entries;
+	bool dirty;
+
+	unsigned int loaded;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int stored;
+	unsigned int rejected;
+	bool environmentChanged;
+
+	std::vector<PipelineTiming> timings;
+};
@@ -15,9 +15,8 @@ cbuffer ExternalData : register(b0)
 
 //registers for textures
 Texture2D AlbedoTex : register(t0);
-Texture2D MetalTex : register(t1);
-Texture2D NormalTex : register(t2);
-Texture2D RoughnessTex : register(t3);
+Texture2D NormalTex : register(t1);
+Texture2D ORMTex : register(t2); // Occlusion, roughness, metal
 
 SamplerState BasicSampler : register(s0);
 
@@ -41,8 +40,9 @@ float4 main(VertexToPixel input) : SV_TARGET
 
 	// Sample various textures
 	input.normal = NormalMapping(NormalTex, BasicSampler, input.uv, input.normal, input.tangent);
-	float roughness = RoughnessTex.Sample(BasicSampler, input.uv).r;
-	float metal = MetalTex.Sample(BasicSampler, input.uv).r;
+	float3 orm = ORMTex.Sample(BasicSampler, input.uv).rgb;
+	float roughness = orm.g;
+	float metal = orm.b;
 
 	// Gamma correct the texture back to linear space and apply the color tint
 	float4 surfaceColor = AlbedoTex.Sample(BasicSampler, input.uv);
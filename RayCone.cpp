@@ -0,0 +1,118 @@
+#include "RayCone.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+// Grazing hits would make the footprint (and the mip) blow up
+#define RAY_CONE_MIN_COSINE 0.01f
+
+static XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static float Length(const XMFLOAT3& a) { return sqrtf(Dot(a, a)); }
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+float RayConeLOD::GetPixelSpreadAngle(float verticalFieldOfView, unsigned int screenHeight)
+{
+	return atanf(2.0f * tanf(verticalFieldOfView * 0.5f) / (float)std::max(screenHeight, 1u));
+}
+
+RayCone RayConeLOD::Propagate(const RayCone& cone, float distance)
+{
+	RayCone result = { cone.Width + cone.Spread * distance, cone.Spread };
+	return result;
+}
+
+
+// --------------------------------------------------------
+// Across the cone's footprint on the surface (its width
+// over the cosine) the normal turns by the curvature times
+// the footprint.  A mirror turns the ray by twice that.
+// Keeping the width signed keeps this right past a focus,
+// where the cone's sides have swapped over.
+// --------------------------------------------------------
+RayCone RayConeLOD::Reflect(const RayCone& cone, float curvature, float cosIncidence)
+{
+	float footprint = cone.Width / std::max(cosIncidence, RAY_CONE_MIN_COSINE);
+	RayCone result = { cone.Width, cone.Spread + 2.0f * curvature * footprint };
+	return result;
+}
+
+
+// --------------------------------------------------------
+// From Snell's law, turning the incoming ray turns the
+// refracted one by r = eta * cos(incidence) / cos(refracted)
+// times as much, and turning the normal turns it by 1 - r.
+// The refracted cone's width is the footprint seen along
+// the refracted ray.
+// --------------------------------------------------------
+RayCone RayConeLOD::Refract(const RayCone& cone, float curvature, float cosIncidence, float cosTransmitted, float eta)
+{
+	cosIncidence = std::max(cosIncidence, RAY_CONE_MIN_COSINE);
+	cosTransmitted = std::max(cosTransmitted, RAY_CONE_MIN_COSINE);
+	float ratio = eta * cosIncidence / cosTransmitted;
+	float footprint = cone.Width / cosIncidence;
+	RayCone result = { footprint * cosTransmitted, ratio * cone.Spread - (1.0f - ratio) * curvature * footprint };
+	return result;
+}
+
+// Texels per world unit squared over the triangle, through its uvs,
+// plus the texture's size, against the cone's footprint
+float RayConeLOD::GetMipLevel(const RayConeTriangle& triangle, float width, float cosIncidence, unsigned int textureWidth, unsigned int textureHeight, float instanceScale)
+{
+	float level = triangle.TexelDensity
+		+ 0.5f * log2f((float)textureWidth * textureHeight)
+		+ log2f(fabsf(width))
+		- log2f(std::max(cosIncidence, RAY_CONE_MIN_COSINE))
+		- log2f(instanceScale);
+	return std::max(level, 0.0f);
+}
+
+
+// --------------------------------------------------------
+// Curvature along each edge is how much the normals turn
+// over its length (exactly 1 / radius on a sphere), and
+// the triangle's is their average.  Degenerate edges and
+// triangles are left out (and get 0).
+// --------------------------------------------------------
+RayConeTriangle RayConeLOD::GetTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+	RayConeTriangle triangle = {};
+
+	XMFLOAT3 edge1 = Subtract(v1.Position, v0.Position);
+	XMFLOAT3 edge2 = Subtract(v2.Position, v0.Position);
+	float area = 0.5f * Length(Cross(edge1, edge2));
+	float uvArea = 0.5f * fabsf((v1.UV.x - v0.UV.x) * (v2.UV.y - v0.UV.y) - (v2.UV.x - v0.UV.x) * (v1.UV.y - v0.UV.y));
+	if (area > 0.0f && uvArea > 0.0f)
+		triangle.TexelDensity = 0.5f * log2f(uvArea / area);
+
+	const Vertex* corners[3] = { &v0, &v1, &v2 };
+	float curvature = 0.0f;
+	int edges = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const Vertex* from = corners[i];
+		const Vertex* to = corners[(i + 1) % 3];
+		XMFLOAT3 position = Subtract(to->Position, from->Position);
+		float lengthSquared = Dot(position, position);
+		if (lengthSquared <= 0.0f)
+			continue;
+
+		curvature += Dot(Subtract(to->Normal, from->Normal), position) / lengthSquared;
+		edges++;
+	}
+	if (edges > 0 && area > 0.0f)
+		triangle.Curvature = curvature / edges;
+	return triangle;
+}
+
+void RayConeLOD::ComputeTriangles(const Vertex* vertices, const unsigned int* indices, size_t indexCount, std::vector<RayConeTriangle>& triangles)
+{
+	triangles.resize(indexCount / 3);
+	for (size_t i = 0; i < triangles.size(); i++)
+		triangles[i] = GetTriangle(vertices[indices[i * 3]], vertices[indices[i * 3 + 1]], vertices[indices[i * 3 + 2]]);
+}
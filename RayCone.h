@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "Vertex.h"
+
+// What a triangle needs for ray cone texture LOD, precomputed per mesh
+// Must match the struct in Raytracing.hlsl
+struct RayConeTriangle
+{
+	float TexelDensity;		// 0.5 * log2(uv area / object space area)
+	float Curvature;		// Along the vertex normals (1 / radius, positive when convex)
+};
+
+// A cone around a ray: its width where it is now, and how fast that
+// grows with distance (its spread angle, in radians; negative when the
+// cone is converging, after a concave mirror or a lens)
+struct RayCone
+{
+	float Width;
+	float Spread;
+};
+
+// --------------------------------------------------------
+// Texture LOD for ray traced hits with ray cones (Ray
+// Tracing Gems, chapter 20, and the curvature estimate of
+// "Improved Shader and Texture Level of Detail Using Ray
+// Cones").  Mirrors the math in Raytracing.hlsl, so it can
+// be checked on the CPU.
+//
+// Primary rays start as a cone with no width and one
+// pixel's spread.  At each hit the width grows by the
+// spread times the distance, the footprint picks the mip
+// (with the triangle's texel density), and the surface's
+// curvature bends the spread for the next ray: a convex
+// mirror spreads the cone, a concave one or a lens can
+// focus it.
+// --------------------------------------------------------
+class RayConeLOD
+{
+public:
+	// The spread of a primary ray's cone: one pixel's angle
+	static float GetPixelSpreadAngle(float verticalFieldOfView, unsigned int screenHeight);
+
+	// The cone after travelling this far
+	static RayCone Propagate(const RayCone& cone, float distance);
+
+	// The cone leaving a hit, either way: cosIncidence is between the
+	// normal facing the ray and the reversed ray, cosTransmitted is
+	// between the reversed normal and the refracted ray, eta is the ratio
+	// of the indices (from over to), and curvature is against the normal
+	// facing the ray
+	static RayCone Reflect(const RayCone& cone, float curvature, float cosIncidence);
+	static RayCone Refract(const RayCone& cone, float curvature, float cosIncidence, float cosTransmitted, float eta);
+
+	// The mip to sample a texture at for a cone this wide hitting a
+	// triangle (in a uniformly scaled instance) at this angle
+	static float GetMipLevel(const RayConeTriangle& triangle, float width, float cosIncidence, unsigned int textureWidth, unsigned int textureHeight, float instanceScale = 1.0f);
+
+	// Texel density and curvature for every triangle of an indexed mesh
+	static RayConeTriangle GetTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+	static void ComputeTriangles(const Vertex* vertices, const unsigned int* indices, size_t indexCount, std::vector<RayConeTriangle>& triangles);
+};
@@ -1,8 +1,29 @@
 
+// Light struct and attenuation helpers (must come before PI is defined below)
+#include "Lighting.hlsli"
+
 // === Defines ===
 
 #define PI 3.141592654f
 
+// Light sampling strategies - must match LightSampler.h
+#define LIGHT_SAMPLING_UNIFORM		0
+#define LIGHT_SAMPLING_ALIAS_TABLE	1
+#define LIGHT_SAMPLING_BVH			2
+#define LIGHT_BVH_LEAF_BIT			0x80000000
+
+// ReSTIR limits - must match ReservoirResampler.h
+#define RESTIR_TEMPORAL_M_CAP				20
+#define RESTIR_NORMAL_THRESHOLD				0.9f
+#define RESTIR_PLANE_DISTANCE_THRESHOLD		0.1f
+#define RESTIR_MAX_SPATIAL_SAMPLES			8
+
+// Denoiser - must match Denoiser.h
+#define DENOISER_INVALID_INSTANCE			0xFFFFFFFF
+
+// Motion vectors - must match Reprojection.h
+#define REPROJECTION_INVALID_DEPTH			0.0f
+
 // === Structs ===
 
 // Layout of data in the vertex buffer
@@ -20,9 +41,12 @@ static const uint VertexSizeInBytes = 11 * 4; // 11 floats total per vertex * 4
 // Note: This should be as small as possible
 struct RayPayload
 {
-	float3 color;
+	float3 color;		// Throughput along the path
+	float3 radiance;	// Direct light gathered along the path
 	uint recursionDepth;
 	uint rayPerPixelIndex;
+	float coneWidth;	// Ray cone for texture LOD (see RayCone.h)
+	float coneSpread;
 	//bool inShadow;
 };
 
@@ -33,6 +57,90 @@ struct ShadowRayPayload
 	bool inShadow;
 };
 
+// Texel density and curvature of a triangle, for ray cones (see RayCone.h)
+struct RayConeTriangle
+{
+	float TexelDensity;
+	float Curvature;
+};
+
+// One entry of the importance-weighted light alias table (see LightSampler.h)
+struct LightAliasEntry
+{
+	float Probability;
+	uint Alias;
+	float Pdf;
+	uint LightIndex;
+};
+
+// One node of the light BVH (see LightSampler.h)
+struct LightBVHNode
+{
+	float3 BoundsMin;
+	float Power;
+	float3 BoundsMax;
+	float MaxRange;
+	uint ChildOrLight;
+	uint3 Padding;
+};
+
+// A chosen light and the probability of having chosen it
+struct LightSample
+{
+	int lightIndex;
+	float pdf;
+};
+
+// Per-pixel input for the denoiser (see Denoiser.h)
+struct DenoiserPixel
+{
+	float3 Color;
+	float Depth;
+	float3 Normal;
+	uint InstanceID;
+	float3 Albedo;
+	float PreviousDepth;
+	float2 Motion;
+	float2 Padding;
+};
+
+// One instance's last object to world matrix and material (see BufferStructs.h)
+#define INSTANCE_TRANSPARENT	0x1
+#define INSTANCE_EMISSIVE		0x2
+struct InstanceData
+{
+	float4 PreviousRow0;
+	float4 PreviousRow1;
+	float4 PreviousRow2;
+	uint MaterialIndex;
+	uint Flags;
+	uint2 Padding;
+};
+
+// One material (see BufferStructs.h)
+#define NO_TEXTURE	0xFFFFFFFF
+struct MaterialData
+{
+	float4 Color; // Alpha is roughness (or intensity, for emissive materials)
+	float2 UVScale;
+	float2 UVOffset;
+	uint AlbedoTexture; // Index into HeapTextures, or NO_TEXTURE
+	uint3 Padding;
+};
+
+// One pixel's light reservoir (see ReservoirResampler.h)
+struct LightReservoir
+{
+	int LightIndex;
+	float WeightSum;
+	float M;
+	float W;
+	float3 Position;
+	float TargetPdf;
+	float3 Normal;
+	float Padding;
+};
+
 // Note: We'll be using the built-in BuiltInTriangleIntersectionAttributes struct
 // for triangle attributes, so no need to define our own.  It contains a single float2.
 
@@ -51,16 +159,22 @@ cbuffer SceneData : register(b0)
 	float3 cameraPosition;
 	uint raysPerPixel;
 	uint maxRecursion;
-	float3 lightSourcePos;
-	bool inShadow;
-};
-
-
-// Ensure this matches C++ buffer struct define!
-#define MAX_INSTANCES_PER_BLAS 100
-cbuffer ObjectData : register(b1)
-{
-	float4 entityColor[MAX_INSTANCES_PER_BLAS];
+	uint lightCount;
+	uint lightSamplingStrategy;
+	uint infiniteLightCount;
+	uint infiniteAliasOffset;
+	float infiniteLightProbability;
+	uint frameIndex;
+	uint restirEnabled;
+	uint restirCandidates;
+	uint restirTemporal;
+	uint restirSpatialSamples;
+	float restirSpatialRadius;
+	uint restirHistoryValid;
+	float3 previousCameraPosition;
+	matrix previousViewProjection;
+	uint checkerboard;
+	float pixelSpreadAngle;
 };
 
 
@@ -69,16 +183,43 @@ cbuffer ObjectData : register(b1)
 // Output UAV 
 RWTexture2D<float4> OutputColor				: register(u0);
 
+// Light reservoirs for this frame and last frame (ReSTIR)
+RWStructuredBuffer<LightReservoir> CurrentReservoirs	: register(u1);
+RWStructuredBuffer<LightReservoir> PreviousReservoirs	: register(u2);
+
+// Linear color and primary hit details for the CPU denoiser
+RWStructuredBuffer<DenoiserPixel> DenoiserData			: register(u3);
+
 // The actual scene we want to trace through (a TLAS)
 RaytracingAccelerationStructure SceneTLAS	: register(t0);
 
 // Geometry buffers
 ByteAddressBuffer IndexBuffer        		: register(t1);
 ByteAddressBuffer VertexBuffer				: register(t2);
+StructuredBuffer<RayConeTriangle> TriangleCones		: register(t8);
+
+// Lights and the structures used to pick one by importance
+StructuredBuffer<Light> Lights						: register(t3);
+StructuredBuffer<LightAliasEntry> LightAliasTable	: register(t4);
+StructuredBuffer<LightBVHNode> LightBVH				: register(t5);
+
+// Each TLAS instance's data (by InstanceIndex()) and the materials it indexes
+StructuredBuffer<InstanceData> Instances	: register(t6);
+StructuredBuffer<MaterialData> Materials	: register(t7);
+
+// Every SRV in the descriptor heap, for the materials' textures
+Texture2D HeapTextures[]					: register(t0, space1);
+SamplerState TextureSampler					: register(s0);
 
 
 // === Helpers ===
 
+// Color of the hit instance's material (only valid in hit shaders)
+float4 InstanceColor()
+{
+	return Materials[Instances[InstanceIndex()].MaterialIndex].Color;
+}
+
 // Loads the indices of the specified triangle from the index buffer
 uint3 LoadIndices(uint triangleIndex)
 {
@@ -215,6 +356,491 @@ bool TryRefract(float3 incident, float3 normal, float ior, out float3 refr)
 	return true;
 }
 
+// === Ray cones ===
+// These mirror RayCone.cpp, which is the reference implementation
+
+// Grazing hits would make the footprint (and the mip) blow up
+static const float RayConeMinCosine = 0.01f;
+
+// Uniform scale of the hit instance (the triangle data is in object space)
+float InstanceScale()
+{
+	return pow(abs(determinant((float3x3)ObjectToWorld4x3())), 1.0f / 3.0f);
+}
+
+// The hit triangle's curvature in world space
+float HitCurvature()
+{
+	return TriangleCones[PrimitiveIndex()].Curvature / InstanceScale();
+}
+
+void RayConeReflect(inout RayPayload payload, float curvature, float cosIncidence)
+{
+	float footprint = payload.coneWidth / max(cosIncidence, RayConeMinCosine);
+	payload.coneSpread += 2.0f * curvature * footprint;
+}
+
+void RayConeRefract(inout RayPayload payload, float curvature, float cosIncidence, float cosTransmitted, float eta)
+{
+	cosIncidence = max(cosIncidence, RayConeMinCosine);
+	cosTransmitted = max(cosTransmitted, RayConeMinCosine);
+	float ratio = eta * cosIncidence / cosTransmitted;
+	float footprint = payload.coneWidth / cosIncidence;
+	payload.coneWidth = footprint * cosTransmitted;
+	payload.coneSpread = ratio * payload.coneSpread - (1.0f - ratio) * curvature * footprint;
+}
+
+// The mip for a texture of this size at the current hit (for SampleLevel),
+// once the cone has been carried to it
+float RayConeMipLevel(RayPayload payload, float cosIncidence, float2 textureSize)
+{
+	float level = TriangleCones[PrimitiveIndex()].TexelDensity
+		+ 0.5f * log2(textureSize.x * textureSize.y)
+		+ log2(abs(payload.coneWidth))
+		- log2(max(cosIncidence, RayConeMinCosine))
+		- log2(InstanceScale());
+	return max(level, 0.0f);
+}
+
+// The hit material's color, times its albedo texture (if it has one)
+// at the mip the ray cone picks.  Call once the cone is carried here
+float3 HitAlbedo(RayPayload payload, float2 uv, float cosIncidence)
+{
+	MaterialData material = Materials[Instances[InstanceIndex()].MaterialIndex];
+	if (material.AlbedoTexture == NO_TEXTURE)
+		return material.Color.rgb;
+
+	Texture2D albedoTexture = HeapTextures[NonUniformResourceIndex(material.AlbedoTexture)];
+	float2 textureSize;
+	albedoTexture.GetDimensions(textureSize.x, textureSize.y);
+
+	// Scaled uvs spread the texture's texels over more (or less) of the triangle
+	float mip = RayConeMipLevel(payload, cosIncidence, textureSize * abs(material.UVScale));
+	float3 albedo = albedoTexture.SampleLevel(TextureSampler, uv * material.UVScale + material.UVOffset, mip).rgb;
+	return pow(albedo, 2.2f) * material.Color.rgb;
+}
+
+// === Light sampling ===
+// These mirror LightSampler.cpp, which is the reference implementation
+
+// Picks an entry from a section of the alias table in constant time
+LightSample SampleAliasRange(uint offset, uint count, float u0, float u1)
+{
+	LightSample result;
+	result.lightIndex = -1;
+	result.pdf = 0;
+	if (count == 0)
+		return result;
+
+	uint bucket = min((uint)(u0 * count), count - 1);
+	LightAliasEntry entry = LightAliasTable[offset + bucket];
+	if (u1 >= entry.Probability)
+		entry = LightAliasTable[offset + entry.Alias];
+
+	result.lightIndex = (int)entry.LightIndex;
+	result.pdf = entry.Pdf;
+	return result;
+}
+
+// Estimated contribution of everything under a BVH node to a position
+float LightBVHNodeImportance(LightBVHNode node, float3 position)
+{
+	float3 closest = max(max(node.BoundsMin - position, 0), position - node.BoundsMax);
+	float distSq = dot(closest, closest);
+	if (node.MaxRange <= 0)
+		return 0;
+
+	float att = saturate(1.0f - distSq / (node.MaxRange * node.MaxRange));
+	return node.Power * att * att;
+}
+
+// Walks the light BVH, picking children by their importance
+LightSample SampleLightBVH(float3 position, float u0, float u1)
+{
+	// Directional lights live outside the BVH
+	if (u1 < infiniteLightProbability)
+	{
+		LightSample infiniteSample = SampleAliasRange(infiniteAliasOffset, infiniteLightCount, u0, u1 / infiniteLightProbability);
+		infiniteSample.pdf *= infiniteLightProbability;
+		return infiniteSample;
+	}
+
+	LightSample result;
+	result.lightIndex = -1;
+	result.pdf = 1.0f - infiniteLightProbability;
+
+	uint nodeIndex = 0;
+	[loop]
+	while (!(LightBVH[nodeIndex].ChildOrLight & LIGHT_BVH_LEAF_BIT))
+	{
+		uint left = nodeIndex + 1;
+		uint right = LightBVH[nodeIndex].ChildOrLight;
+		float importanceLeft = LightBVHNodeImportance(LightBVH[left], position);
+		float importanceRight = LightBVHNodeImportance(LightBVH[right], position);
+		float total = importanceLeft + importanceRight;
+		if (total <= 0)
+		{
+			result.pdf = 0;
+			return result;
+		}
+
+		// Pick a side and rescale the random number for the next level
+		float probLeft = importanceLeft / total;
+		if (u0 < probLeft)
+		{
+			u0 = u0 / probLeft;
+			result.pdf *= probLeft;
+			nodeIndex = left;
+		}
+		else
+		{
+			u0 = (u0 - probLeft) / (1.0f - probLeft);
+			result.pdf *= 1.0f - probLeft;
+			nodeIndex = right;
+		}
+		u0 = min(u0, 0.99999994f);
+	}
+
+	result.lightIndex = (int)(LightBVH[nodeIndex].ChildOrLight & ~LIGHT_BVH_LEAF_BIT);
+	return result;
+}
+
+// Picks one light using the current strategy
+LightSample SampleLight(float3 position, float u0, float u1)
+{
+	LightSample result;
+	result.lightIndex = -1;
+	result.pdf = 0;
+	if (lightCount == 0)
+		return result;
+
+	switch (lightSamplingStrategy)
+	{
+	case LIGHT_SAMPLING_UNIFORM:
+		result.lightIndex = (int)min((uint)(u0 * lightCount), lightCount - 1);
+		result.pdf = 1.0f / lightCount;
+		return result;
+
+	case LIGHT_SAMPLING_ALIAS_TABLE:
+		return SampleAliasRange(0, lightCount, u0, u1);
+
+	default:
+		return SampleLightBVH(position, u0, u1);
+	}
+}
+
+// Light arriving at a position from a light, ignoring visibility,
+// along with the direction and distance to trace a shadow ray
+float3 UnshadowedLight(Light light, float3 position, float3 normal, out float3 toLight, out float maxDistance)
+{
+	float3 contribution = light.Color * light.Intensity;
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+	{
+		toLight = normalize(-light.Direction);
+		maxDistance = 1000.0f;
+	}
+	else
+	{
+		toLight = normalize(light.Position - position);
+		maxDistance = distance(light.Position, position);
+		contribution *= Attenuate(light, position);
+
+		if (light.Type == LIGHT_TYPE_SPOT)
+			contribution *= pow(saturate(dot(-toLight, normalize(light.Direction))), light.SpotFalloff);
+	}
+	return contribution * saturate(dot(normal, toLight));
+}
+
+// Scalar version of the above, used as the ReSTIR target function
+// Must match LightSampler::UnshadowedContribution()
+float LightTargetPdf(uint lightIndex, float3 position, float3 normal)
+{
+	float3 toLight;
+	float maxDistance;
+	float3 contribution = UnshadowedLight(Lights[lightIndex], position, normal, toLight, maxDistance);
+	return dot(contribution, float3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Traces a shadow ray and returns true if nothing is in the way
+bool IsLightVisible(float3 position, float3 normal, float3 toLight, float maxDistance)
+{
+	RayDesc shadowRay;
+	shadowRay.Origin = position + normal * 0.02f; //offset tiny amount to make smoother shadow edges
+	shadowRay.Direction = toLight;
+	shadowRay.TMin = 0.0001f;
+	shadowRay.TMax = maxDistance;
+
+	//shadow ray
+	ShadowRayPayload shadowPayload;
+	shadowPayload.inShadow = true;
+
+	TraceRay(SceneTLAS,
+		RAY_FLAG_FORCE_OPAQUE //these flag mean we stop when we get any hit
+		| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH //and don't execute the hit shader
+		| RAY_FLAG_SKIP_CLOSEST_HIT_SHADER,
+		0xFF,
+		0,
+		0,
+		1,//skip first miss shader and use second
+		shadowRay,
+		shadowPayload);
+
+	//the miss shadow will turn this value false
+	//so if we din't trigger the miss, we hit an 
+	//object and are in shadow
+	return !shadowPayload.inShadow;
+}
+
+// Picks a single light by importance, traces one shadow ray towards
+// it and returns its contribution divided by its pdf
+float3 SampleDirectLight(float3 position, float3 normal, float2 rng)
+{
+	LightSample lightSample = SampleLight(position, rng.x, rng.y);
+	if (lightSample.lightIndex < 0 || lightSample.pdf <= 0)
+		return float3(0, 0, 0);
+
+	float3 toLight;
+	float maxDistance;
+	float3 contribution = UnshadowedLight(Lights[lightSample.lightIndex], position, normal, toLight, maxDistance);
+
+	// Don't bother tracing if this light can't contribute anyway
+	if (all(contribution <= 0) || !IsLightVisible(position, normal, toLight, maxDistance))
+		return float3(0, 0, 0);
+
+	return contribution / lightSample.pdf;
+}
+
+// === Motion vectors ===
+
+// Where the current hit was last frame: returns the screen UV offset from
+// this pixel to there, plus its distance from last frame's camera
+// (REPROJECTION_INVALID_DEPTH if it was behind that camera).
+// Only valid in hit shaders.  Matches Reprojection::MotionVector().
+float2 HitMotionVector(out float previousDepth)
+{
+	// Object space hit, moved with last frame's object to world matrix
+	float4 objectPosition = float4(ObjectRayOrigin() + ObjectRayDirection() * RayTCurrent(), 1);
+	InstanceData instance = Instances[InstanceIndex()];
+	float3 previousPosition = float3(
+		dot(instance.PreviousRow0, objectPosition),
+		dot(instance.PreviousRow1, objectPosition),
+		dot(instance.PreviousRow2, objectPosition));
+
+	// Then projected with last frame's camera
+	float4 previousClip = mul(previousViewProjection, float4(previousPosition, 1));
+	if (previousClip.w <= 0)
+	{
+		previousDepth = REPROJECTION_INVALID_DEPTH;
+		return float2(0, 0);
+	}
+
+	float2 previousUV = previousClip.xy / previousClip.w * float2(0.5f, -0.5f) + 0.5f;
+	float2 uv = ((float2)DispatchRaysIndex().xy + 0.5f) / (float2)DispatchRaysDimensions().xy;
+	previousDepth = length(previousPosition - previousCameraPosition);
+	return previousUV - uv;
+}
+
+// === ReSTIR ===
+// These mirror ReservoirResampler.cpp, which is the reference implementation
+
+// Hash based random numbers so every pixel and frame gets its own stream
+uint HashPixel(uint pixel, uint frame, uint pass)
+{
+	uint h = pixel * 747796405u + frame * 2891336453u + pass * 277803737u;
+	h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+	return (h >> 22u) ^ h;
+}
+
+float NextRandom(inout uint state)
+{
+	state = state * 747796405u + 2891336453u;
+	uint h = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	h = (h >> 22u) ^ h;
+	return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+LightReservoir EmptyReservoir(float3 position, float3 normal)
+{
+	LightReservoir reservoir;
+	reservoir.LightIndex = -1;
+	reservoir.WeightSum = 0;
+	reservoir.M = 0;
+	reservoir.W = 0;
+	reservoir.Position = position;
+	reservoir.TargetPdf = 0;
+	reservoir.Normal = normal;
+	reservoir.Padding = 0;
+	return reservoir;
+}
+
+// Streams one candidate through a reservoir
+void UpdateReservoir(inout LightReservoir reservoir, int lightIndex, float weight, float targetPdf, float u)
+{
+	reservoir.WeightSum += weight;
+	reservoir.M += 1.0f;
+	if (weight > 0 && u * reservoir.WeightSum < weight)
+	{
+		reservoir.LightIndex = lightIndex;
+		reservoir.TargetPdf = targetPdf;
+	}
+}
+
+void FinalizeReservoir(inout LightReservoir reservoir)
+{
+	reservoir.W = (reservoir.LightIndex >= 0 && reservoir.TargetPdf > 0 && reservoir.M > 0) ?
+		reservoir.WeightSum / (reservoir.M * reservoir.TargetPdf) : 0;
+}
+
+// Is another reservoir's surface similar enough to reuse?
+bool CanReuse(LightReservoir reservoir, LightReservoir other)
+{
+	// Also guards against anything left over from a different light set
+	if (other.M <= 0 || other.LightIndex >= (int)lightCount)
+		return false;
+
+	if (dot(reservoir.Normal, other.Normal) < RESTIR_NORMAL_THRESHOLD)
+		return false;
+
+	return abs(dot(other.Position - reservoir.Position, reservoir.Normal)) < RESTIR_PLANE_DISTANCE_THRESHOLD;
+}
+
+// Picks one light per pixel from several candidates, last frame's
+// reservoir and last frame's neighbours, then shades with it using
+// a single shadow ray.  Only runs for primary hits.
+float3 ReSTIRDirectLight(float3 position, float3 normal, uint rayPerPixelIndex)
+{
+	uint2 pixelIndex = DispatchRaysIndex().xy;
+	uint2 dimensions = DispatchRaysDimensions().xy;
+	uint pixel = pixelIndex.y * dimensions.x + pixelIndex.x;
+	uint rng = HashPixel(pixel, frameIndex, rayPerPixelIndex);
+
+	// Initial candidates from the regular light sampler
+	LightReservoir initial = EmptyReservoir(position, normal);
+	for (uint c = 0; c < restirCandidates; c++)
+	{
+		float u0 = NextRandom(rng);
+		float u1 = NextRandom(rng);
+		LightSample candidate = SampleLight(position, u0, u1);
+		if (candidate.lightIndex < 0 || candidate.pdf <= 0)
+		{
+			initial.M += 1.0f;
+			continue;
+		}
+
+		float targetPdf = LightTargetPdf(candidate.lightIndex, position, normal);
+		UpdateReservoir(initial, candidate.lightIndex, targetPdf / candidate.pdf, targetPdf, NextRandom(rng));
+	}
+	FinalizeReservoir(initial);
+
+	// Gather reusable reservoirs from last frame: this pixel, then neighbours.
+	// Neighbours come from last frame too, since this frame's aren't done yet.
+	LightReservoir reservoirs[RESTIR_MAX_SPATIAL_SAMPLES + 2];
+	reservoirs[0] = initial;
+	uint count = 1;
+	if (restirHistoryValid)
+	{
+		float maxTemporalM = RESTIR_TEMPORAL_M_CAP * max(restirCandidates, 1);
+
+		// Follow the motion vector to where this surface was last frame
+		float previousDepth;
+		float2 motion = HitMotionVector(previousDepth);
+		int2 previousPixel = (int2)floor(((float2)pixelIndex + 0.5f) + motion * (float2)dimensions);
+		if (restirTemporal && previousDepth != REPROJECTION_INVALID_DEPTH &&
+			all(previousPixel >= 0) && all(previousPixel < (int2)dimensions))
+		{
+			LightReservoir previous = PreviousReservoirs[previousPixel.y * dimensions.x + previousPixel.x];
+			if (CanReuse(initial, previous))
+			{
+				previous.M = min(previous.M, maxTemporalM);
+				reservoirs[count++] = previous;
+			}
+		}
+
+		uint spatialSamples = min(restirSpatialSamples, RESTIR_MAX_SPATIAL_SAMPLES);
+		for (uint s = 0; s < spatialSamples; s++)
+		{
+			float angle = NextRandom(rng) * 2.0f * PI;
+			float radius = sqrt(NextRandom(rng)) * restirSpatialRadius;
+			int2 neighbour = (int2)pixelIndex + int2(cos(angle) * radius, sin(angle) * radius);
+			if (any(neighbour < 0) || any(neighbour >= (int2)dimensions) || all(neighbour == (int2)pixelIndex))
+				continue;
+
+			LightReservoir other = PreviousReservoirs[neighbour.y * dimensions.x + neighbour.x];
+			if (CanReuse(initial, other))
+			{
+				other.M = min(other.M, maxTemporalM);
+				reservoirs[count++] = other;
+			}
+		}
+	}
+
+	// Resample them all with generalized balance heuristic weights
+	LightReservoir result = EmptyReservoir(position, normal);
+	for (uint i = 0; i < count; i++)
+	{
+		LightReservoir candidate = reservoirs[i];
+		result.M += candidate.M;
+		if (candidate.LightIndex < 0 || candidate.W <= 0)
+			continue;
+
+		float misDenominator = 0;
+		for (uint j = 0; j < count; j++)
+		{
+			float targetPdf = j == i ? candidate.TargetPdf : LightTargetPdf(candidate.LightIndex, reservoirs[j].Position, reservoirs[j].Normal);
+			misDenominator += reservoirs[j].M * targetPdf;
+		}
+		if (misDenominator <= 0)
+			continue;
+
+		float misWeight = candidate.M * candidate.TargetPdf / misDenominator;
+		float targetPdfHere = i == 0 ? candidate.TargetPdf : LightTargetPdf(candidate.LightIndex, position, normal);
+		float weight = misWeight * targetPdfHere * candidate.W;
+		result.WeightSum += weight;
+		if (weight > 0 && NextRandom(rng) * result.WeightSum < weight)
+		{
+			result.LightIndex = candidate.LightIndex;
+			result.TargetPdf = targetPdfHere;
+		}
+	}
+	result.W = (result.LightIndex >= 0 && result.TargetPdf > 0) ? result.WeightSum / result.TargetPdf : 0;
+
+	// One writer per pixel
+	if (rayPerPixelIndex == 0)
+		CurrentReservoirs[pixel] = result;
+
+	if (result.LightIndex < 0 || result.W <= 0)
+		return float3(0, 0, 0);
+
+	// Shade with the one chosen light
+	float3 toLight;
+	float maxDistance;
+	float3 contribution = UnshadowedLight(Lights[result.LightIndex], position, normal, toLight, maxDistance);
+	if (all(contribution <= 0) || !IsLightVisible(position, normal, toLight, maxDistance))
+		return float3(0, 0, 0);
+
+	return contribution * result.W;
+}
+
+// === Denoiser output ===
+
+// Primary hit details for the denoiser, written once per pixel
+// (by the first ray) since later rays are jittered
+void WriteDenoiserHit(uint rayPerPixelIndex, float3 normal, float3 albedo)
+{
+	if (rayPerPixelIndex != 0)
+		return;
+
+	uint2 pixelIndex = DispatchRaysIndex().xy;
+	uint pixel = pixelIndex.y * DispatchRaysDimensions().x + pixelIndex.x;
+	float previousDepth;
+	DenoiserData[pixel].Motion = HitMotionVector(previousDepth);
+	DenoiserData[pixel].PreviousDepth = previousDepth;
+	DenoiserData[pixel].Depth = RayTCurrent();
+	DenoiserData[pixel].Normal = normal;
+	DenoiserData[pixel].InstanceID = InstanceIndex();
+	DenoiserData[pixel].Albedo = albedo;
+}
+
 // === Shaders ===
 
 // Ray generation shader - Launched once for each ray we want to generate
@@ -226,6 +852,29 @@ void RayGen()
 	uint2 rayIndices = DispatchRaysIndex().xy;
 	float3 totalColor = float3(0, 0, 0);
 
+	uint pixel = rayIndices.y * DispatchRaysDimensions().x + rayIndices.x;
+
+	// Start with an empty reservoir in case the primary ray misses
+	// (the hit shader replaces it if ReSTIR runs for this pixel)
+	CurrentReservoirs[pixel] = EmptyReservoir(float3(0, 0, 0), float3(0, 0, 0));
+
+	// Same for the denoiser's data - a miss looks like this
+	DenoiserPixel missed;
+	missed.Color = float3(0, 0, 0);
+	missed.Depth = 0;
+	missed.Normal = float3(0, 0, 0);
+	missed.InstanceID = DENOISER_INVALID_INSTANCE;
+	missed.Albedo = float3(1, 1, 1);
+	missed.PreviousDepth = REPROJECTION_INVALID_DEPTH;
+	missed.Motion = float2(0, 0);
+	missed.Padding = float2(0, 0);
+	DenoiserData[pixel] = missed;
+
+	// Checkerboarding traces every other pixel, alternating each frame
+	// (must match Upscaler::IsTraced) - the CPU fills in the rest
+	if (checkerboard && ((rayIndices.x + rayIndices.y + frameIndex) & 1))
+		return;
+
 	for (uint r = 0; r < raysPerPixel; r++) {
 		//move ray slightly off from pixel 
 		//so not all are going through the same spot
@@ -248,8 +897,11 @@ void RayGen()
 		// This initializes the struct to all zeros
 		RayPayload payload;
 		payload.color = float3(1, 1, 1);
+		payload.radiance = float3(0, 0, 0);
 		payload.recursionDepth = 0;
 		payload.rayPerPixelIndex = r;
+		payload.coneWidth = 0.0f;
+		payload.coneSpread = pixelSpreadAngle;
 
 		// Perform the ray trace for this ray
 		TraceRay(
@@ -262,12 +914,15 @@ void RayGen()
 			ray,
 			payload);
 
-		totalColor += payload.color;
+		totalColor += payload.color + payload.radiance;
 	}
 
 	//average total color
 	totalColor /= raysPerPixel;
 
+	// Linear color for the denoiser
+	DenoiserData[pixel].Color = totalColor;
+
 	// Set the final color of the buffer (gamma corrected)
 	OutputColor[rayIndices] = float4(pow(totalColor, 1.0f / 2.2f), 1);
 }
@@ -316,47 +971,41 @@ void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes
 	//calculate normal in world space
 	float3 normal_WS = normalize(mul(hit.normal, (float3x3)ObjectToWorld4x3()));
 
-	RayDesc shadowRay;
-	shadowRay.Origin = worldOrigin + normal_WS * 0.02f;//offset tiny amount to make smoother shadow edges
-	shadowRay.Direction = normalize(lightSourcePos - worldOrigin);
-	shadowRay.TMin = 0.0001f;
-	shadowRay.TMax = distance(worldOrigin, lightSourcePos);
-
-	//shadow ray
-	ShadowRayPayload shadowPayload;
-	shadowPayload.inShadow = true;
-
-	TraceRay(SceneTLAS,
-		RAY_FLAG_FORCE_OPAQUE //these flag mean we stop when we get any hit
-		| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH //and don't execute the hit shader
-		| RAY_FLAG_SKIP_CLOSEST_HIT_SHADER,
-		0xFF,
-		0,
-		0,
-		1,//skip first miss shader and use second
-		shadowRay,
-		shadowPayload);
+	//carry the ray cone here (its width now picks this hit's texture mips)
+	payload.coneWidth += payload.coneSpread * RayTCurrent();
+	float cosIncidence = abs(dot(WorldRayDirection(), normal_WS));
+	float3 albedo = HitAlbedo(payload, hit.uv, cosIncidence);
 
-	//the miss shadow will turn this value false
-	//so if we din't trigger the miss, we hit an 
-	//object and are in shadow
-	if (shadowPayload.inShadow) {
-		payload.color = float3(0, 0, 0);
-		return;
-	}
+	if (payload.recursionDepth == 0)
+		WriteDenoiserHit(payload.rayPerPixelIndex, normal_WS, albedo);
 
 	// we've hit something so update color
-	payload.color *= entityColor[InstanceID()].rgb;
+	payload.color *= albedo;
 
 	//get a unique rng value to offset this ray from other from same pixel
 	float2 uv = (float2)DispatchRaysIndex() / (float2)DispatchRaysDimensions();
 	float2 rng = Rand2(uv * (payload.recursionDepth + 1) + payload.rayPerPixelIndex + RayTCurrent());
 
+	//direct light from one light picked by importance (one shadow ray per bounce)
+	//primary hits can resample their light with ReSTIR instead
+	if (restirEnabled && payload.recursionDepth == 0)
+	{
+		payload.radiance += payload.color * ReSTIRDirectLight(worldOrigin, normal_WS, payload.rayPerPixelIndex);
+	}
+	else
+	{
+		float2 lightRng = float2(Rand(rng * 1.7f + 0.31f), Rand(rng.yx * 2.3f + 0.77f));
+		payload.radiance += payload.color * SampleDirectLight(worldOrigin, normal_WS, lightRng);
+	}
+
 	//lerp between perfect reflection and random bounce based on roughness
 	float3 refl = reflect(WorldRayDirection(), normal_WS);
 	float3 randomBounce = RandomCosineWeightedHemisphere(Rand(rng), Rand(rng.yx), normal_WS);
 	//use alpha channel as roughness
-	float3 dir = normalize(lerp(refl, randomBounce, saturate(pow(entityColor[InstanceID()].a,2))));
+	float3 dir = normalize(lerp(refl, randomBounce, saturate(pow(InstanceColor().a,2))));
+
+	//the cone leaves as if from a mirror (rough bounces included)
+	RayConeReflect(payload, HitCurvature() * (dot(WorldRayDirection(), normal_WS) > 0 ? -1.0f : 1.0f), cosIncidence);
 
 	RayDesc ray;
 	ray.Origin = WorldRayOrigin() + (WorldRayDirection() * RayTCurrent());
@@ -386,7 +1035,7 @@ void ClosestHitTransparent(inout RayPayload payload, BuiltInTriangleIntersection
 	}
 
 	// we've hit something so update color
-	payload.color *= entityColor[InstanceID()].rgb;
+	payload.color *= InstanceColor().rgb;
 
 	// Grab the index of the triangle we hit
 	//and pass to helper func to get Vertex details
@@ -395,19 +1044,27 @@ void ClosestHitTransparent(inout RayPayload payload, BuiltInTriangleIntersection
 	//calculate normal in world space
 	float3 normal_WS = normalize(mul(hit.normal, (float3x3)ObjectToWorld4x3()));
 
+	if (payload.recursionDepth == 0)
+		WriteDenoiserHit(payload.rayPerPixelIndex, normal_WS, InstanceColor().rgb);
+
+	//carry the ray cone here
+	payload.coneWidth += payload.coneSpread * RayTCurrent();
+
 	//get a unique rng value to offset this ray from other from same pixel
 	float2 uv = (float2)DispatchRaysIndex() / (float2)DispatchRaysDimensions();
 	float2 rng = Rand2(uv * (payload.recursionDepth + 1) + payload.rayPerPixelIndex + RayTCurrent());
 
 	//get index of refraction depending on which side of object we're on (outside/inside)
 	float ior = 1.5f;
+	float curvature = HitCurvature();
 	if (HitKind() == HIT_KIND_TRIANGLE_FRONT_FACE) {
 		//invert ior for front faces
 		ior = 1.0f / ior;
 	}
 	else {
-		//invert normal for back faces
+		//invert normal (and so curvature) for back faces
 		normal_WS *= -1;
+		curvature *= -1;
 	}
 
 	//random chance for reflection instead of refraction
@@ -418,13 +1075,16 @@ void ClosestHitTransparent(inout RayPayload payload, BuiltInTriangleIntersection
 	float3 dir;
 	if (reflectFresnel || !TryRefract(WorldRayDirection(), normal_WS, ior, dir)) {
 			dir = reflect(WorldRayDirection(), normal_WS);
-
+			RayConeReflect(payload, curvature, NdotV);
+	}
+	else {
+		RayConeRefract(payload, curvature, NdotV, -dot(dir, normal_WS), ior);
 	}
 
 	//lerp between perfect refraction/reflection and random bounce based on roughness squard
 	float3 randomBounce = RandomCosineWeightedHemisphere(Rand(rng), Rand(rng.yx), normal_WS);
 	//use alpha channel as roughness
-	dir = normalize(lerp(dir, randomBounce, saturate(pow(entityColor[InstanceID()].a, 2))));
+	dir = normalize(lerp(dir, randomBounce, saturate(pow(InstanceColor().a, 2))));
 
 	RayDesc ray;
 	ray.Origin = WorldRayOrigin() + (WorldRayDirection() * RayTCurrent());
@@ -446,6 +1106,10 @@ void ClosestHitTransparent(inout RayPayload payload, BuiltInTriangleIntersection
 //closest hit for emissive objects
 [shader("closesthit")]
 void ClosestHitEmissive(inout RayPayload payload, BuiltInTriangleIntersectionAttributes hitAttributes) {
-	float4 color = entityColor[InstanceID()];
+	float4 color = InstanceColor();
 	payload.color = color.rgb * color.a;//use a as intensity
+
+	//no normal needed for lights, so just face the camera
+	if (payload.recursionDepth == 0)
+		WriteDenoiserHit(payload.rayPerPixelIndex, -WorldRayDirection(), color.rgb);
 }
\ No newline at end of file
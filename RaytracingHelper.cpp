@@ -3,6 +3,7 @@
 #include "BufferStructs.h"
 
 #include <d3dcompiler.h>
+#include <chrono>
 #include <DirectXMath.h>
 
 using namespace DirectX;
@@ -47,6 +48,8 @@ void RaytracingHelper::Initialize(
 	this->commandQueue = commandQueue;
 	this->screenWidth = screenWidth;
 	this->screenHeight = screenHeight;
+	this->renderWidth = screenWidth;
+	this->renderHeight = screenHeight;
 
 	// Query to see if DXR is supported on this hardware
 	HRESULT dxrDeviceResult = device->QueryInterface(IID_PPV_ARGS(dxrDevice.GetAddressOf()));
@@ -65,6 +68,10 @@ void RaytracingHelper::Initialize(
 	dxrAvailable = true;
 	printf("DXR initialization success - DirectX Raytracing is available on this hardware!\n");
 
+	// BLASes are compacted with the same command list
+	blasCompaction.Initialize(dxrCommandList);
+	accelerationStructures.Initialize(&blasCompaction);
+
 	// Proceed with setup
 	CreateRaytracingRootSignatures();
 	CreateRaytracingPipelineState(raytracingShaderLibraryFile);
@@ -89,9 +96,7 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 
 	// Create a global root signature shared across all raytracing shaders
 	{
-		// Two descriptor ranges
-		// 1: The output texture, which is an unordered access view (UAV)
-		// 2: Two separate SRVs, which are the index and vertex data of the geometry
+		// One descriptor range: the output texture, which is an unordered access view (UAV)
 		D3D12_DESCRIPTOR_RANGE outputUAVRange = {};
 		outputUAVRange.BaseShaderRegister = 0;
 		outputUAVRange.NumDescriptors = 1;
@@ -99,16 +104,17 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 		outputUAVRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
 		outputUAVRange.RegisterSpace = 0;
 
-		D3D12_DESCRIPTOR_RANGE cbufferRange = {};
-		cbufferRange.BaseShaderRegister = 0;
-		cbufferRange.NumDescriptors = 1;
-		cbufferRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
-		cbufferRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-		cbufferRange.RegisterSpace = 0;
+		// And one over every SRV in the heap, which materials index for their textures
+		D3D12_DESCRIPTOR_RANGE heapSRVRange = {};
+		heapSRVRange.BaseShaderRegister = 0;
+		heapSRVRange.NumDescriptors = UINT_MAX; // Unbounded
+		heapSRVRange.OffsetInDescriptorsFromTableStart = 0;
+		heapSRVRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+		heapSRVRange.RegisterSpace = 1;
 
-		// Set up the root parameters for the global signature (of which there are four)
+		// Set up the root parameters for the global signature (of which there are twelve)
 		// These need to match the shader(s) we'll be using
-		D3D12_ROOT_PARAMETER rootParams[3] = {};
+		D3D12_ROOT_PARAMETER rootParams[12] = {};
 		{
 			// First param is the UAV range for the output texture
 			rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
@@ -123,20 +129,68 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 			rootParams[1].Descriptor.RegisterSpace = 0;
 
 			// Third is constant buffer for the overall scene (camera matrices, lights, etc.)
-			rootParams[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+			// as a root CBV, so it doesn't need a descriptor each frame
+			rootParams[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
 			rootParams[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-			rootParams[2].DescriptorTable.NumDescriptorRanges = 1;
-			rootParams[2].DescriptorTable.pDescriptorRanges = &cbufferRange;
+			rootParams[2].Descriptor.ShaderRegister = 0;
+			rootParams[2].Descriptor.RegisterSpace = 0;
+
+			// Fourth, fifth and sixth are the lights, their alias table and their BVH
+			// These are structured buffers, so they can be root SRVs at register(t3) - register(t5)
+			for (unsigned int i = 3; i < 6; i++)
+			{
+				rootParams[i].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+				rootParams[i].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+				rootParams[i].Descriptor.ShaderRegister = i;
+				rootParams[i].Descriptor.RegisterSpace = 0;
+			}
+
+			// Next two are this frame's and last frame's light reservoirs at register(u1) and register(u2)
+			// Then the denoiser's per-pixel data at register(u3)
+			for (unsigned int i = 6; i < 9; i++)
+			{
+				rootParams[i].ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV;
+				rootParams[i].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+				rootParams[i].Descriptor.ShaderRegister = i - 5;
+				rootParams[i].Descriptor.RegisterSpace = 0;
+			}
+
+			// And the instance data and material table at register(t6) and register(t7)
+			for (unsigned int i = 9; i < 11; i++)
+			{
+				rootParams[i].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+				rootParams[i].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+				rootParams[i].Descriptor.ShaderRegister = i - 3;
+				rootParams[i].Descriptor.RegisterSpace = 0;
+			}
+
+			// Last is the whole heap's SRVs at register(t0, space1)
+			rootParams[11].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+			rootParams[11].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+			rootParams[11].DescriptorTable.NumDescriptorRanges = 1;
+			rootParams[11].DescriptorTable.pDescriptorRanges = &heapSRVRange;
 		}
 
+		// Trilinear wrap sampler for material textures; the hit shaders
+		// pick the mip themselves (from the ray cone) with SampleLevel
+		D3D12_STATIC_SAMPLER_DESC linearWrap = {};
+		linearWrap.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+		linearWrap.AddressV = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+		linearWrap.AddressW = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+		linearWrap.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+		linearWrap.MaxLOD = D3D12_FLOAT32_MAX;
+		linearWrap.ShaderRegister = 0; // register(s0)
+		linearWrap.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+		D3D12_STATIC_SAMPLER_DESC samplers[] = { linearWrap };
+
 		// Create the global root signature
 		Microsoft::WRL::ComPtr<ID3DBlob> blob;
 		Microsoft::WRL::ComPtr<ID3DBlob> errors;
 		D3D12_ROOT_SIGNATURE_DESC globalRootSigDesc = {};
 		globalRootSigDesc.NumParameters = ARRAYSIZE(rootParams);
 		globalRootSigDesc.pParameters = rootParams;
-		globalRootSigDesc.NumStaticSamplers = 0;
-		globalRootSigDesc.pStaticSamplers = 0;
+		globalRootSigDesc.NumStaticSamplers = ARRAYSIZE(samplers);
+		globalRootSigDesc.pStaticSamplers = samplers;
 		globalRootSigDesc.Flags = D3D12_ROOT_SIGNATURE_FLAG_NONE;
 
 		D3D12SerializeRootSignature(&globalRootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, blob.GetAddressOf(), errors.GetAddressOf());
@@ -145,36 +199,26 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 
 	// Create a local root signature enabling shaders to have unique data from shader tables
 	{
-		// cbuffer for hit group data
-		D3D12_DESCRIPTOR_RANGE cbufferRange = {};
-		cbufferRange.BaseShaderRegister = 1;
-		cbufferRange.NumDescriptors = 1;
-		cbufferRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
-		cbufferRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-		cbufferRange.RegisterSpace = 0;
-
-		// Table of 2 starting at register(t1)
-		D3D12_DESCRIPTOR_RANGE geometrySRVRange = {};
-		geometrySRVRange.BaseShaderRegister = 1;
-		geometrySRVRange.NumDescriptors = 2;
-		geometrySRVRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
-		geometrySRVRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-		geometrySRVRange.RegisterSpace = 0;
-
-		// Two params: Tables for constant buffer and geometry
-		D3D12_ROOT_PARAMETER rootParams[2] = {};
-
-		// Constant buffer at register(b1)
+		// Table of 2 starting at register(t1), then 1 at register(t8)
+		D3D12_DESCRIPTOR_RANGE geometrySRVRanges[2] = {};
+		geometrySRVRanges[0].BaseShaderRegister = 1;
+		geometrySRVRanges[0].NumDescriptors = 2;
+		geometrySRVRanges[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+		geometrySRVRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+		geometrySRVRanges[0].RegisterSpace = 0;
+		geometrySRVRanges[1] = geometrySRVRanges[0];
+		geometrySRVRanges[1].BaseShaderRegister = 8;
+		geometrySRVRanges[1].NumDescriptors = 1;
+
+		// One param: a table for geometry (per-instance data is indexed
+		// from a global buffer instead)
+		D3D12_ROOT_PARAMETER rootParams[1] = {};
+
+		// Range of SRVs for geometry (verts & indices, and ray cone triangle data)
 		rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 		rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-		rootParams[0].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[0].DescriptorTable.pDescriptorRanges = &cbufferRange;
-
-		// Range of SRVs for geometry (verts & indices)
-		rootParams[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-		rootParams[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-		rootParams[1].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[1].DescriptorTable.pDescriptorRanges = &geometrySRVRange;
+		rootParams[0].DescriptorTable.NumDescriptorRanges = ARRAYSIZE(geometrySRVRanges);
+		rootParams[0].DescriptorTable.pDescriptorRanges = geometrySRVRanges;
 
 		// Create the local root sig (ensure we denote it as a local sig)
 		Microsoft::WRL::ComPtr<ID3DBlob> blob;
@@ -188,6 +232,21 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 
 		D3D12SerializeRootSignature(&localRootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, blob.GetAddressOf(), errors.GetAddressOf());
 		dxrDevice->CreateRootSignature(1, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(localRaytracingRootSig.GetAddressOf()));
+
+		// Every shader uses this local root sig, so each section of the
+		// shader table has the same record layout
+		ShaderRecordArgument recordArguments[ARRAYSIZE(rootParams)] = {};
+		for (unsigned int i = 0; i < ARRAYSIZE(rootParams); i++)
+		{
+			recordArguments[i].Type = (ShaderRecordArgumentType)rootParams[i].ParameterType;
+			if (rootParams[i].ParameterType == D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS)
+				recordArguments[i].Constants = rootParams[i].Constants.Num32BitValues;
+		}
+
+		shaderTableBuilder.Initialize(SHADER_TABLE_COPIES);
+		shaderTableBuilder.SetLayout(SHADER_TABLE_RAY_GEN, recordArguments, ARRAYSIZE(recordArguments));
+		shaderTableBuilder.SetLayout(SHADER_TABLE_MISS, recordArguments, ARRAYSIZE(recordArguments));
+		shaderTableBuilder.SetLayout(SHADER_TABLE_HIT_GROUP, recordArguments, ARRAYSIZE(recordArguments));
 	}
 }
 
@@ -329,8 +388,8 @@ void RaytracingHelper::CreateRaytracingPipelineState(std::wstring raytracingShad
 	// === Shader config (payload) ===
 	{
 		D3D12_RAYTRACING_SHADER_CONFIG shaderConfigDesc[2] = {};
-		// Float3 color, uint for recursion depth and ray pixel index
-		shaderConfigDesc[0].MaxPayloadSizeInBytes = sizeof(DirectX::XMFLOAT3) + (sizeof(unsigned int) * 2);
+		// Float3 color, float3 radiance, uint for recursion depth and ray pixel index
+		shaderConfigDesc[0].MaxPayloadSizeInBytes = sizeof(DirectX::XMFLOAT3) * 2 + (sizeof(unsigned int) * 2) + sizeof(RayCone);
 		shaderConfigDesc[0].MaxAttributeSizeInBytes = sizeof(DirectX::XMFLOAT2); // Float2 for barycentric coords
 
 		shaderConfigDesc[1].MaxPayloadSizeInBytes = sizeof(unsigned int);//one bool to track if pixel is in shadow
@@ -465,8 +524,13 @@ void RaytracingHelper::CreateRaytracingPipelineState(std::wstring raytracingShad
 		raytracingPipelineDesc.NumSubobjects = ARRAYSIZE(subobjects);
 		raytracingPipelineDesc.pSubobjects = subobjects;
 
-		// Create the state and also query it for its properties
+		// Create the state and also query it for its properties.  State objects
+		// have no cached blobs (and pipeline libraries can't hold them), so
+		// this compiles every launch - it's only timed.
+		auto start = std::chrono::high_resolution_clock::now();
 		dxrDevice->CreateStateObject(&raytracingPipelineDesc, IID_PPV_ARGS(raytracingPipelineStateObject.GetAddressOf()));
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		DX12Helper::GetInstance().AddPipelineTiming("Raytracing state object", elapsed.count());
 		raytracingPipelineStateObject->QueryInterface(IID_PPV_ARGS(&raytracingPipelineProperties));
 	}
 }
@@ -483,118 +547,190 @@ void RaytracingHelper::CreateShaderTable()
 	if (!dxrAvailable)
 		return;
 
-	// Create the table of shaders and their data to use for rays
-	// 0 - Ray generation shader
-	// 1 - Miss shader
-	// 2 - Closest hit shader
-	// Note: All records must have the same size, so we need to calculate
-	//       the size of the largest possible entry for our program
-	//       - This also must be aligned up to D3D12_RAYTRACING_SHADER_BINDING_TABLE_RECORD_BYTE_ALIGNMENT
+	// Ray generation and the two miss shaders (normal, and shadow) have
+	// no data of their own.  Hit groups are added as meshes are, growing
+	// the table as needed (see CreateBottomLevelAccelerationStructureForMesh()).
+	std::vector<unsigned char> record((size_t)shaderTableBuilder.GetStride(SHADER_TABLE_RAY_GEN));
+	shaderTableBuilder.EncodeRecord(SHADER_TABLE_RAY_GEN, raytracingPipelineProperties->GetShaderIdentifier(L"RayGen"), 0, &record[0]);
+	shaderTableBuilder.AddRecords(SHADER_TABLE_RAY_GEN, &record[0], 1);
+
+	record.resize((size_t)shaderTableBuilder.GetStride(SHADER_TABLE_MISS));
+	shaderTableBuilder.EncodeRecord(SHADER_TABLE_MISS, raytracingPipelineProperties->GetShaderIdentifier(L"Miss"), 0, &record[0]);
+	shaderTableBuilder.AddRecords(SHADER_TABLE_MISS, &record[0], 1);
+	shaderTableBuilder.EncodeRecord(SHADER_TABLE_MISS, raytracingPipelineProperties->GetShaderIdentifier(L"MissShadow"), 0, &record[0]);
+	shaderTableBuilder.AddRecords(SHADER_TABLE_MISS, &record[0], 1);
+}
+
+
+// --------------------------------------------------------
+// Encodes a mesh's hit group records (normal, transparent
+// and emissive), which all point at the mesh's geometry SRVs
+// --------------------------------------------------------
+void RaytracingHelper::EncodeHitGroupRecords(unsigned int blasIndex, unsigned char* records)
+{
+	const wchar_t* hitGroupNames[] = { L"HitGroup", L"HitGroupTransparent", L"HitGroupEmissive" };
+
+	const void* arguments[] = { &hitGroupGeometrySRVs[blasIndex] };
 
-	UINT64 shaderTableRayGenRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE); // One descriptor
-	UINT64 shaderTableMissRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE); // One descriptor
-	UINT64 shaderTableHitGroupRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE) * 2; // Two descriptors: CBV and index/vertex buffer
+	UINT64 stride = shaderTableBuilder.GetStride(SHADER_TABLE_HIT_GROUP);
+	for (unsigned int i = 0; i < NUM_HIT_GROUPS; i++)
+	{
+		shaderTableBuilder.EncodeRecord(
+			SHADER_TABLE_HIT_GROUP,
+			raytracingPipelineProperties->GetShaderIdentifier(hitGroupNames[i]),
+			arguments,
+			records + stride * i);
+	}
+}
+
+
+// --------------------------------------------------------
+// Switches to the next GPU copy of the shader table and
+// brings it up to date, copying only the records that
+// changed since that copy was last used.  Being on the same
+// queue, the copies wait for earlier frames' rays to finish
+// with the table.
+// --------------------------------------------------------
+void RaytracingHelper::UploadShaderTable()
+{
+	shaderTableCopy = (shaderTableCopy + 1) % SHADER_TABLE_COPIES;
+	Microsoft::WRL::ComPtr<ID3D12Resource>& table = shaderTables[shaderTableCopy];
+	ResourceStateTracker& states = DX12Helper::GetInstance().GetResourceStates();
 
-	// Align them
-	shaderTableRayGenRecordSize = ALIGN(shaderTableRayGenRecordSize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
-	shaderTableMissRecordSize = ALIGN(shaderTableMissRecordSize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
-	shaderTableHitGroupRecordSize = ALIGN(shaderTableHitGroupRecordSize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
+	// The table only grows when it's laid out again, after which every
+	// copy is uploaded in full anyway
+	if (shaderTableSizes[shaderTableCopy] < shaderTableBuilder.GetTableSize())
+	{
+		if (table)
+		{
+			states.Unregister(table.Get());
+			DX12Helper::GetInstance().DeferRelease(table);
+		}
 
-	// Ensure they're all the same size (matching the largest size) - a requirement of the shader table
-	shaderTableRecordSize = max(shaderTableRayGenRecordSize, max(shaderTableMissRecordSize, shaderTableHitGroupRecordSize));
+		shaderTableSizes[shaderTableCopy] = shaderTableBuilder.GetTableSize();
+		table = DX12Helper::GetInstance().CreateBuffer(shaderTableSizes[shaderTableCopy], D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		states.Register(table.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	}
+
+	std::vector<ShaderTableRange> ranges;
+	shaderTableBuilder.CollectUploads(shaderTableCopy, ranges);
+	if (ranges.empty())
+		return;
 
-	// How big should the table be?  Need a record for each of 3 shaders, but MULTIPLE for HIT GROUPS because of multiple meshes
-	shaderTableSize = shaderTableRecordSize + shaderTableRecordSize + shaderTableRecordSize * MAX_HIT_GROUPS_IN_SHADER_TABLE;
-	shaderTableSize = ALIGN(shaderTableSize, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
+	states.Transition(table.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+	states.Flush();
 
-	// Create the shader table buffer and map it so we can write to it
-	shaderTable = DX12Helper::GetInstance().CreateBuffer(shaderTableSize, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ);
-	unsigned char* shaderTableData = 0;
-	shaderTable->Map(0, 0, (void**)&shaderTableData);
+	for (ShaderTableRange& range : ranges)
+		DX12Helper::GetInstance().UploadBufferData(table.Get(), range.Offset, shaderTableBuilder.GetData() + range.Offset, range.Size);
 
-	// Mem copy each record in: ray gen, miss and the overall hit group (from CreateRaytracingPipelineState() above)
-	memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"RayGen"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-	shaderTableData += shaderTableRecordSize;
+	// Back to being read by rays (flushed along with the dispatch's barriers)
+	states.Transition(table.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+}
 
-	memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"Miss"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-	shaderTableData += shaderTableRecordSize;
 
-	memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"MissShadow"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-	shaderTableData += shaderTableRecordSize;
+// --------------------------------------------------------
+// Copies the instance data and material records that
+// changed to their buffers, recreating either one (once
+// earlier frames are done with it) if it has to grow.
+// Being on the same queue, the copies wait for earlier
+// frames' rays to finish reading them.
+// --------------------------------------------------------
+void RaytracingHelper::UploadInstanceData()
+{
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	ResourceStateTracker& states = dx12Helper.GetResourceStates();
 
-	// Make sure each entry in the shader table has the proper identifier
-	for (unsigned int i = 0; i < MAX_HIT_GROUPS_IN_SHADER_TABLE / NUM_HIT_GROUPS * NUM_HIT_GROUPS; i += NUM_HIT_GROUPS)
+	struct Target
 	{
-		memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"HitGroup"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-		shaderTableData += shaderTableRecordSize;
+		Microsoft::WRL::ComPtr<ID3D12Resource>* Buffer;
+		unsigned int* Capacity;
+		unsigned int NewCapacity;
+		UINT64 Stride;
+		const void* Data;
+		std::vector<InstanceBufferRange>* Ranges;
+	};
+	std::vector<InstanceBufferRange> instanceRanges;
+	std::vector<InstanceBufferRange> materialRanges;
+	Target targets[] = {
+		{ &instanceDataBuffer, &instanceDataCapacity, instanceBuffer.GetInstanceCapacity(), sizeof(RaytracingInstanceData), instanceBuffer.GetInstanceData(), &instanceRanges },
+		{ &materialDataBuffer, &materialDataCapacity, instanceBuffer.GetMaterialCapacity(), sizeof(RaytracingMaterialData), instanceBuffer.GetMaterialData(), &materialRanges },
+	};
+
+	for (Target& target : targets)
+	{
+		if (target.NewCapacity <= *target.Capacity)
+			continue;
 
-		memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"HitGroupTransparent"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-		shaderTableData += shaderTableRecordSize;
+		if (*target.Buffer)
+		{
+			states.Unregister(target.Buffer->Get());
+			dx12Helper.DeferRelease(*target.Buffer);
+		}
 
-		memcpy(shaderTableData, raytracingPipelineProperties->GetShaderIdentifier(L"HitGroupEmissive"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-		shaderTableData += shaderTableRecordSize;
+		*target.Capacity = target.NewCapacity;
+		*target.Buffer = dx12Helper.CreateBuffer(target.Stride * target.NewCapacity, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		states.Register(target.Buffer->Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	}
 
-	// Unmap
-	shaderTable->Unmap(0, 0);
+	// Growing means everything in use is in the ranges
+	instanceBuffer.CollectUploads(instanceRanges, materialRanges);
+	for (Target& target : targets)
+	{
+		if (target.Ranges->empty())
+			continue;
+
+		states.Transition(target.Buffer->Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+		states.Flush();
+
+		for (InstanceBufferRange& range : *target.Ranges)
+			dx12Helper.UploadBufferData(target.Buffer->Get(), range.Offset, (const unsigned char*)target.Data + range.Offset, range.Size);
+
+		// Back to being read by rays (flushed along with the dispatch's barriers)
+		states.Transition(target.Buffer->Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	}
 }
 
 
 // --------------------------------------------------------
-// Creates a texture & wraps it with an Unordered Access View,
-// allowing shaders to directly write into this memory.  The
-// data in this texture will later be directly copied to the
-// back buffer after raytracing is complete.
+// Creates the screen sized buffers raytracing writes
+// alongside the output texture (which comes from the render
+// graph, along with its UAV, see SetOutputTexture()).
 // --------------------------------------------------------
 void RaytracingHelper::CreateRaytracingOutputUAV(unsigned int width, unsigned int height)
 {
-	// Default heap for output buffer
-	D3D12_HEAP_PROPERTIES heapDesc = {};
-	heapDesc.Type = D3D12_HEAP_TYPE_DEFAULT;
-	heapDesc.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-	heapDesc.CreationNodeMask = 0;
-	heapDesc.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-	heapDesc.VisibleNodeMask = 0;
-
-	// Describe the final output resource (UAV)
-	D3D12_RESOURCE_DESC desc = {};
-	desc.DepthOrArraySize = 1;
-	desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
-	desc.Width = width;
-	desc.Height = height;
-	desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-	desc.MipLevels = 1;
-	desc.SampleDesc.Count = 1;
-	desc.SampleDesc.Quality = 0;
-
-	dxrDevice->CreateCommittedResource(
-		&heapDesc,
-		D3D12_HEAP_FLAG_NONE,
-		&desc,
-		D3D12_RESOURCE_STATE_COPY_SOURCE,
-		0,
-		IID_PPV_ARGS(raytracingOutput.GetAddressOf()));
-
-	// Do we have a UAV alrady?
-	if (!raytracingOutputUAV_GPU.ptr)
+	// One light reservoir per pixel, for this frame and last frame
+	for (unsigned int i = 0; i < 2; i++)
 	{
-		// Nope, so reserve a spot
-		DX12Helper::GetInstance().ReserveSrvUavDescriptorHeapSlot(
-			&raytracingOutputUAV_CPU,
-			&raytracingOutputUAV_GPU);
+		reservoirBuffers[i] = DX12Helper::GetInstance().CreateBuffer(
+			sizeof(LightReservoir) * (UINT64)width * height,
+			D3D12_HEAP_TYPE_DEFAULT,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 	}
 
-	// Set up the UAV
-	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+	// New buffers hold garbage until they've been written once
+	reservoirHistoryFrames = 0;
 
-	dxrDevice->CreateUnorderedAccessView(
-		raytracingOutput.Get(),
-		0,
-		&uavDesc,
-		raytracingOutputUAV_CPU);
+	// Denoiser input, plus a readback copy of it for the CPU
+	UINT64 denoiserBufferSize = sizeof(DenoiserPixel) * (UINT64)width * height;
+	denoiserBuffer = DX12Helper::GetInstance().CreateBuffer(
+		denoiserBufferSize,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	DX12Helper::GetInstance().GetResourceStates().Register(denoiserBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	denoiserReadbackBuffer = DX12Helper::GetInstance().CreateBuffer(
+		denoiserBufferSize,
+		D3D12_HEAP_TYPE_READBACK,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+
+	// Denoised RGBA8 rows, laid out so they can be copied straight into the back buffer
+	denoiserUploadRowPitch = ALIGN(width * 4, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+	denoiserUploadBuffer = DX12Helper::GetInstance().CreateBuffer(
+		(UINT64)denoiserUploadRowPitch * height,
+		D3D12_HEAP_TYPE_UPLOAD,
+		D3D12_RESOURCE_STATE_GENERIC_READ);
+	denoiser.Reset();
 }
 
 
@@ -608,20 +744,69 @@ void RaytracingHelper::ResizeOutputUAV(unsigned int screenWidth, unsigned int sc
 
 	this->screenWidth = screenWidth;
 	this->screenHeight = screenHeight;
+	Upscaler::GetRenderSize(screenWidth, screenHeight, upscalerSettings.RenderScale, renderWidth, renderHeight);
+	upscaler.Reset();
+
+	// Replace the buffers (the output texture, and so its UAV, is
+	// recreated at the new size by the render graph).  Earlier frames may still be using the
+	// old ones, so they're released once those are done.
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	dx12Helper.GetResourceStates().Unregister(denoiserBuffer.Get());
+	raytracingOutput = 0;
+	dx12Helper.FreeSrvUavDescriptors(raytracingOutputUAV);
+	Microsoft::WRL::ComPtr<ID3D12Resource>* oldBuffers[] = {
+		&reservoirBuffers[0], &reservoirBuffers[1], &denoiserBuffer, &denoiserReadbackBuffer, &denoiserUploadBuffer };
+	for (Microsoft::WRL::ComPtr<ID3D12Resource>* buffer : oldBuffers)
+	{
+		dx12Helper.DeferRelease(*buffer);
+		buffer->Reset();
+	}
+	CreateRaytracingOutputUAV(screenWidth, screenHeight);
+}
 
-	// Wait for the GPU to be done
-	DX12Helper::GetInstance().WaitForGPU();
 
-	// Reset and re-created the buffer
-	raytracingOutput.Reset();
-	CreateRaytracingOutputUAV(screenWidth, screenHeight);
+// --------------------------------------------------------
+// Makes a UAV for a new output texture.  It goes in a fresh
+// descriptor, since frames still in flight may be reading
+// the old one; that's freed, and only reused once they're
+// done (as is the old texture, see DeferRelease()).
+// --------------------------------------------------------
+void RaytracingHelper::SetOutputTexture(ID3D12Resource* output)
+{
+	if (!dxrAvailable || !helperInitialized || output == raytracingOutput)
+		return;
+
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	dx12Helper.FreeSrvUavDescriptors(raytracingOutputUAV);
+
+	raytracingOutput = output;
+	if (!output)
+		return;
+
+	raytracingOutputUAV = dx12Helper.AllocateSrvUavDescriptors(1);
+	if (!raytracingOutputUAV.IsValid())
+	{
+		// Nowhere to put the UAV, so don't raytrace into it
+		raytracingOutput = 0;
+		return;
+	}
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+	dxrDevice->CreateUnorderedAccessView(
+		raytracingOutput,
+		0,
+		&uavDesc,
+		dx12Helper.GetSrvUavCPUHandle(raytracingOutputUAV));
 }
 
 
 // --------------------------------------------------------
 // Creates a BLAS for a particular mesh and returns the
 // data associated with it.  Presumably this data will be
-// stored along with the associated mesh.
+// stored along with the associated mesh.  The build itself
+// is queued until BuildPendingBLASes().
 // --------------------------------------------------------
 MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMesh(Mesh* mesh)
 {
@@ -646,7 +831,9 @@ MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMe
 	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
 	accelStructInputs.pGeometryDescs = &geometryDesc;
 	accelStructInputs.NumDescs = 1;
-	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	accelStructInputs.Flags =
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
 
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
 	dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
@@ -655,42 +842,37 @@ MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMe
 	accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
 	accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
 
-	// Create a scratch buffer so the device has a place to temporarily store data
-	Microsoft::WRL::ComPtr<ID3D12Resource> blasScratchBuffer = DX12Helper::GetInstance().CreateBuffer(
-		accelStructPrebuildInfo.ScratchDataSizeInBytes,
-		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
-
-	// Create the final buffer for the BLAS
-	raytracingData.BLAS = DX12Helper::GetInstance().CreateBuffer(
+	// Create the final buffer for the BLAS, at its worst case size
+	// until it's compacted
+	blasCompaction.SetBLAS(blasCount, DX12Helper::GetInstance().CreateBuffer(
 		accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
 		D3D12_HEAP_TYPE_DEFAULT,
 		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
 		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
-
-	// Describe the final BLAS and set up the build
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
-	buildDesc.Inputs = accelStructInputs;
-	buildDesc.ScratchAccelerationStructureData = blasScratchBuffer->GetGPUVirtualAddress();
-	buildDesc.DestAccelerationStructureData = raytracingData.BLAS->GetGPUVirtualAddress();
-	dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
-
-	// Set up a barrier to wait until the BLAS is actually built to proceed
-	D3D12_RESOURCE_BARRIER blasBarrier = {};
-	blasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	blasBarrier.UAV.pResource = raytracingData.BLAS.Get();
-	blasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-	dxrCommandList->ResourceBarrier(1, &blasBarrier);
-
-	// Create two SRVs for the index and vertex buffers
-	// Note: These must come one after the other in the descriptor heap, and index must come first
+		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT)));
+	accelerationStructures.AddBLAS(blasCount, accelStructPrebuildInfo.ResultDataMaxSizeInBytes, accelStructPrebuildInfo.ScratchDataSizeInBytes);
+
+	// Queue the build (with its scratch space) for later
+	PendingBLASBuild build = {};
+	build.Geometry = geometryDesc;
+	build.BLASIndex = blasCount;
+	build.ScratchSize = accelStructPrebuildInfo.ScratchDataSizeInBytes;
+	build.VertexBuffer = mesh->GetVBResource();
+	build.IndexBuffer = mesh->GetIBResource();
+	pendingBLASBuilds.push_back(build);
+	blasBuildQueue.Add(accelStructPrebuildInfo.ScratchDataSizeInBytes);
+
+	// Create three SRVs for the index, vertex and ray cone triangle buffers
+	// Note: These must come one after the other in the descriptor heap, in that order
 	//       This is due to the way we've set up the root signature (expects a table of these)
-	D3D12_CPU_DESCRIPTOR_HANDLE ib_cpu, vb_cpu;
-	DX12Helper::GetInstance().ReserveSrvUavDescriptorHeapSlot(&ib_cpu, &raytracingData.IndexBufferSRV);
-	DX12Helper::GetInstance().ReserveSrvUavDescriptorHeapSlot(&vb_cpu, &raytracingData.VertexBufferSRV);
+	//       The mesh frees the range when it's destroyed
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	raytracingData.GeometrySRVs = dx12Helper.AllocateSrvUavDescriptors(3);
+	D3D12_CPU_DESCRIPTOR_HANDLE ib_cpu = dx12Helper.GetSrvUavCPUHandle(raytracingData.GeometrySRVs, 0);
+	D3D12_CPU_DESCRIPTOR_HANDLE vb_cpu = dx12Helper.GetSrvUavCPUHandle(raytracingData.GeometrySRVs, 1);
+	D3D12_CPU_DESCRIPTOR_HANDLE triangles_cpu = dx12Helper.GetSrvUavCPUHandle(raytracingData.GeometrySRVs, 2);
+	raytracingData.IndexBufferSRV = dx12Helper.GetSrvUavGPUHandle(raytracingData.GeometrySRVs, 0);
+	raytracingData.VertexBufferSRV = dx12Helper.GetSrvUavGPUHandle(raytracingData.GeometrySRVs, 1);
 
 	// Index buffer SRV
 	D3D12_SHADER_RESOURCE_VIEW_DESC indexSRVDesc = {};
@@ -714,40 +896,144 @@ MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMe
 	vertexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
 	dxrDevice->CreateShaderResourceView(mesh->GetVBResource().Get(), &vertexSRVDesc, vb_cpu);
 
-	// All done - execute, wait and reset command list
-	dxrCommandList->Close();
-	ID3D12CommandList* lists[] = { dxrCommandList.Get() };
-	commandQueue->ExecuteCommandLists(1, lists);
-
-	DX12Helper::GetInstance().WaitForGPU();
-	dxrCommandList->Reset(DX12Helper::GetInstance().GetDefaultAllocator().Get(), 0);
-
-	// Use the BLAS count as the hit group index for this mesh
+	// Ray cone triangle SRV (a structured buffer, one element per triangle)
+	D3D12_SHADER_RESOURCE_VIEW_DESC triangleSRVDesc = {};
+	triangleSRVDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+	triangleSRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	triangleSRVDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+	triangleSRVDesc.Buffer.StructureByteStride = sizeof(RayConeTriangle);
+	triangleSRVDesc.Buffer.FirstElement = 0;
+	triangleSRVDesc.Buffer.NumElements = mesh->GetIndexCount() / 3;
+	triangleSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	dxrDevice->CreateShaderResourceView(mesh->GetRayConeTriangleResource().Get(), &triangleSRVDesc, triangles_cpu);
+
+	// Use the BLAS count as this mesh's index into its hit group records
 	raytracingData.HitGroupIndex = blasCount;
+	hitGroupGeometrySRVs.push_back(raytracingData.IndexBufferSRV);
+	hitGroupRecords.push_back(0);
 	blasCount++;
 
-	// Put this mesh's buffer SRVs in the appropriate shader table entry
-	unsigned char* tablePointer = 0;
-	shaderTable->Map(0, 0, (void**)&tablePointer);
+	// Add this mesh's hit groups to the shader table
+	std::vector<unsigned char> records((size_t)shaderTableBuilder.GetStride(SHADER_TABLE_HIT_GROUP) * NUM_HIT_GROUPS);
+	EncodeHitGroupRecords(raytracingData.HitGroupIndex, &records[0]);
+	hitGroupRecords[raytracingData.HitGroupIndex] = shaderTableBuilder.AddRecords(SHADER_TABLE_HIT_GROUP, &records[0], NUM_HIT_GROUPS);
+
+	return raytracingData;
+}
+
+
+// --------------------------------------------------------
+// Records every queued BLAS build into the command list,
+// sharing one scratch buffer.  Builds in a batch use their
+// own parts of it, and each batch waits (UAV barrier) for
+// the one before to finish with it.  Their compacted sizes
+// are copied to a readback buffer, and once the GPU is done
+// those are read and the scratch buffer is released.
+// --------------------------------------------------------
+void RaytracingHelper::BuildPendingBLASes()
+{
+	if (pendingBLASBuilds.empty())
+		return;
+
+	std::vector<BLASBuildBatch> batches;
+	std::vector<uint64_t> scratchOffsets;
+	uint64_t scratchSize = blasBuildQueue.Plan(batches, scratchOffsets);
+
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	Microsoft::WRL::ComPtr<ID3D12Resource> scratchBuffer = dx12Helper.CreateBuffer(
+		scratchSize,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+
+	// A null UAV barrier covers the scratch buffer and every BLAS
+	D3D12_RESOURCE_BARRIER uavBarrier = {};
+	uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	uavBarrier.UAV.pResource = 0;
+	uavBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+
+	for (size_t b = 0; b < batches.size(); b++)
 	{
-		// Get to the correct address in the table
-		tablePointer += shaderTableRecordSize * 3; // Get past raygen and miss shaders (2 miss shaders: normal, and shadow)
-		tablePointer += shaderTableRecordSize * raytracingData.HitGroupIndex * NUM_HIT_GROUPS; // Skip to this hit group
-		tablePointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; // Get past the identifier
-		tablePointer += 8; // Skip first descriptor, which is for a CBV
-		memcpy(tablePointer, &raytracingData.IndexBufferSRV, 8); // Copy descriptor to table
-	
-		//handle second hit group
-		tablePointer += shaderTableRecordSize;
-		memcpy(tablePointer, &raytracingData.IndexBufferSRV, 8);
+		if (b > 0)
+			dxrCommandList->ResourceBarrier(1, &uavBarrier);
 
-		//third group
-		tablePointer += shaderTableRecordSize;
-		memcpy(tablePointer, &raytracingData.IndexBufferSRV, 8);
+		for (unsigned int i = batches[b].FirstBuild; i < batches[b].FirstBuild + batches[b].BuildCount; i++)
+		{
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+			buildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+			buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+			buildDesc.Inputs.pGeometryDescs = &pendingBLASBuilds[i].Geometry;
+			buildDesc.Inputs.NumDescs = 1;
+			buildDesc.Inputs.Flags =
+				D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+				D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+			buildDesc.ScratchAccelerationStructureData = scratchBuffer->GetGPUVirtualAddress() + scratchOffsets[i];
+			buildDesc.DestAccelerationStructureData = blasCompaction.GetBLAS(pendingBLASBuilds[i].BLASIndex)->GetGPUVirtualAddress();
+			dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
+		}
 	}
-	shaderTable->Unmap(0, 0);
 
-	return raytracingData;
+	// Wait until the BLASes are actually built to proceed
+	dxrCommandList->ResourceBarrier(1, &uavBarrier);
+
+	// Write each one's compacted size (8 bytes apiece) and copy them
+	// all somewhere the CPU can read
+	UINT64 postbuildSize = sizeof(UINT64) * pendingBLASBuilds.size();
+	Microsoft::WRL::ComPtr<ID3D12Resource> postbuildBuffer = dx12Helper.CreateBuffer(
+		postbuildSize,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	Microsoft::WRL::ComPtr<ID3D12Resource> postbuildReadback = dx12Helper.CreateBuffer(
+		postbuildSize,
+		D3D12_HEAP_TYPE_READBACK,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+
+	std::vector<D3D12_GPU_VIRTUAL_ADDRESS> blasAddresses;
+	std::vector<unsigned int> blasIndices;
+	for (PendingBLASBuild& build : pendingBLASBuilds)
+	{
+		blasAddresses.push_back(blasCompaction.GetBLAS(build.BLASIndex)->GetGPUVirtualAddress());
+		blasIndices.push_back(build.BLASIndex);
+	}
+
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+	postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+	postbuildDesc.DestBuffer = postbuildBuffer->GetGPUVirtualAddress();
+	dxrCommandList->EmitRaytracingAccelerationStructurePostbuildInfo(&postbuildDesc, (UINT)blasAddresses.size(), &blasAddresses[0]);
+
+	D3D12_RESOURCE_BARRIER postbuildBarrier = {};
+	postbuildBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	postbuildBarrier.Transition.pResource = postbuildBuffer.Get();
+	postbuildBarrier.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	postbuildBarrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+	postbuildBarrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	dxrCommandList->ResourceBarrier(1, &postbuildBarrier);
+	dxrCommandList->CopyBufferRegion(postbuildReadback.Get(), 0, postbuildBuffer.Get(), 0, postbuildSize);
+
+	// The BLASes can be compacted once this submission is done
+	accelerationStructures.AddBLASScratch(scratchSize);
+	dx12Helper.CallWhenGPUDone([this, blasIndices, scratchSize, scratchBuffer, postbuildBuffer, postbuildReadback]()
+	{
+		D3D12_RANGE readRange = { 0, blasIndices.size() * sizeof(UINT64) };
+		D3D12_RANGE noRange = { 0, 0 };
+		void* mapped = 0;
+		postbuildReadback->Map(0, &readRange, &mapped);
+		const UINT64* compactedSizes = (const UINT64*)mapped;
+		for (size_t i = 0; i < blasIndices.size(); i++)
+		{
+			blasCompaction.SetCompactedSize(blasIndices[i], compactedSizes[i]);
+			accelerationStructures.SetBuildComplete(blasIndices[i]);
+		}
+		postbuildReadback->Unmap(0, &noRange);
+
+		// The buffers go with this callback
+		accelerationStructures.RemoveBLASScratch(scratchSize);
+	});
+
+	pendingBLASBuilds.clear();
+	blasBuildQueue.Clear();
 }
 
 
@@ -761,14 +1047,23 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 	if (scene.size() == 0)
 		return;
 
+	// Any meshes created since the last TLAS build need their BLASes,
+	// and any built BLASes worth compacting are compacted
+	BuildPendingBLASes();
+	accelerationStructures.Update();
+	if (blasCompaction.TakeCompactionsRecorded())
+	{
+		D3D12_RESOURCE_BARRIER compactionBarrier = {};
+		compactionBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+		compactionBarrier.UAV.pResource = 0;
+		dxrCommandList->ResourceBarrier(1, &compactionBarrier);
+	}
+
 	// Create vector of instance descriptions
 	std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs;
 
-	// Create a vector of instance IDs
-	std::vector<unsigned int> instanceIDs;
-	std::vector<RaytracingEntityData> entityData;
-	instanceIDs.resize(blasCount); // One per BLAS (mesh) - all starting at zero due to resize()
-	entityData.resize(blasCount);
+	// Per-instance data is only repacked for entities that changed
+	instanceBuffer.BeginFrame((unsigned int)scene.size());
 
 	// Create an instance description for each entity
 	for (size_t i = 0; i < scene.size(); i++)
@@ -777,7 +1072,7 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 		DirectX::XMFLOAT4X4 transform = scene[i]->GetTransform()->GetWorldMatrix();
 		XMStoreFloat4x4(&transform, XMMatrixTranspose(XMLoadFloat4x4(&transform)));
 
-		// Grab this mesh's index in the shader table
+		// Grab this mesh's BLAS slot (which hit group records it uses)
 		std::shared_ptr<Mesh> mesh = scene[i]->GetMesh();
 		unsigned int meshBlasIndex = mesh->GetRaytracingData().HitGroupIndex;
 
@@ -789,52 +1084,63 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 
 		// Create this description and add to our overall set of descriptions
 		D3D12_RAYTRACING_INSTANCE_DESC id = {};
-		id.InstanceContributionToHitGroupIndex = meshBlasIndex * NUM_HIT_GROUPS + hitGroupOffset;
-		id.InstanceID = instanceIDs[meshBlasIndex];
+		id.InstanceContributionToHitGroupIndex = hitGroupRecords[meshBlasIndex] + hitGroupOffset;
+		id.InstanceID = 0;
 		id.InstanceMask = 0xFF;
 		memcpy(&id.Transform, &transform, sizeof(float) * 3 * 4); // Copy first [3][4] elements
-		id.AccelerationStructure = mesh->GetRaytracingData().BLAS->GetGPUVirtualAddress();
+		id.AccelerationStructure = blasCompaction.GetBLAS(meshBlasIndex)->GetGPUVirtualAddress();
 		id.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
 		instanceDescs.push_back(id);
 
-		// Set up the entity data for this entity, too
-		// - mesh index tells us which cbuffer
-		// - instance ID tells us which instance in that cbuffer
-		XMFLOAT4 c = scene[i]->GetMaterial()->GetColorTint();
-		//previous roughness creation (float)((i+1) % 2)
-		entityData[meshBlasIndex].color[id.InstanceID] = c; // Using alpha channel as "roughness"
-
-		// On to the next instance for this mesh
-		instanceIDs[meshBlasIndex]++;
+		// Set up the instance data too, if the entity's history or material
+		// changed (InstanceIndex() in the shaders is the index into this)
+		Transform* entityTransform = scene[i]->GetTransform();
+		std::shared_ptr<Material> material = scene[i]->GetMaterial();
+		RaytracingInstanceData* instance = instanceBuffer.UpdateInstance(
+			(unsigned int)i, scene[i].get(), entityTransform->GetPreviousWorldMatrixVersion(), material.get());
+		if (instance)
+		{
+			DirectX::XMFLOAT4X4 previousTransform = entityTransform->GetPreviousWorldMatrix();
+			XMStoreFloat4x4(&previousTransform, XMMatrixTranspose(XMLoadFloat4x4(&previousTransform)));
+			memcpy(&instance->previousRow, &previousTransform, sizeof(float) * 3 * 4);
+
+			instance->materialIndex = instanceBuffer.GetMaterialIndex(material.get());
+			if (instance->materialIndex == instanceMaterials.size())
+				instanceMaterials.push_back(material);
+			if (type == MaterialType::Transparent) { instance->flags = RAYTRACING_INSTANCE_TRANSPARENT; }
+			if (type == MaterialType::Emissive) { instance->flags = RAYTRACING_INSTANCE_EMISSIVE; }
+		}
 	}
 
-	// Is our current description buffer too small?
-	if (sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size() > tlasInstanceDataSizeInBytes)
+	// Material colors (and texture descriptors, as textures stream) can
+	// change without any instance changing.  The albedo is the first SRV
+	// in the material's table
+	for (unsigned int i = 0; i < instanceMaterials.size(); i++)
 	{
-		// Create a new buffer to hold instance descriptions, since they
-		// need to actually be on the GPU
-		tlasInstanceDescBuffer.Reset();
-		tlasInstanceDataSizeInBytes = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size();
-
-		tlasInstanceDescBuffer = DX12Helper::GetInstance().CreateBuffer(
-			tlasInstanceDataSizeInBytes,
-			D3D12_HEAP_TYPE_UPLOAD,
-			D3D12_RESOURCE_STATE_GENERIC_READ);
+		RaytracingMaterialData materialData = {};
+		materialData.color = instanceMaterials[i]->GetColorTint(); // Using alpha channel as "roughness"
+		materialData.uvScale = instanceMaterials[i]->GetUVScale();
+		materialData.uvOffset = instanceMaterials[i]->GetUVOffset();
+		D3D12_GPU_DESCRIPTOR_HANDLE textures = instanceMaterials[i]->GetFinalGPUHandleForTextures();
+		materialData.albedoTexture = textures.ptr == 0 ?
+			RAYTRACING_NO_TEXTURE :
+			DX12Helper::GetInstance().GetCBVSRVDescriptorIndex(textures);
+		instanceBuffer.SetMaterialData(i, materialData);
 	}
+	UploadInstanceData();
 
-	// Copy the descriptions into the buffer
-	// NOTE: This may be a spot where a small ringbuffer would be useful
-	//       if we're working multiple frames ahead of the GPU
-	unsigned char* mapped = 0;
-	tlasInstanceDescBuffer->Map(0, 0, (void**)&mapped);
-	memcpy(mapped, &instanceDescs[0], sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size());
-	tlasInstanceDescBuffer->Unmap(0, 0);
+	// Stage the descriptions for this frame; the space is reused
+	// once the GPU has finished with it
+	D3D12_GPU_VIRTUAL_ADDRESS instanceDescAddress = DX12Helper::GetInstance().StageData(
+		&instanceDescs[0],
+		sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size(),
+		D3D12_RAYTRACING_INSTANCE_DESCS_BYTE_ALIGNMENT);
 
 	// Describe our overall input so we can get sizing info
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
 	accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
 	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	accelStructInputs.InstanceDescs = tlasInstanceDescBuffer->GetGPUVirtualAddress();
+	accelStructInputs.InstanceDescs = instanceDescAddress;
 	accelStructInputs.NumDescs = (unsigned int)instanceDescs.size();
 	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
 
@@ -848,7 +1154,8 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 	// Is our current scratch size too small?
 	if (accelStructPrebuildInfo.ScratchDataSizeInBytes > tlasScratchSizeInBytes)
 	{
-		// Create a new scratch buffer
+		// Create a new scratch buffer (the old one goes once earlier frames are done with it)
+		DX12Helper::GetInstance().DeferRelease(tlasScratchBuffer);
 		tlasScratchBuffer.Reset();
 		tlasScratchSizeInBytes = accelStructPrebuildInfo.ScratchDataSizeInBytes;
 
@@ -863,7 +1170,8 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 	// Is our current tlas too small?
 	if (accelStructPrebuildInfo.ResultDataMaxSizeInBytes > tlasBufferSizeInBytes)
 	{
-		// Create a new tlas buffer
+		// Create a new tlas buffer (the old one goes once earlier frames are done with it)
+		DX12Helper::GetInstance().DeferRelease(topLevelAccelerationStructure);
 		topLevelAccelerationStructure.Reset();
 		tlasBufferSizeInBytes = accelStructPrebuildInfo.ResultDataMaxSizeInBytes;
 
@@ -875,6 +1183,8 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 			max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
 	}
 
+	accelerationStructures.SetTLASSize(tlasBufferSizeInBytes, tlasScratchSizeInBytes);
+
 	// Describe the final TLAS and set up the build
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
 	buildDesc.Inputs = accelStructInputs;
@@ -882,35 +1192,161 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 	buildDesc.DestAccelerationStructureData = topLevelAccelerationStructure->GetGPUVirtualAddress();
 	dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
 
-	// Set up a barrier to wait until the TLAS is actually built to proceed
-	D3D12_RESOURCE_BARRIER tlasBarrier = {};
-	tlasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	tlasBarrier.UAV.pResource = topLevelAccelerationStructure.Get();
-	tlasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-	dxrCommandList->ResourceBarrier(1, &tlasBarrier);
-
-	// Finalize the entity data cbuffer stuff and copy descriptors to shader table
-	// NOTE: Another place where ringbuffer style management based on frame sync would be a good idea!
-	unsigned char* tablePointer = 0;
-	shaderTable->Map(0, 0, (void**)&tablePointer);
-	tablePointer += shaderTableRecordSize * 3; // Get past raygen and miss shaders
-	for(int i = 0; i < entityData.size(); i++)
+	// Wait until the TLAS is actually built to proceed (batched with the dispatch's barriers)
+	DX12Helper::GetInstance().GetResourceStates().UAVBarrier(topLevelAccelerationStructure.Get());
+}
+
+
+// --------------------------------------------------------
+// Upload data for the frame being recorded
+// --------------------------------------------------------
+RaytracingFrameData& RaytracingHelper::GetFrameData()
+{
+	return frameData[DX12Helper::GetInstance().GetFrameIndex()];
+}
+
+
+// --------------------------------------------------------
+// Copies data into an upload heap buffer, replacing the
+// buffer with a larger one first if the data won't fit
+// --------------------------------------------------------
+void RaytracingHelper::FillUploadBuffer(
+	Microsoft::WRL::ComPtr<ID3D12Resource>& buffer,
+	UINT64& bufferSizeInBytes,
+	const void* data,
+	UINT64 dataSizeInBytes)
+{
+	// Is our current buffer too small?
+	if (!buffer || dataSizeInBytes > bufferSizeInBytes)
 	{
-		// Need to get to the first descriptor in this hit group's record
-		unsigned char* hitGroupPointer = tablePointer + shaderTableRecordSize * NUM_HIT_GROUPS * i;
-		hitGroupPointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; // Get past identifier
+		buffer.Reset();
+		bufferSizeInBytes = dataSizeInBytes;
+
+		buffer = DX12Helper::GetInstance().CreateBuffer(
+			bufferSizeInBytes,
+			D3D12_HEAP_TYPE_UPLOAD,
+			D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+
+	unsigned char* mapped = 0;
+	buffer->Map(0, 0, (void**)&mapped);
+	memcpy(mapped, data, dataSizeInBytes);
+	buffer->Unmap(0, 0);
+}
+
+
+// --------------------------------------------------------
+// Uploads the light array along with an importance-weighted alias
+// table and a light BVH, so hit shaders can pick a single
+// light to trace a shadow ray towards by importance.
+// Only rebuilds when the lights or strategy actually change.
+// --------------------------------------------------------
+void RaytracingHelper::UpdateLights(const std::vector<Light>& lights, int samplingStrategy)
+{
+	if (!dxrAvailable || !helperInitialized)
+		return;
+
+	// Anything different since last time?
+	bool lightsChanged =
+		lights.size() != uploadedLights.size() ||
+		(lights.size() > 0 && memcmp(&lights[0], &uploadedLights[0], sizeof(Light) * lights.size()) != 0);
 
-		// Copy the data to the CB ring buffer and grab associated CBV to place in shader table
-		D3D12_GPU_DESCRIPTOR_HANDLE cbv = DX12Helper::GetInstance().FillNextConstantBufferAndGetGPUDescriptorHandle(&entityData[i], sizeof(RaytracingEntityData));
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); //normal
+	if (lightsChanged || lightVersion == 0)
+	{
+		// Light indices in old reservoirs may no longer mean the same light
+		if (lights.size() != uploadedLights.size())
+			reservoirHistoryFrames = 0;
 
-		hitGroupPointer += shaderTableRecordSize;
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));//transparent
+		uploadedLights = lights;
+		lightSampler.Build(lights);
+		lightVersion++;
+	}
 
-		hitGroupPointer += shaderTableRecordSize;
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));//emissive
+	// Each frame in flight has its own copy, refreshed the first time
+	// it's used after a change (earlier frames may be reading theirs)
+	RaytracingFrameData& frame = GetFrameData();
+	if (frame.LightVersion != lightVersion)
+	{
+		// Structured buffers can't be empty, so always upload at least one element
+		Light emptyLight = {};
+		LightAliasEntry emptyEntry = {};
+		LightBVHNode emptyNode = {};
+		const std::vector<LightAliasEntry>& aliasTable = lightSampler.GetAliasTable();
+		const std::vector<LightBVHNode>& bvhNodes = lightSampler.GetBVHNodes();
+
+		FillUploadBuffer(frame.LightBuffer, frame.LightBufferSizeInBytes,
+			uploadedLights.empty() ? &emptyLight : &uploadedLights[0],
+			sizeof(Light) * max(uploadedLights.size(), (size_t)1));
+		FillUploadBuffer(frame.LightAliasBuffer, frame.LightAliasBufferSizeInBytes,
+			aliasTable.empty() ? &emptyEntry : &aliasTable[0],
+			sizeof(LightAliasEntry) * max(aliasTable.size(), (size_t)1));
+		FillUploadBuffer(frame.LightBVHBuffer, frame.LightBVHBufferSizeInBytes,
+			bvhNodes.empty() ? &emptyNode : &bvhNodes[0],
+			sizeof(LightBVHNode) * max(bvhNodes.size(), (size_t)1));
+		frame.LightVersion = lightVersion;
 	}
-	shaderTable->Unmap(0, 0);
+
+	// Negative means "whatever suits this many lights"
+	lightSamplingStrategy = samplingStrategy < 0 ? lightSampler.GetDefaultStrategy() : samplingStrategy;
+}
+
+
+// --------------------------------------------------------
+// Turns ReSTIR on or off and changes how much reuse it does
+// --------------------------------------------------------
+void RaytracingHelper::SetReSTIR(bool enabled, const ReSTIRSettings& settings)
+{
+	// Switching it back on shouldn't pick up stale reservoirs
+	if (enabled && !restirEnabled)
+		reservoirHistoryFrames = 0;
+
+	restirEnabled = enabled;
+	restirSettings = settings;
+}
+
+
+// --------------------------------------------------------
+// Turns the CPU denoiser on or off and changes its filtering
+// --------------------------------------------------------
+void RaytracingHelper::SetDenoiser(bool enabled, const DenoiserSettings& settings)
+{
+	// History from before it was switched off no longer lines up
+	if (enabled && !denoiserEnabled)
+		denoiser.Reset();
+
+	denoiserEnabled = enabled;
+	denoiserSettings = settings;
+}
+
+
+// --------------------------------------------------------
+// Changes how many pixels are traced per frame.  The reservoirs
+// are laid out by the traced grid, so a new size drops them.
+// --------------------------------------------------------
+void RaytracingHelper::SetUpscaler(const UpscalerSettings& settings)
+{
+	unsigned int newWidth;
+	unsigned int newHeight;
+	Upscaler::GetRenderSize(screenWidth, screenHeight, settings.RenderScale, newWidth, newHeight);
+	if (newWidth != renderWidth || newHeight != renderHeight || settings.Checkerboard != upscalerSettings.Checkerboard)
+	{
+		reservoirHistoryFrames = 0;
+		upscaler.Reset();
+	}
+
+	renderWidth = newWidth;
+	renderHeight = newHeight;
+	upscalerSettings = settings;
+}
+
+
+// --------------------------------------------------------
+// Primary rays per ray-per-pixel this frame
+// --------------------------------------------------------
+unsigned int RaytracingHelper::GetTracedPixelCount()
+{
+	unsigned int count = renderWidth * renderHeight;
+	return upscalerSettings.Checkerboard ? (count + 1) / 2 : count;
 }
 
 
@@ -922,28 +1358,33 @@ void RaytracingHelper::Raytrace(
 	Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer, 
 	unsigned int raysPerPixel, 
 	unsigned int maxRecursion,
-	XMFLOAT3 lightSourcePos,
 	bool executeCommandList)
 {
-	if (!dxrAvailable || !helperInitialized)
+	if (!dxrAvailable || !helperInitialized || !raytracingOutput)
 		return;
 
+	// Make sure this frame's light buffers exist and are current, even if no lights were given
+	RaytracingFrameData& frame = GetFrameData();
+	if (lightVersion == 0 || frame.LightVersion != lightVersion)
+		UpdateLights(uploadedLights, lightSamplingStrategy);
+
+	// Hit group records change as the TLAS is rebuilt.  Uploaded before
+	// the split barrier below opens, so its copies land outside it
+	UploadShaderTable();
+
 	// Transition the output-related resources to the proper states
-	D3D12_RESOURCE_BARRIER outputBarriers[2] = {};
+	ResourceStateTracker& states = DX12Helper::GetInstance().GetResourceStates();
 	{
-		// Back buffer needs to be COPY DESTINATION (for later)
-		outputBarriers[0].Transition.pResource = currentBackBuffer.Get();
-		outputBarriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_PRESENT;
-		outputBarriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
-		outputBarriers[0].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+		// Back buffer needs to be COPY DESTINATION (for later), so the
+		// transition is split across the raytracing - unless resolving
+		// submits the list in between, which a split barrier can't span
+		if (denoiserEnabled || IsUpscaling())
+			states.Transition(currentBackBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+		else
+			states.BeginTransition(currentBackBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
 
 		// Raytracing output needs to be unordered access for raytracing
-		outputBarriers[1].Transition.pResource = raytracingOutput.Get();
-		outputBarriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
-		outputBarriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-		outputBarriers[1].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-
-		dxrCommandList->ResourceBarrier(2, outputBarriers);
+		states.Transition(raytracingOutput, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	}
 
 	// Grab and fill a constant buffer
@@ -951,7 +1392,23 @@ void RaytracingHelper::Raytrace(
 	sceneData.cameraPosition = camera->GetTransform()->GetPosition();
 	sceneData.raysPerPixel = raysPerPixel;
 	sceneData.maxRecursion = maxRecursion;
-	sceneData.lightSourcePosition = lightSourcePos;
+	sceneData.lightCount = lightSampler.GetLightCount();
+	sceneData.lightSamplingStrategy = lightSamplingStrategy;
+	sceneData.infiniteLightCount = lightSampler.GetInfiniteLightCount();
+	sceneData.infiniteAliasOffset = lightSampler.GetInfiniteAliasOffset();
+	sceneData.infiniteLightProbability = lightSampler.GetInfiniteLightProbability();
+	sceneData.frameIndex = frameIndex;
+	sceneData.restirEnabled = restirEnabled;
+	sceneData.restirCandidates = restirSettings.InitialCandidates;
+	sceneData.restirTemporal = restirSettings.Temporal;
+	sceneData.restirSpatialSamples = restirSettings.SpatialSamples;
+	sceneData.restirSpatialRadius = restirSettings.SpatialRadius;
+	// Last frame's buffer has to have actually been written to be history
+	sceneData.restirHistoryValid = reservoirHistoryFrames >= 1;
+	sceneData.previousCameraPosition = camera->GetPreviousPosition();
+	sceneData.previousViewProjection = camera->GetPreviousViewProjection();
+	sceneData.checkerboard = upscalerSettings.Checkerboard;
+	sceneData.pixelSpreadAngle = RayConeLOD::GetPixelSpreadAngle(camera->GetFieldOfView(), renderHeight);
 	
 	DirectX::XMFLOAT4X4 view = camera->GetView();
 	DirectX::XMFLOAT4X4 proj = camera->GetProjection();
@@ -960,10 +1417,13 @@ void RaytracingHelper::Raytrace(
 	DirectX::XMMATRIX vp = DirectX::XMMatrixMultiply(v, p);
 	DirectX::XMStoreFloat4x4(&sceneData.inverseViewProjection, XMMatrixInverse(0, vp));
 
-	D3D12_GPU_DESCRIPTOR_HANDLE cbuffer = DX12Helper::GetInstance().FillNextConstantBufferAndGetGPUDescriptorHandle(&sceneData, sizeof(RaytracingSceneData));
+	D3D12_GPU_VIRTUAL_ADDRESS cbuffer = DX12Helper::GetInstance().FillNextConstantBufferAndGetGPUAddress(&sceneData, sizeof(RaytracingSceneData));
 
 	// ACTUAL RAYTRACING HERE
 	{
+		// Everything queued so far (TLAS build, output, shader table)
+		states.Flush();
+
 		// Set the CBV/SRV/UAV descriptor heap
 		ID3D12DescriptorHeap* heap[] = { DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get() };
 		dxrCommandList->SetDescriptorHeaps(1, heap);
@@ -974,56 +1434,78 @@ void RaytracingHelper::Raytrace(
 
 		// Set the global root sig so we can also set descriptor tables
 		dxrCommandList->SetComputeRootSignature(globalRaytracingRootSig.Get());
-		dxrCommandList->SetComputeRootDescriptorTable(0, raytracingOutputUAV_GPU);	// First table is just output UAV
+		dxrCommandList->SetComputeRootDescriptorTable(0, DX12Helper::GetInstance().GetSrvUavGPUHandle(raytracingOutputUAV));	// First table is just output UAV
 		dxrCommandList->SetComputeRootShaderResourceView(1, topLevelAccelerationStructure->GetGPUVirtualAddress());		// Second is SRV for accel structure (as root SRV, no table needed)
-		dxrCommandList->SetComputeRootDescriptorTable(2, cbuffer);					// Third is CBV
+		dxrCommandList->SetComputeRootConstantBufferView(2, cbuffer);				// Third is the scene's root CBV
+		dxrCommandList->SetComputeRootShaderResourceView(3, frame.LightBuffer->GetGPUVirtualAddress());		// Lights
+		dxrCommandList->SetComputeRootShaderResourceView(4, frame.LightAliasBuffer->GetGPUVirtualAddress());	// Light alias table
+		dxrCommandList->SetComputeRootShaderResourceView(5, frame.LightBVHBuffer->GetGPUVirtualAddress());	// Light BVH
+		dxrCommandList->SetComputeRootUnorderedAccessView(6, reservoirBuffers[frameIndex % 2]->GetGPUVirtualAddress());		// This frame's reservoirs
+		dxrCommandList->SetComputeRootUnorderedAccessView(7, reservoirBuffers[(frameIndex + 1) % 2]->GetGPUVirtualAddress());	// Last frame's reservoirs
+		dxrCommandList->SetComputeRootUnorderedAccessView(8, denoiserBuffer->GetGPUVirtualAddress());	// Denoiser data
+		dxrCommandList->SetComputeRootShaderResourceView(9, instanceDataBuffer->GetGPUVirtualAddress());	// Instance data
+		dxrCommandList->SetComputeRootShaderResourceView(10, materialDataBuffer->GetGPUVirtualAddress());	// Materials
+		dxrCommandList->SetComputeRootDescriptorTable(11, DX12Helper::GetInstance().GetCBVSRVDescriptorHeap()->GetGPUDescriptorHandleForHeapStart());	// Every SRV, for material textures
 
 		// Dispatch rays
 		D3D12_DISPATCH_RAYS_DESC dispatchDesc = {};
 		
 		// Ray gen shader location in shader table
-		dispatchDesc.RayGenerationShaderRecord.StartAddress = shaderTable->GetGPUVirtualAddress();
-		dispatchDesc.RayGenerationShaderRecord.SizeInBytes = shaderTableRecordSize;
-
-		// Miss shader location in shader table (we could have a whole sub-table of just these, but only 1 for this demo)
-		dispatchDesc.MissShaderTable.StartAddress = shaderTable->GetGPUVirtualAddress() + shaderTableRecordSize; // Offset by 1 record
-		dispatchDesc.MissShaderTable.SizeInBytes = shaderTableRecordSize; // Assuming sizes here (might want to verify later)
-		dispatchDesc.MissShaderTable.StrideInBytes = shaderTableRecordSize;
-
-		// Hit group location in shader table
-		dispatchDesc.HitGroupTable.StartAddress = shaderTable->GetGPUVirtualAddress() + shaderTableRecordSize * 3; // Offset by 2 records
-		dispatchDesc.HitGroupTable.SizeInBytes = shaderTableRecordSize * (UINT64)MAX_HIT_GROUPS_IN_SHADER_TABLE;
-		dispatchDesc.HitGroupTable.StrideInBytes = shaderTableRecordSize;
-
-		// Set number of rays to match screen size
-		dispatchDesc.Width = screenWidth;
-		dispatchDesc.Height = screenHeight;
+		D3D12_GPU_VIRTUAL_ADDRESS shaderTableAddress = shaderTables[shaderTableCopy]->GetGPUVirtualAddress();
+		dispatchDesc.RayGenerationShaderRecord.StartAddress = shaderTableAddress + shaderTableBuilder.GetSectionOffset(SHADER_TABLE_RAY_GEN);
+		dispatchDesc.RayGenerationShaderRecord.SizeInBytes = shaderTableBuilder.GetStride(SHADER_TABLE_RAY_GEN);
+
+		// Miss shaders (normal and shadow)
+		dispatchDesc.MissShaderTable.StartAddress = shaderTableAddress + shaderTableBuilder.GetSectionOffset(SHADER_TABLE_MISS);
+		dispatchDesc.MissShaderTable.SizeInBytes = shaderTableBuilder.GetSectionSize(SHADER_TABLE_MISS);
+		dispatchDesc.MissShaderTable.StrideInBytes = shaderTableBuilder.GetStride(SHADER_TABLE_MISS);
+
+		// Hit groups, up to the last one a mesh is using
+		dispatchDesc.HitGroupTable.StartAddress = shaderTableAddress + shaderTableBuilder.GetSectionOffset(SHADER_TABLE_HIT_GROUP);
+		dispatchDesc.HitGroupTable.SizeInBytes = shaderTableBuilder.GetSectionSize(SHADER_TABLE_HIT_GROUP);
+		dispatchDesc.HitGroupTable.StrideInBytes = shaderTableBuilder.GetStride(SHADER_TABLE_HIT_GROUP);
+
+		// Set number of rays to match the traced grid (the screen size unless upscaling)
+		dispatchDesc.Width = renderWidth;
+		dispatchDesc.Height = renderHeight;
 		dispatchDesc.Depth = 1;
 
 		// GO!
 		dxrCommandList->DispatchRays(&dispatchDesc);
+
+		// Next frame reads what this one wrote
+		states.UAVBarrier(reservoirBuffers[frameIndex % 2].Get());
+
+		frameIndex++;
+		reservoirHistoryFrames++;
 	}
 
 	// Final transitions
 	{
 		// Transition the raytracing output to COPY SOURCE
-		outputBarriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-		outputBarriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
-		dxrCommandList->ResourceBarrier(1, &outputBarriers[1]);
+		states.Transition(raytracingOutput, D3D12_RESOURCE_STATE_COPY_SOURCE);
 
-		// Copy the raytracing output into the back buffer
-		dxrCommandList->CopyResource(currentBackBuffer.Get(), raytracingOutput.Get());
+		// Copy the raytracing output (or its upscaled and/or denoised version) into the back buffer
+		if (denoiserEnabled || IsUpscaling())
+			ResolveIntoBackBuffer(currentBackBuffer, sceneData.frameIndex);
+		else
+		{
+			// Ends the back buffer's split transition
+			states.Transition(currentBackBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+			states.Flush();
+			dxrCommandList->CopyResource(currentBackBuffer.Get(), raytracingOutput);
+		}
 
-		// Back buffer back to PRESENT
-		outputBarriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-		outputBarriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
-		dxrCommandList->ResourceBarrier(1, &outputBarriers[0]);
+		// Back buffer back to PRESENT (merged with whatever the caller
+		// does with it next, unless the list is executed here)
+		states.Transition(currentBackBuffer.Get(), D3D12_RESOURCE_STATE_PRESENT);
 	}
 
 
 	if(executeCommandList)
 	// Close and execute
 	{
+		states.Flush();
 		dxrCommandList->Close();
 		ID3D12CommandList* lists[] = { dxrCommandList.Get() };
 		commandQueue->ExecuteCommandLists(1, lists);
@@ -1033,16 +1515,114 @@ void RaytracingHelper::Raytrace(
 }
 
 
+// --------------------------------------------------------
+// Reads back this frame's denoiser data, upscales and/or
+// denoises it on the CPU and records a copy of the result
+// into the back buffer (which must not have a split
+// transition in flight).
+// 
+// Note: This has to wait for the GPU to finish raytracing,
+// so the rest of the frame's commands start a new list.
+// --------------------------------------------------------
+void RaytracingHelper::ResolveIntoBackBuffer(Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer, unsigned int tracedFrameIndex)
+{
+	// Copy the denoiser data somewhere the CPU can see it
+	ResourceStateTracker& states = DX12Helper::GetInstance().GetResourceStates();
+	states.Transition(denoiserBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE);
+	states.Flush();
 
+	UINT64 tracedSizeInBytes = sizeof(DenoiserPixel) * (UINT64)renderWidth * renderHeight;
+	dxrCommandList->CopyBufferRegion(denoiserReadbackBuffer.Get(), 0, denoiserBuffer.Get(), 0, tracedSizeInBytes);
 
+	states.Transition(denoiserBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
+	// Run everything so far (barriers included) and wait for it
+	DX12Helper::GetInstance().CloseExecuteAndResetCommandList();
 
+	D3D12_RANGE readRange = { 0, (SIZE_T)tracedSizeInBytes };
+	D3D12_RANGE noRange = { 0, 0 };
+	void* mapped = 0;
+	void* output = 0;
+	denoiserReadbackBuffer->Map(0, &readRange, &mapped);
+	denoiserUploadBuffer->Map(0, &noRange, &output);
 
+	// Rebuild the full frame first if fewer pixels were traced
+	const DenoiserPixel* pixels = (const DenoiserPixel*)mapped;
+	if (IsUpscaling())
+	{
+		upscaledPixels.resize((size_t)screenWidth * screenHeight);
+		upscaler.Upscale(pixels, renderWidth, renderHeight, upscaledPixels.data(), screenWidth, screenHeight, upscalerSettings, tracedFrameIndex);
+		pixels = upscaledPixels.data();
+	}
 
+	// Then denoise (or just gamma correct) straight into the upload buffer
+	if (denoiserEnabled)
+		denoiser.Denoise(pixels, screenWidth, screenHeight, denoiserSettings, (unsigned char*)output, denoiserUploadRowPitch);
+	else
+		Denoiser::WriteColor(pixels, screenWidth, screenHeight, (unsigned char*)output, denoiserUploadRowPitch);
+	denoiserUploadBuffer->Unmap(0, 0);
+	denoiserReadbackBuffer->Unmap(0, &noRange);
+
+	// Copy the finished rows into the back buffer
+	D3D12_TEXTURE_COPY_LOCATION source = {};
+	source.pResource = denoiserUploadBuffer.Get();
+	source.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+	source.PlacedFootprint.Offset = 0;
+	source.PlacedFootprint.Footprint.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	source.PlacedFootprint.Footprint.Width = screenWidth;
+	source.PlacedFootprint.Footprint.Height = screenHeight;
+	source.PlacedFootprint.Footprint.Depth = 1;
+	source.PlacedFootprint.Footprint.RowPitch = denoiserUploadRowPitch;
+
+	D3D12_TEXTURE_COPY_LOCATION destination = {};
+	destination.pResource = currentBackBuffer.Get();
+	destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+	destination.SubresourceIndex = 0;
+
+	states.Transition(currentBackBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST);
+	states.Flush();
+	dxrCommandList->CopyTextureRegion(&destination, 0, 0, 0, &source, 0);
+}
 
 
+// --------------------------------------------------------
+// Records a compacting copy into a buffer of the compacted
+// size, which replaces the original from here on.  The
+// original is released once the GPU is done with it.
+// --------------------------------------------------------
+void DX12BLASCompaction::CompactBLAS(unsigned int blas, uint64_t compactedSize)
+{
+	DX12Helper& dx12Helper = DX12Helper::GetInstance();
+	Microsoft::WRL::ComPtr<ID3D12Resource> compacted = dx12Helper.CreateBuffer(
+		compactedSize,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
 
+	commandList->CopyRaytracingAccelerationStructure(
+		compacted->GetGPUVirtualAddress(),
+		blases[blas]->GetGPUVirtualAddress(),
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
 
+	dx12Helper.DeferRelease(blases[blas]);
+	blases[blas] = compacted;
+	compactionsRecorded = true;
+}
 
+void DX12BLASCompaction::SetBLAS(unsigned int blas, Microsoft::WRL::ComPtr<ID3D12Resource> buffer)
+{
+	if (blas >= blases.size())
+	{
+		blases.resize(blas + 1);
+		compactedSizes.resize(blas + 1, 0);
+	}
+	blases[blas] = buffer;
+}
 
-
+bool DX12BLASCompaction::TakeCompactionsRecorded()
+{
+	bool recorded = compactionsRecorded;
+	compactionsRecorded = false;
+	return recorded;
+}
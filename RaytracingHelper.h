@@ -7,8 +7,65 @@
 #include <vector>
 
 #include "Mesh.h"
+#include "BufferStructs.h"
 #include "Camera.h"
 #include "GameEntity.h"
+#include "Lights.h"
+#include "LightSampler.h"
+#include "ReservoirResampler.h"
+#include "Denoiser.h"
+#include "Upscaler.h"
+#include "FrameScheduler.h"
+#include "ShaderTableBuilder.h"
+#include "InstanceBuffer.h"
+#include "BLASBuildQueue.h"
+#include "AccelerationStructureTracker.h"
+#include "DescriptorAllocator.h"
+
+// Upload heap data the CPU rewrites while earlier frames may still be
+// reading it, so there's one of these per frame in flight.  Data that's
+// rewritten every frame goes through DX12Helper's staging ring instead.
+struct RaytracingFrameData
+{
+	// Lights and their sampling structures, as of LightVersion
+	unsigned int LightVersion;
+	UINT64 LightBufferSizeInBytes;
+	UINT64 LightAliasBufferSizeInBytes;
+	UINT64 LightBVHBufferSizeInBytes;
+	Microsoft::WRL::ComPtr<ID3D12Resource> LightBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> LightAliasBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> LightBVHBuffer;
+};
+
+// --------------------------------------------------------
+// The BLAS buffers, by index.  Compacting one copies it into
+// a buffer of its compacted size (read back after the build)
+// and releases the original once the GPU is done with it.
+// --------------------------------------------------------
+class DX12BLASCompaction : public BLASCompactionBackend
+{
+public:
+	DX12BLASCompaction() : compactionsRecorded(false) {}
+
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList4> commandList) { this->commandList = commandList; }
+
+	uint64_t ReadCompactedSize(unsigned int blas) override { return compactedSizes[blas]; }
+	void CompactBLAS(unsigned int blas, uint64_t compactedSize) override;
+
+	void SetBLAS(unsigned int blas, Microsoft::WRL::ComPtr<ID3D12Resource> buffer);
+	ID3D12Resource* GetBLAS(unsigned int blas) { return blases[blas].Get(); }
+	void SetCompactedSize(unsigned int blas, uint64_t size) { compactedSizes[blas] = size; }
+
+	// Whether any copies were recorded since the last call (BLASes
+	// can't be used until a UAV barrier after them)
+	bool TakeCompactionsRecorded();
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList4> commandList;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> blases;
+	std::vector<uint64_t> compactedSizes;
+	bool compactionsRecorded;
+};
 
 class RaytracingHelper
 {
@@ -34,15 +91,28 @@ private:
 	RaytracingHelper() :
 		dxrAvailable(false),
 		helperInitialized(false),
-		raytracingOutputUAV_CPU{},
-		raytracingOutputUAV_GPU{},
+		raytracingOutput(0),
 		screenHeight(1),
 		screenWidth(1),
+		renderHeight(1),
+		renderWidth(1),
 		tlasBufferSizeInBytes(0),
 		tlasScratchSizeInBytes(0),
-		tlasInstanceDataSizeInBytes(0),
-		shaderTableRecordSize(0),
-		blasCount(0)
+		frameData{},
+		shaderTableSizes{},
+		shaderTableCopy(0),
+		instanceDataCapacity(0),
+		materialDataCapacity(0),
+		blasCount(0),
+		lightSamplingStrategy(LIGHT_SAMPLING_ALIAS_TABLE),
+		lightVersion(0),
+		restirEnabled(true),
+		restirSettings{ 16, true, 4, 16.0f, -1 },
+		frameIndex(0),
+		reservoirHistoryFrames(0),
+		denoiserEnabled(false),
+		denoiserSettings{},
+		denoiserUploadRowPitch(0)
 	{};
 #pragma endregion
 
@@ -62,13 +132,45 @@ public:
 	// Resizing when window resizes
 	void ResizeOutputUAV(unsigned int screenWidth, unsigned int screenHeight);
 
-	// Setup process requiring data from outside the helper
+	// The texture rays are traced into: screen sized, RGBA8, allowing
+	// unordered access and registered with the state tracker.  It's owned
+	// by the frame's render graph, so it can change from frame to frame.
+	void SetOutputTexture(ID3D12Resource* output);
+
+	// Setup process requiring data from outside the helper.  BLAS builds
+	// are queued and recorded together (sharing one scratch buffer) by
+	// BuildPendingBLASes(), which the TLAS build calls first.
 	MeshRaytracingData CreateBottomLevelAccelerationStructureForMesh(Mesh* mesh);
+	void BuildPendingBLASes();
 	void CreateTopLevelAccelerationStructureForScene(std::vector<std::shared_ptr<GameEntity>> scene);
+	BLASBuildQueueStats GetBLASBuildStats() { return blasBuildQueue.GetStats(); }
+	// Memory used by acceleration structures (BLASes are compacted
+	// over the frames after they're built)
+	AccelerationStructureMemoryStats GetAccelerationStructureStats() { return accelerationStructures.GetStats(); }
+	BLASMemoryInfo GetBLASMemoryInfo(unsigned int blas) { return accelerationStructures.GetBLASInfo(blas); }
+	ShaderTableBuilderStats GetShaderTableStats() { return shaderTableBuilder.GetStats(); }
+	InstanceBufferStats GetInstanceBufferStats() { return instanceBuffer.GetStats(); }
+
+	// Uploads the scene's lights and their sampling structures
+	// Pass -1 as the strategy to pick one based on the light count
+	void UpdateLights(const std::vector<Light>& lights, int samplingStrategy = -1);
+	int GetLightSamplingStrategy() { return lightSamplingStrategy; }
+
+	// ReSTIR for direct light at primary hits
+	// (the settings' SourceStrategy is ignored - candidates use the light sampling strategy)
+	void SetReSTIR(bool enabled, const ReSTIRSettings& settings);
+
+	// CPU denoising of the raytraced image (reads it back, so it stalls the frame)
+	void SetDenoiser(bool enabled, const DenoiserSettings& settings);
+	const DenoiserTimings& GetDenoiserTimings() { return denoiser.GetTimings(); }
+
+	// Tracing fewer pixels than the window has (reconstructed on the CPU)
+	void SetUpscaler(const UpscalerSettings& settings);
+	unsigned int GetTracedPixelCount();
 
 	// Actual work
 	void Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer, unsigned int raysPerPixel, unsigned int maxRecursion,
-		DirectX::XMFLOAT3 lightSourcePos, bool executeCommandList);
+		bool executeCommandList);
 
 
 private:
@@ -76,17 +178,18 @@ private:
 	unsigned int screenWidth;
 	unsigned int screenHeight;
 
+	// Size of the grid actually traced (smaller with a render scale)
+	unsigned int renderWidth;
+	unsigned int renderHeight;
+
 	// Is raytracing (DirectX Raytracing - DXR) available on this hardware?
 	bool dxrAvailable;
 	bool helperInitialized;
 
-	// This represents the maximum number of hit groups
-	// in our shader table, each of which corresponds to
-	// a unique combination of geometry & hit shader.
-	// In a simple demo, this is effectively the maximum
-	// number of unique mesh BLAS's.
-	const unsigned int MAX_HIT_GROUPS_IN_SHADER_TABLE = 1000;
+	// Hit groups per mesh (normal, transparent and emissive), and
+	// how many copies of the shader table are used in turn
 	const unsigned int NUM_HIT_GROUPS = 3;
+	const unsigned int SHADER_TABLE_COPIES = 2;
 
 	// Command queue for processing raytracing commands
 	Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue;
@@ -106,31 +209,102 @@ private:
 	Microsoft::WRL::ComPtr<ID3D12StateObject> raytracingPipelineStateObject;
 	Microsoft::WRL::ComPtr<ID3D12StateObjectProperties> raytracingPipelineProperties;
 
-	// Shader table holding shaders for use during raytracing
-	Microsoft::WRL::ComPtr<ID3D12Resource> shaderTable;
-	UINT64 shaderTableRecordSize;
-	UINT64 shaderTableSize;
+	// Shader table, laid out from the local root signature.  Records
+	// are written to the builder's CPU copy, and each GPU copy gets
+	// (through staging) just the records that changed since its last use.
+	ShaderTableBuilder shaderTableBuilder;
+	Microsoft::WRL::ComPtr<ID3D12Resource> shaderTables[2];
+	UINT64 shaderTableSizes[2];
+	unsigned int shaderTableCopy;
+
+	// Each BLAS's first hit group record and geometry SRVs
+	std::vector<unsigned int> hitGroupRecords;
+	std::vector<D3D12_GPU_DESCRIPTOR_HANDLE> hitGroupGeometrySRVs;
+
+	// Per-instance data and the material table it indexes, which the
+	// hit shaders read by InstanceIndex().  Only changes are copied.
+	InstanceBuffer instanceBuffer;
+	std::vector<std::shared_ptr<Material>> instanceMaterials;
+	Microsoft::WRL::ComPtr<ID3D12Resource> instanceDataBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> materialDataBuffer;
+	unsigned int instanceDataCapacity;
+	unsigned int materialDataCapacity;
 
 	// How many BLAS we've created
 	UINT blasCount;
 
+	// BLAS builds waiting to be recorded, and what's needed to record
+	// them (keeping the mesh buffers alive until then)
+	struct PendingBLASBuild
+	{
+		D3D12_RAYTRACING_GEOMETRY_DESC Geometry;
+		unsigned int BLASIndex;
+		uint64_t ScratchSize;
+		Microsoft::WRL::ComPtr<ID3D12Resource> VertexBuffer;
+		Microsoft::WRL::ComPtr<ID3D12Resource> IndexBuffer;
+	};
+	BLASBuildQueue blasBuildQueue;
+	std::vector<PendingBLASBuild> pendingBLASBuilds;
+
+	// Every BLAS, and what acceleration structures use (deciding
+	// which BLASes to compact once their builds are done)
+	DX12BLASCompaction blasCompaction;
+	AccelerationStructureTracker accelerationStructures;
+
 	// Accel structure requirements
 	UINT64 tlasBufferSizeInBytes;
 	UINT64 tlasScratchSizeInBytes;
-	UINT64 tlasInstanceDataSizeInBytes;
 	Microsoft::WRL::ComPtr<ID3D12Resource> tlasScratchBuffer; 
-	Microsoft::WRL::ComPtr<ID3D12Resource> tlasInstanceDescBuffer;
 	Microsoft::WRL::ComPtr<ID3D12Resource> topLevelAccelerationStructure;
 
-	// Actual output resource
-	Microsoft::WRL::ComPtr<ID3D12Resource> raytracingOutput;
-	D3D12_CPU_DESCRIPTOR_HANDLE raytracingOutputUAV_CPU;
-	D3D12_GPU_DESCRIPTOR_HANDLE raytracingOutputUAV_GPU;
+	// Per-frame upload data, indexed by DX12Helper's frame index
+	RaytracingFrameData frameData[FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT];
+
+	// Actual output resource (a render graph transient)
+	// and its UAV (a fresh descriptor each time the output changes)
+	ID3D12Resource* raytracingOutput;
+	DescriptorHandle raytracingOutputUAV;
+
+	// Lights and their sampling structures (structured buffers in each
+	// frame's upload heaps, updated when their version falls behind)
+	LightSampler lightSampler;
+	std::vector<Light> uploadedLights;
+	int lightSamplingStrategy;
+	unsigned int lightVersion;
+
+	// ReSTIR reservoirs, swapping between "this frame" and "last frame"
+	bool restirEnabled;
+	ReSTIRSettings restirSettings;
+	unsigned int frameIndex;
+	unsigned int reservoirHistoryFrames;
+	Microsoft::WRL::ComPtr<ID3D12Resource> reservoirBuffers[2];
+
+	// CPU denoiser: ray generation writes color and primary hit data to
+	// denoiserBuffer, which is read back, denoised and uploaded again
+	Denoiser denoiser;
+	bool denoiserEnabled;
+	DenoiserSettings denoiserSettings;
+	UINT denoiserUploadRowPitch;
+
+	// Rebuilds full resolution frames when tracing fewer pixels
+	Upscaler upscaler;
+	UpscalerSettings upscalerSettings;
+	std::vector<DenoiserPixel> upscaledPixels;
+	Microsoft::WRL::ComPtr<ID3D12Resource> denoiserBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> denoiserReadbackBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> denoiserUploadBuffer;
 
 	// Helper functions for each initalization step
 	void CreateRaytracingRootSignatures();
 	void CreateRaytracingPipelineState(std::wstring raytracingShaderLibraryFile);
 	void CreateShaderTable();
+	void UploadShaderTable();
+	void EncodeHitGroupRecords(unsigned int blasIndex, unsigned char* records);
+	void UploadInstanceData();
 	void CreateRaytracingOutputUAV(unsigned int width, unsigned int height);
+	RaytracingFrameData& GetFrameData();
+	void FillUploadBuffer(Microsoft::WRL::ComPtr<ID3D12Resource>& buffer, UINT64& bufferSizeInBytes, const void* data, UINT64 dataSizeInBytes);
+	void ResolveIntoBackBuffer(Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer, unsigned int tracedFrameIndex);
+	bool IsUpscaling() { return upscalerSettings.Checkerboard || renderWidth != screenWidth || renderHeight != screenHeight; }
 };
 
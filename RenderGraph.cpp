@@ -0,0 +1,528 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+
+bool RenderGraphResourceDesc::operator==(const RenderGraphResourceDesc& other) const
+{
+	return Type == other.Type &&
+		Width == other.Width &&
+		Height == other.Height &&
+		Format == other.Format &&
+		Flags == other.Flags;
+}
+
+
+RenderGraph::RenderGraph() :
+	backend(0),
+	states(0),
+	reallocations(0)
+{
+	for (unsigned int kind = 0; kind < RENDER_GRAPH_HEAP_KIND_COUNT; kind++)
+	{
+		plannedHeapSizes[kind] = 0;
+		heapSizes[kind] = 0;
+	}
+}
+
+RenderGraph::~RenderGraph()
+{
+	ReleasePlacements();
+}
+
+void RenderGraph::Initialize(RenderGraphBackend* backend, ResourceStateTracker* states)
+{
+	this->backend = backend;
+	this->states = states;
+}
+
+void RenderGraph::Reset()
+{
+	passes.clear();
+	resources.clear();
+	executionOrder.clear();
+}
+
+RenderGraphResource RenderGraph::CreateTransient(const char* name, const RenderGraphResourceDesc& desc)
+{
+	Resource resource = {};
+	resource.Name = name;
+	resource.Imported = false;
+	resource.Desc = desc;
+	resource.HeapKind =
+		desc.Type == RENDER_GRAPH_BUFFER ? RENDER_GRAPH_HEAP_BUFFERS :
+		(desc.Flags & RENDER_GRAPH_FLAG_RENDER_TARGET) ? RENDER_GRAPH_HEAP_RENDER_TARGETS :
+		RENDER_GRAPH_HEAP_TEXTURES;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::Import(const char* name, void* resource, ResourceStates finalState)
+{
+	Resource imported = {};
+	imported.Name = name;
+	imported.Imported = true;
+	imported.Physical = resource;
+	imported.FinalState = finalState;
+	resources.push_back(imported);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+unsigned int RenderGraph::AddPass(const char* name, std::function<void()> execute)
+{
+	Pass pass = {};
+	pass.Name = name;
+	pass.Execute = execute;
+	passes.push_back(pass);
+	return (unsigned int)passes.size() - 1;
+}
+
+void RenderGraph::Read(unsigned int pass, RenderGraphResource resource, ResourceStates state)
+{
+	passes[pass].Accesses.push_back({ resource, state, false });
+}
+
+void RenderGraph::Write(unsigned int pass, RenderGraphResource resource, ResourceStates state)
+{
+	passes[pass].Accesses.push_back({ resource, state, true });
+}
+
+void RenderGraph::SetSideEffects(unsigned int pass)
+{
+	passes[pass].SideEffects = true;
+}
+
+// --------------------------------------------------------
+// Orders and culls the passes, then places (and if the
+// layout changed, creates) the transient resources
+// --------------------------------------------------------
+bool RenderGraph::Compile()
+{
+	executionOrder.clear();
+	BuildDependencies();
+	if (!ScheduleAndCull())
+		return false;
+
+	PlanAliasing();
+	Realize();
+	return !executionOrder.empty();
+}
+
+// --------------------------------------------------------
+// Records the passes in order.  Before each one, memory
+// that changes hands gets an aliasing barrier and every
+// resource it uses is transitioned, all as one batch.
+// --------------------------------------------------------
+void RenderGraph::Execute()
+{
+	std::vector<void*> beginning;
+	for (unsigned int position = 0; position < executionOrder.size(); position++)
+	{
+		Pass& pass = passes[executionOrder[position]];
+
+		beginning.clear();
+		for (const Access& access : pass.Accesses)
+		{
+			const Resource& resource = resources[access.Resource];
+			if (resource.Imported || !resource.Aliased || resource.FirstUse != position || !resource.Physical)
+				continue;
+			if (std::find(beginning.begin(), beginning.end(), resource.Physical) != beginning.end())
+				continue;
+
+			beginning.push_back(resource.Physical);
+			states->AliasingBarrier(0, resource.Physical);
+		}
+
+		for (const Access& access : pass.Accesses)
+		{
+			void* physical = resources[access.Resource].Physical;
+			if (physical)
+				states->Transition(physical, access.State);
+		}
+		states->Flush();
+
+		for (void* physical : beginning)
+			backend->BeginLifetime(physical);
+
+		if (pass.Execute)
+			pass.Execute();
+	}
+
+	// Left pending, like any other transition, for whatever
+	// comes next (or the command list's close) to flush
+	for (const Resource& resource : resources)
+	{
+		if (resource.Imported && resource.Physical)
+			states->Transition(resource.Physical, resource.FinalState);
+	}
+}
+
+void* RenderGraph::GetPhysical(RenderGraphResource resource) const
+{
+	return resource < resources.size() ? resources[resource].Physical : 0;
+}
+
+RenderGraphStats RenderGraph::GetStats() const
+{
+	RenderGraphStats stats = {};
+	stats.Passes = (unsigned int)passes.size();
+	stats.Reallocations = reallocations;
+	for (const Pass& pass : passes)
+	{
+		if (pass.Culled)
+			stats.CulledPasses++;
+	}
+	for (const Resource& resource : resources)
+	{
+		if (resource.Imported || !resource.Physical)
+			continue;
+
+		stats.TransientResources++;
+		stats.UnaliasedBytes += resource.Size;
+		if (resource.Aliased)
+			stats.AliasedResources++;
+	}
+	for (uint64_t size : heapSizes)
+		stats.HeapBytes += size;
+	return stats;
+}
+
+// --------------------------------------------------------
+// Declaration order is the order the passes would run in
+// without the graph, so it decides what depends on what:
+//  - a read depends on the last write before it,
+//  - a write comes after earlier reads and writes.
+// Only the first kind keeps another pass from being culled.
+// --------------------------------------------------------
+void RenderGraph::BuildDependencies()
+{
+	const unsigned int none = 0xffffffff;
+	std::vector<unsigned int> lastWriter(resources.size(), none);
+	std::vector<std::vector<unsigned int>> readers(resources.size());
+
+	auto addUnique = [](std::vector<unsigned int>& list, unsigned int pass)
+	{
+		if (std::find(list.begin(), list.end(), pass) == list.end())
+			list.push_back(pass);
+	};
+
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		Pass& pass = passes[p];
+		pass.Dependencies.clear();
+		pass.Producers.clear();
+		pass.Culled = false;
+
+		for (const Access& access : pass.Accesses)
+		{
+			unsigned int writer = lastWriter[access.Resource];
+			if (access.Write || writer == none || writer == p)
+				continue;
+
+			addUnique(pass.Dependencies, writer);
+			addUnique(pass.Producers, writer);
+			addUnique(readers[access.Resource], p);
+		}
+
+		for (const Access& access : pass.Accesses)
+		{
+			if (!access.Write)
+				continue;
+
+			unsigned int writer = lastWriter[access.Resource];
+			if (writer != none && writer != p)
+				addUnique(pass.Dependencies, writer);
+			for (unsigned int reader : readers[access.Resource])
+			{
+				if (reader != p)
+					addUnique(pass.Dependencies, reader);
+			}
+
+			lastWriter[access.Resource] = p;
+			readers[access.Resource].clear();
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Keeps passes with side effects or writes to imported
+// resources, and whatever produces what they read.  The
+// rest are ordered with each pass running as soon as what
+// it reads is ready, preferring whichever consumes the
+// most recent result (declaration order breaks ties).
+// --------------------------------------------------------
+bool RenderGraph::ScheduleAndCull()
+{
+	unsigned int count = (unsigned int)passes.size();
+
+	std::vector<bool> needed(count, false);
+	std::vector<unsigned int> stack;
+	for (unsigned int p = 0; p < count; p++)
+	{
+		bool root = passes[p].SideEffects;
+		for (const Access& access : passes[p].Accesses)
+		{
+			if (access.Write && resources[access.Resource].Imported)
+				root = true;
+		}
+		if (root)
+		{
+			needed[p] = true;
+			stack.push_back(p);
+		}
+	}
+	while (!stack.empty())
+	{
+		unsigned int p = stack.back();
+		stack.pop_back();
+		for (unsigned int producer : passes[p].Producers)
+		{
+			if (!needed[producer])
+			{
+				needed[producer] = true;
+				stack.push_back(producer);
+			}
+		}
+	}
+
+	unsigned int live = 0;
+	std::vector<unsigned int> waitingOn(count, 0);
+	std::vector<std::vector<unsigned int>> dependents(count);
+	for (unsigned int p = 0; p < count; p++)
+	{
+		passes[p].Culled = !needed[p];
+		if (!needed[p])
+			continue;
+
+		live++;
+		for (unsigned int dependency : passes[p].Dependencies)
+		{
+			if (!needed[dependency])
+				continue;
+			waitingOn[p]++;
+			dependents[dependency].push_back(p);
+		}
+	}
+
+	// Position each pass ran at, to find the newest result a ready pass reads
+	const unsigned int notRun = 0xffffffff;
+	std::vector<unsigned int> position(count, notRun);
+	std::vector<unsigned int> ready;
+	for (unsigned int p = 0; p < count; p++)
+	{
+		if (needed[p] && waitingOn[p] == 0)
+			ready.push_back(p);
+	}
+
+	while (!ready.empty())
+	{
+		size_t best = 0;
+		int bestScore = -1;
+		for (size_t r = 0; r < ready.size(); r++)
+		{
+			int score = -1;
+			for (unsigned int producer : passes[ready[r]].Producers)
+			{
+				if (position[producer] != notRun)
+					score = std::max(score, (int)position[producer]);
+			}
+			if (score > bestScore || (score == bestScore && ready[r] < ready[best]))
+			{
+				best = r;
+				bestScore = score;
+			}
+		}
+
+		unsigned int p = ready[best];
+		ready.erase(ready.begin() + best);
+		position[p] = (unsigned int)executionOrder.size();
+		executionOrder.push_back(p);
+
+		for (unsigned int dependent : dependents[p])
+		{
+			if (--waitingOn[dependent] == 0)
+				ready.push_back(dependent);
+		}
+	}
+
+	// Anything left over is waiting on itself
+	if (executionOrder.size() != live)
+	{
+		executionOrder.clear();
+		return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Places each heap kind's transients biggest first, at the
+// lowest offset that doesn't overlap anything placed whose
+// lifetime overlaps its own
+// --------------------------------------------------------
+void RenderGraph::PlanAliasing()
+{
+	const unsigned int unused = 0xffffffff;
+	for (Resource& resource : resources)
+	{
+		if (resource.Imported)
+			continue;
+		resource.FirstUse = unused;
+		resource.LastUse = 0;
+		resource.Aliased = false;
+		resource.Physical = 0;
+	}
+
+	for (unsigned int position = 0; position < executionOrder.size(); position++)
+	{
+		for (const Access& access : passes[executionOrder[position]].Accesses)
+		{
+			Resource& resource = resources[access.Resource];
+			if (resource.Imported)
+				continue;
+			resource.FirstUse = std::min(resource.FirstUse, position);
+			resource.LastUse = std::max(resource.LastUse, position);
+		}
+	}
+
+	for (unsigned int kind = 0; kind < RENDER_GRAPH_HEAP_KIND_COUNT; kind++)
+	{
+		std::vector<Resource*> toPlace;
+		for (Resource& resource : resources)
+		{
+			if (resource.Imported || resource.FirstUse == unused || resource.HeapKind != kind)
+				continue;
+			backend->GetAllocationInfo(resource.Desc, resource.Size, resource.Alignment);
+			toPlace.push_back(&resource);
+		}
+		std::stable_sort(toPlace.begin(), toPlace.end(), [](const Resource* a, const Resource* b)
+		{
+			return a->Size > b->Size;
+		});
+
+		uint64_t heapSize = 0;
+		std::vector<Resource*> placed;
+		std::vector<Resource*> live;
+		for (Resource* resource : toPlace)
+		{
+			live.clear();
+			for (Resource* other : placed)
+			{
+				if (other->FirstUse <= resource->LastUse && resource->FirstUse <= other->LastUse)
+					live.push_back(other);
+			}
+			std::sort(live.begin(), live.end(), [](const Resource* a, const Resource* b)
+			{
+				return a->Offset < b->Offset;
+			});
+
+			uint64_t alignment = std::max<uint64_t>(resource->Alignment, 1);
+			uint64_t offset = 0;
+			for (Resource* other : live)
+			{
+				uint64_t aligned = (offset + alignment - 1) / alignment * alignment;
+				if (aligned + resource->Size <= other->Offset)
+					break;
+				offset = std::max(offset, other->Offset + other->Size);
+			}
+			resource->Offset = (offset + alignment - 1) / alignment * alignment;
+
+			for (Resource* other : placed)
+			{
+				if (resource->Offset < other->Offset + other->Size && other->Offset < resource->Offset + resource->Size)
+				{
+					resource->Aliased = true;
+					other->Aliased = true;
+				}
+			}
+
+			placed.push_back(resource);
+			heapSize = std::max(heapSize, resource->Offset + resource->Size);
+		}
+		plannedHeapSizes[kind] = heapSize;
+	}
+}
+
+// --------------------------------------------------------
+// Reuses what's allocated if the layout is the same as last
+// time, otherwise recreates the heaps and placed resources
+// --------------------------------------------------------
+void RenderGraph::Realize()
+{
+	std::vector<Resource*> used;
+	for (Resource& resource : resources)
+	{
+		if (!resource.Imported && resource.FirstUse != 0xffffffff)
+			used.push_back(&resource);
+	}
+
+	bool same = used.size() == placements.size();
+	for (unsigned int kind = 0; same && kind < RENDER_GRAPH_HEAP_KIND_COUNT; kind++)
+		same = plannedHeapSizes[kind] == heapSizes[kind];
+
+	std::vector<bool> taken(placements.size(), false);
+	for (size_t r = 0; same && r < used.size(); r++)
+	{
+		same = false;
+		for (size_t p = 0; p < placements.size(); p++)
+		{
+			const Placement& placement = placements[p];
+			if (!taken[p] &&
+				placement.HeapKind == used[r]->HeapKind &&
+				placement.Offset == used[r]->Offset &&
+				placement.Desc == used[r]->Desc)
+			{
+				taken[p] = true;
+				used[r]->Physical = placement.Physical;
+				same = true;
+				break;
+			}
+		}
+	}
+	if (same)
+		return;
+
+	ReleasePlacements();
+	for (unsigned int kind = 0; kind < RENDER_GRAPH_HEAP_KIND_COUNT; kind++)
+	{
+		heapSizes[kind] = plannedHeapSizes[kind];
+		if (heapSizes[kind] > 0)
+			backend->CreateHeap((RenderGraphHeapKind)kind, heapSizes[kind]);
+	}
+
+	for (Resource* resource : used)
+	{
+		// Created in the state its first pass needs
+		ResourceStates initialState = RESOURCE_STATE_COMMON;
+		for (const Access& access : passes[executionOrder[resource->FirstUse]].Accesses)
+		{
+			if (&resources[access.Resource] == resource)
+			{
+				initialState = access.State;
+				break;
+			}
+		}
+
+		resource->Physical = backend->CreatePlacedResource(resource->Desc, resource->HeapKind, resource->Offset, initialState);
+		if (states)
+			states->Register(resource->Physical, initialState);
+		placements.push_back({ resource->Desc, resource->HeapKind, resource->Offset, resource->Physical });
+	}
+	reallocations++;
+}
+
+void RenderGraph::ReleasePlacements()
+{
+	if (!backend)
+		return;
+
+	if (states)
+	{
+		for (const Placement& placement : placements)
+			states->Unregister(placement.Physical);
+	}
+	if (!placements.empty())
+		backend->ReleaseAll();
+
+	placements.clear();
+	for (uint64_t& size : heapSizes)
+		size = 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ResourceStateTracker.h"
+
+// Index of a resource in a RenderGraph
+typedef unsigned int RenderGraphResource;
+#define RENDER_GRAPH_INVALID_RESOURCE 0xffffffff
+
+enum RenderGraphResourceType
+{
+	RENDER_GRAPH_BUFFER,
+	RENDER_GRAPH_TEXTURE_2D
+};
+
+// What transient textures are used as
+#define RENDER_GRAPH_FLAG_NONE				0x0
+#define RENDER_GRAPH_FLAG_UNORDERED_ACCESS	0x1
+#define RENDER_GRAPH_FLAG_RENDER_TARGET		0x2
+
+// Heaps are kept to one kind of resource each (as the lowest
+// resource heap tier requires), so aliasing happens within a kind
+enum RenderGraphHeapKind
+{
+	RENDER_GRAPH_HEAP_BUFFERS,
+	RENDER_GRAPH_HEAP_TEXTURES,
+	RENDER_GRAPH_HEAP_RENDER_TARGETS,
+	RENDER_GRAPH_HEAP_KIND_COUNT
+};
+
+struct RenderGraphResourceDesc
+{
+	RenderGraphResourceType Type;
+	uint64_t Width;					// Bytes, for buffers
+	unsigned int Height;
+	unsigned int Format;			// DXGI_FORMAT, for textures
+	unsigned int BytesPerPixel;		// Only used for estimates without a device
+	unsigned int Flags;
+
+	bool operator==(const RenderGraphResourceDesc& other) const;
+};
+
+// --------------------------------------------------------
+// Creates the graph's memory and the resources placed in
+// it: placed resources in heaps on the device, nothing but
+// bookkeeping in tests
+// --------------------------------------------------------
+class RenderGraphBackend
+{
+public:
+	virtual ~RenderGraphBackend() {}
+
+	virtual void GetAllocationInfo(const RenderGraphResourceDesc& desc, uint64_t& size, uint64_t& alignment) = 0;
+	virtual void CreateHeap(RenderGraphHeapKind kind, uint64_t size) = 0;
+	virtual void* CreatePlacedResource(const RenderGraphResourceDesc& desc, RenderGraphHeapKind kind, uint64_t offset, ResourceStates initialState) = 0;
+
+	// Releases every heap and placed resource (once the GPU is done with them)
+	virtual void ReleaseAll() = 0;
+
+	// A resource sharing memory is about to be used for the first time
+	// this frame, after its barriers, so its old contents can be discarded
+	virtual void BeginLifetime(void* /*resource*/) {}
+};
+
+struct RenderGraphStats
+{
+	unsigned int Passes;
+	unsigned int CulledPasses;
+	unsigned int TransientResources;
+	unsigned int AliasedResources;		// Sharing memory with another
+	uint64_t UnaliasedBytes;			// Every transient with its own memory
+	uint64_t HeapBytes;					// What's actually reserved
+	unsigned int Reallocations;			// Times the heaps were recreated
+};
+
+// --------------------------------------------------------
+// A frame's work as passes that declare which resources
+// they read and write, and in what state.  Compile():
+//  - orders passes so every read comes after the write it
+//    depends on (running a consumer as soon as it can, to
+//    keep transient lifetimes short),
+//  - culls passes whose results nothing uses,
+//  - places transient resources whose lifetimes don't
+//    overlap in the same heap memory.
+// Execute() then records each pass after queuing (and
+// flushing) its transitions through the state tracker.
+//
+// The graph is meant to be declared again every frame.
+// Heaps and placed resources are kept as long as the
+// layout they were created for stays the same.
+// --------------------------------------------------------
+class RenderGraph
+{
+public:
+	RenderGraph();
+	~RenderGraph();
+
+	void Initialize(RenderGraphBackend* backend, ResourceStateTracker* states);
+
+	// Clears passes and resources (but not the memory behind them)
+	void Reset();
+
+	// Lives only as long as the passes using it
+	RenderGraphResource CreateTransient(const char* name, const RenderGraphResourceDesc& desc);
+
+	// Owned elsewhere (and registered with the state tracker if it's not
+	// null).  It's left in the final state after the graph executes.
+	// Writing to an imported resource keeps the pass from being culled.
+	RenderGraphResource Import(const char* name, void* resource, ResourceStates finalState);
+
+	unsigned int AddPass(const char* name, std::function<void()> execute);
+	void Read(unsigned int pass, RenderGraphResource resource, ResourceStates state);
+	void Write(unsigned int pass, RenderGraphResource resource, ResourceStates state);
+	// Never culled, even if nothing reads what it writes
+	void SetSideEffects(unsigned int pass);
+
+	// False if the passes have a cycle (or nothing to do)
+	bool Compile();
+	void Execute();
+
+	// Only valid after Compile() (null for culled resources)
+	void* GetPhysical(RenderGraphResource resource) const;
+	const std::vector<unsigned int>& GetExecutionOrder() const { return executionOrder; }
+	bool IsCulled(unsigned int pass) const { return pass < passes.size() && passes[pass].Culled; }
+	const char* GetPassName(unsigned int pass) const { return pass < passes.size() ? passes[pass].Name.c_str() : ""; }
+	RenderGraphStats GetStats() const;
+
+private:
+	struct Access
+	{
+		RenderGraphResource Resource;
+		ResourceStates State;
+		bool Write;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		std::function<void()> Execute;
+		std::vector<Access> Accesses;
+		std::vector<unsigned int> Dependencies;	// Passes that must run first
+		std::vector<unsigned int> Producers;	// Of what it reads (keeping them alive)
+		bool SideEffects;
+		bool Culled;
+	};
+
+	struct Resource
+	{
+		std::string Name;
+		bool Imported;
+		void* Physical;
+		ResourceStates FinalState;
+
+		// Transient only
+		RenderGraphResourceDesc Desc;
+		RenderGraphHeapKind HeapKind;
+		uint64_t Size;
+		uint64_t Alignment;
+		uint64_t Offset;
+		unsigned int FirstUse;		// Positions in the execution order
+		unsigned int LastUse;
+		bool Aliased;
+	};
+
+	// A transient as placed by the last realized layout
+	struct Placement
+	{
+		RenderGraphResourceDesc Desc;
+		RenderGraphHeapKind HeapKind;
+		uint64_t Offset;
+		void* Physical;
+	};
+
+	RenderGraphBackend* backend;
+	ResourceStateTracker* states;
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	std::vector<unsigned int> executionOrder;
+
+	// What the last Compile() needs, and what's currently allocated
+	uint64_t plannedHeapSizes[RENDER_GRAPH_HEAP_KIND_COUNT];
+	std::vector<Placement> placements;
+	uint64_t heapSizes[RENDER_GRAPH_HEAP_KIND_COUNT];
+	unsigned int reallocations;
+
+	void BuildDependencies();
+	bool ScheduleAndCull();
+	void PlanAliasing();
+	void Realize();
+	void ReleasePlacements();
+};
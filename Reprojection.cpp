@@ -0,0 +1,135 @@
+#include "Reprojection.h"
+
+#include <cmath>
+
+using namespace DirectX;
+
+// Reprojections that keep less than this much bilinear weight are disocclusions
+#define REPROJECTION_MIN_WEIGHT 0.01f
+
+// --------------------------------------------------------
+// Projects a world space point to a screen UV
+// --------------------------------------------------------
+bool Reprojection::WorldToUV(XMFLOAT3 position, const XMFLOAT4X4& viewProjection, XMFLOAT2& uv)
+{
+	XMFLOAT4 clip;
+	XMStoreFloat4(&clip, XMVector4Transform(XMVectorSet(position.x, position.y, position.z, 1.0f), XMLoadFloat4x4(&viewProjection)));
+	if (clip.w <= 0.0f)
+		return false;
+
+	uv.x = clip.x / clip.w * 0.5f + 0.5f;
+	uv.y = -clip.y / clip.w * 0.5f + 0.5f;
+	return true;
+}
+
+// --------------------------------------------------------
+// Takes a point back into the object's space and out again
+// with last frame's world matrix
+// --------------------------------------------------------
+XMFLOAT3 Reprojection::PreviousPosition(XMFLOAT3 position, const XMFLOAT4X4& world, const XMFLOAT4X4& previousWorld)
+{
+	XMMATRIX toObject = XMMatrixInverse(0, XMLoadFloat4x4(&world));
+	XMMATRIX objectToPrevious = XMMatrixMultiply(toObject, XMLoadFloat4x4(&previousWorld));
+
+	XMFLOAT3 previous;
+	XMStoreFloat3(&previous, XMVector3TransformCoord(XMLoadFloat3(&position), objectToPrevious));
+	return previous;
+}
+
+// --------------------------------------------------------
+// Screen space motion of a point since last frame
+// --------------------------------------------------------
+bool Reprojection::MotionVector(
+	XMFLOAT3 position,
+	const XMFLOAT4X4& world,
+	const XMFLOAT4X4& previousWorld,
+	const XMFLOAT4X4& viewProjection,
+	const XMFLOAT4X4& previousViewProjection,
+	XMFLOAT2& motion)
+{
+	XMFLOAT2 uv;
+	XMFLOAT2 previousUV;
+	if (!WorldToUV(position, viewProjection, uv) ||
+		!WorldToUV(PreviousPosition(position, world, previousWorld), previousViewProjection, previousUV))
+		return false;
+
+	motion.x = previousUV.x - uv.x;
+	motion.y = previousUV.y - uv.y;
+	return true;
+}
+
+// --------------------------------------------------------
+// Instance, normal and depth tests between a surface and
+// the history pixel it was reprojected onto
+// --------------------------------------------------------
+bool Reprojection::IsDisoccluded(const ReprojectionSurface& current, float expectedDepth, const ReprojectionSurface& history)
+{
+	if (expectedDepth <= REPROJECTION_INVALID_DEPTH || history.Depth <= 0.0f)
+		return true;
+
+	if (history.InstanceID != current.InstanceID)
+		return true;
+
+	float nDot =
+		history.Normal.x * current.Normal.x +
+		history.Normal.y * current.Normal.y +
+		history.Normal.z * current.Normal.z;
+	if (nDot < REPROJECTION_NORMAL_THRESHOLD)
+		return true;
+
+	return fabsf(history.Depth - expectedDepth) > REPROJECTION_DEPTH_THRESHOLD * expectedDepth;
+}
+
+// --------------------------------------------------------
+// Gathers the (up to) four history pixels around the
+// reprojected position, dropping any that are disoccluded
+// --------------------------------------------------------
+bool Reprojection::FindHistoryTaps(
+	XMFLOAT2 uv,
+	XMFLOAT2 motion,
+	const ReprojectionSurface& current,
+	float expectedDepth,
+	const ReprojectionSurface* history,
+	unsigned int width,
+	unsigned int height,
+	ReprojectionTaps& taps)
+{
+	taps.Count = 0;
+
+	// Pixel centers sit at half pixel offsets
+	float px = (uv.x + motion.x) * width - 0.5f;
+	float py = (uv.y + motion.y) * height - 0.5f;
+	float x0 = floorf(px);
+	float y0 = floorf(py);
+	float fx = px - x0;
+	float fy = py - y0;
+
+	float weightSum = 0.0f;
+	for (int t = 0; t < 4; t++)
+	{
+		float tx = x0 + (t & 1);
+		float ty = y0 + (t >> 1);
+		if (tx < 0.0f || ty < 0.0f || tx >= (float)width || ty >= (float)height)
+			continue;
+
+		unsigned int index = (unsigned int)ty * width + (unsigned int)tx;
+		if (IsDisoccluded(current, expectedDepth, history[index]))
+			continue;
+
+		float w = ((t & 1) ? fx : 1.0f - fx) * ((t >> 1) ? fy : 1.0f - fy);
+		taps.Indices[taps.Count] = index;
+		taps.Weights[taps.Count] = w;
+		taps.Count++;
+		weightSum += w;
+	}
+
+	if (weightSum < REPROJECTION_MIN_WEIGHT)
+	{
+		taps.Count = 0;
+		return false;
+	}
+
+	for (unsigned int i = 0; i < taps.Count; i++)
+		taps.Weights[i] /= weightSum;
+	return true;
+}
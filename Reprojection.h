@@ -0,0 +1,86 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// History is only reused when the surface there is similar enough
+// (same instance, normals within ~25 degrees, depth within 10%)
+#define REPROJECTION_NORMAL_THRESHOLD 0.9f
+#define REPROJECTION_DEPTH_THRESHOLD 0.1f
+
+// Previous depth written for hits that were behind last frame's camera
+// Must match the define in Raytracing.hlsl
+#define REPROJECTION_INVALID_DEPTH 0.0f
+
+// What the disocclusion tests need to know about a pixel's surface
+struct ReprojectionSurface
+{
+	float				Depth;		// Distance from the camera, 0 for misses
+	DirectX::XMFLOAT3	Normal;		// World space
+	unsigned int		InstanceID;
+};
+
+// Up to four history pixels around a reprojected position and
+// their bilinear weights, renormalized over the taps that passed
+struct ReprojectionTaps
+{
+	unsigned int	Indices[4];
+	float			Weights[4];
+	unsigned int	Count;
+};
+
+// --------------------------------------------------------
+// Motion vectors and history lookups shared by the ray
+// generation pass (mirrored in Raytracing.hlsl) and the CPU
+// passes that accumulate over time.  Every function is pure,
+// so they can be checked without a device.
+//
+// Screen positions are UVs: (0,0) is the top left corner of
+// the screen and (1,1) the bottom right.  Motion vectors point
+// from this frame's UV to last frame's, so history lives at
+// uv + motion.  Matrices use DirectXMath's row vector order.
+// --------------------------------------------------------
+class Reprojection
+{
+public:
+	// Projects a world space point to a screen UV.  Returns false if
+	// it's behind the camera, in which case uv is left untouched.
+	static bool WorldToUV(DirectX::XMFLOAT3 position, const DirectX::XMFLOAT4X4& viewProjection, DirectX::XMFLOAT2& uv);
+
+	// Where a point on an object was last frame, given the object's
+	// world matrix this frame and last frame
+	static DirectX::XMFLOAT3 PreviousPosition(
+		DirectX::XMFLOAT3 position,
+		const DirectX::XMFLOAT4X4& world,
+		const DirectX::XMFLOAT4X4& previousWorld);
+
+	// Screen space motion of a point on an object, from the object's and
+	// camera's current and previous matrices.  Returns false if either
+	// position is behind its camera.
+	static bool MotionVector(
+		DirectX::XMFLOAT3 position,
+		const DirectX::XMFLOAT4X4& world,
+		const DirectX::XMFLOAT4X4& previousWorld,
+		const DirectX::XMFLOAT4X4& viewProjection,
+		const DirectX::XMFLOAT4X4& previousViewProjection,
+		DirectX::XMFLOAT2& motion);
+
+	// Is a history pixel a different surface than the one it was
+	// reprojected from?  expectedDepth is the current surface's distance
+	// from last frame's camera, which is what the history pixel stored.
+	static bool IsDisoccluded(
+		const ReprojectionSurface& current,
+		float expectedDepth,
+		const ReprojectionSurface& history);
+
+	// Bilinear taps around uv + motion that pass the disocclusion tests.
+	// Returns false (and no taps) if too little of the footprint survived.
+	static bool FindHistoryTaps(
+		DirectX::XMFLOAT2 uv,
+		DirectX::XMFLOAT2 motion,
+		const ReprojectionSurface& current,
+		float expectedDepth,
+		const ReprojectionSurface* history,
+		unsigned int width,
+		unsigned int height,
+		ReprojectionTaps& taps);
+};
@@ -0,0 +1,289 @@
+#include "ReservoirResampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Tiny hash based random numbers so every pixel gets its own
+// stream no matter what order the pixels are processed in
+// (the shader does the same thing per dispatch index)
+// --------------------------------------------------------
+static unsigned int HashPixel(unsigned int pixel, unsigned int frameIndex, unsigned int pass)
+{
+	unsigned int h = pixel * 747796405u + frameIndex * 2891336453u + pass * 277803737u;
+	h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+	return (h >> 22u) ^ h;
+}
+
+static float NextRandom(unsigned int& state)
+{
+	state = state * 747796405u + 2891336453u;
+	unsigned int h = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	h = (h >> 22u) ^ h;
+	return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+static float Dot(XMFLOAT3 a, XMFLOAT3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+
+ReservoirResampler::ReservoirResampler() :
+	width(0),
+	height(0)
+{
+}
+
+// --------------------------------------------------------
+// Empties a reservoir and ties it to a shading point
+// --------------------------------------------------------
+void ReservoirResampler::ResetReservoir(LightReservoir& reservoir, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	reservoir = {};
+	reservoir.LightIndex = -1;
+	reservoir.Position = position;
+	reservoir.Normal = normal;
+}
+
+// --------------------------------------------------------
+// Streams one candidate through the reservoir.  The weight
+// is the candidate's target function over its source pdf.
+// Returns true if the candidate replaced the current choice.
+// --------------------------------------------------------
+bool ReservoirResampler::UpdateReservoir(LightReservoir& reservoir, int lightIndex, float weight, float targetPdf, float u)
+{
+	reservoir.WeightSum += weight;
+	reservoir.M += 1.0f;
+
+	if (weight > 0.0f && u * reservoir.WeightSum < weight)
+	{
+		reservoir.LightIndex = lightIndex;
+		reservoir.TargetPdf = targetPdf;
+		return true;
+	}
+	return false;
+}
+
+// --------------------------------------------------------
+// Works out the contribution weight of the chosen light,
+// which takes the place of 1/pdf when shading with it
+// --------------------------------------------------------
+void ReservoirResampler::FinalizeReservoir(LightReservoir& reservoir)
+{
+	if (reservoir.LightIndex < 0 || reservoir.TargetPdf <= 0.0f || reservoir.M <= 0.0f)
+	{
+		reservoir.W = 0.0f;
+		return;
+	}
+
+	reservoir.W = reservoir.WeightSum / (reservoir.M * reservoir.TargetPdf);
+}
+
+// --------------------------------------------------------
+// Merges finalized reservoirs as if all of their candidates
+// had been streamed through one reservoir at the first one's
+// shading point.  Each light is weighted by how likely the
+// reservoirs that could have produced it were to find it
+// (generalized balance heuristic), which keeps the result
+// unbiased and bounded even when neighbours see different lights.
+// --------------------------------------------------------
+void ReservoirResampler::CombineReservoirs(
+	LightReservoir& result,
+	const LightReservoir* const* reservoirs,
+	unsigned int count,
+	const std::vector<Light>& lights,
+	const float* randoms)
+{
+	const LightReservoir& center = *reservoirs[0];
+	ResetReservoir(result, center.Position, center.Normal);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const LightReservoir& candidate = *reservoirs[i];
+		result.M += candidate.M;
+		if (candidate.LightIndex < 0 || candidate.W <= 0.0f)
+			continue;
+
+		// Balance heuristic over every reservoir's view of this light
+		const Light& light = lights[candidate.LightIndex];
+		float misDenominator = 0.0f;
+		for (unsigned int j = 0; j < count; j++)
+		{
+			float targetPdf = j == i ?
+				candidate.TargetPdf :
+				LightSampler::UnshadowedContribution(light, reservoirs[j]->Position, reservoirs[j]->Normal);
+			misDenominator += reservoirs[j]->M * targetPdf;
+		}
+		if (misDenominator <= 0.0f)
+			continue;
+
+		float misWeight = candidate.M * candidate.TargetPdf / misDenominator;
+		float targetPdfHere = i == 0 ?
+			candidate.TargetPdf :
+			LightSampler::UnshadowedContribution(light, center.Position, center.Normal);
+
+		float weight = misWeight * targetPdfHere * candidate.W;
+		result.WeightSum += weight;
+		if (weight > 0.0f && randoms[i] * result.WeightSum < weight)
+		{
+			result.LightIndex = candidate.LightIndex;
+			result.TargetPdf = targetPdfHere;
+		}
+	}
+
+	// The MIS weights already sum to one, so no division by M here
+	result.W = result.LightIndex >= 0 && result.TargetPdf > 0.0f ?
+		result.WeightSum / result.TargetPdf : 0.0f;
+}
+
+// --------------------------------------------------------
+// Rejects reservoirs from different surfaces, which would
+// otherwise bleed light across edges
+// --------------------------------------------------------
+bool ReservoirResampler::CanReuse(const LightReservoir& reservoir, const LightReservoir& other)
+{
+	if (other.M <= 0.0f)
+		return false;
+
+	if (Dot(reservoir.Normal, other.Normal) < RESTIR_NORMAL_THRESHOLD)
+		return false;
+
+	// Distance of the other point from this point's tangent plane
+	XMFLOAT3 offset(
+		other.Position.x - reservoir.Position.x,
+		other.Position.y - reservoir.Position.y,
+		other.Position.z - reservoir.Position.z);
+	return fabsf(Dot(offset, reservoir.Normal)) < RESTIR_PLANE_DISTANCE_THRESHOLD;
+}
+
+void ReservoirResampler::ClearHistory()
+{
+	previousReservoirs.clear();
+	currentReservoirs.clear();
+	temporalReservoirs.clear();
+}
+
+// --------------------------------------------------------
+// One frame of ReSTIR: initial candidates, then temporal
+// reuse, then spatial reuse.  Each pass reads from the
+// previous pass' buffer, as separate dispatches would.
+// --------------------------------------------------------
+void ReservoirResampler::Resample(
+	const std::vector<Light>& lights,
+	const LightSampler& sampler,
+	const std::vector<XMFLOAT3>& positions,
+	const std::vector<XMFLOAT3>& normals,
+	unsigned int width,
+	unsigned int height,
+	const ReSTIRSettings& settings,
+	unsigned int frameIndex)
+{
+	unsigned int pixelCount = width * height;
+
+	// Last frame's results become this frame's history, unless the size changed
+	if (width != this->width || height != this->height)
+	{
+		ClearHistory();
+		this->width = width;
+		this->height = height;
+	}
+	previousReservoirs.swap(currentReservoirs);
+	currentReservoirs.resize(pixelCount);
+	temporalReservoirs.resize(pixelCount);
+	bool hasHistory = previousReservoirs.size() == pixelCount;
+
+	float maxTemporalM = (float)(RESTIR_TEMPORAL_M_CAP * std::max(settings.InitialCandidates, 1u));
+
+	// Initial candidates and temporal reuse
+	for (unsigned int p = 0; p < pixelCount; p++)
+	{
+		unsigned int rng = HashPixel(p, frameIndex, 0);
+		LightReservoir& reservoir = temporalReservoirs[p];
+		ResetReservoir(reservoir, positions[p], normals[p]);
+
+		for (unsigned int c = 0; c < settings.InitialCandidates; c++)
+		{
+			float u0 = NextRandom(rng);
+			float u1 = NextRandom(rng);
+			LightSample sample = sampler.Sample(settings.SourceStrategy, positions[p], u0, u1);
+			if (sample.LightIndex < 0 || sample.Pdf <= 0.0f)
+			{
+				reservoir.M += 1.0f;
+				continue;
+			}
+
+			float targetPdf = LightSampler::UnshadowedContribution(lights[sample.LightIndex], positions[p], normals[p]);
+			UpdateReservoir(reservoir, sample.LightIndex, targetPdf / sample.Pdf, targetPdf, NextRandom(rng));
+		}
+
+		FinalizeReservoir(reservoir);
+
+		// Temporal reuse (the demo camera is mostly static, so this
+		// uses the same pixel and relies on CanReuse to reject changes)
+		if (settings.Temporal && hasHistory)
+		{
+			LightReservoir previous = previousReservoirs[p];
+			if (CanReuse(reservoir, previous) && previous.LightIndex < (int)lights.size())
+			{
+				previous.M = std::min(previous.M, maxTemporalM);
+
+				LightReservoir initial = reservoir;
+				const LightReservoir* pair[2] = { &initial, &previous };
+				float randoms[2] = { NextRandom(rng), NextRandom(rng) };
+				CombineReservoirs(reservoir, pair, 2, lights, randoms);
+			}
+		}
+	}
+
+	// Spatial reuse
+	for (unsigned int p = 0; p < pixelCount; p++)
+	{
+		const LightReservoir& center = temporalReservoirs[p];
+		LightReservoir& reservoir = currentReservoirs[p];
+		if (settings.SpatialSamples == 0)
+		{
+			reservoir = center;
+			continue;
+		}
+
+		unsigned int rng = HashPixel(p, frameIndex, 1);
+		const LightReservoir* neighbours[RESTIR_MAX_SPATIAL_SAMPLES + 1] = { &center };
+		float randoms[RESTIR_MAX_SPATIAL_SAMPLES + 1] = { NextRandom(rng) };
+		unsigned int neighbourCount = 1;
+
+		int x = (int)(p % width);
+		int y = (int)(p / width);
+		unsigned int spatialSamples = std::min(settings.SpatialSamples, (unsigned int)RESTIR_MAX_SPATIAL_SAMPLES);
+		for (unsigned int s = 0; s < spatialSamples; s++)
+		{
+			// Random neighbour in a disk around this pixel
+			float angle = NextRandom(rng) * 6.2831853f;
+			float radius = sqrtf(NextRandom(rng)) * settings.SpatialRadius;
+			int nx = x + (int)(cosf(angle) * radius);
+			int ny = y + (int)(sinf(angle) * radius);
+			if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height || (nx == x && ny == y))
+				continue;
+
+			const LightReservoir& neighbour = temporalReservoirs[ny * width + nx];
+			if (!CanReuse(center, neighbour))
+				continue;
+
+			randoms[neighbourCount] = NextRandom(rng);
+			neighbours[neighbourCount++] = &neighbour;
+		}
+
+		CombineReservoirs(reservoir, neighbours, neighbourCount, lights, randoms);
+	}
+}
+
+// --------------------------------------------------------
+// Direct light estimate for a pixel using its chosen light
+// --------------------------------------------------------
+float ReservoirResampler::Shade(const std::vector<Light>& lights, unsigned int pixel) const
+{
+	const LightReservoir& reservoir = currentReservoirs[pixel];
+	if (reservoir.LightIndex < 0 || reservoir.W <= 0.0f)
+		return 0.0f;
+
+	return LightSampler::UnshadowedContribution(lights[reservoir.LightIndex], reservoir.Position, reservoir.Normal) * reservoir.W;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Lights.h"
+#include "LightSampler.h"
+
+// Temporal reservoirs may carry at most this many times the
+// current frame's candidate count, so stale history can't dominate
+// Must match the define in Raytracing.hlsl
+#define RESTIR_TEMPORAL_M_CAP 20
+
+// Neighbours are only reused when their surface is similar enough
+// Must match the defines in Raytracing.hlsl
+#define RESTIR_NORMAL_THRESHOLD 0.9f
+#define RESTIR_PLANE_DISTANCE_THRESHOLD 0.1f
+
+// Most neighbours spatial reuse will look at
+// Must match the define in Raytracing.hlsl
+#define RESTIR_MAX_SPATIAL_SAMPLES 8
+
+// One pixel's reservoir of light samples (weighted reservoir sampling)
+// Must match the struct in Raytracing.hlsl
+struct LightReservoir
+{
+	int					LightIndex;	// Chosen light, -1 if none yet
+	float				WeightSum;	// Sum of all resampling weights seen
+	float				M;			// Number of candidates seen
+	float				W;			// Unbiased contribution weight of the chosen light
+	DirectX::XMFLOAT3	Position;	// Shading point the reservoir belongs to
+	float				TargetPdf;	// Target function of the chosen light at Position
+	DirectX::XMFLOAT3	Normal;
+	float				Padding;	// 48 bytes
+};
+
+// Which parts of ReSTIR to run
+struct ReSTIRSettings
+{
+	unsigned int	InitialCandidates;	// Lights drawn from the source sampler per pixel
+	bool			Temporal;			// Reuse last frame's reservoir for this pixel
+	unsigned int	SpatialSamples;		// Neighbouring reservoirs to reuse
+	float			SpatialRadius;		// In pixels
+	int				SourceStrategy;		// LightSampler strategy for the candidates
+};
+
+// --------------------------------------------------------
+// Reservoir-based spatiotemporal importance resampling
+// (ReSTIR) for direct lighting.  Each pixel streams a handful
+// of cheap candidates from the light sampler through a single
+// reservoir, then merges the reservoirs of last frame and of
+// its neighbours, ending up with one light that's distributed
+// close to its actual contribution.  Only that one light then
+// needs a shadow ray.
+//
+// This is the CPU reference for the hit shader version in
+// Raytracing.hlsl, operating on a headless "G-buffer" of
+// shading points.  The target function is the unshadowed
+// contribution from LightSampler, so visibility isn't part
+// of the reference.
+// --------------------------------------------------------
+class ReservoirResampler
+{
+public:
+	ReservoirResampler();
+
+	// Reservoir operations
+	static void ResetReservoir(LightReservoir& reservoir, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+	static bool UpdateReservoir(LightReservoir& reservoir, int lightIndex, float weight, float targetPdf, float u);
+	static void FinalizeReservoir(LightReservoir& reservoir);
+
+	// Resamples several finalized reservoirs into one for the first reservoir's
+	// shading point.  Uses generalized balance heuristic weights, so a light that's
+	// much brighter here than where it was found doesn't turn into a firefly.
+	static void CombineReservoirs(
+		LightReservoir& result,
+		const LightReservoir* const* reservoirs,
+		unsigned int count,
+		const std::vector<Light>& lights,
+		const float* randoms);
+
+	// Is another pixel's surface similar enough to reuse its reservoir?
+	static bool CanReuse(const LightReservoir& reservoir, const LightReservoir& other);
+
+	// Runs one frame of resampling over a width * height grid of shading points
+	void Resample(
+		const std::vector<Light>& lights,
+		const LightSampler& sampler,
+		const std::vector<DirectX::XMFLOAT3>& positions,
+		const std::vector<DirectX::XMFLOAT3>& normals,
+		unsigned int width,
+		unsigned int height,
+		const ReSTIRSettings& settings,
+		unsigned int frameIndex);
+
+	// One-sample direct light estimate for a pixel from its reservoir
+	float Shade(const std::vector<Light>& lights, unsigned int pixel) const;
+
+	const std::vector<LightReservoir>& GetReservoirs() const { return currentReservoirs; }
+	void ClearHistory();
+
+private:
+	unsigned int width;
+	unsigned int height;
+	std::vector<LightReservoir> currentReservoirs;
+	std::vector<LightReservoir> previousReservoirs;
+	std::vector<LightReservoir> temporalReservoirs;
+};
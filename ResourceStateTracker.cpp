@@ -0,0 +1,370 @@
+#include "ResourceStateTracker.h"
+
+#include <cstddef>
+
+// States that can be combined with each other (and never written)
+#define RESOURCE_STATE_READ_ONLY_MASK ( \
+	RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER | \
+	RESOURCE_STATE_INDEX_BUFFER | \
+	RESOURCE_STATE_DEPTH_READ | \
+	RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | \
+	RESOURCE_STATE_PIXEL_SHADER_RESOURCE | \
+	RESOURCE_STATE_INDIRECT_ARGUMENT | \
+	RESOURCE_STATE_COPY_SOURCE)
+
+bool ResourceBarrier::operator==(const ResourceBarrier& other) const
+{
+	return Type == other.Type &&
+		Split == other.Split &&
+		Resource == other.Resource &&
+		(Type != RESOURCE_BARRIER_ALIASING || ResourceBefore == other.ResourceBefore) &&
+		(Type != RESOURCE_BARRIER_TRANSITION || (
+			Subresource == other.Subresource &&
+			Before == other.Before &&
+			After == other.After));
+}
+
+
+ResourceStateTracker::ResourceStateTracker() :
+	sink(0),
+	batches(0),
+	barriers(0),
+	skippedTransitions(0),
+	mergedTransitions(0),
+	splitBarriers(0),
+	untrackedUses(0)
+{
+}
+
+void ResourceStateTracker::Initialize(ResourceBarrierSink* sink)
+{
+	this->sink = sink;
+	resources.clear();
+	pending.clear();
+	ResetStats();
+}
+
+void ResourceStateTracker::Register(void* resource, ResourceStates state, unsigned int subresourceCount)
+{
+	TrackedResource& tracked = resources[resource];
+	tracked.State = state;
+	tracked.Subresources.clear();
+	tracked.SubresourceCount = subresourceCount > 0 ? subresourceCount : 1;
+	tracked.SplitInFlight = false;
+	tracked.SplitBefore = state;
+}
+
+// --------------------------------------------------------
+// Also drops anything still queued for it, since it's
+// about to be released
+// --------------------------------------------------------
+void ResourceStateTracker::Unregister(void* resource)
+{
+	resources.erase(resource);
+	for (size_t i = 0; i < pending.size();)
+	{
+		if (pending[i].Resource == resource)
+			pending.erase(pending.begin() + i);
+		else
+			i++;
+	}
+}
+
+// --------------------------------------------------------
+// Read states the resource is already in are kept (so the
+// next read of either kind needs no barrier).  Everything
+// else is a transition to exactly the requested state.
+// --------------------------------------------------------
+void ResourceStateTracker::Transition(void* resource, ResourceStates state, unsigned int subresource)
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+	{
+		untrackedUses++;
+		return;
+	}
+	TrackedResource& tracked = found->second;
+
+	// Finish a split transition first (which may be all that's needed)
+	if (tracked.SplitInFlight)
+	{
+		EndTransition(resource);
+		if (tracked.State == state)
+			return;
+	}
+
+	// A single subresource resource is always uniform
+	if (tracked.SubresourceCount == 1)
+		subresource = RESOURCE_ALL_SUBRESOURCES;
+
+	if (subresource == RESOURCE_ALL_SUBRESOURCES)
+	{
+		if (tracked.Subresources.empty())
+		{
+			ResourceStates current = tracked.State;
+			if (current == state || (IsReadOnly(state) && (current & state) == state))
+			{
+				skippedTransitions++;
+				return;
+			}
+
+			ResourceStates target = IsReadOnly(state) && IsReadOnly(current) ? current | state : state;
+			QueueTransition(resource, RESOURCE_ALL_SUBRESOURCES, current, target);
+			tracked.State = target;
+			return;
+		}
+
+		// Subresources differ, so each one that isn't there yet gets its own
+		for (unsigned int i = 0; i < tracked.SubresourceCount; i++)
+		{
+			if (tracked.Subresources[i] == state)
+				skippedTransitions++;
+			else
+				QueueTransition(resource, i, tracked.Subresources[i], state);
+		}
+		tracked.Subresources.clear();
+		tracked.State = state;
+		return;
+	}
+
+	if (subresource >= tracked.SubresourceCount)
+		return;
+
+	ResourceStates current = GetSubresourceState(tracked, subresource);
+	if (current == state || (IsReadOnly(state) && (current & state) == state))
+	{
+		skippedTransitions++;
+		return;
+	}
+
+	ResourceStates target = IsReadOnly(state) && IsReadOnly(current) ? current | state : state;
+	QueueTransition(resource, subresource, current, target);
+	SetSubresourceState(tracked, subresource, target);
+}
+
+void ResourceStateTracker::BeginTransition(void* resource, ResourceStates state)
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+	{
+		untrackedUses++;
+		return;
+	}
+	TrackedResource& tracked = found->second;
+
+	if (tracked.SplitInFlight)
+		EndTransition(resource);
+
+	// Only whole resources in one state are split
+	if (!tracked.Subresources.empty() || IsReadOnly(state))
+	{
+		Transition(resource, state);
+		return;
+	}
+	if (tracked.State == state)
+	{
+		skippedTransitions++;
+		return;
+	}
+
+	ResourceBarrier barrier = {};
+	barrier.Type = RESOURCE_BARRIER_TRANSITION;
+	barrier.Split = RESOURCE_BARRIER_SPLIT_BEGIN;
+	barrier.Resource = resource;
+	barrier.Subresource = RESOURCE_ALL_SUBRESOURCES;
+	barrier.Before = tracked.State;
+	barrier.After = state;
+	pending.push_back(barrier);
+
+	tracked.SplitInFlight = true;
+	tracked.SplitBefore = tracked.State;
+	tracked.State = state;
+}
+
+// --------------------------------------------------------
+// If the begin hasn't been emitted yet there's nothing to
+// overlap with, so it just becomes a regular transition
+// --------------------------------------------------------
+void ResourceStateTracker::EndTransition(void* resource)
+{
+	auto found = resources.find(resource);
+	if (found == resources.end() || !found->second.SplitInFlight)
+		return;
+	TrackedResource& tracked = found->second;
+	tracked.SplitInFlight = false;
+
+	for (ResourceBarrier& barrier : pending)
+	{
+		if (barrier.Resource == resource && barrier.Split == RESOURCE_BARRIER_SPLIT_BEGIN)
+		{
+			barrier.Split = RESOURCE_BARRIER_SPLIT_NONE;
+			return;
+		}
+	}
+
+	ResourceBarrier barrier = {};
+	barrier.Type = RESOURCE_BARRIER_TRANSITION;
+	barrier.Split = RESOURCE_BARRIER_SPLIT_END;
+	barrier.Resource = resource;
+	barrier.Subresource = RESOURCE_ALL_SUBRESOURCES;
+	barrier.Before = tracked.SplitBefore;
+	barrier.After = tracked.State;
+	pending.push_back(barrier);
+	splitBarriers++;
+}
+
+// --------------------------------------------------------
+// A transition already waits for earlier writes, so a UAV
+// barrier next to one (or another UAV barrier) is dropped
+// --------------------------------------------------------
+void ResourceStateTracker::UAVBarrier(void* resource)
+{
+	for (const ResourceBarrier& barrier : pending)
+	{
+		if (barrier.Resource == resource && barrier.Type != RESOURCE_BARRIER_ALIASING && barrier.Split != RESOURCE_BARRIER_SPLIT_BEGIN)
+		{
+			mergedTransitions++;
+			return;
+		}
+	}
+
+	ResourceBarrier barrier = {};
+	barrier.Type = RESOURCE_BARRIER_UAV;
+	barrier.Split = RESOURCE_BARRIER_SPLIT_NONE;
+	barrier.Resource = resource;
+	pending.push_back(barrier);
+}
+
+void ResourceStateTracker::AliasingBarrier(void* before, void* after)
+{
+	ResourceBarrier barrier = {};
+	barrier.Type = RESOURCE_BARRIER_ALIASING;
+	barrier.Split = RESOURCE_BARRIER_SPLIT_NONE;
+	barrier.Resource = after;
+	barrier.ResourceBefore = before;
+	pending.push_back(barrier);
+}
+
+void ResourceStateTracker::Flush()
+{
+	if (pending.empty())
+		return;
+
+	if (sink)
+		sink->EmitBarriers(pending.data(), (unsigned int)pending.size());
+	batches++;
+	barriers += (unsigned int)pending.size();
+	pending.clear();
+}
+
+ResourceStates ResourceStateTracker::GetState(void* resource, unsigned int subresource) const
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+		return RESOURCE_STATE_COMMON;
+	return GetSubresourceState(found->second, subresource);
+}
+
+ResourceStateTrackerStats ResourceStateTracker::GetStats() const
+{
+	ResourceStateTrackerStats stats = {};
+	stats.TrackedResources = (unsigned int)resources.size();
+	stats.Batches = batches;
+	stats.Barriers = barriers;
+	stats.SkippedTransitions = skippedTransitions;
+	stats.MergedTransitions = mergedTransitions;
+	stats.SplitBarriers = splitBarriers;
+	stats.UntrackedUses = untrackedUses;
+	return stats;
+}
+
+void ResourceStateTracker::ResetStats()
+{
+	batches = 0;
+	barriers = 0;
+	skippedTransitions = 0;
+	mergedTransitions = 0;
+	splitBarriers = 0;
+	untrackedUses = 0;
+}
+
+bool ResourceStateTracker::IsReadOnly(ResourceStates state)
+{
+	return state != 0 && (state & ~RESOURCE_STATE_READ_ONLY_MASK) == 0;
+}
+
+// --------------------------------------------------------
+// Merges with the last queued barrier that touches the same
+// subresource (there's no work between them), dropping it
+// entirely if the two cancel out.  If that barrier covers
+// a different set of subresources (the whole resource vs
+// one of them), merging would change what it does to the
+// others, so the transition is queued after it instead.
+// --------------------------------------------------------
+void ResourceStateTracker::QueueTransition(void* resource, unsigned int subresource, ResourceStates before, ResourceStates after)
+{
+	for (size_t i = pending.size(); i-- > 0;)
+	{
+		ResourceBarrier& barrier = pending[i];
+		if (barrier.Resource != resource || barrier.Type == RESOURCE_BARRIER_ALIASING || barrier.Split != RESOURCE_BARRIER_SPLIT_NONE)
+			continue;
+
+		if (barrier.Type == RESOURCE_BARRIER_UAV)
+		{
+			// The transition covers it
+			barrier.Type = RESOURCE_BARRIER_TRANSITION;
+			barrier.Subresource = subresource;
+			barrier.Before = before;
+			barrier.After = after;
+			mergedTransitions++;
+			return;
+		}
+
+		if (barrier.Subresource == subresource)
+		{
+			barrier.After = after;
+			if (barrier.Before == barrier.After)
+				pending.erase(pending.begin() + i);
+			mergedTransitions++;
+			return;
+		}
+
+		if (barrier.Subresource == RESOURCE_ALL_SUBRESOURCES || subresource == RESOURCE_ALL_SUBRESOURCES)
+			break;
+	}
+
+	ResourceBarrier barrier = {};
+	barrier.Type = RESOURCE_BARRIER_TRANSITION;
+	barrier.Split = RESOURCE_BARRIER_SPLIT_NONE;
+	barrier.Resource = resource;
+	barrier.Subresource = subresource;
+	barrier.Before = before;
+	barrier.After = after;
+	pending.push_back(barrier);
+}
+
+ResourceStates ResourceStateTracker::GetSubresourceState(const TrackedResource& tracked, unsigned int subresource) const
+{
+	if (tracked.Subresources.empty() || subresource >= tracked.Subresources.size())
+		return tracked.State;
+	return tracked.Subresources[subresource];
+}
+
+// --------------------------------------------------------
+// Splits the resource into per-subresource states, and
+// back into one once they all agree again
+// --------------------------------------------------------
+void ResourceStateTracker::SetSubresourceState(TrackedResource& tracked, unsigned int subresource, ResourceStates state)
+{
+	if (tracked.Subresources.empty())
+		tracked.Subresources.assign(tracked.SubresourceCount, tracked.State);
+	tracked.Subresources[subresource] = state;
+
+	for (ResourceStates other : tracked.Subresources)
+	{
+		if (other != state)
+			return;
+	}
+	tracked.Subresources.clear();
+	tracked.State = state;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Resource states, with the same values as D3D12_RESOURCE_STATES
+// (so either can be passed) but usable without a device
+typedef uint32_t ResourceStates;
+#define RESOURCE_STATE_COMMON						0x0
+#define RESOURCE_STATE_PRESENT						0x0
+#define RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER	0x1
+#define RESOURCE_STATE_INDEX_BUFFER					0x2
+#define RESOURCE_STATE_RENDER_TARGET				0x4
+#define RESOURCE_STATE_UNORDERED_ACCESS				0x8
+#define RESOURCE_STATE_DEPTH_WRITE					0x10
+#define RESOURCE_STATE_DEPTH_READ					0x20
+#define RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE	0x40
+#define RESOURCE_STATE_PIXEL_SHADER_RESOURCE		0x80
+#define RESOURCE_STATE_INDIRECT_ARGUMENT			0x200
+#define RESOURCE_STATE_COPY_DEST					0x400
+#define RESOURCE_STATE_COPY_SOURCE					0x800
+#define RESOURCE_STATE_ACCELERATION_STRUCTURE		0x400000
+
+// Every subresource of a resource at once
+#define RESOURCE_ALL_SUBRESOURCES 0xffffffff
+
+enum ResourceBarrierType
+{
+	RESOURCE_BARRIER_TRANSITION,
+	RESOURCE_BARRIER_UAV,
+	RESOURCE_BARRIER_ALIASING
+};
+
+// Split barriers are begun early and ended right before the resource is
+// used, so the GPU can overlap the transition with other work
+enum ResourceBarrierSplit
+{
+	RESOURCE_BARRIER_SPLIT_NONE,
+	RESOURCE_BARRIER_SPLIT_BEGIN,
+	RESOURCE_BARRIER_SPLIT_END
+};
+
+struct ResourceBarrier
+{
+	ResourceBarrierType Type;
+	ResourceBarrierSplit Split;
+	void* Resource;
+	unsigned int Subresource;
+	ResourceStates Before;
+	ResourceStates After;
+	void* ResourceBefore;		// Aliasing barriers only (null means any)
+
+	bool operator==(const ResourceBarrier& other) const;
+};
+
+// --------------------------------------------------------
+// Where batches of barriers end up: a command list on the
+// device, a list of them in tests
+// --------------------------------------------------------
+class ResourceBarrierSink
+{
+public:
+	virtual ~ResourceBarrierSink() {}
+
+	// One call per batch (a single ResourceBarrier() on the device)
+	virtual void EmitBarriers(const ResourceBarrier* barriers, unsigned int count) = 0;
+};
+
+struct ResourceStateTrackerStats
+{
+	unsigned int TrackedResources;
+	unsigned int Batches;				// Calls to the sink
+	unsigned int Barriers;				// Barriers in those calls
+	unsigned int SkippedTransitions;	// Already in (or including) the requested state
+	unsigned int MergedTransitions;		// Folded into a barrier that hadn't been emitted yet
+	unsigned int SplitBarriers;			// Begin/end pairs
+	unsigned int UntrackedUses;			// Transitions of resources nobody registered
+};
+
+// --------------------------------------------------------
+// Knows the state each registered resource (or each of its
+// subresources) is in as commands are recorded, so callers
+// only say what state they need next.  Transitions are
+// queued rather than emitted: requests for the same
+// resource before the next Flush() are merged (A->B->C
+// becomes A->C, A->B->A disappears, two read states are
+// combined) and everything queued goes out as one batch.
+//
+// Flush() must be called before recording work that uses
+// the resources.  One command list (and queue) is assumed,
+// so states carry over from one list to the next.
+// --------------------------------------------------------
+class ResourceStateTracker
+{
+public:
+	ResourceStateTracker();
+
+	void Initialize(ResourceBarrierSink* sink);
+
+	// Starts tracking a resource in a known state.  Registering the same
+	// resource again (a recreated resource at the same address) resets it.
+	void Register(void* resource, ResourceStates state, unsigned int subresourceCount = 1);
+	void Unregister(void* resource);
+	bool IsRegistered(void* resource) const { return resources.count(resource) > 0; }
+
+	// Queues whatever transitions are needed for the resource to be in this state
+	void Transition(void* resource, ResourceStates state, unsigned int subresource = RESOURCE_ALL_SUBRESOURCES);
+
+	// Queues the first half of a split transition (the whole resource).  It's
+	// ended by Transition() to the same state, or EndTransition(), which must
+	// be recorded into the same command list.  Either way it's in the new
+	// state as far as the tracker is concerned from here on.
+	void BeginTransition(void* resource, ResourceStates state);
+	void EndTransition(void* resource);
+
+	// Queues a barrier between UAV writes and whatever uses them next
+	void UAVBarrier(void* resource);
+
+	// Queues a barrier for a placed resource taking over memory another
+	// one (or any other, if null) was using
+	void AliasingBarrier(void* before, void* after);
+
+	// Emits everything queued as one batch
+	void Flush();
+	unsigned int GetPendingCount() const { return (unsigned int)pending.size(); }
+
+	ResourceStates GetState(void* resource, unsigned int subresource = 0) const;
+	ResourceStateTrackerStats GetStats() const;
+	void ResetStats();
+
+private:
+	struct TrackedResource
+	{
+		ResourceStates State;						// When every subresource agrees
+		std::vector<ResourceStates> Subresources;	// Otherwise (empty when uniform)
+		unsigned int SubresourceCount;
+		bool SplitInFlight;
+		ResourceStates SplitBefore;
+	};
+
+	ResourceBarrierSink* sink;
+	std::unordered_map<void*, TrackedResource> resources;
+	std::vector<ResourceBarrier> pending;
+
+	unsigned int batches;
+	unsigned int barriers;
+	unsigned int skippedTransitions;
+	unsigned int mergedTransitions;
+	unsigned int splitBarriers;
+	unsigned int untrackedUses;
+
+	static bool IsReadOnly(ResourceStates state);
+	void QueueTransition(void* resource, unsigned int subresource, ResourceStates before, ResourceStates after);
+	ResourceStates GetSubresourceState(const TrackedResource& tracked, unsigned int subresource) const;
+	void SetSubresourceState(TrackedResource& tracked, unsigned int subresource, ResourceStates state);
+};
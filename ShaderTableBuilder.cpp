@@ -0,0 +1,323 @@
+#include "ShaderTableBuilder.h"
+
+#include <algorithm>
+#include <cstring>
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+ShaderTableBuilder::ShaderTableBuilder() :
+	version(0),
+	layoutVersion(0),
+	recordsWritten(0),
+	recordsUnchanged(0),
+	recordsShared(0),
+	relayouts(0),
+	bytesUploaded(0)
+{
+	for (Section& section : sections)
+	{
+		section.Stride = SHADER_TABLE_RECORD_ALIGNMENT;
+		section.Offset = 0;
+		section.Capacity = 0;
+		section.Used = 0;
+	}
+}
+
+void ShaderTableBuilder::Initialize(unsigned int gpuCopies)
+{
+	copyVersions.assign(gpuCopies, 0);
+}
+
+// --------------------------------------------------------
+// Arguments are placed after the identifier in order, each
+// aligned to its own size (8 bytes for descriptors and
+// tables, 4 for constants).  Any records the section had
+// are dropped, since they were laid out differently.
+// --------------------------------------------------------
+void ShaderTableBuilder::SetLayout(ShaderTableSection section, const ShaderRecordArgument* arguments, unsigned int count)
+{
+	Section& s = sections[section];
+	s.ArgumentOffsets.clear();
+	s.ArgumentSizes.clear();
+
+	uint64_t offset = SHADER_TABLE_IDENTIFIER_SIZE;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		bool constants = arguments[i].Type == SHADER_RECORD_ARGUMENT_CONSTANTS;
+		uint64_t size = constants ? 4ull * arguments[i].Constants : 8;
+		offset = AlignUp(offset, constants ? 4 : 8);
+		s.ArgumentOffsets.push_back(offset);
+		s.ArgumentSizes.push_back(size);
+		offset += size;
+	}
+
+	s.Stride = AlignUp(offset, SHADER_TABLE_RECORD_ALIGNMENT);
+	s.Used = 0;
+	s.Runs.clear();
+	s.FreeRuns.clear();
+	s.RunsByHash.clear();
+	Relayout(section, s.Capacity);
+}
+
+void ShaderTableBuilder::EncodeRecord(ShaderTableSection section, const void* identifier, const void* const* arguments, unsigned char* record) const
+{
+	const Section& s = sections[section];
+	memset(record, 0, (size_t)s.Stride);
+	if (identifier)
+		memcpy(record, identifier, SHADER_TABLE_IDENTIFIER_SIZE);
+
+	for (size_t i = 0; arguments && i < s.ArgumentOffsets.size(); i++)
+	{
+		if (arguments[i])
+			memcpy(record + s.ArgumentOffsets[i], arguments[i], (size_t)s.ArgumentSizes[i]);
+	}
+}
+
+// --------------------------------------------------------
+// Shares a live run with the same contents if there is
+// one, otherwise writes the records somewhere free
+// --------------------------------------------------------
+unsigned int ShaderTableBuilder::AddRecords(ShaderTableSection section, const unsigned char* records, unsigned int count)
+{
+	Section& s = sections[section];
+	uint64_t bytes = s.Stride * count;
+	uint64_t hash = Hash(records, bytes);
+
+	auto matches = s.RunsByHash.equal_range(hash);
+	for (auto it = matches.first; it != matches.second; ++it)
+	{
+		Run& run = s.Runs[it->second];
+		if (run.Count == count && memcmp(GetRecord(section, run.First), records, (size_t)bytes) == 0)
+		{
+			run.References++;
+			recordsShared += count;
+			return run.First;
+		}
+	}
+
+	unsigned int first = AllocateRun(section, count);
+	memcpy(GetRecord(section, first), records, (size_t)bytes);
+	for (unsigned int i = 0; i < count; i++)
+		s.Versions[first + i] = ++version;
+	recordsWritten += count;
+
+	s.Runs[first] = { first, count, 1, hash };
+	s.RunsByHash.insert({ hash, first });
+	return first;
+}
+
+void ShaderTableBuilder::ReleaseRecords(ShaderTableSection section, unsigned int first)
+{
+	Section& s = sections[section];
+	Run* run = FindRun(section, first);
+	if (!run || --run->References > 0)
+		return;
+
+	auto matches = s.RunsByHash.equal_range(run->Hash);
+	for (auto it = matches.first; it != matches.second; ++it)
+	{
+		if (it->second == first)
+		{
+			s.RunsByHash.erase(it);
+			break;
+		}
+	}
+	s.FreeRuns.push_back(*run);
+	s.Runs.erase(first);
+}
+
+// --------------------------------------------------------
+// Compares record by record, so a run whose arguments are
+// mostly the same only dirties what actually changed
+// --------------------------------------------------------
+unsigned int ShaderTableBuilder::UpdateRecords(ShaderTableSection section, unsigned int first, const unsigned char* records)
+{
+	Section& s = sections[section];
+	Run* run = FindRun(section, first);
+	if (!run)
+		return first;
+
+	unsigned int count = run->Count;
+	if (run->References > 1 && memcmp(GetRecord(section, first), records, (size_t)(s.Stride * count)) == 0)
+	{
+		recordsUnchanged += count;
+		return first;
+	}
+	if (run->References > 1)
+	{
+		// Everyone else keeps the old contents
+		run->References--;
+		return AddRecords(section, records, count);
+	}
+
+	bool changed = false;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned char* record = GetRecord(section, first + i);
+		const unsigned char* source = records + s.Stride * i;
+		if (memcmp(record, source, (size_t)s.Stride) == 0)
+		{
+			recordsUnchanged++;
+			continue;
+		}
+
+		memcpy(record, source, (size_t)s.Stride);
+		s.Versions[first + i] = ++version;
+		recordsWritten++;
+		changed = true;
+	}
+
+	if (changed)
+	{
+		auto matches = s.RunsByHash.equal_range(run->Hash);
+		for (auto it = matches.first; it != matches.second; ++it)
+		{
+			if (it->second == first)
+			{
+				s.RunsByHash.erase(it);
+				break;
+			}
+		}
+		run->Hash = Hash(GetRecord(section, first), s.Stride * count);
+		s.RunsByHash.insert({ run->Hash, first });
+	}
+	return first;
+}
+
+// --------------------------------------------------------
+// Everything, if the table moved since this copy was last
+// synced, otherwise just the records that changed
+// --------------------------------------------------------
+void ShaderTableBuilder::CollectUploads(unsigned int copy, std::vector<ShaderTableRange>& ranges)
+{
+	ranges.clear();
+	if (copy >= copyVersions.size())
+		return;
+
+	uint64_t synced = copyVersions[copy];
+	copyVersions[copy] = version;
+
+	if (synced < layoutVersion)
+	{
+		if (!data.empty())
+		{
+			ranges.push_back({ 0, data.size() });
+			bytesUploaded += data.size();
+		}
+		return;
+	}
+
+	for (const Section& s : sections)
+	{
+		for (unsigned int i = 0; i < s.Used; i++)
+		{
+			if (s.Versions[i] <= synced)
+				continue;
+
+			uint64_t offset = s.Offset + s.Stride * i;
+			if (!ranges.empty() && ranges.back().Offset + ranges.back().Size == offset)
+				ranges.back().Size += s.Stride;
+			else
+				ranges.push_back({ offset, s.Stride });
+			bytesUploaded += s.Stride;
+		}
+	}
+}
+
+ShaderTableBuilderStats ShaderTableBuilder::GetStats() const
+{
+	ShaderTableBuilderStats stats = {};
+	stats.TableSize = data.size();
+	stats.RecordsWritten = recordsWritten;
+	stats.RecordsUnchanged = recordsUnchanged;
+	stats.RecordsShared = recordsShared;
+	stats.Relayouts = relayouts;
+	stats.BytesUploaded = bytesUploaded;
+	for (const Section& s : sections)
+	{
+		for (const auto& run : s.Runs)
+			stats.Records += run.second.Count;
+	}
+	return stats;
+}
+
+// FNV-1a
+uint64_t ShaderTableBuilder::Hash(const unsigned char* bytes, uint64_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (uint64_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+ShaderTableBuilder::Run* ShaderTableBuilder::FindRun(ShaderTableSection section, unsigned int first)
+{
+	auto found = sections[section].Runs.find(first);
+	return found == sections[section].Runs.end() ? 0 : &found->second;
+}
+
+// --------------------------------------------------------
+// First fit among released runs, otherwise the end of the
+// section (growing it if that's past its capacity)
+// --------------------------------------------------------
+unsigned int ShaderTableBuilder::AllocateRun(ShaderTableSection section, unsigned int count)
+{
+	Section& s = sections[section];
+	for (size_t i = 0; i < s.FreeRuns.size(); i++)
+	{
+		Run& free = s.FreeRuns[i];
+		if (free.Count < count)
+			continue;
+
+		unsigned int first = free.First;
+		free.First += count;
+		free.Count -= count;
+		if (free.Count == 0)
+			s.FreeRuns.erase(s.FreeRuns.begin() + i);
+		return first;
+	}
+
+	if (s.Used + count > s.Capacity)
+		Relayout(section, std::max(std::max(16u, s.Capacity * 2), s.Used + count));
+
+	unsigned int first = s.Used;
+	s.Used += count;
+	return first;
+}
+
+// --------------------------------------------------------
+// Recomputes where each section starts (after the one
+// before it, on a 64 byte boundary) and moves the records
+// --------------------------------------------------------
+void ShaderTableBuilder::Relayout(ShaderTableSection grownSection, unsigned int capacity)
+{
+	uint64_t offsets[SHADER_TABLE_SECTION_COUNT];
+	uint64_t offset = 0;
+	for (unsigned int i = 0; i < SHADER_TABLE_SECTION_COUNT; i++)
+	{
+		if (i == grownSection)
+			sections[i].Capacity = capacity;
+		offsets[i] = AlignUp(offset, SHADER_TABLE_SECTION_ALIGNMENT);
+		offset = offsets[i] + sections[i].Stride * sections[i].Capacity;
+	}
+
+	std::vector<unsigned char> moved((size_t)AlignUp(offset, SHADER_TABLE_SECTION_ALIGNMENT), 0);
+	for (unsigned int i = 0; i < SHADER_TABLE_SECTION_COUNT; i++)
+	{
+		Section& s = sections[i];
+		if (s.Used > 0)
+			memcpy(&moved[(size_t)offsets[i]], &data[(size_t)s.Offset], (size_t)(s.Stride * s.Used));
+		s.Offset = offsets[i];
+		s.Versions.resize(s.Capacity, 0);
+	}
+
+	data.swap(moved);
+	layoutVersion = ++version;
+	relayouts++;
+}
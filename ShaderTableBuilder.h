@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Shader table rules, with the same values as the D3D12_* constants
+#define SHADER_TABLE_IDENTIFIER_SIZE		32
+#define SHADER_TABLE_RECORD_ALIGNMENT		32
+#define SHADER_TABLE_SECTION_ALIGNMENT		64
+
+// Local root parameter types, with the same values as
+// D3D12_ROOT_PARAMETER_TYPE (so either can be passed)
+enum ShaderRecordArgumentType
+{
+	SHADER_RECORD_ARGUMENT_DESCRIPTOR_TABLE,
+	SHADER_RECORD_ARGUMENT_CONSTANTS,
+	SHADER_RECORD_ARGUMENT_CBV,
+	SHADER_RECORD_ARGUMENT_SRV,
+	SHADER_RECORD_ARGUMENT_UAV
+};
+
+struct ShaderRecordArgument
+{
+	ShaderRecordArgumentType Type;
+	unsigned int Constants;		// 32 bit values, for constants only
+};
+
+// The three parts of the table a dispatch points at
+enum ShaderTableSection
+{
+	SHADER_TABLE_RAY_GEN,
+	SHADER_TABLE_MISS,
+	SHADER_TABLE_HIT_GROUP,
+	SHADER_TABLE_SECTION_COUNT
+};
+
+// Bytes of the table to copy to one of its GPU copies
+struct ShaderTableRange
+{
+	uint64_t Offset;
+	uint64_t Size;
+};
+
+struct ShaderTableBuilderStats
+{
+	uint64_t TableSize;
+	unsigned int Records;				// Live, across all sections
+	unsigned int RecordsWritten;		// New or changed
+	unsigned int RecordsUnchanged;		// Updates that matched what was there
+	unsigned int RecordsShared;			// Added runs that matched an existing one
+	unsigned int Relayouts;				// Sections grown (or strides changed)
+	uint64_t BytesUploaded;
+};
+
+// --------------------------------------------------------
+// Lays out a shader table from its local root signatures
+// and keeps a CPU copy of it that only changes when record
+// contents do.  Each section's stride comes from its root
+// signature's arguments (each aligned to its own size,
+// records to 32 bytes) and sections start on 64 bytes.
+//
+// Records are added in runs (a mesh's hit groups), and a
+// run identical to a live one is shared rather than added
+// again.  Sections grow as needed, which moves everything.
+//
+// The table is meant to be mirrored by several GPU copies
+// used in turn; CollectUploads() gives the ranges of one
+// copy that are out of date, coalescing adjacent records.
+// --------------------------------------------------------
+class ShaderTableBuilder
+{
+public:
+	ShaderTableBuilder();
+
+	void Initialize(unsigned int gpuCopies);
+
+	// Arguments in root parameter order, for every record in the section
+	void SetLayout(ShaderTableSection section, const ShaderRecordArgument* arguments, unsigned int count);
+
+	uint64_t GetStride(ShaderTableSection section) const { return sections[section].Stride; }
+	uint64_t GetSectionOffset(ShaderTableSection section) const { return sections[section].Offset; }
+	// Up to the last record in use
+	uint64_t GetSectionSize(ShaderTableSection section) const { return sections[section].Stride * sections[section].Used; }
+	uint64_t GetArgumentOffset(ShaderTableSection section, unsigned int argument) const { return sections[section].ArgumentOffsets[argument]; }
+	uint64_t GetTableSize() const { return data.size(); }
+	const unsigned char* GetData() const { return data.data(); }
+
+	// Fills a record (stride bytes) from an identifier and a pointer
+	// to each argument's value (null leaves it zeroed)
+	void EncodeRecord(ShaderTableSection section, const void* identifier, const void* const* arguments, unsigned char* record) const;
+
+	// Adds count encoded records, returning the index of the first
+	unsigned int AddRecords(ShaderTableSection section, const unsigned char* records, unsigned int count);
+	void ReleaseRecords(ShaderTableSection section, unsigned int first);
+
+	// Replaces a run's records, only writing the ones that differ.  A
+	// shared run is split off first, so its index can change.
+	unsigned int UpdateRecords(ShaderTableSection section, unsigned int first, const unsigned char* records);
+
+	// Ranges this GPU copy needs for it to match the table, after which
+	// it's considered up to date
+	void CollectUploads(unsigned int copy, std::vector<ShaderTableRange>& ranges);
+
+	ShaderTableBuilderStats GetStats() const;
+
+private:
+	struct Run
+	{
+		unsigned int First;
+		unsigned int Count;
+		unsigned int References;
+		uint64_t Hash;
+	};
+
+	struct Section
+	{
+		std::vector<uint64_t> ArgumentOffsets;
+		std::vector<uint64_t> ArgumentSizes;
+		uint64_t Stride;
+		uint64_t Offset;
+		unsigned int Capacity;
+		unsigned int Used;						// One past the last record ever handed out
+		std::vector<uint64_t> Versions;			// When each record last changed
+		std::unordered_map<unsigned int, Run> Runs;	// Live runs, by first record
+		std::vector<Run> FreeRuns;
+		std::unordered_multimap<uint64_t, unsigned int> RunsByHash;	// Hash to first record
+	};
+
+	Section sections[SHADER_TABLE_SECTION_COUNT];
+	std::vector<unsigned char> data;
+	uint64_t version;
+	uint64_t layoutVersion;					// Last time anything moved
+	std::vector<uint64_t> copyVersions;		// What each GPU copy was last synced to
+
+	unsigned int recordsWritten;
+	unsigned int recordsUnchanged;
+	unsigned int recordsShared;
+	unsigned int relayouts;
+	uint64_t bytesUploaded;
+
+	static uint64_t Hash(const unsigned char* bytes, uint64_t size);
+	unsigned char* GetRecord(ShaderTableSection section, unsigned int index) { return data.data() + sections[section].Offset + sections[section].Stride * index; }
+	Run* FindRun(ShaderTableSection section, unsigned int first);
+	unsigned int AllocateRun(ShaderTableSection section, unsigned int count);
+	void Relayout(ShaderTableSection grownSection, unsigned int capacity);
+};
@@ -0,0 +1,134 @@
+#include "StagingRing.h"
+
+#include <algorithm>
+
+StagingRing::StagingRing() :
+	timeline(0),
+	memory(0),
+	ringBuffer(0),
+	ringAddress(0),
+	dedicatedThreshold(0),
+	overflowing(false),
+	bytesStaged(0),
+	allocations(0),
+	dedicatedAllocations(0),
+	fullSubmissions(0)
+{
+}
+
+StagingRing::~StagingRing()
+{
+	if (!memory)
+		return;
+
+	memory->ReleaseBuffer(ringBuffer);
+	for (const DedicatedBuffer& dedicated : dedicatedBuffers)
+		memory->ReleaseBuffer(dedicated.Buffer);
+}
+
+// --------------------------------------------------------
+// Creates the ring's buffer, which stays mapped from here on
+// --------------------------------------------------------
+void StagingRing::Initialize(GPUTimeline* timeline, StagingMemory* memory, uint64_t capacity, uint64_t dedicatedThreshold)
+{
+	this->timeline = timeline;
+	this->memory = memory;
+	this->dedicatedThreshold = std::min(dedicatedThreshold, capacity);
+	ring.Initialize(timeline, capacity, false);
+	ringAddress = (unsigned char*)memory->CreateBuffer(capacity, ringBuffer);
+}
+
+// --------------------------------------------------------
+// Big allocations get their own buffer; everything else
+// comes from the ring, waiting on earlier submissions if
+// they're still using the space.  Once the current
+// submission alone has filled the ring, the rest of its
+// allocations get their own buffers too.
+// --------------------------------------------------------
+StagingAllocation StagingRing::Allocate(uint64_t size, uint64_t alignment)
+{
+	StagingAllocation allocation;
+	if (size == 0)
+		return allocation;
+
+	Retire();
+
+	uint64_t offset = 0;
+	if (size <= dedicatedThreshold && !overflowing)
+	{
+		if (ring.Allocate(size, offset, alignment))
+		{
+			allocation.CPUAddress = ringAddress + offset;
+			allocation.Buffer = ringBuffer;
+			allocation.Offset = offset;
+			allocation.Size = size;
+			allocations++;
+			bytesStaged += size;
+			return allocation;
+		}
+
+		// The current submission alone fills the ring
+		overflowing = true;
+		fullSubmissions++;
+	}
+
+	DedicatedBuffer dedicated = {};
+	allocation.CPUAddress = memory->CreateBuffer(size, dedicated.Buffer);
+	allocation.Buffer = dedicated.Buffer;
+	allocation.Size = size;
+	dedicatedBuffers.push_back(dedicated);
+	dedicatedAllocations++;
+	allocations++;
+	bytesStaged += size;
+	return allocation;
+}
+
+// --------------------------------------------------------
+// Closes the ring's span for this submission and tags its
+// dedicated buffers
+// --------------------------------------------------------
+void StagingRing::EndSubmission(uint64_t fenceValue)
+{
+	ring.EndFrame(fenceValue);
+	overflowing = false;
+	for (DedicatedBuffer& dedicated : dedicatedBuffers)
+	{
+		if (dedicated.FenceValue == 0)
+			dedicated.FenceValue = fenceValue;
+	}
+}
+
+void StagingRing::Retire()
+{
+	ring.Retire();
+
+	if (dedicatedBuffers.empty())
+		return;
+
+	uint64_t completed = timeline->GetCompletedValue();
+	for (size_t i = 0; i < dedicatedBuffers.size();)
+	{
+		if (dedicatedBuffers[i].FenceValue != 0 && dedicatedBuffers[i].FenceValue <= completed)
+		{
+			memory->ReleaseBuffer(dedicatedBuffers[i].Buffer);
+			dedicatedBuffers.erase(dedicatedBuffers.begin() + i);
+		}
+		else
+			i++;
+	}
+}
+
+StagingRingStats StagingRing::GetStats() const
+{
+	StagingRingStats stats = {};
+	stats.Capacity = ring.GetCapacity();
+	stats.Used = ring.GetUsed();
+	stats.HighWaterMark = ring.GetHighWaterMark();
+	stats.BytesStaged = bytesStaged;
+	stats.Allocations = allocations;
+	stats.DedicatedAllocations = dedicatedAllocations;
+	stats.DedicatedBuffersLive = (unsigned int)dedicatedBuffers.size();
+	stats.Stalls = ring.GetStallCount();
+	stats.FullSubmissions = fullSubmissions;
+	return stats;
+}
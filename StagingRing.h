@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FrameScheduler.h"
+#include "FrameRingAllocator.h"
+
+// --------------------------------------------------------
+// Whatever provides the CPU-visible (mapped) memory being
+// staged into: upload heap buffers on the device, plain
+// memory in tests
+// --------------------------------------------------------
+class StagingMemory
+{
+public:
+	virtual ~StagingMemory() {}
+
+	// Creates a buffer that stays mapped for its whole life,
+	// returning its CPU address and an id for it
+	virtual void* CreateBuffer(uint64_t size, unsigned int& buffer) = 0;
+	virtual void ReleaseBuffer(unsigned int buffer) = 0;
+};
+
+// Space in staging memory, valid until the submission it's
+// used in has finished on the GPU
+struct StagingAllocation
+{
+	void* CPUAddress = 0;
+	unsigned int Buffer = 0;	// Id from StagingMemory
+	uint64_t Offset = 0;		// Within that buffer
+	uint64_t Size = 0;
+
+	bool IsValid() const { return CPUAddress != 0; }
+};
+
+struct StagingRingStats
+{
+	uint64_t Capacity;
+	uint64_t Used;					// Ring space the GPU may still be reading
+	uint64_t HighWaterMark;
+	uint64_t BytesStaged;			// Total, ring and dedicated
+	unsigned int Allocations;
+	unsigned int DedicatedAllocations;	// Too big for the ring, or past a full one
+	unsigned int DedicatedBuffersLive;
+	unsigned int Stalls;			// Waits for the GPU to free ring space
+	unsigned int FullSubmissions;	// Times a single submission filled the whole ring
+};
+
+// --------------------------------------------------------
+// One persistently mapped buffer that everything uploaded
+// to the GPU is written into first.  Space is handed out
+// linearly and reused once the fence of the submission that
+// used it completes (a FrameRingAllocator, retired per
+// submission rather than per frame).
+//
+// Allocations over the dedicated threshold get a buffer of
+// their own instead, released the same way.  So do the rest
+// of a submission's allocations once it has filled the ring
+// by itself, so allocating never needs the owner to submit
+// mid-recording.  IsOverflowing() tells an owner at a point
+// where it can submit that it should.
+// --------------------------------------------------------
+class StagingRing
+{
+public:
+	StagingRing();
+	~StagingRing();
+
+	void Initialize(GPUTimeline* timeline, StagingMemory* memory, uint64_t capacity, uint64_t dedicatedThreshold);
+
+	// Alignment can be anything (not just powers of two)
+	StagingAllocation Allocate(uint64_t size, uint64_t alignment);
+
+	// Whether the current submission has filled the ring
+	bool IsOverflowing() const { return overflowing; }
+
+	// Everything allocated since the last call is used by the work
+	// that signals this fence
+	void EndSubmission(uint64_t fenceValue);
+
+	// Frees ring space and dedicated buffers the GPU is done with
+	void Retire();
+
+	unsigned int GetRingBuffer() const { return ringBuffer; }
+	StagingRingStats GetStats() const;
+
+private:
+	struct DedicatedBuffer
+	{
+		unsigned int Buffer;
+		uint64_t FenceValue;	// 0 until its submission ends
+	};
+
+	GPUTimeline* timeline;
+	StagingMemory* memory;
+	FrameRingAllocator ring;
+	unsigned int ringBuffer;
+	unsigned char* ringAddress;
+	uint64_t dedicatedThreshold;
+	bool overflowing;
+	std::vector<DedicatedBuffer> dedicatedBuffers;
+
+	uint64_t bytesStaged;
+	unsigned int allocations;
+	unsigned int dedicatedAllocations;
+	unsigned int fullSubmissions;
+};
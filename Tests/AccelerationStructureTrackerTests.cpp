@@ -0,0 +1,270 @@
+#include "TestHarness.h"
+
+#include "../AccelerationStructureTracker.h"
+#include "../DeferredReleaseQueue.h"
+#include "SimulatedTimeline.h"
+
+#include <vector>
+
+namespace
+{
+	// --------------------------------------------------------
+	// A device that only knows each BLAS's true compacted size
+	// and whether its build has finished, counting anything
+	// asked of it at the wrong time
+	// --------------------------------------------------------
+	class FakeCompactionBackend : public BLASCompactionBackend
+	{
+	public:
+		std::vector<uint64_t> CompactedSizes;
+		std::vector<bool> Built;
+		std::vector<unsigned int> Compactions;
+		std::vector<uint64_t> Sizes;		// As the device sees them
+		unsigned int EarlyReads = 0;
+
+		unsigned int Add(uint64_t buildSize, uint64_t compactedSize)
+		{
+			CompactedSizes.push_back(compactedSize);
+			Built.push_back(false);
+			Compactions.push_back(0);
+			Sizes.push_back(buildSize);
+			return (unsigned int)Sizes.size() - 1;
+		}
+
+		uint64_t ReadCompactedSize(unsigned int blas) override
+		{
+			if (!Built[blas])
+				EarlyReads++;
+			return CompactedSizes[blas];
+		}
+
+		void CompactBLAS(unsigned int blas, uint64_t compactedSize) override
+		{
+			if (!Built[blas])
+				EarlyReads++;
+			Compactions[blas]++;
+			Sizes[blas] = compactedSize;
+		}
+	};
+}
+
+// --------------------------------------------------------
+// 400 meshes at startup, then 20 more a frame for 10 frames,
+// with builds finishing when their frame's fence does (two
+// frames in flight).  Most BLASes compact to 40-75% of their
+// build size; some barely compact and should be left alone.
+// --------------------------------------------------------
+TEST(AccelerationStructureTracker, CompactsEverythingWorthItOnce)
+{
+	const unsigned int startupMeshes = 400;
+	const unsigned int streamedMeshesPerFrame = 20;
+	const unsigned int streamingFrames = 10;
+	const unsigned int frames = 60;
+	const uint64_t budget = 32ull * 1024 * 1024;
+
+	unsigned int seed = 31337;
+	auto random = [&seed](unsigned int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 2);
+	DeferredReleaseQueue buildsDone;
+	buildsDone.Initialize(&timeline);
+
+	FakeCompactionBackend backend;
+	AccelerationStructureTracker tracker;
+	tracker.Initialize(&backend);
+	tracker.SetCompactionBudget(budget);
+
+	auto addMesh = [&]()
+	{
+		uint64_t buildSize = (64 * 1024ull << random(7)) + random(64) * 256;
+		uint64_t compactedSize = random(10) == 0 ? buildSize - buildSize / 20 : buildSize * (40 + random(36)) / 100;
+		unsigned int blas = backend.Add(buildSize, compactedSize);
+
+		tracker.AddBLAS(blas, buildSize, buildSize / 2);
+		buildsDone.Enqueue([&backend, &tracker, blas]()
+		{
+			backend.Built[blas] = true;
+			tracker.SetBuildComplete(blas);
+		});
+	};
+
+	unsigned int overBudget = 0;
+	unsigned int framesToSettle = 0;
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		unsigned int newMeshes = f == 0 ? startupMeshes : (f <= streamingFrames ? streamedMeshesPerFrame : 0);
+		for (unsigned int i = 0; i < newMeshes; i++)
+			addMesh();
+
+		// No BLAS here is over budget by itself, so no update should be
+		tracker.Update();
+		AccelerationStructureMemoryStats stats = tracker.GetStats();
+		if (stats.LastCompactedBytes > budget)
+			overBudget++;
+		if (stats.AwaitingCompaction > 0)
+			framesToSettle = f + 1;
+
+		timeline.AdvanceCPU(4.0);
+		timeline.Submit(4.0);
+		scheduler.EndFrame();
+		buildsDone.EndSubmission(scheduler.GetLastFrameFenceValue());
+		buildsDone.Retire();
+	}
+
+	// Everything decided once, correctly, and the totals match the device
+	unsigned int doubleCompactions = 0;
+	unsigned int wrongDecisions = 0;
+	unsigned int mismatches = 0;
+	uint64_t deviceBytes = 0;
+	for (unsigned int blas = 0; blas < tracker.GetBLASCount(); blas++)
+	{
+		BLASMemoryInfo info = tracker.GetBLASInfo(blas);
+		bool compact = AccelerationStructureTracker::ShouldCompact(info.BuildSize, backend.CompactedSizes[blas]);
+		if (backend.Compactions[blas] > 1)
+			doubleCompactions++;
+		if (info.State != (compact ? BLAS_STATE_COMPACTED : BLAS_STATE_NOT_COMPACTED))
+			wrongDecisions++;
+		if (info.Size != backend.Sizes[blas])
+			mismatches++;
+		deviceBytes += backend.Sizes[blas];
+	}
+	AccelerationStructureMemoryStats stats = tracker.GetStats();
+
+	printf("  BLAS memory %u KB -> %u KB (%.1f%%), settled after %u frames\n",
+		(unsigned int)(stats.BLASBuildBytes / 1024), (unsigned int)(stats.BLASBytes / 1024),
+		100.0 * stats.BLASBytes / stats.BLASBuildBytes, framesToSettle);
+	CHECK(tracker.GetBLASCount() == startupMeshes + streamedMeshesPerFrame * streamingFrames);
+	CHECK(backend.EarlyReads == 0);
+	CHECK(doubleCompactions == 0);
+	CHECK(wrongDecisions == 0);
+	CHECK(overBudget == 0);
+	CHECK(mismatches == 0);
+	CHECK(stats.BLASBytes == deviceBytes);
+	CHECK(stats.AwaitingCompaction == 0);
+	CHECK(stats.Compacted > tracker.GetBLASCount() / 2);
+
+	// The startup batch is more than one update's worth
+	CHECK(framesToSettle > streamingFrames + 2);
+	CHECK(framesToSettle < frames);
+}
+
+TEST(AccelerationStructureTracker, WaitsForTheBuild)
+{
+	FakeCompactionBackend backend;
+	AccelerationStructureTracker tracker;
+	tracker.Initialize(&backend);
+
+	unsigned int blas = backend.Add(1024 * 1024, 512 * 1024);
+	tracker.AddBLAS(blas, 1024 * 1024, 256 * 1024);
+	tracker.Update();
+	CHECK(tracker.GetBLASInfo(blas).State == BLAS_STATE_BUILDING);
+	CHECK(tracker.GetBLASInfo(blas).Size == 1024 * 1024);
+
+	backend.Built[blas] = true;
+	tracker.SetBuildComplete(blas);
+	CHECK(tracker.GetBLASInfo(blas).State == BLAS_STATE_BUILT);
+	tracker.Update();
+
+	BLASMemoryInfo info = tracker.GetBLASInfo(blas);
+	CHECK(info.State == BLAS_STATE_COMPACTED);
+	CHECK(info.CompactedSize == 512 * 1024 && info.Size == 512 * 1024);
+	CHECK(backend.Compactions[blas] == 1);
+	CHECK(backend.EarlyReads == 0);
+
+	// Completing again (or an unknown BLAS) changes nothing
+	tracker.SetBuildComplete(blas);
+	tracker.SetBuildComplete(7);
+	tracker.Update();
+	CHECK(backend.Compactions[blas] == 1);
+	CHECK(tracker.GetBLASInfo(7).State == BLAS_STATE_NONE);
+}
+
+// --------------------------------------------------------
+// Compacts in the order builds finished, up to the budget
+// per update, though always at least one.  BLASes that
+// aren't worth it don't count against the budget.
+// --------------------------------------------------------
+TEST(AccelerationStructureTracker, KeepsUpdatesToTheBudget)
+{
+	const uint64_t mb = 1024 * 1024;
+	FakeCompactionBackend backend;
+	AccelerationStructureTracker tracker;
+	tracker.Initialize(&backend);
+	tracker.SetCompactionBudget(4 * mb);
+
+	const uint64_t sizes[] = { 8 * mb, 2 * mb, 2 * mb, 2 * mb };
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		backend.Add(sizes[i], sizes[i] / 2);
+		tracker.AddBLAS(i, sizes[i], 0);
+	}
+	unsigned int notWorthIt = backend.Add(2 * mb, 2 * mb - 1024);
+	tracker.AddBLAS(notWorthIt, 2 * mb, 0);
+
+	// Finishing out of order
+	const unsigned int finished[] = { 1, 0, 4, 2, 3 };
+	for (unsigned int blas : finished)
+	{
+		backend.Built[blas] = true;
+		tracker.SetBuildComplete(blas);
+	}
+
+	tracker.Update();
+	CHECK(tracker.GetStats().LastCompactedBytes == 2 * mb);
+	CHECK(tracker.GetBLASInfo(1).State == BLAS_STATE_COMPACTED);
+	CHECK(tracker.GetBLASInfo(0).State == BLAS_STATE_BUILT);
+
+	// Over budget by itself, so it's alone
+	tracker.Update();
+	CHECK(tracker.GetStats().LastCompactedBytes == 8 * mb);
+	CHECK(tracker.GetBLASInfo(0).State == BLAS_STATE_COMPACTED);
+
+	tracker.Update();
+	CHECK(tracker.GetStats().LastCompactedBytes == 4 * mb);
+	CHECK(tracker.GetBLASInfo(notWorthIt).State == BLAS_STATE_NOT_COMPACTED);
+	CHECK(tracker.GetBLASInfo(notWorthIt).Size == 2 * mb);
+	CHECK(backend.Compactions[notWorthIt] == 0);
+	CHECK(tracker.GetStats().AwaitingCompaction == 0);
+
+	tracker.Update();
+	CHECK(tracker.GetStats().LastCompactedBytes == 0);
+}
+
+TEST(AccelerationStructureTracker, ShouldCompactOnlyWhenItSaves)
+{
+	CHECK(!AccelerationStructureTracker::ShouldCompact(1024 * 1024, 0));
+	CHECK(!AccelerationStructureTracker::ShouldCompact(1024 * 1024, 1024 * 1024));
+	CHECK(!AccelerationStructureTracker::ShouldCompact(1024 * 1024, 1024 * 1024 - 100 * 1024));
+	CHECK(AccelerationStructureTracker::ShouldCompact(1024 * 1024, 1024 * 1024 - 110 * 1024));
+
+	// A tenth of a small BLAS isn't worth a copy
+	CHECK(!AccelerationStructureTracker::ShouldCompact(16 * 1024, 13 * 1024));
+	CHECK(AccelerationStructureTracker::ShouldCompact(16 * 1024, 12 * 1024));
+}
+
+TEST(AccelerationStructureTracker, TotalsIncludeTLASAndScratch)
+{
+	FakeCompactionBackend backend;
+	AccelerationStructureTracker tracker;
+	tracker.Initialize(&backend);
+
+	backend.Add(1000, 500);
+	tracker.AddBLAS(0, 1000, 300);
+	tracker.AddBLASScratch(300);
+	tracker.SetTLASSize(2000, 700);
+
+	AccelerationStructureMemoryStats stats = tracker.GetStats();
+	CHECK(stats.BLASCount == 1);
+	CHECK(stats.BLASBytes == 1000 && stats.BLASBuildBytes == 1000);
+	CHECK(stats.ScratchBytes == 1000);
+	CHECK(stats.TotalBytes == 1000 + 2000 + 1000);
+
+	tracker.RemoveBLASScratch(300);
+	CHECK(tracker.GetStats().TotalBytes == 1000 + 2000 + 700);
+}
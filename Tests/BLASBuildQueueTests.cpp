@@ -0,0 +1,184 @@
+#include "TestHarness.h"
+
+#include "../BLASBuildQueue.h"
+#include "../FrameScheduler.h"
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	uint64_t AlignUp(uint64_t size)
+	{
+		return (size + BLAS_BUILD_ALIGNMENT - 1) / BLAS_BUILD_ALIGNMENT * BLAS_BUILD_ALIGNMENT;
+	}
+
+	// Mostly small meshes, some big ones, and one over the budget
+	std::vector<uint64_t> RandomScratchSizes(unsigned int meshCount, uint64_t budget)
+	{
+		unsigned int seed = 4096;
+		std::vector<uint64_t> sizes;
+		for (unsigned int i = 0; i < meshCount; i++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			uint64_t size = 16 * 1024ull << ((seed >> 8) % 8);
+			if (i == meshCount / 2)
+				size = budget + 1024 * 1024;
+			sizes.push_back(size + (seed >> 4) % 1000);
+		}
+		return sizes;
+	}
+
+	// --------------------------------------------------------
+	// Every build in exactly one batch, in order, in its own
+	// aligned part of the scratch buffer.  Returns how many
+	// builds broke a rule.
+	// --------------------------------------------------------
+	unsigned int CheckPlan(const std::vector<uint64_t>& sizes, const std::vector<BLASBuildBatch>& batches,
+		const std::vector<uint64_t>& scratchOffsets, uint64_t scratchSize, uint64_t budget)
+	{
+		unsigned int wrong = 0;
+		unsigned int next = 0;
+		for (const BLASBuildBatch& batch : batches)
+		{
+			if (batch.FirstBuild != next || batch.BuildCount == 0 || batch.ScratchSize > scratchSize)
+				wrong++;
+			if (batch.ScratchSize > budget && batch.BuildCount > 1)
+				wrong++;
+
+			uint64_t end = 0;
+			for (unsigned int i = batch.FirstBuild; i < batch.FirstBuild + batch.BuildCount; i++)
+			{
+				if (scratchOffsets[i] < end || scratchOffsets[i] % BLAS_BUILD_ALIGNMENT != 0)
+					wrong++;
+				end = scratchOffsets[i] + AlignUp(sizes[i]);
+				if (end > batch.ScratchSize)
+					wrong++;
+			}
+			next = batch.FirstBuild + batch.BuildCount;
+		}
+		return wrong + (unsigned int)sizes.size() - next;
+	}
+}
+
+TEST(BLASBuildQueue, PlansEveryBuildOnce)
+{
+	const unsigned int meshCounts[] = { 1, 10, 100, 1000 };
+	for (unsigned int meshCount : meshCounts)
+	{
+		BLASBuildQueue queue;
+		std::vector<uint64_t> sizes = RandomScratchSizes(meshCount, queue.GetScratchBudget());
+		for (unsigned int i = 0; i < meshCount; i++)
+			CHECK(queue.Add(sizes[i]) == i);
+
+		std::vector<BLASBuildBatch> batches;
+		std::vector<uint64_t> scratchOffsets;
+		uint64_t scratchSize = queue.Plan(batches, scratchOffsets);
+		CHECK(CheckPlan(sizes, batches, scratchOffsets, scratchSize, queue.GetScratchBudget()) == 0);
+
+		// The over budget build sets the size
+		CHECK(scratchSize == AlignUp(sizes[meshCount / 2]));
+
+		queue.Clear();
+		BLASBuildQueueStats stats = queue.GetStats();
+		CHECK(stats.Pending == 0);
+		CHECK(stats.Builds == meshCount);
+		CHECK(stats.LastBatches == batches.size());
+		CHECK(stats.LastScratchSize == scratchSize);
+		CHECK(stats.LastScratchSize <= stats.LastUnpooledScratchSize);
+	}
+}
+
+TEST(BLASBuildQueue, SplitsBatchesAtTheBudget)
+{
+	BLASBuildQueue queue;
+	queue.SetScratchBudget(1024);
+	queue.Add(300);		// Aligned to 512
+	queue.Add(256);
+	queue.Add(256);
+	queue.Add(4096);	// Over budget, on its own
+	queue.Add(0);		// Still gets some scratch
+
+	std::vector<BLASBuildBatch> batches;
+	std::vector<uint64_t> scratchOffsets;
+	uint64_t scratchSize = queue.Plan(batches, scratchOffsets);
+	REQUIRE(batches.size() == 3);
+	CHECK(batches[0].FirstBuild == 0 && batches[0].BuildCount == 3 && batches[0].ScratchSize == 1024);
+	CHECK(batches[1].FirstBuild == 3 && batches[1].BuildCount == 1 && batches[1].ScratchSize == 4096);
+	CHECK(batches[2].FirstBuild == 4 && batches[2].BuildCount == 1 && batches[2].ScratchSize == BLAS_BUILD_ALIGNMENT);
+	CHECK(scratchOffsets[1] == 512 && scratchOffsets[2] == 768 && scratchOffsets[3] == 0);
+	CHECK(scratchSize == 4096);
+
+	// Nothing changes until the builds are cleared
+	CHECK(queue.GetPendingCount() == 5);
+	queue.Clear();
+	CHECK(queue.GetPendingCount() == 0);
+	CHECK(queue.GetStats().LastUnpooledScratchSize == 512 + 256 + 256 + 4096 + 256);
+	CHECK(queue.GetStats().Flushes == 1);
+	queue.Clear();
+	CHECK(queue.GetStats().Flushes == 1);
+}
+
+// --------------------------------------------------------
+// Startup builds timed both ways on a simulated timeline:
+//  - Separately: create a scratch buffer, record, submit
+//    and wait, for every mesh
+//  - Queued: create one scratch buffer, record everything
+//    with a barrier between batches, submit once
+// GPU costs are rough: builds in a batch overlap (about
+// four at a time) and each submission has a fixed cost.
+// --------------------------------------------------------
+TEST(BLASBuildQueue, QueuedBuildsFinishSooner)
+{
+	const unsigned int meshCounts[] = { 10, 100, 1000 };
+	const double createScratchMs = 0.03;	// CPU, per buffer
+	const double recordBuildMs = 0.005;		// CPU, per build
+	const double submitMs = 0.05;			// CPU, per submission
+	const double submissionGPUMs = 0.05;	// GPU, per submission
+	const double barrierGPUMs = 0.01;		// GPU, draining between batches
+	const double buildOverlap = 4.0;
+	const double scratchBytesPerGPUMs = 256.0 * 1024 * 1024;
+	auto buildGPUMs = [&](uint64_t scratchSize) { return 0.01 + scratchSize / scratchBytesPerGPUMs; };
+
+	for (unsigned int meshCount : meshCounts)
+	{
+		BLASBuildQueue queue;
+		std::vector<uint64_t> sizes = RandomScratchSizes(meshCount, queue.GetScratchBudget());
+		for (uint64_t size : sizes)
+			queue.Add(size);
+		std::vector<BLASBuildBatch> batches;
+		std::vector<uint64_t> scratchOffsets;
+		queue.Plan(batches, scratchOffsets);
+
+		SimulatedTimeline separate;
+		for (uint64_t size : sizes)
+		{
+			separate.AdvanceCPU(createScratchMs + recordBuildMs + submitMs);
+			separate.Submit(submissionGPUMs + buildGPUMs(size));
+			separate.WaitForValue(separate.Signal());
+		}
+
+		// Waiting at the end, so both measure until the BLASes are ready
+		SimulatedTimeline queued;
+		queued.AdvanceCPU(createScratchMs + recordBuildMs * meshCount + submitMs);
+		double gpuMs = submissionGPUMs;
+		for (const BLASBuildBatch& batch : batches)
+		{
+			double longest = 0;
+			double total = 0;
+			for (unsigned int i = batch.FirstBuild; i < batch.FirstBuild + batch.BuildCount; i++)
+			{
+				longest = std::max(longest, buildGPUMs(sizes[i]));
+				total += buildGPUMs(sizes[i]);
+			}
+			gpuMs += std::max(longest, total / buildOverlap) + barrierGPUMs;
+		}
+		queued.Submit(gpuMs);
+		queued.WaitForValue(queued.Signal());
+
+		printf("  %4u meshes: %.2f ms separately, %.2f ms queued in %u batches\n",
+			meshCount, separate.GetCPUTime(), queued.GetCPUTime(), (unsigned int)batches.size());
+		CHECK(queued.GetCPUTime() < separate.GetCPUTime());
+	}
+}
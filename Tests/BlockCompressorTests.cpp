@@ -0,0 +1,241 @@
+#include "TestHarness.h"
+
+#include "../BlockCompressor.h"
+#include "TestTextures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+	const BlockFormat Formats[] = { BLOCK_FORMAT_BC1, BLOCK_FORMAT_BC4, BLOCK_FORMAT_BC5, BLOCK_FORMAT_BC7 };
+
+	// Channels each format keeps
+	unsigned int GetKeptChannels(BlockFormat format)
+	{
+		switch (format)
+		{
+		case BLOCK_FORMAT_BC1: return 3;
+		case BLOCK_FORMAT_BC4: return 1;
+		case BLOCK_FORMAT_BC5: return 2;
+		default: return 4;
+		}
+	}
+
+	// Smooth in every channel, so any format should keep it well
+	DecodedImage CreateGradient(unsigned int size)
+	{
+		DecodedImage gradient = {};
+		gradient.Width = size;
+		gradient.Height = size;
+		gradient.Channels = 4;
+		for (unsigned int y = 0; y < size; y++)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				unsigned char texel[4] = { (unsigned char)(x * 4), (unsigned char)(y * 4), (unsigned char)(255 - x * 2 - y), (unsigned char)(128 + x) };
+				gradient.Pixels.insert(gradient.Pixels.end(), texel, texel + 4);
+			}
+		}
+		return gradient;
+	}
+}
+
+TEST(BlockCompressor, SizesFollowTheFormat)
+{
+	CHECK(BlockCompressor::GetBlockBytes(BLOCK_FORMAT_BC1) == 8);
+	CHECK(BlockCompressor::GetBlockBytes(BLOCK_FORMAT_BC4) == 8);
+	CHECK(BlockCompressor::GetBlockBytes(BLOCK_FORMAT_BC5) == 16);
+	CHECK(BlockCompressor::GetBlockBytes(BLOCK_FORMAT_BC7) == 16);
+
+	// Small mips still take whole blocks
+	CHECK(BlockCompressor::GetCompressedSize(64, 32, BLOCK_FORMAT_BC7) == 16 * 8 * 16);
+	CHECK(BlockCompressor::GetCompressedSize(2, 1, BLOCK_FORMAT_BC1) == 8);
+	CHECK(BlockCompressor::GetCompressedSize(6, 5, BLOCK_FORMAT_BC4) == 4 * 8);
+
+	CHECK(BlockCompressor::CanCompress(CreateRandomImage(8, 4, 4, 1)));
+	CHECK(!BlockCompressor::CanCompress(CreateRandomImage(8, 6, 4, 1)));
+
+	CompressedImage compressed;
+	BlockCompressor::Compress(CreateRandomImage(12, 8, 1, 1), BLOCK_FORMAT_BC4, BLOCK_QUALITY_FAST, compressed);
+	CHECK(compressed.Width == 12 && compressed.Height == 8 && compressed.Format == BLOCK_FORMAT_BC4);
+	CHECK(compressed.Blocks.size() == BlockCompressor::GetCompressedSize(12, 8, BLOCK_FORMAT_BC4));
+}
+
+TEST(BlockCompressor, FormatsFollowTheName)
+{
+	CHECK(BlockCompressor::GetFormatForPath(L"bronze_normals.png", BLOCK_QUALITY_NORMAL) == BLOCK_FORMAT_BC5);
+	CHECK(BlockCompressor::GetFormatForPath(L"bronze_albedo.png", BLOCK_QUALITY_NORMAL) == BLOCK_FORMAT_BC7);
+	CHECK(BlockCompressor::GetFormatForPath(L"bronze_albedo.png", BLOCK_QUALITY_FAST) == BLOCK_FORMAT_BC1);
+	CHECK(BlockCompressor::GetFormatForPath(L"Bronze_Metal.PNG", BLOCK_QUALITY_NORMAL) == BLOCK_FORMAT_BC4);
+	CHECK(BlockCompressor::GetFormatForPath(L"bronze_roughness.png", BLOCK_QUALITY_HIGH) == BLOCK_FORMAT_BC4);
+	CHECK(BlockCompressor::GetFormatForPath(L"bronze_orm.png", BLOCK_QUALITY_NORMAL) == BLOCK_FORMAT_BC7);
+
+	uint64_t key = BlockCompressor::GetCacheKey(1234, BLOCK_FORMAT_BC7, BLOCK_QUALITY_NORMAL);
+	CHECK(BlockCompressor::GetCacheKey(1234, BLOCK_FORMAT_BC1, BLOCK_QUALITY_NORMAL) != key);
+	CHECK(BlockCompressor::GetCacheKey(1234, BLOCK_FORMAT_BC7, BLOCK_QUALITY_HIGH) != key);
+	CHECK(BlockCompressor::GetCacheKey(1235, BLOCK_FORMAT_BC7, BLOCK_QUALITY_NORMAL) != key);
+}
+
+// Flat images come back (nearly) exactly: 5:6:5 is the limit for BC1
+TEST(BlockCompressor, FlatBlocksComeBack)
+{
+	std::mt19937 rng(46);
+	for (BlockFormat format : Formats)
+	{
+		unsigned int largestError = 0;
+		for (int trial = 0; trial < 64; trial++)
+		{
+			unsigned char color[4] = { (unsigned char)rng(), (unsigned char)rng(), (unsigned char)rng(), (unsigned char)rng() };
+			DecodedImage flat = {};
+			flat.Width = 8;
+			flat.Height = 8;
+			flat.Channels = 4;
+			for (int i = 0; i < 64; i++)
+				flat.Pixels.insert(flat.Pixels.end(), color, color + 4);
+
+			CompressedImage compressed;
+			DecodedImage decompressed;
+			BlockCompressor::Compress(flat, format, BLOCK_QUALITY_NORMAL, compressed);
+			BlockCompressor::Decompress(compressed, decompressed);
+			for (int i = 0; i < 64; i++)
+			{
+				for (unsigned int c = 0; c < GetKeptChannels(format); c++)
+					largestError = std::max(largestError, (unsigned int)abs((int)color[c] - (int)decompressed.Pixels[i * decompressed.Channels + c]));
+			}
+		}
+		CHECK(largestError <= (format == BLOCK_FORMAT_BC1 ? 4u : 1u));
+	}
+}
+
+// --------------------------------------------------------
+// Gradients keep well at every quality, and noise doesn't
+// get worse as the quality goes up
+// --------------------------------------------------------
+TEST(BlockCompressor, QualityOnlyHelps)
+{
+	DecodedImage gradient = CreateGradient(64);
+	DecodedImage noise = CreateRandomImage(64, 64, 4, 46);
+	for (BlockFormat format : Formats)
+	{
+		double lastNoise = 0.0;
+		for (int quality = 0; quality < 3; quality++)
+		{
+			CompressedImage compressed;
+			BlockCompressor::Compress(gradient, format, (BlockQuality)quality, compressed);
+			CHECK(BlockCompressor::MeasurePSNR(gradient, compressed) > 35.0);
+			BlockCompressor::Compress(noise, format, (BlockQuality)quality, compressed);
+			double noisePSNR = BlockCompressor::MeasurePSNR(noise, compressed);
+			CHECK(noisePSNR > lastNoise - 0.01);
+			lastNoise = noisePSNR;
+		}
+	}
+}
+
+TEST(BlockCompressor, DecompressesToTheFormatsChannels)
+{
+	DecodedImage gradient = CreateGradient(8);
+	for (BlockFormat format : Formats)
+	{
+		CompressedImage compressed;
+		DecodedImage decompressed;
+		BlockCompressor::Compress(gradient, format, BLOCK_QUALITY_FAST, compressed);
+		BlockCompressor::Decompress(compressed, decompressed);
+		CHECK(decompressed.Width == 8 && decompressed.Height == 8);
+		CHECK(decompressed.Channels == (format == BLOCK_FORMAT_BC4 ? 1u : 4u));
+		REQUIRE(decompressed.Pixels.size() == 64 * decompressed.Channels);
+		if (format == BLOCK_FORMAT_BC1)
+			CHECK(decompressed.Pixels[3] == 255);
+		if (format == BLOCK_FORMAT_BC5)
+			CHECK(decompressed.Pixels[2] == 0);
+	}
+}
+
+// Cached chains round trip, and are rejected if anything's off
+TEST(BlockCompressor, CachedChainsRoundTrip)
+{
+	std::vector<CompressedImage> levels(2);
+	BlockCompressor::Compress(CreateGradient(64), BLOCK_FORMAT_BC7, BLOCK_QUALITY_FAST, levels[0]);
+	BlockCompressor::Compress(CreateRandomImage(32, 32, 4, 3), BLOCK_FORMAT_BC7, BLOCK_QUALITY_FAST, levels[1]);
+
+	std::vector<unsigned char> data;
+	std::vector<CompressedImage> loaded;
+	BlockCompressor::Serialize(levels, 1234, data);
+	CHECK(BlockCompressor::Deserialize(data.data(), data.size(), 1234, loaded));
+	REQUIRE(loaded.size() == 2);
+	CHECK(loaded[0].Blocks == levels[0].Blocks && loaded[1].Blocks == levels[1].Blocks);
+	CHECK(loaded[1].Width == 32 && loaded[1].Format == BLOCK_FORMAT_BC7);
+	CHECK(!BlockCompressor::Deserialize(data.data(), data.size(), 4321, loaded));
+	CHECK(!BlockCompressor::Deserialize(data.data(), data.size() - 1, 1234, loaded));
+	std::vector<unsigned char> corrupt = data;
+	corrupt[corrupt.size() / 2] ^= 1;
+	CHECK(!BlockCompressor::Deserialize(corrupt.data(), corrupt.size(), 1234, loaded));
+
+	std::wstring path = std::wstring(GetTestOutputDirectory()) + L"BlockCompressorTest.blocks";
+	REQUIRE(BlockCompressor::Save(path, levels, 1234));
+	std::vector<CompressedImage> fromFile;
+	CHECK(BlockCompressor::Load(path, 1234, fromFile));
+	CHECK(fromFile.size() == 2 && fromFile[1].Blocks == levels[1].Blocks);
+	CHECK(!BlockCompressor::Load(path, 4321, fromFile));
+}
+
+// --------------------------------------------------------
+// The material textures, in the format their names pick.
+// High quality is slow, so only the scratched set gets it.
+// --------------------------------------------------------
+TEST(BlockCompressor, MaterialTexturesKeepTheirDetail)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	size_t uncompressedBytes = 0;
+	size_t compressedBytes = 0;
+	double megaTexels = 0.0;
+	double normalMs = 0.0;
+	double worstPSNR = 99.0;
+	unsigned int textureCount = 0;
+	unsigned int gotWorse = 0;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		for (const wchar_t* map : TestTextureMaps)
+		{
+			std::wstring path = GetTestTexturePath(set, map);
+			DecodedImage image = {};
+			if (!LoadTestTexture(path, image) || !BlockCompressor::CanCompress(image))
+				continue;
+
+			BlockFormat format = BlockCompressor::GetFormatForPath(path, BLOCK_QUALITY_NORMAL);
+			int qualities = set == TestTextureSets[3] ? 3 : 2;
+			double lastPSNR = 0.0;
+			for (int quality = 0; quality < qualities; quality++)
+			{
+				CompressedImage compressed;
+				auto start = Clock::now();
+				BlockCompressor::Compress(image, format, (BlockQuality)quality, compressed);
+				double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				double psnr = BlockCompressor::MeasurePSNR(image, compressed);
+				if (psnr < lastPSNR - 0.01)
+					gotWorse++;
+				lastPSNR = psnr;
+
+				if (quality == BLOCK_QUALITY_NORMAL)
+				{
+					worstPSNR = std::min(worstPSNR, psnr);
+					uncompressedBytes += image.Pixels.size();
+					compressedBytes += compressed.Blocks.size();
+					megaTexels += (double)image.Width * image.Height / 1e6;
+					normalMs += ms;
+				}
+			}
+			textureCount++;
+		}
+	}
+
+	printf("  %u textures at %.1f megatexels/s (Normal), worst %.1fdB, %.1f MB -> %.1f MB\n",
+		textureCount, megaTexels / (normalMs / 1000.0), worstPSNR,
+		uncompressedBytes / (1024.0 * 1024.0), compressedBytes / (1024.0 * 1024.0));
+	CHECK(textureCount == 15);
+	CHECK(gotWorse == 0);
+	CHECK(worstPSNR > 30.0);
+	CHECK(compressedBytes * 3 <= uncompressedBytes);
+}
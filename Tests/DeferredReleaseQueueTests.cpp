@@ -0,0 +1,258 @@
+#include "TestHarness.h"
+
+#include "../DeferredReleaseQueue.h"
+#include "SimulatedTimeline.h"
+
+#include <vector>
+
+namespace
+{
+	struct WorkloadResult
+	{
+		unsigned int Released;
+		unsigned int Early;			// Released before the GPU finished with it
+		unsigned int OutOfOrder;
+		unsigned int Drains;		// Times the CPU waited for the GPU to go idle
+		unsigned int PeakPending;
+		double FrameMs;
+		double WaitMs;				// Per frame
+	};
+
+	// --------------------------------------------------------
+	// 600 frames with 3 in flight, where some frames replace
+	// resources (growth, resizes) and some submit part of the
+	// frame early.  Either replaces them after draining the
+	// GPU (the old way) or through the queue.  Every release
+	// checks that the GPU has finished the last submission
+	// that used the resource.
+	// --------------------------------------------------------
+	WorkloadResult RunWorkload(bool deferred, unsigned int& expectedReleases)
+	{
+		const unsigned int frames = 600;
+		const unsigned int startingResources = 64;
+
+		unsigned int seed = 90210;
+		auto random = [&seed](unsigned int range)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) % range;
+		};
+		std::vector<unsigned int> replacements(frames);
+		std::vector<bool> midFrameSubmits(frames);
+		expectedReleases = 0;
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			unsigned int roll = random(100);
+			replacements[f] = roll < 20 ? 1 : (roll < 23 ? 8 : 0);
+			midFrameSubmits[f] = random(10) == 0;
+			expectedReleases += replacements[f];
+		}
+
+		SimulatedTimeline timeline;
+		FrameScheduler scheduler;
+		scheduler.Initialize(&timeline, 3);
+		DeferredReleaseQueue queue;
+		queue.Initialize(&timeline);
+
+		// Submissions are numbered as they're recorded; each resource
+		// remembers the last one that used it
+		const unsigned int unused = ~0u;
+		std::vector<uint64_t> submissionFences;
+		unsigned int openSubmission = 0;
+		std::vector<unsigned int> lastUse;
+		std::vector<unsigned int> live;
+		auto create = [&]()
+		{
+			live.push_back((unsigned int)lastUse.size());
+			lastUse.push_back(unused);
+		};
+		for (unsigned int i = 0; i < startingResources; i++)
+			create();
+
+		WorkloadResult result = {};
+		unsigned int queueOrder = 0;
+		unsigned int lastReleasedOrder = 0;
+		auto release = [&](unsigned int resource, unsigned int order)
+		{
+			unsigned int submission = lastUse[resource];
+			if (submission != unused &&
+				(submission >= submissionFences.size() || timeline.GetCompletedValue() < submissionFences[submission]))
+				result.Early++;
+			if (order < lastReleasedOrder)
+				result.OutOfOrder++;
+			lastReleasedOrder = order;
+			result.Released++;
+		};
+		auto replace = [&](unsigned int count)
+		{
+			for (unsigned int r = 0; r < count; r++)
+			{
+				unsigned int index = random((unsigned int)live.size());
+				unsigned int old = live[index];
+				live[index] = live.back();
+				live.pop_back();
+				create();
+
+				unsigned int order = ++queueOrder;
+				if (deferred)
+					queue.Enqueue([&release, old, order]() { release(old, order); });
+				else
+					release(old, order);
+			}
+		};
+		auto endSubmission = [&](uint64_t fence)
+		{
+			submissionFences.push_back(fence);
+			openSubmission++;
+			queue.EndSubmission(fence);
+		};
+
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			if (!deferred)
+			{
+				// The old way: drain, then replace before anything uses them
+				if (replacements[f])
+				{
+					if (timeline.GetCompletedValue() < scheduler.GetLastFrameFenceValue())
+						result.Drains++;
+					scheduler.WaitForIdle();
+					replace(replacements[f]);
+				}
+				for (unsigned int resource : live)
+					lastUse[resource] = openSubmission;
+			}
+			else
+			{
+				// Resources can be replaced after this frame has used them
+				for (unsigned int resource : live)
+					lastUse[resource] = openSubmission;
+				replace(replacements[f]);
+			}
+
+			timeline.AdvanceCPU(8.0);
+			if (midFrameSubmits[f])
+			{
+				timeline.Submit(1.0);
+				endSubmission(timeline.Signal());
+				for (unsigned int resource : live)
+					lastUse[resource] = openSubmission;
+			}
+
+			timeline.Submit(9.0);
+			scheduler.EndFrame();
+			endSubmission(scheduler.GetLastFrameFenceValue());
+			queue.Retire();
+		}
+
+		scheduler.WaitForIdle();
+		queue.Retire();
+
+		result.PeakPending = queue.GetStats().PeakPending;
+		result.FrameMs = timeline.GetCPUTime() / frames;
+		result.WaitMs = timeline.GetCPUWaitTime() / frames;
+		return result;
+	}
+}
+
+TEST(DeferredReleaseQueue, ReleasesSafelyWithoutDraining)
+{
+	unsigned int expected = 0;
+	WorkloadResult drain = RunWorkload(false, expected);
+	WorkloadResult deferred = RunWorkload(true, expected);
+
+	printf("  draining: %.2f ms/frame (%.2f waiting), %u drains; deferred: %.2f ms/frame (%.2f waiting), peak %u pending\n",
+		drain.FrameMs, drain.WaitMs, drain.Drains, deferred.FrameMs, deferred.WaitMs, deferred.PeakPending);
+	CHECK(drain.Early == 0);
+	CHECK(drain.Released == expected);
+	CHECK(drain.Drains > 0);
+
+	CHECK(deferred.Early == 0);
+	CHECK(deferred.OutOfOrder == 0);
+	CHECK(deferred.Released == expected);
+	CHECK(deferred.Drains == 0);
+	CHECK(deferred.FrameMs < drain.FrameMs);
+	CHECK(deferred.WaitMs < drain.WaitMs);
+}
+
+TEST(DeferredReleaseQueue, WaitsForItsSubmission)
+{
+	SimulatedTimeline timeline;
+	DeferredReleaseQueue queue;
+	queue.Initialize(&timeline);
+
+	unsigned int released = 0;
+	queue.Enqueue([&released]() { released++; });
+
+	// Not tagged yet, so even a completed fence doesn't release it
+	timeline.WaitForValue(timeline.Signal());
+	queue.Retire();
+	CHECK(released == 0);
+
+	timeline.Submit(5.0);
+	uint64_t fence = timeline.Signal();
+	queue.EndSubmission(fence);
+	queue.Retire();
+	CHECK(released == 0);
+	CHECK(queue.GetStats().Pending == 1);
+
+	timeline.WaitForValue(fence);
+	queue.Retire();
+	CHECK(released == 1);
+	CHECK(queue.GetStats().Pending == 0);
+}
+
+// Later entries wait behind earlier ones, and releasing can queue more
+TEST(DeferredReleaseQueue, ReleasesInOrder)
+{
+	SimulatedTimeline timeline;
+	DeferredReleaseQueue queue;
+	queue.Initialize(&timeline);
+
+	std::vector<unsigned int> order;
+	queue.Enqueue([&]()
+	{
+		order.push_back(1);
+		queue.Enqueue([&order]() { order.push_back(3); });
+	});
+	timeline.Submit(1.0);
+	queue.EndSubmission(timeline.Signal());
+	queue.Enqueue([&order]() { order.push_back(2); });
+	timeline.Submit(1.0);
+	uint64_t fence = timeline.Signal();
+	queue.EndSubmission(fence);
+
+	timeline.WaitForValue(fence);
+	queue.Retire();
+	REQUIRE(order.size() == 2);
+	CHECK(order[0] == 1 && order[1] == 2);
+
+	// Queued while releasing, so it waits for the next submission
+	queue.EndSubmission(timeline.Signal());
+	timeline.WaitForValue(fence + 1);
+	queue.Retire();
+	REQUIRE(order.size() == 3);
+	CHECK(order[2] == 3);
+
+	DeferredReleaseQueueStats stats = queue.GetStats();
+	CHECK(stats.Queued == 3);
+	CHECK(stats.Released == 3);
+}
+
+TEST(DeferredReleaseQueue, ReleasesEverythingOnShutdown)
+{
+	SimulatedTimeline timeline;
+	unsigned int released = 0;
+	{
+		DeferredReleaseQueue queue;
+		queue.Initialize(&timeline);
+		queue.Enqueue([&released]() { released++; });
+		queue.EndSubmission(timeline.Signal());
+		queue.Enqueue([&released]() { released++; });
+		queue.ReleaseAll();
+		CHECK(released == 2);
+
+		queue.Enqueue([&released]() { released++; });
+	}
+	CHECK(released == 3);
+}
@@ -0,0 +1,267 @@
+#include "TestHarness.h"
+
+#include "../Denoiser.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	const unsigned int width = 192;
+	const unsigned int height = 108;
+
+	// Mean illumination of the floor and the two walls
+	const float meanShade[3] = { 0.5f, 1.0f, 0.25f };
+
+	// --------------------------------------------------------
+	// A floor, two walls and some sky, shaded with 1spp-like
+	// noise (mostly black, with rare bright samples) around a
+	// different mean on each surface.  With noisy false, each
+	// pixel gets its mean instead: the image to aim for.
+	// --------------------------------------------------------
+	void FillScene(std::vector<DenoiserPixel>& pixels, std::mt19937& rng, bool noisy, unsigned int sceneWidth = width, unsigned int sceneHeight = height)
+	{
+		std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+		pixels.resize((size_t)sceneWidth * sceneHeight);
+		for (unsigned int y = 0; y < sceneHeight; y++)
+		{
+			for (unsigned int x = 0; x < sceneWidth; x++)
+			{
+				DenoiserPixel& pixel = pixels[(size_t)y * sceneWidth + x];
+				float v = (y + 0.5f) / sceneHeight;
+				float u = (x + 0.5f) / sceneWidth;
+				if (v < 0.2f)
+				{
+					pixel = {};
+					pixel.Color = XMFLOAT3(0.3f, 0.5f, 0.95f);
+					pixel.InstanceID = DENOISER_INVALID_INSTANCE;
+					continue;
+				}
+
+				unsigned int instance = v > 0.6f ? 0 : (u < 0.5f ? 1 : 2);
+				float shade = meanShade[instance];
+				if (noisy)
+					shade = noise(rng) < 0.25f ? 8.0f * meanShade[instance] * noise(rng) : 0.0f;
+				pixel.Depth = instance == 0 ? 2.0f / (v - 0.55f) : 8.0f + u * 4.0f;
+				pixel.PreviousDepth = pixel.Depth;
+				pixel.Motion = XMFLOAT2(0, 0);
+				pixel.Normal = instance == 0 ? XMFLOAT3(0, 1, 0) : (instance == 1 ? XMFLOAT3(1, 0, 0) : XMFLOAT3(-1, 0, 0));
+				pixel.InstanceID = instance;
+				pixel.Albedo = XMFLOAT3(0.8f, 0.6f + instance * 0.1f, 0.5f);
+				pixel.Color = XMFLOAT3(pixel.Albedo.x * shade, pixel.Albedo.y * shade, pixel.Albedo.z * shade);
+			}
+		}
+	}
+
+	// Root mean squared difference of the RGB channels of the pixels
+	// selected, in 8 bit steps
+	template<typename Select>
+	double GetError(const std::vector<unsigned char>& image, const std::vector<unsigned char>& expected, Select select)
+	{
+		double squared = 0.0;
+		unsigned int count = 0;
+		for (unsigned int y = 0; y < height; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				if (!select(x, y))
+					continue;
+				for (unsigned int c = 0; c < 3; c++)
+				{
+					double difference = (double)image[(y * width + x) * 4 + c] - expected[(y * width + x) * 4 + c];
+					squared += difference * difference;
+				}
+				count += 3;
+			}
+		}
+		return count ? sqrt(squared / count) : 0.0;
+	}
+
+	bool AnyPixel(unsigned int, unsigned int) { return true; }
+
+	std::vector<unsigned char> GetExpectedImage()
+	{
+		std::mt19937 rng(0);
+		std::vector<DenoiserPixel> pixels;
+		FillScene(pixels, rng, false);
+		std::vector<unsigned char> image(width * height * 4);
+		Denoiser::WriteColor(pixels.data(), width, height, image.data(), width * 4);
+		return image;
+	}
+}
+
+TEST(Denoiser, RemovesMostOfTheNoise)
+{
+	std::vector<unsigned char> expected = GetExpectedImage();
+	std::vector<unsigned char> raw(width * height * 4);
+	std::vector<unsigned char> denoised(width * height * 4);
+	std::vector<DenoiserPixel> pixels;
+	std::mt19937 rng(7);
+
+	Denoiser denoiser;
+	DenoiserSettings settings;
+	double rawError = 0.0;
+	double firstError = 0.0;
+	double lastError = 0.0;
+	for (unsigned int f = 0; f < 8; f++)
+	{
+		FillScene(pixels, rng, true);
+		Denoiser::WriteColor(pixels.data(), width, height, raw.data(), width * 4);
+		denoiser.Denoise(pixels.data(), width, height, settings, denoised.data(), width * 4);
+
+		rawError = GetError(raw, expected, AnyPixel);
+		lastError = GetError(denoised, expected, AnyPixel);
+		if (f == 0)
+			firstError = lastError;
+	}
+	printf("  RMS error in 8 bit steps: %.1f raw, %.1f denoised (first frame), %.1f (after 8 frames)\n", rawError, firstError, lastError);
+
+	// Spatial filtering alone helps a lot, and history more again
+	CHECK(firstError < rawError * 0.35);
+	CHECK(lastError < firstError * 0.6);
+}
+
+// The illumination changes at the floor's edge and where the walls meet,
+// which the depth and normal edge stopping should keep sharp
+TEST(Denoiser, KeepsEdges)
+{
+	std::vector<unsigned char> expected = GetExpectedImage();
+	std::vector<unsigned char> denoised(width * height * 4);
+	std::vector<DenoiserPixel> pixels;
+	std::mt19937 rng(3);
+
+	Denoiser denoiser;
+	DenoiserSettings settings;
+	for (unsigned int f = 0; f < 8; f++)
+	{
+		FillScene(pixels, rng, true);
+		denoiser.Denoise(pixels.data(), width, height, settings, denoised.data(), width * 4);
+	}
+
+	auto isEdge = [](unsigned int x, unsigned int y)
+	{
+		float v = (y + 0.5f) / height;
+		float u = (x + 0.5f) / width;
+		bool nearFloor = fabsf(v - 0.6f) * height < 2.0f;
+		bool nearCorner = v > 0.2f && v < 0.6f && fabsf(u - 0.5f) * width < 2.0f;
+		return nearFloor || nearCorner;
+	};
+	auto isInside = [&](unsigned int x, unsigned int y) { return (y + 0.5f) / height > 0.2f && !isEdge(x, y); };
+
+	double edgeError = GetError(denoised, expected, isEdge);
+	double insideError = GetError(denoised, expected, isInside);
+	printf("  RMS error in 8 bit steps: %.1f at edges, %.1f elsewhere\n", edgeError, insideError);
+	CHECK(edgeError < insideError * 2.0 + 2.0);
+}
+
+TEST(Denoiser, LeavesMissesAlone)
+{
+	std::vector<DenoiserPixel> pixels;
+	std::mt19937 rng(1);
+	FillScene(pixels, rng, true);
+
+	std::vector<unsigned char> raw(width * height * 4);
+	std::vector<unsigned char> denoised(width * height * 4);
+	Denoiser::WriteColor(pixels.data(), width, height, raw.data(), width * 4);
+	Denoiser denoiser;
+	denoiser.Denoise(pixels.data(), width, height, DenoiserSettings(), denoised.data(), width * 4);
+
+	auto isSky = [](unsigned int, unsigned int y) { return (y + 0.5f) / height < 0.2f; };
+	CHECK(GetError(denoised, raw, isSky) == 0.0);
+}
+
+// Upload buffers pad their rows, and the padding must be left alone
+TEST(Denoiser, WritesWithinTheRowPitch)
+{
+	std::vector<DenoiserPixel> pixels;
+	std::mt19937 rng(1);
+	FillScene(pixels, rng, true);
+
+	const unsigned int pitch = width * 4 + 20;
+	std::vector<unsigned char> output(pitch * height, 0xCD);
+	Denoiser denoiser;
+	denoiser.Denoise(pixels.data(), width, height, DenoiserSettings(), output.data(), pitch);
+
+	bool paddingKept = true;
+	bool opaque = true;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int i = width * 4; i < pitch; i++)
+			paddingKept &= output[y * pitch + i] == 0xCD;
+		for (unsigned int x = 0; x < width; x++)
+			opaque &= output[y * pitch + x * 4 + 3] == 255;
+	}
+	CHECK(paddingKept);
+	CHECK(opaque);
+}
+
+TEST(Denoiser, ResetForgetsHistory)
+{
+	std::vector<DenoiserPixel> pixels;
+	std::vector<unsigned char> first(width * height * 4);
+	std::vector<unsigned char> second(width * height * 4);
+	std::mt19937 rng(11);
+
+	Denoiser used;
+	for (unsigned int f = 0; f < 4; f++)
+	{
+		FillScene(pixels, rng, true);
+		used.Denoise(pixels.data(), width, height, DenoiserSettings(), first.data(), width * 4);
+	}
+	FillScene(pixels, rng, true);
+	used.Reset();
+	used.Denoise(pixels.data(), width, height, DenoiserSettings(), first.data(), width * 4);
+
+	Denoiser fresh;
+	fresh.Denoise(pixels.data(), width, height, DenoiserSettings(), second.data(), width * 4);
+	CHECK(first == second);
+}
+
+// --------------------------------------------------------
+// Average time of each stage at 720p and 4K.  The first
+// frame allocates everything (and has no history), so it's
+// left out.  4K only times one frame, to keep unoptimized
+// builds' test runs short.
+// --------------------------------------------------------
+TEST(Denoiser, Timings)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	struct Resolution { unsigned int Width; unsigned int Height; const char* Name; unsigned int Frames; };
+	const Resolution resolutions[] = { { 1280, 720, "720p", 4 }, { 3840, 2160, "4K", 2 } };
+
+	for (const Resolution& resolution : resolutions)
+	{
+		std::vector<DenoiserPixel> pixels;
+		std::vector<unsigned char> output((size_t)resolution.Width * resolution.Height * 4);
+		std::mt19937 rng(7);
+
+		Denoiser denoiser;
+		DenoiserSettings settings;
+		DenoiserTimings total = {};
+		double totalMs = 0.0;
+		for (unsigned int f = 0; f < resolution.Frames; f++)
+		{
+			FillScene(pixels, rng, true, resolution.Width, resolution.Height);
+			auto start = Clock::now();
+			denoiser.Denoise(pixels.data(), resolution.Width, resolution.Height, settings, output.data(), resolution.Width * 4);
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			if (f == 0)
+				continue;
+
+			const DenoiserTimings& timings = denoiser.GetTimings();
+			total.TemporalMs += timings.TemporalMs;
+			total.VarianceMs += timings.VarianceMs;
+			total.AtrousMs += timings.AtrousMs;
+			total.OutputMs += timings.OutputMs;
+			totalMs += ms;
+		}
+
+		double n = resolution.Frames - 1;
+		printf("  %-4s %.2fms (temporal %.2f, variance %.2f, a-trous %.2f, output %.2f)\n", resolution.Name,
+			totalMs / n, total.TemporalMs / n, total.VarianceMs / n, total.AtrousMs / n, total.OutputMs / n);
+		CHECK(totalMs > 0.0);
+	}
+}
@@ -0,0 +1,213 @@
+#include "TestHarness.h"
+
+#include "../DescriptorAllocator.h"
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	struct TrackedRange
+	{
+		DescriptorHandle Handle;
+		uint64_t FreedFence;	// 0 while live (or freed this frame, when Freed is set)
+		bool Freed;
+	};
+
+	// Ends a frame on the simulated timeline
+	void EndFrame(SimulatedTimeline& timeline, FrameScheduler& scheduler, DescriptorAllocator& allocator)
+	{
+		timeline.AdvanceCPU(4.0);
+		timeline.Submit(8.0);
+		scheduler.EndFrame();
+		allocator.EndFrame(scheduler.GetLastFrameFenceValue());
+	}
+}
+
+// --------------------------------------------------------
+// Keeps a set of live handles over many frames, randomly
+// allocating (single slots and tables) and freeing them
+// with 3 frames in flight.  Every new range is checked
+// against live ranges and against freed ranges whose frame
+// the GPU hasn't finished, and freed handles are checked
+// to make sure they no longer validate.
+// --------------------------------------------------------
+TEST(DescriptorAllocator, NeverReusesSlotsTheGPUMayRead)
+{
+	const unsigned int frames = 500;
+	const unsigned int capacity = 1000;
+
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 3);
+
+	DescriptorAllocator allocator;
+	allocator.Initialize(&timeline, capacity);
+
+	std::vector<TrackedRange> tracked;
+	unsigned int overlaps = 0;
+	unsigned int missedStaleHandles = 0;
+	unsigned int allocations = 0;
+	unsigned int frees = 0;
+	unsigned int seed = 777;
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		// Drop freed ranges the GPU is done with
+		uint64_t completed = timeline.GetCompletedValue();
+		tracked.erase(std::remove_if(tracked.begin(), tracked.end(),
+			[=](const TrackedRange& r) { return r.Freed && r.FreedFence != 0 && r.FreedFence <= completed; }), tracked.end());
+
+		for (unsigned int op = 0; op < 20; op++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			unsigned int roll = (seed >> 8) % 100;
+
+			// Hover around ~60% full so frees and reuse are exercised
+			unsigned int liveSlots = 0;
+			for (const TrackedRange& r : tracked)
+				liveSlots += r.Freed ? 0 : r.Handle.Count;
+
+			if (roll < (liveSlots < capacity * 6 / 10 ? 70u : 30u))
+			{
+				// Mostly single descriptors, sometimes tables of up to 8
+				unsigned int count = (seed >> 4) % 4 != 0 ? 1 : 2 + (seed >> 16) % 7;
+				DescriptorHandle handle = allocator.Allocate(count);
+				if (!handle.IsValid())
+					continue;
+				allocations++;
+
+				for (const TrackedRange& r : tracked)
+				{
+					if (handle.Index < r.Handle.Index + r.Handle.Count && r.Handle.Index < handle.Index + handle.Count)
+						overlaps++;
+				}
+				tracked.push_back({ handle, 0, false });
+			}
+			else
+			{
+				// Free a random live handle
+				std::vector<size_t> live;
+				for (size_t i = 0; i < tracked.size(); i++)
+				{
+					if (!tracked[i].Freed)
+						live.push_back(i);
+				}
+				if (live.empty())
+					continue;
+
+				TrackedRange& victim = tracked[live[(seed >> 16) % live.size()]];
+				DescriptorHandle copy = victim.Handle;
+				allocator.Free(copy);
+				CHECK(!copy.IsValid());
+				victim.Freed = true;
+				frees++;
+
+				// The old handle must no longer validate
+				if (allocator.Validate(victim.Handle))
+					missedStaleHandles++;
+			}
+		}
+
+		EndFrame(timeline, scheduler, allocator);
+		for (TrackedRange& r : tracked)
+		{
+			if (r.Freed && r.FreedFence == 0)
+				r.FreedFence = scheduler.GetLastFrameFenceValue();
+		}
+	}
+
+	CHECK(allocations > frames * 5);
+	CHECK(frees > frames * 5);
+	CHECK(overlaps == 0);
+	CHECK(missedStaleHandles == 0);
+
+	// Whatever the allocator thinks is allocated should be exactly what's tracked
+	unsigned int trackedSlots = 0;
+	for (const TrackedRange& r : tracked)
+		trackedSlots += r.Handle.Count;
+	DescriptorAllocatorStats stats = allocator.GetStats();
+	CHECK(stats.Allocated == trackedSlots);
+	CHECK(stats.FailedAllocations == 0);
+	CHECK(stats.HighWaterMark <= capacity);
+}
+
+TEST(DescriptorAllocator, FreedSlotsWaitForTheirFrame)
+{
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 3);
+	DescriptorAllocator allocator;
+	allocator.Initialize(&timeline, 4);
+
+	DescriptorHandle all = allocator.Allocate(4);
+	REQUIRE(all.IsValid());
+	allocator.Free(all);
+	CHECK(allocator.GetStats().PendingFree == 4);
+
+	// Freed this frame, so nothing can be handed out yet
+	CHECK(!allocator.Allocate(1).IsValid());
+	CHECK(allocator.GetStats().FailedAllocations == 1);
+
+	EndFrame(timeline, scheduler, allocator);
+	scheduler.WaitForIdle();
+	DescriptorHandle again = allocator.Allocate(4);
+	CHECK(again.IsValid());
+	CHECK(again.Index == 0);
+	CHECK(allocator.GetStats().PendingFree == 0);
+}
+
+TEST(DescriptorAllocator, TablesAreContiguous)
+{
+	SimulatedTimeline timeline;
+	DescriptorAllocator allocator;
+	allocator.Initialize(&timeline, 200);
+
+	// Fill past a bitmap word, then free every other slot
+	std::vector<DescriptorHandle> singles;
+	for (unsigned int i = 0; i < 100; i++)
+		singles.push_back(allocator.Allocate(1));
+	for (unsigned int i = 0; i < 100; i += 2)
+		allocator.Free(singles[i]);
+	allocator.EndFrame(timeline.Signal());
+
+	// The holes are single slots, so a table has to go after them
+	DescriptorHandle table = allocator.Allocate(8);
+	REQUIRE(table.IsValid());
+	CHECK(table.Index == 100);
+	CHECK(allocator.GetStats().LargestFreeRange == 200 - 108);
+
+	// Too long for any run
+	CHECK(!allocator.Allocate(93).IsValid());
+	CHECK(allocator.Allocate(92).IsValid());
+}
+
+TEST(DescriptorAllocator, CatchesStaleHandles)
+{
+	SimulatedTimeline timeline;
+	DescriptorAllocator allocator;
+	allocator.Initialize(&timeline, 16);
+
+	CHECK(!allocator.Validate(DescriptorHandle()));
+
+	DescriptorHandle handle = allocator.Allocate(2);
+	DescriptorHandle copy = handle;
+	CHECK(allocator.Validate(copy));
+	allocator.Free(handle);
+	CHECK(!handle.IsValid());
+
+	// Double free
+	unsigned int staleBefore = allocator.GetStats().StaleHandleUses;
+	allocator.Free(copy);
+	CHECK(allocator.GetStats().StaleHandleUses == staleBefore + 1);
+	CHECK(allocator.GetStats().PendingFree == 2);
+
+	// Even once the slots are reused
+	allocator.EndFrame(timeline.Signal());
+	timeline.WaitForValue(timeline.Signal());
+	DescriptorHandle reused = allocator.Allocate(16);
+	REQUIRE(reused.IsValid());
+	CHECK(reused.Index == 0);
+	CHECK(!allocator.Validate(copy));
+	CHECK(allocator.Validate(reused));
+}
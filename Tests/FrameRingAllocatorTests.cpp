@@ -0,0 +1,228 @@
+#include "TestHarness.h"
+
+#include "../FrameRingAllocator.h"
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	struct Scenario
+	{
+		uint64_t Capacity;
+		bool Growable;
+		uint64_t UnitSize;			// Allocation granularity
+		unsigned int MaxUnits;		// Largest allocation
+		unsigned int MinAllocs;		// Per frame
+		unsigned int MaxAllocs;
+		unsigned int SpikeEvery;	// Frames between 10x spikes (0 for none)
+	};
+
+	struct ScenarioResult
+	{
+		unsigned int Overlaps;		// Allocations that hit space the GPU was still reading
+		unsigned int Failed;
+		unsigned int Grows;
+		unsigned int Stalls;
+		uint64_t HighWaterMark;
+		uint64_t FrameHighWaterMark;
+	};
+
+	struct LiveRange
+	{
+		unsigned int Generation;	// Grow count when allocated
+		uint64_t Offset;
+		uint64_t Size;
+		uint64_t FenceValue;		// 0 while the frame is still being recorded
+	};
+
+	// --------------------------------------------------------
+	// Runs frames with random allocation counts against a
+	// simulated timeline with 3 frames in flight, checking
+	// every allocation against the ones the GPU hasn't
+	// finished with (including the current frame's own)
+	// --------------------------------------------------------
+	ScenarioResult RunScenario(const Scenario& scenario, unsigned int frames = 300)
+	{
+		SimulatedTimeline timeline;
+		FrameScheduler scheduler;
+		scheduler.Initialize(&timeline, 3);
+
+		FrameRingAllocator ring;
+		ring.Initialize(&timeline, scenario.Capacity, scenario.Growable);
+
+		ScenarioResult result = {};
+		std::vector<LiveRange> live;
+		unsigned int seed = 12345;
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			unsigned int allocs = scenario.MinAllocs + (seed >> 8) % (scenario.MaxAllocs - scenario.MinAllocs + 1);
+			if (scenario.SpikeEvery && f % scenario.SpikeEvery == scenario.SpikeEvery - 1)
+				allocs *= 10;
+
+			for (unsigned int a = 0; a < allocs; a++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				uint64_t size = scenario.UnitSize * (1 + (seed >> 12) % scenario.MaxUnits);
+
+				uint64_t offset = 0;
+				if (!ring.Allocate(size, offset))
+				{
+					result.Failed++;
+					continue;
+				}
+
+				// Forget ranges the GPU is done with, then look for overlaps
+				uint64_t completed = timeline.GetCompletedValue();
+				live.erase(std::remove_if(live.begin(), live.end(),
+					[=](const LiveRange& r) { return r.FenceValue != 0 && r.FenceValue <= completed; }), live.end());
+				for (const LiveRange& r : live)
+				{
+					if (r.Generation == ring.GetGrowCount() && offset < r.Offset + r.Size && r.Offset < offset + size)
+						result.Overlaps++;
+				}
+				live.push_back({ ring.GetGrowCount(), offset, size, 0 });
+			}
+
+			timeline.AdvanceCPU(4.0);
+			timeline.Submit(8.0);
+			scheduler.EndFrame();
+			ring.EndFrame(scheduler.GetLastFrameFenceValue());
+			for (LiveRange& r : live)
+			{
+				if (r.FenceValue == 0)
+					r.FenceValue = scheduler.GetLastFrameFenceValue();
+			}
+		}
+
+		result.Grows = ring.GetGrowCount();
+		result.Stalls = ring.GetStallCount();
+		result.HighWaterMark = ring.GetHighWaterMark();
+		result.FrameHighWaterMark = ring.GetFrameHighWaterMark();
+		return result;
+	}
+}
+
+TEST(FrameRingAllocator, UploadHeapGrowsInsteadOfStalling)
+{
+	ScenarioResult steady = RunScenario({ 1000 * 256, true, 256, 8, 20, 200, 0 });
+	CHECK(steady.Overlaps == 0);
+	CHECK(steady.Failed == 0);
+	CHECK(steady.Stalls == 0);
+
+	ScenarioResult spikes = RunScenario({ 1000 * 256, true, 256, 8, 20, 200, 30 });
+	CHECK(spikes.Overlaps == 0);
+	CHECK(spikes.Failed == 0);
+	CHECK(spikes.Stalls == 0);
+	CHECK(spikes.Grows > steady.Grows);
+	CHECK(spikes.FrameHighWaterMark > steady.FrameHighWaterMark);
+}
+
+TEST(FrameRingAllocator, FixedRingStallsInsteadOfOverwriting)
+{
+	ScenarioResult steady = RunScenario({ 1000, false, 1, 1, 100, 400, 0 });
+	CHECK(steady.Overlaps == 0);
+	CHECK(steady.Failed == 0);
+	CHECK(steady.Grows == 0);
+	CHECK(steady.HighWaterMark <= 1000);
+
+	// Spikes need more than a third of the ring, so the CPU has to wait
+	ScenarioResult spikes = RunScenario({ 1000, false, 1, 1, 20, 100, 25 });
+	CHECK(spikes.Overlaps == 0);
+	CHECK(spikes.Failed == 0);
+	CHECK(spikes.Grows == 0);
+	CHECK(spikes.Stalls > 0);
+}
+
+TEST(FrameRingAllocator, FixedRingFailsOnlyWhenAFrameCantFit)
+{
+	SimulatedTimeline timeline;
+	FrameRingAllocator ring;
+	ring.Initialize(&timeline, 100, false);
+
+	uint64_t offset = 0;
+	CHECK(!ring.Allocate(101, offset));
+	CHECK(ring.Allocate(60, offset));
+	CHECK(!ring.Allocate(60, offset));		// Nothing in flight to wait for
+	CHECK(ring.GetUsed() == 60);
+}
+
+TEST(FrameRingAllocator, RetiresFinishedFrames)
+{
+	SimulatedTimeline timeline;
+	FrameRingAllocator ring;
+	ring.Initialize(&timeline, 100, false);
+
+	uint64_t offset = 0;
+	CHECK(ring.Allocate(40, offset));
+	timeline.Submit(5.0);
+	uint64_t fence = timeline.Signal();
+	ring.EndFrame(fence);
+	CHECK(ring.GetFramesInFlight() == 1);
+
+	ring.Retire();
+	CHECK(ring.GetUsed() == 40);
+
+	timeline.WaitForValue(fence);
+	ring.Retire();
+	CHECK(ring.GetUsed() == 0);
+	CHECK(ring.GetFramesInFlight() == 0);
+	CHECK(ring.GetStallCount() == 0);
+}
+
+// Padding to align an allocation belongs to the frame
+TEST(FrameRingAllocator, Aligns)
+{
+	SimulatedTimeline timeline;
+	FrameRingAllocator ring;
+	ring.Initialize(&timeline, 256, false);
+
+	uint64_t offset = 0;
+	CHECK(ring.Allocate(100, offset));
+	CHECK(offset == 0);
+	CHECK(ring.Allocate(10, offset, 64));
+	CHECK(offset == 128);
+	CHECK(ring.GetUsed() == 100 + 28 + 10);
+}
+
+// Allocations never straddle the end; the space skipped to wrap is charged too
+TEST(FrameRingAllocator, Wraps)
+{
+	SimulatedTimeline timeline;
+	FrameRingAllocator ring;
+	ring.Initialize(&timeline, 256, false);
+
+	uint64_t offset = 0;
+	CHECK(ring.Allocate(200, offset));
+	timeline.Submit(1.0);
+	uint64_t first = timeline.Signal();
+	ring.EndFrame(first);
+
+	CHECK(ring.Allocate(40, offset));
+	CHECK(offset == 200);
+	timeline.WaitForValue(first);
+	CHECK(ring.Allocate(50, offset));
+	CHECK(offset == 0);
+	CHECK(ring.GetUsed() == 40 + 16 + 50);
+	CHECK(ring.GetStallCount() == 0);
+}
+
+TEST(FrameRingAllocator, GrowingStartsOver)
+{
+	SimulatedTimeline timeline;
+	FrameRingAllocator ring;
+	ring.Initialize(&timeline, 64, true);
+
+	uint64_t offset = 0;
+	CHECK(ring.Allocate(48, offset));
+	CHECK(ring.Allocate(48, offset));
+	CHECK(ring.GetCapacity() == 128);
+	CHECK(ring.GetGrowCount() == 1);
+	CHECK(offset == 0);
+
+	CHECK(ring.Allocate(1000, offset));
+	CHECK(ring.GetCapacity() == 1024);
+	CHECK(ring.GetGrowCount() == 2);
+}
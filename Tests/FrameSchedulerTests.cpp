@@ -0,0 +1,173 @@
+#include "TestHarness.h"
+
+#include "../FrameScheduler.h"
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+
+namespace
+{
+	struct Workload
+	{
+		double CPUMs;
+		double GPUMs;
+		unsigned int CPUSpikeEvery;		// Frames between CPU hitches (0 for none)
+		unsigned int GPUSpikeEvery;
+	};
+
+	struct WorkloadResult
+	{
+		double MsPerFrame;
+		unsigned int Overwrites;		// Slots written while the GPU still read them
+		uint64_t MaxAhead;				// Unfinished frames plus the one being recorded
+		unsigned int Stalls;
+	};
+
+	// --------------------------------------------------------
+	// Runs a workload on a simulated timeline.  Each frame
+	// "writes" its slot's per-frame data before recording,
+	// which counts as an overwrite if the GPU hasn't finished
+	// the last frame that read it.
+	// --------------------------------------------------------
+	WorkloadResult RunWorkload(const Workload& workload, unsigned int framesInFlight, unsigned int frames)
+	{
+		SimulatedTimeline timeline;
+		FrameScheduler scheduler;
+		scheduler.Initialize(&timeline, framesInFlight);
+
+		WorkloadResult result = {};
+		uint64_t slotReaders[FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT] = {};
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			unsigned int slot = scheduler.GetFrameIndex();
+			if (!scheduler.IsComplete(slotReaders[slot]))
+				result.Overwrites++;
+
+			bool cpuSpike = workload.CPUSpikeEvery && f % workload.CPUSpikeEvery == 0;
+			bool gpuSpike = workload.GPUSpikeEvery && f % workload.GPUSpikeEvery == 0;
+			timeline.AdvanceCPU(workload.CPUMs * (cpuSpike ? 2.0 : 1.0));
+			timeline.Submit(workload.GPUMs * (gpuSpike ? 2.0 : 1.0));
+			scheduler.EndFrame();
+			slotReaders[slot] = scheduler.GetLastFrameFenceValue();
+
+			result.MaxAhead = std::max(result.MaxAhead, scheduler.GetLastFrameFenceValue() - timeline.GetCompletedValue() + 1);
+		}
+		scheduler.WaitForIdle();
+
+		result.MsPerFrame = timeline.GetCPUTime() / frames;
+		result.Stalls = scheduler.GetStallCount();
+		return result;
+	}
+
+	const Workload workloads[] =
+	{
+		{ 6.0, 10.0, 0, 0 },	// GPU bound
+		{ 10.0, 6.0, 0, 0 },	// CPU bound
+		{ 8.0, 8.0, 0, 0 },		// Balanced
+		{ 8.0, 8.0, 5, 7 },		// Hitching
+	};
+	const unsigned int frames = 240;
+}
+
+TEST(FrameScheduler, NeverOverwritesDataTheGPUIsReading)
+{
+	for (const Workload& workload : workloads)
+	{
+		for (unsigned int framesInFlight = 1; framesInFlight <= FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT; framesInFlight++)
+		{
+			WorkloadResult result = RunWorkload(workload, framesInFlight, frames);
+			CHECK(result.Overwrites == 0);
+			CHECK(result.MaxAhead <= framesInFlight);
+		}
+	}
+}
+
+// One frame in flight is the old wait-every-frame behavior
+TEST(FrameScheduler, OneFrameInFlightSerializesCPUAndGPU)
+{
+	for (const Workload& workload : workloads)
+	{
+		if (workload.CPUSpikeEvery || workload.GPUSpikeEvery)
+			continue;
+
+		WorkloadResult result = RunWorkload(workload, 1, frames);
+		CHECK_NEAR(result.MsPerFrame, workload.CPUMs + workload.GPUMs, 0.01);
+	}
+}
+
+// With two or more, frames take as long as the slower of the two
+TEST(FrameScheduler, OverlapsCPUAndGPU)
+{
+	for (const Workload& workload : workloads)
+	{
+		if (workload.CPUSpikeEvery || workload.GPUSpikeEvery)
+			continue;
+
+		for (unsigned int framesInFlight = 2; framesInFlight <= FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT; framesInFlight++)
+		{
+			WorkloadResult result = RunWorkload(workload, framesInFlight, frames);
+			CHECK(result.MsPerFrame < std::max(workload.CPUMs, workload.GPUMs) * 1.01);
+		}
+	}
+}
+
+// A third frame soaks up hitches that a second can't
+TEST(FrameScheduler, MoreFramesInFlightAbsorbHitches)
+{
+	const Workload& hitching = workloads[3];
+	WorkloadResult one = RunWorkload(hitching, 1, frames);
+	WorkloadResult two = RunWorkload(hitching, 2, frames);
+	WorkloadResult three = RunWorkload(hitching, 3, frames);
+	CHECK(two.MsPerFrame < one.MsPerFrame);
+	CHECK(three.MsPerFrame <= two.MsPerFrame);
+	CHECK(three.Stalls <= two.Stalls);
+}
+
+TEST(FrameScheduler, ChangingFramesInFlightWaitsForIdle)
+{
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 3);
+
+	for (unsigned int f = 0; f < 5; f++)
+	{
+		timeline.AdvanceCPU(1.0);
+		timeline.Submit(10.0);
+		scheduler.EndFrame();
+	}
+	CHECK(scheduler.GetFramesInFlight() == 3);
+
+	// Not until the frame ends
+	scheduler.SetFramesInFlight(2);
+	CHECK(scheduler.GetFramesInFlight() == 3);
+
+	timeline.AdvanceCPU(1.0);
+	timeline.Submit(10.0);
+	scheduler.EndFrame();
+	CHECK(scheduler.GetFramesInFlight() == 2);
+	CHECK(scheduler.IsComplete(scheduler.GetLastFrameFenceValue()));
+	CHECK(scheduler.GetFrameIndex() == scheduler.GetFrameNumber() % 2);
+
+	// Clamped to what per-frame resources are sized for
+	scheduler.SetFramesInFlight(FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT + 5);
+	scheduler.EndFrame();
+	CHECK(scheduler.GetFramesInFlight() == FRAME_SCHEDULER_MAX_FRAMES_IN_FLIGHT);
+}
+
+TEST(FrameScheduler, WaitForIdleFinishesEverything)
+{
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 3);
+
+	timeline.AdvanceCPU(1.0);
+	timeline.Submit(25.0);
+	scheduler.EndFrame();
+	timeline.Submit(5.0);
+	CHECK(!scheduler.IsComplete(scheduler.GetLastFrameFenceValue()));
+
+	scheduler.WaitForIdle();
+	CHECK(scheduler.IsComplete(scheduler.GetLastFrameFenceValue()));
+	CHECK_NEAR(timeline.GetCPUTime(), 31.0, 1e-9);
+	CHECK_NEAR(timeline.GetCPUWaitTime(), 30.0, 1e-9);
+}
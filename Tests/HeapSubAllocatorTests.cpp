@@ -0,0 +1,325 @@
+#include "TestHarness.h"
+
+#include "../HeapSubAllocator.h"
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	const uint64_t alignments[] = { 256, 4096, 65536 };
+
+	// --------------------------------------------------------
+	// A HeapSubAllocator on a simulated timeline (3 frames in
+	// flight), plus a copy of everything the GPU might still be
+	// using, so each new allocation can be checked against it
+	// --------------------------------------------------------
+	class TrackedAllocator
+	{
+	public:
+		HeapSubAllocator Allocator;
+		unsigned int Overlaps = 0;
+		unsigned int Misaligned = 0;
+
+		explicit TrackedAllocator(uint64_t blockSize) :
+			blockSize(blockSize)
+		{
+			scheduler.Initialize(&timeline, 3);
+			Allocator.Initialize(&timeline, blockSize);
+		}
+
+		// Adds one allocation to the tracked set, checking it first
+		void Track(const HeapAllocation& allocation, uint64_t alignment)
+		{
+			if (allocation.Offset % alignment != 0 || allocation.Offset + allocation.Size > blockSize)
+				Misaligned++;
+			for (const TrackedAllocation& t : tracked)
+			{
+				if (t.Allocation.Block == allocation.Block &&
+					allocation.Offset < t.Allocation.Offset + t.Allocation.Size &&
+					t.Allocation.Offset < allocation.Offset + allocation.Size)
+					Overlaps++;
+			}
+			tracked.push_back({ allocation, 0, false });
+		}
+
+		uint64_t GetLiveBytes() const
+		{
+			uint64_t liveBytes = 0;
+			for (const TrackedAllocation& t : tracked)
+				liveBytes += t.Freed ? 0 : t.Allocation.Size;
+			return liveBytes;
+		}
+
+		// Frees a live allocation picked by the seed
+		void FreeOne(unsigned int seed)
+		{
+			std::vector<size_t> live;
+			for (size_t i = 0; i < tracked.size(); i++)
+			{
+				if (!tracked[i].Freed)
+					live.push_back(i);
+			}
+			if (live.empty())
+				return;
+
+			TrackedAllocation& victim = tracked[live[seed % live.size()]];
+			Allocator.Free(victim.Allocation);
+			victim.Freed = true;
+		}
+
+		// Sources are freed by Defragment() itself
+		void TrackMoves(const std::vector<HeapAllocationMove>& moves)
+		{
+			for (const HeapAllocationMove& move : moves)
+			{
+				for (TrackedAllocation& t : tracked)
+				{
+					if (!t.Freed && t.Allocation.Block == move.From.Block && t.Allocation.Offset == move.From.Offset)
+						t.Freed = true;
+				}
+				Track(move.To, HEAP_SUB_ALLOCATOR_GRANULARITY);
+			}
+		}
+
+		// Drops tracked frees the GPU is done with
+		void ForgetRetired()
+		{
+			uint64_t completed = timeline.GetCompletedValue();
+			tracked.erase(std::remove_if(tracked.begin(), tracked.end(),
+				[=](const TrackedAllocation& t) { return t.Freed && t.FreedFence != 0 && t.FreedFence <= completed; }), tracked.end());
+		}
+
+		void EndFrame()
+		{
+			timeline.AdvanceCPU(4.0);
+			timeline.Submit(8.0);
+			scheduler.EndFrame();
+			Allocator.EndFrame(scheduler.GetLastFrameFenceValue());
+			for (TrackedAllocation& t : tracked)
+			{
+				if (t.Freed && t.FreedFence == 0)
+					t.FreedFence = scheduler.GetLastFrameFenceValue();
+			}
+		}
+
+	private:
+		struct TrackedAllocation
+		{
+			HeapAllocation Allocation;
+			uint64_t FreedFence;	// 0 while live (or freed this frame, when Freed is set)
+			bool Freed;
+		};
+
+		uint64_t blockSize;
+		SimulatedTimeline timeline;
+		FrameScheduler scheduler;
+		std::vector<TrackedAllocation> tracked;
+	};
+
+	// Log-uniform sizes from 256 bytes to 4MB
+	uint64_t RandomSize(unsigned int& seed)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		uint64_t scale = 256ull << ((seed >> 8) % 15);
+		return scale + (seed >> 4) % scale;
+	}
+}
+
+// --------------------------------------------------------
+// Grows to about three blocks' worth of mixed size and
+// alignment allocations, shrinks back to well under one
+// (leaving holes spread across every block), then
+// defragments and releases whatever blocks it emptied
+// --------------------------------------------------------
+TEST(HeapSubAllocator, FuzzDefragmentAndRelease)
+{
+	const uint64_t blockSize = 64ull << 20;
+	const unsigned int frames = 800;
+
+	TrackedAllocator tracked(blockSize);
+	HeapSubAllocator& allocator = tracked.Allocator;
+	unsigned int allocations = 0;
+	unsigned int inconsistent = 0;
+	unsigned int seed = 4242;
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		tracked.ForgetRetired();
+
+		uint64_t target = f < frames / 2 ? blockSize * 3 : blockSize / 2;
+		for (unsigned int op = 0; op < 30; op++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			bool allocate = (seed >> 8) % 100 < (tracked.GetLiveBytes() < target ? 70u : 30u);
+			if (!allocate)
+			{
+				tracked.FreeOne(seed >> 16);
+				continue;
+			}
+
+			uint64_t size = RandomSize(seed);
+			uint64_t alignment = alignments[(seed >> 20) % 3];
+			HeapAllocation allocation = allocator.Allocate(size, alignment);
+			CHECK(allocation.IsValid());
+			CHECK(allocation.Size >= size && allocation.Size % HEAP_SUB_ALLOCATOR_GRANULARITY == 0);
+			allocations++;
+			tracked.Track(allocation, alignment);
+		}
+
+		tracked.EndFrame();
+		if (f % 50 == 0 && !allocator.CheckConsistency())
+			inconsistent++;
+	}
+
+	// Let everything freed so far retire, then defragment
+	for (unsigned int f = 0; f < 4; f++)
+		tracked.EndFrame();
+	tracked.ForgetRetired();
+	allocator.Retire();
+	HeapSubAllocatorStats before = allocator.GetStats();
+
+	std::vector<HeapAllocationMove> moves;
+	allocator.Defragment(UINT64_MAX, moves);
+	tracked.TrackMoves(moves);
+	if (!allocator.CheckConsistency())
+		inconsistent++;
+
+	// Once the moves' sources retire, their blocks are empty
+	for (unsigned int f = 0; f < 4; f++)
+		tracked.EndFrame();
+	std::vector<unsigned int> released;
+	allocator.ReleaseEmptyBlocks(released);
+	if (!allocator.CheckConsistency())
+		inconsistent++;
+	HeapSubAllocatorStats after = allocator.GetStats();
+
+	printf("  %u allocations, %u blocks before defragmenting (fragmentation %.2f), %u after (%.2f), %u moves\n",
+		allocations, before.BlockCount, before.Fragmentation, after.BlockCount, after.Fragmentation, (unsigned int)moves.size());
+	CHECK(tracked.Overlaps == 0);
+	CHECK(tracked.Misaligned == 0);
+	CHECK(inconsistent == 0);
+	CHECK(before.HighWaterMark > blockSize * 2);
+	CHECK(before.BlockCount >= 3);
+	CHECK(!moves.empty());
+	CHECK(!released.empty());
+	CHECK(after.BlockCount == before.BlockCount - released.size());
+	CHECK(after.AllocatedBytes == before.AllocatedBytes);
+	CHECK(after.FailedAllocations == 0);
+}
+
+TEST(HeapSubAllocator, AlignsAndRoundsUp)
+{
+	SimulatedTimeline timeline;
+	HeapSubAllocator allocator;
+	allocator.Initialize(&timeline, 1 << 20);
+
+	HeapAllocation small = allocator.Allocate(1, 256);
+	CHECK(small.IsValid() && small.Size == 256 && small.Offset == 0);
+
+	HeapAllocation aligned = allocator.Allocate(300, 65536);
+	CHECK(aligned.IsValid());
+	CHECK(aligned.Size == 512);
+	CHECK(aligned.Offset == 65536);
+
+	// The space skipped to align is still free
+	HeapAllocation filler = allocator.Allocate(1024, 256);
+	CHECK(filler.Offset == 256);
+	CHECK(allocator.CheckConsistency());
+}
+
+TEST(HeapSubAllocator, RespectsBlockLimits)
+{
+	SimulatedTimeline timeline;
+	HeapSubAllocator allocator;
+	allocator.Initialize(&timeline, 1 << 20, 1);
+
+	CHECK(!allocator.Allocate((1 << 20) + 1, 256).IsValid());
+	HeapAllocation whole = allocator.Allocate(1 << 20, 256);
+	CHECK(whole.IsValid());
+	CHECK(!allocator.Allocate(256, 256).IsValid());
+	CHECK(allocator.GetStats().FailedAllocations == 2);
+	CHECK(allocator.GetBlockCount() == 1);
+}
+
+TEST(HeapSubAllocator, FreesWaitForTheirFrame)
+{
+	SimulatedTimeline timeline;
+	HeapSubAllocator allocator;
+	allocator.Initialize(&timeline, 1 << 20, 1);
+
+	HeapAllocation whole = allocator.Allocate(1 << 20, 256);
+	allocator.Free(whole);
+	CHECK(allocator.GetStats().PendingFreeBytes == 1 << 20);
+	CHECK(!allocator.Allocate(256, 256).IsValid());
+
+	timeline.Submit(1.0);
+	uint64_t fence = timeline.Signal();
+	allocator.EndFrame(fence);
+	CHECK(!allocator.Allocate(256, 256).IsValid());
+
+	timeline.WaitForValue(fence);
+	CHECK(allocator.Allocate(256, 256).IsValid());
+	CHECK(allocator.GetStats().PendingFreeBytes == 0);
+}
+
+TEST(HeapSubAllocator, MergesFreeNeighbors)
+{
+	SimulatedTimeline timeline;
+	HeapSubAllocator allocator;
+	allocator.Initialize(&timeline, 1 << 20);
+
+	HeapAllocation a = allocator.Allocate(4096, 256);
+	HeapAllocation b = allocator.Allocate(4096, 256);
+	HeapAllocation c = allocator.Allocate(4096, 256);
+	allocator.Free(b);
+	allocator.Free(a);
+	allocator.Free(c);
+	allocator.EndFrame(timeline.Signal());
+	allocator.Retire();
+
+	HeapSubAllocatorStats stats = allocator.GetStats();
+	CHECK(stats.AllocationCount == 0);
+	CHECK(stats.FreeRangeCount == 1);
+	CHECK(stats.LargestFreeRange == 1 << 20);
+	CHECK(stats.Fragmentation == 0.0f);
+	CHECK(allocator.CheckConsistency());
+
+	std::vector<unsigned int> released;
+	allocator.ReleaseEmptyBlocks(released);
+	CHECK(released.size() == 1 && !allocator.IsBlockActive(0));
+}
+
+// Steady allocate/free churn with a few thousand live allocations
+TEST(HeapSubAllocator, ChurnStaysConsistent)
+{
+	SimulatedTimeline timeline;
+	HeapSubAllocator allocator;
+	allocator.Initialize(&timeline, 256ull << 20);
+
+	const unsigned int liveCount = 4096;
+	std::vector<HeapAllocation> live(liveCount);
+	unsigned int seed = 99;
+	for (HeapAllocation& allocation : live)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		allocation = allocator.Allocate(256ull << ((seed >> 8) % 9), alignments[(seed >> 20) % 3]);
+	}
+
+	unsigned int failed = 0;
+	for (unsigned int i = 0; i < 100000; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		HeapAllocation& allocation = live[(seed >> 8) % liveCount];
+		allocator.Free(allocation);
+		if (i % 64 == 63)
+			allocator.EndFrame(timeline.Signal());
+		allocation = allocator.Allocate(256ull << ((seed >> 16) % 9), alignments[(seed >> 24) % 3]);
+		failed += allocation.IsValid() ? 0 : 1;
+	}
+
+	HeapSubAllocatorStats stats = allocator.GetStats();
+	CHECK(failed == 0);
+	CHECK(stats.BlockCount == 1);
+	CHECK(allocator.CheckConsistency());
+}
@@ -0,0 +1,315 @@
+#include "TestHarness.h"
+
+#include "../InstanceBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	struct Entity
+	{
+		float Position[3];
+		unsigned int Version;
+		unsigned int Material;
+	};
+
+	uint64_t GetUploadSize(const std::vector<InstanceBufferRange>& ranges)
+	{
+		uint64_t size = 0;
+		for (const InstanceBufferRange& range : ranges)
+			size += range.Size;
+		return size;
+	}
+
+	// Packs every instance in order, returning how many had changed
+	unsigned int PackAll(InstanceBuffer& buffer, const std::vector<Entity>& entities, const int* materialKeys)
+	{
+		unsigned int packed = 0;
+		buffer.BeginFrame((unsigned int)entities.size());
+		for (unsigned int i = 0; i < entities.size(); i++)
+		{
+			const Entity& e = entities[i];
+			RaytracingInstanceData* record = buffer.UpdateInstance(i, &e, e.Version, &materialKeys[e.Material]);
+			if (record)
+			{
+				record->materialIndex = buffer.GetMaterialIndex(&materialKeys[e.Material]);
+				packed++;
+			}
+		}
+		return packed;
+	}
+}
+
+// --------------------------------------------------------
+// A big scene of one mesh: a few entities move or change
+// material each frame, more are added now and then, and a
+// material's color changes.  GPU buffers updated only
+// from the collected ranges must always match packing
+// everything from scratch.
+// --------------------------------------------------------
+TEST(InstanceBuffer, GPUCopiesMatchAFullRepack)
+{
+	const unsigned int frames = 100;
+	const unsigned int startInstances = 200000;
+	const unsigned int addedInstances = 20000;
+	const unsigned int materialCount = 64;
+
+	unsigned int seed = 777;
+	auto random = [&seed](unsigned int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	// Materials are identified by address, like the renderer's
+	int materialKeys[materialCount] = {};
+	RaytracingMaterialData materialData[materialCount] = {};
+	for (unsigned int m = 0; m < materialCount; m++)
+		materialData[m].color = DirectX::XMFLOAT4(random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+
+	// Entities are identified by address too, so they mustn't move
+	std::vector<Entity> entities;
+	entities.reserve(startInstances + addedInstances * (frames / 25));
+	auto addEntities = [&](unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			Entity e = {};
+			e.Position[0] = (float)random(10000);
+			e.Position[2] = (float)random(10000);
+			e.Material = random(materialCount);
+			entities.push_back(e);
+		}
+	};
+	addEntities(startInstances);
+
+	// What the renderer writes for each instance
+	InstanceBuffer buffer;
+	auto packInstance = [&](const Entity& e, RaytracingInstanceData* record)
+	{
+		for (unsigned int r = 0; r < 3; r++)
+			record->previousRow[r] = DirectX::XMFLOAT4(r == 0 ? 1.0f : 0.0f, r == 1 ? 1.0f : 0.0f, r == 2 ? 1.0f : 0.0f, e.Position[r]);
+		record->materialIndex = buffer.GetMaterialIndex(&materialKeys[e.Material]);
+		record->flags = e.Material % 3 == 1 ? RAYTRACING_INSTANCE_TRANSPARENT : (e.Material % 3 == 2 ? RAYTRACING_INSTANCE_EMISSIVE : 0);
+	};
+
+	std::vector<RaytracingInstanceData> gpuInstances;
+	std::vector<RaytracingMaterialData> gpuMaterials;
+	std::vector<RaytracingInstanceData> reference;
+	std::vector<InstanceBufferRange> instanceRanges;
+	std::vector<InstanceBufferRange> materialRanges;
+	unsigned int mismatches = 0;
+	unsigned int maxRanges = 0;
+	uint64_t fullRepackBytes = 0;
+
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		// A few entities (0.2%) move and fewer change material
+		if (f > 0 && f % 25 == 0)
+			addEntities(addedInstances);
+		for (unsigned int i = 0; i < entities.size() / 500; i++)
+		{
+			Entity& e = entities[random((unsigned int)entities.size())];
+			e.Position[1] += 0.25f;
+			e.Version++;
+		}
+		for (unsigned int i = 0; i < entities.size() / 10000; i++)
+			entities[random((unsigned int)entities.size())].Material = random(materialCount);
+		if (f % 10 == 5)
+			materialData[random(materialCount)].color.x += 0.01f;
+
+		// Pack what changed
+		buffer.BeginFrame((unsigned int)entities.size());
+		for (unsigned int i = 0; i < entities.size(); i++)
+		{
+			const Entity& e = entities[i];
+			RaytracingInstanceData* record = buffer.UpdateInstance(i, &e, e.Version, &materialKeys[e.Material]);
+			if (record)
+				packInstance(e, record);
+		}
+		for (unsigned int m = 0; m < materialCount; m++)
+			buffer.SetMaterialData(buffer.GetMaterialIndex(&materialKeys[m]), materialData[m]);
+		buffer.CollectUploads(instanceRanges, materialRanges);
+		if (f > 0)
+			maxRanges = std::max(maxRanges, (unsigned int)instanceRanges.size());
+
+		// The GPU buffers catch up (recreated, with garbage, if they grew)
+		if (gpuInstances.size() < buffer.GetInstanceCapacity())
+		{
+			gpuInstances.resize(buffer.GetInstanceCapacity());
+			memset(gpuInstances.data(), 0xCD, sizeof(RaytracingInstanceData) * gpuInstances.size());
+		}
+		if (gpuMaterials.size() < buffer.GetMaterialCapacity())
+		{
+			gpuMaterials.resize(buffer.GetMaterialCapacity());
+			memset(gpuMaterials.data(), 0xCD, sizeof(RaytracingMaterialData) * gpuMaterials.size());
+		}
+		for (const InstanceBufferRange& range : instanceRanges)
+			memcpy((unsigned char*)gpuInstances.data() + range.Offset, (const unsigned char*)buffer.GetInstanceData() + range.Offset, (size_t)range.Size);
+		for (const InstanceBufferRange& range : materialRanges)
+			memcpy((unsigned char*)gpuMaterials.data() + range.Offset, (const unsigned char*)buffer.GetMaterialData() + range.Offset, (size_t)range.Size);
+
+		fullRepackBytes += sizeof(RaytracingInstanceData) * (uint64_t)entities.size();
+		if (f % 10 != 9)
+			continue;
+
+		reference.assign(entities.size(), RaytracingInstanceData{});
+		for (unsigned int i = 0; i < entities.size(); i++)
+		{
+			memset(&reference[i], 0, sizeof(RaytracingInstanceData));
+			packInstance(entities[i], &reference[i]);
+		}
+		if (memcmp(gpuInstances.data(), reference.data(), sizeof(RaytracingInstanceData) * reference.size()) != 0)
+			mismatches++;
+		for (unsigned int m = 0; m < materialCount; m++)
+		{
+			if (memcmp(&gpuMaterials[buffer.GetMaterialIndex(&materialKeys[m])], &materialData[m], sizeof(RaytracingMaterialData)) != 0)
+				mismatches++;
+		}
+	}
+
+	InstanceBufferStats stats = buffer.GetStats();
+	printf("  %u instances (capacity %u), %.1f MB uploaded (%.1f MB packing everything), at most %u copies a frame\n",
+		stats.Instances, stats.InstanceCapacity, stats.BytesUploaded / (1024.0 * 1024.0), fullRepackBytes / (1024.0 * 1024.0), maxRanges);
+	CHECK(mismatches == 0);
+	CHECK(stats.Instances == entities.size());
+	CHECK(stats.Materials == materialCount);
+	CHECK(stats.BytesUploaded * 4 < fullRepackBytes);
+	CHECK(maxRanges <= 4096);
+}
+
+TEST(InstanceBuffer, OnlyRepacksWhatChanged)
+{
+	int materialKeys[2] = {};
+	std::vector<Entity> entities(100, Entity{ { 0, 0, 0 }, 0, 0 });
+	InstanceBuffer buffer;
+	std::vector<InstanceBufferRange> instanceRanges, materialRanges;
+
+	CHECK(PackAll(buffer, entities, materialKeys) == 100);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(PackAll(buffer, entities, materialKeys) == 0);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(instanceRanges.empty() && materialRanges.empty());
+
+	// A new transform version or material, or a different entity in the slot
+	entities[10].Version++;
+	entities[20].Material = 1;
+	CHECK(PackAll(buffer, entities, materialKeys) == 2);
+	Entity other = {};
+	buffer.BeginFrame(100);
+	CHECK(buffer.UpdateInstance(30, &other, 0, &materialKeys[0]) != 0);
+	CHECK(buffer.UpdateInstance(30, &other, 0, &materialKeys[0]) == 0);
+}
+
+// --------------------------------------------------------
+// Records up to 8 apart go in one copy, further apart in
+// separate ones, and scattered changes are merged harder
+// rather than making thousands of copies
+// --------------------------------------------------------
+TEST(InstanceBuffer, CoalescesNearbyChanges)
+{
+	const uint64_t stride = sizeof(RaytracingInstanceData);
+	int materialKeys[1] = {};
+	std::vector<Entity> entities(100000, Entity{ { 0, 0, 0 }, 0, 0 });
+	InstanceBuffer buffer;
+	std::vector<InstanceBufferRange> instanceRanges, materialRanges;
+	PackAll(buffer, entities, materialKeys);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+
+	entities[100].Version++;
+	entities[108].Version++;
+	entities[117].Version++;
+	PackAll(buffer, entities, materialKeys);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	REQUIRE(instanceRanges.size() == 2);
+	CHECK(instanceRanges[0].Offset == stride * 100 && instanceRanges[0].Size == stride * 9);
+	CHECK(instanceRanges[1].Offset == stride * 117 && instanceRanges[1].Size == stride);
+	CHECK(materialRanges.empty());
+
+	// Every 20th record changed would be 5000 copies, so the gap
+	// doubles until they're merged
+	for (unsigned int i = 0; i < entities.size(); i += 20)
+		entities[i].Version++;
+	PackAll(buffer, entities, materialKeys);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(!instanceRanges.empty());
+	CHECK(instanceRanges.size() <= 4096);
+	CHECK(buffer.GetStats().Ranges == instanceRanges.size());
+
+	// Everything changed is still covered
+	unsigned int uncovered = 0;
+	for (unsigned int i = 0; i < entities.size(); i += 20)
+	{
+		bool covered = false;
+		for (const InstanceBufferRange& range : instanceRanges)
+			covered = covered || (stride * i >= range.Offset && stride * (i + 1) <= range.Offset + range.Size);
+		uncovered += covered ? 0 : 1;
+	}
+	CHECK(uncovered == 0);
+}
+
+// The buffer is recreated when it grows, so everything in use goes up
+TEST(InstanceBuffer, GrowingUploadsEverythingInUse)
+{
+	const uint64_t stride = sizeof(RaytracingInstanceData);
+	int materialKeys[1] = {};
+	std::vector<Entity> entities(1000, Entity{ { 0, 0, 0 }, 0, 0 });
+	InstanceBuffer buffer;
+	std::vector<InstanceBufferRange> instanceRanges, materialRanges;
+	PackAll(buffer, entities, materialKeys);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(buffer.GetInstanceCapacity() == 1024);
+	CHECK(GetUploadSize(instanceRanges) == stride * 1000);
+
+	entities.resize(1500, Entity{ { 0, 0, 0 }, 0, 0 });
+	PackAll(buffer, entities, materialKeys);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(buffer.GetInstanceCapacity() == 2048);
+	REQUIRE(instanceRanges.size() == 1);
+	CHECK(instanceRanges[0].Offset == 0 && instanceRanges[0].Size == stride * 1500);
+
+	// Slots past a smaller count are left alone
+	entities.resize(500);
+	entities[0].Version++;
+	buffer.BeginFrame(500);
+	buffer.UpdateInstance(0, &entities[0], entities[0].Version, &materialKeys[0]);
+	buffer.UpdateInstance(600, &entities[0], 7, &materialKeys[0]);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	REQUIRE(instanceRanges.size() == 1);
+	CHECK(instanceRanges[0].Offset == 0 && instanceRanges[0].Size == stride);
+}
+
+TEST(InstanceBuffer, MaterialsByIdentity)
+{
+	const uint64_t stride = sizeof(RaytracingMaterialData);
+	int materialKeys[20] = {};
+	InstanceBuffer buffer;
+	std::vector<InstanceBufferRange> instanceRanges, materialRanges;
+
+	CHECK(buffer.GetMaterialIndex(&materialKeys[0]) == 0);
+	CHECK(buffer.GetMaterialIndex(&materialKeys[1]) == 1);
+	CHECK(buffer.GetMaterialIndex(&materialKeys[0]) == 0);
+	CHECK(buffer.GetMaterialCapacity() == 16);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	CHECK(GetUploadSize(materialRanges) == stride * 2);
+
+	// Setting the same data again changes nothing
+	RaytracingMaterialData data = {};
+	data.color = DirectX::XMFLOAT4(1, 0, 0, 0.5f);
+	buffer.SetMaterialData(1, data);
+	buffer.SetMaterialData(1, data);
+	CHECK(buffer.GetStats().MaterialsChanged == 1);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	REQUIRE(materialRanges.size() == 1);
+	CHECK(materialRanges[0].Offset == stride && materialRanges[0].Size == stride);
+
+	// Outgrowing the table uploads all of it
+	for (unsigned int m = 2; m < 20; m++)
+		buffer.GetMaterialIndex(&materialKeys[m]);
+	CHECK(buffer.GetMaterialCapacity() == 32);
+	buffer.CollectUploads(instanceRanges, materialRanges);
+	REQUIRE(materialRanges.size() == 1);
+	CHECK(materialRanges[0].Offset == 0 && materialRanges[0].Size == stride * 20);
+}
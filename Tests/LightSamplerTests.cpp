@@ -0,0 +1,161 @@
+#include "TestHarness.h"
+
+#include "../LightSampler.h"
+#include "TestLights.h"
+
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// Chance of each light coming out of an alias table, worked out from
+	// the table itself (each bucket keeps its entry or jumps to its alias)
+	std::vector<double> GetAliasTableOdds(const std::vector<LightAliasEntry>& table, unsigned int offset, unsigned int count, unsigned int lightCount)
+	{
+		std::vector<double> odds(lightCount, 0.0);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			const LightAliasEntry& entry = table[offset + i];
+			odds[entry.LightIndex] += (double)entry.Probability / count;
+			odds[table[offset + entry.Alias].LightIndex] += (1.0 - entry.Probability) / count;
+		}
+		return odds;
+	}
+
+	double GetTotalImportance(const std::vector<Light>& lights, float sceneVolume, bool directionalOnly)
+	{
+		double total = 0.0;
+		for (const Light& light : lights)
+		{
+			if (!directionalOnly || light.Type == LIGHT_TYPE_DIRECTIONAL)
+				total += LightSampler::LightImportance(light, sceneVolume);
+		}
+		return total;
+	}
+}
+
+// Half by importance, half uniform
+TEST(LightSampler, AliasTablePicksLightsByImportance)
+{
+	std::vector<Light> lights = CreateRandomLights(200, 7);
+	LightSampler sampler;
+	sampler.Build(lights);
+	REQUIRE(sampler.GetAliasTable().size() == sampler.GetLightCount() + sampler.GetInfiniteLightCount());
+	REQUIRE(sampler.GetSceneVolume() > 0.0f);
+
+	float volume = sampler.GetSceneVolume();
+	double total = GetTotalImportance(lights, volume, false);
+	std::vector<double> expected(lights.size());
+	for (unsigned int i = 0; i < lights.size(); i++)
+		expected[i] = 0.5 * LightSampler::LightImportance(lights[i], volume) / total + 0.5 / lights.size();
+
+	std::vector<double> odds = GetAliasTableOdds(sampler.GetAliasTable(), 0, sampler.GetLightCount(), (unsigned int)lights.size());
+	for (unsigned int i = 0; i < lights.size(); i++)
+		CHECK_NEAR(odds[i], expected[i], 1e-5);
+
+	// Far reaching lights matter more than their power alone says
+	Light nearby = lights[10];
+	Light farReaching = nearby;
+	farReaching.Range *= 2.0f;
+	CHECK(LightSampler::LightImportance(farReaching, volume) > LightSampler::LightImportance(nearby, volume));
+
+	// Samples report the pdf of the light they picked
+	for (unsigned int s = 0; s < 1000; s++)
+	{
+		LightSample sample = sampler.SampleAliasTable((s + 0.5f) / 1000.0f, (s * 7 % 1000 + 0.5f) / 1000.0f);
+		REQUIRE(sample.LightIndex >= 0 && sample.LightIndex < (int)lights.size());
+		CHECK_NEAR(sample.Pdf, expected[sample.LightIndex], 1e-5);
+	}
+}
+
+TEST(LightSampler, DirectionalTableHoldsOnlyDirectionalLights)
+{
+	std::vector<Light> lights = CreateRandomLights(50, 3);
+	LightSampler sampler;
+	sampler.Build(lights);
+	REQUIRE(sampler.GetInfiniteLightCount() == 3);
+
+	float volume = sampler.GetSceneVolume();
+	double total = GetTotalImportance(lights, volume, true);
+	std::vector<double> odds = GetAliasTableOdds(sampler.GetAliasTable(), sampler.GetInfiniteAliasOffset(), sampler.GetInfiniteLightCount(), (unsigned int)lights.size());
+	for (unsigned int i = 0; i < lights.size(); i++)
+	{
+		double expected = lights[i].Type == LIGHT_TYPE_DIRECTIONAL ? LightSampler::LightImportance(lights[i], volume) / total : 0.0;
+		CHECK_NEAR(odds[i], expected, 1e-5);
+	}
+}
+
+// How often the BVH walk picks each light should be the pdf it reports
+TEST(LightSampler, BVHSamplesMatchTheirPdf)
+{
+	std::vector<Light> lights = CreateRandomLights(40, 11);
+	LightSampler sampler;
+	sampler.Build(lights);
+
+	XMFLOAT3 positions[] = { XMFLOAT3(0, 0, 0), XMFLOAT3(5, 1, -3), XMFLOAT3(-8, 0, 6) };
+	for (const XMFLOAT3& position : positions)
+	{
+		const unsigned int steps = 512;
+		std::vector<double> frequency(lights.size(), 0.0);
+		std::vector<float> pdfs(lights.size(), -1.0f);
+		for (unsigned int a = 0; a < steps; a++)
+		{
+			for (unsigned int b = 0; b < steps; b++)
+			{
+				LightSample sample = sampler.SampleBVH(position, (a + 0.5f) / steps, (b + 0.5f) / steps);
+				if (sample.LightIndex < 0)
+					continue;
+
+				// The same light always has the same pdf at a position
+				float& pdf = pdfs[sample.LightIndex];
+				CHECK(pdf < 0.0f || fabsf(pdf - sample.Pdf) <= 1e-5f * pdf);
+				pdf = sample.Pdf;
+				frequency[sample.LightIndex] += 1.0 / (steps * steps);
+			}
+		}
+
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			if (pdfs[i] > 0.0f)
+				CHECK_NEAR(frequency[i], pdfs[i], 0.002 + 0.02 * pdfs[i]);
+		}
+	}
+}
+
+// Weighing lights by how far they reach beats picking uniformly, and the
+// BVH, which knows where the shading point is, beats both - by far once
+// lights spread out
+TEST(LightSampler, BVHLowersVariance)
+{
+	const unsigned int counts[] = { 100, 1000, 10000, 100000 };
+	for (unsigned int count : counts)
+	{
+		std::vector<Light> lights = CreateRandomLights(count, count);
+		double uniform = LightSampler::MeasureVariance(lights, LIGHT_SAMPLING_UNIFORM, 64);
+		double alias = LightSampler::MeasureVariance(lights, LIGHT_SAMPLING_ALIAS_TABLE, 64);
+		double bvh = LightSampler::MeasureVariance(lights, LIGHT_SAMPLING_BVH, 64);
+		printf("  %u lights: variance vs uniform %.4fx (alias table), %.4fx (BVH)\n", count, alias / uniform, bvh / uniform);
+		CHECK(alias < uniform);
+		CHECK(bvh < alias);
+		if (count >= 1000)
+			CHECK(bvh < uniform * 0.1);
+	}
+}
+
+TEST(LightSampler, DefaultStrategyFollowsLocalLightCount)
+{
+	LightSampler sampler;
+	sampler.Build(CreateRandomLights(3 + LIGHT_BVH_THRESHOLD, 1));
+	CHECK(sampler.GetDefaultStrategy() == LIGHT_SAMPLING_UNIFORM);
+	sampler.Build(CreateRandomLights(4 + LIGHT_BVH_THRESHOLD, 1));
+	CHECK(sampler.GetDefaultStrategy() == LIGHT_SAMPLING_BVH);
+}
+
+TEST(LightSampler, NoLightsPicksNothing)
+{
+	LightSampler sampler;
+	sampler.Build(std::vector<Light>());
+	for (int strategy = LIGHT_SAMPLING_UNIFORM; strategy <= LIGHT_SAMPLING_BVH; strategy++)
+		CHECK(sampler.Sample(strategy, XMFLOAT3(0, 0, 0), 0.5f, 0.5f).LightIndex == -1);
+}
@@ -0,0 +1,196 @@
+#include "TestHarness.h"
+
+#include "../FileStreams.h"
+#include "../MaterialCompiler.h"
+#include "TestTextures.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// 8x8 of increasing values, in one channel
+	DecodedImage CreateRamp()
+	{
+		DecodedImage ramp = {};
+		ramp.Width = 8;
+		ramp.Height = 8;
+		ramp.Channels = 1;
+		for (unsigned int i = 0; i < 64; i++)
+			ramp.Pixels.push_back((unsigned char)(i * 4));
+		return ramp;
+	}
+
+	DecodedImage CreateFlat(unsigned int size, unsigned int channels, unsigned char value)
+	{
+		DecodedImage flat = {};
+		flat.Width = size;
+		flat.Height = size;
+		flat.Channels = channels;
+		flat.Pixels.assign((size_t)size * size * channels, value);
+		return flat;
+	}
+
+	bool LoadFile(const std::wstring& path, DecodedImage& image)
+	{
+		std::vector<unsigned char> file;
+		return ReadWholeFile(path, file) && PNGDecoder::Decode(file.data(), file.size(), image);
+	}
+}
+
+// Each map goes in its channel, and missing ones get their default
+TEST(MaterialCompiler, PacksEachMapInItsChannel)
+{
+	DecodedImage roughness = CreateRamp();
+	DecodedImage metal = CreateFlat(8, 4, 200);
+	DecodedImage orm;
+	REQUIRE(MaterialCompiler::PackORM(0, &roughness, &metal, orm));
+	CHECK(orm.Width == 8 && orm.Height == 8 && orm.Channels == 4);
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < 64; i++)
+	{
+		const unsigned char* pixel = &orm.Pixels[i * 4];
+		if (pixel[0] != 255 || pixel[1] != roughness.Pixels[i] || pixel[2] != 200 || pixel[3] != 255)
+			wrong++;
+	}
+	CHECK(wrong == 0);
+
+	DecodedImage occlusion = CreateFlat(8, 1, 90);
+	REQUIRE(MaterialCompiler::PackORM(&occlusion, 0, 0, orm));
+	CHECK(orm.Pixels[0] == 90 && orm.Pixels[1] == 255 && orm.Pixels[2] == 0);
+
+	DecodedImage empty;
+	CHECK(!MaterialCompiler::PackORM(0, 0, 0, empty));
+	DecodedImage broken = CreateFlat(8, 1, 0);
+	broken.Pixels.pop_back();
+	CHECK(!MaterialCompiler::PackORM(&broken, 0, 0, empty));
+}
+
+// Smaller maps are scaled up to the largest, so flat ones stay flat
+TEST(MaterialCompiler, ScalesSmallerMapsUp)
+{
+	DecodedImage roughness = CreateRamp();
+	DecodedImage metal = CreateFlat(2, 1, 37);
+	DecodedImage orm;
+	REQUIRE(MaterialCompiler::PackORM(0, &roughness, &metal, orm));
+	CHECK(orm.Width == 8 && orm.Height == 8);
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < 64; i++)
+	{
+		if (orm.Pixels[i * 4 + 2] != 37)
+			wrong++;
+	}
+	CHECK(wrong == 0);
+}
+
+TEST(MaterialCompiler, PNGsRoundTrip)
+{
+	DecodedImage ramp = CreateRamp();
+	DecodedImage orm;
+	REQUIRE(MaterialCompiler::PackORM(0, &ramp, 0, orm));
+
+	std::vector<unsigned char> png;
+	DecodedImage decoded;
+	PNGDecoder::Encode(orm, png);
+	CHECK(PNGDecoder::IsPNG(png.data(), png.size()));
+	REQUIRE(PNGDecoder::Decode(png.data(), png.size(), decoded));
+	CHECK(decoded.Channels == 4 && decoded.Pixels == orm.Pixels);
+
+	PNGDecoder::Encode(ramp, png);
+	REQUIRE(PNGDecoder::Decode(png.data(), png.size(), decoded));
+	CHECK(decoded.Channels == 1 && decoded.Pixels == ramp.Pixels);
+
+	const unsigned char crcCheck[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	CHECK(PNGDecoder::CRC32(crcCheck, sizeof(crcCheck)) == 0xCBF43926);
+}
+
+TEST(MaterialCompiler, SourcesFollowTheSet)
+{
+	MaterialSource source = MaterialCompiler::GetSourcesForSet(L"Textures/", L"paint");
+	CHECK(source.Albedo == L"Textures/paint_albedo.png");
+	CHECK(source.Normals == L"Textures/paint_normals.png");
+	CHECK(source.Metal == L"Textures/paint_metal.png");
+	CHECK(source.Roughness == L"Textures/paint_roughness.png");
+	CHECK(source.Occlusion == L"Textures/paint_ao.png");
+
+	// Nothing to pack
+	MaterialSource missing = MaterialCompiler::GetSourcesForSet(L"Missing/", L"paint");
+	CompiledMaterial compiled = MaterialCompiler::Compile(missing, GetTestOutputDirectory());
+	CHECK(!compiled.Valid && compiled.ORM.empty());
+}
+
+// --------------------------------------------------------
+// The material sets, compiled twice into the test output
+// directory: the second time every ORM texture is found in
+// the cache.  The packed channels match their maps (where
+// no scaling was needed), and each material binds one
+// texture fewer than its maps.
+// --------------------------------------------------------
+TEST(MaterialCompiler, MaterialSetsPackIntoThreeTextures)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	std::wstring cacheDirectory = GetTestOutputDirectory();
+	std::wstring textureDirectory = std::wstring(GetTestAssetDirectory()) + L"Textures/";
+
+	// The packed name comes from the maps, so clear out earlier runs
+	for (const wchar_t* set : TestTextureSets)
+	{
+		CompiledMaterial compiled = MaterialCompiler::Compile(MaterialCompiler::GetSourcesForSet(textureDirectory, set), cacheDirectory);
+		remove(GetNarrowPath(compiled.ORM).c_str());
+	}
+
+	unsigned int bindingsBefore = 0;
+	unsigned int bindingsAfter = 0;
+	unsigned int mismatches = 0;
+	unsigned int compared = 0;
+	double compileMs = 0.0;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		MaterialSource source = MaterialCompiler::GetSourcesForSet(textureDirectory, set);
+		auto start = Clock::now();
+		CompiledMaterial compiled = MaterialCompiler::Compile(source, cacheDirectory);
+		compileMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		CHECK(compiled.Valid);
+		CHECK(!compiled.CacheHit);
+
+		CompiledMaterial again = MaterialCompiler::Compile(source, cacheDirectory);
+		CHECK(again.Valid && again.CacheHit);
+		CHECK(again.ORM == compiled.ORM);
+
+		const std::wstring* before[4] = { &source.Albedo, &source.Normals, &source.Metal, &source.Roughness };
+		const std::wstring* after[3] = { &compiled.Albedo, &compiled.Normals, &compiled.ORM };
+		DecodedImage maps[4];
+		for (int i = 0; i < 4; i++)
+			bindingsBefore += LoadFile(*before[i], maps[i]) ? 1 : 0;
+		DecodedImage images[3];
+		for (int i = 0; i < 3; i++)
+			bindingsAfter += LoadFile(*after[i], images[i]) ? 1 : 0;
+
+		const DecodedImage& orm = images[2];
+		for (int map = 0; map < 2; map++)
+		{
+			const DecodedImage& original = maps[3 - map];
+			if (original.Width != orm.Width || original.Height != orm.Height)
+				continue;
+			compared++;
+			for (size_t t = 0; t < (size_t)orm.Width * orm.Height; t++)
+			{
+				if (orm.Pixels[t * 4 + 1 + map] != original.Pixels[t * original.Channels])
+				{
+					mismatches++;
+					break;
+				}
+			}
+		}
+	}
+
+	printf("  compiled in %.1fms, textures bound %u before, %u after\n", compileMs, bindingsBefore, bindingsAfter);
+	CHECK(compared >= 4);
+	CHECK(mismatches == 0);
+	CHECK(bindingsBefore == 15);
+	CHECK(bindingsAfter == 11);
+}
@@ -0,0 +1,299 @@
+#include "TestHarness.h"
+
+#include "../MipGenerator.h"
+#include "TestTextures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// Largest difference between two chains, in bytes (256 if their shapes differ)
+	unsigned int CompareMips(const std::vector<DecodedImage>& a, const std::vector<DecodedImage>& b)
+	{
+		if (a.size() != b.size())
+			return 256;
+
+		unsigned int largest = 0;
+		for (size_t level = 0; level < a.size(); level++)
+		{
+			if (a[level].Width != b[level].Width || a[level].Height != b[level].Height || a[level].Pixels.size() != b[level].Pixels.size())
+				return 256;
+			for (size_t i = 0; i < a[level].Pixels.size(); i++)
+				largest = std::max(largest, (unsigned int)abs((int)a[level].Pixels[i] - (int)b[level].Pixels[i]));
+		}
+		return largest;
+	}
+
+	// Longest and shortest normal in a level, as decoded
+	void MeasureNormals(const DecodedImage& mip, float& shortest, float& longest)
+	{
+		shortest = 2.0f;
+		longest = 0.0f;
+		for (size_t i = 0; i < mip.Pixels.size(); i += 4)
+		{
+			float x = mip.Pixels[i] / 127.5f - 1.0f;
+			float y = mip.Pixels[i + 1] / 127.5f - 1.0f;
+			float z = mip.Pixels[i + 2] / 127.5f - 1.0f;
+			float length = sqrtf(x * x + y * y + z * z);
+			shortest = std::min(shortest, length);
+			longest = std::max(longest, length);
+		}
+	}
+
+	MipSettings MakeSettings(MipFilter filter, MipContent content, bool wrap)
+	{
+		MipSettings settings;
+		settings.Filter = filter;
+		settings.Content = content;
+		settings.Wrap = wrap;
+		return settings;
+	}
+
+	struct Size { unsigned int Width, Height; };
+
+	// Odd, non-square and one texel wide
+	const Size TestSizes[] = { { 67, 45 }, { 64, 16 }, { 1, 9 } };
+}
+
+TEST(MipGenerator, LevelsHalveDownToOne)
+{
+	CHECK(MipGenerator::GetMipCount(1, 1) == 1);
+	CHECK(MipGenerator::GetMipCount(1024, 1024) == 11);
+	CHECK(MipGenerator::GetMipCount(67, 45) == 7);
+	CHECK(MipGenerator::GetMipCount(1, 9) == 4);
+
+	std::vector<DecodedImage> mips;
+	MipGenerator::Generate(CreateRandomImage(67, 45, 4, 1), MipSettings(), mips);
+	REQUIRE(mips.size() == 7);
+	unsigned int width = 67;
+	unsigned int height = 45;
+	for (const DecodedImage& mip : mips)
+	{
+		CHECK(mip.Width == width && mip.Height == height && mip.Channels == 4);
+		CHECK(mip.Pixels.size() == (size_t)width * height * 4);
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+}
+
+// Every filter, content type and edge mode, against the slow reference
+TEST(MipGenerator, MatchesTheReference)
+{
+	unsigned int seed = 45;
+	unsigned int largestError = 0;
+	for (unsigned int filter = 0; filter < 3; filter++)
+	{
+		for (unsigned int content = 0; content < 3; content++)
+		{
+			for (int wrap = 0; wrap < 2; wrap++)
+			{
+				for (const Size& size : TestSizes)
+				{
+					for (unsigned int channels : { 1u, 4u })
+					{
+						MipSettings settings = MakeSettings((MipFilter)filter, (MipContent)content, wrap != 0);
+						DecodedImage image = CreateRandomImage(size.Width, size.Height, channels, seed++);
+						std::vector<DecodedImage> fast;
+						std::vector<DecodedImage> reference;
+						MipGenerator::Generate(image, settings, fast);
+						MipGenerator::GenerateReference(image, settings, reference);
+						largestError = std::max(largestError, CompareMips(fast, reference));
+					}
+				}
+			}
+		}
+	}
+	CHECK(largestError <= 1);
+}
+
+TEST(MipGenerator, FlatImagesStayFlat)
+{
+	unsigned int changed = 0;
+	for (unsigned int filter = 0; filter < 3; filter++)
+	{
+		for (unsigned int content = 0; content < 3; content++)
+		{
+			for (int wrap = 0; wrap < 2; wrap++)
+			{
+				for (const Size& size : TestSizes)
+				{
+					for (unsigned int channels : { 1u, 4u })
+					{
+						DecodedImage image = CreateRandomImage(size.Width, size.Height, channels, filter * 3 + content);
+						for (size_t i = channels; i < image.Pixels.size(); i++)
+							image.Pixels[i] = image.Pixels[i % channels];
+
+						std::vector<DecodedImage> mips;
+						MipGenerator::Generate(image, MakeSettings((MipFilter)filter, (MipContent)content, wrap != 0), mips);
+						for (size_t level = 1; level < mips.size(); level++)
+						{
+							for (size_t i = 0; i < mips[level].Pixels.size(); i++)
+							{
+								if (mips[level].Pixels[i] != mips[1].Pixels[i % channels])
+									changed++;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	CHECK(changed == 0);
+}
+
+// --------------------------------------------------------
+// A black and white checkerboard averages to middle grey in
+// linear light (188 in sRGB), not to 128.  Alpha is linear.
+// --------------------------------------------------------
+TEST(MipGenerator, FiltersColorInLinearLight)
+{
+	DecodedImage checkerboard = {};
+	checkerboard.Width = 64;
+	checkerboard.Height = 64;
+	checkerboard.Channels = 4;
+	for (unsigned int y = 0; y < 64; y++)
+	{
+		for (unsigned int x = 0; x < 64; x++)
+		{
+			unsigned char value = ((x ^ y) & 1) ? 255 : 0;
+			unsigned char pixel[4] = { value, value, value, value };
+			checkerboard.Pixels.insert(checkerboard.Pixels.end(), pixel, pixel + 4);
+		}
+	}
+
+	std::vector<DecodedImage> srgb;
+	std::vector<DecodedImage> linear;
+	MipGenerator::Generate(checkerboard, MakeSettings(MIP_FILTER_BOX, MIP_CONTENT_SRGB, true), srgb);
+	MipGenerator::Generate(checkerboard, MakeSettings(MIP_FILTER_BOX, MIP_CONTENT_LINEAR, true), linear);
+	CHECK_NEAR(srgb[1].Pixels[0], 188, 1);
+	CHECK_NEAR(srgb[1].Pixels[3], 128, 1);
+	CHECK_NEAR(linear[1].Pixels[0], 128, 1);
+	CHECK(srgb.back().Pixels[0] == srgb[1].Pixels[0]);
+}
+
+// Random normals stay unit length, unlike filtering them as colors
+TEST(MipGenerator, RenormalizesNormals)
+{
+	std::mt19937 rng(45);
+	std::normal_distribution<float> gaussian(0.0f, 1.0f);
+	DecodedImage image = {};
+	image.Width = 128;
+	image.Height = 128;
+	image.Channels = 4;
+	for (unsigned int i = 0; i < 128 * 128; i++)
+	{
+		float n[3] = { gaussian(rng), gaussian(rng), fabsf(gaussian(rng)) + 0.5f };
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		for (int c = 0; c < 3; c++)
+			image.Pixels.push_back((unsigned char)((n[c] / length * 0.5f + 0.5f) * 255.0f + 0.5f));
+		image.Pixels.push_back(255);
+	}
+
+	std::vector<DecodedImage> normals;
+	std::vector<DecodedImage> colors;
+	MipGenerator::Generate(image, MakeSettings(MIP_FILTER_KAISER, MIP_CONTENT_NORMAL, true), normals);
+	MipGenerator::Generate(image, MakeSettings(MIP_FILTER_KAISER, MIP_CONTENT_LINEAR, true), colors);
+	float shortestNormal = 2.0f, longestNormal = 0.0f, shortestColor = 2.0f;
+	for (size_t level = 1; level < normals.size(); level++)
+	{
+		float shortest, longest, ignored;
+		MeasureNormals(normals[level], shortest, longest);
+		shortestNormal = std::min(shortestNormal, shortest);
+		longestNormal = std::max(longestNormal, longest);
+		MeasureNormals(colors[level], shortest, ignored);
+		shortestColor = std::min(shortestColor, shortest);
+	}
+
+	printf("  normal lengths %.3f to %.3f (as colors, down to %.3f)\n", shortestNormal, longestNormal, shortestColor);
+	CHECK(shortestNormal > 0.98f && longestNormal < 1.02f);
+	CHECK(shortestColor < 0.5f);
+}
+
+TEST(MipGenerator, SettingsFollowTheName)
+{
+	CHECK(MipGenerator::GetSettingsForPath(L"Textures/bronze_albedo.png").Content == MIP_CONTENT_SRGB);
+	CHECK(MipGenerator::GetSettingsForPath(L"Textures/Rock_Diffuse.PNG").Content == MIP_CONTENT_SRGB);
+	CHECK(MipGenerator::GetSettingsForPath(L"Textures/bronze_normals.png").Content == MIP_CONTENT_NORMAL);
+	CHECK(MipGenerator::GetSettingsForPath(L"Textures/bronze_roughness.png").Content == MIP_CONTENT_LINEAR);
+
+	MipSettings settings;
+	uint64_t key = MipGenerator::GetCacheKey(1234, settings);
+	CHECK(MipGenerator::GetCacheKey(1235, settings) != key);
+	settings.Wrap = false;
+	CHECK(MipGenerator::GetCacheKey(1234, settings) != key);
+}
+
+// Cached chains round trip, and are rejected if anything's off
+TEST(MipGenerator, CachedChainsRoundTrip)
+{
+	std::vector<DecodedImage> mips;
+	MipGenerator::Generate(CreateRandomImage(40, 24, 4, 7), MipSettings(), mips);
+
+	std::vector<unsigned char> data;
+	std::vector<DecodedImage> loaded;
+	MipGenerator::Serialize(mips, 1234, data);
+	CHECK(MipGenerator::Deserialize(data.data(), data.size(), 1234, loaded));
+	CHECK(CompareMips(loaded, mips) == 0);
+	CHECK(!MipGenerator::Deserialize(data.data(), data.size(), 4321, loaded));
+	CHECK(!MipGenerator::Deserialize(data.data(), data.size() - 1, 1234, loaded));
+	std::vector<unsigned char> corrupt = data;
+	corrupt[corrupt.size() / 2] ^= 1;
+	CHECK(!MipGenerator::Deserialize(corrupt.data(), corrupt.size(), 1234, loaded));
+
+	// Nothing is left from a failed load
+	CHECK(loaded.empty());
+
+	std::wstring path = std::wstring(GetTestOutputDirectory()) + L"MipGeneratorTest.mips";
+	REQUIRE(MipGenerator::Save(path, mips, 1234));
+	std::vector<DecodedImage> fromFile;
+	CHECK(MipGenerator::Load(path, 1234, fromFile));
+	CHECK(CompareMips(fromFile, mips) == 0);
+	CHECK(!MipGenerator::Load(path, 4321, fromFile));
+	CHECK(!MipGenerator::Load(std::wstring(GetTestOutputDirectory()) + L"Missing.mips", 1234, fromFile));
+}
+
+// --------------------------------------------------------
+// The material textures, each with the settings its name
+// implies.  The reference is slow, so only one set is
+// checked against it; the rest are timed.
+// --------------------------------------------------------
+TEST(MipGenerator, MaterialTexturesMatchTheReference)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	double totalMs = 0.0;
+	unsigned int textureCount = 0;
+	unsigned int largestError = 0;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		for (const wchar_t* map : TestTextureMaps)
+		{
+			std::wstring path = GetTestTexturePath(set, map);
+			DecodedImage image = {};
+			if (!LoadTestTexture(path, image))
+				continue;
+
+			MipSettings settings = MipGenerator::GetSettingsForPath(path);
+			std::vector<DecodedImage> mips;
+			auto start = Clock::now();
+			MipGenerator::Generate(image, settings, mips);
+			totalMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			textureCount++;
+			CHECK(mips.size() == MipGenerator::GetMipCount(image.Width, image.Height));
+
+			if (set == TestTextureSets[3])
+			{
+				std::vector<DecodedImage> reference;
+				MipGenerator::GenerateReference(image, settings, reference);
+				largestError = std::max(largestError, CompareMips(mips, reference));
+			}
+		}
+	}
+
+	printf("  %u chains in %.1fms\n", textureCount, totalMs);
+	CHECK(textureCount == 15);
+	CHECK(largestError <= 1);
+}
@@ -0,0 +1,249 @@
+#include "TestHarness.h"
+
+#include "../MipResidency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// A square chain from size down to 1x1, as BC7 (1 byte a texel), BC4 (half) or RGBA8 (4)
+	std::vector<uint64_t> MakeLevelBytes(unsigned int size, unsigned int kind)
+	{
+		std::vector<uint64_t> levelBytes;
+		for (unsigned int w = size; w >= 1; w /= 2)
+		{
+			uint64_t blocks = (uint64_t)std::max(1u, w / 4) * std::max(1u, w / 4);
+			levelBytes.push_back(kind == 0 ? blocks * 16 : (kind == 1 ? blocks * 8 : (uint64_t)w * w * 4));
+		}
+		return levelBytes;
+	}
+
+	uint64_t Sum(const std::vector<uint64_t>& levelBytes, unsigned int from)
+	{
+		uint64_t bytes = 0;
+		for (size_t level = from; level < levelBytes.size(); level++)
+			bytes += levelBytes[level];
+		return bytes;
+	}
+}
+
+TEST(MipResidency, TailsAreTheSmallLevels)
+{
+	std::vector<uint64_t> levelBytes = MakeLevelBytes(1024, 2);
+	unsigned int tail = MipResidency::GetTailLevel(levelBytes);
+	CHECK(levelBytes[tail] <= MIP_RESIDENCY_DEFAULT_TAIL_BYTES);
+	CHECK(levelBytes[tail - 1] > MIP_RESIDENCY_DEFAULT_TAIL_BYTES);
+	CHECK(MipResidency::GetTailLevel(levelBytes, UINT64_MAX) == 0);
+
+	// A texture that's all tail, or too big to have one, still keeps its last level
+	CHECK(MipResidency::GetTailLevel(MakeLevelBytes(64, 0)) == 0);
+	std::vector<uint64_t> huge = { 1 << 30, 1 << 29 };
+	CHECK(MipResidency::GetTailLevel(huge) == 1);
+}
+
+TEST(MipResidency, TailsStayWhateverTheBudget)
+{
+	MipResidency residency;
+	std::vector<uint64_t> levelBytes = MakeLevelBytes(2048, 0);
+	unsigned int tail = MipResidency::GetTailLevel(levelBytes);
+	residency.AddTexture(levelBytes, tail);
+	residency.SetBudget(1);
+
+	std::vector<MipResidencyChange> changes;
+	residency.Update(changes);
+	CHECK(changes.empty());
+	CHECK(residency.GetResidentLevel(0) == tail);
+	CHECK(residency.GetStats().ResidentBytes == Sum(levelBytes, tail));
+	CHECK(residency.GetStats().TailBytes == Sum(levelBytes, tail));
+	CHECK(residency.GetStats().Streaming == 1);
+}
+
+// --------------------------------------------------------
+// Streams in a level at a time (coarsest first) up to the
+// upload limit, though always at least one level, then
+// drops levels straight away when they're no longer wanted
+// --------------------------------------------------------
+TEST(MipResidency, StreamsInThenEvicts)
+{
+	MipResidency residency;
+	std::vector<uint64_t> levelBytes = MakeLevelBytes(1024, 2);
+	unsigned int tail = MipResidency::GetTailLevel(levelBytes);
+	residency.AddTexture(levelBytes, tail);
+	residency.SetUploadLimit(1);
+
+	std::vector<MipResidencyChange> changes;
+	for (unsigned int level = tail; level-- > 0;)
+	{
+		residency.Update(changes);
+		REQUIRE(changes.size() == 1);
+		CHECK(changes[0].FromLevel == level + 1 && changes[0].ToLevel == level);
+	}
+	residency.Update(changes);
+	CHECK(changes.empty());
+	CHECK(residency.GetStats().Loads == tail);
+	CHECK(residency.GetStats().LoadedBytes == Sum(levelBytes, 0) - Sum(levelBytes, tail));
+
+	residency.SetWantedLevel(0, 3);
+	residency.Update(changes);
+	REQUIRE(changes.size() == 1);
+	CHECK(changes[0].FromLevel == 0 && changes[0].ToLevel == 3);
+	CHECK(residency.GetStats().Evictions == 3);
+	CHECK(residency.GetStats().ResidentBytes == Sum(levelBytes, 3));
+
+	// Never past the tail, however little is wanted
+	residency.SetWantedLevel(0, 100);
+	residency.Update(changes);
+	CHECK(residency.GetResidentLevel(0) == tail);
+}
+
+// Room for one more level: equally short, so the higher priority gets it
+TEST(MipResidency, BudgetGoesToTheHigherPriority)
+{
+	std::vector<uint64_t> levelBytes = MakeLevelBytes(1024, 0);
+	unsigned int tail = MipResidency::GetTailLevel(levelBytes);
+	MipResidency residency;
+	residency.AddTexture(levelBytes, tail);
+	residency.AddTexture(levelBytes, tail);
+	uint64_t budget = Sum(levelBytes, tail) * 2 + levelBytes[tail - 1];
+	residency.SetBudget(budget);
+	residency.SetWantedLevel(0, 0, 0.5f);
+	residency.SetWantedLevel(1, 0, 2.0f);
+
+	std::vector<MipResidencyChange> changes;
+	for (int update = 0; update < 4; update++)
+		residency.Update(changes);
+	CHECK(residency.GetResidentLevel(1) == tail - 1);
+	CHECK(residency.GetResidentLevel(0) == tail);
+	CHECK(residency.GetStats().ResidentBytes == budget);
+	CHECK(residency.GetStats().Streaming == 2);
+}
+
+// --------------------------------------------------------
+// Textures of mixed sizes and formats scattered over a
+// plane, with a camera flying over it then stopping.  Each
+// texture wants the level that puts about a texel on each
+// pixel at its distance, with closer ones mattering more.
+// Run with 15% of every level as the budget, then with
+// enough for everything.
+// --------------------------------------------------------
+TEST(MipResidency, FlyoverKeepsToTheBudgetAndSettles)
+{
+	const unsigned int textureCount = 64;
+	const unsigned int movingUpdates = 400;
+	const unsigned int stillUpdates = 200;
+	const uint64_t uploadLimit = 2 * 1024 * 1024;
+
+	std::mt19937 rng(48);
+	std::vector<std::vector<uint64_t>> levelBytes(textureCount);
+	std::vector<unsigned int> tails(textureCount);
+	std::vector<float> positions(textureCount * 2);
+	uint64_t allBytes = 0;
+	for (unsigned int t = 0; t < textureCount; t++)
+	{
+		unsigned int size = 256u << (rng() % 4);
+		levelBytes[t] = MakeLevelBytes(size, rng() % 3);
+		tails[t] = MipResidency::GetTailLevel(levelBytes[t]);
+		allBytes += Sum(levelBytes[t], 0);
+		positions[t * 2] = (float)(rng() % 1000);
+		positions[t * 2 + 1] = (float)(rng() % 1000);
+	}
+
+	for (int run = 0; run < 2; run++)
+	{
+		MipResidency residency;
+		for (unsigned int t = 0; t < textureCount; t++)
+			residency.AddTexture(levelBytes[t], tails[t]);
+		uint64_t budget = run == 0 ? allBytes * 15 / 100 : allBytes;
+		residency.SetBudget(budget);
+		residency.SetUploadLimit(uploadLimit);
+
+		std::vector<unsigned int> wanted(textureCount);
+		uint64_t peakResident = 0;
+		unsigned int settledAt = 0;
+		unsigned int levelsOutOfRange = 0;
+		unsigned int overBudget = 0;
+		unsigned int overUploadLimit = 0;
+		unsigned int wrongChanges = 0;
+		std::vector<MipResidencyChange> changes;
+		for (unsigned int update = 0; update < movingUpdates + stillUpdates; update++)
+		{
+			// Flies a loop over the plane, then stops
+			float time = (float)std::min(update, movingUpdates) / movingUpdates;
+			float cameraX = 500.0f + 400.0f * cosf(time * 6.2832f);
+			float cameraY = 500.0f + 400.0f * sinf(time * 6.2832f);
+			for (unsigned int t = 0; t < textureCount; t++)
+			{
+				float dx = positions[t * 2] - cameraX;
+				float dy = positions[t * 2 + 1] - cameraY;
+				float distance = std::max(sqrtf(dx * dx + dy * dy), 1.0f);
+				float texels = (float)(1u << (levelBytes[t].size() - 1));
+				wanted[t] = (unsigned int)std::max(0.0f, floorf(log2f(texels * distance / 80000.0f)));
+				residency.SetWantedLevel(t, wanted[t], 1.0f / distance);
+			}
+
+			std::vector<unsigned int> before(textureCount);
+			for (unsigned int t = 0; t < textureCount; t++)
+				before[t] = residency.GetResidentLevel(t);
+			residency.Update(changes);
+			MipResidencyStats stats = residency.GetStats();
+
+			// Tails kept, never more detail than wanted, and within the
+			// budget (beyond the tails) and the upload limit
+			uint64_t uploaded = 0;
+			unsigned int loadedLevels = 0;
+			for (unsigned int t = 0; t < textureCount; t++)
+			{
+				unsigned int resident = residency.GetResidentLevel(t);
+				if (resident > tails[t] || resident < std::min(wanted[t], tails[t]))
+					levelsOutOfRange++;
+				for (unsigned int level = resident; level < before[t]; level++)
+				{
+					uploaded += levelBytes[t][level];
+					loadedLevels++;
+				}
+			}
+			if (stats.ResidentBytes > std::max(budget, stats.TailBytes))
+				overBudget++;
+			if (loadedLevels > 1 && uploaded > uploadLimit)
+				overUploadLimit++;
+			for (const MipResidencyChange& change : changes)
+			{
+				if (change.FromLevel != before[change.Texture] || change.ToLevel != residency.GetResidentLevel(change.Texture))
+					wrongChanges++;
+			}
+
+			peakResident = std::max(peakResident, stats.ResidentBytes);
+			if (!changes.empty())
+				settledAt = update + 1;
+		}
+
+		// With room for everything, every texture ends on the level it wants
+		unsigned int shortOfWanted = 0;
+		for (unsigned int t = 0; t < textureCount; t++)
+		{
+			if (residency.GetResidentLevel(t) != std::min(wanted[t], tails[t]))
+				shortOfWanted++;
+		}
+
+		MipResidencyStats stats = residency.GetStats();
+		printf("  budget %.1f MB: peak %.1f MB resident, %.1f MB wanted, settled %u updates after stopping, %u of %u short\n",
+			budget / (1024.0 * 1024.0), peakResident / (1024.0 * 1024.0), stats.WantedBytes / (1024.0 * 1024.0),
+			settledAt > movingUpdates ? settledAt - movingUpdates : 0, stats.Streaming, stats.Textures);
+		CHECK(levelsOutOfRange == 0);
+		CHECK(overBudget == 0);
+		CHECK(overUploadLimit == 0);
+		CHECK(wrongChanges == 0);
+		CHECK(settledAt < movingUpdates + stillUpdates);
+		CHECK(stats.Textures == textureCount);
+		if (run == 0)
+			CHECK(peakResident < allBytes / 4);
+		else
+		{
+			CHECK(shortOfWanted == 0);
+			CHECK(stats.Streaming == 0);
+		}
+	}
+}
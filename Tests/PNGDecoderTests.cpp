@@ -0,0 +1,253 @@
+#include "TestHarness.h"
+
+#include "../FileStreams.h"
+#include "../PNGDecoder.h"
+#include "TestTextures.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	void WriteBigEndian(std::vector<unsigned char>& data, uint32_t value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			data.push_back((unsigned char)(value >> shift));
+	}
+
+	// Chunk CRCs are left at zero, since the decoder doesn't read them
+	void WritePNGChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& chunk)
+	{
+		WriteBigEndian(png, (uint32_t)chunk.size());
+		png.insert(png.end(), type, type + 4);
+		png.insert(png.end(), chunk.begin(), chunk.end());
+		WriteBigEndian(png, 0);
+	}
+
+	// --------------------------------------------------------
+	// Encodes rows of packed samples as a PNG, filtering row y
+	// with filter y % 5 (so every filter gets used) and storing
+	// the result uncompressed in a zlib stream
+	// --------------------------------------------------------
+	std::vector<unsigned char> EncodePNG(
+		unsigned int width,
+		unsigned int height,
+		unsigned int bitDepth,
+		unsigned int colorType,
+		size_t rowBytes,
+		size_t pixelBytes,
+		const std::vector<unsigned char>& rows,
+		const std::vector<unsigned char>& palette,
+		const std::vector<unsigned char>& paletteAlpha)
+	{
+		std::vector<unsigned char> filtered;
+		for (unsigned int y = 0; y < height; y++)
+		{
+			unsigned int filter = y % 5;
+			const unsigned char* row = rows.data() + rowBytes * y;
+			const unsigned char* previous = y > 0 ? row - rowBytes : 0;
+			filtered.push_back((unsigned char)filter);
+			for (size_t i = 0; i < rowBytes; i++)
+			{
+				int left = i >= pixelBytes ? row[i - pixelBytes] : 0;
+				int up = previous ? previous[i] : 0;
+				int upLeft = previous && i >= pixelBytes ? previous[i - pixelBytes] : 0;
+				int predicted = 0;
+				if (filter == 1)
+					predicted = left;
+				else if (filter == 2)
+					predicted = up;
+				else if (filter == 3)
+					predicted = (left + up) / 2;
+				else if (filter == 4)
+				{
+					int estimate = left + up - upLeft;
+					int toLeft = abs(estimate - left);
+					int toUp = abs(estimate - up);
+					int toUpLeft = abs(estimate - upLeft);
+					predicted = (toLeft <= toUp && toLeft <= toUpLeft) ? left : (toUp <= toUpLeft ? up : upLeft);
+				}
+				filtered.push_back((unsigned char)(row[i] - predicted));
+			}
+		}
+
+		std::vector<unsigned char> zlib = { 0x78, 0x01 };
+		size_t offset = 0;
+		do
+		{
+			size_t length = std::min<size_t>(filtered.size() - offset, 65535);
+			zlib.push_back(offset + length == filtered.size() ? 1 : 0);
+			zlib.push_back((unsigned char)length);
+			zlib.push_back((unsigned char)(length >> 8));
+			zlib.push_back((unsigned char)~length);
+			zlib.push_back((unsigned char)(~length >> 8));
+			zlib.insert(zlib.end(), filtered.begin() + offset, filtered.begin() + offset + length);
+			offset += length;
+		} while (offset < filtered.size());
+		WriteBigEndian(zlib, PNGDecoder::Adler32(filtered.data(), filtered.size()));
+
+		std::vector<unsigned char> header;
+		WriteBigEndian(header, width);
+		WriteBigEndian(header, height);
+		header.push_back((unsigned char)bitDepth);
+		header.push_back((unsigned char)colorType);
+		header.push_back(0);
+		header.push_back(0);
+		header.push_back(0);
+
+		std::vector<unsigned char> png = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+		WritePNGChunk(png, "IHDR", header);
+		if (!palette.empty())
+			WritePNGChunk(png, "PLTE", palette);
+		if (!paletteAlpha.empty())
+			WritePNGChunk(png, "tRNS", paletteAlpha);
+		WritePNGChunk(png, "IDAT", zlib);
+		WritePNGChunk(png, "IEND", {});
+		return png;
+	}
+
+	// A small image of every row filter, in RGBA
+	std::vector<unsigned char> MakeSmallPNG()
+	{
+		DecodedImage image = CreateRandomImage(37, 23, 4, 2024);
+		return EncodePNG(37, 23, 8, 6, 37 * 4, 4, image.Pixels, {}, {});
+	}
+}
+
+// --------------------------------------------------------
+// Random images in every color type and bit depth, encoded
+// then decoded, compared against what the decoder should
+// make of their samples
+// --------------------------------------------------------
+TEST(PNGDecoder, DecodesEveryFormat)
+{
+	struct Format { unsigned int ColorType, BitDepth; };
+	const Format formats[] = {
+		{ 0, 1 }, { 0, 2 }, { 0, 4 }, { 0, 8 }, { 0, 16 },
+		{ 2, 8 }, { 2, 16 },
+		{ 3, 1 }, { 3, 2 }, { 3, 4 }, { 3, 8 },
+		{ 4, 8 }, { 4, 16 },
+		{ 6, 8 }, { 6, 16 } };
+	const unsigned int width = 37;
+	const unsigned int height = 23;
+
+	unsigned int seed = 2024;
+	auto random = [&seed](unsigned int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	unsigned int failures = 0;
+	for (const Format& format : formats)
+	{
+		unsigned int samples = format.ColorType == 2 ? 3 : (format.ColorType == 4 ? 2 : (format.ColorType == 6 ? 4 : 1));
+		unsigned int channels = format.ColorType == 0 ? 1 : 4;
+		unsigned int maxSample = format.BitDepth == 16 ? 65535 : (1u << format.BitDepth) - 1;
+		size_t pixelBits = (size_t)samples * format.BitDepth;
+		size_t rowBytes = (width * pixelBits + 7) / 8;
+		size_t pixelBytes = pixelBits < 8 ? 1 : pixelBits / 8;
+
+		// A palette a little bigger than the indices need, some entries see-through
+		std::vector<unsigned char> palette;
+		std::vector<unsigned char> paletteAlpha;
+		if (format.ColorType == 3)
+		{
+			for (unsigned int i = 0; i <= maxSample; i++)
+			{
+				for (int c = 0; c < 3; c++)
+					palette.push_back((unsigned char)random(256));
+				paletteAlpha.push_back(i % 3 == 0 ? (unsigned char)random(256) : 255);
+			}
+		}
+
+		// Pack random samples, and work out the 8-bit pixels they should decode to
+		std::vector<unsigned char> rows(rowBytes * height, 0);
+		std::vector<unsigned char> expected;
+		for (unsigned int y = 0; y < height; y++)
+		{
+			unsigned char* row = rows.data() + rowBytes * y;
+			for (unsigned int x = 0; x < width; x++)
+			{
+				unsigned int values[4] = {};
+				for (unsigned int s = 0; s < samples; s++)
+				{
+					// Some rows repeat the one above, to give the filters something to do
+					size_t index = (size_t)x * samples + s;
+					values[s] = (y % 4 == 3) ? 0 : random(maxSample + 1);
+					if (format.BitDepth == 16)
+					{
+						row[index * 2] = (unsigned char)(values[s] >> 8);
+						row[index * 2 + 1] = (unsigned char)values[s];
+						values[s] >>= 8;
+					}
+					else if (format.BitDepth == 8)
+						row[index] = (unsigned char)values[s];
+					else
+					{
+						size_t bit = index * format.BitDepth;
+						row[bit / 8] |= (unsigned char)(values[s] << (8 - format.BitDepth - bit % 8));
+					}
+				}
+
+				unsigned char pixel[4] = {};
+				switch (format.ColorType)
+				{
+				case 0: pixel[0] = (unsigned char)(format.BitDepth < 8 ? values[0] * 255 / maxSample : values[0]); break;
+				case 2: pixel[0] = (unsigned char)values[0]; pixel[1] = (unsigned char)values[1]; pixel[2] = (unsigned char)values[2]; pixel[3] = 255; break;
+				case 3: memcpy(pixel, &palette[values[0] * 3], 3); pixel[3] = paletteAlpha[values[0]]; break;
+				case 4: pixel[0] = pixel[1] = pixel[2] = (unsigned char)values[0]; pixel[3] = (unsigned char)values[1]; break;
+				case 6: for (int c = 0; c < 4; c++) pixel[c] = (unsigned char)values[c]; break;
+				}
+				expected.insert(expected.end(), pixel, pixel + channels);
+			}
+		}
+
+		std::vector<unsigned char> png = EncodePNG(width, height, format.BitDepth, format.ColorType, rowBytes, pixelBytes, rows, palette, paletteAlpha);
+		DecodedImage image = {};
+		CHECK(PNGDecoder::IsPNG(png.data(), png.size()));
+		bool decoded = PNGDecoder::Decode(png.data(), png.size(), image);
+		if (!decoded || image.Width != width || image.Height != height || image.Channels != channels || image.Pixels != expected)
+		{
+			printf("  color type %u at %u bits didn't match\n", format.ColorType, format.BitDepth);
+			failures++;
+		}
+	}
+	CHECK(failures == 0);
+}
+
+// Truncated, or with a byte of image data changed, anywhere
+TEST(PNGDecoder, BrokenFilesFail)
+{
+	std::vector<unsigned char> realFile;
+	DecodedImage real = {};
+	REQUIRE(ReadWholeFile(GetTestTexturePath(TestTextureSets[0], TestTextureMaps[0]), realFile));
+	REQUIRE(PNGDecoder::Decode(realFile.data(), realFile.size(), real));
+
+	std::vector<unsigned char> small = MakeSmallPNG();
+	std::vector<std::vector<unsigned char>> broken;
+	const std::vector<unsigned char>* files[] = { &small, &realFile };
+	for (const std::vector<unsigned char>* file : files)
+	{
+		broken.push_back(std::vector<unsigned char>(file->begin(), file->begin() + file->size() / 2));
+		broken.push_back(std::vector<unsigned char>(file->begin(), file->end() - 13));
+		for (size_t position : { file->size() / 3, file->size() / 2, file->size() - 40 })
+		{
+			broken.push_back(*file);
+			broken.back()[position] ^= 0x5A;
+		}
+	}
+
+	unsigned int decoded = 0;
+	for (const std::vector<unsigned char>& file : broken)
+	{
+		DecodedImage image = {};
+		if (PNGDecoder::Decode(file.data(), file.size(), image))
+			decoded++;
+	}
+	CHECK(decoded == 0);
+	CHECK(!PNGDecoder::IsPNG(realFile.data() + 1, realFile.size() - 1));
+}
+
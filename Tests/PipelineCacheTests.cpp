@@ -0,0 +1,296 @@
+#include "TestHarness.h"
+
+#include "../PipelineCache.h"
+
+#include <string>
+#include <vector>
+
+namespace
+{
+	const uint64_t Environment = 0x1234;
+
+	// Made-up descriptions and bytecode
+	struct Pipeline
+	{
+		std::vector<unsigned char> Description;
+		std::vector<unsigned char> Bytecode;
+	};
+
+	std::vector<Pipeline> MakePipelines(unsigned int count)
+	{
+		unsigned int seed = 2718;
+		auto random = [&seed](unsigned int range)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) % range;
+		};
+
+		std::vector<Pipeline> pipelines(count);
+		for (Pipeline& pipeline : pipelines)
+		{
+			pipeline.Description.resize(256);
+			pipeline.Bytecode.resize(2048 + random(30000));
+			for (unsigned char& byte : pipeline.Description) byte = (unsigned char)random(256);
+			for (unsigned char& byte : pipeline.Bytecode) byte = (unsigned char)random(256);
+		}
+		return pipelines;
+	}
+
+	uint64_t KeyOf(const Pipeline& pipeline)
+	{
+		PipelineKeyHasher hasher;
+		hasher.Add(pipeline.Description.data(), pipeline.Description.size());
+		hasher.Add(pipeline.Bytecode.data(), pipeline.Bytecode.size());
+		return hasher.GetHash();
+	}
+
+	// The "driver" compiles a blob from the key alone
+	std::vector<unsigned char> Compile(uint64_t key)
+	{
+		std::vector<unsigned char> blob(512 + key % 4096);
+		for (size_t i = 0; i < blob.size(); i++)
+			blob[i] = (unsigned char)(key >> (8 * (i % 8)));
+		return blob;
+	}
+
+	// Finds or compiles every pipeline, as startup does
+	void CreateAll(PipelineCache& cache, const std::vector<Pipeline>& pipelines)
+	{
+		for (const Pipeline& pipeline : pipelines)
+		{
+			uint64_t key = KeyOf(pipeline);
+			if (!cache.Find(key))
+			{
+				std::vector<unsigned char> blob = Compile(key);
+				cache.Store(key, blob.data(), blob.size());
+			}
+		}
+	}
+
+	// A first launch's file, with every pipeline in it
+	std::vector<unsigned char> MakeFile(const std::vector<Pipeline>& pipelines)
+	{
+		PipelineCache cache;
+		cache.Deserialize(0, 0, Environment);
+		CreateAll(cache, pipelines);
+
+		std::vector<unsigned char> file;
+		cache.Serialize(file);
+		return file;
+	}
+}
+
+TEST(PipelineCache, KeysChangeWithAnyBit)
+{
+	unsigned int seed = 77;
+	std::vector<Pipeline> pipelines = MakePipelines(24);
+	unsigned int missed = 0;
+	for (Pipeline& pipeline : pipelines)
+	{
+		uint64_t key = KeyOf(pipeline);
+		for (unsigned int test = 0; test < 64; test++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			std::vector<unsigned char>& bytes = test % 2 ? pipeline.Bytecode : pipeline.Description;
+			unsigned char& byte = bytes[(seed >> 8) % bytes.size()];
+			unsigned char bit = (unsigned char)(1 << (seed >> 4) % 8);
+			byte ^= bit;
+			if (KeyOf(pipeline) == key)
+				missed++;
+			byte ^= bit;
+		}
+	}
+	CHECK(missed == 0);
+
+	// The terminator keeps strings apart
+	PipelineKeyHasher ab, a;
+	ab.AddString("ab");
+	ab.AddString("c");
+	a.AddString("a");
+	a.AddString("bc");
+	CHECK(ab.GetHash() != a.GetHash());
+}
+
+// --------------------------------------------------------
+// Rough startup cost model: compiling costs about 30ms per
+// 10KB of bytecode, creating from a blob about 1ms
+// --------------------------------------------------------
+TEST(PipelineCache, SecondLaunchLoadsEveryBlob)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(24);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+
+	PipelineCache cache;
+	CHECK(cache.Deserialize(file.data(), file.size(), Environment));
+	CHECK(cache.GetStats().Loaded == pipelines.size());
+	CHECK(cache.IsDirty());
+
+	double firstMs = 0;
+	double secondMs = 0;
+	unsigned int wrongBlobs = 0;
+	for (const Pipeline& pipeline : pipelines)
+	{
+		uint64_t key = KeyOf(pipeline);
+		const std::vector<unsigned char>* blob = cache.Find(key);
+		if (!blob || *blob != Compile(key))
+			wrongBlobs++;
+		firstMs += 30.0 * pipeline.Bytecode.size() / 10240;
+		secondMs += blob ? 1.0 : 30.0 * pipeline.Bytecode.size() / 10240;
+	}
+
+	printf("  startup %.1fms first launch, %.1fms with the cache\n", firstMs, secondMs);
+	CHECK(wrongBlobs == 0);
+	CHECK(cache.GetStats().Hits == pipelines.size());
+	CHECK(cache.GetStats().Misses == 0);
+	CHECK(!cache.IsDirty());
+	CHECK(secondMs < firstMs / 10);
+}
+
+TEST(PipelineCache, NewEnvironmentDropsEverything)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(8);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+
+	PipelineCache cache;
+	CHECK(!cache.Deserialize(file.data(), file.size(), Environment + 1));
+	CHECK(cache.GetStats().Loaded == 0);
+	CHECK(cache.GetStats().EnvironmentChanged);
+	CHECK(cache.IsDirty());
+	CHECK(!cache.Find(KeyOf(pipelines[0])));
+
+	// Anything that isn't a cache file at all
+	std::vector<unsigned char> garbage(64, 0xAB);
+	CHECK(!cache.Deserialize(garbage.data(), garbage.size(), Environment));
+	CHECK(!cache.GetStats().EnvironmentChanged);
+	CHECK(!cache.Deserialize(0, 0, Environment));
+}
+
+TEST(PipelineCache, CorruptBlobsAreDropped)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(24);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+
+	// A byte inside the first blob (after the header and its entry's fields)
+	file[24 + 24 + 100] ^= 0xFF;
+	PipelineCache cache;
+	CHECK(cache.Deserialize(file.data(), file.size(), Environment));
+	CHECK(cache.GetStats().Loaded == pipelines.size() - 1);
+	CHECK(cache.GetStats().Rejected == 1);
+
+	unsigned int wrongBlobs = 0;
+	for (const Pipeline& pipeline : pipelines)
+	{
+		uint64_t key = KeyOf(pipeline);
+		const std::vector<unsigned char>* blob = cache.Find(key);
+		if (blob && *blob != Compile(key))
+			wrongBlobs++;
+	}
+	CHECK(wrongBlobs == 0);
+	CHECK(cache.GetStats().Misses == 1);
+}
+
+// Cutting the file anywhere keeps only whole entries from before the cut
+TEST(PipelineCache, TruncatedFilesKeepWhatCameBefore)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(24);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+
+	unsigned int badEntries = 0;
+	unsigned int shrinking = 0;
+	unsigned int lastLoaded = 0;
+	for (size_t cut = 0; cut < file.size(); cut += 97)
+	{
+		PipelineCache cache;
+		cache.Deserialize(file.data(), cut, Environment);
+		unsigned int found = 0;
+		for (const Pipeline& pipeline : pipelines)
+		{
+			uint64_t key = KeyOf(pipeline);
+			const std::vector<unsigned char>* blob = cache.Find(key);
+			if (blob && *blob != Compile(key))
+				badEntries++;
+			found += blob ? 1 : 0;
+		}
+
+		unsigned int loaded = cache.GetStats().Loaded;
+		if (found != loaded || loaded < lastLoaded)
+			shrinking++;
+		lastLoaded = loaded;
+	}
+	CHECK(badEntries == 0);
+	CHECK(shrinking == 0);
+	CHECK(lastLoaded < pipelines.size());
+}
+
+// Changing a shader makes a new entry, and the old one isn't saved again
+TEST(PipelineCache, OnlyUsedEntriesAreSaved)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(24);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+	uint64_t staleKey = KeyOf(pipelines[0]);
+	pipelines[0].Bytecode[0] ^= 1;
+
+	PipelineCache edited;
+	edited.Deserialize(file.data(), file.size(), Environment);
+	CreateAll(edited, pipelines);
+	CHECK(edited.GetStats().Misses == 1);
+	CHECK(edited.GetStats().Stored == 1);
+	CHECK(edited.GetStats().Entries == pipelines.size() + 1);
+	CHECK(edited.IsDirty());
+
+	std::vector<unsigned char> editedFile;
+	edited.Serialize(editedFile);
+	PipelineCache reloaded;
+	reloaded.Deserialize(editedFile.data(), editedFile.size(), Environment);
+	CHECK(reloaded.GetStats().Loaded == pipelines.size());
+	CHECK(!reloaded.Find(staleKey));
+	CHECK(reloaded.Find(KeyOf(pipelines[0])) != 0);
+}
+
+TEST(PipelineCache, RejectedBlobsAreForgotten)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(4);
+	std::vector<unsigned char> file = MakeFile(pipelines);
+
+	PipelineCache cache;
+	cache.Deserialize(file.data(), file.size(), Environment);
+	CreateAll(cache, pipelines);
+	CHECK(!cache.IsDirty());
+
+	uint64_t key = KeyOf(pipelines[2]);
+	cache.Reject(key);
+	cache.Reject(key);
+	CHECK(cache.GetStats().Rejected == 1);
+	CHECK(cache.IsDirty());
+	CHECK(!cache.Find(key));
+}
+
+TEST(PipelineCache, SavesAndLoadsFiles)
+{
+	std::vector<Pipeline> pipelines = MakePipelines(12);
+	std::wstring path = std::wstring(GetTestOutputDirectory()) + L"PipelineCacheTest.bin";
+
+	PipelineCache first;
+	CHECK(!first.Load(std::wstring(GetTestOutputDirectory()) + L"Missing.bin", Environment));
+	CreateAll(first, pipelines);
+	CHECK(first.IsDirty());
+	REQUIRE(first.Save(path));
+	CHECK(!first.IsDirty());
+
+	PipelineCache second;
+	REQUIRE(second.Load(path, Environment));
+	CHECK(second.GetStats().Loaded == pipelines.size());
+	unsigned int wrongBlobs = 0;
+	for (const Pipeline& pipeline : pipelines)
+	{
+		uint64_t key = KeyOf(pipeline);
+		const std::vector<unsigned char>* blob = second.Find(key);
+		if (!blob || *blob != Compile(key))
+			wrongBlobs++;
+	}
+	CHECK(wrongBlobs == 0);
+
+	PipelineCache newDriver;
+	CHECK(!newDriver.Load(path, Environment + 1));
+	CHECK(newDriver.GetStats().EnvironmentChanged);
+}
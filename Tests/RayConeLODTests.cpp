@@ -0,0 +1,300 @@
+#include "TestHarness.h"
+
+#include "../RayCone.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	XMFLOAT3 Add(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z); }
+	XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+	XMFLOAT3 Scale(const XMFLOAT3& a, float s) { return XMFLOAT3(a.x * s, a.y * s, a.z * s); }
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	float Length(const XMFLOAT3& a) { return sqrtf(Dot(a, a)); }
+	XMFLOAT3 Normalize(const XMFLOAT3& a) { return Scale(a, 1.0f / Length(a)); }
+
+	// A latitude/longitude sphere (normals out, or in)
+	void MakeSphere(float radius, unsigned int segments, unsigned int rings, bool inward, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		vertices.clear();
+		indices.clear();
+		for (unsigned int ring = 0; ring <= rings; ring++)
+		{
+			float theta = 3.14159265f * ring / rings;
+			for (unsigned int segment = 0; segment <= segments; segment++)
+			{
+				float phi = 6.2831853f * segment / segments;
+				Vertex vertex = {};
+				vertex.Normal = XMFLOAT3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+				vertex.Position = Scale(vertex.Normal, radius);
+				vertex.UV = XMFLOAT2((float)segment / segments, (float)ring / rings);
+				if (inward)
+					vertex.Normal = Scale(vertex.Normal, -1.0f);
+				vertices.push_back(vertex);
+			}
+		}
+		for (unsigned int ring = 0; ring < rings; ring++)
+		{
+			for (unsigned int segment = 0; segment < segments; segment++)
+			{
+				unsigned int corner = ring * (segments + 1) + segment;
+				unsigned int quad[6] = { corner, corner + 1, corner + segments + 1, corner + 1, corner + segments + 2, corner + segments + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+	}
+
+	// A 2x2 quad with uvs 0-1, facing up
+	RayConeTriangle GetPlaneTriangle()
+	{
+		Vertex quad[4] = {};
+		for (int i = 0; i < 4; i++)
+		{
+			quad[i].Position = XMFLOAT3(i & 1 ? 1.0f : -1.0f, 0.0f, i & 2 ? 1.0f : -1.0f);
+			quad[i].UV = XMFLOAT2(i & 1 ? 1.0f : 0.0f, i & 2 ? 1.0f : 0.0f);
+			quad[i].Normal = XMFLOAT3(0, 1, 0);
+		}
+		return RayConeLOD::GetTriangle(quad[0], quad[1], quad[2]);
+	}
+
+	// Distance along the ray to a sphere, from outside (nearest) or inside
+	// (the far side), or -1 for a miss
+	float IntersectSphere(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& center, float radius)
+	{
+		XMFLOAT3 offset = Subtract(origin, center);
+		float b = Dot(offset, direction);
+		float c = Dot(offset, offset) - radius * radius;
+		float discriminant = b * b - c;
+		if (discriminant < 0.0f)
+			return -1.0f;
+		float root = sqrtf(discriminant);
+		return -b - root > 1e-4f ? -b - root : -b + root;
+	}
+
+	// A ray's path through mirror and glass spheres, exactly
+	struct TracedRay
+	{
+		XMFLOAT3 Origin;
+		XMFLOAT3 Direction;
+	};
+
+	// One step of a scenario: off or through the sphere, and what the cone saw
+	struct ConeStep
+	{
+		float Distance;
+		float CosIncidence;
+		float CosTransmitted;
+		float Curvature;		// Against the normal facing the ray
+		bool Refracted;
+		float Eta;
+		bool Valid;
+	};
+
+	// Hits the sphere and bounces or refracts, returning what the cone needs
+	ConeStep TraceStep(TracedRay& ray, const XMFLOAT3& center, float radius, bool refract, float outsideIndex, float insideIndex)
+	{
+		ConeStep step = {};
+		float distance = IntersectSphere(ray.Origin, ray.Direction, center, radius);
+		if (distance <= 0.0f)
+			return step;
+
+		XMFLOAT3 hit = Add(ray.Origin, Scale(ray.Direction, distance));
+		XMFLOAT3 outward = Scale(Subtract(hit, center), 1.0f / radius);
+		bool inside = Dot(ray.Direction, outward) > 0.0f;
+		XMFLOAT3 normal = inside ? Scale(outward, -1.0f) : outward;
+
+		step.Distance = distance;
+		step.CosIncidence = -Dot(ray.Direction, normal);
+		step.Curvature = inside ? -1.0f / radius : 1.0f / radius;
+		step.Refracted = refract;
+		step.Eta = inside ? insideIndex / outsideIndex : outsideIndex / insideIndex;
+		ray.Origin = hit;
+		if (!refract)
+		{
+			ray.Direction = Subtract(ray.Direction, Scale(normal, 2.0f * Dot(ray.Direction, normal)));
+			step.Valid = true;
+			return step;
+		}
+
+		float k = 1.0f - step.Eta * step.Eta * (1.0f - step.CosIncidence * step.CosIncidence);
+		if (k < 0.0f)
+			return step;
+		step.CosTransmitted = sqrtf(k);
+		ray.Direction = Normalize(Add(Scale(ray.Direction, step.Eta), Scale(normal, step.Eta * step.CosIncidence - step.CosTransmitted)));
+		step.Valid = true;
+		return step;
+	}
+
+	// Distance between a ray and a point, across the plane through the
+	// point at right angles to the other ray's direction
+	float GetSeparation(const TracedRay& ray, const XMFLOAT3& point, const XMFLOAT3& across)
+	{
+		float along = Dot(Subtract(point, ray.Origin), across) / Dot(ray.Direction, across);
+		return Length(Subtract(Add(ray.Origin, Scale(ray.Direction, along)), point));
+	}
+
+	struct Scenario
+	{
+		const char* Name;
+		XMFLOAT3 Center;
+		float Radius;
+		bool Refracts;
+		int Steps;
+		float Angle;
+	};
+
+	// ----------------------------------------------------
+	// Two rays leave the camera a small angle apart and
+	// follow each other off or through a sphere a few
+	// times.  The cone around the first is propagated with
+	// the same steps, and its width is compared with how
+	// far apart the rays really are, at several distances
+	// after the last step.  Returns the worst difference,
+	// relative to the widest the rays get (so passing
+	// through a focus isn't a huge error at a tiny width),
+	// or -1 if the rays missed.
+	// ----------------------------------------------------
+	float CheckScenario(const Scenario& scenario, bool useCurvature)
+	{
+		const float spread = 0.001f;
+		const float insideIndex = 1.5f;
+		TracedRay first = { XMFLOAT3(0, 0, 0), XMFLOAT3(sinf(scenario.Angle), 0, cosf(scenario.Angle)) };
+		TracedRay second = { XMFLOAT3(0, 0, 0), XMFLOAT3(sinf(scenario.Angle + spread), 0, cosf(scenario.Angle + spread)) };
+		RayCone cone = { 0.0f, spread };
+		for (int i = 0; i < scenario.Steps; i++)
+		{
+			ConeStep step = TraceStep(first, scenario.Center, scenario.Radius, scenario.Refracts, 1.0f, insideIndex);
+			ConeStep other = TraceStep(second, scenario.Center, scenario.Radius, scenario.Refracts, 1.0f, insideIndex);
+			if (!step.Valid || !other.Valid)
+				return -1.0f;
+
+			float curvature = useCurvature ? step.Curvature : 0.0f;
+			cone = RayConeLOD::Propagate(cone, step.Distance);
+			cone = step.Refracted ?
+				RayConeLOD::Refract(cone, curvature, step.CosIncidence, step.CosTransmitted, step.Eta) :
+				RayConeLOD::Reflect(cone, curvature, step.CosIncidence);
+		}
+
+		const float distances[] = { 0.0f, 1.0f, 4.0f, 16.0f };
+		float actual[4];
+		float predicted[4];
+		float largest = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			XMFLOAT3 point = Add(first.Origin, Scale(first.Direction, distances[i]));
+			actual[i] = GetSeparation(second, point, first.Direction);
+			predicted[i] = fabsf(RayConeLOD::Propagate(cone, distances[i]).Width);
+			largest = std::max(largest, actual[i]);
+		}
+		float worst = 0.0f;
+		for (int i = 0; i < 4; i++)
+			worst = std::max(worst, fabsf(predicted[i] - actual[i]) / largest);
+		return worst;
+	}
+}
+
+// A 2x2 quad with uvs 0-1 has a quarter of a uv per unit squared
+TEST(RayConeLOD, PlanesHaveTheirTexelDensity)
+{
+	RayConeTriangle plane = GetPlaneTriangle();
+	CHECK_NEAR(plane.TexelDensity, -1.0f, 1e-5f);
+	CHECK(plane.Curvature == 0.0f);
+}
+
+// Every edge of a sphere has curvature 1 / radius (negative inside)
+TEST(RayConeLOD, SpheresHaveTheirCurvature)
+{
+	const float radius = 2.0f;
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<RayConeTriangle> triangles;
+	for (int inward = 0; inward < 2; inward++)
+	{
+		MakeSphere(radius, 64, 32, inward == 1, vertices, indices);
+		RayConeLOD::ComputeTriangles(vertices.data(), indices.data(), indices.size(), triangles);
+		REQUIRE(triangles.size() == indices.size() / 3);
+
+		float expected = inward ? -1.0f / radius : 1.0f / radius;
+		float worst = 0.0f;
+		for (const RayConeTriangle& triangle : triangles)
+		{
+			if (triangle.Curvature != 0.0f)
+				worst = std::max(worst, fabsf(triangle.Curvature - expected));
+		}
+		CHECK(worst <= 1e-3f);
+	}
+}
+
+// --------------------------------------------------------
+// A pixel's cone on the quad (1024 texels across 2 units)
+// covers as many texels as the pixel's footprint does,
+// straight on, at an angle and in an instance scaled up
+// --------------------------------------------------------
+TEST(RayConeLOD, MipsMatchThePixelFootprint)
+{
+	const float fieldOfView = 3.14159265f / 3.0f;
+	const unsigned int screenHeight = 1080;
+	const float texel = 2.0f / 1024.0f;
+	RayConeTriangle plane = GetPlaneTriangle();
+	float pixelSpread = RayConeLOD::GetPixelSpreadAngle(fieldOfView, screenHeight);
+	for (float distance = 1.0f; distance <= 64.0f; distance *= 4.0f)
+	{
+		RayCone cone = RayConeLOD::Propagate({ 0.0f, pixelSpread }, distance);
+		float pixel = 2.0f * distance * tanf(fieldOfView * 0.5f) / screenHeight;
+		CHECK_NEAR(RayConeLOD::GetMipLevel(plane, cone.Width, 1.0f, 1024, 1024), std::max(log2f(pixel / texel), 0.0f), 0.01f);
+		CHECK_NEAR(RayConeLOD::GetMipLevel(plane, cone.Width, 0.5f, 1024, 1024), std::max(log2f(pixel / (0.5f * texel)), 0.0f), 0.01f);
+		CHECK_NEAR(RayConeLOD::GetMipLevel(plane, cone.Width, 1.0f, 1024, 1024, 2.0f), std::max(log2f(pixel / (2.0f * texel)), 0.0f), 0.01f);
+	}
+}
+
+// --------------------------------------------------------
+// Cones against pairs of rays traced exactly.  With the
+// curvature they stay within 5% (cones are first order,
+// so near grazing they drift by a few percent); ignoring
+// it, the mirrors and lenses are far off.
+// --------------------------------------------------------
+TEST(RayConeLOD, ConesFollowTracedRays)
+{
+	const Scenario scenarios[] =
+	{
+		{ "Convex mirror", XMFLOAT3(0, 0, 10), 2.0f, false, 1, 0.1f },
+		{ "Concave mirror (focuses)", XMFLOAT3(0, 0, 2), 6.0f, false, 1, 0.2f },
+		{ "Concave mirror, twice", XMFLOAT3(0, 0, 2), 6.0f, false, 2, 0.2f },
+		{ "Into a glass sphere", XMFLOAT3(0, 0, 10), 2.0f, true, 1, 0.05f },
+		{ "Through a glass sphere", XMFLOAT3(0, 0, 10), 2.0f, true, 2, 0.05f },
+		{ "Convex mirror, near grazing", XMFLOAT3(0, 0, 10), 2.0f, false, 1, 0.19f },
+	};
+	float withCurvature = 0.0f;
+	float withoutCurvature = 0.0f;
+	for (const Scenario& scenario : scenarios)
+	{
+		float worst = CheckScenario(scenario, true);
+		float flat = CheckScenario(scenario, false);
+		printf("  %-28s off by %.1f%% (%.1f%% ignoring curvature)\n", scenario.Name, worst * 100.0f, flat * 100.0f);
+		CHECK(worst >= 0.0f && worst <= 0.05f);
+		withCurvature = std::max(withCurvature, worst);
+		withoutCurvature = std::max(withoutCurvature, flat);
+	}
+	CHECK(withoutCurvature > withCurvature * 10.0f);
+}
+
+// Precomputation, as a mesh load would do it
+TEST(RayConeLOD, PrecomputesEveryTriangle)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<RayConeTriangle> triangles;
+	MakeSphere(1.0f, 1024, 512, false, vertices, indices);
+	auto start = Clock::now();
+	RayConeLOD::ComputeTriangles(vertices.data(), indices.data(), indices.size(), triangles);
+	double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	printf("  %zu triangles in %.1fms (%zu bytes each)\n", triangles.size(), ms, sizeof(RayConeTriangle));
+	CHECK(triangles.size() == (size_t)1024 * 512 * 2);
+	CHECK(sizeof(RayConeTriangle) == 8);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "../ResourceStateTracker.h"
+
+// --------------------------------------------------------
+// Keeps every batch it's given, so exactly which barriers
+// a frame emits can be checked
+// --------------------------------------------------------
+class RecordingBarrierSink : public ResourceBarrierSink
+{
+public:
+	void EmitBarriers(const ResourceBarrier* barriers, unsigned int count) override
+	{
+		batches.emplace_back(barriers, barriers + count);
+	}
+
+	void Clear() { batches.clear(); }
+
+	const std::vector<std::vector<ResourceBarrier>>& GetBatches() const { return batches; }
+
+	unsigned int GetBarrierCount() const
+	{
+		unsigned int count = 0;
+		for (const std::vector<ResourceBarrier>& batch : batches)
+			count += (unsigned int)batch.size();
+		return count;
+	}
+
+private:
+	std::vector<std::vector<ResourceBarrier>> batches;
+};
@@ -0,0 +1,576 @@
+#include "TestHarness.h"
+
+#include "../RenderGraph.h"
+#include "RecordingBarrierSink.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// --------------------------------------------------------
+	// Placed resources are records of where they went, with
+	// the heaps remembered so placement can be checked
+	// --------------------------------------------------------
+	class TestRenderGraphBackend : public RenderGraphBackend
+	{
+	public:
+		struct Placed
+		{
+			RenderGraphHeapKind HeapKind;
+			uint64_t Offset;
+			uint64_t Size;
+		};
+
+		uint64_t HeapSizes[RENDER_GRAPH_HEAP_KIND_COUNT] = {};
+		unsigned int Discards = 0;
+
+		void GetAllocationInfo(const RenderGraphResourceDesc& desc, uint64_t& size, uint64_t& alignment) override
+		{
+			const uint64_t pageSize = 64 * 1024;
+			uint64_t bytes = desc.Type == RENDER_GRAPH_BUFFER ? desc.Width : desc.Width * desc.Height * desc.BytesPerPixel;
+			size = (bytes + pageSize - 1) / pageSize * pageSize;
+			alignment = pageSize;
+		}
+
+		void CreateHeap(RenderGraphHeapKind kind, uint64_t size) override
+		{
+			HeapSizes[kind] = size;
+		}
+
+		void* CreatePlacedResource(const RenderGraphResourceDesc& desc, RenderGraphHeapKind kind, uint64_t offset, ResourceStates /*initialState*/) override
+		{
+			uint64_t size = 0, alignment = 0;
+			GetAllocationInfo(desc, size, alignment);
+			placed.emplace_back(new Placed{ kind, offset, size });
+			return placed.back().get();
+		}
+
+		void ReleaseAll() override
+		{
+			placed.clear();
+			for (uint64_t& size : HeapSizes)
+				size = 0;
+		}
+
+		void BeginLifetime(void* /*resource*/) override { Discards++; }
+
+	private:
+		std::vector<std::unique_ptr<Placed>> placed;
+	};
+
+	// --------------------------------------------------------
+	// A RenderGraph plus a copy of everything declared, so
+	// the compiled result can be checked against the
+	// declaration without looking inside the graph.  Every
+	// pass checks that what it uses is in the state it asked
+	// for and records its name when it runs.
+	// --------------------------------------------------------
+	class CheckedGraph
+	{
+	public:
+		TestRenderGraphBackend Backend;	// Outlives the graph, which releases into it
+		RenderGraph Graph;
+		std::vector<std::string> Ran;
+		unsigned int WrongStates = 0;
+
+		explicit CheckedGraph(ResourceStateTracker* states) :
+			states(states)
+		{
+			Graph.Initialize(&Backend, states);
+		}
+
+		void Reset()
+		{
+			Graph.Reset();
+			transient.clear();
+			accesses.clear();
+			Ran.clear();
+		}
+
+		RenderGraphResource CreateTransient(const char* name, const RenderGraphResourceDesc& desc)
+		{
+			transient.push_back(true);
+			return Graph.CreateTransient(name, desc);
+		}
+
+		RenderGraphResource Import(const char* name, void* resource, ResourceStates finalState)
+		{
+			transient.push_back(false);
+			return Graph.Import(name, resource, finalState);
+		}
+
+		unsigned int AddPass(const char* name)
+		{
+			unsigned int pass = (unsigned int)GetPassCount();
+			std::string passName = name;
+			return Graph.AddPass(name, [this, pass, passName]()
+			{
+				Ran.push_back(passName);
+				for (const DeclaredAccess& access : accesses)
+				{
+					void* physical = Graph.GetPhysical(access.Resource);
+					if (access.Pass == pass && physical && states && (states->GetState(physical) & access.State) != access.State)
+						WrongStates++;
+				}
+			});
+		}
+
+		void Read(unsigned int pass, RenderGraphResource resource, ResourceStates state)
+		{
+			accesses.push_back({ pass, resource, state, false });
+			Graph.Read(pass, resource, state);
+		}
+
+		void Write(unsigned int pass, RenderGraphResource resource, ResourceStates state)
+		{
+			accesses.push_back({ pass, resource, state, true });
+			Graph.Write(pass, resource, state);
+		}
+
+		// Two transients in use at the same time must not share memory,
+		// and everything has to fit in its heap
+		unsigned int CountOverlaps() const
+		{
+			std::vector<unsigned int> first, last;
+			GetLifetimes(first, last);
+
+			unsigned int overlaps = 0;
+			for (size_t i = 0; i < transient.size(); i++)
+			{
+				const TestRenderGraphBackend::Placed* a = GetPlaced((RenderGraphResource)i);
+				if (!a)
+					continue;
+				if (a->Offset + a->Size > Backend.HeapSizes[a->HeapKind])
+					overlaps++;
+
+				for (size_t j = i + 1; j < transient.size(); j++)
+				{
+					const TestRenderGraphBackend::Placed* b = GetPlaced((RenderGraphResource)j);
+					if (!b || a->HeapKind != b->HeapKind)
+						continue;
+					bool liveTogether = first[i] <= last[j] && first[j] <= last[i];
+					bool sameMemory = a->Offset < b->Offset + b->Size && b->Offset < a->Offset + a->Size;
+					if (liveTogether && sameMemory)
+						overlaps++;
+				}
+			}
+			return overlaps;
+		}
+
+		// Passes touching the same resource, at least one of them
+		// writing, have to run in the order they were declared
+		unsigned int CountOutOfOrder() const
+		{
+			std::vector<unsigned int> position = GetPositions();
+			unsigned int outOfOrder = 0;
+			for (size_t i = 0; i < accesses.size(); i++)
+			{
+				for (size_t j = i + 1; j < accesses.size(); j++)
+				{
+					const DeclaredAccess& a = accesses[i];
+					const DeclaredAccess& b = accesses[j];
+					if (a.Resource != b.Resource || a.Pass == b.Pass || (!a.Write && !b.Write))
+						continue;
+					if (Graph.IsCulled(a.Pass) || Graph.IsCulled(b.Pass))
+						continue;
+
+					unsigned int earlier = std::min(a.Pass, b.Pass);
+					unsigned int later = std::max(a.Pass, b.Pass);
+					if (position[earlier] > position[later])
+						outOfOrder++;
+				}
+			}
+			return outOfOrder;
+		}
+
+		// Culled passes may not write anything imported, or anything a
+		// pass that runs reads
+		unsigned int CountWronglyCulled() const
+		{
+			unsigned int wronglyCulled = 0;
+			for (size_t i = 0; i < accesses.size(); i++)
+			{
+				const DeclaredAccess& write = accesses[i];
+				if (!write.Write || !Graph.IsCulled(write.Pass))
+					continue;
+				if (!transient[write.Resource])
+				{
+					wronglyCulled++;
+					continue;
+				}
+
+				// Reads up to the next write of the same resource
+				for (size_t j = i + 1; j < accesses.size(); j++)
+				{
+					const DeclaredAccess& next = accesses[j];
+					if (next.Resource != write.Resource || next.Pass == write.Pass)
+						continue;
+					if (next.Write)
+						break;
+					if (!Graph.IsCulled(next.Pass))
+						wronglyCulled++;
+				}
+			}
+			return wronglyCulled;
+		}
+
+		const TestRenderGraphBackend::Placed* GetPlaced(RenderGraphResource resource) const
+		{
+			if (resource >= transient.size() || !transient[resource])
+				return 0;
+			return (const TestRenderGraphBackend::Placed*)Graph.GetPhysical(resource);
+		}
+
+	private:
+		struct DeclaredAccess
+		{
+			unsigned int Pass;
+			RenderGraphResource Resource;
+			ResourceStates State;
+			bool Write;
+		};
+
+		ResourceStateTracker* states;
+		std::vector<bool> transient;
+		std::vector<DeclaredAccess> accesses;
+
+		size_t GetPassCount() const
+		{
+			return (size_t)Graph.GetStats().Passes;
+		}
+
+		std::vector<unsigned int> GetPositions() const
+		{
+			std::vector<unsigned int> position(GetPassCount(), 0xffffffff);
+			const std::vector<unsigned int>& order = Graph.GetExecutionOrder();
+			for (unsigned int i = 0; i < order.size(); i++)
+				position[order[i]] = i;
+			return position;
+		}
+
+		// First and last positions in the execution order using each resource
+		void GetLifetimes(std::vector<unsigned int>& first, std::vector<unsigned int>& last) const
+		{
+			std::vector<unsigned int> position = GetPositions();
+			first.assign(transient.size(), 0xffffffff);
+			last.assign(transient.size(), 0);
+			for (const DeclaredAccess& access : accesses)
+			{
+				if (Graph.IsCulled(access.Pass))
+					continue;
+				first[access.Resource] = std::min(first[access.Resource], position[access.Pass]);
+				last[access.Resource] = std::max(last[access.Resource], position[access.Pass]);
+			}
+		}
+	};
+
+	RenderGraphResourceDesc Texture(uint64_t width, unsigned int height, unsigned int format, unsigned int bytesPerPixel)
+	{
+		RenderGraphResourceDesc desc = {};
+		desc.Type = RENDER_GRAPH_TEXTURE_2D;
+		desc.Width = width;
+		desc.Height = height;
+		desc.Format = format;
+		desc.BytesPerPixel = bytesPerPixel;
+		desc.Flags = RENDER_GRAPH_FLAG_UNORDERED_ACCESS;
+		return desc;
+	}
+
+	// --------------------------------------------------------
+	// A frame like the renderer is heading towards: path traced
+	// radiance (plus the G-buffer and motion it needs) goes
+	// through temporal accumulation, denoising, upscaling and
+	// tonemapping before the copy to the back buffer.  A debug
+	// view nothing reads should be culled.  Scale is in
+	// quarters of 1280x720 rendered, 1920x1080 output.
+	// --------------------------------------------------------
+	struct Frame
+	{
+		int Objects[2];
+		void* History = &Objects[0];
+		void* BackBuffer = &Objects[1];
+
+		RecordingBarrierSink Sink;
+		ResourceStateTracker Tracker;
+		CheckedGraph Graph;
+
+		Frame() :
+			Graph(&Tracker)
+		{
+			Tracker.Initialize(&Sink);
+			Tracker.Register(History, RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			Tracker.Register(BackBuffer, RESOURCE_STATE_PRESENT);
+		}
+
+		void Declare(unsigned int scale)
+		{
+			const unsigned int rw = 1280 * scale / 4, rh = 720 * scale / 4;
+			const unsigned int ow = 1920 * scale / 4, oh = 1080 * scale / 4;
+
+			CheckedGraph& g = Graph;
+			g.Reset();
+			RenderGraphResource tlas = g.Import("TLAS", 0, RESOURCE_STATE_ACCELERATION_STRUCTURE);
+			RenderGraphResource history = g.Import("History", History, RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			RenderGraphResource backBuffer = g.Import("Back buffer", BackBuffer, RESOURCE_STATE_PRESENT);
+			RenderGraphResource radiance = g.CreateTransient("Radiance", Texture(rw, rh, 10, 8));
+			RenderGraphResource gbuffer = g.CreateTransient("G-buffer", Texture(rw, rh, 2, 16));
+			RenderGraphResource motion = g.CreateTransient("Motion", Texture(rw, rh, 34, 4));
+			RenderGraphResource accumulated = g.CreateTransient("Accumulated", Texture(rw, rh, 10, 8));
+			RenderGraphResource denoised = g.CreateTransient("Denoised", Texture(rw, rh, 10, 8));
+			RenderGraphResource upscaled = g.CreateTransient("Upscaled", Texture(ow, oh, 10, 8));
+			RenderGraphResource ldr = g.CreateTransient("LDR", Texture(ow, oh, 28, 4));
+			RenderGraphResource debug = g.CreateTransient("Debug", Texture(ow, oh, 28, 4));
+
+			unsigned int p = g.AddPass("Build TLAS");
+			g.Write(p, tlas, RESOURCE_STATE_ACCELERATION_STRUCTURE);
+
+			p = g.AddPass("Raytrace");
+			g.Read(p, tlas, RESOURCE_STATE_ACCELERATION_STRUCTURE);
+			g.Write(p, radiance, RESOURCE_STATE_UNORDERED_ACCESS);
+			g.Write(p, gbuffer, RESOURCE_STATE_UNORDERED_ACCESS);
+			g.Write(p, motion, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("Accumulate");
+			g.Read(p, radiance, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Read(p, motion, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Read(p, history, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Write(p, accumulated, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("Denoise");
+			g.Read(p, accumulated, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Read(p, gbuffer, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Write(p, denoised, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("Upscale");
+			g.Read(p, denoised, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Read(p, motion, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Write(p, upscaled, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("Tonemap");
+			g.Read(p, upscaled, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Write(p, ldr, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("Copy to back buffer");
+			g.Read(p, ldr, RESOURCE_STATE_COPY_SOURCE);
+			g.Write(p, backBuffer, RESOURCE_STATE_COPY_DEST);
+
+			p = g.AddPass("Debug view");
+			g.Read(p, gbuffer, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			g.Write(p, debug, RESOURCE_STATE_UNORDERED_ACCESS);
+
+			p = g.AddPass("UI");
+			g.Read(p, backBuffer, RESOURCE_STATE_RENDER_TARGET);
+			g.Write(p, backBuffer, RESOURCE_STATE_RENDER_TARGET);
+		}
+
+		void Run()
+		{
+			Sink.Clear();
+			Graph.Graph.Execute();
+			Tracker.Flush();
+		}
+
+		unsigned int CountAliasingBarriers() const
+		{
+			unsigned int count = 0;
+			for (const std::vector<ResourceBarrier>& batch : Sink.GetBatches())
+			{
+				for (const ResourceBarrier& barrier : batch)
+					count += barrier.Type == RESOURCE_BARRIER_ALIASING ? 1 : 0;
+			}
+			return count;
+		}
+	};
+}
+
+TEST(RenderGraph, FrameRunsInDependencyOrder)
+{
+	Frame frame;
+	frame.Declare(4);
+	REQUIRE(frame.Graph.Graph.Compile());
+	frame.Run();
+
+	const char* expected[] = { "Build TLAS", "Raytrace", "Accumulate", "Denoise", "Upscale", "Tonemap", "Copy to back buffer", "UI" };
+	const std::vector<std::string>& ran = frame.Graph.Ran;
+	REQUIRE(ran.size() == sizeof(expected) / sizeof(expected[0]));
+	for (size_t i = 0; i < ran.size(); i++)
+		CHECK(ran[i] == expected[i]);
+	CHECK(frame.Graph.CountOutOfOrder() == 0);
+	CHECK(frame.Graph.WrongStates == 0);
+
+	// Imports are left in their final states (read states are combined)
+	CHECK(frame.Tracker.GetState(frame.BackBuffer) == RESOURCE_STATE_PRESENT);
+	CHECK(frame.Tracker.GetState(frame.History) ==
+		(RESOURCE_STATE_PIXEL_SHADER_RESOURCE | RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+}
+
+TEST(RenderGraph, CullsWhatNothingUses)
+{
+	Frame frame;
+	frame.Declare(4);
+	REQUIRE(frame.Graph.Graph.Compile());
+
+	RenderGraphStats stats = frame.Graph.Graph.GetStats();
+	CHECK(stats.Passes == 9);
+	CHECK(stats.CulledPasses == 1);
+	CHECK(frame.Graph.Graph.IsCulled(7));
+	CHECK(std::string(frame.Graph.Graph.GetPassName(7)) == "Debug view");
+	CHECK(frame.Graph.CountWronglyCulled() == 0);
+
+	// Debug only has a culled pass using it, so it's never placed
+	CHECK(frame.Graph.GetPlaced(10) == 0);
+	CHECK(stats.TransientResources == 7);
+}
+
+// --------------------------------------------------------
+// Resources from early passes should share memory with
+// later ones, without two live at once ever overlapping.
+// Whatever takes over memory gets an aliasing barrier and
+// its old contents discarded.
+// --------------------------------------------------------
+TEST(RenderGraph, TransientsShareMemoryOnlyWhenNotLive)
+{
+	Frame frame;
+	frame.Declare(4);
+	REQUIRE(frame.Graph.Graph.Compile());
+	frame.Run();
+
+	RenderGraphStats stats = frame.Graph.Graph.GetStats();
+	printf("  %.1f MB without aliasing, %.1f MB in heaps, %u aliased, %u barriers in %u batches\n",
+		stats.UnaliasedBytes / (1024.0 * 1024.0), stats.HeapBytes / (1024.0 * 1024.0), stats.AliasedResources,
+		frame.Sink.GetBarrierCount(), (unsigned int)frame.Sink.GetBatches().size());
+	CHECK(frame.Graph.CountOverlaps() == 0);
+	CHECK(stats.AliasedResources > 0);
+	CHECK(stats.HeapBytes < stats.UnaliasedBytes);
+	CHECK(frame.CountAliasingBarriers() == stats.AliasedResources);
+	CHECK(frame.Graph.Backend.Discards == stats.AliasedResources);
+}
+
+// The same frame again keeps its memory, a resize doesn't
+TEST(RenderGraph, KeepsMemoryWhileTheLayoutHolds)
+{
+	Frame frame;
+	frame.Declare(4);
+	REQUIRE(frame.Graph.Graph.Compile());
+	frame.Run();
+	const void* radiance = frame.Graph.Graph.GetPhysical(3);
+	CHECK(frame.Graph.Graph.GetStats().Reallocations == 1);
+
+	frame.Declare(4);
+	REQUIRE(frame.Graph.Graph.Compile());
+	CHECK(frame.Graph.Graph.GetStats().Reallocations == 1);
+	CHECK(frame.Graph.Graph.GetPhysical(3) == radiance);
+	frame.Run();
+	CHECK(frame.Graph.WrongStates == 0);
+
+	frame.Declare(3);
+	REQUIRE(frame.Graph.Graph.Compile());
+	CHECK(frame.Graph.Graph.GetStats().Reallocations == 2);
+	CHECK(frame.Graph.CountOverlaps() == 0);
+	frame.Run();
+	CHECK(frame.Graph.WrongStates == 0);
+}
+
+TEST(RenderGraph, NothingToDoFailsToCompile)
+{
+	ResourceStateTracker tracker;
+	tracker.Initialize(0);
+	CheckedGraph graph(&tracker);
+
+	RenderGraphResource scratch = graph.CreateTransient("Scratch", Texture(64, 64, 10, 8));
+	unsigned int pass = graph.AddPass("Unused");
+	graph.Write(pass, scratch, RESOURCE_STATE_UNORDERED_ACCESS);
+	CHECK(!graph.Graph.Compile());
+	CHECK(graph.Graph.IsCulled(pass));
+
+	// Unless it has side effects
+	graph.Graph.SetSideEffects(pass);
+	CHECK(graph.Graph.Compile());
+	CHECK(!graph.Graph.IsCulled(pass));
+	CHECK(graph.GetPlaced(scratch) != 0);
+}
+
+// --------------------------------------------------------
+// Bigger random graphs: each pass reads a few recent
+// results and writes one or two new ones, some of them
+// writing the output too
+// --------------------------------------------------------
+TEST(RenderGraph, RandomGraphsStayValid)
+{
+	const unsigned int passCount = 200;
+	const unsigned int transientCount = 300;
+
+	ResourceStateTracker tracker;
+	tracker.Initialize(0);
+	CheckedGraph graph(&tracker);
+	int outputObject = 0;
+	tracker.Register(&outputObject, RESOURCE_STATE_PRESENT);
+
+	unsigned int overlaps = 0, outOfOrder = 0, wronglyCulled = 0, culled = 0;
+	uint64_t heapBytes = 0, unaliasedBytes = 0;
+	for (unsigned int i = 0; i < 20; i++)
+	{
+		unsigned int seed = 12345 + i;
+		auto random = [&seed](unsigned int range)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) % range;
+		};
+
+		graph.Reset();
+		RenderGraphResource output = graph.Import("Output", &outputObject, RESOURCE_STATE_PRESENT);
+		std::vector<RenderGraphResource> transients;
+		for (unsigned int t = 0; t < transientCount; t++)
+		{
+			RenderGraphResourceDesc desc = Texture(256u << random(4), 256u << random(3), 10, 8);
+			if (random(4) == 0)
+			{
+				desc.Type = RENDER_GRAPH_BUFFER;
+				desc.Width = 65536u << random(6);
+			}
+			transients.push_back(graph.CreateTransient("", desc));
+		}
+
+		unsigned int nextTransient = 0;
+		for (unsigned int p = 0; p < passCount; p++)
+		{
+			unsigned int pass = graph.AddPass("");
+			unsigned int reads = nextTransient ? 1 + random(3) : 0;
+			for (unsigned int r = 0; r < reads; r++)
+			{
+				unsigned int back = std::min(nextTransient, 1 + random(12));
+				graph.Read(pass, transients[nextTransient - back], RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			}
+			unsigned int writes = 1 + random(2);
+			for (unsigned int w = 0; w < writes && nextTransient < transientCount; w++)
+				graph.Write(pass, transients[nextTransient++], RESOURCE_STATE_UNORDERED_ACCESS);
+			if (random(10) == 0 || p == passCount - 1)
+				graph.Write(pass, output, RESOURCE_STATE_COPY_DEST);
+		}
+
+		CHECK(graph.Graph.Compile());
+		graph.Graph.Execute();
+		tracker.Flush();
+
+		RenderGraphStats stats = graph.Graph.GetStats();
+		overlaps += graph.CountOverlaps();
+		outOfOrder += graph.CountOutOfOrder();
+		wronglyCulled += graph.CountWronglyCulled();
+		culled += stats.CulledPasses;
+		heapBytes += stats.HeapBytes;
+		unaliasedBytes += stats.UnaliasedBytes;
+	}
+
+	printf("  %u of %u passes culled, %.0f MB in heaps for %.0f MB of transients\n",
+		culled, passCount * 20, heapBytes / (1024.0 * 1024.0), unaliasedBytes / (1024.0 * 1024.0));
+	CHECK(overlaps == 0);
+	CHECK(outOfOrder == 0);
+	CHECK(wronglyCulled == 0);
+	CHECK(graph.WrongStates == 0);
+	CHECK(culled > 0);
+	CHECK(heapBytes < unaliasedBytes);
+	CHECK(tracker.GetState(&outputObject) == RESOURCE_STATE_PRESENT);
+}
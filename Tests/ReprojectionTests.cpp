@@ -0,0 +1,275 @@
+#include "TestHarness.h"
+
+#include "../Camera.h"
+#include "../Reprojection.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	XMFLOAT4X4 Translation(float x, float y, float z)
+	{
+		XMFLOAT4X4 matrix;
+		XMStoreFloat4x4(&matrix, XMMatrixTranslation(x, y, z));
+		return matrix;
+	}
+
+	bool SameMatrix(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+	{
+		return memcmp(&a, &b, sizeof(XMFLOAT4X4)) == 0;
+	}
+
+	// Five units back from the origin, looking down +Z
+	Camera MakeCamera()
+	{
+		return Camera(0.0f, 0.0f, -5.0f, 1.0f, 1.0f, 3.14159265f / 3.0f, 16.0f / 9.0f);
+	}
+
+	ReprojectionSurface MakeSurface(float depth, unsigned int instance)
+	{
+		ReprojectionSurface surface = {};
+		surface.Depth = depth;
+		surface.Normal = XMFLOAT3(0, 0, -1);
+		surface.InstanceID = instance;
+		return surface;
+	}
+
+	float SumWeights(const ReprojectionTaps& taps)
+	{
+		float sum = 0.0f;
+		for (unsigned int i = 0; i < taps.Count; i++)
+			sum += taps.Weights[i];
+		return sum;
+	}
+}
+
+// The point the camera looks at lands in the middle, and points behind it nowhere
+TEST(Reprojection, PointsProjectToScreenUVs)
+{
+	Camera camera = MakeCamera();
+	XMFLOAT4X4 viewProjection = camera.GetViewProjection();
+	XMFLOAT2 uv = XMFLOAT2(-1.0f, -1.0f);
+	REQUIRE(Reprojection::WorldToUV(XMFLOAT3(0, 0, 0), viewProjection, uv));
+	CHECK_NEAR(uv.x, 0.5f, 1e-5f);
+	CHECK_NEAR(uv.y, 0.5f, 1e-5f);
+
+	// Right is +U, up is -V
+	REQUIRE(Reprojection::WorldToUV(XMFLOAT3(1, 1, 0), viewProjection, uv));
+	CHECK(uv.x > 0.5f && uv.y < 0.5f);
+
+	XMFLOAT2 untouched = XMFLOAT2(7.0f, 7.0f);
+	CHECK(!Reprojection::WorldToUV(XMFLOAT3(0, 0, -10), viewProjection, untouched));
+	CHECK(untouched.x == 7.0f && untouched.y == 7.0f);
+}
+
+// --------------------------------------------------------
+// An object that moved right since last frame, under a
+// still camera: its history is to the left, by as far as
+// the point it was at projects from where it is now
+// --------------------------------------------------------
+TEST(Reprojection, MovingObjectsMoveTheirHistory)
+{
+	Camera camera = MakeCamera();
+	XMFLOAT4X4 viewProjection = camera.GetViewProjection();
+	XMFLOAT4X4 world = Translation(1.0f, 0.0f, 0.0f);
+	XMFLOAT4X4 previousWorld = Translation(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 position = XMFLOAT3(1.5f, 0.5f, 0.0f);
+
+	XMFLOAT3 previous = Reprojection::PreviousPosition(position, world, previousWorld);
+	CHECK_NEAR(previous.x, 0.5f, 1e-5f);
+	CHECK_NEAR(previous.y, 0.5f, 1e-5f);
+	CHECK_NEAR(previous.z, 0.0f, 1e-5f);
+
+	XMFLOAT2 motion;
+	REQUIRE(Reprojection::MotionVector(position, world, previousWorld, viewProjection, viewProjection, motion));
+	XMFLOAT2 uv;
+	XMFLOAT2 previousUV;
+	REQUIRE(Reprojection::WorldToUV(position, viewProjection, uv));
+	REQUIRE(Reprojection::WorldToUV(previous, viewProjection, previousUV));
+	CHECK(motion.x < 0.0f);
+	CHECK_NEAR(motion.x, previousUV.x - uv.x, 1e-6f);
+	CHECK_NEAR(motion.y, 0.0f, 1e-6f);
+
+	// Nothing moved, no motion
+	REQUIRE(Reprojection::MotionVector(position, world, world, viewProjection, viewProjection, motion));
+	CHECK_NEAR(motion.x, 0.0f, 1e-6f);
+	CHECK_NEAR(motion.y, 0.0f, 1e-6f);
+}
+
+// A still object under a camera that moved right: the object's history is to its right
+TEST(Reprojection, MovingCamerasMoveTheHistory)
+{
+	Camera camera = MakeCamera();
+	camera.StorePreviousFrame();
+	camera.GetTransform()->MoveAbsolute(1.0f, 0.0f, 0.0f);
+	camera.UpdateViewMatrix();
+
+	XMFLOAT4X4 identity = Translation(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT2 motion;
+	REQUIRE(Reprojection::MotionVector(position, identity, identity, camera.GetViewProjection(), camera.GetPreviousViewProjection(), motion));
+
+	XMFLOAT2 uv;
+	XMFLOAT2 previousUV;
+	REQUIRE(Reprojection::WorldToUV(position, camera.GetViewProjection(), uv));
+	REQUIRE(Reprojection::WorldToUV(position, camera.GetPreviousViewProjection(), previousUV));
+	CHECK(uv.x < 0.5f);
+	CHECK_NEAR(previousUV.x, 0.5f, 1e-5f);
+	CHECK(motion.x > 0.0f);
+	CHECK_NEAR(motion.x, previousUV.x - uv.x, 1e-6f);
+	CHECK_NEAR(motion.y, 0.0f, 1e-6f);
+}
+
+// --------------------------------------------------------
+// History is only reused for the same surface: the same
+// instance, facing about the same way, at about the depth
+// the current surface was from last frame's camera
+// --------------------------------------------------------
+TEST(Reprojection, DifferentSurfacesAreDisoccluded)
+{
+	ReprojectionSurface current = MakeSurface(10.0f, 3);
+	CHECK(!Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(10.0f, 3)));
+	CHECK(!Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(10.5f, 3)));
+
+	// Another instance at the same depth
+	CHECK(Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(10.0f, 4)));
+
+	// Normals 45 degrees apart, then just inside the threshold
+	ReprojectionSurface turned = MakeSurface(10.0f, 3);
+	turned.Normal = XMFLOAT3(0.7071068f, 0.0f, -0.7071068f);
+	CHECK(Reprojection::IsDisoccluded(current, 10.0f, turned));
+	float angle = acosf(REPROJECTION_NORMAL_THRESHOLD) * 0.9f;
+	turned.Normal = XMFLOAT3(sinf(angle), 0.0f, -cosf(angle));
+	CHECK(!Reprojection::IsDisoccluded(current, 10.0f, turned));
+
+	// In front of or behind where the surface was
+	CHECK(Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(8.5f, 3)));
+	CHECK(Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(11.5f, 3)));
+
+	// Misses, and surfaces that were behind last frame's camera
+	CHECK(Reprojection::IsDisoccluded(current, 10.0f, MakeSurface(0.0f, 3)));
+	CHECK(Reprojection::IsDisoccluded(current, REPROJECTION_INVALID_DEPTH, MakeSurface(10.0f, 3)));
+}
+
+// --------------------------------------------------------
+// Bilinear taps weigh 1 in total wherever they land, lose
+// the pixels that are off screen or disoccluded, and give
+// up when nothing's left
+// --------------------------------------------------------
+TEST(Reprojection, HistoryTapsWeighOne)
+{
+	const unsigned int width = 16;
+	const unsigned int height = 8;
+	ReprojectionSurface current = MakeSurface(10.0f, 1);
+	std::vector<ReprojectionSurface> history(width * height, MakeSurface(10.0f, 1));
+	XMFLOAT2 still = XMFLOAT2(0.0f, 0.0f);
+	ReprojectionTaps taps;
+
+	// Between four pixel centers
+	REQUIRE(Reprojection::FindHistoryTaps(XMFLOAT2(0.3f, 0.55f), XMFLOAT2(0.02f, -0.1f), current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 4);
+	CHECK_NEAR(SumWeights(taps), 1.0f, 1e-5f);
+
+	// Right on a pixel center, all its weight
+	REQUIRE(Reprojection::FindHistoryTaps(XMFLOAT2(5.5f / width, 2.5f / height), still, current, 10.0f, history.data(), width, height, taps));
+	float centerWeight = 0.0f;
+	for (unsigned int i = 0; i < taps.Count; i++)
+	{
+		if (taps.Indices[i] == 2 * width + 5)
+			centerWeight = taps.Weights[i];
+	}
+	CHECK_NEAR(centerWeight, 1.0f, 1e-5f);
+
+	// Corners and edges only keep the pixels on screen
+	REQUIRE(Reprojection::FindHistoryTaps(XMFLOAT2(0.0f, 0.0f), still, current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 1 && taps.Indices[0] == 0);
+	CHECK_NEAR(SumWeights(taps), 1.0f, 1e-5f);
+	REQUIRE(Reprojection::FindHistoryTaps(XMFLOAT2(1.0f, 1.0f), still, current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 1 && taps.Indices[0] == width * height - 1);
+	REQUIRE(Reprojection::FindHistoryTaps(XMFLOAT2(0.999f, 0.5f), still, current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 2);
+	CHECK_NEAR(SumWeights(taps), 1.0f, 1e-5f);
+	for (unsigned int i = 0; i < taps.Count; i++)
+		CHECK(taps.Indices[i] % width == width - 1);
+
+	// Off screen entirely
+	CHECK(!Reprojection::FindHistoryTaps(XMFLOAT2(0.5f, 0.5f), XMFLOAT2(-1.0f, 0.0f), current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 0);
+
+	// A disoccluded pixel drops out and the rest still weigh 1
+	XMFLOAT2 between = XMFLOAT2(6.0f / width, 4.0f / height);
+	history[3 * width + 5] = MakeSurface(10.0f, 2);
+	REQUIRE(Reprojection::FindHistoryTaps(between, still, current, 10.0f, history.data(), width, height, taps));
+	CHECK(taps.Count == 3);
+	CHECK_NEAR(SumWeights(taps), 1.0f, 1e-5f);
+	for (unsigned int i = 0; i < taps.Count; i++)
+		CHECK(taps.Indices[i] != 3 * width + 5);
+
+	// And with all four gone, there's no history
+	history[3 * width + 6] = history[4 * width + 5] = history[4 * width + 6] = MakeSurface(10.0f, 2);
+	CHECK(!Reprojection::FindHistoryTaps(between, still, current, 10.0f, history.data(), width, height, taps));
+}
+
+// --------------------------------------------------------
+// Transforms keep last frame's world matrix, and only bump
+// its version when storing actually changes it
+// --------------------------------------------------------
+TEST(Reprojection, TransformsKeepTheirPreviousWorldMatrix)
+{
+	Transform transform;
+	XMFLOAT4X4 identity = Translation(0.0f, 0.0f, 0.0f);
+	CHECK(SameMatrix(transform.GetPreviousWorldMatrix(), identity));
+	unsigned int version = transform.GetPreviousWorldMatrixVersion();
+
+	// Nothing moved
+	transform.StorePreviousWorldMatrix();
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version);
+
+	// Moved, but not stored yet
+	transform.SetPosition(2.0f, 0.0f, 1.0f);
+	XMFLOAT4X4 world = transform.GetWorldMatrix();
+	CHECK(SameMatrix(transform.GetPreviousWorldMatrix(), identity));
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version);
+
+	transform.StorePreviousWorldMatrix();
+	CHECK(SameMatrix(transform.GetPreviousWorldMatrix(), world));
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version + 1);
+
+	// Stored again without moving, and moved back to where it was
+	transform.StorePreviousWorldMatrix();
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version + 1);
+	transform.MoveAbsolute(0.0f, 0.0f, 0.0f);
+	transform.StorePreviousWorldMatrix();
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version + 1);
+	transform.SetRotation(0.0f, 1.0f, 0.0f);
+	transform.StorePreviousWorldMatrix();
+	CHECK(transform.GetPreviousWorldMatrixVersion() == version + 2);
+	CHECK(!SameMatrix(transform.GetPreviousWorldMatrix(), world));
+}
+
+// Cameras start with their own matrix as last frame's, and keep it until told to store
+TEST(Reprojection, CamerasKeepTheirPreviousFrame)
+{
+	Camera camera = MakeCamera();
+	XMFLOAT4X4 first = camera.GetViewProjection();
+	CHECK(SameMatrix(camera.GetPreviousViewProjection(), first));
+	CHECK(camera.GetPreviousPosition().z == -5.0f);
+
+	camera.GetTransform()->MoveAbsolute(0.0f, 1.0f, 0.0f);
+	camera.UpdateViewMatrix();
+	XMFLOAT4X4 second = camera.GetViewProjection();
+	CHECK(!SameMatrix(second, first));
+	CHECK(SameMatrix(camera.GetPreviousViewProjection(), first));
+
+	camera.StorePreviousFrame();
+	CHECK(SameMatrix(camera.GetPreviousViewProjection(), second));
+	CHECK(camera.GetPreviousPosition().y == 1.0f);
+
+	// Updating with no input leaves the view where it was
+	camera.Update(0.1f);
+	CHECK(SameMatrix(camera.GetViewProjection(), second));
+}
@@ -0,0 +1,218 @@
+#include "TestHarness.h"
+
+#include "../ReservoirResampler.h"
+#include "TestLights.h"
+
+#include <chrono>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	// Spatial reuse looks 3 pixels away, a few units on these planes, so
+	// neighbours still sit inside most of the same lights' ranges
+	const unsigned int width = 64;
+	const unsigned int height = 64;
+
+	struct Scene
+	{
+		std::vector<Light> Lights;
+		LightSampler Sampler;
+		std::vector<XMFLOAT3> Positions;
+		std::vector<XMFLOAT3> Normals;
+		std::vector<double> Reference;		// Exact direct light per pixel
+		double ReferenceSquared;
+	};
+
+	void CreateScene(unsigned int lightCount, Scene& scene)
+	{
+		scene.Lights = CreateRandomLights(lightCount, lightCount);
+		scene.Sampler.Build(scene.Lights);
+		CreateGroundPlane(lightCount, width, height, scene.Positions, scene.Normals);
+
+		scene.Reference.assign(width * height, 0.0);
+		scene.ReferenceSquared = 0.0;
+		for (unsigned int p = 0; p < width * height; p++)
+		{
+			for (const Light& light : scene.Lights)
+				scene.Reference[p] += LightSampler::UnshadowedContribution(light, scene.Positions[p], scene.Normals[p]);
+			scene.ReferenceSquared += scene.Reference[p] * scene.Reference[p];
+		}
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct Error
+	{
+		double RelativeMSE;		// Squared error over the squared exact image
+		double RelativeBias;	// Of the image's total
+		double FrameMs;			// Picking every pixel's light (not shading it)
+	};
+
+	Error MeasureReSTIR(const Scene& scene, const ReSTIRSettings& settings, unsigned int frames)
+	{
+		ReservoirResampler resampler;
+		double squaredError = 0.0;
+		double estimated = 0.0;
+		double exact = 0.0;
+		double totalMs = 0.0;
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			auto start = Clock::now();
+			resampler.Resample(scene.Lights, scene.Sampler, scene.Positions, scene.Normals, width, height, settings, f);
+			totalMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			for (unsigned int p = 0; p < width * height; p++)
+			{
+				double estimate = resampler.Shade(scene.Lights, p);
+				squaredError += (estimate - scene.Reference[p]) * (estimate - scene.Reference[p]);
+				estimated += estimate;
+				exact += scene.Reference[p];
+			}
+		}
+		Error error = { squaredError / (scene.ReferenceSquared * frames), (estimated - exact) / exact, totalMs / frames };
+		return error;
+	}
+
+	// One light per pixel straight from the light sampler
+	Error MeasureLightSampler(const Scene& scene, unsigned int frames)
+	{
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+		int strategy = scene.Sampler.GetDefaultStrategy();
+		double squaredError = 0.0;
+		double estimated = 0.0;
+		double exact = 0.0;
+		double totalMs = 0.0;
+		std::vector<LightSample> samples(width * height);
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			auto start = Clock::now();
+			for (unsigned int p = 0; p < width * height; p++)
+				samples[p] = scene.Sampler.Sample(strategy, scene.Positions[p], dist(rng), dist(rng));
+			totalMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			for (unsigned int p = 0; p < width * height; p++)
+			{
+				const LightSample& sample = samples[p];
+				double estimate = 0.0;
+				if (sample.LightIndex >= 0 && sample.Pdf > 0.0f)
+					estimate = LightSampler::UnshadowedContribution(scene.Lights[sample.LightIndex], scene.Positions[p], scene.Normals[p]) / sample.Pdf;
+				squaredError += (estimate - scene.Reference[p]) * (estimate - scene.Reference[p]);
+				estimated += estimate;
+				exact += scene.Reference[p];
+			}
+		}
+		Error error = { squaredError / (scene.ReferenceSquared * frames), (estimated - exact) / exact, totalMs / frames };
+		return error;
+	}
+}
+
+TEST(ReservoirResampler, ReservoirKeepsCandidatesInProportionToWeight)
+{
+	const float weights[] = { 1.0f, 3.0f, 0.0f, 4.0f };
+	const unsigned int trials = 40000;
+	unsigned int kept[4] = {};
+	std::mt19937 rng(9);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	for (unsigned int t = 0; t < trials; t++)
+	{
+		LightReservoir reservoir;
+		ReservoirResampler::ResetReservoir(reservoir, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 1, 0));
+		for (int i = 0; i < 4; i++)
+			ReservoirResampler::UpdateReservoir(reservoir, i, weights[i], weights[i], dist(rng));
+		REQUIRE(reservoir.LightIndex >= 0);
+		kept[reservoir.LightIndex]++;
+
+		// W replaces 1/pdf: the weights' average over the chosen target
+		ReservoirResampler::FinalizeReservoir(reservoir);
+		CHECK(reservoir.M == 4.0f);
+		CHECK_NEAR(reservoir.W, 2.0f / weights[reservoir.LightIndex], 1e-6);
+	}
+
+	for (int i = 0; i < 4; i++)
+		CHECK_NEAR((double)kept[i] / trials, weights[i] / 8.0, 0.01);
+}
+
+TEST(ReservoirResampler, ReusesOnlySimilarSurfaces)
+{
+	LightReservoir center;
+	ReservoirResampler::ResetReservoir(center, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 1, 0));
+	LightReservoir other = center;
+	other.M = 1.0f;
+	other.Position = XMFLOAT3(3, 0.05f, 0);
+	CHECK(ReservoirResampler::CanReuse(center, other));
+
+	// Empty, off the tangent plane, or facing another way
+	LightReservoir empty = other;
+	empty.M = 0.0f;
+	CHECK(!ReservoirResampler::CanReuse(center, empty));
+	LightReservoir step = other;
+	step.Position = XMFLOAT3(3, 0.5f, 0);
+	CHECK(!ReservoirResampler::CanReuse(center, step));
+	LightReservoir wall = other;
+	wall.Normal = XMFLOAT3(1, 0, 0);
+	CHECK(!ReservoirResampler::CanReuse(center, wall));
+}
+
+// Every kind of reuse should stay unbiased: over many frames the image
+// averages out to the exact one
+TEST(ReservoirResampler, StaysUnbiased)
+{
+	Scene scene;
+	CreateScene(1000, scene);
+	int strategy = scene.Sampler.GetDefaultStrategy();
+	ReSTIRSettings variants[] =
+	{
+		{ 32, false, 0, 0.0f, strategy },
+		{ 32, true, 0, 0.0f, strategy },
+		{ 32, false, 5, 3.0f, strategy },
+		{ 32, true, 5, 3.0f, strategy },
+	};
+	for (const ReSTIRSettings& settings : variants)
+	{
+		Error error = MeasureReSTIR(scene, settings, 16);
+		CHECK(fabs(error.RelativeBias) < 0.02);
+	}
+}
+
+TEST(ReservoirResampler, ReuseLowersError)
+{
+	const unsigned int counts[] = { 100, 1000 };
+	for (unsigned int count : counts)
+	{
+		Scene scene;
+		CreateScene(count, scene);
+		int strategy = scene.Sampler.GetDefaultStrategy();
+		ReSTIRSettings ris = { 32, false, 0, 0.0f, strategy };
+		ReSTIRSettings temporal = { 32, true, 0, 0.0f, strategy };
+		ReSTIRSettings spatial = { 32, false, 5, 3.0f, strategy };
+		ReSTIRSettings both = { 32, true, 5, 3.0f, strategy };
+
+		Error plain = MeasureLightSampler(scene, 8);
+		Error risOnly = MeasureReSTIR(scene, ris, 8);
+		Error temporalOnly = MeasureReSTIR(scene, temporal, 8);
+		Error spatialOnly = MeasureReSTIR(scene, spatial, 8);
+		Error bothKinds = MeasureReSTIR(scene, both, 8);
+		double plainError = plain.RelativeMSE;
+		double risError = risOnly.RelativeMSE;
+		double temporalError = temporalOnly.RelativeMSE;
+		double spatialError = spatialOnly.RelativeMSE;
+		double bothError = bothKinds.RelativeMSE;
+		printf("  %u lights: relative MSE %.5f (light sampler), %.5f (RIS), %.5f (temporal), %.5f (spatial), %.5f (both)\n",
+			count, plainError, risError, temporalError, spatialError, bothError);
+
+		// What the lower error costs, per 64x64 frame, and in candidate lights
+		// looked at per second (one per pixel for the light sampler)
+		double pixels = width * height;
+		printf("  %u lights: ms per frame %.3f (light sampler), %.3f (RIS), %.3f (temporal), %.3f (spatial), %.3f (both)\n",
+			count, plain.FrameMs, risOnly.FrameMs, temporalOnly.FrameMs, spatialOnly.FrameMs, bothKinds.FrameMs);
+		printf("  %u lights: million candidates per second %.2f (light sampler), %.2f (RIS)\n",
+			count, pixels / (plain.FrameMs * 1000.0), pixels * ris.InitialCandidates / (risOnly.FrameMs * 1000.0));
+
+		CHECK(risError < plainError);
+		CHECK(temporalError < risError);
+		CHECK(spatialError < risError);
+		CHECK(bothError < temporalError && bothError < spatialError);
+	}
+}
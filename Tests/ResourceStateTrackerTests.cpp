@@ -0,0 +1,328 @@
+#include "TestHarness.h"
+
+#include "../ResourceStateTracker.h"
+#include "RecordingBarrierSink.h"
+
+#include <vector>
+
+namespace
+{
+	typedef std::vector<std::vector<ResourceBarrier>> Batches;
+
+	ResourceBarrier Transition(void* resource, ResourceStates before, ResourceStates after, unsigned int subresource = RESOURCE_ALL_SUBRESOURCES)
+	{
+		return ResourceBarrier{ RESOURCE_BARRIER_TRANSITION, RESOURCE_BARRIER_SPLIT_NONE, resource, subresource, before, after, 0 };
+	}
+
+	ResourceBarrier Split(ResourceBarrierSplit half, void* resource, ResourceStates before, ResourceStates after)
+	{
+		return ResourceBarrier{ RESOURCE_BARRIER_TRANSITION, half, resource, RESOURCE_ALL_SUBRESOURCES, before, after, 0 };
+	}
+
+	ResourceBarrier UAV(void* resource)
+	{
+		return ResourceBarrier{ RESOURCE_BARRIER_UAV, RESOURCE_BARRIER_SPLIT_NONE, resource, 0, 0, 0, 0 };
+	}
+
+	ResourceBarrier Aliasing(void* before, void* after)
+	{
+		return ResourceBarrier{ RESOURCE_BARRIER_ALIASING, RESOURCE_BARRIER_SPLIT_NONE, after, 0, 0, 0, before };
+	}
+
+	bool Matches(const Batches& emitted, const Batches& expected)
+	{
+		if (emitted.size() != expected.size())
+			return false;
+		for (size_t b = 0; b < expected.size(); b++)
+		{
+			if (!(emitted[b] == expected[b]))
+				return false;
+		}
+		return true;
+	}
+
+	// --------------------------------------------------------
+	// Stand-ins for the renderer's resources (only the
+	// addresses matter), registered in the states a frame
+	// starts and ends in
+	// --------------------------------------------------------
+	struct FrameResources
+	{
+		int Objects[7];
+		void* BackBuffer = &Objects[0];
+		void* Output = &Objects[1];
+		void* ShaderTable = &Objects[2];
+		void* Denoiser = &Objects[3];
+		void* Reservoir = &Objects[4];
+		void* TLAS = &Objects[5];
+		void* Texture = &Objects[6];
+
+		RecordingBarrierSink Sink;
+		ResourceStateTracker Tracker;
+
+		FrameResources()
+		{
+			Tracker.Initialize(&Sink);
+			Tracker.Register(BackBuffer, RESOURCE_STATE_PRESENT);
+			Tracker.Register(Output, RESOURCE_STATE_COPY_SOURCE);
+			Tracker.Register(ShaderTable, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			Tracker.Register(Denoiser, RESOURCE_STATE_UNORDERED_ACCESS);
+			Tracker.Register(Texture, RESOURCE_STATE_COPY_DEST, 4);
+		}
+	};
+}
+
+// --------------------------------------------------------
+// Matches Raytrace() and Game::Draw(): the back buffer's
+// transition to copy dest is split across the dispatch,
+// and its trip back to present is merged with the UI's
+// transition to render target.  (Written by hand, the
+// same frame took 9 batches and 10 barriers.)
+// --------------------------------------------------------
+TEST(ResourceStateTracker, CopyToBackBufferFrame)
+{
+	FrameResources r;
+	ResourceStateTracker& tracker = r.Tracker;
+
+	// TLAS build, then Raytrace() starts
+	tracker.UAVBarrier(r.TLAS);
+	tracker.BeginTransition(r.BackBuffer, RESOURCE_STATE_COPY_DEST);
+	tracker.Transition(r.Output, RESOURCE_STATE_UNORDERED_ACCESS);
+	// Shader table upload
+	tracker.Transition(r.ShaderTable, RESOURCE_STATE_COPY_DEST);
+	tracker.Flush();
+	tracker.Transition(r.ShaderTable, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	// Dispatch
+	tracker.Flush();
+	tracker.UAVBarrier(r.Reservoir);
+	tracker.Transition(r.Output, RESOURCE_STATE_COPY_SOURCE);
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST);
+	// Copy to the back buffer
+	tracker.Flush();
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_PRESENT);
+	// UI
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_RENDER_TARGET);
+	tracker.Flush();
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_PRESENT);
+	// Close
+	tracker.Flush();
+
+	CHECK(Matches(r.Sink.GetBatches(), {
+		{ UAV(r.TLAS),
+		  Split(RESOURCE_BARRIER_SPLIT_BEGIN, r.BackBuffer, RESOURCE_STATE_PRESENT, RESOURCE_STATE_COPY_DEST),
+		  Transition(r.Output, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_UNORDERED_ACCESS),
+		  Transition(r.ShaderTable, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, RESOURCE_STATE_COPY_DEST) },
+		{ Transition(r.ShaderTable, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) },
+		{ UAV(r.Reservoir),
+		  Transition(r.Output, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE),
+		  Split(RESOURCE_BARRIER_SPLIT_END, r.BackBuffer, RESOURCE_STATE_PRESENT, RESOURCE_STATE_COPY_DEST) },
+		{ Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_RENDER_TARGET) },
+		{ Transition(r.BackBuffer, RESOURCE_STATE_RENDER_TARGET, RESOURCE_STATE_PRESENT) } }));
+	CHECK(r.Sink.GetBarrierCount() == 10);
+
+	ResourceStateTrackerStats stats = tracker.GetStats();
+	CHECK(stats.Batches == 5);
+	CHECK(stats.SplitBarriers == 1);
+	CHECK(stats.UntrackedUses == 0);
+	CHECK(tracker.GetState(r.BackBuffer) == RESOURCE_STATE_PRESENT);
+	CHECK(tracker.GetState(r.Output) == RESOURCE_STATE_COPY_SOURCE);
+}
+
+// The list is submitted mid-frame, so the back buffer's transition isn't split
+TEST(ResourceStateTracker, DenoisedFrame)
+{
+	FrameResources r;
+	ResourceStateTracker& tracker = r.Tracker;
+
+	tracker.UAVBarrier(r.TLAS);
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST);
+	tracker.Transition(r.Output, RESOURCE_STATE_UNORDERED_ACCESS);
+	tracker.Flush();
+	tracker.UAVBarrier(r.Reservoir);
+	tracker.Transition(r.Output, RESOURCE_STATE_COPY_SOURCE);
+	// Readback of the denoiser buffer
+	tracker.Transition(r.Denoiser, RESOURCE_STATE_COPY_SOURCE);
+	tracker.Flush();
+	tracker.Transition(r.Denoiser, RESOURCE_STATE_UNORDERED_ACCESS);
+	// Submit and wait, then copy the result in
+	tracker.Flush();
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST);
+	tracker.Flush();
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_PRESENT);
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_RENDER_TARGET);
+	tracker.Flush();
+	tracker.Transition(r.BackBuffer, RESOURCE_STATE_PRESENT);
+	tracker.Flush();
+
+	CHECK(Matches(r.Sink.GetBatches(), {
+		{ UAV(r.TLAS),
+		  Transition(r.BackBuffer, RESOURCE_STATE_PRESENT, RESOURCE_STATE_COPY_DEST),
+		  Transition(r.Output, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_UNORDERED_ACCESS) },
+		{ UAV(r.Reservoir),
+		  Transition(r.Output, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE),
+		  Transition(r.Denoiser, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE) },
+		{ Transition(r.Denoiser, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_UNORDERED_ACCESS) },
+		{ Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_RENDER_TARGET) },
+		{ Transition(r.BackBuffer, RESOURCE_STATE_RENDER_TARGET, RESOURCE_STATE_PRESENT) } }));
+	CHECK(tracker.GetStats().SkippedTransitions == 1);
+}
+
+TEST(ResourceStateTracker, RedundantAndCancellingRequestsEmitNothing)
+{
+	FrameResources r;
+	r.Tracker.Transition(r.Output, RESOURCE_STATE_COPY_SOURCE);
+	r.Tracker.Transition(r.BackBuffer, RESOURCE_STATE_COPY_DEST);
+	r.Tracker.Transition(r.BackBuffer, RESOURCE_STATE_PRESENT);
+	r.Tracker.Flush();
+
+	CHECK(r.Sink.GetBatches().empty());
+	CHECK(r.Tracker.GetPendingCount() == 0);
+	CHECK(r.Tracker.GetStats().SkippedTransitions == 1);
+	CHECK(r.Tracker.GetStats().MergedTransitions == 1);
+}
+
+// Per-mip states on a texture, then read states combining
+TEST(ResourceStateTracker, SubresourcesAndReadStates)
+{
+	FrameResources r;
+	ResourceStateTracker& tracker = r.Tracker;
+	tracker.Transition(r.Texture, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+	tracker.Flush();
+	CHECK(tracker.GetState(r.Texture, 1) == RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	CHECK(tracker.GetState(r.Texture, 2) == RESOURCE_STATE_COPY_DEST);
+
+	tracker.Transition(r.Texture, RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	tracker.Flush();
+	tracker.Transition(r.Texture, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	tracker.Transition(r.Texture, RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	tracker.Flush();
+
+	const ResourceStates shaderRead = RESOURCE_STATE_PIXEL_SHADER_RESOURCE | RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+	CHECK(Matches(r.Sink.GetBatches(), {
+		{ Transition(r.Texture, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1) },
+		{ Transition(r.Texture, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 0),
+		  Transition(r.Texture, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 2),
+		  Transition(r.Texture, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 3) },
+		{ Transition(r.Texture, RESOURCE_STATE_PIXEL_SHADER_RESOURCE, shaderRead) } }));
+	CHECK(tracker.GetState(r.Texture, 3) == shaderRead);
+}
+
+// Once single subresources have been transitioned, a later
+// whole-resource transition can't be folded into an earlier one
+TEST(ResourceStateTracker, KeepsOrderAcrossSubresourceTransitions)
+{
+	FrameResources r;
+	ResourceStateTracker& tracker = r.Tracker;
+	tracker.Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS);
+	for (unsigned int i = 0; i < 4; i++)
+		tracker.Transition(r.Texture, RESOURCE_STATE_COPY_SOURCE, i);
+	tracker.Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS);
+	tracker.Flush();
+
+	CHECK(Matches(r.Sink.GetBatches(), {
+		{ Transition(r.Texture, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_UNORDERED_ACCESS),
+		  Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE, 0),
+		  Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE, 1),
+		  Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE, 2),
+		  Transition(r.Texture, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE, 3),
+		  Transition(r.Texture, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_UNORDERED_ACCESS) } }));
+}
+
+TEST(ResourceStateTracker, UAVAndAliasingBarriers)
+{
+	FrameResources r;
+	ResourceStateTracker& tracker = r.Tracker;
+
+	// Next to a transition (or each other) a UAV barrier is redundant
+	tracker.UAVBarrier(r.Denoiser);
+	tracker.UAVBarrier(r.Denoiser);
+	tracker.Transition(r.Denoiser, RESOURCE_STATE_COPY_SOURCE);
+	tracker.AliasingBarrier(r.Reservoir, r.TLAS);
+	tracker.AliasingBarrier(0, r.Output);
+	tracker.Flush();
+
+	CHECK(Matches(r.Sink.GetBatches(), {
+		{ Transition(r.Denoiser, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE),
+		  Aliasing(r.Reservoir, r.TLAS),
+		  Aliasing(0, r.Output) } }));
+}
+
+TEST(ResourceStateTracker, CountsUntrackedUses)
+{
+	FrameResources r;
+	int stranger;
+	r.Tracker.Transition(&stranger, RESOURCE_STATE_COPY_DEST);
+	r.Tracker.BeginTransition(&stranger, RESOURCE_STATE_COPY_DEST);
+	r.Tracker.Flush();
+	CHECK(r.Sink.GetBatches().empty());
+	CHECK(r.Tracker.GetStats().UntrackedUses == 2);
+
+	// Unregistered resources are strangers too
+	r.Tracker.Unregister(r.Output);
+	CHECK(!r.Tracker.IsRegistered(r.Output));
+	r.Tracker.Transition(r.Output, RESOURCE_STATE_COPY_DEST);
+	CHECK(r.Tracker.GetStats().UntrackedUses == 3);
+}
+
+// --------------------------------------------------------
+// Random requests with frequent flushes: replaying the
+// emitted barriers from the registered states must always
+// find each resource in the barrier's before state, and
+// end where the tracker thinks everything is
+// --------------------------------------------------------
+TEST(ResourceStateTracker, BarriersReplayToTrackedStates)
+{
+	const unsigned int resourceCount = 64;
+	const unsigned int subresourceCount = 4;
+	const ResourceStates states[] = {
+		RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE };
+
+	std::vector<int> objects(resourceCount);
+	std::vector<std::vector<ResourceStates>> replayed(resourceCount, std::vector<ResourceStates>(subresourceCount, RESOURCE_STATE_COMMON));
+	RecordingBarrierSink sink;
+	ResourceStateTracker tracker;
+	tracker.Initialize(&sink);
+	for (unsigned int i = 0; i < resourceCount; i++)
+		tracker.Register(&objects[i], RESOURCE_STATE_COMMON, subresourceCount);
+
+	unsigned int wrongBefore = 0;
+	unsigned int seed = 1234;
+	for (unsigned int i = 0; i < 100000; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		unsigned int subresource = (seed >> 4) % 3 == 0 ? (seed >> 12) % subresourceCount : RESOURCE_ALL_SUBRESOURCES;
+		tracker.Transition(&objects[(seed >> 8) % resourceCount], states[(seed >> 24) % 4], subresource);
+		if (i % 8 != 7)
+			continue;
+
+		tracker.Flush();
+		for (const std::vector<ResourceBarrier>& batch : sink.GetBatches())
+		{
+			for (const ResourceBarrier& barrier : batch)
+			{
+				std::vector<ResourceStates>& replay = replayed[(int*)barrier.Resource - objects.data()];
+				for (unsigned int s = 0; s < subresourceCount; s++)
+				{
+					if (barrier.Subresource != RESOURCE_ALL_SUBRESOURCES && barrier.Subresource != s)
+						continue;
+					if (replay[s] != barrier.Before)
+						wrongBefore++;
+					replay[s] = barrier.After;
+				}
+			}
+		}
+		sink.Clear();
+	}
+
+	unsigned int wrongAfter = 0;
+	for (unsigned int i = 0; i < resourceCount; i++)
+	{
+		for (unsigned int s = 0; s < subresourceCount; s++)
+			wrongAfter += tracker.GetState(&objects[i], s) != replayed[i][s] ? 1 : 0;
+	}
+	CHECK(wrongBefore == 0);
+	CHECK(wrongAfter == 0);
+	CHECK(tracker.GetStats().MergedTransitions > 0);
+	CHECK(tracker.GetStats().SkippedTransitions > 0);
+}
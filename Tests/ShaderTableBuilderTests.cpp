@@ -0,0 +1,341 @@
+#include "TestHarness.h"
+
+#include "../ShaderTableBuilder.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	// The renderer's local root signature
+	const ShaderRecordArgument rendererArguments[] = { { SHADER_RECORD_ARGUMENT_CBV, 0 }, { SHADER_RECORD_ARGUMENT_DESCRIPTOR_TABLE, 0 } };
+
+	void SetRendererLayout(ShaderTableBuilder& builder)
+	{
+		for (unsigned int s = 0; s < SHADER_TABLE_SECTION_COUNT; s++)
+			builder.SetLayout((ShaderTableSection)s, rendererArguments, 2);
+	}
+
+	// A record whose identifier is filled with one byte and whose two arguments are given
+	std::vector<unsigned char> MakeRecord(const ShaderTableBuilder& builder, unsigned char id, uint64_t constantBuffer, uint64_t table)
+	{
+		unsigned char identifier[SHADER_TABLE_IDENTIFIER_SIZE];
+		memset(identifier, id, SHADER_TABLE_IDENTIFIER_SIZE);
+		const void* values[] = { &constantBuffer, &table };
+		std::vector<unsigned char> record((size_t)builder.GetStride(SHADER_TABLE_HIT_GROUP));
+		builder.EncodeRecord(SHADER_TABLE_HIT_GROUP, identifier, values, record.data());
+		return record;
+	}
+
+	uint64_t GetUploadSize(const std::vector<ShaderTableRange>& ranges)
+	{
+		uint64_t size = 0;
+		for (const ShaderTableRange& range : ranges)
+			size += range.Size;
+		return size;
+	}
+}
+
+// --------------------------------------------------------
+// Argument offsets, padding and strides for a few root
+// signatures, checked byte by byte in encoded records
+// --------------------------------------------------------
+TEST(ShaderTableBuilder, LaysOutRecordsByTheRules)
+{
+	struct LayoutCase
+	{
+		std::vector<ShaderRecordArgument> Arguments;
+		std::vector<uint64_t> Offsets;
+		uint64_t Stride;
+	};
+	const LayoutCase cases[] = {
+		{ {}, {}, 32 },
+		{ { { SHADER_RECORD_ARGUMENT_CBV, 0 }, { SHADER_RECORD_ARGUMENT_DESCRIPTOR_TABLE, 0 } }, { 32, 40 }, 64 },
+		{ { { SHADER_RECORD_ARGUMENT_CONSTANTS, 3 }, { SHADER_RECORD_ARGUMENT_CBV, 0 } }, { 32, 48 }, 64 },
+		{ { { SHADER_RECORD_ARGUMENT_CONSTANTS, 1 } }, { 32 }, 64 },
+		{ { { SHADER_RECORD_ARGUMENT_DESCRIPTOR_TABLE, 0 }, { SHADER_RECORD_ARGUMENT_CONSTANTS, 5 }, { SHADER_RECORD_ARGUMENT_SRV, 0 } }, { 32, 40, 64 }, 96 },
+	};
+
+	unsigned char identifier[SHADER_TABLE_IDENTIFIER_SIZE];
+	for (unsigned int i = 0; i < SHADER_TABLE_IDENTIFIER_SIZE; i++)
+		identifier[i] = (unsigned char)(0xA0 + i);
+
+	for (const LayoutCase& c : cases)
+	{
+		ShaderTableBuilder builder;
+		builder.Initialize(1);
+		for (unsigned int s = 0; s < SHADER_TABLE_SECTION_COUNT; s++)
+			builder.SetLayout((ShaderTableSection)s, c.Arguments.data(), (unsigned int)c.Arguments.size());
+
+		CHECK(builder.GetStride(SHADER_TABLE_HIT_GROUP) == c.Stride);
+		for (size_t a = 0; a < c.Offsets.size(); a++)
+			CHECK(builder.GetArgumentOffset(SHADER_TABLE_HIT_GROUP, (unsigned int)a) == c.Offsets[a]);
+
+		// Each argument's bytes where they belong, zeros everywhere else
+		std::vector<unsigned char> values(c.Arguments.size() * 64);
+		std::vector<const void*> pointers;
+		for (size_t a = 0; a < c.Arguments.size(); a++)
+		{
+			memset(&values[a * 64], (int)(0x10 + a), 64);
+			pointers.push_back(&values[a * 64]);
+		}
+		std::vector<unsigned char> record((size_t)c.Stride);
+		builder.EncodeRecord(SHADER_TABLE_HIT_GROUP, identifier, pointers.data(), record.data());
+
+		unsigned int wrongBytes = 0;
+		for (uint64_t b = 0; b < c.Stride; b++)
+		{
+			unsigned char expected = b < SHADER_TABLE_IDENTIFIER_SIZE ? identifier[b] : 0;
+			for (size_t a = 0; a < c.Arguments.size(); a++)
+			{
+				uint64_t size = c.Arguments[a].Type == SHADER_RECORD_ARGUMENT_CONSTANTS ? 4ull * c.Arguments[a].Constants : 8;
+				if (b >= c.Offsets[a] && b < c.Offsets[a] + size)
+					expected = (unsigned char)(0x10 + a);
+			}
+			wrongBytes += record[b] == expected ? 0 : 1;
+		}
+		CHECK(wrongBytes == 0);
+
+		// Sections on 64 byte boundaries, records on 32
+		CHECK(builder.AddRecords(SHADER_TABLE_RAY_GEN, record.data(), 1) == 0);
+		builder.AddRecords(SHADER_TABLE_MISS, record.data(), 1);
+		builder.AddRecords(SHADER_TABLE_HIT_GROUP, record.data(), 1);
+		for (unsigned int s = 0; s < SHADER_TABLE_SECTION_COUNT; s++)
+		{
+			CHECK(builder.GetSectionOffset((ShaderTableSection)s) % SHADER_TABLE_SECTION_ALIGNMENT == 0);
+			CHECK(builder.GetStride((ShaderTableSection)s) % SHADER_TABLE_RECORD_ALIGNMENT == 0);
+		}
+		CHECK(builder.GetTableSize() % SHADER_TABLE_SECTION_ALIGNMENT == 0);
+		CHECK(memcmp(builder.GetData() + builder.GetSectionOffset(SHADER_TABLE_HIT_GROUP), record.data(), (size_t)c.Stride) == 0);
+	}
+}
+
+// --------------------------------------------------------
+// A scene's worth of meshes (one ray gen, two miss and
+// three hit groups each) added, duplicated, changed and
+// removed over many frames, with two GPU copies used in
+// turn that must match the table after every upload
+// --------------------------------------------------------
+TEST(ShaderTableBuilder, GPUCopiesAlwaysMatch)
+{
+	const unsigned int hitGroupsPerMesh = 3;
+	const unsigned int frames = 1000;
+	const unsigned int maxMeshes = 400;
+
+	ShaderTableBuilder builder;
+	builder.Initialize(2);
+	SetRendererLayout(builder);
+	uint64_t stride = builder.GetStride(SHADER_TABLE_HIT_GROUP);
+
+	unsigned char identifiers[6][SHADER_TABLE_IDENTIFIER_SIZE];
+	for (unsigned int i = 0; i < 6; i++)
+		memset(identifiers[i], (int)(i + 1), SHADER_TABLE_IDENTIFIER_SIZE);
+
+	std::vector<unsigned char> record((size_t)stride);
+	builder.EncodeRecord(SHADER_TABLE_RAY_GEN, identifiers[0], 0, record.data());
+	builder.AddRecords(SHADER_TABLE_RAY_GEN, record.data(), 1);
+	builder.EncodeRecord(SHADER_TABLE_MISS, identifiers[1], 0, record.data());
+	builder.AddRecords(SHADER_TABLE_MISS, record.data(), 1);
+	builder.EncodeRecord(SHADER_TABLE_MISS, identifiers[2], 0, record.data());
+	builder.AddRecords(SHADER_TABLE_MISS, record.data(), 1);
+
+	struct Mesh
+	{
+		uint64_t ConstantBuffer;
+		uint64_t GeometryTable;
+		unsigned int First;
+	};
+	std::vector<Mesh> meshes;
+	std::vector<unsigned char> runRecords((size_t)(stride * hitGroupsPerMesh));
+	auto encodeMesh = [&](const Mesh& mesh)
+	{
+		for (unsigned int h = 0; h < hitGroupsPerMesh; h++)
+		{
+			const void* values[] = { &mesh.ConstantBuffer, &mesh.GeometryTable };
+			builder.EncodeRecord(SHADER_TABLE_HIT_GROUP, identifiers[3 + h], values, &runRecords[(size_t)(stride * h)]);
+		}
+	};
+
+	std::vector<unsigned char> gpuCopies[2];
+	std::vector<ShaderTableRange> ranges;
+	unsigned int mismatches = 0;
+	unsigned int wrongRecords = 0;
+	uint64_t fullRewriteBytes = 0;
+	unsigned int seed = 4242;
+	auto random = [&seed](unsigned int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		// Meshes keep loading in (some of them instances of the same
+		// geometry), some are unloaded, and now and then one's
+		// constant buffer moves
+		unsigned int adds = f < 20 ? 10 : (random(10) == 0 ? 1 + random(4) : 0);
+		for (unsigned int a = 0; a < adds && meshes.size() < maxMeshes; a++)
+		{
+			Mesh mesh = {};
+			if (!meshes.empty() && random(4) == 0)
+				mesh = meshes[random((unsigned int)meshes.size())];
+			else
+			{
+				mesh.ConstantBuffer = 0x100000000ull + 256ull * random(100000);
+				mesh.GeometryTable = 0x200000000ull + 32ull * random(100000);
+			}
+			encodeMesh(mesh);
+			mesh.First = builder.AddRecords(SHADER_TABLE_HIT_GROUP, runRecords.data(), hitGroupsPerMesh);
+			meshes.push_back(mesh);
+		}
+		if (!meshes.empty() && random(20) == 0)
+		{
+			unsigned int m = random((unsigned int)meshes.size());
+			builder.ReleaseRecords(SHADER_TABLE_HIT_GROUP, meshes[m].First);
+			meshes[m] = meshes.back();
+			meshes.pop_back();
+		}
+		for (Mesh& mesh : meshes)
+		{
+			if (random(200) == 0)
+				mesh.ConstantBuffer = 0x100000000ull + 256ull * random(100000);
+			encodeMesh(mesh);
+			mesh.First = builder.UpdateRecords(SHADER_TABLE_HIT_GROUP, mesh.First, runRecords.data());
+		}
+
+		// This frame's GPU copy catches up (recreated if the table outgrew it)
+		std::vector<unsigned char>& gpu = gpuCopies[f % 2];
+		if (gpu.size() < builder.GetTableSize())
+			gpu.assign((size_t)builder.GetTableSize(), 0xCD);
+		builder.CollectUploads(f % 2, ranges);
+		for (const ShaderTableRange& range : ranges)
+			memcpy(&gpu[(size_t)range.Offset], builder.GetData() + range.Offset, (size_t)range.Size);
+		if (memcmp(gpu.data(), builder.GetData(), (size_t)builder.GetTableSize()) != 0)
+			mismatches++;
+
+		// Every mesh's records must still hold its own arguments
+		for (const Mesh& mesh : meshes)
+		{
+			encodeMesh(mesh);
+			const unsigned char* live = builder.GetData() + builder.GetSectionOffset(SHADER_TABLE_HIT_GROUP) + stride * mesh.First;
+			if (memcmp(live, runRecords.data(), runRecords.size()) != 0)
+				wrongRecords++;
+		}
+
+		// Rewriting every record in use, every frame
+		fullRewriteBytes += stride * (3 + hitGroupsPerMesh * (uint64_t)meshes.size());
+	}
+
+	ShaderTableBuilderStats stats = builder.GetStats();
+	printf("  %u records in a %u KB table, %u written, %u shared, %u relayouts, %.1f KB uploaded (%.1f KB rewriting every frame)\n",
+		stats.Records, (unsigned int)(stats.TableSize / 1024), stats.RecordsWritten, stats.RecordsShared, stats.Relayouts,
+		stats.BytesUploaded / 1024.0, fullRewriteBytes / 1024.0);
+	CHECK(mismatches == 0);
+	CHECK(wrongRecords == 0);
+	CHECK(stats.RecordsShared > 0);
+	CHECK(stats.Relayouts > 1);
+	CHECK(stats.BytesUploaded * 10 < fullRewriteBytes);
+}
+
+TEST(ShaderTableBuilder, SharesIdenticalRuns)
+{
+	ShaderTableBuilder builder;
+	builder.Initialize(1);
+	SetRendererLayout(builder);
+
+	std::vector<unsigned char> a = MakeRecord(builder, 1, 0x1000, 0x2000);
+	std::vector<unsigned char> b = MakeRecord(builder, 1, 0x1100, 0x2000);
+	unsigned int first = builder.AddRecords(SHADER_TABLE_HIT_GROUP, a.data(), 1);
+	CHECK(builder.AddRecords(SHADER_TABLE_HIT_GROUP, a.data(), 1) == first);
+	CHECK(builder.AddRecords(SHADER_TABLE_HIT_GROUP, b.data(), 1) != first);
+	CHECK(builder.GetStats().RecordsShared == 1);
+	CHECK(builder.GetStats().Records == 2);
+
+	// Still live until both references are gone
+	builder.ReleaseRecords(SHADER_TABLE_HIT_GROUP, first);
+	CHECK(builder.GetStats().Records == 2);
+	builder.ReleaseRecords(SHADER_TABLE_HIT_GROUP, first);
+	CHECK(builder.GetStats().Records == 1);
+
+	// The released record is reused
+	std::vector<unsigned char> c = MakeRecord(builder, 2, 0x1000, 0x2000);
+	CHECK(builder.AddRecords(SHADER_TABLE_HIT_GROUP, c.data(), 1) == first);
+}
+
+// Changing a shared run leaves everyone else with the old contents
+TEST(ShaderTableBuilder, SplitsSharedRunsOnUpdate)
+{
+	ShaderTableBuilder builder;
+	builder.Initialize(1);
+	SetRendererLayout(builder);
+
+	std::vector<unsigned char> a = MakeRecord(builder, 1, 0x1000, 0x2000);
+	std::vector<unsigned char> b = MakeRecord(builder, 1, 0x1100, 0x2000);
+	unsigned int first = builder.AddRecords(SHADER_TABLE_HIT_GROUP, a.data(), 1);
+	builder.AddRecords(SHADER_TABLE_HIT_GROUP, a.data(), 1);
+
+	CHECK(builder.UpdateRecords(SHADER_TABLE_HIT_GROUP, first, a.data()) == first);
+	unsigned int moved = builder.UpdateRecords(SHADER_TABLE_HIT_GROUP, first, b.data());
+	REQUIRE(moved != first);
+
+	const unsigned char* records = builder.GetData() + builder.GetSectionOffset(SHADER_TABLE_HIT_GROUP);
+	uint64_t stride = builder.GetStride(SHADER_TABLE_HIT_GROUP);
+	CHECK(memcmp(records + stride * first, a.data(), a.size()) == 0);
+	CHECK(memcmp(records + stride * moved, b.data(), b.size()) == 0);
+}
+
+// --------------------------------------------------------
+// Once a copy is synced, only changed records go up, with
+// neighbors coalesced.  Growing a section moves everything,
+// so every copy gets the whole table again.
+// --------------------------------------------------------
+TEST(ShaderTableBuilder, UploadsOnlyWhatChanged)
+{
+	ShaderTableBuilder builder;
+	builder.Initialize(2);
+	SetRendererLayout(builder);
+	uint64_t stride = builder.GetStride(SHADER_TABLE_HIT_GROUP);
+
+	std::vector<unsigned char> records;
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		std::vector<unsigned char> record = MakeRecord(builder, 1, 0x1000 + 256 * i, 0x2000);
+		records.insert(records.end(), record.begin(), record.end());
+	}
+	unsigned int first = builder.AddRecords(SHADER_TABLE_HIT_GROUP, records.data(), 4);
+
+	std::vector<ShaderTableRange> ranges;
+	builder.CollectUploads(0, ranges);
+	REQUIRE(ranges.size() == 1);
+	CHECK(ranges[0].Offset == 0 && ranges[0].Size == builder.GetTableSize());
+	builder.CollectUploads(0, ranges);
+	CHECK(ranges.empty());
+
+	// Records 1 and 2 change
+	std::vector<unsigned char> changed = records;
+	changed[(size_t)(stride + 32)] ^= 0xFF;
+	changed[(size_t)(stride * 2 + 40)] ^= 0xFF;
+	CHECK(builder.UpdateRecords(SHADER_TABLE_HIT_GROUP, first, changed.data()) == first);
+	CHECK(builder.GetStats().RecordsUnchanged == 2);
+
+	builder.CollectUploads(0, ranges);
+	REQUIRE(ranges.size() == 1);
+	CHECK(ranges[0].Offset == builder.GetSectionOffset(SHADER_TABLE_HIT_GROUP) + stride * (first + 1));
+	CHECK(ranges[0].Size == stride * 2);
+
+	// The other copy never synced
+	builder.CollectUploads(1, ranges);
+	CHECK(GetUploadSize(ranges) == builder.GetTableSize());
+
+	// Past the section's first 16 records it grows and everything moves
+	unsigned int relayouts = builder.GetStats().Relayouts;
+	for (unsigned int i = 0; i < 16; i++)
+	{
+		std::vector<unsigned char> record = MakeRecord(builder, 2, 0x1000 + 256 * i, 0x3000);
+		builder.AddRecords(SHADER_TABLE_HIT_GROUP, record.data(), 1);
+	}
+	CHECK(builder.GetStats().Relayouts == relayouts + 1);
+	builder.CollectUploads(0, ranges);
+	CHECK(GetUploadSize(ranges) == builder.GetTableSize());
+	CHECK(memcmp(builder.GetData() + builder.GetSectionOffset(SHADER_TABLE_HIT_GROUP) + stride * first, changed.data(), changed.size()) == 0);
+}
@@ -0,0 +1,66 @@
+#include "SimulatedTimeline.h"
+
+#include <algorithm>
+
+// --------------------------------------------------------
+// Starts with both clocks at zero and nothing submitted
+// --------------------------------------------------------
+SimulatedTimeline::SimulatedTimeline() :
+	cpuTime(0.0),
+	gpuFinishTime(0.0),
+	gpuBusyTime(0.0),
+	cpuWaitTime(0.0)
+{
+}
+
+// --------------------------------------------------------
+// Moves the CPU clock forward
+// --------------------------------------------------------
+void SimulatedTimeline::AdvanceCPU(double ms)
+{
+	cpuTime += ms;
+}
+
+// --------------------------------------------------------
+// Work starts once the GPU is done with everything before
+// it, but no earlier than the CPU submits it
+// --------------------------------------------------------
+void SimulatedTimeline::Submit(double gpuMs)
+{
+	gpuFinishTime = std::max(gpuFinishTime, cpuTime) + gpuMs;
+	gpuBusyTime += gpuMs;
+}
+
+// --------------------------------------------------------
+// The signal is reached as soon as the work before it is
+// --------------------------------------------------------
+uint64_t SimulatedTimeline::Signal()
+{
+	signalTimes.push_back(std::max(gpuFinishTime, cpuTime));
+	return signalTimes.size();
+}
+
+// --------------------------------------------------------
+// Every signal at or before the CPU's current time
+// --------------------------------------------------------
+uint64_t SimulatedTimeline::GetCompletedValue()
+{
+	// Signal times never decrease, so count the ones that have passed
+	return std::upper_bound(signalTimes.begin(), signalTimes.end(), cpuTime) - signalTimes.begin();
+}
+
+// --------------------------------------------------------
+// Jumps the CPU ahead to when the value is reached
+// --------------------------------------------------------
+void SimulatedTimeline::WaitForValue(uint64_t value)
+{
+	if (value == 0 || value > signalTimes.size())
+		return;
+
+	double reached = signalTimes[value - 1];
+	if (reached > cpuTime)
+	{
+		cpuWaitTime += reached - cpuTime;
+		cpuTime = reached;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../FrameScheduler.h"
+
+#include <vector>
+
+// --------------------------------------------------------
+// A GPU timeline on a simulated clock, so scheduling can be
+// checked without a device.  The CPU spends time through
+// AdvanceCPU(), submitted work runs back to back on the GPU
+// (but never before it was submitted) and waiting jumps the
+// CPU clock ahead to when the value is reached.
+// --------------------------------------------------------
+class SimulatedTimeline : public GPUTimeline
+{
+public:
+	SimulatedTimeline();
+
+	// CPU work (recording commands, game logic, etc.)
+	void AdvanceCPU(double ms);
+
+	// Queues GPU work that takes this long to execute
+	void Submit(double gpuMs);
+
+	uint64_t Signal() override;
+	uint64_t GetCompletedValue() override;
+	void WaitForValue(uint64_t value) override;
+
+	double GetCPUTime() const { return cpuTime; }
+	double GetGPUBusyTime() const { return gpuBusyTime; }
+	double GetCPUWaitTime() const { return cpuWaitTime; }
+
+private:
+	double cpuTime;
+	double gpuFinishTime;		// When the last submitted work ends
+	double gpuBusyTime;
+	double cpuWaitTime;
+	std::vector<double> signalTimes;	// When each value is reached (value - 1)
+};
@@ -0,0 +1,273 @@
+#include "TestHarness.h"
+
+#include "../StagingRing.h"
+#include "SimulatedTimeline.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	// --------------------------------------------------------
+	// StagingMemory in ordinary heap memory.  Released slots
+	// are reused so ids stay small.
+	// --------------------------------------------------------
+	class TestStagingMemory : public StagingMemory
+	{
+	public:
+		void* CreateBuffer(uint64_t size, unsigned int& buffer) override
+		{
+			buffer = 0;
+			while (buffer < buffers.size() && buffers[buffer])
+				buffer++;
+			if (buffer == buffers.size())
+				buffers.emplace_back();
+
+			buffers[buffer].reset(new unsigned char[(size_t)size]);
+			return buffers[buffer].get();
+		}
+
+		void ReleaseBuffer(unsigned int buffer) override
+		{
+			if (buffer < buffers.size())
+				buffers[buffer].reset();
+		}
+
+		unsigned int GetLiveBufferCount() const
+		{
+			unsigned int count = 0;
+			for (const std::unique_ptr<unsigned char[]>& buffer : buffers)
+				count += buffer ? 1 : 0;
+			return count;
+		}
+
+	private:
+		std::vector<std::unique_ptr<unsigned char[]>> buffers;
+	};
+
+	struct InFlight
+	{
+		StagingAllocation Allocation;
+		unsigned char Pattern;
+		uint64_t FenceValue;	// 0 until its submission ends
+	};
+}
+
+// --------------------------------------------------------
+// Each allocation is checked against everything still in
+// flight, then filled with a byte pattern that's checked
+// again when its submission completes on the simulated GPU
+// (the last moment the GPU could read it).
+// Loading-style frames (lots of uploads, some bigger than
+// the ring's threshold) are mixed with steady per-frame
+// uploads like instance data.
+// --------------------------------------------------------
+TEST(StagingRing, NeverOverwritesUploadsInFlight)
+{
+	const uint64_t capacity = 4 * 1024 * 1024;
+	const uint64_t dedicatedThreshold = 1024 * 1024;
+	const unsigned int frames = 600;
+	const uint64_t alignments[] = { 16, 256, 512 };
+
+	SimulatedTimeline timeline;
+	FrameScheduler scheduler;
+	scheduler.Initialize(&timeline, 3);
+
+	TestStagingMemory memory;
+	StagingRing staging;
+	staging.Initialize(&timeline, &memory, capacity, dedicatedThreshold);
+
+	std::vector<InFlight> inFlight;
+	unsigned int corrupted = 0;
+	unsigned int overlaps = 0;
+	unsigned int misaligned = 0;
+	unsigned int failed = 0;
+	unsigned int overflows = 0;
+	unsigned int seed = 31337;
+
+	// "GPU reads" everything whose submission has completed
+	auto checkCompleted = [&]()
+	{
+		uint64_t completed = timeline.GetCompletedValue();
+		for (size_t i = 0; i < inFlight.size();)
+		{
+			const InFlight& f = inFlight[i];
+			if (f.FenceValue == 0 || f.FenceValue > completed)
+			{
+				i++;
+				continue;
+			}
+
+			const unsigned char* bytes = (const unsigned char*)f.Allocation.CPUAddress;
+			for (uint64_t b = 0; b < f.Allocation.Size; b++)
+			{
+				if (bytes[b] != f.Pattern)
+				{
+					corrupted++;
+					break;
+				}
+			}
+			inFlight[i] = inFlight.back();
+			inFlight.pop_back();
+		}
+	};
+
+	auto endSubmission = [&](uint64_t fenceValue)
+	{
+		staging.EndSubmission(fenceValue);
+		for (InFlight& f : inFlight)
+		{
+			if (f.FenceValue == 0)
+				f.FenceValue = fenceValue;
+		}
+	};
+
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		// Every so often a burst of loading, otherwise just per-frame data
+		bool loading = f % 100 < 5;
+		seed = seed * 1664525u + 1013904223u;
+		unsigned int uploads = loading ? 200 + (seed >> 8) % 200 : 4 + (seed >> 8) % 8;
+
+		for (unsigned int u = 0; u < uploads; u++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			uint64_t size = loading && (seed >> 4) % 50 == 0 ?
+				dedicatedThreshold + (seed >> 8) % (2 * dedicatedThreshold) :	// Big texture
+				256 + (seed >> 8) % (64 * 1024);								// Buffers, instance data
+			uint64_t alignment = alignments[(seed >> 20) % 3];
+
+			// Dedicated buffers are released as soon as they're done,
+			// so they're read before each Allocate()
+			checkCompleted();
+			StagingAllocation allocation = staging.Allocate(size, alignment);
+			if (allocation.Buffer != staging.GetRingBuffer() && size <= dedicatedThreshold)
+				overflows++;
+			if (!allocation.IsValid())
+			{
+				failed++;
+				continue;
+			}
+			if (allocation.Offset % alignment != 0 ||
+				(allocation.Buffer == staging.GetRingBuffer() && allocation.Offset + allocation.Size > capacity))
+				misaligned++;
+
+			// Allocating may have waited on the GPU for ring space, so catch
+			// up on what it finished, then nothing still in flight may overlap
+			checkCompleted();
+			for (const InFlight& other : inFlight)
+			{
+				if (other.Allocation.Buffer == allocation.Buffer &&
+					allocation.Offset < other.Allocation.Offset + other.Allocation.Size &&
+					other.Allocation.Offset < allocation.Offset + allocation.Size)
+					overlaps++;
+			}
+
+			unsigned char pattern = (unsigned char)(seed >> 24);
+			memset(allocation.CPUAddress, pattern, (size_t)size);
+			inFlight.push_back({ allocation, pattern, 0 });
+		}
+
+		timeline.AdvanceCPU(4.0);
+		timeline.Submit(8.0);
+		scheduler.EndFrame();
+		endSubmission(scheduler.GetLastFrameFenceValue());
+	}
+	scheduler.WaitForIdle();
+	checkCompleted();
+	staging.Retire();
+
+	StagingRingStats stats = staging.GetStats();
+	CHECK(inFlight.empty());
+	CHECK(overlaps == 0);
+	CHECK(corrupted == 0);
+	CHECK(misaligned == 0);
+	CHECK(failed == 0);
+
+	// Loading bursts are bigger than the ring, so they must have overflowed
+	CHECK(overflows > 0);
+	CHECK(stats.FullSubmissions > 0 && stats.FullSubmissions <= overflows);
+	CHECK(stats.DedicatedAllocations > 0);
+	CHECK(stats.DedicatedBuffersLive == 0);
+	CHECK(stats.HighWaterMark <= capacity);
+	CHECK(stats.Used == 0);
+	CHECK(memory.GetLiveBufferCount() == 1);
+}
+
+TEST(StagingRing, BigUploadsGetTheirOwnBuffer)
+{
+	SimulatedTimeline timeline;
+	TestStagingMemory memory;
+	StagingRing staging;
+	staging.Initialize(&timeline, &memory, 1024, 256);
+
+	StagingAllocation small = staging.Allocate(256, 4);
+	StagingAllocation big = staging.Allocate(257, 4);
+	REQUIRE(small.IsValid() && big.IsValid());
+	CHECK(small.Buffer == staging.GetRingBuffer());
+	CHECK(big.Buffer != staging.GetRingBuffer());
+	CHECK(big.Offset == 0 && big.Size == 257);
+	CHECK(staging.GetStats().DedicatedBuffersLive == 1);
+
+	// Released once the submission using it completes
+	timeline.Submit(1.0);
+	uint64_t fence = timeline.Signal();
+	staging.EndSubmission(fence);
+	staging.Retire();
+	CHECK(staging.GetStats().DedicatedBuffersLive == 1);
+	timeline.WaitForValue(fence);
+	staging.Retire();
+	CHECK(staging.GetStats().DedicatedBuffersLive == 0);
+	CHECK(memory.GetLiveBufferCount() == 1);
+}
+
+// A submission that fills the ring carries on in buffers of its own, so
+// nothing has to submit mid-recording, and the ring is back once it ends
+TEST(StagingRing, FullSubmissionOverflowsUntilSubmitted)
+{
+	SimulatedTimeline timeline;
+	TestStagingMemory memory;
+	StagingRing staging;
+	staging.Initialize(&timeline, &memory, 1024, 1024);
+
+	CHECK(staging.Allocate(1000, 4).IsValid());
+	CHECK(!staging.IsOverflowing());
+	StagingAllocation overflow = staging.Allocate(100, 4);
+	REQUIRE(overflow.IsValid());
+	CHECK(overflow.Buffer != staging.GetRingBuffer());
+	CHECK(staging.IsOverflowing());
+	CHECK(staging.GetStats().FullSubmissions == 1);
+
+	// Even what would fit stays out of the ring until the submission ends
+	StagingAllocation small = staging.Allocate(4, 4);
+	CHECK(small.IsValid() && small.Buffer != staging.GetRingBuffer());
+	CHECK(staging.GetStats().FullSubmissions == 1);
+	CHECK(staging.GetStats().DedicatedBuffersLive == 2);
+
+	timeline.Submit(1.0);
+	uint64_t fence = timeline.Signal();
+	staging.EndSubmission(fence);
+	CHECK(!staging.IsOverflowing());
+	StagingAllocation next = staging.Allocate(100, 4);
+	CHECK(next.IsValid());
+	CHECK(next.Buffer == staging.GetRingBuffer() && next.Offset == 0);
+	CHECK(staging.GetStats().Stalls == 1);
+
+	staging.Retire();
+	CHECK(staging.GetStats().DedicatedBuffersLive == 0);
+	CHECK(memory.GetLiveBufferCount() == 1);
+}
+
+TEST(StagingRing, AlignsToAnyMultiple)
+{
+	SimulatedTimeline timeline;
+	TestStagingMemory memory;
+	StagingRing staging;
+	staging.Initialize(&timeline, &memory, 1024, 1024);
+
+	CHECK(staging.Allocate(10, 4).Offset == 0);
+	CHECK(staging.Allocate(10, 48).Offset == 48);
+	CHECK(staging.Allocate(10, 3).Offset == 60);
+	CHECK(staging.GetStats().BytesStaged == 30);
+}
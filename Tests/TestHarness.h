@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+// --------------------------------------------------------
+// Just enough of a test framework for the headless tests.
+// TEST(Suite, Name) registers a test, CHECK records a
+// failure and carries on, REQUIRE records one and leaves
+// the test.  TestMain.cpp runs one suite (or all of them)
+// and exits non-zero if anything failed.
+// --------------------------------------------------------
+typedef void (*TestFunction)();
+
+struct TestRegistrar
+{
+	TestRegistrar(const char* suite, const char* name, TestFunction function);
+};
+
+// Counts a failure against the running test and prints where it was
+void ReportTestFailure(const char* file, int line, const char* expression);
+
+// Directory holding the repo's Assets folder (with a trailing slash)
+const wchar_t* GetTestAssetDirectory();
+
+// A scratch directory for files the tests write (with a trailing slash)
+const wchar_t* GetTestOutputDirectory();
+
+#define TEST(suite, name) \
+	static void suite##_##name(); \
+	static TestRegistrar suite##_##name##_registrar(#suite, #name, suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) ReportTestFailure(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) \
+	do { if (!(fabs((double)(actual) - (double)(expected)) <= (double)(tolerance))) ReportTestFailure(__FILE__, __LINE__, #actual " is near " #expected); } while (0)
+
+#define REQUIRE(condition) \
+	do { if (!(condition)) { ReportTestFailure(__FILE__, __LINE__, #condition); return; } } while (0)
@@ -0,0 +1,15 @@
+#include "../Input.h"
+
+// --------------------------------------------------------
+// Input without a window, for the classes under test that
+// read it (Camera::Update): nothing is ever pressed and the
+// mouse never moves
+// --------------------------------------------------------
+Input* Input::instance;
+
+Input::~Input() { }
+
+int Input::GetMouseXDelta() { return 0; }
+int Input::GetMouseYDelta() { return 0; }
+bool Input::KeyDown(int) { return false; }
+bool Input::MouseLeftDown() { return false; }
@@ -0,0 +1,58 @@
+#include "TestLights.h"
+
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+float GetRandomLightSpread(unsigned int count)
+{
+	return 10.0f * cbrtf(count / 17.0f);
+}
+
+std::vector<Light> CreateRandomLights(unsigned int count, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	std::vector<Light> lights;
+	lights.reserve(count);
+	float spread = GetRandomLightSpread(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		Light light = {};
+		light.Type = i < 3 ? LIGHT_TYPE_DIRECTIONAL : LIGHT_TYPE_POINT;
+		light.Direction = XMFLOAT3(dist(rng) * 2 - 1, -1, dist(rng) * 2 - 1);
+		light.Position = XMFLOAT3((dist(rng) * 2 - 1) * spread, (dist(rng) * 2 - 1) * spread * 0.5f, (dist(rng) * 2 - 1) * spread);
+		light.Color = XMFLOAT3(dist(rng), dist(rng), dist(rng));
+		light.Range = 5.0f + dist(rng) * 5.0f;
+		light.Intensity = i < 3 ? 0.2f : 0.1f + dist(rng) * 2.9f;
+		lights.push_back(light);
+	}
+	return lights;
+}
+
+void CreateGroundPlane(
+	unsigned int count,
+	unsigned int width,
+	unsigned int height,
+	std::vector<XMFLOAT3>& positions,
+	std::vector<XMFLOAT3>& normals)
+{
+	float spread = GetRandomLightSpread(count);
+	positions.resize(width * height);
+	normals.resize(width * height);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			float px = ((x + 0.5f) / width * 2 - 1) * spread;
+			float pz = ((y + 0.5f) / height * 2 - 1) * spread;
+			float dydx = 0.1f * cosf(px * 0.5f) * 0.5f;
+			float dydz = -0.1f * sinf(pz * 0.5f) * 0.5f;
+			float length = sqrtf(dydx * dydx + 1 + dydz * dydz);
+			positions[y * width + x] = XMFLOAT3(px, 0.1f * sinf(px * 0.5f) + 0.1f * cosf(pz * 0.5f), pz);
+			normals[y * width + x] = XMFLOAT3(-dydx / length, 1 / length, -dydz / length);
+		}
+	}
+}
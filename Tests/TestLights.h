@@ -0,0 +1,23 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "../Lights.h"
+
+// Random lights in the same mix as Game::CreateLights (3 directional, the
+// rest point lights), spread over a volume that grows with the count so
+// the density stays roughly that of the demo scene
+std::vector<Light> CreateRandomLights(unsigned int count, unsigned int seed);
+
+// Half the width of the volume CreateRandomLights spreads lights over
+float GetRandomLightSpread(unsigned int count);
+
+// A gently rolling ground plane under those lights, one shading point
+// per pixel of a width * height grid
+void CreateGroundPlane(
+	unsigned int count,
+	unsigned int width,
+	unsigned int height,
+	std::vector<DirectX::XMFLOAT3>& positions,
+	std::vector<DirectX::XMFLOAT3>& normals);
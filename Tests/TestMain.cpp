@@ -0,0 +1,86 @@
+#include "TestHarness.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct TestCase
+{
+	const char* Suite;
+	const char* Name;
+	TestFunction Function;
+};
+
+// Function local so registration works whatever order files initialize in
+static std::vector<TestCase>& GetTests()
+{
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+static unsigned int currentFailures = 0;
+
+TestRegistrar::TestRegistrar(const char* suite, const char* name, TestFunction function)
+{
+	GetTests().push_back({ suite, name, function });
+}
+
+void ReportTestFailure(const char* file, int line, const char* expression)
+{
+	printf("  %s(%d): failed: %s\n", file, line, expression);
+	currentFailures++;
+}
+
+static std::wstring Widen(const char* path)
+{
+	return std::wstring(path, path + strlen(path));
+}
+
+const wchar_t* GetTestAssetDirectory()
+{
+	static std::wstring directory = Widen(RENDERER_TEST_ASSET_DIRECTORY);
+	return directory.c_str();
+}
+
+const wchar_t* GetTestOutputDirectory()
+{
+	static std::wstring directory = Widen(RENDERER_TEST_OUTPUT_DIRECTORY);
+	return directory.c_str();
+}
+
+
+// --------------------------------------------------------
+// Runs every test, or only those of the suites named on
+// the command line, and returns the number that failed
+// (so any failure makes the exit code non-zero)
+// --------------------------------------------------------
+int main(int argc, char** argv)
+{
+	unsigned int run = 0;
+	unsigned int failed = 0;
+	for (const TestCase& test : GetTests())
+	{
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++)
+			selected |= strcmp(argv[i], test.Suite) == 0;
+		if (!selected)
+			continue;
+
+		printf("[ RUN    ] %s.%s\n", test.Suite, test.Name);
+		fflush(stdout);
+		currentFailures = 0;
+		test.Function();
+		printf("[ %s ] %s.%s\n", currentFailures ? "FAILED" : "    OK", test.Suite, test.Name);
+		run++;
+		if (currentFailures)
+			failed++;
+	}
+
+	if (run == 0)
+	{
+		printf("No tests matched\n");
+		return 1;
+	}
+	printf("%u of %u tests passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#include "TestTextures.h"
+#include "TestHarness.h"
+
+#include "../FileStreams.h"
+
+#include <random>
+#include <vector>
+
+const wchar_t* const TestTextureSets[4] = { L"bronze", L"cobblestone", L"paint", L"scratched" };
+const wchar_t* const TestTextureMaps[4] = { L"albedo", L"metal", L"normals", L"roughness" };
+
+std::wstring GetTestTexturePath(const wchar_t* set, const wchar_t* map)
+{
+	return std::wstring(GetTestAssetDirectory()) + L"Textures/" + set + L"_" + map + L".png";
+}
+
+bool LoadTestTexture(const std::wstring& path, DecodedImage& image)
+{
+	std::vector<unsigned char> png;
+	return ReadWholeFile(path, png) && PNGDecoder::Decode(png.data(), png.size(), image);
+}
+
+DecodedImage CreateRandomImage(unsigned int width, unsigned int height, unsigned int channels, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	DecodedImage image = {};
+	image.Width = width;
+	image.Height = height;
+	image.Channels = channels;
+	image.Pixels.resize((size_t)width * height * channels);
+	for (unsigned char& value : image.Pixels)
+		value = (unsigned char)(rng() & 255);
+	return image;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+#include "../PNGDecoder.h"
+
+// The material sets and maps in Assets/Textures, as Game names them
+// (cobblestone has no normal map)
+extern const wchar_t* const TestTextureSets[4];
+extern const wchar_t* const TestTextureMaps[4];
+
+// Assets/Textures/<set>_<map>.png
+std::wstring GetTestTexturePath(const wchar_t* set, const wchar_t* map);
+
+// Reads and decodes a file; false if it's missing or won't decode
+bool LoadTestTexture(const std::wstring& path, DecodedImage& image);
+
+// Noise, so nothing can be predicted or compressed away
+DecodedImage CreateRandomImage(unsigned int width, unsigned int height, unsigned int channels, unsigned int seed);
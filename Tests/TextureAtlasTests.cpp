@@ -0,0 +1,336 @@
+#include "TestHarness.h"
+
+#include "../MaterialCompiler.h"
+#include "../MipGenerator.h"
+#include "../TextureAtlas.h"
+#include "TestTextures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// Every channel of an image at a point in texture space, filtered
+	// bilinearly (wrapping or clamping, as the sampler would)
+	void SampleBilinear(const DecodedImage& image, float u, float v, bool wrap, float* result)
+	{
+		float x = u * image.Width - 0.5f;
+		float y = v * image.Height - 0.5f;
+		float left = floorf(x);
+		float top = floorf(y);
+		float fractionX = x - left;
+		float fractionY = y - top;
+
+		auto texel = [&image, wrap](int column, int row, unsigned int channel)
+		{
+			int width = (int)image.Width;
+			int height = (int)image.Height;
+			column = wrap ? ((column % width) + width) % width : std::min(std::max(column, 0), width - 1);
+			row = wrap ? ((row % height) + height) % height : std::min(std::max(row, 0), height - 1);
+			return (float)image.Pixels[((size_t)row * width + column) * image.Channels + channel];
+		};
+
+		int column = (int)left;
+		int row = (int)top;
+		for (unsigned int c = 0; c < image.Channels; c++)
+		{
+			float upper = texel(column, row, c) + (texel(column + 1, row, c) - texel(column, row, c)) * fractionX;
+			float lower = texel(column, row + 1, c) + (texel(column + 1, row + 1, c) - texel(column, row + 1, c)) * fractionX;
+			result[c] = upper + (lower - upper) * fractionY;
+		}
+	}
+
+	std::vector<DecodedImage> MakeChain(unsigned int width, unsigned int height, unsigned int channels, unsigned int seed)
+	{
+		std::vector<DecodedImage> chain;
+		MipGenerator::Generate(CreateRandomImage(width, height, channels, seed), MipSettings(), chain);
+		return chain;
+	}
+
+	// Chains of noise in two layers (four channels, then two), so any
+	// bleeding between items shows
+	struct NoiseItems
+	{
+		std::vector<std::vector<DecodedImage>> Chains;
+		std::vector<AtlasItem> Items;
+
+		NoiseItems(const std::vector<unsigned int>& sizes)
+		{
+			Chains.reserve(sizes.size() * 2);
+			for (size_t i = 0; i < sizes.size(); i++)
+			{
+				unsigned int width = sizes[i];
+				unsigned int height = std::max(sizes[i] / (unsigned int)(i % 2 + 1), 16u);
+				Chains.push_back(MakeChain(width, height, 4, (unsigned int)i * 2));
+				Chains.push_back(MakeChain(width, height, 2, (unsigned int)i * 2 + 1));
+			}
+			Items.resize(sizes.size());
+			for (size_t i = 0; i < Items.size(); i++)
+				Items[i].Layers = { &Chains[i * 2], &Chains[i * 2 + 1] };
+		}
+	};
+
+	uint64_t GetChainBytes(const std::vector<DecodedImage>& chain)
+	{
+		uint64_t bytes = 0;
+		for (const DecodedImage& level : chain)
+			bytes += level.Pixels.size();
+		return bytes;
+	}
+}
+
+// Enough levels for the smallest item to stay whole texels, up to the maximum
+TEST(TextureAtlas, LevelsFollowTheSmallestItem)
+{
+	NoiseItems noise({ 64, 32, 24 });
+	AtlasSettings settings;
+	CHECK(TextureAtlas::GetLevelCount(noise.Items, settings) == 4);
+	settings.MaxLevels = 2;
+	CHECK(TextureAtlas::GetLevelCount(noise.Items, settings) == 2);
+
+	// 24 halves three times, 12 only twice
+	NoiseItems odd({ 64, 12 });
+	settings.MaxLevels = 6;
+	CHECK(TextureAtlas::GetLevelCount(odd.Items, settings) == 3);
+
+	// Items too big to pack don't count (32x16 halves four times)
+	settings.MaxItemSize = 32;
+	CHECK(TextureAtlas::GetLevelCount(NoiseItems({ 256, 32 }).Items, settings) == 5);
+}
+
+// --------------------------------------------------------
+// Items never overlap (gutters and all), start on whole
+// blocks at every level, and sample like their own textures
+// (wrapped or clamped) at every level, even right at their
+// edges.  The page is made small enough to need several.
+// --------------------------------------------------------
+TEST(TextureAtlas, ItemsSampleLikeTheirOwnTextures)
+{
+	std::vector<unsigned int> sizes;
+	for (unsigned int i = 0; i < 24; i++)
+		sizes.push_back(128u >> (i % 4));
+	NoiseItems noise(sizes);
+
+	std::mt19937 rng(49);
+	std::uniform_real_distribution<float> anywhere(0.0f, 1.0f);
+	AtlasSettings settings;
+	settings.Size = 256;
+	for (int wrap = 0; wrap < 2; wrap++)
+	{
+		settings.Wrap = wrap == 1;
+		std::vector<AtlasPage> pages;
+		std::vector<AtlasPlacement> placements;
+		REQUIRE(TextureAtlas::Build(noise.Items, settings, pages, placements));
+		REQUIRE(placements.size() == noise.Items.size());
+		CHECK(pages.size() > 1);
+
+		unsigned int levels = TextureAtlas::GetLevelCount(noise.Items, settings);
+		unsigned int cell = 4u << (levels - 1);
+		unsigned int gutter = settings.Gutter << (levels - 1);
+		unsigned int misplaced = 0;
+		unsigned int overlaps = 0;
+		unsigned int pageItems = 0;
+		float worst = 0.0f;
+		for (const AtlasPage& page : pages)
+		{
+			pageItems += page.Items;
+			CHECK(page.Width <= settings.Size && page.Height <= settings.Size);
+			CHECK(page.Layers.size() == 2 && page.Layers[0].size() == levels);
+		}
+		for (size_t i = 0; i < noise.Items.size(); i++)
+		{
+			const AtlasPlacement& placement = placements[i];
+			if (!placement.Packed || placement.Page >= pages.size() || (placement.X - gutter) % cell != 0 || (placement.Y - gutter) % cell != 0 ||
+				placement.X + placement.Width + gutter > pages[placement.Page].Width || placement.Y + placement.Height + gutter > pages[placement.Page].Height)
+			{
+				misplaced++;
+				continue;
+			}
+			for (size_t j = 0; j < i; j++)
+			{
+				const AtlasPlacement& other = placements[j];
+				if (other.Page == placement.Page &&
+					placement.X - gutter < other.X + other.Width + gutter && other.X - gutter < placement.X + placement.Width + gutter &&
+					placement.Y - gutter < other.Y + other.Height + gutter && other.Y - gutter < placement.Y + placement.Height + gutter)
+					overlaps++;
+			}
+
+			for (size_t layer = 0; layer < 2; layer++)
+			{
+				for (unsigned int level = 0; level < levels; level++)
+				{
+					const DecodedImage& own = (*noise.Items[i].Layers[layer])[level];
+					const DecodedImage& page = pages[placement.Page].Layers[layer][level];
+					for (int sample = 0; sample < 64; sample++)
+					{
+						// Corners and edges first, then anywhere
+						float u = sample < 4 ? (float)(sample & 1) : (sample < 8 ? (sample & 1) * 0.999f : anywhere(rng));
+						float v = sample < 4 ? (float)(sample >> 1) : (sample < 8 ? ((sample >> 1) & 1) * 0.999f : anywhere(rng));
+						float expected[4] = {};
+						float actual[4] = {};
+						SampleBilinear(own, u, v, settings.Wrap, expected);
+						SampleBilinear(page, u * placement.ScaleU + placement.OffsetU, v * placement.ScaleV + placement.OffsetV, false, actual);
+						for (unsigned int c = 0; c < own.Channels; c++)
+							worst = std::max(worst, fabsf(expected[c] - actual[c]));
+					}
+				}
+			}
+		}
+
+		printf("  %s gutters: %zu pages, %u levels, worst sampling difference %.3f (of 255)\n",
+			settings.Wrap ? "wrapped" : "clamped", pages.size(), levels, worst);
+		CHECK(misplaced == 0);
+		CHECK(overlaps == 0);
+		CHECK(pageItems == noise.Items.size());
+		CHECK(worst <= 0.5f);
+	}
+}
+
+// Items too big for the settings (or a page) keep their own textures
+TEST(TextureAtlas, OversizedItemsAreLeftOut)
+{
+	NoiseItems noise({ 256, 128, 64, 32 });
+	AtlasSettings settings;
+	settings.MaxItemSize = 64;
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasPlacement> placements;
+	REQUIRE(TextureAtlas::Build(noise.Items, settings, pages, placements));
+	CHECK(!placements[0].Packed && !placements[1].Packed);
+	CHECK(placements[2].Packed && placements[3].Packed);
+	CHECK(pages.size() == 1 && pages[0].Items == 2);
+
+	// Or with nothing that fits, nothing is built
+	settings.MaxItemSize = 16;
+	CHECK(!TextureAtlas::Build(noise.Items, settings, pages, placements));
+	CHECK(pages.empty());
+}
+
+// Layers have to match the first item's, in count and channels, and have every level
+TEST(TextureAtlas, MismatchedLayersAreLeftOut)
+{
+	NoiseItems noise({ 64, 64 });
+	std::vector<DecodedImage> threeChannels = MakeChain(64, 64, 3, 7);
+	std::vector<DecodedImage> topOnly = { CreateRandomImage(64, 64, 4, 8) };
+	std::vector<AtlasItem> items = noise.Items;
+	items.push_back(AtlasItem());
+	items.back().Layers = { &noise.Chains[0] };
+	items.push_back(AtlasItem());
+	items.back().Layers = { &noise.Chains[0], &threeChannels };
+	items.push_back(AtlasItem());
+	items.back().Layers = { &topOnly, &noise.Chains[1] };
+	items.push_back(AtlasItem());
+	items.back().Layers = { &noise.Chains[0], 0 };
+
+	AtlasSettings settings;
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasPlacement> placements;
+	REQUIRE(TextureAtlas::Build(items, settings, pages, placements));
+	CHECK(placements[0].Packed && placements[1].Packed);
+	unsigned int packed = 0;
+	for (size_t i = 2; i < items.size(); i++)
+		packed += placements[i].Packed ? 1 : 0;
+	CHECK(packed == 0);
+}
+
+// --------------------------------------------------------
+// Small materials, as Game makes them: mips of every set's
+// albedo, normals and ORM (256 down to 32 texels).  Packed,
+// they need a few pages' textures and tables instead of
+// three textures and a table each, and the items fill most
+// of each page.
+// --------------------------------------------------------
+TEST(TextureAtlas, SmallMaterialsShareAFewPages)
+{
+	const unsigned int sizes[] = { 256, 128, 64, 32 };
+	const unsigned int layerCount = 3;
+	std::wstring directory = std::wstring(GetTestAssetDirectory()) + L"Textures/";
+	std::vector<std::vector<DecodedImage>> chains;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		MaterialSource source = MaterialCompiler::GetSourcesForSet(directory, set);
+		const std::wstring* paths[] = { &source.Albedo, &source.Normals, &source.Occlusion, &source.Roughness, &source.Metal };
+		DecodedImage maps[5];
+		bool found[5] = {};
+		for (int i = 0; i < 5; i++)
+			found[i] = LoadTestTexture(*paths[i], maps[i]);
+		REQUIRE(found[0]);
+
+		// Materials without normals get flat ones
+		if (!found[1])
+		{
+			const unsigned char flat[4] = { 128, 128, 255, 255 };
+			maps[1] = { maps[0].Width, maps[0].Height, 4, {} };
+			for (size_t i = 0; i < (size_t)maps[0].Width * maps[0].Height; i++)
+				maps[1].Pixels.insert(maps[1].Pixels.end(), flat, flat + 4);
+		}
+
+		DecodedImage orm;
+		REQUIRE(MaterialCompiler::PackORM(found[2] ? &maps[2] : 0, found[3] ? &maps[3] : 0, found[4] ? &maps[4] : 0, orm));
+		DecodedImage* layers[] = { &maps[0], &maps[1], &orm };
+		MipSettings settings[] = { MipGenerator::GetSettingsForPath(source.Albedo), MipGenerator::GetSettingsForPath(source.Normals), MipSettings() };
+		std::vector<DecodedImage> full[layerCount];
+		for (unsigned int layer = 0; layer < layerCount; layer++)
+			MipGenerator::Generate(*layers[layer], settings[layer], full[layer]);
+
+		// Each small size's part of the chains, where every layer has it
+		for (unsigned int size : sizes)
+		{
+			size_t levels[layerCount] = {};
+			unsigned int matched = 0;
+			for (unsigned int layer = 0; layer < layerCount; layer++)
+			{
+				for (size_t level = 0; level < full[layer].size(); level++)
+				{
+					if (full[layer][level].Width == size && full[layer][level].Height == size)
+					{
+						levels[layer] = level;
+						matched++;
+					}
+				}
+			}
+			if (matched != layerCount)
+				continue;
+			for (unsigned int layer = 0; layer < layerCount; layer++)
+				chains.push_back(std::vector<DecodedImage>(full[layer].begin() + levels[layer], full[layer].end()));
+		}
+	}
+
+	std::vector<AtlasItem> items(chains.size() / layerCount);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		for (unsigned int layer = 0; layer < layerCount; layer++)
+			items[i].Layers.push_back(&chains[i * layerCount + layer]);
+	}
+	REQUIRE(items.size() >= 12);
+
+	AtlasSettings settings;
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasPlacement> placements;
+	REQUIRE(TextureAtlas::Build(items, settings, pages, placements));
+
+	uint64_t separateBytes = 0;
+	for (const std::vector<DecodedImage>& chain : chains)
+		separateBytes += GetChainBytes(chain);
+	uint64_t pageBytes = 0;
+	uint64_t itemTexels = 0;
+	uint64_t pageTexels = 0;
+	for (const AtlasPage& page : pages)
+	{
+		itemTexels += page.ItemTexels;
+		pageTexels += (uint64_t)page.Width * page.Height;
+		for (const std::vector<DecodedImage>& layer : page.Layers)
+			pageBytes += GetChainBytes(layer);
+	}
+	unsigned int packed = 0;
+	for (const AtlasPlacement& placement : placements)
+		packed += placement.Packed ? 1 : 0;
+
+	printf("  %zu materials: %zu textures and %zu tables separately (%.1f MB), %zu textures and %zu tables packed (%.1f MB), %.0f%% filled\n",
+		items.size(), items.size() * layerCount, items.size(), separateBytes / (1024.0 * 1024.0),
+		pages.size() * layerCount, pages.size(), pageBytes / (1024.0 * 1024.0), 100.0 * itemTexels / pageTexels);
+	CHECK(packed == items.size());
+	CHECK(pages.size() * 4 <= items.size());
+	CHECK(itemTexels * 2 > pageTexels);
+}
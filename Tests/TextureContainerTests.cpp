@@ -0,0 +1,256 @@
+#include "TestHarness.h"
+
+#include "../FileStreams.h"
+#include "../MipGenerator.h"
+#include "../TextureContainer.h"
+#include "TestTextures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	// Header, level table and table checksum, as the file format lays them out
+	size_t GetHeaderSize(size_t levelCount)
+	{
+		return 4 * 2 + 8 + 4 * 5 + levelCount * (8 * 2 + 4 * 4 + 8) + 8;
+	}
+
+	// 16x8 down to 1x1, of noise
+	std::vector<DecodedImage> MakePixelChain()
+	{
+		std::vector<DecodedImage> chain;
+		unsigned int seed = 48;
+		for (unsigned int w = 16, h = 8; ; w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+		{
+			chain.push_back(CreateRandomImage(w, h, 4, seed++));
+			if (w == 1 && h == 1)
+				break;
+		}
+		return chain;
+	}
+
+	// Three levels of BC7 blocks, from 16x16 down
+	std::vector<CompressedImage> MakeBlockChain()
+	{
+		std::vector<CompressedImage> chain(3);
+		for (unsigned int level = 0; level < 3; level++)
+			BlockCompressor::Compress(CreateRandomImage(16 >> level, 16 >> level, 4, level), BLOCK_FORMAT_BC7, BLOCK_QUALITY_FAST, chain[level]);
+		return chain;
+	}
+
+	// Adds up a level's bytes, so every page of it is really read
+	uint64_t TouchLevel(const TextureLevel& level)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < level.Size; i += 64)
+			sum += level.Data[i];
+		return sum;
+	}
+}
+
+// Pixels come back exactly, each level at an aligned offset, smallest first
+TEST(TextureContainer, PixelsRoundTrip)
+{
+	std::vector<DecodedImage> pixels = MakePixelChain();
+	std::vector<unsigned char> data;
+	TextureContainer::Serialize(pixels, 1234, data);
+
+	TextureContainer container;
+	REQUIRE(container.Open(data.data(), data.size(), 1234));
+	CHECK(container.GetWidth() == 16 && container.GetHeight() == 8);
+	CHECK(container.GetLevelCount() == pixels.size());
+	CHECK(container.GetChannels() == 4 && container.GetFormat() == BLOCK_FORMAT_NONE);
+
+	unsigned int wrong = 0;
+	for (unsigned int level = 0; level < pixels.size(); level++)
+	{
+		TextureLevel view = container.GetLevel(level);
+		if (view.Width != pixels[level].Width || view.Height != pixels[level].Height ||
+			view.RowPitch != pixels[level].Width * 4 || view.Size != pixels[level].Pixels.size() ||
+			memcmp(view.Data, pixels[level].Pixels.data(), view.Size) != 0 ||
+			(view.Data - data.data()) % TEXTURE_CONTAINER_ALIGNMENT != 0 || !container.VerifyLevel(level))
+			wrong++;
+		if (level > 0 && view.Data > container.GetLevel(level - 1).Data)
+			wrong++;
+	}
+	CHECK(wrong == 0);
+	CHECK(container.GetLevel(100).Data == 0);
+	CHECK(!container.VerifyLevel(100));
+
+	container.Close();
+	CHECK(!container.IsOpen());
+	CHECK(container.GetLevelCount() == 0);
+}
+
+TEST(TextureContainer, BlocksRoundTrip)
+{
+	std::vector<CompressedImage> blocks = MakeBlockChain();
+	std::vector<unsigned char> data;
+	TextureContainer::Serialize(blocks, 5678, data);
+
+	TextureContainer container;
+	REQUIRE(container.Open(data.data(), data.size(), 5678));
+	CHECK(container.GetFormat() == BLOCK_FORMAT_BC7 && container.GetChannels() == 0);
+	REQUIRE(container.GetLevelCount() == 3);
+	for (unsigned int level = 0; level < 3; level++)
+	{
+		TextureLevel view = container.GetLevel(level);
+		CHECK(view.Size == blocks[level].Blocks.size());
+		CHECK(memcmp(view.Data, blocks[level].Blocks.data(), view.Size) == 0);
+		CHECK(view.RowPitch == BlockCompressor::GetCompressedSize(view.Width, 4, BLOCK_FORMAT_BC7));
+	}
+}
+
+// --------------------------------------------------------
+// Damage is rejected: anywhere in the header on open, and
+// in a level when it's verified (opening doesn't read it)
+// --------------------------------------------------------
+TEST(TextureContainer, DamageIsRejected)
+{
+	std::vector<DecodedImage> pixels = MakePixelChain();
+	std::vector<unsigned char> data;
+	TextureContainer::Serialize(pixels, 1234, data);
+
+	TextureContainer container;
+	CHECK(!container.Open(data.data(), data.size(), 4321));
+	CHECK(!container.Open(data.data(), data.size() - TEXTURE_CONTAINER_ALIGNMENT, 1234));
+	CHECK(!container.Open(data.data(), 16, 1234));
+	CHECK(!container.Open(0, 0, 1234));
+
+	unsigned int accepted = 0;
+	for (size_t position = 0; position < GetHeaderSize(pixels.size()); position++)
+	{
+		std::vector<unsigned char> damaged = data;
+		damaged[position] ^= 1;
+		if (container.Open(damaged.data(), damaged.size(), 1234))
+			accepted++;
+	}
+	CHECK(accepted == 0);
+
+	// The last (largest) level
+	std::vector<unsigned char> damaged = data;
+	damaged[damaged.size() - TEXTURE_CONTAINER_ALIGNMENT + 1] ^= 1;
+	REQUIRE(container.Open(damaged.data(), damaged.size(), 1234));
+	CHECK(container.VerifyLevel((unsigned int)pixels.size() - 1));
+	CHECK(!container.VerifyLevel(0));
+}
+
+// Written to disk and read back through a mapped file
+TEST(TextureContainer, SavesAndMapsFiles)
+{
+	std::vector<CompressedImage> blocks = MakeBlockChain();
+	std::vector<DecodedImage> pixels = MakePixelChain();
+	std::wstring blockPath = std::wstring(GetTestOutputDirectory()) + L"TextureContainerTest.tex";
+	std::wstring pixelPath = std::wstring(GetTestOutputDirectory()) + L"TextureContainerPixels.tex";
+	REQUIRE(TextureContainer::Save(blockPath, blocks, 5678));
+	REQUIRE(TextureContainer::Save(pixelPath, pixels, 1234));
+
+	TextureContainer container;
+	REQUIRE(container.Open(blockPath, 5678));
+	CHECK(container.GetLevelCount() == 3);
+	CHECK(container.VerifyLevel(0) && container.VerifyLevel(2));
+	CHECK(memcmp(container.GetLevel(0).Data, blocks[0].Blocks.data(), blocks[0].Blocks.size()) == 0);
+	container.Prefetch(0, 2);
+
+	REQUIRE(container.Open(pixelPath, 1234));
+	CHECK(container.GetFormat() == BLOCK_FORMAT_NONE);
+	CHECK(memcmp(container.GetLevel(1).Data, pixels[1].Pixels.data(), pixels[1].Pixels.size()) == 0);
+
+	CHECK(!container.Open(blockPath, 1234));
+	CHECK(!container.IsOpen());
+	CHECK(!container.Open(std::wstring(GetTestOutputDirectory()) + L"Missing.tex", 5678));
+
+	// An empty file can't be mapped
+	std::wstring emptyPath = std::wstring(GetTestOutputDirectory()) + L"Empty.tex";
+	REQUIRE(WriteWholeFile(emptyPath, 0, 0));
+	CHECK(!container.Open(emptyPath, 5678));
+}
+
+// --------------------------------------------------------
+// Each material texture as a launch without a cache loads
+// it (decode, mips, then blocks, though at the fast quality
+// to keep this quick), against opening its container and
+// reading just the tail or every level.  The containers are
+// in the page cache, having just been written, so this is
+// the best case for them.
+// --------------------------------------------------------
+TEST(TextureContainer, MaterialTexturesOpenFasterThanTheyDecode)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	const size_t tailBytes = 64 * 1024;
+	double pngMs = 0.0;
+	double tailMs = 0.0;
+	double allMs = 0.0;
+	uint64_t bytes[2] = {};
+	uint64_t checksum = 0;
+	unsigned int textureCount = 0;
+	unsigned int mismatches = 0;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		for (const wchar_t* map : TestTextureMaps)
+		{
+			std::wstring path = GetTestTexturePath(set, map);
+			std::vector<unsigned char> png;
+			if (!ReadWholeFile(path, png))
+				continue;
+
+			auto start = Clock::now();
+			DecodedImage image = {};
+			REQUIRE(PNGDecoder::Decode(png.data(), png.size(), image));
+			std::vector<DecodedImage> chain;
+			MipGenerator::Generate(image, MipGenerator::GetSettingsForPath(path), chain);
+			std::vector<CompressedImage> compressed;
+			if (BlockCompressor::CanCompress(chain[0]))
+			{
+				compressed.resize(chain.size());
+				for (size_t level = 0; level < chain.size(); level++)
+					BlockCompressor::Compress(chain[level], BlockCompressor::GetFormatForPath(path, BLOCK_QUALITY_FAST), BLOCK_QUALITY_FAST, compressed[level]);
+			}
+			pngMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			std::wstring containerPath = std::wstring(GetTestOutputDirectory()) + set + L"_" + map + L".tex";
+			REQUIRE(compressed.empty() ? TextureContainer::Save(containerPath, chain, textureCount) : TextureContainer::Save(containerPath, compressed, textureCount));
+
+			// Just the levels that always stay resident, then everything
+			TextureContainer container;
+			for (int pass = 0; pass < 2; pass++)
+			{
+				start = Clock::now();
+				REQUIRE(container.Open(containerPath, textureCount));
+				for (unsigned int level = container.GetLevelCount(); level-- > 0;)
+				{
+					TextureLevel view = container.GetLevel(level);
+					if (pass == 0 && view.Size > tailBytes && level + 1 < container.GetLevelCount())
+						break;
+					checksum += TouchLevel(view);
+					bytes[pass] += view.Size;
+				}
+				(pass == 0 ? tailMs : allMs) += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			}
+
+			// Same data as was made
+			CHECK(container.GetLevelCount() == chain.size());
+			for (unsigned int level = 0; level < container.GetLevelCount(); level++)
+			{
+				TextureLevel view = container.GetLevel(level);
+				const unsigned char* expected = compressed.empty() ? chain[level].Pixels.data() : compressed[level].Blocks.data();
+				if (memcmp(view.Data, expected, view.Size) != 0)
+				{
+					mismatches++;
+					break;
+				}
+			}
+			textureCount++;
+		}
+	}
+
+	printf("  %u textures: %.1fms from PNGs, %.2fms for tails (%.0f KB), %.2fms for everything (%.0f KB, checksum %llu)\n",
+		textureCount, pngMs, tailMs, bytes[0] / 1024.0, allMs, bytes[1] / 1024.0, (unsigned long long)checksum);
+	CHECK(textureCount == 15);
+	CHECK(mismatches == 0);
+	CHECK(bytes[0] * 10 < bytes[1]);
+	CHECK(tailMs < pngMs);
+}
@@ -0,0 +1,228 @@
+#include "TestHarness.h"
+
+#include "../TextureManager.h"
+#include "TestTextures.h"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	// Files held in memory, so only decoding is measured (not the disk)
+	class MemoryTextureSource : public TextureSource
+	{
+	public:
+		std::unordered_map<std::wstring, std::vector<unsigned char>> Files;
+
+		bool Read(const std::wstring& path, std::vector<unsigned char>& data) override
+		{
+			auto file = Files.find(path);
+			if (file == Files.end())
+				return false;
+			data = file->second;
+			return true;
+		}
+	};
+
+	std::vector<unsigned char> EncodeRandomImage(unsigned int size, unsigned int seed)
+	{
+		std::vector<unsigned char> png;
+		PNGDecoder::Encode(CreateRandomImage(size, size, 4, seed), png);
+		return png;
+	}
+}
+
+TEST(TextureManager, RequestsArePerPath)
+{
+	MemoryTextureSource memory;
+	TextureManager manager;
+	manager.Initialize(&memory);
+	CHECK(!manager.HasPending());
+
+	unsigned int first = manager.Request(L"Textures/a_albedo.png");
+	CHECK(manager.Request(L"Textures/a_albedo.png") == first);
+	CHECK(manager.Request(L"TEXTURES\\A_Albedo.PNG") == first);
+	CHECK(manager.Request(L"Textures/b_albedo.png") != first);
+	CHECK(manager.HasPending());
+	CHECK(manager.GetTextureCount() == 2);
+	CHECK(manager.GetPath(first) == L"Textures/a_albedo.png");
+	CHECK(manager.GetState(first) == TEXTURE_LOAD_PENDING);
+	CHECK(manager.GetStats().Requests == 4);
+
+	manager.LoadPending();
+	CHECK(!manager.HasPending());
+	CHECK(manager.GetState(first) == TEXTURE_LOAD_MISSING);
+	CHECK(manager.GetImage(first) == 0);
+	CHECK(manager.GetStats().Missing == 2);
+	CHECK(manager.GetStats().Loads == 1);
+
+	// Nothing new, so nothing to load
+	manager.Request(L"textures/A_ALBEDO.png");
+	CHECK(!manager.HasPending());
+}
+
+TEST(TextureManager, UndecodableFilesAreKeptForWIC)
+{
+	MemoryTextureSource memory;
+	memory.Files[L"picture.jpg"] = std::vector<unsigned char>(100, 0xFF);
+	memory.Files[L"picture.png"] = EncodeRandomImage(16, 1);
+
+	TextureManager manager;
+	manager.Initialize(&memory);
+	unsigned int jpg = manager.Request(L"picture.jpg");
+	unsigned int png = manager.Request(L"picture.png");
+	manager.LoadPending();
+
+	CHECK(manager.GetState(jpg) == TEXTURE_LOAD_UNDECODED);
+	CHECK(manager.GetImage(jpg) == 0);
+	CHECK(manager.GetState(png) == TEXTURE_LOAD_DECODED);
+	REQUIRE(manager.GetImage(png) != 0);
+	CHECK(manager.GetImage(png)->Width == 16);
+	CHECK(manager.GetLevelCount(png) == 1);
+	CHECK(manager.GetStats().Undecoded == 1 && manager.GetStats().Decoded == 1);
+
+	manager.ReleaseImage(png);
+	CHECK(manager.GetImage(png) == 0);
+}
+
+// --------------------------------------------------------
+// The material textures as Game would load them: each set
+// for its own material, then the scratched set for a bunch
+// of other materials, half of which name copies of the
+// scratched files in another folder.  Decoding every
+// request where it's made (as LoadTexture used to) is
+// compared with the manager, which decodes each distinct
+// file once, in parallel.
+// --------------------------------------------------------
+TEST(TextureManager, SharedContentsDecodeOnce)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	const unsigned int otherMaterials = 16;
+	std::wstring directory = std::wstring(GetTestAssetDirectory()) + L"Textures/";
+
+	MemoryTextureSource memory;
+	FileTextureSource files;
+	std::vector<std::wstring> requests;
+	for (const wchar_t* set : TestTextureSets)
+	{
+		for (const wchar_t* map : TestTextureMaps)
+		{
+			std::wstring path = GetTestTexturePath(set, map);
+			std::vector<unsigned char> data;
+			if (files.Read(path, data))
+				memory.Files[path] = data;
+			requests.push_back(path);
+		}
+	}
+	REQUIRE(memory.Files.size() == 15);
+	for (unsigned int m = 0; m < otherMaterials; m++)
+	{
+		for (const wchar_t* map : TestTextureMaps)
+		{
+			std::wstring name = std::wstring(L"scratched_") + map + L".png";
+			std::wstring path = directory + name;
+			if (m % 2 == 1)
+			{
+				path = directory + L"Copies/" + name;
+				memory.Files[path] = memory.Files[directory + name];
+			}
+			requests.push_back(path);
+		}
+	}
+
+	auto start = Clock::now();
+	std::vector<DecodedImage> separate(requests.size());
+	unsigned int separateDecodes = 0;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		std::vector<unsigned char> data;
+		if (memory.Read(requests[i], data) && PNGDecoder::Decode(data.data(), data.size(), separate[i]))
+			separateDecodes++;
+	}
+	double separateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	start = Clock::now();
+	TextureManager manager;
+	manager.Initialize(&memory);
+	std::vector<unsigned int> ids;
+	for (const std::wstring& path : requests)
+		ids.push_back(manager.Request(path));
+	manager.LoadPending();
+	double managerMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	TextureLoadStats stats = manager.GetStats();
+
+	// Same pixels either way, and a second request of the same paths adds nothing
+	unsigned int mismatches = 0;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		const DecodedImage* image = manager.GetImage(ids[i]);
+		bool decoded = !separate[i].Pixels.empty();
+		if (decoded != (image != 0) || (image && (image->Width != separate[i].Width || image->Pixels != separate[i].Pixels)))
+			mismatches++;
+	}
+	for (const std::wstring& path : requests)
+	{
+		if (manager.Request(path) >= stats.Textures)
+			mismatches++;
+	}
+
+	printf("  %u requests: %u decodes in %.1fms separately, %u in %.1fms through the manager\n",
+		(unsigned int)requests.size(), separateDecodes, separateMs, stats.Decoded, managerMs);
+	CHECK(mismatches == 0);
+	CHECK(!manager.HasPending());
+	CHECK(stats.Textures == 20);		// Each set's paths, then the four copies
+	CHECK(stats.SharedContents == 5);	// Cobblestone and paint share a metal map too
+	CHECK(stats.Missing == 1);			// Cobblestone has no normals
+	CHECK(stats.Decoded == 14);
+	CHECK(separateDecodes == 15 + otherMaterials * 4);
+}
+
+// --------------------------------------------------------
+// Chains are generated and compressed once, saved to the
+// cache and mapped back; a later manager (as on the next
+// launch) maps them without decoding anything
+// --------------------------------------------------------
+TEST(TextureManager, FinishedChainsAreCachedAndMapped)
+{
+	MemoryTextureSource memory;
+	memory.Files[L"cached_albedo.png"] = EncodeRandomImage(64, 44);
+	memory.Files[L"cached_roughness.png"] = EncodeRandomImage(32, 45);
+
+	for (int launch = 0; launch < 2; launch++)
+	{
+		TextureManager manager;
+		manager.Initialize(&memory);
+		manager.SetCacheDirectory(GetTestOutputDirectory());
+		manager.SetBlockCompression(true, BLOCK_QUALITY_FAST);
+		unsigned int albedo = manager.Request(L"cached_albedo.png", true);
+		unsigned int roughness = manager.Request(L"cached_roughness.png");
+		manager.LoadPending();
+
+		CHECK(manager.GetState(albedo) == TEXTURE_LOAD_DECODED);
+		CHECK(manager.IsMapped(albedo) && manager.IsMapped(roughness));
+		CHECK(manager.GetLevelCount(albedo) == MipGenerator::GetMipCount(64, 64));
+		CHECK(manager.GetLevelCount(roughness) == 1);
+		CHECK(manager.GetFormat(albedo) == BlockCompressor::GetFormatForPath(L"cached_albedo.png", BLOCK_QUALITY_FAST));
+		CHECK(manager.GetFormat(roughness) == BLOCK_FORMAT_BC4);
+		CHECK(manager.GetChannels(albedo) == 0);
+
+		// Mapped levels outlive the release, for streaming
+		manager.ReleaseImage(albedo);
+		TextureLevel level = {};
+		CHECK(manager.GetLevel(albedo, 0, level) && level.Width == 64);
+		CHECK(level.Size == BlockCompressor::GetCompressedSize(64, 64, manager.GetFormat(albedo)));
+		CHECK(manager.GetLevel(albedo, manager.GetLevelCount(albedo) - 1, level) && level.Width == 1);
+
+		TextureLoadStats stats = manager.GetStats();
+		CHECK(stats.Mapped == 2 && stats.Compressed == 2);
+		CHECK(stats.GPUBytes < stats.UncompressedBytes);
+		if (launch == 1)
+		{
+			CHECK(stats.MipCacheHits == 1);
+			CHECK(stats.BlockCacheHits == 2);
+			CHECK(stats.MipChains == 0);
+		}
+	}
+}
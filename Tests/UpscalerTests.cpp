@@ -0,0 +1,250 @@
+#include "TestHarness.h"
+
+#include "../Upscaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	const unsigned int width = 480;
+	const unsigned int height = 270;
+	const float aspect = (float)width / height;
+	const float panStep = 1.37f / width;	// Not a whole pixel, so history needs filtering
+
+	bool IsHit(const DenoiserPixel& pixel) { return pixel.InstanceID != DENOISER_INVALID_INSTANCE; }
+
+	// --------------------------------------------------------
+	// What a primary ray through a screen UV sees in the
+	// scene the tests pan across: sky, a checkered floor and three
+	// spheres, all sliding sideways as pan grows
+	// --------------------------------------------------------
+	DenoiserPixel ScenePixel(float u, float v, float pan)
+	{
+		DenoiserPixel pixel = {};
+		pixel.InstanceID = DENOISER_INVALID_INSTANCE;
+		pixel.Albedo = XMFLOAT3(1, 1, 1);
+		pixel.Motion = XMFLOAT2(panStep, 0);
+		float wx = u + pan;
+
+		// Closest sphere, if any
+		const float spheres[3][3] = { { 0.3f, 0.55f, 0.12f }, { 0.65f, 0.6f, 0.1f }, { 1.0f, 0.5f, 0.15f } };
+		const XMFLOAT3 sphereColors[3] = { XMFLOAT3(0.9f, 0.3f, 0.2f), XMFLOAT3(0.2f, 0.8f, 0.3f), XMFLOAT3(0.3f, 0.4f, 0.9f) };
+		for (int i = 0; i < 3; i++)
+		{
+			float dx = (wx - spheres[i][0]) * aspect / spheres[i][2];
+			float dy = (v - spheres[i][1]) / spheres[i][2];
+			float d2 = dx * dx + dy * dy;
+			float depth = 3.0f + i - sqrtf(std::max(1.0f - d2, 0.0f)) * 0.5f;
+			if (d2 >= 1.0f || (IsHit(pixel) && depth >= pixel.Depth))
+				continue;
+
+			float nz = sqrtf(1.0f - d2);
+			pixel.Depth = depth;
+			pixel.Normal = XMFLOAT3(dx, -dy, -nz);
+			pixel.InstanceID = 1 + i;
+			float stripes = 0.75f + 0.25f * sinf(dx * 12.0f);
+			pixel.Albedo = XMFLOAT3(sphereColors[i].x * stripes, sphereColors[i].y * stripes, sphereColors[i].z * stripes);
+			float light = std::max(dx * -0.5f + -dy * 0.7f + -nz * -0.5f, 0.0f) + 0.08f;
+			pixel.Color = XMFLOAT3(pixel.Albedo.x * light, pixel.Albedo.y * light, pixel.Albedo.z * light);
+		}
+
+		if (!IsHit(pixel))
+		{
+			if (v < 0.35f)
+			{
+				// Sky
+				pixel.Color = XMFLOAT3(0.4f * (1.0f - v), 0.6f * (1.0f - v), 0.9f);
+			}
+			else
+			{
+				// Checkered floor
+				float depth = 0.5f / (v - 0.3f);
+				float fx = (wx - 0.5f) * aspect * depth * 2.0f;
+				bool light = (((int)floorf(fx) + (int)floorf(depth)) & 1) != 0;
+				pixel.Depth = depth;
+				pixel.Normal = XMFLOAT3(0, 1, 0);
+				pixel.InstanceID = 0;
+				pixel.Albedo = light ? XMFLOAT3(0.75f, 0.72f, 0.68f) : XMFLOAT3(0.25f, 0.22f, 0.2f);
+				pixel.Color = XMFLOAT3(pixel.Albedo.x * 0.9f, pixel.Albedo.y * 0.9f, pixel.Albedo.z * 0.9f);
+			}
+		}
+
+		pixel.PreviousDepth = pixel.Depth;
+		return pixel;
+	}
+
+	struct Quality
+	{
+		double PSNR;
+		double SSIM;
+		double TracedFraction;
+	};
+
+	// --------------------------------------------------------
+	// Pans across the scene for a few frames, tracing only
+	// what the settings ask for (skipped checkerboard pixels
+	// are misses, as on the GPU), and averages the quality
+	// of the upscaled frames against native ones.  The first
+	// frame has no checkerboard history, so it's left out.
+	// --------------------------------------------------------
+	Quality MeasureQuality(const UpscalerSettings& settings, unsigned int frames = 6)
+	{
+		unsigned int renderWidth;
+		unsigned int renderHeight;
+		Upscaler::GetRenderSize(width, height, settings.RenderScale, renderWidth, renderHeight);
+
+		std::vector<DenoiserPixel> traced(renderWidth * renderHeight);
+		std::vector<DenoiserPixel> upscaled(width * height);
+		std::vector<DenoiserPixel> reference(width * height);
+		std::vector<unsigned char> referenceImage(width * height * 4);
+		std::vector<unsigned char> image(width * height * 4);
+
+		Upscaler upscaler;
+		Quality quality = {};
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			float pan = f * panStep;
+			size_t rays = 0;
+			for (unsigned int y = 0; y < renderHeight; y++)
+			{
+				for (unsigned int x = 0; x < renderWidth; x++)
+				{
+					DenoiserPixel& pixel = traced[y * renderWidth + x];
+					if (settings.Checkerboard && !Upscaler::IsTraced(x, y, f))
+					{
+						pixel = {};
+						pixel.InstanceID = DENOISER_INVALID_INSTANCE;
+						pixel.Albedo = XMFLOAT3(1, 1, 1);
+						continue;
+					}
+					pixel = ScenePixel((x + 0.5f) / renderWidth, (y + 0.5f) / renderHeight, pan);
+					rays++;
+				}
+			}
+			upscaler.Upscale(traced.data(), renderWidth, renderHeight, upscaled.data(), width, height, settings, f);
+			if (f == 0)
+				continue;
+
+			for (unsigned int y = 0; y < height; y++)
+				for (unsigned int x = 0; x < width; x++)
+					reference[y * width + x] = ScenePixel((x + 0.5f) / width, (y + 0.5f) / height, pan);
+			Denoiser::WriteColor(reference.data(), width, height, referenceImage.data(), width * 4);
+			Denoiser::WriteColor(upscaled.data(), width, height, image.data(), width * 4);
+			quality.PSNR += Upscaler::ComputePSNR(image.data(), referenceImage.data(), width, height) / (frames - 1);
+			quality.SSIM += Upscaler::ComputeSSIM(image.data(), referenceImage.data(), width, height) / (frames - 1);
+			quality.TracedFraction = (double)rays / (width * height);
+		}
+		return quality;
+	}
+
+	UpscalerSettings GetSettings(float scale, bool checkerboard, bool edgeAware)
+	{
+		UpscalerSettings settings;
+		settings.RenderScale = scale;
+		settings.Checkerboard = checkerboard;
+		settings.EdgeAware = edgeAware;
+		return settings;
+	}
+}
+
+TEST(Upscaler, RenderSizeIsClampedAndRounded)
+{
+	unsigned int w;
+	unsigned int h;
+	Upscaler::GetRenderSize(1920, 1080, 0.75f, w, h);
+	CHECK(w == 1440 && h == 810);
+	Upscaler::GetRenderSize(1920, 1080, 0.1f, w, h);
+	CHECK(w == 960 && h == 540);
+	Upscaler::GetRenderSize(1920, 1080, 2.0f, w, h);
+	CHECK(w == 1920 && h == 1080);
+	Upscaler::GetRenderSize(1, 1, 0.5f, w, h);
+	CHECK(w == 1 && h == 1);
+}
+
+TEST(Upscaler, CheckerboardTracesHalfOfEachFrame)
+{
+	for (unsigned int f = 0; f < 2; f++)
+	{
+		unsigned int traced = 0;
+		for (unsigned int y = 0; y < 16; y++)
+		{
+			for (unsigned int x = 0; x < 16; x++)
+			{
+				traced += Upscaler::IsTraced(x, y, f);
+				CHECK(Upscaler::IsTraced(x, y, f) != Upscaler::IsTraced(x, y, f + 1));
+			}
+		}
+		CHECK(traced == 128);
+	}
+}
+
+TEST(Upscaler, ImageMetrics)
+{
+	std::vector<unsigned char> a(64 * 64 * 4);
+	for (size_t i = 0; i < a.size(); i++)
+		a[i] = (unsigned char)((i * 37) % 251);
+	CHECK(Upscaler::ComputePSNR(a.data(), a.data(), 64, 64) == 100.0);
+	CHECK_NEAR(Upscaler::ComputeSSIM(a.data(), a.data(), 64, 64), 1.0, 1e-9);
+
+	// Off by 2 everywhere: MSE 4
+	std::vector<unsigned char> b = a;
+	for (unsigned char& value : b)
+		value = value < 128 ? value + 2 : value - 2;
+	CHECK_NEAR(Upscaler::ComputePSNR(b.data(), a.data(), 64, 64), 10.0 * log10(255.0 * 255.0 / 4.0), 1e-9);
+	CHECK(Upscaler::ComputeSSIM(b.data(), a.data(), 64, 64) < 1.0);
+}
+
+// Tracing every pixel leaves nothing to reconstruct
+TEST(Upscaler, NativeResolutionIsUntouched)
+{
+	std::vector<DenoiserPixel> input(width * height);
+	std::vector<DenoiserPixel> output(width * height);
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++)
+			input[y * width + x] = ScenePixel((x + 0.5f) / width, (y + 0.5f) / height, 0.0f);
+
+	Upscaler upscaler;
+	upscaler.Upscale(input.data(), width, height, output.data(), width, height, GetSettings(1.0f, false, true), 0);
+	bool same = true;
+	for (unsigned int p = 0; p < width * height; p++)
+		same &= memcmp(&input[p], &output[p], sizeof(DenoiserPixel)) == 0;
+	CHECK(same);
+}
+
+// Stopping at edges keeps silhouettes sharp (higher SSIM), but
+// a hard edge a subpixel off costs about as much squared error
+// as a blurred one, so PSNR only has to stay level
+TEST(Upscaler, EdgeAwareKeepsStructure)
+{
+	const float scales[] = { 0.75f, 0.5f };
+	for (float scale : scales)
+	{
+		Quality bilinear = MeasureQuality(GetSettings(scale, false, false));
+		Quality edgeAware = MeasureQuality(GetSettings(scale, false, true));
+		printf("  %.0f%% scale: %.2f dB / SSIM %.4f bilinear, %.2f dB / SSIM %.4f edge-aware\n",
+			scale * 100.0f, bilinear.PSNR, bilinear.SSIM, edgeAware.PSNR, edgeAware.SSIM);
+		CHECK(edgeAware.SSIM > bilinear.SSIM);
+		CHECK(edgeAware.PSNR > bilinear.PSNR - 0.5);
+		CHECK_NEAR(edgeAware.TracedFraction, scale * scale, 0.01);
+	}
+}
+
+// Half the rays, but history fills the rest back in
+TEST(Upscaler, CheckerboardRecoversMostDetail)
+{
+	Quality checkerboard = MeasureQuality(GetSettings(1.0f, true, true));
+	Quality scaled = MeasureQuality(GetSettings(0.75f, false, true));
+	Quality both = MeasureQuality(GetSettings(0.75f, true, true));
+	printf("  %.2f dB / SSIM %.4f checkerboard, %.2f dB / SSIM %.4f at 75%% scale, %.2f dB / SSIM %.4f both\n",
+		checkerboard.PSNR, checkerboard.SSIM, scaled.PSNR, scaled.SSIM, both.PSNR, both.SSIM);
+	CHECK_NEAR(checkerboard.TracedFraction, 0.5, 0.01);
+	CHECK(checkerboard.PSNR > scaled.PSNR);
+	CHECK(checkerboard.SSIM > 0.95);
+	CHECK(both.PSNR > 25.0);
+}
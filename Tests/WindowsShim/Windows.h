@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+// The few names from Windows.h that Input.h and Camera.cpp use, for
+// building the tests where there's no Windows SDK (see CMakeLists.txt)
+typedef void* HWND;
+typedef intptr_t LPARAM;
+
+#define VK_LBUTTON	0x01
+#define VK_RBUTTON	0x02
+#define VK_MBUTTON	0x04
+#define VK_SHIFT	0x10
+#define VK_CONTROL	0x11
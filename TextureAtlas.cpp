@@ -0,0 +1,278 @@
+#include "TextureAtlas.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <string.h>
+
+// ImGui builds its own copy of the packer as static functions,
+// so this file needs one too (and doesn't call all of them)
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4505)
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "Vendor/imgui-1.87/imstb_rectpack.h"
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+// Times both sides halve before one goes odd (32 for zero)
+static unsigned int CountHalvings(unsigned int size)
+{
+	unsigned int count = 0;
+	while (count < 32 && (size & (1u << count)) == 0)
+		count++;
+	return count;
+}
+
+unsigned int TextureAtlas::GetLevelCount(const std::vector<AtlasItem>& items, const AtlasSettings& settings)
+{
+	unsigned int levels = std::max(settings.MaxLevels, 1u);
+	for (const AtlasItem& item : items)
+	{
+		if (item.Layers.empty() || !item.Layers[0] || item.Layers[0]->empty())
+			continue;
+
+		const DecodedImage& top = (*item.Layers[0])[0];
+		if (top.Width == 0 || top.Height == 0 || top.Width > settings.MaxItemSize || top.Height > settings.MaxItemSize)
+			continue;
+		levels = std::min(levels, std::min(CountHalvings(top.Width), CountHalvings(top.Height)) + 1);
+	}
+	return levels;
+}
+
+// Whether the item can go in a page on its own, with these layers
+static bool CanPack(const AtlasItem& item, const AtlasSettings& settings, unsigned int levels, const AtlasItem* reference)
+{
+	if (item.Layers.empty() || (reference && item.Layers.size() != reference->Layers.size()))
+		return false;
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	for (size_t layer = 0; layer < item.Layers.size(); layer++)
+	{
+		const std::vector<DecodedImage>* chain = item.Layers[layer];
+		if (!chain || chain->size() < levels)
+			return false;
+		if (layer == 0)
+		{
+			width = (*chain)[0].Width;
+			height = (*chain)[0].Height;
+		}
+
+		unsigned int channels = reference ? (*reference->Layers[layer])[0].Channels : (*chain)[0].Channels;
+		for (unsigned int level = 0; level < levels; level++)
+		{
+			const DecodedImage& image = (*chain)[level];
+			if (image.Width != std::max(width >> level, 1u) || image.Height != std::max(height >> level, 1u) ||
+				image.Channels != channels || image.Pixels.size() != (size_t)image.Width * image.Height * image.Channels)
+				return false;
+		}
+	}
+	return width > 0 && height > 0 && width <= settings.MaxItemSize && height <= settings.MaxItemSize;
+}
+
+
+// --------------------------------------------------------
+// Packs what fits into a page, then the rest into the
+// next, and so on.  Sizes go to the packer in cells, so
+// every position it picks is already aligned.
+// --------------------------------------------------------
+bool TextureAtlas::Build(const std::vector<AtlasItem>& items, const AtlasSettings& settings, std::vector<AtlasPage>& pages, std::vector<AtlasPlacement>& placements)
+{
+	pages.clear();
+	placements.assign(items.size(), AtlasPlacement());
+
+	unsigned int levels = GetLevelCount(items, settings);
+	unsigned int cell = (settings.BlockAligned ? 4u : 1u) << (levels - 1);
+	unsigned int gutter = settings.Gutter << (levels - 1);
+	unsigned int cells = settings.Size / cell;
+	if (cells == 0)
+		return false;
+
+	const AtlasItem* reference = 0;
+	std::vector<unsigned int> remaining;
+	for (unsigned int i = 0; i < items.size(); i++)
+	{
+		if (!CanPack(items[i], settings, levels, reference))
+			continue;
+
+		const DecodedImage& top = (*items[i].Layers[0])[0];
+		if ((top.Width + gutter * 2 + cell - 1) / cell > cells || (top.Height + gutter * 2 + cell - 1) / cell > cells)
+			continue;
+		if (!reference)
+			reference = &items[i];
+		remaining.push_back(i);
+	}
+	if (!reference)
+		return false;
+
+	std::vector<stbrp_node> nodes(cells);
+	auto pack = [&](unsigned int columns, unsigned int rows, std::vector<stbrp_rect>& rects)
+	{
+		for (size_t i = 0; i < remaining.size(); i++)
+		{
+			const DecodedImage& top = (*items[remaining[i]].Layers[0])[0];
+			rects[i].id = (int)remaining[i];
+			rects[i].w = (top.Width + gutter * 2 + cell - 1) / cell;
+			rects[i].h = (top.Height + gutter * 2 + cell - 1) / cell;
+		}
+
+		stbrp_context context;
+		stbrp_init_target(&context, (int)columns, (int)rows, nodes.data(), (int)columns);
+		stbrp_pack_rects(&context, rects.data(), (int)rects.size());
+		for (const stbrp_rect& rect : rects)
+		{
+			if (!rect.was_packed)
+				return false;
+		}
+		return true;
+	};
+
+	while (!remaining.empty())
+	{
+		// When the rest fit, the page halves (the longer side first) for
+		// as long as they still do
+		unsigned int columns = cells;
+		unsigned int rows = cells;
+		std::vector<stbrp_rect> rects(remaining.size());
+		if (pack(columns, rows, rects))
+		{
+			std::vector<stbrp_rect> smaller(remaining.size());
+			bool shrunk = true;
+			while (shrunk)
+			{
+				shrunk = false;
+				bool rowsFirst = rows >= columns;
+				for (int attempt = 0; attempt < 2 && !shrunk; attempt++)
+				{
+					bool halveRows = rowsFirst == (attempt == 0);
+					unsigned int side = halveRows ? rows : columns;
+					if (side % 2 != 0 || !pack(halveRows ? columns : columns / 2, halveRows ? rows / 2 : rows, smaller))
+						continue;
+					(halveRows ? rows : columns) /= 2;
+					rects.swap(smaller);
+					shrunk = true;
+				}
+			}
+		}
+
+		// Then it's cut down to what the items use
+		unsigned int usedColumns = 1;
+		unsigned int usedRows = 1;
+		for (const stbrp_rect& rect : rects)
+		{
+			if (rect.was_packed)
+			{
+				usedColumns = std::max(usedColumns, (unsigned int)(rect.x + rect.w));
+				usedRows = std::max(usedRows, (unsigned int)(rect.y + rect.h));
+			}
+		}
+		columns = std::min(columns, usedColumns);
+		rows = std::min(rows, usedRows);
+		unsigned int pageWidth = columns * cell;
+		unsigned int pageHeight = rows * cell;
+
+		AtlasPage page = {};
+		page.Width = pageWidth;
+		page.Height = pageHeight;
+		std::vector<unsigned int> packed;
+		std::vector<unsigned int> next;
+		for (const stbrp_rect& rect : rects)
+		{
+			if (!rect.was_packed)
+			{
+				next.push_back((unsigned int)rect.id);
+				continue;
+			}
+
+			const DecodedImage& top = (*items[rect.id].Layers[0])[0];
+			AtlasPlacement& placement = placements[rect.id];
+			placement.Packed = true;
+			placement.Page = (unsigned int)pages.size();
+			placement.X = (unsigned int)rect.x * cell + gutter;
+			placement.Y = (unsigned int)rect.y * cell + gutter;
+			placement.Width = top.Width;
+			placement.Height = top.Height;
+			placement.ScaleU = (float)top.Width / pageWidth;
+			placement.ScaleV = (float)top.Height / pageHeight;
+			placement.OffsetU = (float)placement.X / pageWidth;
+			placement.OffsetV = (float)placement.Y / pageHeight;
+			packed.push_back((unsigned int)rect.id);
+
+			page.Items++;
+			page.ItemTexels += (uint64_t)top.Width * top.Height;
+			page.PaddedTexels += (uint64_t)rect.w * rect.h * cell * cell;
+		}
+		if (packed.empty())
+			break;
+
+		// Each level of each item (with its gutter) is copied in from
+		// that item's own level, so items are jobs of their own
+		page.Layers.resize(reference->Layers.size());
+		for (size_t layer = 0; layer < page.Layers.size(); layer++)
+		{
+			unsigned int channels = (*reference->Layers[layer])[0].Channels;
+			page.Layers[layer].resize(levels);
+			for (unsigned int level = 0; level < levels; level++)
+			{
+				DecodedImage& image = page.Layers[layer][level];
+				image.Width = pageWidth >> level;
+				image.Height = pageHeight >> level;
+				image.Channels = channels;
+				image.Pixels.assign((size_t)image.Width * image.Height * channels, 0);
+			}
+		}
+
+		JobSystem::GetInstance().ParallelFor((unsigned int)packed.size(), [&](unsigned int start, unsigned int end)
+		{
+			for (unsigned int i = start; i < end; i++)
+			{
+				const AtlasPlacement& placement = placements[packed[i]];
+				const AtlasItem& item = items[packed[i]];
+				for (size_t layer = 0; layer < page.Layers.size(); layer++)
+				{
+					for (unsigned int level = 0; level < levels; level++)
+					{
+						const DecodedImage& source = (*item.Layers[layer])[level];
+						DecodedImage& destination = page.Layers[layer][level];
+						unsigned int channels = destination.Channels;
+
+						// The padded cells, and the item's corner, at this level
+						int left = (int)((placement.X - gutter) >> level);
+						int top = (int)((placement.Y - gutter) >> level);
+						int right = (int)((((placement.X + placement.Width + gutter + cell - 1) / cell) * cell) >> level);
+						int bottom = (int)((((placement.Y + placement.Height + gutter + cell - 1) / cell) * cell) >> level);
+						int itemX = (int)(placement.X >> level);
+						int itemY = (int)(placement.Y >> level);
+						int width = (int)source.Width;
+						int height = (int)source.Height;
+
+						for (int y = top; y < bottom; y++)
+						{
+							int row = y - itemY;
+							row = settings.Wrap ? ((row % height) + height) % height : std::min(std::max(row, 0), height - 1);
+							unsigned char* out = &destination.Pixels[((size_t)y * destination.Width + left) * channels];
+							for (int x = left; x < right; x++, out += channels)
+							{
+								int column = x - itemX;
+								column = settings.Wrap ? ((column % width) + width) % width : std::min(std::max(column, 0), width - 1);
+								memcpy(out, &source.Pixels[((size_t)row * width + column) * channels], channels);
+							}
+						}
+					}
+				}
+			}
+		}, 1);
+
+		pages.push_back(std::move(page));
+		remaining.swap(next);
+	}
+	return !pages.empty();
+}
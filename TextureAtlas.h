@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "PNGDecoder.h"
+
+struct AtlasSettings
+{
+	unsigned int Size = 2048;		// Width and height of a full page (the last one shrinks to fit)
+	unsigned int MaxItemSize = 256;	// Anything wider or taller keeps its own textures
+	unsigned int MaxLevels = 4;		// Mips kept in the pages (each one costs gutter)
+	unsigned int Gutter = 2;		// Texels of padding round each item, at every level
+	bool BlockAligned = true;		// Items start on 4x4 blocks at every level, for compression
+	bool Wrap = true;				// Gutters repeat the far edge (false = stretch the near one)
+};
+
+// Something to pack, usually a material: one mip chain per layer (albedo,
+// normals, etc.), all the same size, which share a place in every layer
+struct AtlasItem
+{
+	std::vector<const std::vector<DecodedImage>*> Layers;
+};
+
+// Where an item ended up.  Sampling a page at uv * Scale + Offset (for uv
+// in [0, 1]) reads the item as if it were its own texture.
+struct AtlasPlacement
+{
+	bool Packed;				// False when too big, or the layers don't match the others
+	unsigned int Page;
+	unsigned int X;				// Of the item itself (inside its gutter), in level 0 texels
+	unsigned int Y;
+	unsigned int Width;
+	unsigned int Height;
+	float ScaleU;
+	float ScaleV;
+	float OffsetU;
+	float OffsetV;
+};
+
+// One texture per layer, each a mip chain of GetLevelCount() levels
+struct AtlasPage
+{
+	unsigned int Width;			// Of level 0
+	unsigned int Height;
+	std::vector<std::vector<DecodedImage>> Layers;
+	unsigned int Items;
+	uint64_t ItemTexels;		// Level 0 texels of the items themselves
+	uint64_t PaddedTexels;		// Plus their gutters and alignment
+};
+
+// --------------------------------------------------------
+// Packs small textures into a few big ones (pages), so a
+// set of tiny materials costs a handful of resources and
+// one descriptor table instead of one of each per material.
+//
+// Rectangles are packed with stb_rect_pack (vendored with
+// ImGui), in cells of the alignment every kept level needs:
+// with L levels, an item's corner lands on a whole texel
+// (or 4x4 block) all the way down to level L-1, so no texel
+// or block ever holds two items.  Each level of a page is
+// filled from the items' own mips, not filtered from the
+// level above, and each item's gutter is redone at every
+// level from that level's texels.  So filtering at an
+// item's edge reads what sampling the item's own texture
+// would (wrapped or clamped), and neighbours never bleed
+// in at any distance.
+//
+// Mips past the page's last level aren't kept, since the
+// gutter they'd need at level 0 doubles with each one.
+// --------------------------------------------------------
+class TextureAtlas
+{
+public:
+	// Levels every page keeps: enough for the smallest item to still be a
+	// whole number of texels, up to the settings' maximum
+	static unsigned int GetLevelCount(const std::vector<AtlasItem>& items, const AtlasSettings& settings);
+
+	// Packs every item that fits into as many pages as it takes.  Layers
+	// must match the first packable item's (count and channels), and each
+	// chain needs at least GetLevelCount() levels.  Returns false if
+	// nothing could be packed.
+	static bool Build(const std::vector<AtlasItem>& items, const AtlasSettings& settings, std::vector<AtlasPage>& pages, std::vector<AtlasPlacement>& placements);
+};
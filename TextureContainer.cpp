@@ -0,0 +1,269 @@
+#include "TextureContainer.h"
+#include "FileStreams.h"
+#include "MipGenerator.h"
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define TEXTURE_CONTAINER_MAGIC 0x43584554		// "TEXC"
+
+TextureContainer::TextureContainer() :
+	data(0),
+	size(0),
+	width(0),
+	height(0),
+	format(BLOCK_FORMAT_NONE),
+	channels(0)
+{
+}
+
+template<typename T> static void AppendValue(std::vector<unsigned char>& data, const T& value)
+{
+	const unsigned char* bytes = (const unsigned char*)&value;
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T> static bool ReadValue(const unsigned char* data, size_t size, size_t& offset, T& value)
+{
+	if (size - offset < sizeof(T))
+		return false;
+	memcpy(&value, data + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+static uint64_t Checksum(const unsigned char* data, size_t size)
+{
+	PipelineKeyHasher hasher;
+	hasher.Add(data, size);
+	return hasher.GetHash();
+}
+
+static size_t AlignUp(size_t value)
+{
+	return (value + TEXTURE_CONTAINER_ALIGNMENT - 1) / TEXTURE_CONTAINER_ALIGNMENT * TEXTURE_CONTAINER_ALIGNMENT;
+}
+
+// The header, level table and table checksum, before the first level's data
+static size_t GetHeaderSize(size_t levelCount)
+{
+	return 4 * 2 + 8 + 4 * 5 + levelCount * (8 * 2 + 4 * 4 + 8) + 8;
+}
+
+void TextureContainer::Serialize(const std::vector<DecodedImage>& levels, uint64_t key, std::vector<unsigned char>& data)
+{
+	std::vector<TextureLevel> views;
+	for (const DecodedImage& level : levels)
+		views.push_back({ level.Width, level.Height, (size_t)level.Width * level.Channels, level.Pixels.size(), level.Pixels.data() });
+	Serialize(views, BLOCK_FORMAT_NONE, levels.empty() ? 0 : levels[0].Channels, key, data);
+}
+
+void TextureContainer::Serialize(const std::vector<CompressedImage>& levels, uint64_t key, std::vector<unsigned char>& data)
+{
+	std::vector<TextureLevel> views;
+	for (const CompressedImage& level : levels)
+	{
+		size_t rowPitch = BlockCompressor::GetCompressedSize(level.Width, 4, level.Format);
+		views.push_back({ level.Width, level.Height, rowPitch, level.Blocks.size(), level.Blocks.data() });
+	}
+	Serialize(views, levels.empty() ? BLOCK_FORMAT_NONE : levels[0].Format, 0, key, data);
+}
+
+
+// --------------------------------------------------------
+// Data goes in smallest level first, each level starting
+// on an aligned offset, then the table is filled in and
+// checksummed
+// --------------------------------------------------------
+void TextureContainer::Serialize(const std::vector<TextureLevel>& levels, BlockFormat format, unsigned int channels, uint64_t key, std::vector<unsigned char>& data)
+{
+	std::vector<uint64_t> offsets(levels.size());
+	size_t end = AlignUp(GetHeaderSize(levels.size()));
+	for (size_t i = levels.size(); i-- > 0;)
+	{
+		offsets[i] = end;
+		end = AlignUp(end + levels[i].Size);
+	}
+
+	data.clear();
+	data.reserve(end);
+	AppendValue(data, (uint32_t)TEXTURE_CONTAINER_MAGIC);
+	AppendValue(data, (uint32_t)TEXTURE_CONTAINER_VERSION);
+	AppendValue(data, key);
+	AppendValue(data, (uint32_t)(levels.empty() ? 0 : levels[0].Width));
+	AppendValue(data, (uint32_t)(levels.empty() ? 0 : levels[0].Height));
+	AppendValue(data, (uint32_t)format);
+	AppendValue(data, (uint32_t)channels);
+	AppendValue(data, (uint32_t)levels.size());
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		AppendValue(data, offsets[i]);
+		AppendValue(data, (uint64_t)levels[i].Size);
+		AppendValue(data, (uint32_t)levels[i].Width);
+		AppendValue(data, (uint32_t)levels[i].Height);
+		AppendValue(data, (uint32_t)levels[i].RowPitch);
+		AppendValue(data, (uint32_t)0);
+		AppendValue(data, Checksum(levels[i].Data, levels[i].Size));
+	}
+	AppendValue(data, Checksum(data.data(), data.size()));
+
+	data.resize(end, 0);
+	for (size_t i = 0; i < levels.size(); i++)
+		memcpy(data.data() + offsets[i], levels[i].Data, levels[i].Size);
+}
+
+bool TextureContainer::Save(const std::wstring& path, const std::vector<DecodedImage>& levels, uint64_t key)
+{
+	std::vector<unsigned char> data;
+	Serialize(levels, key, data);
+	return WriteWholeFile(path, data.data(), data.size());
+}
+
+bool TextureContainer::Save(const std::wstring& path, const std::vector<CompressedImage>& levels, uint64_t key)
+{
+	std::vector<unsigned char> data;
+	Serialize(levels, key, data);
+	return WriteWholeFile(path, data.data(), data.size());
+}
+
+bool TextureContainer::Open(const std::wstring& path, uint64_t key)
+{
+	Close();
+	if (!file.Open(path))
+		return false;
+
+	data = file.GetData();
+	size = file.GetSize();
+	if (!Parse(key))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool TextureContainer::Open(const unsigned char* data, size_t size, uint64_t key)
+{
+	Close();
+	this->data = data;
+	this->size = size;
+	if (!data || !Parse(key))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void TextureContainer::Close()
+{
+	file.Close();
+	data = 0;
+	size = 0;
+	width = 0;
+	height = 0;
+	format = BLOCK_FORMAT_NONE;
+	channels = 0;
+	levels.clear();
+}
+
+
+// --------------------------------------------------------
+// Only accepts a chain for this key whose table passes its
+// checksum and whose levels are the sizes their format
+// says, in order, inside the file.  Only the header pages
+// are read here.
+// --------------------------------------------------------
+bool TextureContainer::Parse(uint64_t key)
+{
+	size_t offset = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t fileKey = 0;
+	uint32_t fileFormat = 0;
+	uint32_t levelCount = 0;
+	if (!ReadValue(data, size, offset, magic) || magic != TEXTURE_CONTAINER_MAGIC ||
+		!ReadValue(data, size, offset, version) || version != TEXTURE_CONTAINER_VERSION ||
+		!ReadValue(data, size, offset, fileKey) || fileKey != key ||
+		!ReadValue(data, size, offset, width) ||
+		!ReadValue(data, size, offset, height) ||
+		!ReadValue(data, size, offset, fileFormat) ||
+		!ReadValue(data, size, offset, channels) ||
+		!ReadValue(data, size, offset, levelCount))
+		return false;
+
+	format = (BlockFormat)fileFormat;
+	if (width == 0 || height == 0 || width > 65536 || height > 65536 || fileFormat > BLOCK_FORMAT_BC7 ||
+		(format == BLOCK_FORMAT_NONE ? (channels != 1 && channels != 4) : channels != 0) ||
+		levelCount == 0 || levelCount > MipGenerator::GetMipCount(width, height))
+		return false;
+
+	size_t headerSize = GetHeaderSize(levelCount);
+	if (size < headerSize)
+		return false;
+
+	levels.resize(levelCount);
+	uint64_t dataEnd = size;
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		LevelEntry& level = levels[i];
+		uint32_t padding = 0;
+		ReadValue(data, size, offset, level.Offset);
+		ReadValue(data, size, offset, level.Size);
+		ReadValue(data, size, offset, level.Width);
+		ReadValue(data, size, offset, level.Height);
+		ReadValue(data, size, offset, level.RowPitch);
+		ReadValue(data, size, offset, padding);
+		ReadValue(data, size, offset, level.Checksum);
+
+		uint32_t levelWidth = std::max(1u, width >> i);
+		uint32_t levelHeight = std::max(1u, height >> i);
+		uint64_t rowPitch = format == BLOCK_FORMAT_NONE ? (uint64_t)levelWidth * channels : BlockCompressor::GetCompressedSize(levelWidth, 4, format);
+		uint64_t levelSize = format == BLOCK_FORMAT_NONE ? rowPitch * levelHeight : BlockCompressor::GetCompressedSize(levelWidth, levelHeight, format);
+		if (level.Width != levelWidth || level.Height != levelHeight || level.RowPitch != rowPitch || level.Size != levelSize ||
+			level.Offset % TEXTURE_CONTAINER_ALIGNMENT != 0 || level.Offset < headerSize || level.Offset > dataEnd || level.Size > dataEnd - level.Offset)
+			return false;
+
+		// Each level sits before the larger one, after the smaller ones
+		dataEnd = level.Offset;
+	}
+
+	uint64_t checksum = 0;
+	size_t tableEnd = offset;
+	ReadValue(data, size, offset, checksum);
+	return checksum == Checksum(data, tableEnd);
+}
+
+TextureLevel TextureContainer::GetLevel(unsigned int level) const
+{
+	TextureLevel view = {};
+	if (level >= levels.size())
+		return view;
+
+	const LevelEntry& entry = levels[level];
+	view.Width = entry.Width;
+	view.Height = entry.Height;
+	view.RowPitch = entry.RowPitch;
+	view.Size = (size_t)entry.Size;
+	view.Data = data + entry.Offset;
+	return view;
+}
+
+bool TextureContainer::VerifyLevel(unsigned int level) const
+{
+	if (level >= levels.size())
+		return false;
+	return Checksum(data + levels[level].Offset, (size_t)levels[level].Size) == levels[level].Checksum;
+}
+
+void TextureContainer::Prefetch(unsigned int first, unsigned int last) const
+{
+	if (first > last || last >= levels.size())
+		return;
+
+	// The larger level comes later in the file
+	size_t start = (size_t)levels[last].Offset;
+	size_t end = (size_t)(levels[first].Offset + levels[first].Size);
+	file.Prefetch(start, end - start);
+}
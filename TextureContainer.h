@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BlockCompressor.h"
+#include "MappedFile.h"
+#include "PNGDecoder.h"
+
+// Bump when the file layout changes, so old containers are rebuilt
+#define TEXTURE_CONTAINER_VERSION 1
+
+// Level data starts on this boundary in the file (D3D12's placement
+// alignment for texture copies), so uploads can read it in place
+#define TEXTURE_CONTAINER_ALIGNMENT 512
+
+// One mip level's data, wherever it lives
+struct TextureLevel
+{
+	unsigned int Width;
+	unsigned int Height;
+	size_t RowPitch;			// Bytes per row of texels (or of 4x4 blocks)
+	size_t Size;
+	const unsigned char* Data;
+};
+
+// --------------------------------------------------------
+// A texture's finished mip chain in one file, either as
+// decoded pixels or as blocks, laid out so it can be
+// mapped and uploaded without being parsed or copied.
+//
+// The header and level table come first (with their own
+// checksum, checked on open).  Level data follows, smallest
+// level first, so the tail of the chain a texture always
+// needs is one short read from the front of the file and
+// the big levels are only touched if they're streamed in.
+// Each level has its own checksum too, checked only when
+// asked, since that means reading the whole level.
+//
+// File format (little endian):
+//   Magic, version (uint32 each), key (uint64), width,
+//   height, format, channels, level count (uint32 each),
+//   then per level (largest first): offset, size (uint64
+//   each), width, height, row pitch, 0 (uint32 each),
+//   checksum (uint64), then a checksum of all of the above
+//   (uint64), then each level's data at its offset
+// --------------------------------------------------------
+class TextureContainer
+{
+public:
+	TextureContainer();
+
+	static void Serialize(const std::vector<DecodedImage>& levels, uint64_t key, std::vector<unsigned char>& data);
+	static void Serialize(const std::vector<CompressedImage>& levels, uint64_t key, std::vector<unsigned char>& data);
+	static bool Save(const std::wstring& path, const std::vector<DecodedImage>& levels, uint64_t key);
+	static bool Save(const std::wstring& path, const std::vector<CompressedImage>& levels, uint64_t key);
+
+	// Maps the file (or uses the memory, which must outlive the container)
+	// and checks its header against the key
+	bool Open(const std::wstring& path, uint64_t key);
+	bool Open(const unsigned char* data, size_t size, uint64_t key);
+	void Close();
+	bool IsOpen() const { return data != 0; }
+
+	unsigned int GetWidth() const { return width; }
+	unsigned int GetHeight() const { return height; }
+	unsigned int GetLevelCount() const { return (unsigned int)levels.size(); }
+	BlockFormat GetFormat() const { return format; }
+	unsigned int GetChannels() const { return channels; }		// 0 when compressed
+
+	// Points into the file; nothing is read until the data is touched
+	TextureLevel GetLevel(unsigned int level) const;
+
+	// Reads the whole level and checks it against its checksum
+	bool VerifyLevel(unsigned int level) const;
+
+	// Hints that levels first through last (inclusive) will be read soon
+	void Prefetch(unsigned int first, unsigned int last) const;
+
+private:
+	struct LevelEntry
+	{
+		uint64_t Offset;
+		uint64_t Size;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t RowPitch;
+		uint64_t Checksum;
+	};
+
+	MappedFile file;
+	const unsigned char* data;
+	size_t size;
+	unsigned int width;
+	unsigned int height;
+	BlockFormat format;
+	unsigned int channels;
+	std::vector<LevelEntry> levels;
+
+	bool Parse(uint64_t key);
+	static void Serialize(const std::vector<TextureLevel>& levels, BlockFormat format, unsigned int channels, uint64_t key, std::vector<unsigned char>& data);
+};
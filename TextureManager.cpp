@@ -0,0 +1,378 @@
+#include "TextureManager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "FileStreams.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+
+bool FileTextureSource::Read(const std::wstring& path, std::vector<unsigned char>& data)
+{
+	return ReadWholeFile(path, data);
+}
+
+TextureManager::TextureManager() :
+	source(&fileSource),
+	compress(false),
+	blockQuality(BLOCK_QUALITY_NORMAL),
+	firstPending(0),
+	requests(0),
+	loads(0),
+	mipChains(0),
+	lastReadMs(0),
+	lastDecodeMs(0),
+	lastMipMs(0),
+	lastCompressMs(0),
+	gpuBytes(0),
+	uncompressedBytes(0)
+{
+}
+
+void TextureManager::Initialize(TextureSource* source)
+{
+	this->source = source ? source : &fileSource;
+}
+
+void TextureManager::SetBlockCompression(bool enabled, BlockQuality quality)
+{
+	compress = enabled;
+	blockQuality = quality;
+}
+
+unsigned int TextureManager::Request(const std::wstring& path, bool generateMips)
+{
+	requests++;
+
+	// Too late for mips once it's loaded
+	std::wstring key = NormalizePath(path);
+	auto existing = texturesByPath.find(key);
+	if (existing != texturesByPath.end())
+	{
+		if (existing->second >= firstPending && generateMips)
+			textures[existing->second].GenerateMips = true;
+		return existing->second;
+	}
+
+	unsigned int texture = (unsigned int)textures.size();
+	Texture added = {};
+	added.Path = path;
+	added.State = TEXTURE_LOAD_PENDING;
+	added.Owner = texture;
+	added.GenerateMips = generateMips;
+	added.Format = BLOCK_FORMAT_NONE;
+	textures.push_back(std::move(added));
+	texturesByPath[key] = texture;
+	return texture;
+}
+
+
+// --------------------------------------------------------
+// Reads and hashes every new file on the job system, finds
+// which contents have been seen before, then decodes the
+// rest on the job system.  Files are kept only until their
+// contents are matched or decoded.  Finished chains are
+// mapped from the cache if they're there; otherwise they're
+// generated and compressed a texture at a time (each one
+// spread across the job system, which can't run two loops
+// at once), saved, and mapped back in place of the copies
+// in memory.
+// --------------------------------------------------------
+void TextureManager::LoadPending()
+{
+	if (!HasPending())
+		return;
+
+	typedef std::chrono::high_resolution_clock Clock;
+	size_t first = firstPending;
+	firstPending = textures.size();
+	loads++;
+
+	auto start = Clock::now();
+	JobSystem::GetInstance().ParallelFor((unsigned int)(textures.size() - first), [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Texture& texture = textures[first + i];
+			if (!source->Read(texture.Path, texture.FileData))
+			{
+				texture.State = TEXTURE_LOAD_MISSING;
+				std::vector<unsigned char>().swap(texture.FileData);
+				continue;
+			}
+
+			PipelineKeyHasher hasher;
+			hasher.Add(texture.FileData.data(), texture.FileData.size());
+			texture.ContentHash = hasher.GetHash();
+		}
+	});
+	auto afterRead = Clock::now();
+
+	// Files that match an earlier one share it.  Bytes are compared
+	// while both are around; against earlier loads, the hash has to do.
+	std::vector<unsigned int> owners;
+	for (size_t i = first; i < textures.size(); i++)
+	{
+		Texture& texture = textures[i];
+		if (texture.State == TEXTURE_LOAD_MISSING)
+			continue;
+
+		auto match = ownersByContent.find(texture.ContentHash);
+		if (match == ownersByContent.end())
+			ownersByContent[texture.ContentHash] = (unsigned int)i;
+		else if (textures[match->second].FileData.empty() || textures[match->second].FileData == texture.FileData)
+		{
+			texture.Owner = match->second;
+			if (texture.Owner >= first && texture.GenerateMips)
+				textures[texture.Owner].GenerateMips = true;
+			std::vector<unsigned char>().swap(texture.FileData);
+			continue;
+		}
+		owners.push_back((unsigned int)i);
+	}
+
+	JobSystem::GetInstance().ParallelFor((unsigned int)owners.size(), [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Texture& texture = textures[owners[i]];
+			if (!cacheDirectory.empty())
+			{
+				std::unique_ptr<TextureContainer> container(new TextureContainer());
+				if (container->Open(GetContainerPath(texture), GetContainerKey(texture)))
+				{
+					texture.Container = std::move(container);
+					texture.Format = texture.Container->GetFormat();
+					texture.MipCacheHit = texture.GenerateMips;
+					texture.BlockCacheHit = texture.Format != BLOCK_FORMAT_NONE;
+				}
+			}
+
+			bool decoded = texture.Container != nullptr;
+			if (!decoded)
+			{
+				texture.Levels.resize(1);
+				decoded = PNGDecoder::Decode(texture.FileData.data(), texture.FileData.size(), texture.Levels[0]);
+			}
+			texture.State = decoded ? TEXTURE_LOAD_DECODED : TEXTURE_LOAD_UNDECODED;
+			if (!decoded)
+				texture.Levels.clear();
+			std::vector<unsigned char>().swap(texture.FileData);
+		}
+	});
+	auto afterDecode = Clock::now();
+
+	std::vector<unsigned int> generated;
+	for (unsigned int owner : owners)
+	{
+		Texture& texture = textures[owner];
+		if (!texture.GenerateMips || texture.Container || texture.State != TEXTURE_LOAD_DECODED)
+			continue;
+
+		DecodedImage top = std::move(texture.Levels[0]);
+		MipGenerator::Generate(top, MipGenerator::GetSettingsForPath(texture.Path), texture.Levels);
+		generated.push_back(owner);
+	}
+	mipChains += (unsigned int)generated.size();
+	auto afterMips = Clock::now();
+
+	std::vector<unsigned int> compressed;
+	for (unsigned int owner : owners)
+	{
+		Texture& texture = textures[owner];
+		if (!compress || texture.Container || texture.State != TEXTURE_LOAD_DECODED || !BlockCompressor::CanCompress(texture.Levels[0]))
+			continue;
+
+		texture.Format = BlockCompressor::GetFormatForPath(texture.Path, blockQuality);
+		texture.Blocks.resize(texture.Levels.size());
+		for (size_t level = 0; level < texture.Levels.size(); level++)
+			BlockCompressor::Compress(texture.Levels[level], texture.Format, blockQuality, texture.Blocks[level]);
+		compressed.push_back(owner);
+	}
+
+	// Drop the pixels that blocks replaced, then save what was made and
+	// map it back, dropping the copies in memory too
+	for (unsigned int owner : compressed)
+		std::vector<DecodedImage>().swap(textures[owner].Levels);
+	if (!cacheDirectory.empty())
+	{
+		JobSystem::GetInstance().ParallelFor((unsigned int)owners.size(), [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Texture& texture = textures[owners[i]];
+				if (texture.Container || texture.State != TEXTURE_LOAD_DECODED)
+					continue;
+
+				std::wstring path = GetContainerPath(texture);
+				uint64_t key = GetContainerKey(texture);
+				bool saved = texture.Blocks.empty() ? TextureContainer::Save(path, texture.Levels, key) : TextureContainer::Save(path, texture.Blocks, key);
+				std::unique_ptr<TextureContainer> container(new TextureContainer());
+				if (saved && container->Open(path, key))
+				{
+					texture.Container = std::move(container);
+					std::vector<DecodedImage>().swap(texture.Levels);
+					std::vector<CompressedImage>().swap(texture.Blocks);
+				}
+			}
+		});
+	}
+
+	// BC4 stands in for R8; everything else for RGBA8
+	for (unsigned int owner : owners)
+	{
+		TextureLevel level = {};
+		for (unsigned int i = 0; GetLevel(owner, i, level); i++)
+		{
+			gpuBytes += level.Size;
+			if (textures[owner].Format == BLOCK_FORMAT_NONE)
+				uncompressedBytes += level.Size;
+			else
+				uncompressedBytes += (uint64_t)level.Width * level.Height * (textures[owner].Format == BLOCK_FORMAT_BC4 ? 1 : 4);
+		}
+	}
+	auto afterCompress = Clock::now();
+
+	for (size_t i = first; i < textures.size(); i++)
+	{
+		if (textures[i].Owner != i)
+			textures[i].State = textures[textures[i].Owner].State;
+	}
+
+	lastReadMs = std::chrono::duration<double, std::milli>(afterRead - start).count();
+	lastDecodeMs = std::chrono::duration<double, std::milli>(afterDecode - afterRead).count();
+	lastMipMs = std::chrono::duration<double, std::milli>(afterMips - afterDecode).count();
+	lastCompressMs = std::chrono::duration<double, std::milli>(afterCompress - afterMips).count();
+}
+
+const DecodedImage* TextureManager::GetImage(unsigned int texture, unsigned int level) const
+{
+	const Texture& owner = textures[textures[texture].Owner];
+	if (owner.State != TEXTURE_LOAD_DECODED || level >= owner.Levels.size())
+		return 0;
+	return &owner.Levels[level];
+}
+
+const CompressedImage* TextureManager::GetCompressedImage(unsigned int texture, unsigned int level) const
+{
+	const Texture& owner = textures[textures[texture].Owner];
+	if (owner.State != TEXTURE_LOAD_DECODED || level >= owner.Blocks.size())
+		return 0;
+	return &owner.Blocks[level];
+}
+
+unsigned int TextureManager::GetLevelCount(unsigned int texture) const
+{
+	const Texture& owner = textures[textures[texture].Owner];
+	if (owner.Container)
+		return owner.Container->GetLevelCount();
+	return (unsigned int)(owner.Blocks.empty() ? owner.Levels.size() : owner.Blocks.size());
+}
+
+bool TextureManager::GetLevel(unsigned int texture, unsigned int level, TextureLevel& data) const
+{
+	const Texture& owner = textures[textures[texture].Owner];
+	if (owner.State != TEXTURE_LOAD_DECODED || level >= GetLevelCount(texture))
+		return false;
+
+	if (owner.Container)
+		data = owner.Container->GetLevel(level);
+	else if (!owner.Blocks.empty())
+	{
+		const CompressedImage& blocks = owner.Blocks[level];
+		data = { blocks.Width, blocks.Height, BlockCompressor::GetCompressedSize(blocks.Width, 4, blocks.Format), blocks.Blocks.size(), blocks.Blocks.data() };
+	}
+	else
+	{
+		const DecodedImage& image = owner.Levels[level];
+		data = { image.Width, image.Height, (size_t)image.Width * image.Channels, image.Pixels.size(), image.Pixels.data() };
+	}
+	return true;
+}
+
+unsigned int TextureManager::GetChannels(unsigned int texture) const
+{
+	const Texture& owner = textures[textures[texture].Owner];
+	if (owner.Container)
+		return owner.Container->GetChannels();
+	return owner.Levels.empty() ? 0 : owner.Levels[0].Channels;
+}
+
+void TextureManager::ReleaseImage(unsigned int texture)
+{
+	Texture& owner = textures[textures[texture].Owner];
+	std::vector<DecodedImage>().swap(owner.Levels);
+	std::vector<CompressedImage>().swap(owner.Blocks);
+}
+
+TextureLoadStats TextureManager::GetStats() const
+{
+	TextureLoadStats stats = {};
+	stats.Requests = requests;
+	stats.Textures = (unsigned int)textures.size();
+	for (unsigned int i = 0; i < textures.size(); i++)
+	{
+		const Texture& texture = textures[i];
+		if (texture.Owner != i)
+			stats.SharedContents++;
+		else if (texture.State == TEXTURE_LOAD_DECODED)
+			stats.Decoded++;
+
+		if (texture.State == TEXTURE_LOAD_UNDECODED)
+			stats.Undecoded++;
+		else if (texture.State == TEXTURE_LOAD_MISSING)
+			stats.Missing++;
+
+		if (texture.MipCacheHit)
+			stats.MipCacheHits++;
+		if (texture.BlockCacheHit)
+			stats.BlockCacheHits++;
+		if (texture.Owner == i && texture.Format != BLOCK_FORMAT_NONE)
+			stats.Compressed++;
+		if (texture.Container)
+			stats.Mapped++;
+	}
+	stats.MipChains = mipChains;
+	stats.LastMipMs = lastMipMs;
+	stats.LastCompressMs = lastCompressMs;
+	stats.GPUBytes = gpuBytes;
+	stats.UncompressedBytes = uncompressedBytes;
+	stats.Loads = loads;
+	stats.LastReadMs = lastReadMs;
+	stats.LastDecodeMs = lastDecodeMs;
+	return stats;
+}
+
+// The contents, then the mip settings and block format applied to them,
+// so edited files (or changed settings) get a new container
+uint64_t TextureManager::GetContainerKey(const Texture& texture) const
+{
+	uint64_t key = texture.ContentHash;
+	if (texture.GenerateMips)
+		key = MipGenerator::GetCacheKey(texture.ContentHash, MipGenerator::GetSettingsForPath(texture.Path));
+	if (compress)
+		key = BlockCompressor::GetCacheKey(key, BlockCompressor::GetFormatForPath(texture.Path, blockQuality), blockQuality);
+
+	PipelineKeyHasher hasher;
+	hasher.AddValue(key);
+	hasher.AddValue((uint32_t)TEXTURE_CONTAINER_VERSION);
+	return hasher.GetHash();
+}
+
+std::wstring TextureManager::GetContainerPath(const Texture& texture) const
+{
+	wchar_t name[32];
+	swprintf(name, 32, L"%016llx.tex", (unsigned long long)GetContainerKey(texture));
+	return cacheDirectory + name;
+}
+
+// Paths differing only in case or slash direction are the same file
+std::wstring TextureManager::NormalizePath(const std::wstring& path)
+{
+	std::wstring key = path;
+	for (wchar_t& c : key)
+		c = c == L'/' ? L'\\' : (wchar_t)towlower(c);
+	return key;
+}
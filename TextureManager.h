@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockCompressor.h"
+#include "MipGenerator.h"
+#include "PNGDecoder.h"
+#include "TextureContainer.h"
+
+// --------------------------------------------------------
+// Where texture files come from.  Read() is called from
+// worker threads, so it mustn't touch shared state.
+// --------------------------------------------------------
+class TextureSource
+{
+public:
+	virtual ~TextureSource() {}
+
+	virtual bool Read(const std::wstring& path, std::vector<unsigned char>& data) = 0;
+};
+
+// Reads files from disk
+class FileTextureSource : public TextureSource
+{
+public:
+	bool Read(const std::wstring& path, std::vector<unsigned char>& data) override;
+};
+
+enum TextureLoadState
+{
+	TEXTURE_LOAD_PENDING,		// Requested, not loaded yet
+	TEXTURE_LOAD_DECODED,		// Pixels ready (here or in its content owner)
+	TEXTURE_LOAD_UNDECODED,		// Read, but not something the PNG decoder handles
+	TEXTURE_LOAD_MISSING		// Couldn't be read
+};
+
+struct TextureLoadStats
+{
+	unsigned int Requests;			// Every Request() call
+	unsigned int Textures;			// Distinct paths
+	unsigned int Decoded;			// Distinct contents, decoded once each
+	unsigned int SharedContents;	// Paths whose contents matched another path's
+	unsigned int Undecoded;
+	unsigned int Missing;
+	unsigned int Loads;				// LoadPending() calls that had work
+	double LastReadMs;				// Reading and hashing, on the pool
+	double LastDecodeMs;			// Decoding, on the pool
+	unsigned int MipChains;			// Generated on the CPU
+	unsigned int MipCacheHits;		// Came from a cached container instead
+	double LastMipMs;				// Generating chains
+	unsigned int Compressed;		// Block compressed (including cache hits)
+	unsigned int BlockCacheHits;	// Compressed blocks in a cached container
+	unsigned int Mapped;			// Owners whose levels are in a mapped container
+	double LastCompressMs;			// Compressing (and saving the cache)
+	uint64_t GPUBytes;				// Every owner's levels, as uploaded
+	uint64_t UncompressedBytes;		// The same, if nothing were compressed
+};
+
+// --------------------------------------------------------
+// Turns texture requests into decoded pixels, once per file
+// and once per distinct file contents.
+//
+// Request() is cheap: it hands back the same id for the same
+// path (ignoring case and slash direction), so materials can
+// ask for the textures they use without caring who else
+// does.  LoadPending() then reads and hashes every new file,
+// and decodes each distinct content, in parallel across the
+// job system.  Textures whose files are byte-for-byte the
+// same as an earlier one's share its pixels (its "content
+// owner"), so only the owner needs a GPU resource.
+//
+// Textures that want mips get a full chain built on the CPU
+// (see MipGenerator).  With block compression on, every
+// level is then compressed (see BlockCompressor).  The
+// finished chain is cached on disk by content, in a
+// container that's then mapped rather than kept in memory
+// (see TextureContainer), so later launches map it straight
+// away without decoding anything, and levels are only read
+// from disk when they're uploaded.
+// --------------------------------------------------------
+class TextureManager
+{
+public:
+	TextureManager();
+
+	// Files are read from disk unless a source is given
+	void Initialize(TextureSource* source = 0);
+
+	// Where finished chains are cached (no caching, or mapping, until
+	// this is set)
+	void SetCacheDirectory(const std::wstring& directory) { cacheDirectory = directory; }
+
+	// Compresses textures loaded from now on, in the format their names
+	// pick (see BlockCompressor::GetFormatForPath)
+	void SetBlockCompression(bool enabled, BlockQuality quality = BLOCK_QUALITY_NORMAL);
+
+	// Mips are made if any request of the path (or its contents) wants them
+	unsigned int Request(const std::wstring& path, bool generateMips = false);
+	bool HasPending() const { return firstPending < textures.size(); }
+
+	// Reads and decodes everything requested since last time
+	void LoadPending();
+
+	unsigned int GetTextureCount() const { return (unsigned int)textures.size(); }
+	const std::wstring& GetPath(unsigned int texture) const { return textures[texture].Path; }
+	TextureLoadState GetState(unsigned int texture) const { return textures[texture].State; }
+
+	// The first texture with the same contents (itself, if none before)
+	unsigned int GetContentOwner(unsigned int texture) const { return textures[texture].Owner; }
+
+	// The owner's pixels for a mip level, or null if they're not
+	// decoded (or were released)
+	const DecodedImage* GetImage(unsigned int texture, unsigned int level = 0) const;
+	unsigned int GetLevelCount(unsigned int texture) const;
+	bool GetGenerateMips(unsigned int texture) const { return textures[textures[texture].Owner].GenerateMips; }
+
+	// The owner's blocks for a mip level, or null if it isn't compressed
+	const CompressedImage* GetCompressedImage(unsigned int texture, unsigned int level = 0) const;
+
+	// The owner's data for a mip level, whether it's pixels, blocks or in
+	// a mapped container.  False if there's no such level (or it was released).
+	bool GetLevel(unsigned int texture, unsigned int level, TextureLevel& data) const;
+	BlockFormat GetFormat(unsigned int texture) const { return textures[textures[texture].Owner].Format; }
+	unsigned int GetChannels(unsigned int texture) const;
+
+	// Mapped levels can still be read after ReleaseImage(), so they can be
+	// streamed in later
+	bool IsMapped(unsigned int texture) const { return textures[textures[texture].Owner].Container != nullptr; }
+
+	// Frees the owner's pixels or blocks (every level) once they're
+	// uploaded.  A mapped container stays mapped.
+	void ReleaseImage(unsigned int texture);
+
+	TextureLoadStats GetStats() const;
+
+private:
+	struct Texture
+	{
+		std::wstring Path;
+		TextureLoadState State;
+		unsigned int Owner;
+		uint64_t ContentHash;
+		bool GenerateMips;
+		bool MipCacheHit;
+		bool BlockCacheHit;
+		BlockFormat Format;						// None unless compressed
+		std::vector<unsigned char> FileData;	// Only while loading
+		std::vector<DecodedImage> Levels;		// Only in owners (just the top without mips)
+		std::vector<CompressedImage> Blocks;	// Replaces the levels when compressed
+		std::unique_ptr<TextureContainer> Container;	// Replaces both once cached
+	};
+
+	FileTextureSource fileSource;
+	TextureSource* source;
+	std::wstring cacheDirectory;
+	bool compress;
+	BlockQuality blockQuality;
+
+	std::vector<Texture> textures;
+	std::unordered_map<std::wstring, unsigned int> texturesByPath;
+	std::unordered_map<uint64_t, unsigned int> ownersByContent;
+	size_t firstPending;
+
+	unsigned int requests;
+	unsigned int loads;
+	unsigned int mipChains;
+	double lastReadMs;
+	double lastDecodeMs;
+	double lastMipMs;
+	double lastCompressMs;
+	uint64_t gpuBytes;
+	uint64_t uncompressedBytes;
+
+	uint64_t GetContainerKey(const Texture& texture) const;
+	std::wstring GetContainerPath(const Texture& texture) const;
+	static std::wstring NormalizePath(const std::wstring& path);
+};
@@ -1,5 +1,7 @@
 #include "Transform.h"
 
+#include <cstring>
+
 using namespace DirectX;
 
 
@@ -7,15 +9,17 @@ Transform::Transform() :
 	position(0, 0, 0),
 	pitchYawRoll(0, 0, 0),
 	scale(1, 1, 1),
+	vectorsDirty(false),
 	up(0, 1, 0),
 	right(1, 0, 0),
 	forward(0, 0, 1),
 	matricesDirty(false),
-	vectorsDirty(false)
+	previousWorldMatrixVersion(0)
 {
 	// Start with an identity matrix and basic transform data
 	XMStoreFloat4x4(&worldMatrix, XMMatrixIdentity());
 	XMStoreFloat4x4(&worldInverseTransposeMatrix, XMMatrixIdentity());
+	XMStoreFloat4x4(&previousWorldMatrix, XMMatrixIdentity());
 }
 
 void Transform::MoveAbsolute(float x, float y, float z)
@@ -184,6 +188,26 @@ DirectX::XMFLOAT4X4 Transform::GetWorldInverseTransposeMatrix()
 	return worldMatrix;
 }
 
+void Transform::StorePreviousWorldMatrix()
+{
+	UpdateMatrices();
+	if (memcmp(&previousWorldMatrix, &worldMatrix, sizeof(XMFLOAT4X4)) == 0)
+		return;
+
+	previousWorldMatrix = worldMatrix;
+	previousWorldMatrixVersion++;
+}
+
+DirectX::XMFLOAT4X4 Transform::GetPreviousWorldMatrix()
+{
+	return previousWorldMatrix;
+}
+
+unsigned int Transform::GetPreviousWorldMatrixVersion()
+{
+	return previousWorldMatrixVersion;
+}
+
 void Transform::UpdateMatrices()
 {
 	// Anything to update?
@@ -41,6 +41,14 @@ public:
 	DirectX::XMFLOAT4X4 GetWorldMatrix();
 	DirectX::XMFLOAT4X4 GetWorldInverseTransposeMatrix();
 
+	// Last frame's world matrix, for motion vectors
+	// Call StorePreviousWorldMatrix() once per frame, before moving anything
+	void StorePreviousWorldMatrix();
+	DirectX::XMFLOAT4X4 GetPreviousWorldMatrix();
+
+	// Changes whenever the previous world matrix does
+	unsigned int GetPreviousWorldMatrixVersion();
+
 private:
 	// Raw transformation data
 	DirectX::XMFLOAT3 position;
@@ -57,6 +65,8 @@ private:
 	bool matricesDirty;
 	DirectX::XMFLOAT4X4 worldMatrix;
 	DirectX::XMFLOAT4X4 worldInverseTransposeMatrix;
+	DirectX::XMFLOAT4X4 previousWorldMatrix;
+	unsigned int previousWorldMatrixVersion;
 
 	// Helper to update both matrices if necessary
 	void UpdateMatrices();
@@ -0,0 +1,363 @@
+#include "Upscaler.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+// Relative depth change that halves (roughly) a tap's upscaling weight
+#define UPSCALER_DEPTH_SIGMA 0.05f
+
+// Neighbour pairs whose depths differ by more than this (relatively)
+// straddle an edge, so checkerboard holes aren't averaged across them
+#define UPSCALER_PAIR_DEPTH_THRESHOLD 0.1f
+
+static bool IsHit(const DenoiserPixel& pixel) { return pixel.InstanceID != DENOISER_INVALID_INSTANCE; }
+
+// --------------------------------------------------------
+// How much a tap belongs to the same surface as the
+// reference pixel: 0 across instance or hit/miss edges,
+// falling off with depth and normal differences otherwise
+// --------------------------------------------------------
+static float GuideWeight(const DenoiserPixel& tap, const DenoiserPixel& reference)
+{
+	if (IsHit(tap) != IsHit(reference))
+		return 0.0f;
+	if (!IsHit(reference))
+		return 1.0f;
+	if (tap.InstanceID != reference.InstanceID)
+		return 0.0f;
+
+	float depthWeight = expf(-fabsf(tap.Depth - reference.Depth) / (UPSCALER_DEPTH_SIGMA * reference.Depth + 0.0001f));
+	float nDot = std::max(
+		tap.Normal.x * reference.Normal.x +
+		tap.Normal.y * reference.Normal.y +
+		tap.Normal.z * reference.Normal.z, 0.0f);
+	nDot *= nDot;
+	nDot *= nDot;
+	nDot *= nDot;
+	return depthWeight * nDot;
+}
+
+// --------------------------------------------------------
+// Relative depth difference between two pixels, treating
+// different surfaces (or a hit and a miss) as an edge
+// --------------------------------------------------------
+static float PairDifference(const DenoiserPixel& a, const DenoiserPixel& b)
+{
+	if (IsHit(a) != IsHit(b) || a.InstanceID != b.InstanceID)
+		return FLT_MAX;
+	if (!IsHit(a))
+		return 0.0f;
+	return fabsf(a.Depth - b.Depth) / std::max(std::min(a.Depth, b.Depth), 0.0001f);
+}
+
+Upscaler::Upscaler() :
+	historyWidth(0),
+	historyHeight(0),
+	hasHistory(false)
+{
+}
+
+void Upscaler::Reset()
+{
+	hasHistory = false;
+}
+
+// --------------------------------------------------------
+// Size of the grid to trace for a given output size
+// --------------------------------------------------------
+void Upscaler::GetRenderSize(unsigned int outputWidth, unsigned int outputHeight, float renderScale, unsigned int& renderWidth, unsigned int& renderHeight)
+{
+	renderScale = std::min(std::max(renderScale, UPSCALER_MIN_RENDER_SCALE), 1.0f);
+	renderWidth = std::max((unsigned int)(outputWidth * renderScale + 0.5f), 1u);
+	renderHeight = std::max((unsigned int)(outputHeight * renderScale + 0.5f), 1u);
+}
+
+// --------------------------------------------------------
+// Resolves the checkerboard (if any), then scales up to the
+// output size (if needed)
+// --------------------------------------------------------
+void Upscaler::Upscale(
+	const DenoiserPixel* input,
+	unsigned int inputWidth,
+	unsigned int inputHeight,
+	DenoiserPixel* output,
+	unsigned int outputWidth,
+	unsigned int outputHeight,
+	const UpscalerSettings& settings,
+	unsigned int frameIndex)
+{
+	if (settings.Checkerboard)
+	{
+		ResolveCheckerboard(input, inputWidth, inputHeight, frameIndex);
+		input = resolved.data();
+	}
+	else
+	{
+		hasHistory = false;
+	}
+
+	SpatialUpscale(input, inputWidth, inputHeight, output, outputWidth, outputHeight, settings.EdgeAware);
+}
+
+// --------------------------------------------------------
+// Fills the pixels that weren't traced this frame.  History
+// is found through the motion vector of the closest traced
+// neighbour and clamped to the neighbours' color range, so
+// anything that changed can't ghost.  Without history, the
+// hole is averaged along the neighbour pair (horizontal or
+// vertical) that crosses the smaller depth change.
+// --------------------------------------------------------
+void Upscaler::ResolveCheckerboard(const DenoiserPixel* input, unsigned int width, unsigned int height, unsigned int frameIndex)
+{
+	if (width != historyWidth || height != historyHeight)
+	{
+		historyWidth = width;
+		historyHeight = height;
+		history.assign((size_t)width * height, DenoiserPixel{});
+		historySurfaces.assign((size_t)width * height, ReprojectionSurface{ 0.0f, XMFLOAT3(0, 0, 0), DENOISER_INVALID_INSTANCE });
+		hasHistory = false;
+	}
+	resolved.resize((size_t)width * height);
+
+	JobSystem::GetInstance().ParallelFor(height, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				size_t p = (size_t)y * width + x;
+				if (IsTraced(x, y, frameIndex))
+				{
+					resolved[p] = input[p];
+					continue;
+				}
+
+				// Left, right, up and down were all traced this frame
+				const DenoiserPixel* left = x > 0 ? &input[p - 1] : 0;
+				const DenoiserPixel* right = x + 1 < width ? &input[p + 1] : 0;
+				const DenoiserPixel* up = y > 0 ? &input[p - width] : 0;
+				const DenoiserPixel* down = y + 1 < height ? &input[p + width] : 0;
+				const DenoiserPixel* neighbours[4] = { left, right, up, down };
+
+				// The closest surface around the hole stands in for it
+				const DenoiserPixel* guide = 0;
+				XMFLOAT3 colorMin(FLT_MAX, FLT_MAX, FLT_MAX);
+				XMFLOAT3 colorMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for (const DenoiserPixel* n : neighbours)
+				{
+					if (!n)
+						continue;
+					if (!guide || (IsHit(*n) && (!IsHit(*guide) || n->Depth < guide->Depth)))
+						guide = n;
+					colorMin = XMFLOAT3(std::min(colorMin.x, n->Color.x), std::min(colorMin.y, n->Color.y), std::min(colorMin.z, n->Color.z));
+					colorMax = XMFLOAT3(std::max(colorMax.x, n->Color.x), std::max(colorMax.y, n->Color.y), std::max(colorMax.z, n->Color.z));
+				}
+				if (!guide)
+				{
+					resolved[p] = input[p];
+					continue;
+				}
+
+				// Last frame's resolved image, if this surface was visible
+				ReprojectionTaps taps;
+				if (hasHistory && IsHit(*guide) && Reprojection::FindHistoryTaps(
+					XMFLOAT2((x + 0.5f) / width, (y + 0.5f) / height),
+					guide->Motion,
+					ReprojectionSurface{ guide->Depth, guide->Normal, guide->InstanceID },
+					guide->PreviousDepth,
+					historySurfaces.data(),
+					width,
+					height,
+					taps))
+				{
+					XMFLOAT3 color(0, 0, 0);
+					for (unsigned int t = 0; t < taps.Count; t++)
+					{
+						const XMFLOAT3& c = history[taps.Indices[t]].Color;
+						color.x += c.x * taps.Weights[t];
+						color.y += c.y * taps.Weights[t];
+						color.z += c.z * taps.Weights[t];
+					}
+
+					resolved[p] = *guide;
+					resolved[p].Color = XMFLOAT3(
+						std::min(std::max(color.x, colorMin.x), colorMax.x),
+						std::min(std::max(color.y, colorMin.y), colorMax.y),
+						std::min(std::max(color.z, colorMin.z), colorMax.z));
+					continue;
+				}
+
+				// Otherwise interpolate along the smoother direction
+				float horizontal = left && right ? PairDifference(*left, *right) : FLT_MAX;
+				float vertical = up && down ? PairDifference(*up, *down) : FLT_MAX;
+				const DenoiserPixel* a = horizontal <= vertical ? left : up;
+				const DenoiserPixel* b = horizontal <= vertical ? right : down;
+				resolved[p] = *guide;
+				if (a && b && std::min(horizontal, vertical) < UPSCALER_PAIR_DEPTH_THRESHOLD)
+				{
+					resolved[p] = *a;
+					resolved[p].Color = XMFLOAT3(
+						(a->Color.x + b->Color.x) * 0.5f,
+						(a->Color.y + b->Color.y) * 0.5f,
+						(a->Color.z + b->Color.z) * 0.5f);
+				}
+			}
+		}
+	}, 4);
+
+	// This frame becomes next frame's history
+	history = resolved;
+	for (size_t p = 0; p < resolved.size(); p++)
+	{
+		historySurfaces[p].Depth = resolved[p].Depth;
+		historySurfaces[p].Normal = resolved[p].Normal;
+		historySurfaces[p].InstanceID = resolved[p].InstanceID;
+	}
+	hasHistory = true;
+}
+
+// --------------------------------------------------------
+// Bilinear upsampling where each tap is also weighted by
+// how well it matches the nearest input pixel's surface, so
+// colors don't bleed across depth, normal or object edges.
+// The guides themselves come from the nearest input pixel.
+// --------------------------------------------------------
+void Upscaler::SpatialUpscale(
+	const DenoiserPixel* input,
+	unsigned int inputWidth,
+	unsigned int inputHeight,
+	DenoiserPixel* output,
+	unsigned int outputWidth,
+	unsigned int outputHeight,
+	bool edgeAware)
+{
+	if (inputWidth == outputWidth && inputHeight == outputHeight)
+	{
+		std::copy(input, input + (size_t)inputWidth * inputHeight, output);
+		return;
+	}
+
+	float scaleX = (float)inputWidth / outputWidth;
+	float scaleY = (float)inputHeight / outputHeight;
+	int maxX = (int)inputWidth - 1;
+	int maxY = (int)inputHeight - 1;
+
+	JobSystem::GetInstance().ParallelFor(outputHeight, [&](unsigned int rowStart, unsigned int rowEnd)
+	{
+		for (unsigned int y = rowStart; y < rowEnd; y++)
+		{
+			float py = (y + 0.5f) * scaleY - 0.5f;
+			int y0 = (int)floorf(py);
+			float fy = py - y0;
+			int nearestY = std::min(std::max((int)floorf(py + 0.5f), 0), maxY);
+
+			for (unsigned int x = 0; x < outputWidth; x++)
+			{
+				float px = (x + 0.5f) * scaleX - 0.5f;
+				int x0 = (int)floorf(px);
+				float fx = px - x0;
+				int nearestX = std::min(std::max((int)floorf(px + 0.5f), 0), maxX);
+
+				const DenoiserPixel& reference = input[(size_t)nearestY * inputWidth + nearestX];
+				XMFLOAT3 color(0, 0, 0);
+				float weightSum = 0.0f;
+				for (int t = 0; t < 4; t++)
+				{
+					int tx = std::min(std::max(x0 + (t & 1), 0), maxX);
+					int ty = std::min(std::max(y0 + (t >> 1), 0), maxY);
+					const DenoiserPixel& tap = input[(size_t)ty * inputWidth + tx];
+
+					float w = ((t & 1) ? fx : 1.0f - fx) * ((t >> 1) ? fy : 1.0f - fy);
+					if (edgeAware)
+						w *= GuideWeight(tap, reference);
+
+					color.x += tap.Color.x * w;
+					color.y += tap.Color.y * w;
+					color.z += tap.Color.z * w;
+					weightSum += w;
+				}
+
+				DenoiserPixel& result = output[(size_t)y * outputWidth + x];
+				result = reference;
+				if (weightSum > 0.0001f)
+					result.Color = XMFLOAT3(color.x / weightSum, color.y / weightSum, color.z / weightSum);
+			}
+		}
+	}, 4);
+}
+
+// --------------------------------------------------------
+// Peak signal to noise ratio over RGB, in dB
+// --------------------------------------------------------
+double Upscaler::ComputePSNR(const unsigned char* image, const unsigned char* reference, unsigned int width, unsigned int height)
+{
+	double squaredError = 0.0;
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			double d = (double)image[i * 4 + c] - reference[i * 4 + c];
+			squaredError += d * d;
+		}
+	}
+
+	double mse = squaredError / (count * 3.0);
+	if (mse <= 0.0)
+		return 100.0;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+// --------------------------------------------------------
+// Mean structural similarity of the luma, over 8x8 windows
+// spaced 4 pixels apart
+// --------------------------------------------------------
+double Upscaler::ComputeSSIM(const unsigned char* image, const unsigned char* reference, unsigned int width, unsigned int height)
+{
+	const unsigned int window = 8;
+	const unsigned int step = 4;
+	const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+	const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+	auto luma = [](const unsigned char* pixel) { return 0.299 * pixel[0] + 0.587 * pixel[1] + 0.114 * pixel[2]; };
+
+	double total = 0.0;
+	unsigned int windows = 0;
+	for (unsigned int wy = 0; wy + window <= height; wy += step)
+	{
+		for (unsigned int wx = 0; wx + window <= width; wx += step)
+		{
+			double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+			for (unsigned int y = wy; y < wy + window; y++)
+			{
+				for (unsigned int x = wx; x < wx + window; x++)
+				{
+					size_t i = ((size_t)y * width + x) * 4;
+					double a = luma(image + i);
+					double b = luma(reference + i);
+					sumA += a;
+					sumB += b;
+					sumAA += a * a;
+					sumBB += b * b;
+					sumAB += a * b;
+				}
+			}
+
+			double n = window * window;
+			double meanA = sumA / n;
+			double meanB = sumB / n;
+			double varA = sumAA / n - meanA * meanA;
+			double varB = sumBB / n - meanB * meanB;
+			double covariance = sumAB / n - meanA * meanB;
+			total += ((2 * meanA * meanB + c1) * (2 * covariance + c2)) /
+				((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2));
+			windows++;
+		}
+	}
+
+	return windows ? total / windows : 1.0;
+}
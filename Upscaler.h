@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "Denoiser.h"
+
+// Lowest supported render scale (per axis)
+#define UPSCALER_MIN_RENDER_SCALE 0.5f
+
+struct UpscalerSettings
+{
+	float	RenderScale = 1.0f;		// Fraction of the output resolution to trace, per axis
+	bool	Checkerboard = false;	// Trace only half the pixels each frame
+	bool	EdgeAware = true;		// Use depth and normal guides (false = plain bilinear)
+};
+
+// --------------------------------------------------------
+// Reconstructs full resolution frames from cheaper ones:
+//  - Checkerboard: each frame traces alternating pixels
+//    and fills the rest from last frame (through the motion
+//    vectors, clamped to the traced neighbours) or, where
+//    that's disoccluded, along whichever neighbour pair
+//    crosses the smaller depth change
+//  - Render scale: traces a smaller grid and upsamples it
+//    with bilinear weights that stop at depth, normal and
+//    instance edges of the nearest traced pixel
+//
+// Works on DenoiserPixels so the result can still be
+// denoised, and reports image quality as PSNR and SSIM.
+// --------------------------------------------------------
+class Upscaler
+{
+public:
+	Upscaler();
+
+	// Size of the grid to trace for a given output size and scale
+	static void GetRenderSize(unsigned int outputWidth, unsigned int outputHeight, float renderScale, unsigned int& renderWidth, unsigned int& renderHeight);
+
+	// Is this pixel traced on this frame when checkerboarding?
+	// Must match the test in Raytracing.hlsl
+	static bool IsTraced(unsigned int x, unsigned int y, unsigned int frameIndex) { return ((x + y + frameIndex) & 1) == 0; }
+
+	// Rebuilds a full output frame from a traced (render size) frame
+	void Upscale(
+		const DenoiserPixel* input,
+		unsigned int inputWidth,
+		unsigned int inputHeight,
+		DenoiserPixel* output,
+		unsigned int outputWidth,
+		unsigned int outputHeight,
+		const UpscalerSettings& settings,
+		unsigned int frameIndex);
+
+	// Forget checkerboard history
+	void Reset();
+
+	// Quality of an RGBA8 image (tightly packed) against a reference
+	static double ComputePSNR(const unsigned char* image, const unsigned char* reference, unsigned int width, unsigned int height);
+	static double ComputeSSIM(const unsigned char* image, const unsigned char* reference, unsigned int width, unsigned int height);
+
+private:
+	unsigned int historyWidth;
+	unsigned int historyHeight;
+	bool hasHistory;
+	std::vector<DenoiserPixel> resolved;		// This frame's checkerboard result
+	std::vector<DenoiserPixel> history;			// Last frame's
+	std::vector<ReprojectionSurface> historySurfaces;
+
+	void ResolveCheckerboard(const DenoiserPixel* input, unsigned int width, unsigned int height, unsigned int frameIndex);
+	void SpatialUpscale(
+		const DenoiserPixel* input,
+		unsigned int inputWidth,
+		unsigned int inputHeight,
+		DenoiserPixel* output,
+		unsigned int outputWidth,
+		unsigned int outputHeight,
+		bool edgeAware);
+};